@@ -3,7 +3,21 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#include "filesys/journal.h"
+#endif
+
+/* Number of buckets in a latency histogram.  Bucket 0 counts
+   transfers under 1 us, bucket I those under 2**I us, and the
+   last one everything slower. */
+#define LAT_BUCKETS 18
 
 /* A block device. */
 struct block
@@ -19,8 +33,34 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+    unsigned long long expire_cnt;      /* Taken past their deadlines. */
+    unsigned long long seq_cnt;         /* Transfers starting at head. */
+    unsigned long long rand_cnt;        /* Other transfers. */
+    unsigned long long read_lat[LAT_BUCKETS];  /* Latency histograms, */
+    unsigned long long write_lat[LAT_BUCKETS]; /* see record_latency(). */
+    uint64_t depth_area;                /* Sum of depth times cycles. */
+    uint64_t depth_since;               /* Cycle depth last changed. */
+    uint64_t first_cycle;               /* Cycle of the first request. */
+    unsigned depth;                     /* Requests queued or running. */
+
+    /* Request queue. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct list queue;                  /* Requests not yet started. */
+    bool busy;                          /* Is a thread carrying them out? */
+    block_sector_t head;                /* Sector after the last transfer. */
   };
 
+/* Most sectors a merged transfer covers. */
+#define MERGE_MAX 256
+
+/* How long a request may wait, in timer ticks, before it goes
+   ahead of the sweep: not long for reads, which someone is
+   usually waiting for, and much longer for writes, which are
+   mostly writeback. */
+#define READ_EXPIRE (TIMER_FREQ / 20)
+#define WRITE_EXPIRE (TIMER_FREQ * 2)
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -113,6 +153,339 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR lie within
+   BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector,
+               block_sector_t cnt)
+{
+  ASSERT (cnt > 0);
+  check_sector (block, sector);
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%"PRDSNu
+           ", size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
+/* Request queue.
+
+   Requests wait in BLOCK's queue until the device is free.
+   There is no I/O thread: the thread that finds the device idle
+   when it submits carries out queued requests, its own and those
+   submitted meanwhile, until the queue is empty, starting each
+   one as soon as the previous one is done.  Each request carries
+   its submitter's priority and a deadline.  The request whose
+   deadline passed first goes next; if none has, only those of
+   the highest priority queued are considered, in C-LOOK order,
+   sweeping upward from the last sector transferred and then
+   jumping back to the lowest.  Either way, queued requests that
+   continue a transfer, both on disk and in memory, are merged
+   into it.  Completion functions run in the thread
+   doing the transfers, with no locks held by the block layer,
+   but possibly locks of that thread's own, so they must not
+   block. */
+
+/* Removes from BLOCK's queue the request to carry out next,
+   along with those merged into it, and puts them in BATCH.
+   Stores the extent of the whole transfer into *SECTOR and *CNT.
+   BLOCK's queue_lock must be held, and the queue not empty. */
+static struct block_request *
+take_batch (struct block *block, struct list *batch,
+            block_sector_t *sector, block_sector_t *cnt)
+{
+  struct block_request *first = NULL, *lowest = NULL, *expired = NULL;
+  int64_t now = timer_ticks ();
+  int top = PRI_MIN;
+  struct list_elem *e;
+  bool merged;
+
+  ASSERT (!list_empty (&block->queue));
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->deadline <= now
+          && (expired == NULL || r->deadline < expired->deadline))
+        expired = r;
+      if (r->priority > top)
+        top = r->priority;
+    }
+
+  if (expired != NULL)
+    {
+      first = expired;
+      block->expire_cnt++;
+    }
+  else
+    {
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                elem);
+          if (r->priority != top)
+            continue;
+          if (lowest == NULL || r->sector < lowest->sector)
+            lowest = r;
+          if (r->sector >= block->head
+              && (first == NULL || r->sector < first->sector))
+            first = r;
+        }
+      if (first == NULL)
+        first = lowest;
+    }
+
+  list_remove (&first->elem);
+  list_push_back (batch, &first->elem);
+  *sector = first->sector;
+  *cnt = first->cnt;
+
+  do
+    {
+      uint8_t *end = (uint8_t *) first->buffer + *cnt * BLOCK_SECTOR_SIZE;
+
+      merged = false;
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request, elem);
+          if (r->write == first->write && r->sector == *sector + *cnt
+              && r->buffer == end && *cnt + r->cnt <= MERGE_MAX)
+            {
+              list_remove (&r->elem);
+              list_push_back (batch, &r->elem);
+              *cnt += r->cnt;
+              block->merge_cnt++;
+              merged = true;
+              break;
+            }
+        }
+    }
+  while (merged);
+  return first;
+}
+
+/* Records in BLOCK's histograms a transfer that took CYCLES. */
+static void
+record_latency (struct block *block, bool write, uint64_t cycles)
+{
+  uint64_t us = timer_cycles_to_us (cycles);
+  int b = 0;
+
+  while (us != 0 && b < LAT_BUCKETS - 1)
+    {
+      us >>= 1;
+      b++;
+    }
+  if (write)
+    block->write_lat[b]++;
+  else
+    block->read_lat[b]++;
+}
+
+/* Adds to BLOCK's depth integral the time at the current depth
+   and then changes the depth by DELTA.  BLOCK's queue_lock must
+   be held. */
+static void
+change_depth (struct block *block, int delta)
+{
+  uint64_t now = timer_cycles ();
+
+  if (block->first_cycle == 0)
+    block->first_cycle = now;
+  else
+    block->depth_area += block->depth * (now - block->depth_since);
+  block->depth_since = now;
+  block->depth += delta;
+}
+
+/* Moves the CNT sectors starting at SECTOR between BLOCK and
+   BUFFER with the driver's operations. */
+static void
+transfer (struct block *block, block_sector_t sector, void *buffer,
+          block_sector_t cnt, bool write)
+{
+  uint64_t start;
+  block_sector_t i;
+
+  if (sector == block->head)
+    block->seq_cnt++;
+  else
+    block->rand_cnt++;
+
+  start = timer_cycles ();
+
+  if (write && block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, buffer, cnt);
+  else if (write)
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i,
+                         (const uint8_t *) buffer + i * BLOCK_SECTOR_SIZE);
+  else if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, buffer, cnt);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i,
+                        (uint8_t *) buffer + i * BLOCK_SECTOR_SIZE);
+  record_latency (block, write, timer_cycles () - start);
+
+  if (write)
+    block->write_cnt += cnt;
+  else
+    block->read_cnt += cnt;
+}
+
+/* Carries out the requests in BLOCK's queue until it is empty,
+   unless another thread is doing so already.  BLOCK's queue_lock
+   must be held; it is released. */
+static void
+drive (struct block *block)
+{
+  if (block->busy)
+    {
+      lock_release (&block->queue_lock);
+      return;
+    }
+
+  block->busy = true;
+  while (!list_empty (&block->queue))
+    {
+      struct list batch;
+      struct block_request *first;
+      block_sector_t sector, cnt;
+      int done_cnt;
+
+      list_init (&batch);
+      first = take_batch (block, &batch, &sector, &cnt);
+      lock_release (&block->queue_lock);
+
+      transfer (block, sector, first->buffer, cnt, first->write);
+      block->head = sector + cnt;
+      done_cnt = 0;
+      while (!list_empty (&batch))
+        {
+          struct block_request *done = list_entry (list_pop_front (&batch),
+                                                   struct block_request, elem);
+          done->done (done);
+          done_cnt++;
+        }
+
+      lock_acquire (&block->queue_lock);
+      change_depth (block, -done_cnt);
+    }
+  block->busy = false;
+  lock_release (&block->queue_lock);
+}
+
+/* Checks request R for BLOCK, gives it the running thread's
+   priority and a deadline, and adds it to the queue.  BLOCK's
+   queue_lock must be held. */
+static void
+enqueue (struct block *block, struct block_request *r)
+{
+  check_sectors (block, r->sector, r->cnt);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+  ASSERT (r->done != NULL);
+  ASSERT (!is_vmalloc_vaddr (r->buffer));
+
+  r->priority = thread_get_priority ();
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  list_push_back (&block->queue, &r->elem);
+  change_depth (block, 1);
+}
+
+/* Queues request R on BLOCK.  R->done is called, possibly before
+   this function returns, once the transfer is complete; until
+   then R and its buffer must stay valid.  The buffer may not be
+   from vmalloc(). */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  lock_acquire (&block->queue_lock);
+  enqueue (block, r);
+  drive (block);
+}
+
+/* Queues the CNT requests in REQS on BLOCK, like block_submit(),
+   but all before any of them starts, so that they can be sorted
+   and merged with each other. */
+void
+block_submit_batch (struct block *block, struct block_request *reqs[],
+                    size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&block->queue_lock);
+  for (i = 0; i < cnt; i++)
+    enqueue (block, reqs[i]);
+  drive (block);
+}
+
+/* Completion function of a synchronous request. */
+static void
+wake_submitter (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Carries out a transfer through the queue and waits for it. */
+static void
+transfer_wait (struct block *block, block_sector_t sector, void *buffer,
+               block_sector_t cnt, bool write)
+{
+  struct block_request r;
+  struct semaphore done;
+  enum cpu_time old_time;
+
+  sema_init (&done, 0);
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = write;
+  r.done = wake_submitter;
+  r.aux = &done;
+  old_time = thread_set_block_time (CPU_IO_WAIT);
+  block_submit (block, &r);
+  sema_down (&done);
+  thread_set_block_time (old_time);
+}
+
+/* Carries out a transfer and waits for it.  Drivers hand buffers
+   to DMA by physical address, so one that vmalloc() mapped goes
+   through a bounce page, a page at a time. */
+static void
+transfer_sync (struct block *block, block_sector_t sector, void *buffer,
+               block_sector_t cnt, bool write)
+{
+  const block_sector_t page_sectors = PGSIZE / BLOCK_SECTOR_SIZE;
+  uint8_t *p = buffer;
+  void *bounce;
+
+  if (!is_vmalloc_vaddr (buffer))
+    {
+      transfer_wait (block, sector, buffer, cnt, write);
+      return;
+    }
+
+  bounce = palloc_get_page (PAL_ASSERT);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < page_sectors ? cnt : page_sectors;
+      size_t size = n * BLOCK_SECTOR_SIZE;
+
+      if (write)
+        memcpy (bounce, p, size);
+      transfer_wait (block, sector, bounce, n, write);
+      if (!write)
+        memcpy (p, bounce, size);
+      sector += n;
+      p += size;
+      cnt -= n;
+    }
+  palloc_free_page (bounce);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +493,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer_sync (block, sector, buffer, 1, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +504,32 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer_sync (block, sector, (void *) buffer, 1, true);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Devices that support it do this in a single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     void *buffer, block_sector_t cnt)
+{
+  transfer_sync (block, sector, buffer, cnt, false);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Devices that support it do this in a single request.  Returns
+   after the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, block_sector_t cnt)
+{
+  transfer_sync (block, sector, (void *) buffer, cnt, true);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +553,25 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Prints the nonempty buckets of latency histogram LAT, labeled
+   with NAME. */
+static void
+print_latency (const char *name, const unsigned long long lat[LAT_BUCKETS])
+{
+  int b;
+
+  printf ("  %s latency:", name);
+  for (b = 0; b < LAT_BUCKETS; b++)
+    if (lat[b] != 0)
+      {
+        if (b == LAT_BUCKETS - 1)
+          printf (" >=%lluus:%llu", 1ULL << (b - 1), lat[b]);
+        else
+          printf (" <%lluus:%llu", 1ULL << b, lat[b]);
+      }
+  printf ("\n");
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -171,11 +583,27 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          uint64_t span = block->depth_since - block->first_cycle;
+
+          printf ("%s (%s): %llu reads, %llu writes, %llu merges, "
+                  "%llu expired\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->read_cnt, block->write_cnt, block->merge_cnt,
+                  block->expire_cnt);
+          printf ("  %llu bytes, %llu sequential, %llu random transfers, "
+                  "queue depth %llu.%02llu\n",
+                  (block->read_cnt + block->write_cnt) * BLOCK_SECTOR_SIZE,
+                  block->seq_cnt, block->rand_cnt,
+                  span != 0 ? block->depth_area / span : 0,
+                  span != 0 ? block->depth_area * 100 / span % 100 : 0);
+          print_latency ("read", block->read_lat);
+          print_latency ("write", block->write_lat);
         }
     }
+#ifdef FILESYS
+  cache_print_stats ();
+  journal_print_stats ();
+#endif
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -200,6 +628,21 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->merge_cnt = 0;
+  block->expire_cnt = 0;
+  block->seq_cnt = 0;
+  block->rand_cnt = 0;
+  memset (block->read_lat, 0, sizeof block->read_lat);
+  memset (block->write_lat, 0, sizeof block->write_lat);
+  block->depth_area = 0;
+  block->depth_since = 0;
+  block->first_cycle = 0;
+  block->depth = 0;
+  lock_init (&block->queue_lock);
+  lock_set_name (&block->queue_lock, "block queue");
+  list_init (&block->queue);
+  block->busy = false;
+  block->head = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -1,6 +1,8 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
 
@@ -53,9 +55,33 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *,
+                          block_sector_t cnt);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           block_sector_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* An asynchronous transfer, handed to block_submit(). */
+struct block_request
+  {
+    block_sector_t sector;      /* First sector. */
+    block_sector_t cnt;         /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /* Write BUFFER, or read into it? */
+    void (*done) (struct block_request *);  /* Called once finished. */
+    void *aux;                  /* For DONE's use. */
+
+    /* Private to the block layer. */
+    int priority;               /* Submitter's priority. */
+    int64_t deadline;           /* Tick to start it by. */
+    struct list_elem elem;
+  };
+
+void block_submit (struct block *, struct block_request *);
+void block_submit_batch (struct block *, struct block_request *[],
+                         size_t cnt);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,6 +91,13 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors in one request.  May be
+       null, in which case read or write is called per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           block_sector_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            block_sector_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
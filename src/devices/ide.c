@@ -3,12 +3,18 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/trace.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "threads/worker.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,8 +40,10 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
+#define CTL_NIEN 0x02           /* Disable interrupts. */
 #define CTL_SRST 0x04           /* Software Reset. */
 
 /* Device Register bits. */
@@ -43,12 +51,59 @@
 #define DEV_LBA 0x40            /* Linear based addressing. */
 #define DEV_DEV 0x10            /* Select device: 0=master, 1=slave. */
 
+/* Bus master IDE registers, relative to a channel's bm_base.
+   See [IDE-BM]. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_START 0x01           /* Start transfer. */
+#define BM_TO_MEMORY 0x08       /* Transfer direction: 1=disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_ERROR 0x02           /* Transfer failed (write 1 to clear). */
+#define BM_INTR 0x04            /* Interrupt raised (write 1 to clear). */
+
+/* A Physical Region Descriptor: one piece of memory, within a
+   single 64 kB region, that a DMA transfer reads or writes. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Bytes; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT, or 0. */
+  };
+#define PRD_EOT 0x8000          /* Last descriptor of the table. */
+
 /* Commands.
    Many more are defined but this is the small subset that we
    use. */
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* The same, with 48-bit sector numbers, for sectors at
+   LBA28_LIMIT and past it. */
+#define CMD_READ_SECTOR_EXT 0x24        /* READ SECTOR EXT. */
+#define CMD_WRITE_SECTOR_EXT 0x34       /* WRITE SECTOR EXT. */
+#define CMD_READ_MULTIPLE_EXT 0x29      /* READ MULTIPLE EXT. */
+#define CMD_WRITE_MULTIPLE_EXT 0x39     /* WRITE MULTIPLE EXT. */
+#define CMD_READ_DMA_EXT 0x25           /* READ DMA EXT. */
+#define CMD_WRITE_DMA_EXT 0x35          /* WRITE DMA EXT. */
+#define LBA28_LIMIT (1UL << 28)
+
+/* Most sectors we transfer per DRQ block with READ/WRITE
+   MULTIPLE.  A page is 8 sectors. */
+#define MULTIPLE_MAX 8
+
+/* Most sectors one command can transfer: a sector count of 0
+   means 256. */
+#define NSECT_MAX 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +112,12 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per DRQ block under READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    bool dma;                   /* Transfer with READ/WRITE DMA? */
+    bool lba48;                 /* Has the 48-bit commands? */
+    block_sector_t capacity;    /* Size in sectors, once identified. */
+    char info[128];             /* Model and serial, for block_register(). */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +133,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master registers, or 0 if none. */
+    struct prd *prdt;           /* PRD table, one page, if bm_base. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -80,12 +144,20 @@ struct channel
 static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
+static struct block_operations ide_dma_operations;
+
+static uint16_t find_bus_master (void);
 
-static void reset_channel (struct channel *);
+static work_func probe_channel_work;
+static void probe_channel (struct channel *);
+static bool reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void register_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, const uint16_t *id);
+static bool issue_set_multiple (struct ata_disk *, int n);
+static bool select_sector (struct ata_disk *, block_sector_t, int cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -97,16 +169,24 @@ static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
-/* Initialize the disk subsystem and detect disks. */
+/* Upped by a worker once it has probed its channel. */
+static struct semaphore probe_done;
+
+/* Initialize the disk subsystem and detect disks.  Each channel
+   is probed at the same time as the others, since resetting one
+   mostly means waiting for it, but the disks are registered in
+   order afterward so that they are always found the same way. */
 void
 ide_init (void) 
 {
+  static struct work probe_work[CHANNEL_CNT];
   size_t chan_no;
+  int dev_no;
+  uint16_t bm_base = find_bus_master ();
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
-      int dev_no;
 
       /* Initialize channel. */
       snprintf (c->name, sizeof c->name, "ide%zu", chan_no);
@@ -126,6 +206,10 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = NULL;
+      if (c->bm_base != 0)
+        c->prdt = palloc_get_page (PAL_ASSERT);
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,37 +220,118 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
+    }
 
-      /* Reset hardware. */
-      reset_channel (c);
+  /* Probe the first channel ourselves and the rest on workers. */
+  sema_init (&probe_done, 0);
+  for (chan_no = 1; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      work_init (&probe_work[chan_no], probe_channel_work,
+                 &channels[chan_no]);
+      work_queue (WQ_NORMAL, &probe_work[chan_no]);
+    }
+  probe_channel (&channels[0]);
+  for (chan_no = 1; chan_no < CHANNEL_CNT; chan_no++)
+    sema_down (&probe_done);
 
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    for (dev_no = 0; dev_no < 2; dev_no++)
+      if (channels[chan_no].devices[dev_no].is_ata)
+        register_ata_device (&channels[chan_no].devices[dev_no]);
+}
 
-      /* Read hard disk identity information. */
-      for (dev_no = 0; dev_no < 2; dev_no++)
-        if (c->devices[dev_no].is_ata)
-          identify_ata_device (&c->devices[dev_no]);
-    }
+/* Returns true if no transfer is in progress on any channel.
+   Interrupts must be off. */
+bool
+ide_idle (void)
+{
+  size_t chan_no;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    if (channels[chan_no].lock.holder != NULL)
+      return false;
+  return true;
+}
+
+/* Sets up the controller and disks again after hibernate()
+   resumes, since a fresh boot leaves bus mastering and READ/WRITE
+   MULTIPLE off. */
+void
+ide_reinit (void)
+{
+  size_t chan_no;
+  int dev_no;
+
+  find_bus_master ();
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    for (dev_no = 0; dev_no < 2; dev_no++)
+      {
+        struct ata_disk *d = &channels[chan_no].devices[dev_no];
+
+        if (d->is_ata && d->multiple > 0)
+          {
+            lock_acquire (&d->channel->lock);
+            if (!issue_set_multiple (d, d->multiple))
+              PANIC ("%s: READ/WRITE MULTIPLE refused on resume", d->name);
+            lock_release (&d->channel->lock);
+          }
+      }
 }
 
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
 
-/* Resets an ATA channel and waits for any devices present on it
-   to finish the reset. */
+/* Work function that probes channel C_. */
+static void
+probe_channel_work (void *c_) 
+{
+  probe_channel (c_);
+  sema_up (&probe_done);
+}
+
+/* Resets channel C and reads the identity of the ATA disks on
+   it, leaving them to be registered by the caller. */
 static void
+probe_channel (struct channel *c) 
+{
+  int dev_no;
+
+  /* Reset hardware. */
+  if (!reset_channel (c))
+    return;
+
+  /* Distinguish ATA hard disks from other devices. */
+  if (check_device_type (&c->devices[0]))
+    check_device_type (&c->devices[1]);
+
+  /* Read hard disk identity information. */
+  for (dev_no = 0; dev_no < 2; dev_no++)
+    if (c->devices[dev_no].is_ata)
+      identify_ata_device (&c->devices[dev_no]);
+}
+
+/* Resets an ATA channel and waits for any devices present on it
+   to finish the reset.  Returns false, without a reset, if no
+   device is present. */
+static bool
 reset_channel (struct channel *c) 
 {
   bool present[2];
   int dev_no;
 
+  /* Nothing drives the bus of an empty channel, so its status
+     register reads as all ones. */
+  if (inb (reg_status (c)) == 0xff)
+    return false;
+
   /* The ATA reset sequence depends on which devices are present,
      so we start by detecting device presence. */
   for (dev_no = 0; dev_no < 2; dev_no++)
@@ -187,6 +352,8 @@ reset_channel (struct channel *c)
       present[dev_no] = (inb (reg_nsect (c)) == 0x55
                          && inb (reg_lbal (c)) == 0xaa);
     }
+  if (!present[0] && !present[1])
+    return false;
 
   /* Issue soft reset sequence, which selects device 0 as a side effect.
      Also enable interrupts. */
@@ -219,6 +386,7 @@ reset_channel (struct channel *c)
         }
       wait_while_busy (&c->devices[1]);
     }
+  return true;
 }
 
 /* Checks whether device D is an ATA disk and sets D's is_ata
@@ -254,8 +422,7 @@ check_device_type (struct ata_disk *d)
 }
 
 /* Sends an IDENTIFY DEVICE command to disk D and reads the
-   response.  Registers the disk with the block device
-   layer. */
+   response.  Clears D's is_ata member if D is not to be used. */
 static void
 identify_ata_device (struct ata_disk *d) 
 {
@@ -263,8 +430,6 @@ identify_ata_device (struct ata_disk *d)
   char id[BLOCK_SECTOR_SIZE];
   block_sector_t capacity;
   char *model, *serial;
-  char extra_info[128];
-  struct block *block;
 
   ASSERT (d->is_ata);
 
@@ -281,12 +446,17 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
-  /* Calculate capacity.
+  /* Calculate capacity, from the 48-bit count if the disk has the
+     48-bit commands, clamped to what a block_sector_t holds.
      Read model name and serial number. */
+  d->lba48 = (((const uint16_t *) id)[83] & 0x400) != 0;
   capacity = *(uint32_t *) &id[60 * 2];
+  if (d->lba48)
+    capacity = (*(uint32_t *) &id[102 * 2] != 0 ? UINT32_MAX
+                : *(uint32_t *) &id[100 * 2]);
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
-  snprintf (extra_info, sizeof extra_info,
+  snprintf (d->info, sizeof d->info,
             "model \"%s\", serial \"%s\"", model, serial);
 
   /* Disable access to IDE disks over 1 GB, which are likely
@@ -297,15 +467,29 @@ identify_ata_device (struct ata_disk *d)
   if (capacity >= 1024 * 1024 * 1024 / BLOCK_SECTOR_SIZE)
     {
       printf ("%s: ignoring ", d->name);
-      print_human_readable_size (capacity * 512);
+      print_human_readable_size ((uint64_t) capacity * 512);
       printf ("disk for safety\n");
       d->is_ata = false;
       return;
     }
 
-  /* Register. */
-  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
-                          &ide_operations, d);
+  set_multiple_mode (d, (const uint16_t *) id);
+
+  /* Use DMA if both the disk and the controller can. */
+  d->dma = c->bm_base != 0 && (((const uint16_t *) id)[49] & 0x100) != 0;
+  if (d->dma)
+    strlcat (d->info, ", DMA", sizeof d->info);
+  d->capacity = capacity;
+}
+
+/* Registers identified disk D with the block device layer. */
+static void
+register_ata_device (struct ata_disk *d) 
+{
+  struct block *block;
+
+  block = block_register (d->name, BLOCK_RAW, d->info, d->capacity,
+                          d->dma ? &ide_dma_operations : &ide_operations, d);
   partition_scan (block);
 }
 
@@ -337,68 +521,354 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Each group of up to NSECT_MAX sectors is one command: READ
+   MULTIPLE if the disk supports it, which interrupts once per
+   block of D->multiple sectors, or else READ SECTOR, which
+   interrupts once per sector.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, void *buffer,
+                   block_sector_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *p = buffer;
+  int per_intr = d->multiple > 0 ? d->multiple : 1;
+
+  trace (TRACE_IDE_READ, sec_no, cnt);
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      int nsect = cnt < NSECT_MAX ? cnt : NSECT_MAX;
+      int left;
+
+      if (select_sector (d, sec_no, nsect))
+        issue_pio_command (c, d->multiple > 0
+                              ? CMD_READ_MULTIPLE_EXT : CMD_READ_SECTOR_EXT);
+      else
+        issue_pio_command (c, d->multiple > 0
+                              ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+      for (left = nsect; left > 0; )
+        {
+          int i, n = left < per_intr ? left : per_intr;
+
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + (nsect - left));
+          for (i = 0; i < n; i++, p += BLOCK_SECTOR_SIZE)
+            input_sector (c, p);
+          left -= n;
+        }
+      sec_no += nsect;
+      cnt -= nsect;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes, with
+   WRITE MULTIPLE or WRITE SECTOR as in ide_read_multiple().
+   Returns after the disk has acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, const void *buffer,
+                    block_sector_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *p = buffer;
+  int per_intr = d->multiple > 0 ? d->multiple : 1;
+
+  trace (TRACE_IDE_WRITE, sec_no, cnt);
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      int nsect = cnt < NSECT_MAX ? cnt : NSECT_MAX;
+      int left;
+
+      if (select_sector (d, sec_no, nsect))
+        issue_pio_command (c, d->multiple > 0
+                              ? CMD_WRITE_MULTIPLE_EXT : CMD_WRITE_SECTOR_EXT);
+      else
+        issue_pio_command (c, d->multiple > 0
+                              ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+      for (left = nsect; left > 0; )
+        {
+          int i, n = left < per_intr ? left : per_intr;
+
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + (nsect - left));
+          for (i = 0; i < n; i++, p += BLOCK_SECTOR_SIZE)
+            output_sector (c, p);
+          sema_down (&c->completion_wait);
+          left -= n;
+        }
+      sec_no += nsect;
+      cnt -= nsect;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, buffer, 1);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, buffer, 1);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
-
-/* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+
+/* Moves the CNT sectors starting at SEC_NO between disk D and
+   BUFFER by bus master DMA, from the disk if TO_MEMORY is true
+   or to it otherwise.  Each group of up to NSECT_MAX sectors is
+   one READ or WRITE DMA command, which interrupts only once it
+   is done; the CPU is free meanwhile.  BUFFER must be a kernel
+   address and have an even address. */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, void *buffer,
+              block_sector_t cnt, bool to_memory)
 {
   struct channel *c = d->channel;
+  uint8_t *p = buffer;
+  uint8_t dir = to_memory ? BM_TO_MEMORY : 0;
+
+  ASSERT (is_kernel_vaddr (buffer));
+  ASSERT (((uintptr_t) buffer & 1) == 0);
+
+  trace (to_memory ? TRACE_IDE_READ : TRACE_IDE_WRITE, sec_no, cnt);
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      int nsect = cnt < NSECT_MAX ? cnt : NSECT_MAX;
+      size_t left = (size_t) nsect * BLOCK_SECTOR_SIZE;
+      struct prd *prd = c->prdt;
+      uint8_t status;
 
-  ASSERT (sec_no < (1UL << 28));
+      /* Describe the buffer, cut at 64 kB boundaries. */
+      while (left > 0)
+        {
+          uintptr_t paddr = vtop (p);
+          size_t size = 0x10000 - (paddr & 0xffff);
+          if (size > left)
+            size = left;
+          prd->addr = paddr;
+          prd->size = size & 0xffff;
+          prd->flags = 0;
+          prd++;
+          p += size;
+          left -= size;
+        }
+      prd[-1].flags = PRD_EOT;
+
+      outl (reg_bm_prdt (c), vtop (c->prdt));
+      outb (reg_bm_command (c), dir);
+      outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_ERROR | BM_INTR);
+
+      if (select_sector (d, sec_no, nsect))
+        issue_pio_command (c, to_memory
+                              ? CMD_READ_DMA_EXT : CMD_WRITE_DMA_EXT);
+      else
+        issue_pio_command (c, to_memory ? CMD_READ_DMA : CMD_WRITE_DMA);
+      outb (reg_bm_command (c), dir | BM_START);
+      sema_down (&c->completion_wait);
+      outb (reg_bm_command (c), dir);
+
+      status = inb (reg_bm_status (c));
+      outb (reg_bm_status (c), status | BM_ERROR | BM_INTR);
+      if ((status & BM_ERROR) != 0 || (inb (reg_alt_status (c)) & STA_ERR))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, to_memory ? "read" : "write", sec_no);
+
+      sec_no += nsect;
+      cnt -= nsect;
+    }
+  lock_release (&c->lock);
+}
+
+/* Reads as ide_read_multiple() does, by DMA unless BUFFER is
+   misaligned. */
+static void
+ide_dma_read_multiple (void *d_, block_sector_t sec_no, void *buffer,
+                       block_sector_t cnt)
+{
+  if (((uintptr_t) buffer & 1) == 0)
+    dma_transfer (d_, sec_no, buffer, cnt, true);
+  else
+    ide_read_multiple (d_, sec_no, buffer, cnt);
+}
+
+/* Writes as ide_write_multiple() does, by DMA unless BUFFER is
+   misaligned. */
+static void
+ide_dma_write_multiple (void *d_, block_sector_t sec_no, const void *buffer,
+                        block_sector_t cnt)
+{
+  if (((uintptr_t) buffer & 1) == 0)
+    dma_transfer (d_, sec_no, (void *) buffer, cnt, false);
+  else
+    ide_write_multiple (d_, sec_no, buffer, cnt);
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, by DMA. */
+static void
+ide_dma_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_dma_read_multiple (d_, sec_no, buffer, 1);
+}
+
+/* Writes sector SEC_NO to disk D from BUFFER, by DMA. */
+static void
+ide_dma_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_dma_write_multiple (d_, sec_no, buffer, 1);
+}
+
+static struct block_operations ide_dma_operations =
+  {
+    ide_dma_read,
+    ide_dma_write,
+    ide_dma_read_multiple,
+    ide_dma_write_multiple
+  };
+
+/* Looks on PCI bus 0 for an IDE controller that drives the two
+   legacy channels and can be a bus master.  Enables bus
+   mastering on it and returns the base of its bus master
+   registers, or returns 0 if there is no such controller. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, fn;
+
+  for (dev = 0; dev < 32; dev++)
+    for (fn = 0; fn < 8; fn++)
+      {
+        uint32_t id = pci_read_config (dev, fn, 0x00);
+        uint32_t class = pci_read_config (dev, fn, 0x08);
+        uint32_t bar4;
+
+        if ((id & 0xffff) == 0xffff)
+          {
+            if (fn == 0)
+              break;
+            continue;
+          }
+
+        /* Class 1, subclass 1 is IDE.  Programming interface bit 7
+           means bus master capable, bits 0 and 2 native mode. */
+        if ((class >> 16) != 0x0101 || (class & 0x8000) == 0
+            || (class & 0x0500) != 0)
+          {
+            /* Only multi-function devices have functions past 0. */
+            if (fn == 0 && (pci_read_config (dev, 0, 0x0c) & 0x800000) == 0)
+              break;
+            continue;
+          }
+        bar4 = pci_read_config (dev, fn, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space access and bus mastering. */
+        pci_write_config (dev, fn, 0x04,
+                          pci_read_config (dev, fn, 0x04) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Enables READ/WRITE MULTIPLE on disk D, whose IDENTIFY DEVICE
+   data is ID, with the largest block size up to MULTIPLE_MAX that
+   the disk supports.  Leaves D->multiple 0 if the disk lacks the
+   feature or rejects the command. */
+static void
+set_multiple_mode (struct ata_disk *d, const uint16_t *id)
+{
+  int max = id[47] & 0xff;
+  int n;
+
+  d->multiple = 0;
+  if (max == 0)
+    return;
+  for (n = 1; n * 2 <= max && n * 2 <= MULTIPLE_MAX; n *= 2)
+    continue;
+
+  if (issue_set_multiple (d, n))
+    d->multiple = n;
+}
+
+/* Issues SET MULTIPLE MODE for blocks of N sectors to disk D.
+   Returns true if the disk accepted it. */
+static bool
+issue_set_multiple (struct ata_disk *d, int n)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), n);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  return !(inb (reg_alt_status (c)) & STA_ERR);
+}
+
+/* Selects device D, waiting for it to become ready, and then
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.)  Returns true if the
+   transfer reaches past LBA28_LIMIT, in which case the registers
+   were each written twice, high byte first, for a 48-bit
+   command, which the caller must then issue. */
+static bool
+select_sector (struct ata_disk *d, block_sector_t sec_no, int cnt)
+{
+  struct channel *c = d->channel;
+
+  ASSERT (cnt > 0 && cnt <= NSECT_MAX);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  if ((uint64_t) sec_no + cnt > LBA28_LIMIT)
+    {
+      ASSERT (d->lba48);
+      outb (reg_nsect (c), cnt >> 8);
+      outb (reg_lbal (c), sec_no >> 24);
+      outb (reg_lbam (c), 0);
+      outb (reg_lbah (c), 0);
+      outb (reg_nsect (c), cnt);
+      outb (reg_lbal (c), sec_no);
+      outb (reg_lbam (c), sec_no >> 8);
+      outb (reg_lbah (c), sec_no >> 16);
+      outb (reg_device (c),
+            DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0));
+      return true;
+    }
+  outb (reg_nsect (c), cnt == NSECT_MAX ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
   outb (reg_device (c),
         DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+  return false;
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
@@ -430,6 +900,102 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Polled transfers.
+
+   hibernate() saves and restores memory with interrupts off, the
+   second time before ide_init() and while overwriting this
+   driver's data, so these use only the legacy ports and keep no
+   state. */
+
+/* Command block ports of each legacy channel, in the form the
+   reg_*() macros take. */
+struct legacy_channel
+  {
+    uint16_t reg_base;
+  };
+static const struct legacy_channel legacy_channels[CHANNEL_CNT] =
+  {{0x1f0}, {0x170}};
+
+/* Waits for channel C to clear BSY and returns its status, with
+   STA_ERR set if it never does.  The status may be stale for
+   400 ns after a command, so the first reads don't count. */
+static uint8_t
+poll_status (const struct legacy_channel *c)
+{
+  unsigned i;
+
+  for (i = 0; i < 4; i++)
+    inb (reg_alt_status (c));
+  for (i = 0; i < 100000000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (!(status & STA_BSY))
+        return status;
+    }
+  return STA_ERR;
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk DISK_NO, 0
+   for hda through 3 for hdd, into BUFFER, or writes them from
+   BUFFER if WRITE, by PIO with the disk's interrupt disabled.
+   Interrupts must be off.  Returns false if there is no such
+   disk or a transfer fails. */
+bool
+ide_poll_transfer (int disk_no, block_sector_t sec_no, void *buffer,
+                   block_sector_t cnt, bool write)
+{
+  const struct legacy_channel *c = &legacy_channels[disk_no / 2];
+  uint8_t dev = DEV_MBS | DEV_LBA | (disk_no % 2 == 1 ? DEV_DEV : 0);
+  uint8_t *p = buffer;
+  bool ok = true;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (disk_no >= 0 && disk_no < CHANNEL_CNT * 2);
+
+  if (inb (reg_status (c)) == 0xff)
+    return false;
+  outb (reg_ctl (c), CTL_NIEN);
+  while (ok && cnt > 0)
+    {
+      int nsect = cnt < NSECT_MAX ? cnt : NSECT_MAX;
+      int i;
+
+      outb (reg_device (c), dev);
+      if ((uint64_t) sec_no + nsect > LBA28_LIMIT
+          || (poll_status (c) & STA_ERR))
+        {
+          ok = false;
+          break;
+        }
+      outb (reg_nsect (c), nsect == NSECT_MAX ? 0 : nsect);
+      outb (reg_lbal (c), sec_no);
+      outb (reg_lbam (c), sec_no >> 8);
+      outb (reg_lbah (c), sec_no >> 16);
+      outb (reg_device (c), dev | (sec_no >> 24));
+      outb (reg_command (c),
+            write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY);
+      for (i = 0; i < nsect; i++, p += BLOCK_SECTOR_SIZE)
+        {
+          if ((poll_status (c) & (STA_ERR | STA_DRQ)) != STA_DRQ)
+            {
+              ok = false;
+              break;
+            }
+          if (write)
+            outsw (reg_data (c), p, BLOCK_SECTOR_SIZE / 2);
+          else
+            insw (reg_data (c), p, BLOCK_SECTOR_SIZE / 2);
+        }
+      if (ok && write && (poll_status (c) & STA_ERR))
+        ok = false;
+      sec_no += nsect;
+      cnt -= nsect;
+    }
+  inb (reg_status (c));
+  outb (reg_ctl (c), 0);
+  return ok;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -1,6 +1,13 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+#include "devices/block.h"
+
 void ide_init (void);
+bool ide_idle (void);
+void ide_reinit (void);
+bool ide_poll_transfer (int disk_no, block_sector_t, void *,
+                        block_sector_t cnt, bool write);
 
 #endif /* devices/ide.h */
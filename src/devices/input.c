@@ -1,43 +1,131 @@
 #include "devices/input.h"
 #include <debug.h>
-#include "devices/intq.h"
 #include "devices/serial.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
-/* Stores keys from the keyboard and serial port. */
-static struct intq buffer;
+/* Keys from the keyboard and serial port go through a simple
+   line discipline before they can be read.  The interrupt side
+   edits the line being typed, which backspace shortens, and hands
+   it over whole to readers once a newline ends it, the buffer
+   fills up, or Ctrl+D is typed.  A Ctrl+D on an empty line reads
+   as end of file.  Readers thus get whole lines in one step,
+   instead of waiting for each byte. */
+
+/* Buffer size, in bytes. */
+#define INPUT_BUFSIZE 256
+
+/* A circular buffer.  Bytes from TAIL to LINE_END are complete
+   lines, ready to be read; bytes from LINE_END to HEAD are the
+   line still being typed.  Indexes only grow and are taken
+   modulo INPUT_BUFSIZE. */
+static uint8_t buf[INPUT_BUFSIZE];
+static unsigned head, line_end, tail;
+
+/* Ctrl+Ds typed on an empty line, not yet read. */
+static unsigned eof_cnt;
+
+/* Only one thread reads at a time; it waits as READER. */
+static struct lock read_lock;
+static struct thread *reader;
 
 /* Initializes the input buffer. */
 void
-input_init (void) 
+input_init (void)
+{
+  lock_init (&read_lock);
+}
+
+/* Hands the line being typed over to readers, waking one that is
+   waiting. */
+static void
+end_line (void)
 {
-  intq_init (&buffer);
+  line_end = head;
+  if (reader != NULL)
+    {
+      thread_unblock (reader);
+      reader = NULL;
+    }
 }
 
 /* Adds a key to the input buffer.
    Interrupts must be off and the buffer must not be full. */
 void
-input_putc (uint8_t key) 
+input_putc (uint8_t key)
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT (!intq_full (&buffer));
+  ASSERT (!input_full ());
 
-  intq_putc (&buffer, key);
+  if (key == '\r')
+    key = '\n';
+  if (key == '\b' || key == 0x7f)
+    {
+      /* Erase the last key typed, if the line has one. */
+      if (head != line_end)
+        head--;
+    }
+  else if (key == 0x04)
+    {
+      /* Ctrl+D. */
+      if (head == line_end)
+        eof_cnt++;
+      end_line ();
+    }
+  else
+    {
+      buf[head++ % INPUT_BUFSIZE] = key;
+      if (key == '\n' || input_full ())
+        end_line ();
+    }
   serial_notify ();
 }
 
-/* Retrieves a key from the input buffer.
-   If the buffer is empty, waits for a key to be pressed. */
-uint8_t
-input_getc (void) 
+/* Reads up to SIZE bytes of complete lines from the input buffer
+   into BUFFER.  If there are none, waits for a line first if
+   BLOCK, or returns 0 if not.  Returns the number of bytes read,
+   which is 0 also at end of file. */
+size_t
+input_read (void *buffer_, size_t size, bool block)
 {
+  uint8_t *buffer = buffer_;
   enum intr_level old_level;
-  uint8_t key;
+  size_t n = 0;
 
+  lock_acquire (&read_lock);
   old_level = intr_disable ();
-  key = intq_getc (&buffer);
+  while (block && tail == line_end && eof_cnt == 0)
+    {
+      enum cpu_time old_time = thread_set_block_time (CPU_IO_WAIT);
+
+      reader = thread_current ();
+      thread_block ();
+      thread_set_block_time (old_time);
+    }
+  if (tail != line_end)
+    {
+      while (n < size && tail != line_end)
+        buffer[n++] = buf[tail++ % INPUT_BUFSIZE];
+    }
+  else if (eof_cnt > 0)
+    eof_cnt--;
   serial_notify ();
   intr_set_level (old_level);
-  
+  lock_release (&read_lock);
+
+  return n;
+}
+
+/* Retrieves a key from the input buffer.
+   If there is no complete line in it, waits for one. */
+uint8_t
+input_getc (void)
+{
+  uint8_t key;
+
+  while (input_read (&key, 1, true) == 0)
+    continue;
   return key;
 }
 
@@ -45,8 +133,8 @@ input_getc (void)
    false otherwise.
    Interrupts must be off. */
 bool
-input_full (void) 
+input_full (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  return intq_full (&buffer);
+  return head - tail == INPUT_BUFSIZE;
 }
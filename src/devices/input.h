@@ -2,10 +2,12 @@
 #define DEVICES_INPUT_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 void input_init (void);
 void input_putc (uint8_t);
+size_t input_read (void *, size_t size, bool block);
 uint8_t input_getc (void);
 bool input_full (void);
 
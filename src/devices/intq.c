@@ -1,114 +1,211 @@
 #include "devices/intq.h"
 #include <debug.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/spinlock.h"
 #include "threads/thread.h"
 
-static int next (int pos);
-static void wait (struct intq *q, struct thread **waiter);
-static void signal (struct intq *q, struct thread **waiter);
+/* Orders all earlier loads and stores before all later ones.
+   x86 keeps stores in order, and loads in order, so the ring
+   itself needs only compiler barriers; but a waiter's "store
+   myself, then check the queue" against the other side's "store
+   a position, then check for a waiter" needs a full fence on a
+   multiprocessor.  A locked add is one that every IA-32 CPU
+   has. */
+#define full_fence() asm volatile ("lock addl $0, (%%esp)" : : : "memory")
+#define compiler_fence() asm volatile ("" : : : "memory")
 
-/* Initializes interrupt queue Q. */
+static void wait (struct intq *, struct thread *volatile *waiter);
+static void signal (struct thread *volatile *waiter);
+
+/* Initializes interrupt queue Q to hold up to CNT records of
+   SIZE bytes each in BUF, which must have room for CNT * SIZE
+   bytes.  CNT must be a power of 2. */
 void
-intq_init (struct intq *q) 
+intq_init (struct intq *q, void *buf, size_t cnt, size_t size) 
 {
-  lock_init (&q->lock);
-  q->not_full = q->not_empty = NULL;
+  ASSERT (cnt > 0 && (cnt & (cnt - 1)) == 0);
+  ASSERT (size > 0);
+
+  q->buf = buf;
+  q->cnt = cnt;
+  q->size = size;
   q->head = q->tail = 0;
+  q->not_full = q->not_empty = NULL;
+}
+
+/* Returns the number of records in Q.  Exact for the consumer;
+   for anyone else, at most a snapshot. */
+size_t
+intq_count (const struct intq *q) 
+{
+  return q->head - q->tail;
+}
+
+/* Returns the number of records Q has room for.  Exact for the
+   producer; for anyone else, at most a snapshot. */
+size_t
+intq_space (const struct intq *q) 
+{
+  return q->cnt - intq_count (q);
 }
 
 /* Returns true if Q is empty, false otherwise. */
 bool
 intq_empty (const struct intq *q) 
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  return q->head == q->tail;
+  return intq_count (q) == 0;
 }
 
 /* Returns true if Q is full, false otherwise. */
 bool
 intq_full (const struct intq *q) 
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  return next (q->head) == q->tail;
+  return intq_count (q) == q->cnt;
+}
+
+/* Copies CNT records from Q, starting at record position POS,
+   into BUFFER, in at most two pieces. */
+static void
+copy_out (const struct intq *q, size_t pos, uint8_t *buffer, size_t cnt) 
+{
+  size_t ofs = pos & (q->cnt - 1);
+  size_t first = cnt < q->cnt - ofs ? cnt : q->cnt - ofs;
+
+  memcpy (buffer, q->buf + ofs * q->size, first * q->size);
+  memcpy (buffer + first * q->size, q->buf, (cnt - first) * q->size);
+}
+
+/* Copies CNT records from BUFFER into Q, starting at record
+   position POS, in at most two pieces. */
+static void
+copy_in (struct intq *q, size_t pos, const uint8_t *buffer, size_t cnt) 
+{
+  size_t ofs = pos & (q->cnt - 1);
+  size_t first = cnt < q->cnt - ofs ? cnt : q->cnt - ofs;
+
+  memcpy (q->buf + ofs * q->size, buffer, first * q->size);
+  memcpy (q->buf, buffer + first * q->size, (cnt - first) * q->size);
+}
+
+/* Removes up to CNT records from Q into BUFFER, without waiting,
+   and returns the number removed.  For the consumer only. */
+size_t
+intq_get (struct intq *q, void *buffer, size_t cnt) 
+{
+  size_t tail = q->tail;
+  size_t avail = q->head - tail;
+
+  /* Read HEAD before the records it covers. */
+  compiler_fence ();
+  if (cnt > avail)
+    cnt = avail;
+  if (cnt == 0)
+    return 0;
+  copy_out (q, tail, buffer, cnt);
+
+  /* Finish reading the records before handing their slots back. */
+  compiler_fence ();
+  q->tail = tail + cnt;
+  full_fence ();
+  signal (&q->not_full);
+  return cnt;
+}
+
+/* Adds up to CNT records from BUFFER to Q, without waiting, and
+   returns the number added.  For the producer only. */
+size_t
+intq_put (struct intq *q, const void *buffer, size_t cnt) 
+{
+  size_t head = q->head;
+  size_t room = q->cnt - (head - q->tail);
+
+  /* Read TAIL before overwriting the slots it frees. */
+  compiler_fence ();
+  if (cnt > room)
+    cnt = room;
+  if (cnt == 0)
+    return 0;
+  copy_in (q, head, buffer, cnt);
+
+  /* Finish writing the records before publishing them. */
+  compiler_fence ();
+  q->head = head + cnt;
+  full_fence ();
+  signal (&q->not_empty);
+  return cnt;
 }
 
-/* Removes a byte from Q and returns it.
-   If Q is empty, sleeps until a byte is added.
-   When called from an interrupt handler, Q must not be empty. */
+/* Removes a byte from Q, whose records must be bytes, and returns
+   it.  If Q is empty, sleeps until a byte is added, so it may
+   not be called from an interrupt handler. */
 uint8_t
 intq_getc (struct intq *q) 
 {
   uint8_t byte;
-  
-  ASSERT (intr_get_level () == INTR_OFF);
-  while (intq_empty (q)) 
-    {
-      ASSERT (!intr_context ());
-      lock_acquire (&q->lock);
-      wait (q, &q->not_empty);
-      lock_release (&q->lock);
-    }
-  
-  byte = q->buf[q->tail];
-  q->tail = next (q->tail);
-  signal (q, &q->not_full);
+
+  ASSERT (q->size == 1);
+  while (intq_get (q, &byte, 1) == 0)
+    wait (q, &q->not_empty);
   return byte;
 }
 
-/* Adds BYTE to the end of Q.
-   If Q is full, sleeps until a byte is removed.
-   When called from an interrupt handler, Q must not be full. */
+/* Adds BYTE to the end of Q, whose records must be bytes.  If Q
+   is full, sleeps until a byte is removed, so it may not be
+   called from an interrupt handler. */
 void
 intq_putc (struct intq *q, uint8_t byte) 
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  while (intq_full (q))
-    {
-      ASSERT (!intr_context ());
-      lock_acquire (&q->lock);
-      wait (q, &q->not_full);
-      lock_release (&q->lock);
-    }
-
-  q->buf[q->head] = byte;
-  q->head = next (q->head);
-  signal (q, &q->not_empty);
-}
-
-/* Returns the position after POS within an intq. */
-static int
-next (int pos) 
-{
-  return (pos + 1) % INTQ_BUFSIZE;
+  ASSERT (q->size == 1);
+  while (intq_put (q, &byte, 1) == 0)
+    wait (q, &q->not_full);
 }
 
 /* WAITER must be the address of Q's not_empty or not_full
-   member.  Waits until the given condition is true. */
+   member.  Sleeps until the other side signals it, unless the
+   condition became true meanwhile. */
 static void
-wait (struct intq *q UNUSED, struct thread **waiter) 
+wait (struct intq *q, struct thread *volatile *waiter) 
 {
+  enum intr_level old_level;
+
   ASSERT (!intr_context ());
-  ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT ((waiter == &q->not_empty && intq_empty (q))
-          || (waiter == &q->not_full && intq_full (q)));
+  ASSERT (*waiter == NULL);
 
+  old_level = intr_disable ();
   *waiter = thread_current ();
-  thread_block ();
+  full_fence ();
+  if (waiter == &q->not_empty ? intq_empty (q) : intq_full (q))
+    {
+      enum cpu_time old_time = thread_set_block_time (CPU_IO_WAIT);
+      thread_block ();
+      thread_set_block_time (old_time);
+    }
+  else
+    {
+      /* No need to sleep after all.  With interrupts off, and
+         only this processor scheduling threads, the other side
+         cannot be in signal() now, so WAITER is still us. */
+      *waiter = NULL;
+    }
+  intr_set_level (old_level);
 }
 
-/* WAITER must be the address of Q's not_empty or not_full
+/* WAITER must be the address of a queue's not_empty or not_full
    member, and the associated condition must be true.  If a
    thread is waiting for the condition, wakes it up and resets
    the waiting thread. */
 static void
-signal (struct intq *q UNUSED, struct thread **waiter) 
+signal (struct thread *volatile *waiter) 
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT ((waiter == &q->not_empty && !intq_empty (q))
-          || (waiter == &q->not_full && !intq_full (q)));
-
   if (*waiter != NULL) 
     {
-      thread_unblock (*waiter);
-      *waiter = NULL;
+      struct thread *t;
+      enum intr_level old_level = intr_disable ();
+
+      t = (struct thread *) spin_xchg ((volatile uint32_t *) waiter, 0);
+      if (t != NULL)
+        thread_unblock (t);
+      intr_set_level (old_level);
     }
 }
@@ -1,42 +1,53 @@
 #ifndef DEVICES_INTQ_H
 #define DEVICES_INTQ_H
 
-#include "threads/interrupt.h"
-#include "threads/synch.h"
-
-/* An "interrupt queue", a circular buffer shared between
-   kernel threads and external interrupt handlers.
-
-   Interrupt queue functions can be called from kernel threads or
-   from external interrupt handlers.  Except for intq_init(),
-   interrupts must be off in either case.
-
-   The interrupt queue has the structure of a "monitor".  Locks
-   and condition variables from threads/synch.h cannot be used in
-   this case, as they normally would, because they can only
-   protect kernel threads from one another, not from interrupt
-   handlers. */
-
-/* Queue buffer size, in bytes. */
-#define INTQ_BUFSIZE 64
-
-/* A circular queue of bytes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* An "interrupt queue", a circular buffer that hands bytes or
+   fixed-size records from one producer to one consumer, for
+   example from an external interrupt handler to a kernel thread
+   or back.
+
+   The producer alone advances HEAD and the consumer alone
+   advances TAIL, so neither needs to turn interrupts off or take
+   a lock to move data, and each side can move a whole burst of
+   records in one call.  Only one thread may produce and one may
+   consume at a time; callers with several serialize them
+   themselves.
+
+   Locks and condition variables from threads/synch.h cannot be
+   used to wait here, because they can only protect kernel
+   threads from one another, not from interrupt handlers.
+   Instead, intq_getc() and intq_putc() sleep on the queue
+   itself, which the other side wakes. */
+
+/* A circular queue of records. */
 struct intq
   {
+    uint8_t *buf;               /* CNT records of SIZE bytes. */
+    size_t cnt;                 /* Capacity, a power of 2. */
+    size_t size;                /* Bytes per record. */
+
+    /* Positions only grow and are taken modulo CNT. */
+    volatile size_t head;       /* New records are written here. */
+    volatile size_t tail;       /* Old records are read here. */
+
     /* Waiting threads. */
-    struct lock lock;           /* Only one thread may wait at once. */
-    struct thread *not_full;    /* Thread waiting for not-full condition. */
-    struct thread *not_empty;   /* Thread waiting for not-empty condition. */
-
-    /* Queue. */
-    uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
-    int head;                   /* New data is written here. */
-    int tail;                   /* Old data is read here. */
+    struct thread *volatile not_full;   /* Waiting for room. */
+    struct thread *volatile not_empty;  /* Waiting for data. */
   };
 
-void intq_init (struct intq *);
+void intq_init (struct intq *, void *buf, size_t cnt, size_t size);
+size_t intq_count (const struct intq *);
+size_t intq_space (const struct intq *);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
+
+size_t intq_get (struct intq *, void *, size_t cnt);
+size_t intq_put (struct intq *, const void *, size_t cnt);
+
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
 
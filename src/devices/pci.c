@@ -0,0 +1,24 @@
+#include "devices/pci.h"
+#include "threads/io.h"
+
+/* PCI configuration space access, configuration mechanism #1. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Reads the 32-bit register at byte offset REG of the
+   configuration space of PCI function FN of device DEV on bus
+   0. */
+uint32_t
+pci_read_config (int dev, int fn, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | (reg & 0xfc));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to a register read by pci_read_config(). */
+void
+pci_write_config (int dev, int fn, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | (reg & 0xfc));
+  outl (PCI_CONFIG_DATA, value);
+}
@@ -0,0 +1,10 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdint.h>
+
+/* Configuration space access for functions on PCI bus 0. */
+uint32_t pci_read_config (int dev, int fn, int reg);
+void pci_write_config (int dev, int fn, int reg, uint32_t value);
+
+#endif /* devices/pci.h */
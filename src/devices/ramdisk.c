@@ -0,0 +1,81 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device held in memory, for data that needn't survive
+   a reboot, such as swap or scratch space.  Its pages come from
+   the kernel pool at boot and need not be contiguous.  It is
+   registered as a raw device named "ram0", to be given a role
+   with -filesys, -scratch or -swap. */
+
+/* Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    uint8_t **pages;            /* Backing pages. */
+  };
+
+/* Returns where SECTOR of the RAM disk RD_ is held. */
+static uint8_t *
+sector_data (void *rd_, block_sector_t sector)
+{
+  struct ramdisk *rd = rd_;
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+static void
+ramdisk_read (void *rd, block_sector_t sector, void *buffer)
+{
+  memcpy (buffer, sector_data (rd, sector), BLOCK_SECTOR_SIZE);
+}
+
+static void
+ramdisk_write (void *rd, block_sector_t sector, const void *buffer)
+{
+  memcpy (sector_data (rd, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static const struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+  };
+
+/* Creates a zeroed RAM disk of KB kilobytes, rounded up to whole
+   pages, and registers it, unless KB is 0. */
+void
+ramdisk_init (size_t kb)
+{
+  struct ramdisk *rd;
+  size_t page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  size_t i;
+
+  if (page_cnt == 0)
+    return;
+
+  rd = malloc (sizeof *rd);
+  if (rd != NULL)
+    rd->pages = malloc (page_cnt * sizeof *rd->pages);
+  if (rd == NULL || rd->pages == NULL)
+    PANIC ("couldn't allocate RAM disk");
+  for (i = 0; i < page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("RAM disk of %zu kB doesn't fit in kernel memory", kb);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk",
+                  page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, rd);
+}
@@ -37,6 +37,14 @@
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable the FIFOs. */
+#define FCR_CLEAR 0x06          /* Empty both FIFOs. */
+#define FCR_TRIGGER_SHIFT 6     /* Receive trigger level, 2 bits. */
+
+/* Interrupt Identification Register bits. */
+#define IIR_FIFO 0xc0           /* FIFOs enabled and working. */
+
 /* Line Control Register bits. */
 #define LCR_N81 0x03            /* No parity, 8 data bits, 1 stop bit. */
 #define LCR_DLAB 0x80           /* Divisor Latch Access Bit (DLAB). */
@@ -51,12 +59,30 @@
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
+/* Data to be transmitted, a ring of TXQ_SIZE bytes.  Bursts of
+   output up to that size are queued without waiting, and the
+   interrupt handler takes out a FIFO's worth at a time.  A
+   thread that finds the ring full sleeps until the interrupt
+   handler has drained half of it. */
+#define TXQ_SIZE 2048
+static uint8_t txq_buf[TXQ_SIZE];
 static struct intq txq;
+static struct thread *tx_waiter;
+
+/* Bytes the transmit FIFO accepts once THR is empty, or 1 if the
+   UART has no working FIFO. */
+#define TX_FIFO_DEPTH 16
+static int tx_burst = 1;
+
+/* Bytes the receive FIFO holds before it interrupts: 1, 4, 8 or
+   14.  It also interrupts when input stops short of that. */
+static int rx_trigger = 1;
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
+static uint8_t txq_getc (void);
 static void write_ier (void);
+static void enable_fifos (void);
 static intr_handler_func serial_interrupt;
 
 /* Initializes the serial port device for polling mode.
@@ -71,10 +97,22 @@ init_poll (void)
   outb (FCR_REG, 0);                    /* Disable FIFO. */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
+  intq_init (&txq, txq_buf, TXQ_SIZE, 1);
   mode = POLL;
 } 
 
+/* Sets the receive FIFO trigger level to BYTES, which must be 1,
+   4, 8 or 14.  Returns false if it is not.  Takes effect at
+   serial_init_queue(). */
+bool
+serial_set_rx_trigger (int bytes)
+{
+  if (bytes != 1 && bytes != 4 && bytes != 8 && bytes != 14)
+    return false;
+  rx_trigger = bytes;
+  return true;
+}
+
 /* Initializes the serial port device for queued interrupt-driven
    I/O.  With interrupt-driven I/O we don't waste CPU time
    waiting for the serial device to become ready. */
@@ -87,6 +125,7 @@ serial_init_queue (void)
     init_poll ();
   ASSERT (mode == POLL);
 
+  enable_fifos ();
   intr_register_ext (0x20 + 4, serial_interrupt, "serial");
   mode = QUEUE;
   old_level = intr_disable ();
@@ -94,37 +133,73 @@ serial_init_queue (void)
   intr_set_level (old_level);
 }
 
+/* Programs the serial port again after hibernate() resumes.
+   Interrupts must be off. */
+void
+serial_reinit (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (mode == QUEUE);
+
+  set_serial (9600);
+  outb (MCR_REG, MCR_OUT2);
+  enable_fifos ();
+  write_ier ();
+}
+
 /* Sends BYTE to the serial port. */
 void
 serial_putc (uint8_t byte) 
+{
+  serial_putbuf (&byte, 1);
+}
+
+/* Sends the N bytes in BUFFER to the serial port, queuing as
+   many at a time as the transmit queue has room for. */
+void
+serial_putbuf (const uint8_t *buffer, size_t n) 
 {
   enum intr_level old_level = intr_disable ();
 
   if (mode != QUEUE)
     {
       /* If we're not set up for interrupt-driven I/O yet,
-         use dumb polling to transmit a byte. */
+         use dumb polling to transmit the bytes. */
       if (mode == UNINIT)
         init_poll ();
-      putc_poll (byte); 
+      while (n-- > 0)
+        putc_poll (*buffer++); 
     }
   else 
-    {
-      /* Otherwise, queue a byte and update the interrupt enable
-         register. */
-      if (old_level == INTR_OFF && intq_full (&txq)) 
-        {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq)); 
-        }
-
-      intq_putc (&txq, byte); 
-      write_ier ();
-    }
+    while (n > 0)
+      {
+        size_t chunk;
+
+        if (intq_full (&txq) && old_level == INTR_ON && tx_waiter == NULL) 
+          {
+            /* Wait for the interrupt handler to make room. */
+            tx_waiter = thread_current ();
+            write_ier ();
+            while (intq_full (&txq))
+              thread_block ();
+          }
+        if (intq_full (&txq)) 
+          {
+            /* Interrupts are off, or another thread is already
+               waiting, and the transmit queue is full.  If we
+               wanted to wait for the queue to empty, we'd have to
+               reenable interrupts.  That's impolite, so we'll send
+               a character via polling instead. */
+            putc_poll (txq_getc ()); 
+          }
+
+        /* Queue as much as fits, and update the interrupt enable
+           register. */
+        chunk = intq_put (&txq, buffer, n);
+        buffer += chunk;
+        n -= chunk;
+        write_ier ();
+      }
   
   intr_set_level (old_level);
 }
@@ -136,7 +211,12 @@ serial_flush (void)
 {
   enum intr_level old_level = intr_disable ();
   while (!intq_empty (&txq))
-    putc_poll (intq_getc (&txq));
+    putc_poll (txq_getc ());
+  if (tx_waiter != NULL) 
+    {
+      thread_unblock (tx_waiter);
+      tx_waiter = NULL;
+    }
   intr_set_level (old_level);
 }
 
@@ -172,6 +252,20 @@ set_serial (int bps)
   outb (LCR_REG, LCR_N81);
 }
 
+/* Turns on the FIFOs, if the UART has them, so that each
+   transmit interrupt can hand the UART a burst of bytes instead
+   of one. */
+static void
+enable_fifos (void)
+{
+  outb (FCR_REG, (FCR_ENABLE | FCR_CLEAR
+                  | (rx_trigger == 1 ? 0 : rx_trigger / 4) << FCR_TRIGGER_SHIFT));
+  if ((inb (IIR_REG) & IIR_FIFO) == IIR_FIFO)
+    tx_burst = TX_FIFO_DEPTH;
+  else
+    outb (FCR_REG, 0);
+}
+
 /* Update interrupt enable register. */
 static void
 write_ier (void) 
@@ -205,6 +299,20 @@ putc_poll (uint8_t byte)
   outb (THR_REG, byte);
 }
 
+/* Removes and returns the oldest byte of the transmit queue,
+   which must not be empty. */
+static uint8_t
+txq_getc (void) 
+{
+  uint8_t byte;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (intq_get (&txq, &byte, 1) != 1)
+    NOT_REACHED ();
+  return byte;
+}
+
 /* Serial interrupt handler. */
 static void
 serial_interrupt (struct intr_frame *f UNUSED) 
@@ -219,9 +327,21 @@ serial_interrupt (struct intr_frame *f UNUSED)
     input_putc (inb (RBR_REG));
 
   /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
+     ready to accept a byte for transmission, transmit a byte.
+     An empty THR means an empty FIFO, which takes a whole burst. */
   while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+    {
+      uint8_t burst[TX_FIFO_DEPTH];
+      size_t n = intq_get (&txq, burst, tx_burst);
+
+      outsb (THR_REG, burst, n);
+    }
+
+  if (tx_waiter != NULL && intq_count (&txq) <= TXQ_SIZE / 2) 
+    {
+      thread_unblock (tx_waiter);
+      tx_waiter = NULL;
+    }
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
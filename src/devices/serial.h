@@ -1,10 +1,15 @@
 #ifndef DEVICES_SERIAL_H
 #define DEVICES_SERIAL_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+bool serial_set_rx_trigger (int bytes);
 void serial_init_queue (void);
+void serial_reinit (void);
 void serial_putc (uint8_t);
+void serial_putbuf (const uint8_t *, size_t);
 void serial_flush (void);
 void serial_notify (void);
 
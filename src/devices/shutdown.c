@@ -4,15 +4,31 @@
 #include "devices/kbd.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/memprof.h"
+#include "threads/palloc.h"
+#include "threads/pmc.h"
+#include "threads/profile.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
 
 /* Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -87,9 +103,7 @@ shutdown_reboot (void)
 void
 shutdown_power_off (void)
 {
-  const char s[] = "Shutdown";
-  const char *p;
-
+  trace_dump ();
 #ifdef FILESYS
   filesys_done ();
 #endif
@@ -97,6 +111,18 @@ shutdown_power_off (void)
   print_stats ();
 
   printf ("Powering off...\n");
+  shutdown_power_off_now ();
+}
+
+/* Powers down the machine at once, without finishing up the file
+   system or printing statistics, as hibernate() does once it has
+   saved the machine's state. */
+void
+shutdown_power_off_now (void)
+{
+  const char s[] = "Shutdown";
+  const char *p;
+
   serial_flush ();
 
   /* This is a special power-off sequence supported by Bochs and
@@ -126,7 +152,11 @@ static void
 print_stats (void)
 {
   timer_print_stats ();
+  intr_print_stats ();
   thread_print_stats ();
+  palloc_print_stats ();
+  kmem_print_stats ();
+  memprof_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
 #endif
@@ -134,5 +164,16 @@ print_stats (void)
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  pagedir_print_stats ();
+  process_print_stats ();
+  syscall_print_stats ();
+#endif
+#ifdef VM
+  frame_print_stats ();
+  swap_print_stats ();
+  zswap_print_stats ();
 #endif
+  lockstat_print_stats ();
+  pmc_print_stats ();
+  profile_print_stats ();
 }
@@ -1,10 +1,13 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
@@ -20,20 +23,57 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Number of hardware timer periods since OS booted.  Every
+   real_per_tick() of them make a timer tick. */
+static int64_t real_ticks;
+
+/* Tickless idle.  Before the idle thread halts, the PIT is set to
+   one long period that ends when the next timer event is due,
+   instead of interrupting every hardware period, and the next
+   interrupt of any kind restarts the periodic tick and accounts
+   for the periods skipped.  stop_periods is the number of
+   periods the long one spans, or 0 while the tick runs. */
+static int64_t stop_periods;
+static uint16_t period_count;   /* PIT cycles per hardware period. */
+static int64_t skipped_ticks;   /* Timer ticks skipped while idle. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* loops_per_tick from an earlier boot on the same host, given on
+   the kernel command line, or 0. */
+static unsigned preset_loops_per_tick;
+
+/* Time-stamp counter increments per microsecond.
+   Initialized by timer_calibrate(). */
+static uint64_t cycles_per_us;
+
+/* Nanoseconds per hardware timer period. */
+#define PERIOD_NS (1000000000 / REAL_TIMER_FREQ)
+
+/* timer_now_ns() counts TSC cycles from tsc_base, which was read
+   ns_base nanoseconds after boot.  Until then it counts hardware
+   timer periods. */
+static uint64_t tsc_base;
+static int64_t ns_base;
+
+/* Sleeps shorter than this busy-wait instead of blocking. */
+#define SLEEP_SPIN_NS 50000
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
-
-/* List of sleeping processes, that is, processes that should be 
-	 checked each tick whether it should be awake or not. */
-extern struct list sleep_list;            /* extern from threads/threads.c */
-extern struct list pri_list[PRI_MAX+1];   /* extern from threads/threads.c */
+static void fire_events (struct list *, int64_t now);
+
+/* Pending timer events, in order of firing tick, so that each
+	 tick looks only at the events that are due.  High-resolution
+	 events are kept apart, in order of firing time, and looked
+	 at every hardware period. */
+static struct list event_list = LIST_INITIALIZER (event_list);
+static struct list hr_list = LIST_INITIALIZER (hr_list);
 extern struct list rcc_list;              /* extern from threads/threads.c */
 extern int thread_priority;               /* extern from threads/threads.c */   
 
@@ -42,10 +82,61 @@ extern int thread_priority;               /* extern from threads/threads.c */
 void
 timer_init (void) 
 {
+	period_count = (PIT_HZ + REAL_TIMER_FREQ / 2) / REAL_TIMER_FREQ;
 	pit_configure_channel (0, 2, REAL_TIMER_FREQ); /* Use REAL_TIMER_FREQ for timer emulation. */
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
+/* Returns the number of hardware timer periods per timer tick. */
+static int
+real_per_tick (void)
+{
+	return (thread_mlfqs
+					? TIMER_FREQ_FAKENESS
+					: TIMER_FREQ_FAKENESS * TIMER_FREQ_REDUCE_FACTOR);
+}
+
+/* Measures cycles_per_us over one emulated tick. */
+static void
+calibrate_cycles (void)
+{
+  int64_t start = ticks;
+  uint64_t begin;
+
+  while (ticks == start)
+    barrier ();
+  begin = timer_cycles ();
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  cycles_per_us = ((timer_cycles () - begin) * REAL_TIMER_FREQ
+                   / real_per_tick () / 1000000);
+  if (cycles_per_us == 0)
+    cycles_per_us = 1;
+
+  intr_disable ();
+  ns_base = real_ticks * PERIOD_NS;
+  tsc_base = timer_cycles ();
+  intr_enable ();
+}
+
+/* Supplies LOOPS_PER_SEC, the figure timer_calibrate() printed
+   on an earlier boot, as a decimal string.  timer_calibrate()
+   then only checks it instead of measuring it again. */
+void
+timer_preset_calibration (const char *loops_per_sec)
+{
+  uint64_t lps = 0;
+  const char *p;
+
+  if (loops_per_sec == NULL)
+    return;
+  for (p = loops_per_sec; *p >= '0' && *p <= '9'; p++)
+    lps = lps * 10 + (*p - '0');
+  if (*p == '\0' && lps / TIMER_FREQ <= UINT_MAX / 2)
+    preset_loops_per_tick = lps / TIMER_FREQ;
+}
+
 /* Calibrates loops_per_tick, used to implement brief delays. */
 void
 timer_calibrate (void) 
@@ -55,6 +146,19 @@ timer_calibrate (void)
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
 
+  /* A preset value is good if it still takes less than one tick,
+     but twice as many loops take more. */
+  if (preset_loops_per_tick > (1u << 10)
+      && !too_many_loops (preset_loops_per_tick)
+      && too_many_loops (preset_loops_per_tick * 2))
+    {
+      loops_per_tick = preset_loops_per_tick;
+      printf ("%'"PRIu64" loops/s.\n",
+              (uint64_t) loops_per_tick * TIMER_FREQ);
+      calibrate_cycles ();
+      return;
+    }
+
   /* Approximate loops_per_tick as the largest power-of-two
      still less than one timer tick. */
   loops_per_tick = 1u << 10;
@@ -71,6 +175,25 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  calibrate_cycles ();
+}
+
+/* Programs the PIT again after hibernate() resumes, and rebases
+   the time-stamp counter, which started over from 0.
+   Interrupts must be off. */
+void
+timer_reinit (void)
+{
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	pit_configure_channel (0, 2, REAL_TIMER_FREQ);
+	stop_periods = 0;
+	if (tsc_base != 0)
+		{
+			ns_base = real_ticks * PERIOD_NS;
+			tsc_base = timer_cycles ();
+		}
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -91,20 +214,225 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Converts CYCLES of the time-stamp counter to microseconds.
+   Returns 0 before timer_calibrate() has run. */
+uint64_t
+timer_cycles_to_us (uint64_t cycles)
+{
+  return cycles_per_us != 0 ? cycles / cycles_per_us : 0;
+}
+
+/* Returns the number of nanoseconds since the OS booted, from the
+   time-stamp counter once timer_calibrate() has run. */
+int64_t
+timer_now_ns (void)
+{
+	enum intr_level old_level;
+	int64_t ns;
+
+	if (tsc_base != 0)
+		return ns_base + (timer_cycles () - tsc_base) * 1000 / cycles_per_us;
+
+	old_level = intr_disable ();
+	ns = real_ticks * PERIOD_NS;
+	intr_set_level (old_level);
+	return ns;
+}
+
+/* Initializes EVENT to call FUNC with AUX when it fires. */
+void
+timer_event_init (struct timer_event *event, timer_func *func, void *aux)
+{
+	ASSERT (func != NULL);
+
+	event->func = func;
+	event->aux = aux;
+	event->pending = false;
+}
+
+/* Returns true if event A fires before event B. */
+static bool
+event_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED)
+{
+	const struct timer_event *a = list_entry (a_, struct timer_event, elem);
+	const struct timer_event *b = list_entry (b_, struct timer_event, elem);
+
+	return a->when < b->when;
+}
+
+/* Schedules EVENT to fire TICKS timer ticks from now, in the
+   first tick if TICKS <= 0.  EVENT must not be pending.  May be
+   called from an interrupt handler, including an event's own
+   function to make it periodic. */
+void
+timer_event_schedule (struct timer_event *event, int64_t ticks)
+{
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (!event->pending);
+	event->when = ticks + timer_ticks ();
+	event->pending = true;
+	list_insert_ordered (&event_list, &event->elem, event_less, NULL);
+	intr_set_level (old_level);
+}
+
+/* Schedules EVENT to fire NS nanoseconds from now.  It fires at
+   the first hardware timer period that ends after that, which is
+   at most 1 / REAL_TIMER_FREQ seconds late.  EVENT must not be
+   pending.  May be called from an interrupt handler. */
+void
+timer_event_schedule_ns (struct timer_event *event, int64_t ns)
+{
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (!event->pending);
+	event->when = timer_now_ns () + ns;
+	event->pending = true;
+	list_insert_ordered (&hr_list, &event->elem, event_less, NULL);
+	intr_set_level (old_level);
+}
+
+/* Keeps EVENT from firing.  Returns true if it was pending. */
+bool
+timer_event_cancel (struct timer_event *event)
+{
+	enum intr_level old_level = intr_disable ();
+	bool pending = event->pending;
+
+	if (pending) {
+		list_remove (&event->elem);
+		event->pending = false;
+	}
+	intr_set_level (old_level);
+	return pending;
+}
+
+/* Stops the periodic tick until the next timer event is due, or
+   for as long as the PIT allows, for the idle thread to halt.
+   With the MLFQS scheduler the tick is back by the next second,
+   which does its once-per-second work.  Interrupts must be off. */
+void
+timer_stop_tick (void)
+{
+	int64_t when = INT64_MAX, periods, max;
+	uint16_t left;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (stop_periods == 0);
+
+	if (!list_empty (&event_list))
+		when = list_entry (list_front (&event_list),
+											 struct timer_event, elem)->when;
+	if (thread_mlfqs && (ticks / TIMER_FREQ + 1) * TIMER_FREQ < when)
+		when = (ticks / TIMER_FREQ + 1) * TIMER_FREQ;
+	if (when != INT64_MAX)
+		when *= real_per_tick ();
+	if (!list_empty (&hr_list)) {
+		/* The period in progress ends within PERIOD_NS. */
+		int64_t ns = list_entry (list_front (&hr_list),
+														 struct timer_event, elem)->when - timer_now_ns ();
+		int64_t hr_when = real_ticks + 1 + (ns > 0 ? ns / PERIOD_NS : 0);
+		if (hr_when < when)
+			when = hr_when;
+	}
+
+	/* WHEN is now the hardware period that must be handled: end
+	   the long period with it.  It starts with what is left of
+	   the current one. */
+	left = pit_read_count (0);
+	if (left == 0 || left > period_count)
+		return;
+	max = (UINT16_MAX - left) / period_count + 1;
+	periods = when == INT64_MAX ? max : when - real_ticks;
+	if (periods > max)
+		periods = max;
+	if (periods <= 1)
+		return;
+
+	pit_load_count (0, 2, left + (periods - 1) * period_count);
+	stop_periods = periods;
+}
+
+/* Adds N skipped hardware periods to the tick counts. */
+static void
+skip_periods (int64_t n)
+{
+	int64_t now;
+
+	real_ticks += n;
+	now = real_ticks / real_per_tick ();
+	skipped_ticks += now - ticks;
+	cpu_current ()->idle_ticks += now - ticks;
+	ticks = now;
+}
+
+/* Restarts the periodic tick, if timer_stop_tick() stopped it,
+   and accounts for the hardware periods that went by.  Called on
+   entry to every external interrupt handler; FIRED is true for
+   the timer's own. */
+void
+timer_resume (bool fired)
+{
+	int64_t done;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (stop_periods == 0)
+		return;
+
+	/* The period that completes the long one is counted by
+	   timer_interrupt(), now or, if the timer interrupt is still
+	   pending behind this one, right after. */
+	if (fired || intr_pending (0x20))
+		done = stop_periods - 1;
+	else
+		done = stop_periods - 1 - pit_read_count (0) / period_count;
+	pit_load_count (0, 2, period_count);
+	stop_periods = 0;
+	if (done > 0)
+		skip_periods (done);
+}
+
+/* Timer event function of timer_sleep(). */
+static void
+wake_up (void *t)
+{
+	thread_unblock (t);
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
-	struct thread *t;
+	struct timer_event event;
 
   ASSERT (intr_get_level () == INTR_ON);
 
+	if (ticks <= 0)
+		return;
+	timer_event_init (&event, wake_up, thread_current ());
 	intr_disable ();
-	t = thread_current ();
-	list_push_back (&sleep_list, &t->sleepelem);
-	t->awake_tick = start + ticks;
+	timer_event_schedule (&event, ticks);
+	thread_block ();
+	intr_enable ();
+}
+
+/* Sleeps for at least NS nanoseconds, blocking on a
+   high-resolution event.  Interrupts must be turned on. */
+void
+timer_sleep_ns (int64_t ns)
+{
+	struct timer_event event;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+	if (ns <= 0)
+		return;
+	timer_event_init (&event, wake_up, thread_current ());
+	intr_disable ();
+	timer_event_schedule_ns (&event, ns);
 	thread_block ();
 	intr_enable ();
 }
@@ -176,20 +504,21 @@ timer_ndelay (int64_t ns)
 void
 timer_print_stats (void) 
 {
-  printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  printf ("Timer: %"PRId64" ticks, %"PRId64" skipped while idle\n",
+          timer_ticks (), skipped_ticks);
 }
 
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
 	/* Timer tick emulation. */
-	static int64_t real_ticks = 0;
 	real_ticks++;
-	register int ticks_per_upper_tick = thread_mlfqs
-			? TIMER_FREQ_FAKENESS 
-			: TIMER_FREQ_FAKENESS * TIMER_FREQ_REDUCE_FACTOR;
-	if(real_ticks % ticks_per_upper_tick != 0){
+	if (profile_enabled)
+		profile_sample (args);
+	if (!list_empty (&hr_list))
+		fire_events (&hr_list, timer_now_ns ());
+	if(real_ticks % real_per_tick () != 0){
 		return;
 	}
 
@@ -213,7 +542,7 @@ timer_interrupt (struct intr_frame *args UNUSED)
 	if (thread_mlfqs && (now % 4 == 0)) {
 		/* For recent_cpu changed threads, update it's priority. */
 		for ( e = list_begin (&rcc_list); e != list_end (&rcc_list) ;) {
-			int i, new_priority;
+			int new_priority;
 			register int a;
 			struct thread *t = list_entry (e, struct thread, rccelem);
 
@@ -229,37 +558,48 @@ timer_interrupt (struct intr_frame *args UNUSED)
 			else if (new_priority > PRI_MAX)
 				new_priority = PRI_MAX;
 
-			/* Set priority to new value. */
-			t->priority = new_priority;
+			/* Set priority to new value, plus what is left of a boost
+				 for waking from I/O.  If it's ready, this also moves it to
+				 the ready queue of the new priority. */
+			thread_change_priority (t, thread_boosted_priority (t, new_priority));
 			t->original_priority = new_priority;
 
-			/* If it's in ready_list, reset the location to new priority. */
-			if (t->status==THREAD_READY){
-				list_remove (&t->prielem);
-				list_push_back (&pri_list[t->priority], &t->prielem);
-			}
-
 			/* Remove from recent_cpu changed list. And unmark the thread. */
 			e = list_remove (e);   /* Now `e' is set to the next element. */
 			t->rcc = false;
 
-			if (!yield)  for ( i=PRI_MAX ; i>thread_priority ; i-- )
-				if (!list_empty (&pri_list[i])){
-					yield=true;
-					intr_yield_on_return ();
-					break;
-				}
+			if (!yield && thread_ready_higher (thread_priority)) {
+				yield=true;
+				intr_yield_on_return ();
+			}
 		}
 	}
 
-	/* Wake sleeping threads. */
-	for ( e = list_begin (&sleep_list); e != list_end (&sleep_list); e = list_next (e)){
-		struct thread *t = list_entry(e, struct thread, sleepelem);
-		if ( t->awake_tick <= now ){
-			e = list_remove (e)->prev;
-			thread_unblock (t);
-		}
+	/* Fire due events, such as sleeping threads' wakeups. */
+	fire_events (&event_list, now);
+}
+
+/* Fires the events in LIST, which is in order, that are due by
+   NOW.  Sleepers' wakeups are gathered and done as one batch. */
+static void
+fire_events (struct list *list, int64_t now)
+{
+	struct list wakeups;
+
+	list_init (&wakeups);
+	while (!list_empty (list)) {
+		struct timer_event *ev =
+				list_entry (list_front (list), struct timer_event, elem);
+		if (ev->when > now)
+			break;
+		list_pop_front (list);
+		ev->pending = false;
+		if (ev->func == wake_up)
+			list_push_back (&wakeups, &((struct thread *) ev->aux)->elem);
+		else
+			ev->func (ev->aux);
 	}
+	thread_unblock_batch (&wakeups);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -315,6 +655,12 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
+  else if (tsc_base != 0 && num * 1000000000 / denom >= SLEEP_SPIN_NS)
+    {
+      /* Less than a tick, but long enough to be worth blocking
+         for on a high-resolution event. */
+      timer_sleep_ns (num * 1000000000 / denom);
+    }
   else 
     {
       /* Otherwise, use a busy-wait loop for more accurate
@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -19,21 +21,60 @@
 
 void timer_init (void);
 void timer_calibrate (void);
+void timer_reinit (void);
+void timer_preset_calibration (const char *loops_per_sec);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
 
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+timer_cycles (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+uint64_t timer_cycles_to_us (uint64_t cycles);
+int64_t timer_now_ns (void);
+
+/* Tickless idle. */
+void timer_stop_tick (void);
+void timer_resume (bool fired);
+
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
+void timer_sleep_ns (int64_t nanoseconds);
 
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* One-shot kernel timers.  FUNC is called with AUX from the
+   timer interrupt, with interrupts off, so it must not sleep. */
+typedef void timer_func (void *aux);
+
+struct timer_event
+  {
+    struct list_elem elem;      /* Element in the pending event list. */
+    int64_t when;               /* Tick at which to fire, or for a
+                                   high-resolution event, the
+                                   timer_now_ns() time. */
+    timer_func *func;           /* Called when the event fires. */
+    void *aux;                  /* Passed to FUNC. */
+    bool pending;               /* Scheduled and not yet fired? */
+  };
+
+void timer_event_init (struct timer_event *, timer_func *, void *aux);
+void timer_event_schedule (struct timer_event *, int64_t ticks);
+void timer_event_schedule_ns (struct timer_event *, int64_t ns);
+bool timer_event_cancel (struct timer_event *);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
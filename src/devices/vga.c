@@ -8,12 +8,24 @@
 #include "threads/interrupt.h"
 #include "threads/vaddr.h"
 
-/* VGA text screen support.  See [FREEVGA] for more information. */
+/* VGA text screen support.  See [FREEVGA] for more information.
+
+   Characters are written to a copy of the screen in RAM, and
+   only the rows they changed are copied to video memory, once
+   per vga_putbuf() call, before the hardware cursor is moved.
+   The screen is a window onto a ring of VRAM_ROWS rows of video
+   memory, which scrolls by moving the CRTC start address down a
+   row instead of moving every row up.  When the window reaches
+   the end of video memory, it starts over at the top and the
+   whole screen is copied there. */
 
 /* Number of columns and rows on the text display. */
 #define COL_CNT 80
 #define ROW_CNT 25
 
+/* Rows of the 32 kB of color text video memory. */
+#define VRAM_ROWS (0x8000 / (COL_CNT * 2))
+
 /* Current cursor position.  (0,0) is in the upper left corner of
    the display. */
 static size_t cx, cy;
@@ -21,14 +33,33 @@ static size_t cx, cy;
 /* Attribute value for gray text on a black background. */
 #define GRAY_ON_BLACK 0x07
 
-/* Framebuffer.  See [FREEVGA] under "VGA Text Mode Operation".
-   The character at (x,y) is fb[y][x][0].
-   The attribute at (x,y) is fb[y][x][1]. */
-static uint8_t (*fb)[COL_CNT][2];
+/* A row of characters, in the format of video memory.  See
+   [FREEVGA] under "VGA Text Mode Operation".  The character in
+   column X is row[X][0], its attribute row[X][1]. */
+typedef uint8_t row_t[COL_CNT][2];
+
+/* Video memory. */
+static row_t *vram;
+
+/* First row of VRAM on the screen. */
+static size_t origin;
+
+/* The screen, as a ring: screen row Y is shadow[(top + Y) %
+   ROW_CNT]. */
+static row_t shadow[ROW_CNT];
+static size_t top;
 
+/* Bit Y set if screen row Y changed since the last flush(). */
+static uint32_t dirty;
+#define ALL_DIRTY ((1u << ROW_CNT) - 1)
+
+static void putc_no_cursor (uint8_t, enum intr_level);
+static row_t *row (size_t y);
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
+static void flush (void);
+static void set_origin (void);
 static void move_cursor (void);
 static void find_cursor (size_t *x, size_t *y);
 
@@ -40,23 +71,47 @@ init (void)
   static bool inited;
   if (!inited)
     {
-      fb = ptov (0xb8000);
+      vram = ptov (0xb8000);
+      memcpy (shadow, vram, sizeof shadow);
+      set_origin ();
       find_cursor (&cx, &cy);
       inited = true; 
     }
 }
 
-/* Writes C to the VGA text display, interpreting control
-   characters in the conventional ways.  */
+/* Writes C to the VGA text display.  */
 void
 vga_putc (int c)
+{
+  char ch = c;
+  vga_putbuf (&ch, 1);
+}
+
+/* Writes the N characters in BUFFER to the VGA text display,
+   interpreting control characters in the conventional ways, and
+   updates the display and the hardware cursor once at the end. */
+void
+vga_putbuf (const char *buffer, size_t n)
 {
   /* Disable interrupts to lock out interrupt handlers
      that might write to the console. */
   enum intr_level old_level = intr_disable ();
 
   init ();
-  
+  while (n-- > 0)
+    putc_no_cursor (*buffer++, old_level);
+
+  flush ();
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes C to the display without moving the hardware cursor.
+   Interrupts are off; OLD_LEVEL is what they were before. */
+static void
+putc_no_cursor (uint8_t c, enum intr_level old_level)
+{
   switch (c) 
     {
     case '\n':
@@ -83,25 +138,31 @@ vga_putc (int c)
       break;
 
     case '\a':
+      /* Show what came before the beep. */
+      flush ();
+      move_cursor ();
       intr_set_level (old_level);
       speaker_beep ();
       intr_disable ();
       break;
       
     default:
-      fb[cy][cx][0] = c;
-      fb[cy][cx][1] = GRAY_ON_BLACK;
+      (*row (cy))[cx][0] = c;
+      (*row (cy))[cx][1] = GRAY_ON_BLACK;
+      dirty |= 1u << cy;
       if (++cx >= COL_CNT)
         newline ();
       break;
     }
+}
 
-  /* Update cursor position. */
-  move_cursor ();
-
-  intr_set_level (old_level);
+/* Returns screen row Y in the shadow copy. */
+static row_t *
+row (size_t y)
+{
+  return &shadow[(top + y) % ROW_CNT];
 }
-
+
 /* Clears the screen and moves the cursor to the upper left. */
 static void
 cls (void)
@@ -112,7 +173,6 @@ cls (void)
     clear_row (y);
 
   cx = cy = 0;
-  move_cursor ();
 }
 
 /* Clears row Y to spaces. */
@@ -123,9 +183,10 @@ clear_row (size_t y)
 
   for (x = 0; x < COL_CNT; x++)
     {
-      fb[y][x][0] = ' ';
-      fb[y][x][1] = GRAY_ON_BLACK;
+      (*row (y))[x][0] = ' ';
+      (*row (y))[x][1] = GRAY_ON_BLACK;
     }
+  dirty |= 1u << y;
 }
 
 /* Advances the cursor to the first column in the next line on
@@ -139,17 +200,51 @@ newline (void)
   if (cy >= ROW_CNT)
     {
       cy = ROW_CNT - 1;
-      memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
+      top = (top + 1) % ROW_CNT;
+      dirty >>= 1;
+      if (++origin + ROW_CNT > VRAM_ROWS)
+        {
+          origin = 0;
+          dirty = ALL_DIRTY;
+        }
       clear_row (ROW_CNT - 1);
     }
 }
 
+/* Copies the rows that changed to video memory and shows them. */
+static void
+flush (void)
+{
+  static size_t shown_origin;
+  size_t y;
+
+  for (y = 0; dirty != 0; y++, dirty >>= 1)
+    if (dirty & 1)
+      memcpy (&vram[origin + y], row (y), sizeof (row_t));
+  if (origin != shown_origin)
+    {
+      set_origin ();
+      shown_origin = origin;
+    }
+}
+
+/* Sets the CRTC start address to the first character of row
+   ORIGIN. */
+static void
+set_origin (void)
+{
+  /* See [FREEVGA] under "CRTC Registers". */
+  uint16_t sa = origin * COL_CNT;
+  outw (0x3d4, 0x0c | (sa & 0xff00));
+  outw (0x3d4, 0x0d | (sa << 8));
+}
+
 /* Moves the hardware cursor to (cx,cy). */
 static void
 move_cursor (void) 
 {
   /* See [FREEVGA] under "Manipulating the Text-mode Cursor". */
-  uint16_t cp = cx + COL_CNT * cy;
+  uint16_t cp = cx + COL_CNT * (origin + cy);
   outw (0x3d4, 0x0e | (cp & 0xff00));
   outw (0x3d4, 0x0f | (cp << 8));
 }
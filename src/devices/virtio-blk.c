@@ -0,0 +1,419 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Driver for virtio block devices, as QEMU provides with
+   "-drive if=virtio", through the legacy virtio PCI interface
+   [VIRTIO-0.9.5].
+
+   Each device has one split virtqueue.  A transfer is cut into
+   requests of up to REQ_SECTORS sectors, all of which are put on
+   the queue before the first completes, and the caller sleeps
+   until the interrupt handler has seen every one of them come
+   back.  Callers may come from several threads at once; the
+   queue has room for up to SLOT_MAX requests in all. */
+
+/* PCI identity of a legacy ("transitional") virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio registers, relative to the I/O base in BAR 0. */
+#define reg_host_features(D) ((D)->io_base + 0x00)   /* 32 bits. */
+#define reg_guest_features(D) ((D)->io_base + 0x04)  /* 32 bits. */
+#define reg_queue_pfn(D) ((D)->io_base + 0x08)       /* 32 bits. */
+#define reg_queue_size(D) ((D)->io_base + 0x0c)      /* 16 bits. */
+#define reg_queue_select(D) ((D)->io_base + 0x0e)    /* 16 bits. */
+#define reg_queue_notify(D) ((D)->io_base + 0x10)    /* 16 bits. */
+#define reg_status(D) ((D)->io_base + 0x12)          /* 8 bits. */
+#define reg_isr(D) ((D)->io_base + 0x13)             /* 8 bits. */
+#define reg_capacity(D) ((D)->io_base + 0x14)        /* 64 bits. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Guest has noticed the device. */
+#define STATUS_DRIVER 0x02      /* Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver gave up. */
+
+/* A descriptor of the virtqueue: one buffer of a request. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor, if F_NEXT. */
+  };
+#define VRING_DESC_F_NEXT 1     /* Request continues in NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Device writes the buffer. */
+
+/* Ring of requests made available to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the next entry goes, mod size. */
+    uint16_t ring[];            /* First descriptor of each request. */
+  };
+
+/* Ring of requests the device has carried out. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* First descriptor of the request. */
+    uint32_t len;               /* Bytes written into its buffers. */
+  };
+
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts the next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Legacy virtqueues are laid out at this alignment. */
+#define VRING_ALIGN PGSIZE
+
+/* Header of a block request. */
+struct blk_req_header
+  {
+    uint32_t type;              /* BLK_T_IN or BLK_T_OUT. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+#define BLK_T_IN 0              /* Read. */
+#define BLK_T_OUT 1             /* Write. */
+#define BLK_S_OK 0              /* Status of a successful request. */
+
+/* Most sectors one request transfers. */
+#define REQ_SECTORS 64
+
+/* Most requests outstanding on a device.  Each takes three
+   descriptors: header, data and status. */
+#define SLOT_MAX 32
+
+/* Most virtio block devices we drive. */
+#define VBLK_MAX 4
+
+/* An outstanding request. */
+struct slot
+  {
+    struct blk_req_header header;
+    uint8_t status;             /* Written by the device. */
+    bool busy;                  /* In use? */
+    struct semaphore done;      /* Up'd by the interrupt handler. */
+  };
+
+/* A virtio block device. */
+struct vblk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt vector. */
+
+    uint16_t queue_size;        /* Entries in each ring. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    volatile struct vring_avail *avail;
+    volatile struct vring_used *used;
+    uint16_t used_idx;          /* Next used entry to look at. */
+
+    struct lock lock;           /* Protects slots and the avail ring. */
+    struct semaphore free_slots;        /* Slots that aren't busy. */
+    struct slot *slots;
+    size_t slot_cnt;
+  };
+
+static struct vblk devices[VBLK_MAX];
+static size_t device_cnt;
+
+static const struct block_operations vblk_operations;
+
+static void probe (int dev, int fn);
+static bool setup_queue (struct vblk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds virtio block devices on PCI bus 0 and registers them. */
+void
+virtio_blk_init (void)
+{
+  int dev, fn;
+
+  for (dev = 0; dev < 32; dev++)
+    for (fn = 0; fn < 8; fn++)
+      {
+        uint32_t id = pci_read_config (dev, fn, 0x00);
+
+        if ((id & 0xffff) == 0xffff)
+          {
+            if (fn == 0)
+              break;
+            continue;
+          }
+        if ((id & 0xffff) == VIRTIO_VENDOR && (id >> 16) == VIRTIO_BLK_DEVICE)
+          probe (dev, fn);
+
+        /* Only multi-function devices have functions past 0. */
+        if (fn == 0 && (pci_read_config (dev, 0, 0x0c) & 0x800000) == 0)
+          break;
+      }
+}
+
+/* Sets up the virtio block device at PCI function FN of device
+   DEV and registers it. */
+static void
+probe (int dev, int fn)
+{
+  uint32_t bar0 = pci_read_config (dev, fn, 0x10);
+  int irq_line = pci_read_config (dev, fn, 0x3c) & 0xff;
+  struct vblk *d;
+  struct block *block;
+  uint64_t capacity;
+  size_t i;
+
+  if (device_cnt >= VBLK_MAX || (bar0 & 1) == 0 || irq_line > 15)
+    return;
+  d = &devices[device_cnt];
+  snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) device_cnt);
+  d->io_base = bar0 & 0xfffc;
+  d->irq = 0x20 + irq_line;
+
+  /* Enable I/O space access and bus mastering. */
+  pci_write_config (dev, fn, 0x04, pci_read_config (dev, fn, 0x04) | 0x05);
+
+  /* Reset the device and tell it we drive it, with no optional
+     features. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl (reg_host_features (d));
+  outl (reg_guest_features (d), 0);
+  if (!setup_queue (d))
+    {
+      outb (reg_status (d), STATUS_FAILED);
+      printf ("%s: can't set up virtqueue\n", d->name);
+      return;
+    }
+
+  lock_init (&d->lock);
+  d->slot_cnt = d->queue_size / 3 < SLOT_MAX ? d->queue_size / 3 : SLOT_MAX;
+  sema_init (&d->free_slots, d->slot_cnt);
+  d->slots = malloc (d->slot_cnt * sizeof *d->slots);
+  if (d->slots == NULL)
+    PANIC ("%s: can't allocate request slots", d->name);
+  for (i = 0; i < d->slot_cnt; i++)
+    {
+      d->slots[i].busy = false;
+      sema_init (&d->slots[i].done, 0);
+    }
+
+  /* Devices may share an interrupt line. */
+  for (i = 0; i < device_cnt; i++)
+    if (devices[i].irq == d->irq)
+      break;
+  if (i == device_cnt)
+    intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+  device_cnt++;
+
+  outb (reg_status (d),
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  capacity = (inl (reg_capacity (d))
+              | (uint64_t) inl (reg_capacity (d) + 4) << 32);
+  if (capacity > UINT32_MAX)
+    capacity = UINT32_MAX;
+  block = block_register (d->name, BLOCK_RAW, "virtio", capacity,
+                          &vblk_operations, d);
+  partition_scan (block);
+}
+
+/* Allocates virtqueue 0 of D in the legacy layout and gives it to
+   the device.  Returns false if the device has no such queue. */
+static bool
+setup_queue (struct vblk *d)
+{
+  size_t n, used_ofs, pages;
+  uint8_t *ring;
+
+  outw (reg_queue_select (d), 0);
+  n = inw (reg_queue_size (d));
+  if (n < 3)
+    return false;
+
+  used_ofs = ROUND_UP (n * sizeof (struct vring_desc)
+                       + sizeof (struct vring_avail)
+                       + (n + 1) * sizeof (uint16_t), VRING_ALIGN);
+  pages = DIV_ROUND_UP (used_ofs + sizeof (struct vring_used)
+                        + n * sizeof (struct vring_used_elem)
+                        + sizeof (uint16_t), PGSIZE);
+  ring = palloc_get_multiple (PAL_ZERO, pages);
+  if (ring == NULL)
+    return false;
+
+  d->queue_size = n;
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + n * sizeof (struct vring_desc));
+  d->used = (struct vring_used *) (ring + used_ofs);
+  d->used_idx = 0;
+  outl (reg_queue_pfn (d), vtop (ring) / VRING_ALIGN);
+  return true;
+}
+
+/* Puts on D's queue a request to move the CNT sectors starting at
+   SECTOR between the disk and BUFFER, and returns its slot.
+   Waits for a free slot if there is none. */
+static struct slot *
+start_request (struct vblk *d, block_sector_t sector, void *buffer,
+               block_sector_t cnt, bool write)
+{
+  struct slot *s;
+  struct vring_desc *desc;
+  size_t i;
+
+  sema_down (&d->free_slots);
+  lock_acquire (&d->lock);
+  for (i = 0; d->slots[i].busy; i++)
+    ASSERT (i + 1 < d->slot_cnt);
+  s = &d->slots[i];
+  s->busy = true;
+  s->header.type = write ? BLK_T_OUT : BLK_T_IN;
+  s->header.reserved = 0;
+  s->header.sector = sector;
+  s->status = 0xff;
+
+  desc = &d->desc[3 * i];
+  desc[0].addr = vtop (&s->header);
+  desc[0].len = sizeof s->header;
+  desc[0].flags = VRING_DESC_F_NEXT;
+  desc[0].next = 3 * i + 1;
+  desc[1].addr = vtop (buffer);
+  desc[1].len = cnt * BLOCK_SECTOR_SIZE;
+  desc[1].flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+  desc[1].next = 3 * i + 2;
+  desc[2].addr = vtop (&s->status);
+  desc[2].len = 1;
+  desc[2].flags = VRING_DESC_F_WRITE;
+  desc[2].next = 0;
+
+  /* The device must see the entry before the index that covers
+     it. */
+  d->avail->ring[d->avail->idx % d->queue_size] = 3 * i;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (reg_queue_notify (d), 0);
+  lock_release (&d->lock);
+  return s;
+}
+
+/* Waits for the request in slot S of D to complete and frees the
+   slot.  Returns true if it succeeded. */
+static bool
+finish_request (struct vblk *d, struct slot *s)
+{
+  bool ok;
+
+  sema_down (&s->done);
+  ok = s->status == BLK_S_OK;
+  lock_acquire (&d->lock);
+  s->busy = false;
+  lock_release (&d->lock);
+  sema_up (&d->free_slots);
+  return ok;
+}
+
+/* Moves the CNT sectors starting at SECTOR between device D_ and
+   BUFFER, which must be a kernel address, keeping up to SLOT_MAX
+   requests in flight. */
+static void
+vblk_transfer (void *d_, block_sector_t sector, void *buffer,
+               block_sector_t cnt, bool write)
+{
+  struct vblk *d = d_;
+  struct slot *pending[SLOT_MAX];
+  size_t head = 0, tail = 0;
+  uint8_t *p = buffer;
+
+  ASSERT (is_kernel_vaddr (buffer));
+
+  while (cnt > 0 || head != tail)
+    {
+      if (cnt > 0 && tail - head < d->slot_cnt)
+        {
+          block_sector_t n = cnt < REQ_SECTORS ? cnt : REQ_SECTORS;
+
+          pending[tail++ % SLOT_MAX] = start_request (d, sector, p, n, write);
+          sector += n;
+          p += n * BLOCK_SECTOR_SIZE;
+          cnt -= n;
+        }
+      else if (!finish_request (d, pending[head++ % SLOT_MAX]))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, write ? "write" : "read", sector);
+    }
+}
+
+static void
+vblk_read_multiple (void *d, block_sector_t sector, void *buffer,
+                    block_sector_t cnt)
+{
+  vblk_transfer (d, sector, buffer, cnt, false);
+}
+
+static void
+vblk_write_multiple (void *d, block_sector_t sector, const void *buffer,
+                     block_sector_t cnt)
+{
+  vblk_transfer (d, sector, (void *) buffer, cnt, true);
+}
+
+static void
+vblk_read (void *d, block_sector_t sector, void *buffer)
+{
+  vblk_transfer (d, sector, buffer, 1, false);
+}
+
+static void
+vblk_write (void *d, block_sector_t sector, const void *buffer)
+{
+  vblk_transfer (d, sector, (void *) buffer, 1, true);
+}
+
+static const struct block_operations vblk_operations =
+  {
+    vblk_read,
+    vblk_write,
+    vblk_read_multiple,
+    vblk_write_multiple
+  };
+
+/* virtio-blk interrupt handler.  Wakes the waiter of every
+   request the devices on this line have completed. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < device_cnt; i++)
+    {
+      struct vblk *d = &devices[i];
+
+      if (d->irq != f->vec_no)
+        continue;
+
+      /* Reading the ISR acknowledges the interrupt. */
+      inb (reg_isr (d));
+      while (d->used_idx != d->used->idx)
+        {
+          uint32_t id = d->used->ring[d->used_idx % d->queue_size].id;
+          sema_up (&d->slots[id / 3].done);
+          d->used_idx++;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+/* bench.c
+
+   Timing shared by the application benchmarks. */
+
+#include "bench.h"
+#include <stdio.h>
+
+/* Returns TS in units of 1/HZ seconds. */
+static int64_t
+to_units (const struct timespec *ts, long hz)
+{
+  return ts->tv_sec * hz + ts->tv_nsec / (1000000000 / hz);
+}
+
+/* Starts timing into T. */
+void
+bench_start (struct bench_timer *t)
+{
+  clock_gettime (CLOCK_TICKS, &t->ticks);
+  clock_gettime (CLOCK_MONOTONIC, &t->mono);
+}
+
+/* Stops the timing T started and reports, under NAME, the timer
+   ticks that passed and AMOUNT of UNIT done per second. */
+void
+bench_stop (const struct bench_timer *t, const char *name,
+            uint64_t amount, const char *unit)
+{
+  struct timespec ticks, mono;
+  int64_t tick_cnt, us;
+
+  clock_gettime (CLOCK_MONOTONIC, &mono);
+  clock_gettime (CLOCK_TICKS, &ticks);
+  tick_cnt = (to_units (&ticks, BENCH_TIMER_FREQ)
+              - to_units (&t->ticks, BENCH_TIMER_FREQ));
+  us = to_units (&mono, 1000000) - to_units (&t->mono, 1000000);
+  if (us <= 0)
+    us = 1;
+
+  printf ("BENCH %s-ticks %lld ticks\n", name, (long long) tick_cnt);
+  printf ("BENCH %s-rate %llu %s/s\n", name,
+          (unsigned long long) (amount * 1000000 / us), unit);
+}
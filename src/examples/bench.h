@@ -0,0 +1,24 @@
+#ifndef EXAMPLES_BENCH_H
+#define EXAMPLES_BENCH_H
+
+#include <stdint.h>
+#include <syscall.h>
+
+/* Timing for the application benchmarks.  Each reports what it
+   measured as "BENCH NAME VALUE UNIT" lines, like the benchmarks
+   under tests/bench. */
+
+/* Timer ticks per second, as in devices/timer.h. */
+#define BENCH_TIMER_FREQ 100
+
+struct bench_timer
+  {
+    struct timespec ticks;      /* CLOCK_TICKS at the start. */
+    struct timespec mono;       /* CLOCK_MONOTONIC at the start. */
+  };
+
+void bench_start (struct bench_timer *);
+void bench_stop (const struct bench_timer *, const char *name,
+                 uint64_t amount, const char *unit);
+
+#endif /* examples/bench.h */
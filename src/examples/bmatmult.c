@@ -0,0 +1,88 @@
+/* bmatmult.c
+
+   Multiplies two DIM x DIM matrices of ints in BLOCK x BLOCK
+   tiles, so that each tile is reused while it is resident.  With
+   a large enough DIM the three matrices don't fit in physical
+   memory, which makes this a paging workload with locality:
+
+    Dim       Memory
+ ------     --------
+    256       768 kB
+    512     3,072 kB
+  1,024    12,288 kB
+  2,048    49,152 kB
+
+   usage: bmatmult DIM [BLOCK] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "bench.h"
+
+int
+main (int argc, char *argv[])
+{
+  struct bench_timer timer;
+  int dim, block, i, j, k, i0, j0, k0;
+  int *a, *b, *c;
+
+  if (argc < 2 || argc > 3)
+    {
+      printf ("usage: bmatmult DIM [BLOCK]\n");
+      return EXIT_FAILURE;
+    }
+  dim = atoi (argv[1]);
+  block = argc > 2 ? atoi (argv[2]) : 32;
+  if (dim <= 0 || block <= 0)
+    {
+      printf ("bmatmult: DIM and BLOCK must be positive\n");
+      return EXIT_FAILURE;
+    }
+  a = malloc (sizeof *a * dim * dim);
+  b = malloc (sizeof *b * dim * dim);
+  c = malloc (sizeof *c * dim * dim);
+  if (a == NULL || b == NULL || c == NULL)
+    {
+      printf ("bmatmult: out of memory\n");
+      return EXIT_FAILURE;
+    }
+
+  /* A is all ones and B[k][j] is j, so C[i][j] is DIM * j. */
+  for (i = 0; i < dim; i++)
+    for (j = 0; j < dim; j++)
+      {
+        a[i * dim + j] = 1;
+        b[i * dim + j] = j;
+        c[i * dim + j] = 0;
+      }
+
+  bench_start (&timer);
+  for (i0 = 0; i0 < dim; i0 += block)
+    for (k0 = 0; k0 < dim; k0 += block)
+      for (j0 = 0; j0 < dim; j0 += block)
+        {
+          int i1 = i0 + block < dim ? i0 + block : dim;
+          int k1 = k0 + block < dim ? k0 + block : dim;
+          int j1 = j0 + block < dim ? j0 + block : dim;
+
+          for (i = i0; i < i1; i++)
+            for (k = k0; k < k1; k++)
+              {
+                int aik = a[i * dim + k];
+                for (j = j0; j < j1; j++)
+                  c[i * dim + j] += aik * b[k * dim + j];
+              }
+        }
+  bench_stop (&timer, "bmatmult", (uint64_t) dim * dim * dim, "madds");
+
+  /* Check the first and last rows. */
+  for (i = 0; i < dim; i += dim - 1 > 0 ? dim - 1 : 1)
+    for (j = 0; j < dim; j++)
+      if (c[i * dim + j] != dim * j)
+        {
+          printf ("bmatmult: C[%d][%d] is %d, not %d\n",
+                  i, j, c[i * dim + j], dim * j);
+          return EXIT_FAILURE;
+        }
+  return EXIT_SUCCESS;
+}
@@ -6,15 +6,20 @@
 
    By default, only the name of each file is printed.  If "-l" is
    given as the first argument, the type, size, and inumber of
-   each file is also printed.  This won't work until project 4. */
+   each file is also printed, as read along with the names by
+   getdents().  This won't work until project 4. */
 
 #include <syscall.h>
 #include <stdio.h>
 #include <string.h>
 
+/* Entries read per getdents() call. */
+#define ENT_BATCH 32
+
 static bool
 list_dir (const char *dir, bool verbose) 
 {
+  struct stat st;
   int dir_fd = open (dir);
   if (dir_fd == -1) 
     {
@@ -22,40 +27,35 @@ list_dir (const char *dir, bool verbose)
       return false;
     }
 
-  if (isdir (dir_fd))
+  fstat (dir_fd, &st);
+  if (st.st_type == DT_DIR)
     {
-      char name[READDIR_MAX_LEN];
+      struct dirent ents[ENT_BATCH];
+      int n;
 
       printf ("%s", dir);
       if (verbose)
-        printf (" (inumber %d)", inumber (dir_fd));
+        printf (" (inumber %u)", st.st_ino);
       printf (":\n");
 
-      while (readdir (dir_fd, name)) 
+      while ((n = getdents (dir_fd, ents, ENT_BATCH)) > 0) 
         {
-          printf ("%s", name); 
-          if (verbose) 
-            {
-              char full_name[128];
-              int entry_fd;
+          int i;
 
-              snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
-              entry_fd = open (full_name);
-
-              printf (": ");
-              if (entry_fd != -1)
+          for (i = 0; i < n; i++)
+            {
+              printf ("%s", ents[i].d_name); 
+              if (verbose) 
                 {
-                  if (isdir (entry_fd))
+                  printf (": ");
+                  if (ents[i].d_type == DT_DIR)
                     printf ("directory");
                   else
-                    printf ("%d-byte file", filesize (entry_fd));
-                  printf (", inumber %d", inumber (entry_fd));
+                    printf ("%u-byte file", ents[i].d_size);
+                  printf (", inumber %u", ents[i].d_ino);
                 }
-              else
-                printf ("open failed");
-              close (entry_fd);
+              printf ("\n");
             }
-          printf ("\n");
         }
     }
   else 
@@ -0,0 +1,187 @@
+/* msort.c
+
+   Sorts a file of random 32-bit integers too big to sort in
+   memory: sorts it in runs of RUN_KB kilobytes, writes each run to
+   a file of its own, then merges the runs into msort.out.
+
+   usage: msort MB [RUN_KB] */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "bench.h"
+
+#define MAX_RUNS 64             /* Most runs merged at once. */
+#define IO_SIZE 4096            /* Bytes per merge buffer. */
+#define IO_CNT (IO_SIZE / sizeof (uint32_t))
+
+/* A run being merged. */
+struct run
+  {
+    int fd;
+    uint32_t buf[IO_CNT];
+    size_t pos, cnt;            /* Next value in BUF, values in BUF. */
+  };
+
+static struct run runs[MAX_RUNS];
+static uint32_t out_buf[IO_CNT];
+
+/* Opens FILE, created SIZE bytes long, or exits on failure. */
+static int
+create_open (const char *file, unsigned size)
+{
+  int fd;
+
+  remove (file);
+  if (!create (file, size) || (fd = open (file)) < 0)
+    {
+      printf ("msort: %s: create failed\n", file);
+      exit (EXIT_FAILURE);
+    }
+  return fd;
+}
+
+/* Writes SIZE bytes from BUF to FD, or exits on failure. */
+static void
+write_all (int fd, const void *buf, unsigned size)
+{
+  if (write (fd, buf, size) != (int) size)
+    {
+      printf ("msort: write failed\n");
+      exit (EXIT_FAILURE);
+    }
+}
+
+static int
+compare_u32 (const void *a_, const void *b_)
+{
+  uint32_t a = *(const uint32_t *) a_, b = *(const uint32_t *) b_;
+  return a < b ? -1 : a > b;
+}
+
+/* Refills R's buffer.  Returns false at the end of the run. */
+static bool
+refill (struct run *r)
+{
+  int n = read (r->fd, r->buf, sizeof r->buf);
+
+  r->pos = 0;
+  r->cnt = n > 0 ? n / sizeof *r->buf : 0;
+  return r->cnt > 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct bench_timer timer;
+  unsigned size, run_size, run_cnt, i;
+  uint32_t *buf, last;
+  size_t total, done;
+  char name[16];
+  int in_fd, out_fd;
+
+  if (argc < 2 || argc > 3)
+    {
+      printf ("usage: msort MB [RUN_KB]\n");
+      return EXIT_FAILURE;
+    }
+  size = atoi (argv[1]) * 1024 * 1024;
+  run_size = (argc > 2 ? atoi (argv[2]) : 256) * 1024;
+  run_cnt = (size + run_size - 1) / run_size;
+  if (size == 0 || run_size == 0 || run_cnt > MAX_RUNS)
+    {
+      printf ("msort: need 1 to %d runs of RUN_KB\n", MAX_RUNS);
+      return EXIT_FAILURE;
+    }
+  buf = malloc (run_size);
+  if (buf == NULL)
+    {
+      printf ("msort: out of memory\n");
+      return EXIT_FAILURE;
+    }
+
+  /* Write the input. */
+  random_init (size);
+  in_fd = create_open ("msort.in", size);
+  for (done = 0; done < size; done += sizeof out_buf)
+    {
+      for (i = 0; i < IO_CNT; i++)
+        out_buf[i] = random_ulong ();
+      write_all (in_fd, out_buf, sizeof out_buf);
+    }
+
+  /* Sort it into runs. */
+  bench_start (&timer);
+  seek (in_fd, 0);
+  for (i = 0; i < run_cnt; i++)
+    {
+      unsigned n = size - i * run_size < run_size ? size - i * run_size
+                                                  : run_size;
+      if (read (in_fd, buf, n) != (int) n)
+        {
+          printf ("msort: read failed\n");
+          return EXIT_FAILURE;
+        }
+      qsort (buf, n / sizeof *buf, sizeof *buf, compare_u32);
+      snprintf (name, sizeof name, "msort.%u", i);
+      runs[i].fd = create_open (name, n);
+      write_all (runs[i].fd, buf, n);
+      seek (runs[i].fd, 0);
+      refill (&runs[i]);
+    }
+  close (in_fd);
+
+  /* Merge the runs, smallest head first, checking the order. */
+  out_fd = create_open ("msort.out", size);
+  total = done = 0;
+  last = 0;
+  for (;;)
+    {
+      struct run *min = NULL;
+      uint32_t value;
+
+      for (i = 0; i < run_cnt; i++)
+        if (runs[i].cnt > 0
+            && (min == NULL || runs[i].buf[runs[i].pos] < min->buf[min->pos]))
+          min = &runs[i];
+      if (min == NULL)
+        break;
+
+      value = min->buf[min->pos];
+      if (++min->pos == min->cnt)
+        refill (min);
+      if (value < last)
+        {
+          printf ("msort: output out of order\n");
+          return EXIT_FAILURE;
+        }
+      last = value;
+
+      out_buf[done++] = value;
+      if (done == IO_CNT)
+        {
+          write_all (out_fd, out_buf, sizeof out_buf);
+          total += done;
+          done = 0;
+        }
+    }
+  write_all (out_fd, out_buf, done * sizeof *out_buf);
+  total += done;
+  close (out_fd);
+  bench_stop (&timer, "msort", size / 1024, "kB");
+
+  for (i = 0; i < run_cnt; i++)
+    {
+      close (runs[i].fd);
+      snprintf (name, sizeof name, "msort.%u", i);
+      remove (name);
+    }
+  if (total * sizeof *out_buf != size)
+    {
+      printf ("msort: merged %zu values of %u\n", total,
+              size / (unsigned) sizeof *out_buf);
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/* pipeline.c
+
+   Runs STAGES processes at once, each reading the file the one
+   before it is still writing, adding 1 to every byte and writing
+   the result to a file of its own, as a pipeline through shared
+   files.  The first stage reads KB kilobytes written beforehand;
+   the last stage's output is checked at the end.
+
+   usage: pipeline STAGES KB
+   Each stage runs as: pipeline -stage N KB */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "bench.h"
+
+#define MAX_STAGES 16
+#define CHUNK 4096
+#define STALL_MS 10000          /* Give up on an input this idle. */
+
+static unsigned char buf[CHUNK];
+
+/* Returns the byte at OFS of the pipeline's input. */
+static unsigned char
+pattern (size_t ofs)
+{
+  return ofs * 7 + (ofs >> 12);
+}
+
+/* Opens FILE, or exits on failure. */
+static int
+open_or_die (const char *file)
+{
+  int fd = open (file);
+
+  if (fd < 0)
+    {
+      printf ("pipeline: %s: open failed\n", file);
+      exit (EXIT_FAILURE);
+    }
+  return fd;
+}
+
+/* Stage N: copies pipe.N-1 to pipe.N, adding 1 to each byte, as
+   the previous stage writes it. */
+static int
+run_stage (int n, size_t size)
+{
+  char in_name[24], out_name[24];
+  int in_fd, out_fd;
+  int idle_ms = 0;
+  size_t done;
+
+  snprintf (in_name, sizeof in_name, "pipe.%d", n - 1);
+  snprintf (out_name, sizeof out_name, "pipe.%d", n);
+  in_fd = open_or_die (in_name);
+  out_fd = open_or_die (out_name);
+
+  for (done = 0; done < size; )
+    {
+      int cnt = read (in_fd, buf, size - done < CHUNK ? size - done : CHUNK);
+      int i;
+
+      if (cnt <= 0)
+        {
+          /* Caught up with the stage before; let it run. */
+          if (++idle_ms > STALL_MS)
+            {
+              printf ("pipeline: %s stopped growing\n", in_name);
+              return EXIT_FAILURE;
+            }
+          sleep_ms (1);
+          continue;
+        }
+      idle_ms = 0;
+      for (i = 0; i < cnt; i++)
+        buf[i]++;
+      if (write (out_fd, buf, cnt) != cnt)
+        {
+          printf ("pipeline: %s: write failed\n", out_name);
+          return EXIT_FAILURE;
+        }
+      done += cnt;
+    }
+  return EXIT_SUCCESS;
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct bench_timer timer;
+  pid_t pids[MAX_STAGES];
+  char name[16], cmd[48];
+  int stage_cnt, fd, i;
+  size_t size, ofs;
+  bool ok = true;
+
+  if (argc == 4 && !strcmp (argv[1], "-stage"))
+    return run_stage (atoi (argv[2]), atoi (argv[3]) * 1024);
+  if (argc != 3)
+    {
+      printf ("usage: pipeline STAGES KB\n");
+      return EXIT_FAILURE;
+    }
+  stage_cnt = atoi (argv[1]);
+  size = atoi (argv[2]) * 1024;
+  if (stage_cnt < 1 || stage_cnt > MAX_STAGES || size == 0)
+    {
+      printf ("pipeline: need 1 to %d stages of at least 1 kB\n",
+              MAX_STAGES);
+      return EXIT_FAILURE;
+    }
+
+  /* Write the input, and empty files for the stages to write. */
+  for (i = 0; i <= stage_cnt; i++)
+    {
+      snprintf (name, sizeof name, "pipe.%d", i);
+      remove (name);
+      if (!create (name, 0))
+        {
+          printf ("pipeline: %s: create failed\n", name);
+          return EXIT_FAILURE;
+        }
+    }
+  fd = open_or_die ("pipe.0");
+  for (ofs = 0; ofs < size; ofs += CHUNK)
+    {
+      size_t n = size - ofs < CHUNK ? size - ofs : CHUNK, j;
+
+      for (j = 0; j < n; j++)
+        buf[j] = pattern (ofs + j);
+      if (write (fd, buf, n) != (int) n)
+        {
+          printf ("pipeline: pipe.0: write failed\n");
+          return EXIT_FAILURE;
+        }
+    }
+  close (fd);
+
+  /* Run the stages together. */
+  bench_start (&timer);
+  for (i = 0; i < stage_cnt; i++)
+    {
+      snprintf (cmd, sizeof cmd, "pipeline -stage %d %s", i + 1, argv[2]);
+      pids[i] = exec (cmd);
+      if (pids[i] == PID_ERROR)
+        {
+          printf ("pipeline: exec failed\n");
+          return EXIT_FAILURE;
+        }
+    }
+  for (i = 0; i < stage_cnt; i++)
+    if (wait (pids[i]) != EXIT_SUCCESS)
+      ok = false;
+  bench_stop (&timer, "pipeline", (uint64_t) size * stage_cnt / 1024, "kB");
+
+  /* Check the output. */
+  snprintf (name, sizeof name, "pipe.%d", stage_cnt);
+  fd = open_or_die (name);
+  for (ofs = 0; ok && ofs < size; ofs += CHUNK)
+    {
+      int want = size - ofs < CHUNK ? size - ofs : CHUNK;
+      int n = read (fd, buf, want), j;
+
+      if (n != want)
+        ok = false;
+      for (j = 0; ok && j < n; j++)
+        if (buf[j] != (unsigned char) (pattern (ofs + j) + stage_cnt))
+          ok = false;
+    }
+  close (fd);
+  for (i = 0; i <= stage_cnt; i++)
+    {
+      snprintf (name, sizeof name, "pipe.%d", i);
+      remove (name);
+    }
+  if (!ok)
+    {
+      printf ("pipeline: output does not match\n");
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+/* wc.c
+
+   Counts the lines, words and bytes of FILE, and how many of the
+   words are different, like "wc" with a word-frequency table.
+   Given MB, first writes MB megabytes of made-up text to FILE.
+
+   usage: wc FILE [MB] */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "bench.h"
+
+#define BUF_SIZE 4096
+#define BUCKET_CNT 4096
+#define WORD_MAX 31             /* Longer words are cut short. */
+
+/* A distinct word, in a chain of the hash table. */
+struct word
+  {
+    struct word *next;
+    unsigned cnt;               /* Times seen. */
+    char text[];
+  };
+
+static struct word *buckets[BUCKET_CNT];
+static size_t distinct_cnt;
+static char buf[BUF_SIZE];
+
+/* Syllables the made-up words are built from. */
+static const char *syllables[] =
+  {
+    "ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo",
+    "ba", "de", "fu", "go", "hi", "ja", "pe", "zu",
+  };
+#define SYLLABLE_CNT (sizeof syllables / sizeof *syllables)
+
+/* Writes MB megabytes of lines of words to FD. */
+static void
+generate (int fd, unsigned mb)
+{
+  size_t size = mb * 1024 * 1024, len = 0, done;
+  unsigned words_on_line = 0;
+
+  random_init (mb);
+  for (done = 0; done < size; )
+    {
+      /* Words of 1 to 3 syllables, 10 to a line. */
+      int syl_cnt = random_ulong () % 3 + 1;
+
+      while (syl_cnt-- > 0 && len < BUF_SIZE - 4)
+        {
+          const char *s = syllables[random_ulong () % SYLLABLE_CNT];
+          buf[len++] = s[0];
+          buf[len++] = s[1];
+        }
+      buf[len++] = ++words_on_line % 10 == 0 ? '\n' : ' ';
+
+      if (len >= BUF_SIZE - 8 || done + len >= size)
+        {
+          if (done + len > size)
+            len = size - done;
+          if (write (fd, buf, len) != (int) len)
+            {
+              printf ("wc: write failed\n");
+              exit (EXIT_FAILURE);
+            }
+          done += len;
+          len = 0;
+        }
+    }
+}
+
+/* Returns a hash of the LEN bytes at S. */
+static unsigned
+hash_word (const char *s, size_t len)
+{
+  unsigned h = 2166136261u;
+
+  while (len-- > 0)
+    h = (h ^ (unsigned char) *s++) * 16777619u;
+  return h;
+}
+
+/* Counts one more use of the LEN-byte word S. */
+static void
+add_word (const char *s, size_t len)
+{
+  struct word **bucket = &buckets[hash_word (s, len) % BUCKET_CNT];
+  struct word *w;
+
+  for (w = *bucket; w != NULL; w = w->next)
+    if (!memcmp (w->text, s, len) && w->text[len] == '\0')
+      {
+        w->cnt++;
+        return;
+      }
+
+  w = malloc (sizeof *w + len + 1);
+  if (w == NULL)
+    {
+      printf ("wc: out of memory\n");
+      exit (EXIT_FAILURE);
+    }
+  w->cnt = 1;
+  memcpy (w->text, s, len);
+  w->text[len] = '\0';
+  w->next = *bucket;
+  *bucket = w;
+  distinct_cnt++;
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct bench_timer timer;
+  size_t line_cnt = 0, word_cnt = 0, byte_cnt = 0;
+  char word[WORD_MAX];
+  size_t word_len = 0;
+  const struct word *top = NULL;
+  int fd, n, i;
+
+  if (argc < 2 || argc > 3)
+    {
+      printf ("usage: wc FILE [MB]\n");
+      return EXIT_FAILURE;
+    }
+  if (argc > 2)
+    {
+      remove (argv[1]);
+      if (!create (argv[1], 0))
+        {
+          printf ("%s: create failed\n", argv[1]);
+          return EXIT_FAILURE;
+        }
+    }
+  fd = open (argv[1]);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  if (argc > 2)
+    {
+      generate (fd, atoi (argv[2]));
+      seek (fd, 0);
+    }
+
+  bench_start (&timer);
+  while ((n = read (fd, buf, sizeof buf)) > 0)
+    {
+      byte_cnt += n;
+      for (i = 0; i < n; i++)
+        {
+          char c = buf[i];
+
+          if (c == ' ' || c == '\n' || c == '\t')
+            {
+              if (word_len > 0)
+                {
+                  add_word (word, word_len);
+                  word_cnt++;
+                  word_len = 0;
+                }
+              if (c == '\n')
+                line_cnt++;
+            }
+          else if (word_len < sizeof word)
+            word[word_len++] = c;
+        }
+    }
+  if (word_len > 0)
+    {
+      add_word (word, word_len);
+      word_cnt++;
+    }
+  bench_stop (&timer, "wc", byte_cnt / 1024, "kB");
+  close (fd);
+
+  for (i = 0; i < BUCKET_CNT; i++)
+    {
+      const struct word *w;
+      for (w = buckets[i]; w != NULL; w = w->next)
+        if (top == NULL || w->cnt > top->cnt)
+          top = w;
+    }
+  printf ("%zu lines, %zu words, %zu bytes, %zu different",
+          line_cnt, word_cnt, byte_cnt, distinct_cnt);
+  if (top != NULL)
+    printf (", most often \"%s\" (%u)", top->text, top->cnt);
+  printf ("\n");
+  return EXIT_SUCCESS;
+}
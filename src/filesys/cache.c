@@ -0,0 +1,633 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/worker.h"
+
+/* Buffer cache.
+
+   Holds up to CACHE_SIZE sectors of the file system device.  All
+   file system accesses to fs_device go through here, so that
+   repeated and partial sector accesses don't hit the disk.
+
+   Modified sectors are written back lazily: when they are
+   evicted, by a worker every CACHE_FLUSH_TICKS ticks, and by
+   cache_flush() at filesys_done().  The periodic flush also has
+   the free map write out its changed sectors, and the journal
+   commit, first.  Sectors written by a journal transaction are
+   held back from write-back until it commits.  Sequential readers
+   get the following sector fetched in the background by the
+   read-ahead thread.
+
+   Runs of whole sectors of file data can be read and written
+   with cache_read_run() and cache_write_run(), which move the
+   sectors that are not cached straight between the caller's
+   buffer and the disk, in one request.  A miss on a sector being
+   written that way waits for the write to finish, so the cache
+   never picks up what it is replacing.
+
+   Synchronization: cache_lock protects the tag of every entry
+   (sector, valid), the pin counts, the held flags, the clock
+   hand, and the list of direct writes.  Each entry's own lock protects its data and dirty bit,
+   and is held
+   across the disk I/O that fills it, so a thread that finds a
+   sector still being read in simply waits on that entry.  An
+   entry with a nonzero pin count is never evicted.  cache_lock
+   may be held while acquiring an entry's lock, never the other
+   way around. */
+
+/* Ticks between two periodic flushes. */
+#define CACHE_FLUSH_TICKS (5 * TIMER_FREQ)
+
+/* Maximum number of pending read-ahead requests. */
+#define READAHEAD_MAX 16
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;      /* Sector held, if valid. */
+    bool valid;                 /* Holds a sector? */
+    bool dirty;                 /* Modified since last write-back? */
+    bool accessed;              /* Used since the clock hand passed? */
+    bool held;                  /* Not to be written back yet? */
+    int pin_cnt;                /* Number of threads using the entry. */
+    struct lock lock;           /* Protects data and dirty. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition cache_unpinned;  /* Signaled when a pin drops. */
+static size_t clock_hand;
+
+/* Read-ahead request queue, a ring of sectors. */
+static block_sector_t ra_queue[READAHEAD_MAX];
+static size_t ra_head, ra_cnt;
+static struct lock ra_lock;
+static struct condition ra_nonempty;
+
+/* A run of sectors being written straight to disk. */
+struct direct_write
+  {
+    struct list_elem elem;      /* In direct_writes. */
+    block_sector_t sector;      /* First sector. */
+    block_sector_t cnt;         /* Number of sectors. */
+  };
+
+static struct list direct_writes;
+static struct condition direct_done;   /* Signaled when one ends. */
+
+/* Statistics. */
+static unsigned long long hit_cnt, miss_cnt, evict_cnt;
+static unsigned long long writeback_cnt, readahead_cnt;
+static unsigned long long direct_read_cnt, direct_write_cnt;
+
+/* Periodic flush: the timer event queues the work, which arms
+   the event again when it is done. */
+static struct timer_event flush_event;
+static struct work flush_work;
+
+static timer_func queue_flush;
+static work_func periodic_flush;
+static thread_func read_ahead NO_RETURN;
+
+/* Initializes the buffer cache and starts its helper threads. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t pages = CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE;
+  size_t i;
+
+  data = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, pages);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->valid = false;
+      e->dirty = false;
+      e->accessed = false;
+      e->held = false;
+      e->pin_cnt = 0;
+      lock_init (&e->lock);
+      e->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+  lock_init (&cache_lock);
+  lock_set_name (&cache_lock, "cache");
+  cond_init (&cache_unpinned);
+  clock_hand = 0;
+  list_init (&direct_writes);
+  cond_init (&direct_done);
+
+  lock_init (&ra_lock);
+  lock_set_name (&ra_lock, "readahead");
+  cond_init (&ra_nonempty);
+  ra_head = ra_cnt = 0;
+
+  timer_event_init (&flush_event, queue_flush, NULL);
+  work_init (&flush_work, periodic_flush, NULL);
+  timer_event_schedule (&flush_event, CACHE_FLUSH_TICKS);
+  thread_create ("cache-ra", PRI_DEFAULT, read_ahead, NULL);
+}
+
+/* Writes E back to disk if it is dirty and not held.
+   E's lock must be held. */
+static void
+write_back (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->valid && e->dirty && !e->held)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      writeback_cnt++;
+    }
+}
+
+/* Returns a cache entry that is neither pinned nor held,
+   advancing the clock hand past recently used entries.  Waits if
+   there is none.  cache_lock must be held. */
+static struct cache_entry *
+pick_victim (void)
+{
+  for (;;)
+    {
+      size_t tries;
+
+      for (tries = 0; tries < 2 * CACHE_SIZE; tries++)
+        {
+          struct cache_entry *e = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+          if (e->pin_cnt > 0 || e->held)
+            continue;
+          if (!e->valid)
+            return e;
+          if (e->accessed)
+            e->accessed = false;
+          else
+            return e;
+        }
+      cond_wait (&cache_unpinned, &cache_lock);
+    }
+}
+
+/* Returns true if SECTOR is being written straight to disk.
+   cache_lock must be held. */
+static bool
+in_direct_write (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&direct_writes); e != list_end (&direct_writes);
+       e = list_next (e))
+    {
+      struct direct_write *d = list_entry (e, struct direct_write, elem);
+      if (sector - d->sector < d->cnt)
+        return true;
+    }
+  return false;
+}
+
+/* Returns the cache entry for SECTOR, pinned and with its lock
+   held, loading the sector from disk if necessary.  If
+   OVERWRITE is true the caller is about to replace the whole
+   sector, so a miss needn't read it.  If HOLD is true the entry
+   is also held back from write-back, before the caller gets to
+   change it, until cache_unhold(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool overwrite, bool hold)
+{
+  struct cache_entry *e;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+ retry:
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      e = &cache[i];
+      if (e->valid && e->sector == sector)
+        {
+          e->pin_cnt++;
+          e->held |= hold;
+          hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+    }
+  if (in_direct_write (sector))
+    {
+      cond_wait (&direct_done, &cache_lock);
+      goto retry;
+    }
+
+  /* Miss.  An unpinned entry's lock is free, so taking it here
+     doesn't block, and it keeps anyone who finds the new tag
+     from seeing the data before it has been read. */
+  miss_cnt++;
+  e = pick_victim ();
+  lock_acquire (&e->lock);
+  if (e->valid)
+    {
+      evict_cnt++;
+      write_back (e);
+    }
+  e->sector = sector;
+  e->valid = true;
+  e->dirty = false;
+  e->accessed = false;
+  e->held = hold;
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  if (!overwrite)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Releases entry E obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  e->accessed = true;
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Reads SIZE bytes starting at byte OFS within SECTOR into
+   BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, false, false);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte
+   OFS, holding the sector back from write-back if HOLD. */
+static void
+write_sector (block_sector_t sector, const void *buffer, int ofs, int size,
+              bool hold)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, ofs == 0 && size == BLOCK_SECTOR_SIZE, hold);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte OFS.
+   The sector reaches the disk later, when it is evicted or
+   flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  write_sector (sector, buffer, ofs, size, false);
+}
+
+/* Like cache_write(), but keeps SECTOR in the cache and off the
+   disk until cache_unhold(), for the journal, which must log it
+   before it may reach its home location. */
+void
+cache_write_held (block_sector_t sector, const void *buffer, int ofs,
+                  int size)
+{
+  write_sector (sector, buffer, ofs, size, true);
+}
+
+/* Lets SECTOR, written by cache_write_held(), be written back
+   and evicted again. */
+void
+cache_unhold (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->valid && e->sector == sector && e->held)
+        {
+          e->held = false;
+          cond_signal (&cache_unpinned, &cache_lock);
+          break;
+        }
+    }
+  lock_release (&cache_lock);
+}
+
+/* Pins the cached entries for the CNT sectors starting at SECTOR
+   and stores them into HITS in sector order.  Returns how many
+   there are.  cache_lock must be held. */
+static size_t
+pin_run (block_sector_t sector, block_sector_t cnt,
+         struct cache_entry *hits[CACHE_SIZE])
+{
+  size_t n = 0, i, j;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->valid && e->sector - sector < cnt)
+        {
+          e->pin_cnt++;
+          for (j = n++; j > 0 && hits[j - 1]->sector > e->sector; j--)
+            hits[j] = hits[j - 1];
+          hits[j] = e;
+        }
+    }
+  return n;
+}
+
+/* Reads the CNT whole sectors starting at SECTOR into BUFFER,
+   which must be in kernel memory.  Cached sectors are copied from
+   the cache, and each run of the others is read from disk
+   straight into BUFFER, in one request, without being cached. */
+void
+cache_read_run (block_sector_t sector, block_sector_t cnt, void *buffer_)
+{
+  struct cache_entry *hits[CACHE_SIZE];
+  uint8_t *buffer = buffer_;
+  block_sector_t idx = 0;
+  size_t n, i;
+
+  ASSERT (is_kernel_vaddr (buffer));
+
+  lock_acquire (&cache_lock);
+  n = pin_run (sector, cnt, hits);
+  hit_cnt += n;
+  direct_read_cnt += cnt - n;
+  lock_release (&cache_lock);
+
+  for (i = 0; i <= n; i++)
+    {
+      block_sector_t end = i < n ? hits[i]->sector - sector : cnt;
+
+      if (end > idx)
+        block_read_multiple (fs_device, sector + idx,
+                             buffer + idx * BLOCK_SECTOR_SIZE, end - idx);
+      if (i < n)
+        {
+          lock_acquire (&hits[i]->lock);
+          memcpy (buffer + end * BLOCK_SECTOR_SIZE, hits[i]->data,
+                  BLOCK_SECTOR_SIZE);
+          cache_put (hits[i]);
+          idx = end + 1;
+        }
+    }
+}
+
+/* Writes the CNT whole sectors starting at SECTOR from BUFFER,
+   which must be in kernel memory, to disk in one request, and
+   updates the cached ones to match. */
+void
+cache_write_run (block_sector_t sector, block_sector_t cnt,
+                 const void *buffer_)
+{
+  struct cache_entry *hits[CACHE_SIZE];
+  const uint8_t *buffer = buffer_;
+  struct direct_write d;
+  size_t n, i;
+
+  ASSERT (is_kernel_vaddr (buffer));
+
+  d.sector = sector;
+  d.cnt = cnt;
+  lock_acquire (&cache_lock);
+  list_push_back (&direct_writes, &d.elem);
+  n = pin_run (sector, cnt, hits);
+  direct_write_cnt += cnt;
+  lock_release (&cache_lock);
+
+  /* Update the cached copies first, so that one written back
+     meanwhile doesn't undo the write.  Our write leaves them
+     clean. */
+  for (i = 0; i < n; i++)
+    {
+      struct cache_entry *e = hits[i];
+
+      lock_acquire (&e->lock);
+      ASSERT (!e->held);
+      memcpy (e->data, buffer + (e->sector - sector) * BLOCK_SECTOR_SIZE,
+              BLOCK_SECTOR_SIZE);
+      e->dirty = false;
+      cache_put (e);
+    }
+  block_write_multiple (fs_device, sector, buffer, cnt);
+
+  lock_acquire (&cache_lock);
+  list_remove (&d.elem);
+  cond_broadcast (&direct_done, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache.
+   Returns immediately; the request is dropped if the queue is
+   full. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt < READAHEAD_MAX)
+    {
+      ra_queue[(ra_head + ra_cnt) % READAHEAD_MAX] = sector;
+      ra_cnt++;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Writes every dirty sector that is not held back to disk. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (!e->valid || !e->dirty || e->held)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      write_back (e);
+      lock_release (&e->lock);
+
+      lock_acquire (&cache_lock);
+      if (--e->pin_cnt == 0)
+        cond_signal (&cache_unpinned, &cache_lock);
+      lock_release (&cache_lock);
+    }
+}
+
+/* Completion function of a cache_sync() write. */
+static void
+sync_done (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Writes every dirty cached sector for which MATCH returns true,
+   given AUX, back to disk, and waits until they are all written.
+   They are queued on the device together, so that it can take
+   them in one sweep.  MATCH is called with cache_lock held. */
+void
+cache_sync (cache_match_func *match, void *aux)
+{
+  struct cache_entry **batch;
+  struct block_request *reqs, **reqp;
+  struct semaphore done;
+  enum cpu_time old_time;
+  size_t cnt = 0, i, j;
+
+  batch = malloc (CACHE_SIZE * sizeof *batch);
+  reqs = malloc (CACHE_SIZE * sizeof *reqs);
+  reqp = malloc (CACHE_SIZE * sizeof *reqp);
+  if (batch == NULL || reqs == NULL || reqp == NULL)
+    {
+      /* Short of memory: write them back one at a time. */
+      free (batch);
+      free (reqs);
+      free (reqp);
+      cache_flush ();
+      return;
+    }
+
+  /* Pin the matching dirty entries, in sector order. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->valid && e->dirty && !e->held && match (e->sector, aux))
+        {
+          e->pin_cnt++;
+          for (j = cnt++; j > 0 && batch[j - 1]->sector > e->sector; j--)
+            batch[j] = batch[j - 1];
+          batch[j] = e;
+        }
+    }
+  lock_release (&cache_lock);
+
+  /* Lock them, in sector order, and queue the ones still dirty.
+     Nobody else ever holds two entry locks, so this can't
+     deadlock. */
+  sema_init (&done, 0);
+  for (i = j = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = batch[i];
+
+      lock_acquire (&e->lock);
+      if (e->dirty && !e->held)
+        {
+          struct block_request *r = &reqs[j];
+          r->sector = e->sector;
+          r->cnt = 1;
+          r->buffer = e->data;
+          r->write = true;
+          r->done = sync_done;
+          r->aux = &done;
+          reqp[j++] = r;
+          e->dirty = false;
+        }
+    }
+  old_time = thread_set_block_time (CPU_IO_WAIT);
+  block_submit_batch (fs_device, reqp, j);
+  writeback_cnt += j;
+  while (j-- > 0)
+    sema_down (&done);
+  thread_set_block_time (old_time);
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      lock_release (&batch[i]->lock);
+      if (--batch[i]->pin_cnt == 0)
+        cond_signal (&cache_unpinned, &cache_lock);
+    }
+  lock_release (&cache_lock);
+
+  free (batch);
+  free (reqs);
+  free (reqp);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %llu hits, %llu misses, %llu evictions, "
+          "%llu write-backs, %llu read-aheads\n",
+          hit_cnt, miss_cnt, evict_cnt, writeback_cnt, readahead_cnt);
+  printf ("Cache: %llu sectors read and %llu written directly\n",
+          direct_read_cnt, direct_write_cnt);
+}
+
+/* Timer event function that hands the periodic flush to a
+   worker, since it sleeps on disk I/O. */
+static void
+queue_flush (void *aux UNUSED)
+{
+  work_queue (WQ_NORMAL, &flush_work);
+}
+
+/* Writes dirty sectors back, then schedules the next run. */
+static void
+periodic_flush (void *aux UNUSED)
+{
+  free_map_flush ();
+  journal_commit ();
+  cache_flush ();
+  timer_event_schedule (&flush_event, CACHE_FLUSH_TICKS);
+}
+
+/* Read-ahead thread.  Loads queued sectors into the cache. */
+static void
+read_ahead (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % READAHEAD_MAX;
+      ra_cnt--;
+      lock_release (&ra_lock);
+
+      cache_put (cache_get (sector, false, false));
+      readahead_cnt++;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Number of sectors held by the buffer cache. */
+#define CACHE_SIZE 64
+
+void cache_init (void);
+void cache_read (block_sector_t, void *, int ofs, int size);
+void cache_write (block_sector_t, const void *, int ofs, int size);
+void cache_write_held (block_sector_t, const void *, int ofs, int size);
+void cache_unhold (block_sector_t);
+void cache_read_run (block_sector_t, block_sector_t cnt, void *);
+void cache_write_run (block_sector_t, block_sector_t cnt, const void *);
+void cache_readahead (block_sector_t);
+void cache_flush (void);
+
+/* Selects sectors for cache_sync(). */
+typedef bool cache_match_func (block_sector_t, void *aux);
+void cache_sync (cache_match_func *, void *aux);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,185 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Path name lookup cache.
+
+   Remembers, for up to DCACHE_SIZE (directory, name) pairs, the
+   inode sector the name leads to, so that resolving a path
+   needn't open the directories along it or read their entries.
+   Names found missing are remembered too, as negative entries
+   with sector 0, which never holds a file's inode.
+
+   Entries are only added by dir_lookup() and only changed by
+   dir_add() and dir_remove(), all with the directory's own lock
+   held, so an entry can't outlive the directory entry it was made
+   from.  The least recently used entry makes room for new ones. */
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem elem;              /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru. */
+    block_sector_t dir;                 /* Directory holding NAME. */
+    char name[NAME_MAX + 1];            /* Null terminated name. */
+    block_sector_t sector;              /* Inode of NAME, or 0. */
+    bool is_dir;                        /* Is that inode a directory? */
+  };
+
+static struct hash dentries;            /* Entries by dir and name. */
+static struct list lru;                 /* Most recently used first. */
+static size_t dentry_cnt;               /* Number of entries. */
+static struct lock dcache_lock;         /* Protects the above. */
+
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, elem);
+  return a->dir != b->dir ? a->dir < b->dir : strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the lookup cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  dentry_cnt = 0;
+  lock_init (&dcache_lock);
+  lock_set_name (&dcache_lock, "dcache");
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer.
+   dcache_lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.elem);
+  return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Removes entry D and frees it.  dcache_lock must be held. */
+static void
+drop (struct dentry *d)
+{
+  hash_delete (&dentries, &d->elem);
+  list_remove (&d->lru_elem);
+  dentry_cnt--;
+  free (d);
+}
+
+/* Looks NAME up in the directory at sector DIR.  Returns false
+   if the cache doesn't know.  Otherwise stores into *SECTOR the
+   inode sector NAME leads to, or 0 if there is no such name, and
+   into *IS_DIR whether that is a directory, and returns true. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sector, bool *is_dir)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      *sector = d->sector;
+      *is_dir = d->is_dir;
+      list_remove (&d->lru_elem);
+      list_push_front (&lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory at DIR leads to the inode
+   at SECTOR, or to nothing if SECTOR is 0.  Does nothing if
+   memory is short. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               block_sector_t sector, bool is_dir)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      if (dentry_cnt >= DCACHE_SIZE)
+        drop (list_entry (list_back (&lru), struct dentry, lru_elem));
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        goto done;
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->elem);
+      dentry_cnt++;
+    }
+  else
+    list_remove (&d->lru_elem);
+  d->sector = sector;
+  d->is_dir = is_dir;
+  list_push_front (&lru, &d->lru_elem);
+
+ done:
+  lock_release (&dcache_lock);
+}
+
+/* Forgets NAME in the directory at DIR. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    drop (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name in the directory at DIR, which is being
+   removed, so that nothing is found there if its sector is
+   reused. */
+void
+dcache_forget_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        drop (d);
+    }
+  lock_release (&dcache_lock);
+}
@@ -0,0 +1,18 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Number of names held by the lookup cache. */
+#define DCACHE_SIZE 256
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sector, bool *is_dir);
+void dcache_insert (block_sector_t dir, const char *name,
+                    block_sector_t sector, bool is_dir);
+void dcache_invalidate (block_sector_t dir, const char *name);
+void dcache_forget_dir (block_sector_t dir);
+
+#endif /* filesys/dcache.h */
@@ -0,0 +1,91 @@
+#include "filesys/defrag.h"
+#include <list.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Online defragmentation.  Files queued with defrag_queue() are
+   moved into one run of sectors each by inode_defrag(), one at a
+   time, by a thread of the lowest priority, so that it only uses
+   the disk when nothing else wants the CPU.  A queued file is
+   kept open until its turn has come. */
+
+/* A file waiting to be defragmented. */
+struct defrag_req
+  {
+    struct list_elem elem;      /* Element in queue. */
+    struct inode *inode;        /* File to move, reopened. */
+  };
+
+static struct list queue;
+static struct lock queue_lock;
+static struct condition queue_ready;  /* Signaled when queued. */
+static struct condition queue_done;   /* Signaled when idle. */
+static bool busy;                     /* Moving a file? */
+
+static thread_func defrag_thread NO_RETURN;
+
+/* Starts the defragmenter thread. */
+void
+defrag_init (void)
+{
+  list_init (&queue);
+  lock_init (&queue_lock);
+  cond_init (&queue_ready);
+  cond_init (&queue_done);
+  thread_create ("defrag", PRI_MIN, defrag_thread, NULL);
+}
+
+/* Queues INODE to be defragmented in the background.  Returns
+   false if memory is short. */
+bool
+defrag_queue (struct inode *inode)
+{
+  struct defrag_req *r = malloc (sizeof *r);
+
+  if (r == NULL)
+    return false;
+  r->inode = inode_reopen (inode);
+  lock_acquire (&queue_lock);
+  list_push_back (&queue, &r->elem);
+  cond_signal (&queue_ready, &queue_lock);
+  lock_release (&queue_lock);
+  return true;
+}
+
+/* Waits until every queued file has been defragmented. */
+void
+defrag_done (void)
+{
+  lock_acquire (&queue_lock);
+  while (busy || !list_empty (&queue))
+    cond_wait (&queue_done, &queue_lock);
+  lock_release (&queue_lock);
+}
+
+/* Defragmenter thread. */
+static void
+defrag_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct defrag_req *r;
+
+      lock_acquire (&queue_lock);
+      while (list_empty (&queue))
+        cond_wait (&queue_ready, &queue_lock);
+      r = list_entry (list_pop_front (&queue), struct defrag_req, elem);
+      busy = true;
+      lock_release (&queue_lock);
+
+      inode_defrag (r->inode);
+      inode_close (r->inode);
+      free (r);
+
+      lock_acquire (&queue_lock);
+      busy = false;
+      cond_broadcast (&queue_done, &queue_lock);
+      lock_release (&queue_lock);
+    }
+}
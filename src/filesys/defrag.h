@@ -0,0 +1,12 @@
+#ifndef FILESYS_DEFRAG_H
+#define FILESYS_DEFRAG_H
+
+#include <stdbool.h>
+
+struct inode;
+
+void defrag_init (void);
+bool defrag_queue (struct inode *);
+void defrag_done (void);
+
+#endif /* filesys/defrag.h */
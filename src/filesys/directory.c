@@ -1,16 +1,47 @@
 #include "filesys/directory.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Name index of an open directory inode, shared by every
+   struct dir open on it.  Built on the first lookup and then kept
+   in sync by dir_add() and dir_remove().  LOCK serializes every
+   operation on the directory's entries, and guards the index
+   itself; open_indexes_lock guards ELEM and OPEN_CNT. */
+struct dir_index
+  {
+    struct list_elem elem;              /* Element in open_indexes. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    int open_cnt;                       /* Number of struct dirs. */
+    struct lock lock;                   /* The directory's lock. */
+    bool built;                         /* NAMES filled in yet? */
+    struct hash names;                  /* struct dir_name, by name. */
+    size_t free_slot;                   /* No free slot before here. */
+  };
+
+/* An entry of a directory index. */
+struct dir_name
+  {
+    struct hash_elem elem;              /* Element in dir_index names. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    size_t slot;                        /* Slot of the dir_entry. */
+  };
 
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    struct dir_index *index;            /* Name index of INODE. */
   };
 
 /* A single directory entry. */
@@ -18,15 +49,263 @@ struct dir_entry
   {
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
-    bool in_use;                        /* In use or free? */
   };
 
+/* A directory's data is an array of blocks, each one sector and
+   holding DIR_BLOCK_ENTRIES entry slots, so that no entry
+   straddles a sector.  Slot N is entry N % DIR_BLOCK_ENTRIES of
+   block N / DIR_BLOCK_ENTRIES.  The head of a block says which of
+   its slots are in use and keeps a byte of each one's name hash,
+   so that a scan compares only the names that may match. */
+#define DIR_BLOCK_ENTRIES 24
+
+struct dir_head
+  {
+    uint32_t used;                      /* Bit N set if slot N in use. */
+    uint8_t hints[DIR_BLOCK_ENTRIES];   /* Low byte of each name's hash. */
+  };
+
+struct dir_block
+  {
+    struct dir_head head;
+    struct dir_entry entries[DIR_BLOCK_ENTRIES];
+    uint8_t unused[BLOCK_SECTOR_SIZE - sizeof (struct dir_head)
+                   - DIR_BLOCK_ENTRIES * sizeof (struct dir_entry)];
+  };
+
+/* Byte offsets of block BLK and of the entry in SLOT. */
+#define BLOCK_OFS(BLK) ((off_t) (BLK) * BLOCK_SECTOR_SIZE)
+#define SLOT_OFS(SLOT)                                          \
+  (BLOCK_OFS ((SLOT) / DIR_BLOCK_ENTRIES)                       \
+   + (off_t) offsetof (struct dir_block, entries)               \
+   + (off_t) ((SLOT) % DIR_BLOCK_ENTRIES) * sizeof (struct dir_entry))
+
+/* Returns NAME's hint byte. */
+static uint8_t
+name_hint (const char *name)
+{
+  return hash_string (name);
+}
+
+/* Reads the head of DIR's block BLK into *HEAD.  Returns false
+   past the end of the directory. */
+static bool
+read_head (const struct dir *dir, size_t blk, struct dir_head *head)
+{
+  return inode_read_at (dir->inode, head, sizeof *head, BLOCK_OFS (blk))
+         == sizeof *head;
+}
+
+/* Reads the entry in DIR's SLOT into *E. */
+static bool
+read_entry (const struct dir *dir, size_t slot, struct dir_entry *e)
+{
+  return inode_read_at (dir->inode, e, sizeof *e, SLOT_OFS (slot))
+         == sizeof *e;
+}
+
+/* Marks DIR's SLOT in use with entry E, or free if E is null.
+   Both writes land in the slot's own sector.  The entry is
+   written before the head marks it in use, and the head marks it
+   free first. */
+static bool
+write_slot (struct dir *dir, size_t slot, const struct dir_entry *e)
+{
+  size_t blk = slot / DIR_BLOCK_ENTRIES;
+  uint32_t bit = 1u << (slot % DIR_BLOCK_ENTRIES);
+  struct dir_head head;
+
+  if (!read_head (dir, blk, &head))
+    memset (&head, 0, sizeof head);
+  if (e != NULL)
+    {
+      if (inode_write_at (dir->inode, e, sizeof *e, SLOT_OFS (slot))
+          != sizeof *e)
+        return false;
+      head.used |= bit;
+      head.hints[slot % DIR_BLOCK_ENTRIES] = name_hint (e->name);
+    }
+  else
+    head.used &= ~bit;
+  return inode_write_at (dir->inode, &head, sizeof head, BLOCK_OFS (blk))
+         == sizeof head;
+}
+
+/* Indexes of open directories, like the list of open inodes. */
+static struct list open_indexes;
+static struct lock open_indexes_lock;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  list_init (&open_indexes);
+  lock_init (&open_indexes_lock);
+}
+
+static unsigned
+dir_name_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct dir_name, elem)->name);
+}
+
+static bool
+dir_name_less (const struct hash_elem *a, const struct hash_elem *b,
+               void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct dir_name, elem)->name,
+                 hash_entry (b, struct dir_name, elem)->name) < 0;
+}
+
+static void
+dir_name_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct dir_name, elem));
+}
+
+/* Returns the index of the directory in SECTOR, with one more
+   opener, or a null pointer if memory is short. */
+static struct dir_index *
+index_open (block_sector_t sector)
+{
+  struct dir_index *index;
+  struct list_elem *e;
+
+  lock_acquire (&open_indexes_lock);
+  for (e = list_begin (&open_indexes); e != list_end (&open_indexes);
+       e = list_next (e))
+    {
+      index = list_entry (e, struct dir_index, elem);
+      if (index->sector == sector)
+        {
+          index->open_cnt++;
+          goto done;
+        }
+    }
+
+  index = malloc (sizeof *index);
+  if (index == NULL)
+    goto done;
+  if (!hash_init (&index->names, dir_name_hash, dir_name_less, NULL))
+    {
+      free (index);
+      index = NULL;
+      goto done;
+    }
+  index->sector = sector;
+  index->open_cnt = 1;
+  lock_init (&index->lock);
+  index->built = false;
+  index->free_slot = 0;
+  list_push_front (&open_indexes, &index->elem);
+
+ done:
+  lock_release (&open_indexes_lock);
+  return index;
+}
+
+/* Drops an opener of INDEX, freeing it after the last one. */
+static void
+index_close (struct dir_index *index)
+{
+  bool last;
+
+  lock_acquire (&open_indexes_lock);
+  last = --index->open_cnt == 0;
+  if (last)
+    list_remove (&index->elem);
+  lock_release (&open_indexes_lock);
+
+  if (last)
+    {
+      hash_destroy (&index->names, dir_name_free);
+      free (index);
+    }
+}
+
+/* Adds NAME, in the entry in SLOT naming INODE_SECTOR, to INDEX.
+   Returns false if memory is short. */
+static bool
+index_insert (struct dir_index *index, const char *name,
+              block_sector_t inode_sector, size_t slot)
+{
+  struct dir_name *n = malloc (sizeof *n);
+  if (n == NULL)
+    return false;
+  strlcpy (n->name, name, sizeof n->name);
+  n->inode_sector = inode_sector;
+  n->slot = slot;
+  hash_insert (&index->names, &n->elem);
+  return true;
+}
+
+/* Returns the index entry for NAME, or a null pointer. */
+static struct dir_name *
+index_find (struct dir_index *index, const char *name)
+{
+  struct dir_name key;
+  struct hash_elem *e;
+
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&index->names, &key.elem);
+  return e != NULL ? hash_entry (e, struct dir_name, elem) : NULL;
+}
+
+/* Fills DIR's index from the entries on disk, if not done yet,
+   reading a block at a time.  The last block may be cut short
+   after its last entry in use.  Returns false if memory is
+   short. */
+static bool
+index_build (const struct dir *dir)
+{
+  struct dir_index *index = dir->index;
+  struct dir_block *b;
+  bool free_seen = false;
+  size_t blk, i;
+
+  if (index->built)
+    return true;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  for (blk = 0; inode_read_at (dir->inode, b, sizeof *b, BLOCK_OFS (blk))
+                >= (off_t) sizeof b->head; blk++)
+    for (i = 0; i < DIR_BLOCK_ENTRIES; i++)
+      {
+        size_t slot = blk * DIR_BLOCK_ENTRIES + i;
+        struct dir_entry *e = &b->entries[i];
+
+        if (!(b->head.used & (1u << i)))
+          {
+            if (!free_seen)
+              index->free_slot = slot;
+            free_seen = true;
+          }
+        else if (!index_insert (index, e->name, e->inode_sector, slot))
+          {
+            hash_clear (&index->names, dir_name_free);
+            free (b);
+            return false;
+          }
+      }
+  if (!free_seen)
+    index->free_slot = blk * DIR_BLOCK_ENTRIES;
+  free (b);
+  index->built = true;
+  return true;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, held in the directory at PARENT.  Returns true if
+   successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  ASSERT (sizeof (struct dir_block) == BLOCK_SECTOR_SIZE);
+  return inode_create (sector, BLOCK_OFS (DIV_ROUND_UP (entry_cnt,
+                                                        DIR_BLOCK_ENTRIES)),
+                       parent);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -35,7 +314,8 @@ struct dir *
 dir_open (struct inode *inode) 
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL
+      && (dir->index = index_open (inode_get_inumber (inode))) != NULL)
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -71,6 +351,7 @@ dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
+      index_close (dir->index);
       inode_close (dir->inode);
       free (dir);
     }
@@ -85,49 +366,90 @@ dir_get_inode (struct dir *dir)
 
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   if EP is non-null, and sets *SLOTP to the slot of the
+   directory entry if SLOTP is non-null.
+   otherwise, returns false and ignores EP and SLOTP.
+   Uses the directory's name index, falling back to a scan of the
+   blocks only if the index can't be built for lack of memory.
+   The directory's lock must be held. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+        struct dir_entry *ep, size_t *slotp) 
 {
+  struct dir_head head;
   struct dir_entry e;
-  size_t ofs;
+  uint8_t hint;
+  size_t blk, i;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  if (index_build (dir))
+    {
+      struct dir_name *n = index_find (dir->index, name);
+      if (n == NULL)
+        return false;
+      if (ep != NULL)
+        {
+          ep->inode_sector = n->inode_sector;
+          strlcpy (ep->name, n->name, sizeof ep->name);
+        }
+      if (slotp != NULL)
+        *slotp = n->slot;
+      return true;
+    }
+
+  /* Only the entries whose hint matches are read. */
+  hint = name_hint (name);
+  for (blk = 0; read_head (dir, blk, &head); blk++)
+    for (i = 0; i < DIR_BLOCK_ENTRIES; i++)
+      if ((head.used & (1u << i)) && head.hints[i] == hint
+          && read_entry (dir, blk * DIR_BLOCK_ENTRIES + i, &e)
+          && !strcmp (name, e.name))
+        {
+          if (ep != NULL)
+            *ep = e;
+          if (slotp != NULL)
+            *slotp = blk * DIR_BLOCK_ENTRIES + i;
+          return true;
+        }
   return false;
 }
 
 /* Searches DIR for a file with the given NAME
-   and returns true if one exists, false otherwise.
+   and returns true if one exists, false otherwise.  "." names
+   DIR itself and ".." the directory holding it.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   The outcome is recorded in the path name lookup cache. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t sector = inode_get_inumber (dir->inode);
   struct dir_entry e;
+  bool cache;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
+  /* A removed directory's sector may be reused, so nothing found
+     in it is cached. */
+  lock_acquire (&dir->index->lock);
+  cache = !inode_is_removed (dir->inode);
+  *inode = NULL;
+  if (!strcmp (name, "."))
+    *inode = inode_reopen (dir->inode);
+  else if (!strcmp (name, ".."))
+    *inode = inode_open (inode_get_parent (dir->inode));
+  else if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  else if (cache)
+    dcache_insert (sector, name, 0, false);
+  if (*inode != NULL && cache)
+    dcache_insert (sector, name, inode_get_inumber (*inode),
+                   inode_is_dir (*inode));
+  lock_release (&dir->index->lock);
 
   return *inode != NULL;
 }
@@ -136,101 +458,198 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long, "." or ".."), DIR has
+   been removed, or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_head head;
   struct dir_entry e;
-  off_t ofs;
+  size_t slot;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX
+      || !strcmp (name, ".") || !strcmp (name, ".."))
     return false;
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  lock_acquire (&dir->index->lock);
+  if (inode_is_removed (dir->inode) || lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  /* Set SLOT to a free slot, checking a block's head for one.
+     If there are no free slots, then it will be set to the first
+     slot of a new block at the end of file.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+     read due to something intermittent such as low memory.
+
+     No slot before the index's free_slot is free, so start there. */
+  slot = dir->index->built ? dir->index->free_slot : 0;
+  while (read_head (dir, slot / DIR_BLOCK_ENTRIES, &head))
+    {
+      size_t i;
+      for (i = slot % DIR_BLOCK_ENTRIES; i < DIR_BLOCK_ENTRIES; i++, slot++)
+        if (!(head.used & (1u << i)))
+          goto found;
+    }
+ found:
 
   /* Write slot. */
-  e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = write_slot (dir, slot, &e);
+  if (success)
+    dcache_invalidate (inode_get_inumber (dir->inode), name);
+
+  /* Keep the index in sync.  If that fails for lack of memory,
+     throw it away; it is rebuilt on the next lookup. */
+  if (success && dir->index->built)
+    {
+      dir->index->free_slot = slot + 1;
+      if (!index_insert (dir->index, name, inode_sector, slot))
+        {
+          hash_clear (&dir->index->names, dir_name_free);
+          dir->index->built = false;
+        }
+    }
 
  done:
+  lock_release (&dir->index->lock);
   return success;
 }
 
+/* Returns true if DIR has no entries.  DIR's lock must be
+   held. */
+static bool
+is_empty (const struct dir *dir)
+{
+  struct dir_head head;
+  size_t blk;
+
+  if (index_build (dir))
+    return hash_empty (&dir->index->names);
+  for (blk = 0; read_head (dir, blk, &head); blk++)
+    if (head.used != 0)
+      return false;
+  return true;
+}
+
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs if
+   there is no file with the given NAME, or it is a directory
+   that is not empty. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  struct dir *child = NULL;
   bool success = false;
-  off_t ofs;
+  size_t slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  lock_acquire (&dir->index->lock);
+  if (!lookup (dir, name, &e, &slot))
     goto done;
 
-  /* Open inode. */
+  /* Open inode.  A directory stays locked from the check that it
+     is empty until it is marked removed, after which nothing can
+     be added to it. */
   inode = inode_open (e.inode_sector);
   if (inode == NULL)
     goto done;
+  if (inode_is_dir (inode))
+    {
+      child = dir_open (inode_reopen (inode));
+      if (child == NULL)
+        goto done;
+      lock_acquire (&child->index->lock);
+      if (!is_empty (child))
+        goto done;
+    }
 
   /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  if (!write_slot (dir, slot, NULL))
     goto done;
+  if (dir->index->built)
+    {
+      struct dir_name *n = index_find (dir->index, name);
+      hash_delete (&dir->index->names, &n->elem);
+      free (n);
+      if (slot < dir->index->free_slot)
+        dir->index->free_slot = slot;
+    }
 
   /* Remove inode. */
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  if (child != NULL)
+    dcache_forget_dir (e.inode_sector);
   inode_remove (inode);
   success = true;
 
  done:
+  if (child != NULL)
+    {
+      lock_release (&child->index->lock);
+      dir_close (child);
+    }
+  lock_release (&dir->index->lock);
   inode_close (inode);
   return success;
 }
 
+/* Sets the position of DIR's next dir_readdir() to POS. */
+void
+dir_seek (struct dir *dir, off_t pos)
+{
+  dir->pos = pos;
+}
+
+/* Returns the position of DIR's next dir_readdir(). */
+off_t
+dir_tell (const struct dir *dir)
+{
+  return dir->pos;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
-   NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   NAME and, if SECTOR is nonnull, the sector of its inode in
+   *SECTOR.  Returns true if successful, false if the directory
+   contains no more entries.  A position is a slot number; free
+   slots are skipped by their block's head, without reading
+   them. */
 bool
-dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+dir_readdir (struct dir *dir, char name[NAME_MAX + 1], block_sector_t *sector)
 {
+  struct dir_head head;
   struct dir_entry e;
+  bool success = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
-    {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
-    }
-  return false;
+  lock_acquire (&dir->index->lock);
+  while (!success && dir->pos >= 0
+         && read_head (dir, dir->pos / DIR_BLOCK_ENTRIES, &head))
+    do
+      {
+        size_t slot = dir->pos++;
+        if ((head.used & (1u << (slot % DIR_BLOCK_ENTRIES)))
+            && read_entry (dir, slot, &e))
+          {
+            strlcpy (name, e.name, NAME_MAX + 1);
+            if (sector != NULL)
+              *sector = e.inode_sector;
+            success = true;
+          }
+      }
+    while (!success && dir->pos % DIR_BLOCK_ENTRIES != 0);
+  lock_release (&dir->index->lock);
+  return success;
 }
@@ -1,8 +1,15 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
 #include "filesys/inode.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window of a sequential reader, in sectors: where it
+   starts, and the most it grows to. */
+#define RA_MIN 2
+#define RA_MAX 16
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -15,6 +22,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ref_cnt = 1;
       return file;
     }
   else
@@ -33,12 +41,30 @@ file_reopen (struct file *file)
   return file_open (inode_reopen (file->inode));
 }
 
-/* Closes FILE. */
+/* Returns FILE itself, which then takes one more file_close()
+   to close.  Unlike file_reopen(), the two share a position. */
+struct file *
+file_dup (struct file *file)
+{
+  enum intr_level old_level = intr_disable ();
+  file->ref_cnt++;
+  intr_set_level (old_level);
+  return file;
+}
+
+/* Closes FILE, unless file_dup() has given out other references
+   to it, in which case it drops one of them. */
 void
 file_close (struct file *file) 
 {
   if (file != NULL)
     {
+      enum intr_level old_level = intr_disable ();
+      bool last = --file->ref_cnt == 0;
+      intr_set_level (old_level);
+      if (!last)
+        return;
+
       file_allow_write (file);
       inode_close (file->inode);
       free (file); 
@@ -52,6 +78,42 @@ file_get_inode (struct file *file)
   return file->inode;
 }
 
+/* Notes that BYTES bytes were just read from FILE at OFS.  A read
+   that continues the previous one doubles FILE's read-ahead window,
+   up to RA_MAX sectors, and has the sectors in the window past
+   what was read brought into the cache in the background.  Any
+   other read closes the window. */
+static void
+readahead (struct file *file, off_t ofs, off_t bytes)
+{
+  off_t start, end;
+
+  if (bytes == 0)
+    return;
+  if (ofs == file->ra_next)
+    file->ra_window = (file->ra_window == 0 ? RA_MIN
+                       : file->ra_window * 2 < RA_MAX
+                       ? file->ra_window * 2 : RA_MAX);
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  file->ra_next = ofs + bytes;
+  if (file->ra_window == 0)
+    return;
+
+  start = ROUND_UP (file->ra_next, BLOCK_SECTOR_SIZE);
+  end = start + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (start < file->ra_end)
+    start = file->ra_end;
+  if (start < end)
+    {
+      inode_readahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -61,6 +123,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  readahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -73,20 +136,21 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  readahead (file, file_ofs, bytes_read);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written = file_write_at (file, buffer, size, file->pos);
   file->pos += bytes_written;
   return bytes_written;
 }
@@ -94,17 +158,58 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.  Directories can't
+   be written this way.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
                off_t file_ofs) 
 {
+  if (inode_is_dir (file->inode))
+    return 0;
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies up to SIZE bytes from SRC to DST, starting at the
+   current position of each and advancing both.  The data moves
+   through the buffer cache one destination sector at a time, so
+   that sectors DST is wholly overwriting needn't be read first.
+   Returns the number of bytes actually copied, which may be less
+   than SIZE if end of SRC is reached or DST cannot be written. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size) 
+{
+  uint8_t buffer[BLOCK_SECTOR_SIZE];
+  off_t copied = 0;
+
+  ASSERT (dst != NULL);
+  ASSERT (src != NULL);
+
+  if (inode_is_dir (dst->inode))
+    return 0;
+
+  while (size > 0)
+    {
+      int sector_left = BLOCK_SECTOR_SIZE - dst->pos % BLOCK_SECTOR_SIZE;
+      off_t chunk = size < sector_left ? size : sector_left;
+      off_t bytes_read, bytes_written;
+
+      bytes_read = inode_read_at (src->inode, buffer, chunk, src->pos);
+      if (bytes_read == 0)
+        break;
+      bytes_written = inode_write_at (dst->inode, buffer, bytes_read,
+                                      dst->pos);
+      src->pos += bytes_written;
+      dst->pos += bytes_written;
+      copied += bytes_written;
+      size -= bytes_written;
+      if (bytes_written < chunk)
+        break;
+    }
+  return copied;
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -141,13 +246,19 @@ file_length (struct file *file)
 }
 
 /* Sets the current position in FILE to NEW_POS bytes from the
-   start of the file. */
+   start of the file.  Seeking anywhere but where the last read
+   ended closes the read-ahead window. */
 void
 file_seek (struct file *file, off_t new_pos)
 {
   ASSERT (file != NULL);
   ASSERT (new_pos >= 0);
   file->pos = new_pos;
+  if (new_pos != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
 }
 
 /* Returns the current position in FILE as a byte offset from the
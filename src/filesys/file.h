@@ -10,6 +10,12 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Where a read continuing the last
+                                   one would start. */
+    off_t ra_end;               /* End of what was read ahead. */
+    int ra_window;              /* Sectors to keep read ahead; 0 while
+                                   reads are not sequential. */
+    int ref_cnt;                /* file_close() calls until closed. */
   };
 
 struct inode;
@@ -17,6 +23,7 @@ struct inode;
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
+struct file *file_dup (struct file *);
 void file_close (struct file *);
 struct inode *file_get_inode (struct file *);
 
@@ -25,6 +32,7 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_copy (struct file *dst, struct file *src, off_t size);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
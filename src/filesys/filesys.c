@@ -2,16 +2,96 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/defrag.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/image.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
+#include "filesys/stats.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
 static void do_format (void);
 
+/* A file system type.  These operations are all that differ
+   between file systems here: everything else goes through the
+   inode, whose own operations know where its data lives. */
+struct fs_ops
+  {
+    const char *name;                   /* For filesys_mount(). */
+
+    /* Creates the root directory of a new instance, to be mounted
+       in the directory at PARENT, and stores its inumber into
+       *ROOT.  Null if the type cannot be mounted. */
+    bool (*mount) (block_sector_t parent, block_sector_t *root);
+
+    /* Creates a file LENGTH bytes long or, if IS_DIR, a
+       directory, for the directory at PARENT, and stores its
+       inumber into *SECTOR. */
+    bool (*create) (block_sector_t parent, off_t length, bool is_dir,
+                    block_sector_t *sector);
+
+    /* Frees the inode made by create() at SECTOR, which no
+       directory refers to. */
+    void (*release) (block_sector_t sector);
+  };
+
+static bool disk_create (block_sector_t, off_t, bool, block_sector_t *);
+static void disk_release (block_sector_t);
+static bool tmpfs_mount (block_sector_t, block_sector_t *);
+static bool tmpfs_create (block_sector_t, off_t, bool, block_sector_t *);
+static void tmpfs_release (block_sector_t);
+
+/* The file system on fs_device, mounted at the root.  The buffer
+   cache and free map serve only the one device, so it cannot be
+   mounted again. */
+static const struct fs_ops disk_ops =
+  { "disk", NULL, disk_create, disk_release };
+
+/* File systems held in memory. */
+static const struct fs_ops tmpfs_ops =
+  { "tmpfs", tmpfs_mount, tmpfs_create, tmpfs_release };
+
+/* A packed image on the scratch device, read in place.  Its
+   directories are in memory, so fs_of() takes its inodes for a
+   tmpfs's, which is how anything created in them is made. */
+static const struct fs_ops image_ops =
+  { "image", image_mount, tmpfs_create, tmpfs_release };
+
+/* Types filesys_mount() knows. */
+static const struct fs_ops *const fs_types[] =
+  { &disk_ops, &tmpfs_ops, &image_ops };
+
+/* A file system mounted over a directory of another.  Looking up
+   the directory leads to the root of the mounted one.  Mounts are
+   made at boot, before other threads use the file system, so they
+   need no lock. */
+struct mount
+  {
+    block_sector_t covered;             /* Directory mounted on. */
+    block_sector_t root;                /* Its root directory. */
+  };
+
+#define MOUNT_MAX 4
+static struct mount mounts[MOUNT_MAX];
+static size_t mount_cnt;
+
+/* Returns the type of the file system holding the inode at
+   SECTOR.  All disk inodes are on fs_device, and all inodes in
+   memory belong to a tmpfs. */
+static const struct fs_ops *
+fs_of (block_sector_t sector)
+{
+  return inode_in_memory (sector) ? &tmpfs_ops : &disk_ops;
+}
+
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
@@ -21,7 +101,12 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
+  journal_init (format);
   inode_init ();
+  defrag_init ();
+  dir_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
@@ -35,9 +120,203 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  /* Files being defragmented, and removed files still being
+     freed, would leave sectors in use.  Waiting for them needs
+     interrupts on, as below. */
+  if (intr_get_level () == INTR_ON)
+    {
+      defrag_done ();
+      inode_done ();
+    }
   free_map_close ();
+
+  /* Write-behind data can only reach the disk with interrupts on,
+     which is not the case when we get here from a kernel panic. */
+  if (intr_get_level () == INTR_ON)
+    journal_done ();
 }
 
+/* Path names.
+
+   A path is a sequence of names separated by slashes, resolved
+   from the root directory if it starts with a slash and from the
+   current directory otherwise.  Each directory on the way is
+   looked up in the path name lookup cache first, so that
+   resolving a familiar path opens no directories at all.  A
+   directory with a tmpfs mounted on it stands for the tmpfs's
+   root. */
+
+/* Returns the sector of the root of the file system mounted on
+   the directory at SECTOR, or SECTOR if there is none. */
+static block_sector_t
+mount_cover (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < mount_cnt; i++)
+    if (mounts[i].covered == sector)
+      return mounts[i].root;
+  return sector;
+}
+
+/* Returns true if SECTOR is the root of a mounted file system. */
+static bool
+is_mount_root (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < mount_cnt; i++)
+    if (mounts[i].root == sector)
+      return true;
+  return false;
+}
+
+/* Looks up NAME in the directory at sector DIR and stores the
+   sector of the inode it leads to into *SECTOR.  Returns false
+   if there is no such name or memory is short.  Stores into
+   *IS_DIR whether the inode is a directory. */
+static bool
+walk (block_sector_t dir, const char *name, block_sector_t *sector,
+      bool *is_dir)
+{
+  if (!dcache_lookup (dir, name, sector, is_dir))
+    {
+      struct dir *d = dir_open (inode_open (dir));
+      struct inode *inode = NULL;
+
+      if (d != NULL)
+        dir_lookup (d, name, &inode);
+      dir_close (d);
+      if (inode == NULL)
+        return false;
+      *sector = inode_get_inumber (inode);
+      *is_dir = inode_is_dir (inode);
+      inode_close (inode);
+    }
+  if (*is_dir)
+    *sector = mount_cover (*sector);
+  return *sector != 0;
+}
+
+/* Resolves all of PATH but its last name, storing the sector of
+   the directory that should hold it into *DIR and the name
+   itself into NAME, or "." if PATH has no names, as for "/".
+   Returns false if PATH is empty, a name in it is too long, or a
+   directory along it doesn't exist. */
+static bool
+resolve (const char *path, block_sector_t *dir, char name[NAME_MAX + 1])
+{
+  struct dir *cwd = thread_current ()->process->cwd;
+
+  if (*path == '\0')
+    return false;
+  *dir = (*path == '/' || cwd == NULL
+          ? ROOT_DIR_SECTOR : inode_get_inumber (dir_get_inode (cwd)));
+  strlcpy (name, ".", NAME_MAX + 1);
+  for (;;)
+    {
+      size_t len;
+      bool is_dir;
+
+      while (*path == '/')
+        path++;
+      if (*path == '\0')
+        return true;
+      len = strcspn (path, "/");
+      if (len > NAME_MAX)
+        return false;
+      memcpy (name, path, len);
+      name[len] = '\0';
+      path += len;
+
+      while (*path == '/')
+        path++;
+      if (*path == '\0')
+        return true;
+      if (!walk (*dir, name, dir, &is_dir) || !is_dir)
+        return false;
+    }
+}
+
+/* Opens the directory at sector DIR for modification. */
+static struct dir *
+open_dir (block_sector_t dir)
+{
+  return dir_open (inode_open (dir));
+}
+
+static bool
+disk_create (block_sector_t parent, off_t length, bool is_dir,
+             block_sector_t *sector)
+{
+  /* Place the inode near its directory's. */
+  if (!free_map_allocate (parent, 1, sector))
+    return false;
+  if (is_dir ? dir_create (*sector, 16, parent)
+      : inode_create (*sector, length, 0))
+    return true;
+  free_map_release (*sector, 1);
+  return false;
+}
+
+static void
+disk_release (block_sector_t sector)
+{
+  free_map_release (sector, 1);
+}
+
+static bool
+tmpfs_mount (block_sector_t parent, block_sector_t *root)
+{
+  return inode_create_mem (0, parent, root);
+}
+
+static bool
+tmpfs_create (block_sector_t parent, off_t length, bool is_dir,
+              block_sector_t *sector)
+{
+  return inode_create_mem (is_dir ? 0 : length, is_dir ? parent : 0, sector);
+}
+
+static void
+tmpfs_release (block_sector_t sector)
+{
+  struct inode *inode = inode_open (sector);
+
+  inode_remove (inode);
+  inode_close (inode);
+}
+
+/* Creates a file or, if IS_DIR, a directory named PATH, with the
+   given INITIAL_SIZE, in whichever file system holds the
+   directory it goes in. */
+static bool
+create (const char *path, off_t initial_size, bool is_dir)
+{
+  char name[NAME_MAX + 1];
+  block_sector_t parent, inode_sector;
+  const struct fs_ops *ops;
+  struct dir *dir;
+  bool success = false;
+
+  if (!resolve (path, &parent, name))
+    return false;
+  ops = fs_of (parent);
+  journal_begin ();
+  dir = open_dir (parent);
+  if (dir != NULL
+      && ops->create (parent, initial_size, is_dir, &inode_sector))
+    {
+      success = dir_add (dir, name, inode_sector);
+      if (!success)
+        ops->release (inode_sector);
+    }
+  dir_close (dir);
+  journal_end ();
+
+  return success;
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -45,58 +324,142 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
-  dir_close (dir);
+  return create (name, initial_size, false);
+}
 
-  return success;
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  return create (name, 0, true);
+}
+
+/* Opens the file or directory at PATH and returns its inode, or
+   a null pointer. */
+static struct inode *
+open_inode (const char *path)
+{
+  char name[NAME_MAX + 1];
+  block_sector_t dir, sector;
+  struct inode *inode = NULL;
+  bool is_dir;
+
+  if (!resolve (path, &dir, name))
+    return NULL;
+  if (walk (dir, name, &sector, &is_dir))
+    inode = inode_open (sector);
+  return inode;
 }
 
 /* Opens the file with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   or if an internal memory allocation fails.
+   Names under STATS_DIR open statistics files instead. */
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  struct inode *inode = NULL;
+  if (stats_is_path (name))
+    return file_open (stats_open (name));
+  return file_open (open_inode (name));
+}
 
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
-  dir_close (dir);
+/* Makes the directory named NAME the running thread's current
+   directory.  Returns true if successful, false if there is no
+   such directory or memory is short. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *t = thread_current ()->process;
+  struct inode *inode = open_inode (name);
+  struct dir *dir;
 
-  return file_open (inode);
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char last[NAME_MAX + 1];
+  block_sector_t parent, sector;
+  struct dir *dir;
+  bool success, is_dir;
+
+  if (!resolve (name, &parent, last))
+    return false;
+  /* Keep mount points. */
+  if (walk (parent, last, &sector, &is_dir) && is_mount_root (sector))
+    return false;
+  journal_begin ();
+  dir = open_dir (parent);
+  success = dir != NULL && dir_remove (dir, last);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
-
+
+/* Mounts a new file system of the type named TYPE, such as
+   "tmpfs", whose files live only in memory, on the directory at
+   PATH, creating that first if it does not exist.  Returns false
+   if there is no such type or it cannot be mounted, PATH is the
+   root directory or not on the disk, it is not a directory, or
+   there is no memory or room in the mount table. */
+bool
+filesys_mount (const char *type, const char *path)
+{
+  const struct fs_ops *ops = NULL;
+  struct inode *inode;
+  struct mount *m;
+  bool success = false;
+  size_t i;
+
+  for (i = 0; i < sizeof fs_types / sizeof *fs_types; i++)
+    if (!strcmp (fs_types[i]->name, type))
+      ops = fs_types[i];
+  if (ops == NULL || ops->mount == NULL || mount_cnt >= MOUNT_MAX)
+    return false;
+  filesys_mkdir (path);
+  inode = open_inode (path);
+  m = &mounts[mount_cnt];
+  if (inode != NULL && inode_is_dir (inode)
+      && inode_get_inumber (inode) != ROOT_DIR_SECTOR
+      && fs_of (inode_get_inumber (inode)) == &disk_ops)
+    {
+      m->covered = inode_get_inumber (inode);
+      success = ops->mount (inode_get_parent (inode), &m->root);
+      if (success)
+        mount_cnt++;
+    }
+  inode_close (inode);
+  return success;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
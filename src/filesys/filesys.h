@@ -7,6 +7,7 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* Metadata journal header sector. */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
@@ -16,5 +17,8 @@ void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+bool filesys_mkdir (const char *name);
+bool filesys_chdir (const char *name);
+bool filesys_mount (const char *type, const char *path);
 
 #endif /* filesys/filesys.h */
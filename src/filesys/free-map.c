@@ -1,12 +1,131 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The disk is divided into block groups of GROUP_SECTORS
+   sectors, and the number of free sectors in each is kept, so
+   that allocation can skip groups that are full instead of
+   scanning their bits. */
+#define GROUP_SECTORS 4096
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty;         /* Free map file sectors changed
+                                        since last written. */
+static size_t *group_free;           /* Free sectors in each group. */
+static size_t group_cnt;             /* Number of block groups. */
+static size_t free_cnt;              /* Free sectors in all groups. */
+static size_t reserved_cnt;          /* Free sectors promised to data
+                                        not yet given sectors. */
+static struct lock free_map_lock;    /* Protects the members above. */
+
+/* Bits of the free map held by one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Marks the CNT sectors starting at SECTOR as USED or free,
+   adjusting the group counts and noting the changed bits for
+   write_dirty().  free_map_lock must be held. */
+static void
+mark (block_sector_t sector, size_t cnt, bool used)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  block_sector_t end = sector + cnt;
+  block_sector_t s;
+
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  bitmap_set_multiple (dirty, first, last - first + 1, true);
+  for (s = sector; s < end; s = ROUND_DOWN (s, GROUP_SECTORS) + GROUP_SECTORS)
+    {
+      block_sector_t group_end = ROUND_DOWN (s, GROUP_SECTORS) + GROUP_SECTORS;
+      size_t n = (end < group_end ? end : group_end) - s;
+
+      if (used)
+        {
+          group_free[s / GROUP_SECTORS] -= n;
+          free_cnt -= n;
+        }
+      else
+        {
+          group_free[s / GROUP_SECTORS] += n;
+          free_cnt += n;
+        }
+    }
+}
+
+/* Writes the sectors of the free map file whose bits have
+   changed, if the file is open.  They go to the journal, as part
+   of the running operation.  free_map_lock must be held. */
+static void
+write_dirty (void)
+{
+  size_t size = bitmap_file_size (free_map);
+  size_t i;
+
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (dirty); i++)
+      if (bitmap_test (dirty, i))
+        {
+          size_t ofs = i * BLOCK_SECTOR_SIZE;
+          size_t cnt = size - ofs < BLOCK_SECTOR_SIZE ? size - ofs
+                                                      : BLOCK_SECTOR_SIZE;
+          if (!bitmap_write_part (free_map, free_map_file, ofs, cnt))
+            PANIC ("can't write free map");
+          bitmap_reset (dirty, i);
+        }
+}
+
+/* Recomputes every group's free count from the free map. */
+static void
+count_groups (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t g;
+
+  free_cnt = 0;
+  for (g = 0; g < group_cnt; g++)
+    {
+      size_t start = g * GROUP_SECTORS;
+      size_t len = size - start < GROUP_SECTORS ? size - start : GROUP_SECTORS;
+      group_free[g] = bitmap_count (free_map, start, len, false);
+      free_cnt += group_free[g];
+    }
+}
+
+/* Returns true if CNT sectors can be allocated without taking
+   any that are reserved.  free_map_lock must be held. */
+static bool
+unreserved (size_t cnt)
+{
+  return free_cnt >= reserved_cnt && free_cnt - reserved_cnt >= cnt;
+}
+
+/* Returns the first of CNT free sectors in a row starting in
+   group G, at or after FROM, or BITMAP_ERROR.  The run may reach
+   into the groups after G.  free_map_lock must be held. */
+static block_sector_t
+scan_group (size_t g, block_sector_t from, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t end = (g + 1) * GROUP_SECTORS;
+  size_t s;
+
+  if (from < g * GROUP_SECTORS)
+    from = g * GROUP_SECTORS;
+  if (end > size)
+    end = size;
+  for (s = from; s < end && s + cnt <= size; s++)
+    if (bitmap_none (free_map, s, cnt))
+      return s;
+  return BITMAP_ERROR;
+}
 
 /* Initializes the free map. */
 void
@@ -15,38 +134,179 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                       BLOCK_SECTOR_SIZE));
+  if (dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("can't allocate block group table");
+  lock_init (&free_map_lock);
+  lock_set_name (&free_map_lock, "free map");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  count_groups ();
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Allocates CNT consecutive sectors from the free map, as close
+   after sector GOAL as possible, and stores the first into
+   *SECTORP.  The search starts at GOAL and goes group by group,
+   wrapping around to the start of the disk, scanning the bits
+   only of groups whose free count leaves room.  A run of more
+   than a group is looked for by a plain scan.  The changed free
+   map sectors are written in the same journal transaction as
+   whatever the caller does with the new ones.  Reserved sectors
+   are left free.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate (block_sector_t goal, size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector = BITMAP_ERROR;
+  size_t i;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  if (cnt <= GROUP_SECTORS)
+    for (i = 0; i <= group_cnt && sector == BITMAP_ERROR; i++)
+      {
+        /* The goal's group comes up again last, for the sectors
+           before the goal.  A run starting in G ends in G or the
+           group after it. */
+        size_t g = (goal / GROUP_SECTORS + i) % group_cnt;
+        size_t room = group_free[g];
+
+        if (g + 1 < group_cnt)
+          room += group_free[g + 1];
+        if (group_free[g] > 0 && room >= cnt)
+          sector = scan_group (g, i == 0 ? goal : 0, cnt);
+      }
+  else
+    sector = bitmap_scan (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR && !unreserved (cnt))
+    sector = BITMAP_ERROR;
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark (sector, cnt, true);
+      write_dirty ();
     }
+  lock_release (&free_map_lock);
+  journal_end ();
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates the CNT sectors starting at SECTOR, if they are all
+   free, so that a file can grow in place.
+   Returns true if successful, false if any of them is in use. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  bool success = false;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  if (unreserved (cnt) && sector < bitmap_size (free_map)
+      && cnt <= bitmap_size (free_map) - sector
+      && bitmap_none (free_map, sector, cnt))
+    {
+      mark (sector, cnt, true);
+      write_dirty ();
+      success = true;
+    }
+  lock_release (&free_map_lock);
+  journal_end ();
+  return success;
+}
+
+/* Reserves CNT free sectors, without choosing which, for data
+   that will be given sectors later.  Allocations then leave at
+   least that many free until free_map_unreserve() gives them
+   back.  Returns false if fewer than CNT unreserved sectors are
+   free. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = unreserved (cnt);
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors reserved with free_map_reserve(),
+   usually just before allocating them. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, and
+   writes the changed free map sectors if WRITE. */
+static void
+release (block_sector_t sector, size_t cnt, bool write)
+{
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  mark (sector, cnt, false);
+  journal_revoke (sector, cnt);
+  if (write)
+    write_dirty ();
+  lock_release (&free_map_lock);
+  journal_end ();
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  release (sector, cnt, true);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, but
+   leaves the free map file to be written by the next
+   free_map_flush() or allocation, so that many releases can
+   write it once.  Should the system crash first, the sectors
+   stay in use. */
+void
+free_map_release_lazy (block_sector_t sector, size_t cnt)
+{
+  release (sector, cnt, false);
+}
+
+/* Writes the sectors of the free map file whose bits have
+   changed.  They go to the buffer cache, which writes them to
+   disk in turn. */
+void
+free_map_flush (void)
+{
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  write_dirty ();
+  lock_release (&free_map_lock);
+  journal_end ();
+}
+
+/* Writes the free map to disk and waits until it is written. */
+void
+free_map_sync (void)
+{
+  free_map_flush ();
+  if (free_map_file != NULL)
+    inode_sync (file_get_inode (free_map_file));
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +318,17 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty, false);
+  count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -73,13 +337,16 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), 0))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  Writing all of it allocates every
+     sector of the file, so that write_dirty() never has to
+     allocate any while holding free_map_lock. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty, false);
 }
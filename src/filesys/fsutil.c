@@ -1,9 +1,11 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "filesys/defrag.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -22,7 +24,7 @@ fsutil_ls (char **argv UNUSED)
   dir = dir_open_root ();
   if (dir == NULL)
     PANIC ("root dir open failed");
-  while (dir_readdir (dir, name))
+  while (dir_readdir (dir, name, NULL))
     printf ("%s\n", name);
   dir_close (dir);
   printf ("End of listing.\n");
@@ -67,8 +69,29 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Queues file ARGV[1] to be defragmented in the background. */
+void
+fsutil_defrag (char **argv)
+{
+  const char *file_name = argv[1];
+  struct file *file;
+
+  printf ("Defragmenting '%s'...\n", file_name);
+  file = filesys_open (file_name);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  if (!defrag_queue (file_get_inode (file)))
+    PANIC ("%s: defragmentation failed", file_name);
+  file_close (file);
+}
+
+/* Sectors fsutil_extract() copies at a time. */
+#define EXTRACT_SECTORS 64
+
 /* Extracts a ustar-format tar archive from the scratch block
-   device into the Pintos file system. */
+   device into the Pintos file system.  File data is copied
+   EXTRACT_SECTORS at a time, into files created at their full
+   size. */
 void
 fsutil_extract (char **argv UNUSED) 
 {
@@ -79,7 +102,7 @@ fsutil_extract (char **argv UNUSED)
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = malloc (EXTRACT_SECTORS * BLOCK_SECTOR_SIZE);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -127,10 +150,13 @@ fsutil_extract (char **argv UNUSED)
           /* Do copy. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
+              int chunk_size = (size > EXTRACT_SECTORS * BLOCK_SECTOR_SIZE
+                                ? EXTRACT_SECTORS * BLOCK_SECTOR_SIZE
                                 : size);
-              block_read (src, sector++, data);
+              block_sector_t chunk_sectors = DIV_ROUND_UP (chunk_size,
+                                                           BLOCK_SECTOR_SIZE);
+              block_read_multiple (src, sector, data, chunk_sectors);
+              sector += chunk_sectors;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -0,0 +1,227 @@
+#include "filesys/image.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Sector 0 of an image. */
+struct image_header
+  {
+    uint32_t magic;                     /* IMAGE_MAGIC. */
+    uint32_t entry_cnt;                 /* Number of entries. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+/* An entry of the index.  "/" separates the names of PATH, which
+   has none at either end. */
+struct image_entry
+  {
+    char path[IMAGE_PATH_MAX + 1];      /* Null terminated. */
+    uint32_t is_dir;                    /* Directory, or else file? */
+    block_sector_t start;               /* File's first data sector. */
+    uint32_t length;                    /* File size in bytes. */
+  };
+
+#define ENTRIES_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct image_entry))
+
+/* A mounted file, the aux of its inode. */
+struct image_file
+  {
+    block_sector_t start;               /* First data sector. */
+    off_t length;                       /* Size in bytes. */
+  };
+
+static off_t image_read_at (struct inode *, void *, off_t, off_t);
+static off_t image_write_at (struct inode *, const void *, off_t, off_t);
+static void image_readahead (struct inode *, off_t, off_t);
+static void image_sync (struct inode *);
+static void image_release (struct inode *);
+
+static const struct inode_ops image_ops =
+  {
+    image_read_at, image_write_at, image_readahead, image_sync,
+    image_release
+  };
+
+/* The scratch device the image is on. */
+static struct block *image_device;
+
+/* Opens the directory in the image holding PATH, whose root is
+   ROOT, and stores the offset of PATH's last name into *NAME.
+   Returns a null pointer if that directory isn't there. */
+static struct dir *
+open_parent (block_sector_t root, const char *path, size_t *name)
+{
+  struct dir *dir = dir_open (inode_open (root));
+  const char *p = path, *slash;
+
+  while (dir != NULL && (slash = strchr (p, '/')) != NULL)
+    {
+      char component[NAME_MAX + 1];
+      struct inode *inode = NULL;
+
+      if ((size_t) (slash - p) > NAME_MAX)
+        break;
+      memcpy (component, p, slash - p);
+      component[slash - p] = '\0';
+      dir_lookup (dir, component, &inode);
+      dir_close (dir);
+      dir = NULL;
+      if (inode != NULL && inode_is_dir (inode))
+        dir = dir_open (inode);
+      else
+        inode_close (inode);
+      p = slash + 1;
+    }
+  *name = p - path;
+  return dir;
+}
+
+/* Adds E to the image whose root is ROOT.  A directory is made
+   in memory; a file gets an inode that reads the scratch device,
+   kept open for good so that the directory entry finds it. */
+static bool
+add_entry (block_sector_t root, const struct image_entry *e)
+{
+  struct dir *dir;
+  size_t name;
+  block_sector_t sector;
+  bool success = false;
+
+  dir = open_parent (root, e->path, &name);
+  if (dir == NULL)
+    return false;
+  if (e->is_dir)
+    success = (inode_create_mem (0, inode_get_inumber (dir_get_inode (dir)),
+                                 &sector)
+               && dir_add (dir, e->path + name, sector));
+  else
+    {
+      struct image_file *f = malloc (sizeof *f);
+      struct inode *inode = f != NULL ? inode_create_anon (&image_ops, f)
+                                      : NULL;
+      if (inode != NULL)
+        {
+          f->start = e->start;
+          f->length = e->length;
+          inode_set_length (inode, e->length);
+          success = dir_add (dir, e->path + name, inode_get_inumber (inode));
+        }
+      else
+        free (f);
+    }
+  dir_close (dir);
+  return success;
+}
+
+/* Mounts the image on the scratch device as a directory held in
+   the one at PARENT, storing the inumber of its root into *ROOT.
+   Returns false if there is no image or memory is short. */
+bool
+image_mount (block_sector_t parent, block_sector_t *root)
+{
+  struct image_header *h;
+  struct image_entry *entries;
+  uint32_t i;
+  bool success = false;
+
+  image_device = block_get_role (BLOCK_SCRATCH);
+  if (image_device == NULL)
+    return false;
+  h = malloc (BLOCK_SECTOR_SIZE);
+  entries = malloc (BLOCK_SECTOR_SIZE);
+  if (h == NULL || entries == NULL)
+    goto done;
+  block_read (image_device, 0, h);
+  if (h->magic != IMAGE_MAGIC || !inode_create_mem (0, parent, root))
+    goto done;
+
+  printf ("Mounting image of %"PRIu32" entries from %s.\n",
+          h->entry_cnt, block_name (image_device));
+  for (i = 0; i < h->entry_cnt; i++)
+    {
+      struct image_entry *e = &entries[i % ENTRIES_PER_SECTOR];
+
+      if (i % ENTRIES_PER_SECTOR == 0)
+        block_read (image_device, 1 + i / ENTRIES_PER_SECTOR, entries);
+      e->path[IMAGE_PATH_MAX] = '\0';
+      if (!add_entry (*root, e))
+        printf ("image: can't add %s\n", e->path);
+    }
+  success = true;
+
+ done:
+  free (entries);
+  free (h);
+  return success;
+}
+
+/* Reads from the contiguous data of INODE's file a page at a
+   time, since the scratch device may transfer only to kernel
+   memory. */
+static off_t
+image_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
+{
+  struct image_file *f = inode_aux (inode);
+  uint8_t *buffer = buffer_;
+  uint8_t *bounce;
+  off_t bytes_read = 0;
+
+  if (offset >= f->length || size <= 0)
+    return 0;
+  if (size > f->length - offset)
+    size = f->length - offset;
+  bounce = palloc_get_page (0);
+  if (bounce == NULL)
+    return 0;
+
+  while (bytes_read < size)
+    {
+      off_t pos = offset + bytes_read;
+      int sector_ofs = pos % BLOCK_SECTOR_SIZE;
+      off_t chunk = PGSIZE - sector_ofs;
+      block_sector_t cnt;
+
+      if (chunk > size - bytes_read)
+        chunk = size - bytes_read;
+      cnt = DIV_ROUND_UP (sector_ofs + chunk, BLOCK_SECTOR_SIZE);
+      block_read_multiple (image_device, f->start + pos / BLOCK_SECTOR_SIZE,
+                           bounce, cnt);
+      memcpy (buffer + bytes_read, bounce + sector_ofs, chunk);
+      bytes_read += chunk;
+    }
+  palloc_free_page (bounce);
+  return bytes_read;
+}
+
+/* An image is read-only. */
+static off_t
+image_write_at (struct inode *inode UNUSED, const void *buffer UNUSED,
+                off_t size UNUSED, off_t offset UNUSED)
+{
+  return 0;
+}
+
+/* An image file is read straight from the device. */
+static void
+image_readahead (struct inode *inode UNUSED, off_t offset UNUSED,
+                 off_t size UNUSED)
+{
+}
+
+/* An image has nothing to write back. */
+static void
+image_sync (struct inode *inode UNUSED)
+{
+}
+
+static void
+image_release (struct inode *inode)
+{
+  free (inode_aux (inode));
+}
@@ -0,0 +1,20 @@
+#ifndef FILESYS_IMAGE_H
+#define FILESYS_IMAGE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* A read-only packed image on the scratch device, as written by
+   "pintos --image", mounted in place with filesys_mount ("image",
+   DIR) so that its files need no extraction.
+
+   Sector 0 holds IMAGE_MAGIC and the number of entries, which
+   follow from sector 1, four to a sector, sorted by path, so that
+   every directory comes before what it holds.  Each file's data
+   is contiguous, starting at a sector boundary. */
+#define IMAGE_MAGIC 0x474d4950          /* "PIMG". */
+#define IMAGE_PATH_MAX 115
+
+bool image_mount (block_sector_t parent, block_sector_t *root);
+
+#endif /* filesys/image.h */
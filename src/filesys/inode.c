@@ -1,23 +1,78 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of consecutive data sectors. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t cnt;                       /* Number of sectors. */
+  };
+
+/* Start of an extent that is a hole: it has no sectors on disk
+   and reads as zeros until written.  Sector 0 holds the free
+   map's inode, so it is never file data. */
+#define HOLE 0
+
+/* Extents held in the inode itself, and in its indirect extent
+   block. */
+#define DIRECT_EXTENTS 60
+#define INDIRECT_EXTENTS (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+#define MAX_EXTENTS (DIRECT_EXTENTS + INDIRECT_EXTENTS)
+
+/* Most bytes of data kept in the inode itself, in place of its
+   extents. */
+#define INLINE_MAX (DIRECT_EXTENTS * sizeof (struct extent))
+
+/* Fewest whole sectors that reads and writes move in one run
+   between the caller's buffer and the disk, past the cache.
+   Smaller accesses are cached. */
+#define RUN_MIN (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Inode flags. */
+#define INODE_INLINE 0x1                /* Data is in the inode. */
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   The file's data is the concatenation of its extents, the first
+   DIRECT_EXTENTS of them stored here and the rest in the sector
+   INDIRECT.  Together they cover exactly the sectors needed for
+   LENGTH bytes.  Sectors never written may lie in holes, or in
+   the run of UNWRITTEN_CNT sectors from file sector UNWRITTEN on,
+   which inode_allocate() gave sectors that still read as zeros.
+   With INODE_INLINE, the data of a file of at most INLINE_MAX
+   bytes is stored where the extents go instead, followed by
+   zeros, and there are no extents.  It moves out to extents when
+   the file outgrows that. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    block_sector_t indirect;            /* Indirect extent block, or 0. */
+    block_sector_t parent;              /* For a directory, the one
+                                           holding it; 0 for a file. */
+    uint32_t flags;                     /* INODE_* flags. */
+    block_sector_t unwritten;           /* First unwritten file sector. */
+    uint32_t unwritten_cnt;             /* Unwritten sectors, or 0. */
+    struct extent extents[DIRECT_EXTENTS];  /* First extents. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,51 +83,695 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory extent map: every extent of an inode, each tagged with
+   the index within the file of its first sector, for binary
+   search. */
+struct extent_map
+  {
+    size_t cnt;                         /* Number of extents. */
+    size_t hint;                        /* Extent of the last lookup. */
+    block_sector_t sectors;             /* Total sectors, the sum of cnt. */
+    struct extent ext[MAX_EXTENTS];
+    block_sector_t first[MAX_EXTENTS];  /* File sector of ext[i].start. */
+  };
+
+/* Sectors allocated ahead of a file being written, just past the
+   ones filled in last, to be taken by the next fill that
+   continues them. */
+struct prealloc
+  {
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors, or 0. */
+  };
+
+/* Bounds on how many sectors a file being written preallocates:
+   as many as it is long, within these limits. */
+#define PREALLOC_MIN 8
+#define PREALLOC_MAX 128
+
+/* Data appended to a file but not given sectors yet: the CNT
+   file sectors from FIRST on, which lie in the hole at the end of
+   the file, are held in BUF and reserved in the free map.  Their
+   sectors are allocated all at once when the data is flushed, so
+   that the file gets one run sized to what was written, instead
+   of whatever each write could find. */
+struct delalloc
+  {
+    block_sector_t first;               /* First file sector. */
+    size_t cnt;                         /* Number of sectors, or 0. */
+    uint8_t *buf;                       /* DELALLOC_SECTORS sectors, or
+                                           null if CNT is 0. */
+  };
+
+/* Most sectors of data delayed at once. */
+#define DELALLOC_SECTORS 64
+
+/* Sectors in a cluster, the unit in which holes are filled and
+   preallocation grows, so that file data lies on disk in runs of
+   whole clusters and moves a cluster per command.  Set with
+   "-cluster=SECTORS".  The disk layout doesn't depend on it. */
+#define CLUSTER_MAX 64
+unsigned inode_cluster = PGSIZE / BLOCK_SECTOR_SIZE;
+
+/* In-memory inode.
+   open_inodes_lock protects ELEM and OPEN_CNT, and LOADED is set
+   under LOCK held exclusively while the inode is read in, before
+   which the rest must not be used.  LOCK protects the
+   rest.  Reads, and writes within the current length, hold it
+   shared, since the buffer cache serializes access to each
+   sector; growing the file or changing the other fields takes it
+   exclusive.  The extent map's lookup hint is updated under the
+   shared lock, which is harmless as any value below its count is
+   a valid hint. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loaded;                        /* Read in from disk yet? */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    unsigned write_gen;                 /* Changed by every write. */
+    bool page_cached;                   /* Ever had pages in the VM's
+                                           page cache? */
+    struct rwlock lock;                 /* Protects the fields below. */
     struct inode_disk data;             /* Inode content. */
+    struct extent_map *map;             /* All of data's extents. */
+    struct prealloc pa;                 /* Sectors reserved for growth. */
+    struct delalloc da;                 /* Data not yet given sectors. */
+    uint8_t **pages;                    /* In memory: data pages, or null
+                                           for zeros. */
+    size_t page_cnt;                    /* In memory: size of PAGES. */
+    const struct inode_ops *ops;        /* Where the data lives. */
+    void *aux;                          /* For OPS from inode_create_anon(). */
   };
 
+static off_t disk_read_at (struct inode *, void *, off_t, off_t);
+static off_t disk_write_at (struct inode *, const void *, off_t, off_t);
+static void disk_readahead (struct inode *, off_t, off_t);
+static void disk_sync (struct inode *);
+static void disk_release (struct inode *);
+static void delalloc_flush (struct inode *);
+
+static const struct inode_ops disk_inode_ops =
+  {
+    disk_read_at, disk_write_at, disk_readahead, disk_sync, disk_release
+  };
+
+static off_t mem_read_at (struct inode *, void *, off_t, off_t);
+static off_t mem_write_at (struct inode *, const void *, off_t, off_t);
+static void mem_readahead (struct inode *, off_t, off_t);
+static void mem_sync (struct inode *);
+static void mem_release (struct inode *);
+
+static const struct inode_ops mem_inode_ops =
+  {
+    mem_read_at, mem_write_at, mem_readahead, mem_sync, mem_release
+  };
+
+/* Returns true if extent B can be merged into extent A, which
+   precedes it in the file: both are holes, or B follows A on
+   disk. */
+static inline bool
+extent_continues (const struct extent *a, const struct extent *b)
+{
+  if (a->start == HOLE || b->start == HOLE)
+    return a->start == b->start;
+  return a->start + a->cnt == b->start;
+}
+
+/* Appends the CNT sectors at START, or a hole if START is HOLE,
+   to MAP, merging them into the last extent when possible.
+   Returns false if MAP is full. */
+static bool
+map_append (struct extent_map *map, block_sector_t start, size_t cnt)
+{
+  struct extent *last = map->cnt > 0 ? &map->ext[map->cnt - 1] : NULL;
+  struct extent x = { start, cnt };
+
+  if (last != NULL && extent_continues (last, &x))
+    last->cnt += cnt;
+  else if (map->cnt < MAX_EXTENTS)
+    {
+      map->ext[map->cnt].start = start;
+      map->ext[map->cnt].cnt = cnt;
+      map->first[map->cnt] = map->sectors;
+      map->cnt++;
+    }
+  else
+    return false;
+  map->sectors += cnt;
+  return true;
+}
+
+/* Fills MAP from the extents of DISK. */
+static void
+map_load (struct extent_map *map, const struct inode_disk *disk)
+{
+  struct extent *ext = map->ext;
+  size_t i;
+
+  ASSERT (disk->extent_cnt <= MAX_EXTENTS);
+
+  map->cnt = map->hint = map->sectors = 0;
+  memcpy (ext, disk->extents,
+          DIRECT_EXTENTS * sizeof *ext);
+  if (disk->extent_cnt > DIRECT_EXTENTS)
+    cache_read (disk->indirect, ext + DIRECT_EXTENTS, 0,
+                BLOCK_SECTOR_SIZE);
+  for (i = 0; i < disk->extent_cnt; i++)
+    {
+      map->first[i] = map->sectors;
+      map->sectors += ext[i].cnt;
+    }
+  map->cnt = disk->extent_cnt;
+}
+
+/* Stores MAP into DISK and the indirect block, and writes DISK to
+   SECTOR.  Returns false if an indirect block is needed and none
+   can be allocated. */
+static bool
+map_store (const struct extent_map *map, struct inode_disk *disk,
+           block_sector_t sector)
+{
+  size_t direct = map->cnt < DIRECT_EXTENTS ? map->cnt : DIRECT_EXTENTS;
+
+  if (map->cnt > DIRECT_EXTENTS)
+    {
+      if (disk->indirect == 0
+          && !free_map_allocate (sector, 1, &disk->indirect))
+        return false;
+      journal_write (disk->indirect, map->ext + DIRECT_EXTENTS, 0,
+                     BLOCK_SECTOR_SIZE);
+    }
+  memset (disk->extents, 0, sizeof disk->extents);
+  memcpy (disk->extents, map->ext, direct * sizeof *map->ext);
+  disk->extent_cnt = map->cnt;
+  journal_write (sector, disk, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* Drops the extents of MAP past its first CNT sectors and frees
+   their sectors. */
+static void
+map_truncate (struct extent_map *map, block_sector_t cnt)
+{
+  while (map->sectors > cnt)
+    {
+      struct extent *last = &map->ext[map->cnt - 1];
+      block_sector_t drop = map->sectors - cnt;
+
+      if (drop > last->cnt)
+        drop = last->cnt;
+      if (last->start != HOLE)
+        free_map_release (last->start + last->cnt - drop, drop);
+      last->cnt -= drop;
+      map->sectors -= drop;
+      if (last->cnt == 0)
+        map->cnt--;
+    }
+  if (map->hint >= map->cnt)
+    map->hint = 0;
+}
+
+/* Returns the index of the extent of MAP holding file sector
+   IDX, which must be less than map->sectors.  Tries the extent of
+   the previous lookup and the one after it first, which is all a
+   sequential access needs, then falls back to binary search. */
+static size_t
+map_lookup (struct extent_map *map, block_sector_t idx)
+{
+  size_t lo, hi, h = map->hint;
+
+  ASSERT (idx < map->sectors);
+
+  if (h < map->cnt && idx >= map->first[h])
+    {
+      if (idx < map->first[h] + map->ext[h].cnt)
+        return h;
+      if (h + 1 < map->cnt && idx < map->first[h + 1] + map->ext[h + 1].cnt)
+        return map->hint = h + 1;
+    }
+
+  lo = 0;
+  hi = map->cnt;
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (map->first[mid] <= idx)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return map->hint = lo;
+}
+
+/* Replaces the N extents of MAP starting at index E by the K
+   extents in PIECES, and recomputes the file sector of each
+   extent after them.  The total length must not change. */
+static void
+map_splice (struct extent_map *map, size_t e, size_t n,
+            const struct extent *pieces, size_t k)
+{
+  size_t i;
+
+  ASSERT (map->cnt - n + k <= MAX_EXTENTS);
+
+  memmove (map->ext + e + k, map->ext + e + n,
+           (map->cnt - e - n) * sizeof *map->ext);
+  memcpy (map->ext + e, pieces, k * sizeof *pieces);
+  map->cnt = map->cnt - n + k;
+  for (i = e; i < map->cnt; i++)
+    map->first[i] = i > 0 ? map->first[i - 1] + map->ext[i - 1].cnt : 0;
+  map->hint = 0;
+}
+
+/* Turns the CNT file sectors starting at IDX, which lie in hole
+   extent E of MAP, into the CNT sectors at START, merging them
+   with the extents on either side when they continue on disk.
+   Returns false if MAP would need more than MAX_EXTENTS
+   extents. */
+static bool
+map_plug (struct extent_map *map, size_t e, block_sector_t idx,
+          block_sector_t start, block_sector_t cnt)
+{
+  struct extent data = { start, cnt };
+  struct extent hole = { HOLE, 0 };
+  struct extent pieces[3];
+  block_sector_t left = idx - map->first[e];
+  block_sector_t right = map->ext[e].cnt - left - cnt;
+  struct extent *prev = e > 0 ? &map->ext[e - 1] : NULL;
+  struct extent *next = e + 1 < map->cnt ? &map->ext[e + 1] : NULL;
+  bool merge_prev = left == 0 && prev != NULL && extent_continues (prev, &data);
+  bool merge_next = right == 0 && next != NULL && extent_continues (&data, next);
+  size_t k = 0;
+
+  ASSERT (map->ext[e].start == HOLE);
+
+  if (left > 0)
+    {
+      hole.cnt = left;
+      pieces[k++] = hole;
+    }
+  if (!merge_prev && !merge_next)
+    pieces[k++] = data;
+  if (right > 0)
+    {
+      hole.cnt = right;
+      pieces[k++] = hole;
+    }
+  if (map->cnt - 1 - (merge_prev && merge_next) + k > MAX_EXTENTS)
+    return false;
+
+  if (merge_prev && merge_next)
+    {
+      prev->cnt += cnt + next->cnt;
+      map_splice (map, e, 2, pieces, k);
+    }
+  else
+    {
+      if (merge_prev)
+        prev->cnt += cnt;
+      else if (merge_next)
+        {
+          next->start = start;
+          next->cnt += cnt;
+        }
+      map_splice (map, e, 1, pieces, k);
+    }
+  return true;
+}
+
+/* A sector of zeros, for filling new sectors. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Allocates up to WANT sectors, preferably at NEAR, storing the
+   first into *START and the number into *GOT.  Takes them from
+   PA, if it is nonnull and holds sectors at NEAR.  Otherwise,
+   with PA, tries to allocate EXTRA more sectors as well and
+   leaves those in PA, replacing what it held.  Returns false if
+   the disk is full. */
+static bool
+alloc_run (block_sector_t near, size_t want, size_t extra,
+           struct prealloc *pa, block_sector_t *start, size_t *got)
+{
+  size_t run;
+
+  if (pa != NULL && pa->cnt > 0 && pa->start == near)
+    {
+      *start = pa->start;
+      *got = pa->cnt < want ? pa->cnt : want;
+      pa->start += *got;
+      pa->cnt -= *got;
+      return true;
+    }
+  if (pa == NULL)
+    extra = 0;
+
+  run = want + extra;
+  for (;;)
+    {
+      if (free_map_allocate_at (near, run))
+        *start = near;
+      else if (!free_map_allocate (near, run, start))
+        {
+          if (extra > 0)
+            {
+              run = want;
+              extra = 0;
+            }
+          else if (run == 1)
+            return false;
+          else
+            run /= 2;
+          continue;
+        }
+      break;
+    }
+
+  *got = run < want ? run : want;
+  if (run > want)
+    {
+      if (pa->cnt > 0)
+        free_map_release (pa->start, pa->cnt);
+      pa->start = *start + want;
+      pa->cnt = run - want;
+    }
+  return true;
+}
+
+/* Allocates zeroed sectors for the holes among the CNT file
+   sectors of MAP starting at IDX.  Each run goes right after the
+   data before it on disk if possible, or else near GOAL.  With
+   PA, runs grow speculatively as described for alloc_run().
+   Returns false if the disk is full or MAP runs out of extents,
+   in which case some of the holes may have been filled. */
+static bool
+map_fill (struct extent_map *map, block_sector_t idx, block_sector_t cnt,
+          block_sector_t goal, struct prealloc *pa)
+{
+  block_sector_t end = idx + cnt;
+  size_t extra = map->sectors;
+
+  if (extra < PREALLOC_MIN)
+    extra = PREALLOC_MIN;
+  else if (extra > PREALLOC_MAX)
+    extra = PREALLOC_MAX;
+  extra = ROUND_UP (extra, inode_cluster);
+
+  while (idx < end)
+    {
+      size_t e = map_lookup (map, idx);
+      struct extent *x = &map->ext[e];
+      block_sector_t x_end = map->first[e] + x->cnt;
+      block_sector_t near = goal;
+      block_sector_t lo, hi;
+      block_sector_t start;
+      size_t got, i;
+
+      if (x->start != HOLE)
+        {
+          idx = x_end;
+          continue;
+        }
+
+      /* Fill whole clusters of the hole around what is wanted. */
+      lo = ROUND_DOWN (idx, inode_cluster);
+      hi = ROUND_UP (end < x_end ? end : x_end, inode_cluster);
+      if (lo < map->first[e])
+        lo = map->first[e];
+      if (hi > x_end)
+        hi = x_end;
+
+      if (e > 0 && map->ext[e - 1].start != HOLE)
+        {
+          struct extent *prev = &map->ext[e - 1];
+          near = prev->start + prev->cnt + (lo - map->first[e]);
+        }
+
+      if (!alloc_run (near, hi - lo, extra, pa, &start, &got))
+        return false;
+      if (!map_plug (map, e, lo, start, got))
+        {
+          free_map_release (start, got);
+          return false;
+        }
+      for (i = 0; i < got; i++)
+        cache_write (start + i, zeros, 0, BLOCK_SECTOR_SIZE);
+      idx = lo + got;
+    }
+  return true;
+}
+
+/* Returns true if any of the CNT file sectors of MAP starting at
+   IDX lies in a hole. */
+static bool
+map_has_hole (struct extent_map *map, block_sector_t idx, block_sector_t cnt)
+{
+  block_sector_t end = idx + cnt;
+
+  while (idx < end)
+    {
+      size_t e = map_lookup (map, idx);
+      if (map->ext[e].start == HOLE)
+        return true;
+      idx = map->first[e] + map->ext[e].cnt;
+    }
+  return false;
+}
+
+/* Returns true if every file sector of MAP from IDX on lies in
+   a hole. */
+static bool
+map_hole_from (struct extent_map *map, block_sector_t idx)
+{
+  size_t e;
+
+  if (idx >= map->sectors)
+    return true;
+  e = map_lookup (map, idx);
+  return map->ext[e].start == HOLE && e == map->cnt - 1;
+}
+
+/* Returns true if file sector IDX of INODE is unwritten. */
+static inline bool
+is_unwritten (const struct inode *inode, block_sector_t idx)
+{
+  return idx - inode->data.unwritten < inode->data.unwritten_cnt;
+}
+
+/* Returns true if INODE's data is stored in the inode. */
+static inline bool
+inode_is_inline (const struct inode *inode)
+{
+  return (inode->data.flags & INODE_INLINE) != 0;
+}
+
+/* Returns the data of inline INODE. */
+static inline uint8_t *
+inline_data (struct inode *inode)
+{
+  return (uint8_t *) inode->data.extents;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    {
+      struct extent_map *map = inode->map;
+      block_sector_t idx = pos / BLOCK_SECTOR_SIZE;
+      size_t e = map_lookup (map, idx);
+      return map->ext[e].start + (idx - map->first[e]);
+    }
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns how many whole sectors of INODE, starting at byte
+   OFFSET and within SIZE bytes and the inode's length, an access
+   to BUFFER can move in one run past the cache: they must lie in
+   one extent, consecutive on disk or all in one hole, be all
+   unwritten or all not, and be at least RUN_MIN.  Returns 0 if the access should go through the
+   cache instead. */
+static block_sector_t
+run_sectors (struct inode *inode, const void *buffer, off_t offset,
+             off_t size)
+{
+  struct extent_map *map = inode->map;
+  off_t left = inode->data.length - offset;
+  block_sector_t idx = offset / BLOCK_SECTOR_SIZE;
+  block_sector_t cnt, ext_left, uw_left;
+  size_t e;
+
+  if (size < left)
+    left = size;
+  if (offset % BLOCK_SECTOR_SIZE != 0 || !is_kernel_vaddr (buffer)
+      || left < (off_t) (RUN_MIN * BLOCK_SECTOR_SIZE))
+    return 0;
+  e = map_lookup (map, idx);
+  ext_left = map->ext[e].cnt - (idx - map->first[e]);
+  cnt = left / BLOCK_SECTOR_SIZE;
+  if (ext_left < cnt)
+    cnt = ext_left;
+  if (is_unwritten (inode, idx))
+    uw_left = inode->data.unwritten + inode->data.unwritten_cnt - idx;
+  else if (inode->data.unwritten_cnt > 0 && idx < inode->data.unwritten)
+    uw_left = inode->data.unwritten - idx;
+  else
+    uw_left = cnt;
+  if (uw_left < cnt)
+    cnt = uw_left;
+  return cnt >= RUN_MIN ? cnt : 0;
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static inline block_sector_t
+sector_of (const struct inode *inode)
+{
+  return inode->sector;
+}
+
+static inline bool
+sector_eq (block_sector_t a, block_sector_t b)
+{
+  return a == b;
+}
+
+HASH_SPECIALIZE (open_inode, struct inode, elem, block_sector_t,
+                 sector_of, hash_word, sector_eq)
+
+/* Inumber for the next inode created in memory. */
+static block_sector_t next_mem_sector = INODE_MEM_BASE;
+
+/* A removed inode whose sectors are yet to be freed. */
+struct reclaim
+  {
+    struct list_elem elem;              /* Element in reclaim_list. */
+    block_sector_t sector;              /* The inode's sector. */
+    block_sector_t indirect;            /* Its indirect block, or 0. */
+    struct extent_map *map;             /* Its extents. */
+  };
+
+/* Removed inodes are freed by the reclaimer thread, so that
+   closing one doesn't wait for its extents to be released.  It
+   takes all that are queued at once and frees them in one
+   journal operation, writing the free map once for the lot. */
+static struct list reclaim_list;
+static struct lock reclaim_lock;
+static struct condition reclaim_ready; /* Signaled when queued. */
+static struct condition reclaim_done;  /* Signaled when idle. */
+static bool reclaim_busy;              /* Freeing a batch? */
+
+static thread_func reclaimer NO_RETURN;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (inode_cluster == 0 || inode_cluster > CLUSTER_MAX
+      || (inode_cluster & (inode_cluster - 1)) != 0)
+    PANIC ("cluster size must be a power of 2 up to %d sectors",
+           CLUSTER_MAX);
+  open_inode_init (&open_inodes);
+  lock_init (&open_inodes_lock);
+  lock_set_name (&open_inodes_lock, "open inodes");
+
+  list_init (&reclaim_list);
+  lock_init (&reclaim_lock);
+  cond_init (&reclaim_ready);
+  cond_init (&reclaim_done);
+  thread_create ("reclaim", PRI_DEFAULT, reclaimer, NULL);
+}
+
+/* Waits until the reclaimer has freed every removed inode closed
+   so far. */
+void
+inode_done (void)
+{
+  lock_acquire (&reclaim_lock);
+  while (reclaim_busy || !list_empty (&reclaim_list))
+    cond_wait (&reclaim_done, &reclaim_lock);
+  lock_release (&reclaim_lock);
+}
+
+/* Frees the inode sector SECTOR, the indirect block INDIRECT if
+   it is nonzero, and the sectors of MAP.  The free map file is
+   left for the caller to write. */
+static void
+free_inode_sectors (block_sector_t sector, block_sector_t indirect,
+                    const struct extent_map *map)
+{
+  size_t i;
+
+  free_map_release_lazy (sector, 1);
+  if (indirect != 0)
+    free_map_release_lazy (indirect, 1);
+  for (i = 0; i < map->cnt; i++)
+    if (map->ext[i].start != HOLE)
+      free_map_release_lazy (map->ext[i].start, map->ext[i].cnt);
+}
+
+/* Reclaimer thread.  Frees the sectors of queued inodes in
+   batches. */
+static void
+reclaimer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct list batch;
+
+      lock_acquire (&reclaim_lock);
+      while (list_empty (&reclaim_list))
+        cond_wait (&reclaim_ready, &reclaim_lock);
+      list_init (&batch);
+      list_splice (list_end (&batch), list_begin (&reclaim_list),
+                   list_end (&reclaim_list));
+      reclaim_busy = true;
+      lock_release (&reclaim_lock);
+
+      journal_begin ();
+      while (!list_empty (&batch))
+        {
+          struct reclaim *r = list_entry (list_pop_front (&batch),
+                                          struct reclaim, elem);
+          free_inode_sectors (r->sector, r->indirect, r->map);
+          free (r->map);
+          free (r);
+        }
+      free_map_flush ();
+      journal_end ();
+
+      lock_acquire (&reclaim_lock);
+      reclaim_busy = false;
+      cond_broadcast (&reclaim_done, &reclaim_lock);
+      lock_release (&reclaim_lock);
+    }
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data starts out in the inode if it fits, or else as
+   a hole, so no data sectors are allocated or written until they
+   are first written to.  If
+   PARENT is nonzero the inode is a directory held in the one at
+   PARENT.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, block_sector_t parent)
 {
   struct inode_disk *disk_inode = NULL;
+  struct extent_map *map = NULL;
   bool success = false;
 
   ASSERT (length >= 0);
@@ -82,26 +781,20 @@ inode_create (block_sector_t sector, off_t length)
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  map = calloc (1, sizeof *map);
+  if (disk_inode != NULL && map != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
+      disk_inode->parent = parent;
+      if (length <= (off_t) INLINE_MAX)
+        disk_inode->flags = INODE_INLINE;
+      else
+        map_append (map, HOLE, bytes_to_sectors (length));
+      success = map_store (map, disk_inode, sector);
     }
+  free (map);
+  free (disk_inode);
   return success;
 }
 
@@ -111,42 +804,164 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+
+  /* Check whether this inode is already open, waiting for it to
+     be read in if somebody is just doing so. */
+  inode = open_inode_find (&open_inodes, sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      if (!inode->loaded)
         {
-          inode_reopen (inode);
-          return inode; 
+          rwlock_acquire_shared (&inode->lock);
+          rwlock_release_shared (&inode->lock);
         }
+      return inode;
     }
+  if (inode_in_memory (sector))
+    goto fail;
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    goto fail;
+  inode->map = malloc (sizeof *inode->map);
+  if (inode->map == NULL)
+    {
+      free (inode);
+      goto fail;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is read in after open_inodes_lock is
+     dropped, so that opening other inodes need not wait for the
+     disk, but with its own lock held, so that anybody who finds
+     it meanwhile waits. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loaded = false;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->page_cached = false;
+  inode->pa.cnt = 0;
+  inode->da.cnt = 0;
+  inode->da.buf = NULL;
+  inode->pages = NULL;
+  inode->page_cnt = 0;
+  inode->ops = &disk_inode_ops;
+  rwlock_init (&inode->lock);
+  rwlock_acquire_exclusive (&inode->lock);
+  open_inode_insert (&open_inodes, inode);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  map_load (inode->map, &inode->data);
+  inode->loaded = true;
+  rwlock_release_exclusive (&inode->lock);
+  return inode;
+
+ fail:
+  lock_release (&open_inodes_lock);
+  return NULL;
+}
+
+/* Creates an inode with LENGTH bytes of data, all zeros, that
+   lives only in memory, and stores its inumber into *SECTORP.  If
+   PARENT is nonzero the inode is a directory held in the one at
+   PARENT.  The inode stays open, and inode_open() finds it, until
+   inode_remove() is called on it; its data pages are allocated as
+   it is written.  Returns false if memory is short. */
+bool
+inode_create_mem (off_t length, block_sector_t parent, block_sector_t *sectorp)
+{
+  struct inode *inode;
+
+  ASSERT (length >= 0);
+
+  inode = calloc (1, sizeof *inode);
+  if (inode == NULL)
+    return false;
+  inode->open_cnt = 1;
+  inode->loaded = true;
+  inode->data.length = length;
+  inode->data.magic = INODE_MAGIC;
+  inode->data.parent = parent;
+  inode->ops = &mem_inode_ops;
+  rwlock_init (&inode->lock);
+
+  lock_acquire (&open_inodes_lock);
+  ASSERT (next_mem_sector != 0);
+  inode->sector = *sectorp = next_mem_sector++;
+  open_inode_insert (&open_inodes, inode);
+  lock_release (&open_inodes_lock);
+  return true;
+}
+
+/* Creates and returns an inode, open once, whose data OPS
+   provide, with AUX for them to find with inode_aux().  It is in
+   no directory, so it goes away once closed; OPS->release then
+   frees what it holds.  Returns a null pointer if memory is
+   short. */
+struct inode *
+inode_create_anon (const struct inode_ops *ops, void *aux)
+{
+  struct inode *inode;
+
+  inode = calloc (1, sizeof *inode);
+  if (inode == NULL)
+    return NULL;
+  inode->open_cnt = 1;
+  inode->loaded = true;
+  inode->data.magic = INODE_MAGIC;
+  inode->ops = ops;
+  inode->aux = aux;
+  rwlock_init (&inode->lock);
+
+  lock_acquire (&open_inodes_lock);
+  ASSERT (next_mem_sector != 0);
+  inode->sector = next_mem_sector++;
+  open_inode_insert (&open_inodes, inode);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
+/* Returns the AUX that INODE was created with by
+   inode_create_anon(), or a null pointer. */
+void *
+inode_aux (const struct inode *inode)
+{
+  return inode->aux;
+}
+
+/* Sets the length that inode_length() reports for INODE, which
+   inode_create_anon() made. */
+void
+inode_set_length (struct inode *inode, off_t length)
+{
+  ASSERT (inode->ops != &disk_inode_ops && inode->ops != &mem_inode_ops);
+  inode->data.length = length;
+}
+
+/* Returns the operations on INODE's data. */
+const struct inode_ops *
+inode_get_ops (const struct inode *inode)
+{
+  return inode->ops;
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -157,6 +972,28 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.parent != 0;
+}
+
+/* Returns the sector of the directory holding directory INODE. */
+block_sector_t
+inode_get_parent (const struct inode *inode)
+{
+  ASSERT (inode_is_dir (inode));
+  return inode->data.parent;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
@@ -168,21 +1005,77 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
-        }
+      /* Remove from inode table and release lock. */
+      open_inode_remove (&open_inodes, inode);
+      lock_release (&open_inodes_lock);
+
+#ifdef VM
+      /* Cached pages are keyed by INODE, which is about to go. */
+      if (inode->page_cached)
+        frame_forget_inode (inode);
+#endif
 
+      inode->ops->release (inode);
       free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
+}
+
+/* Flushes the delayed data of INODE, which is on disk, or drops
+   it if INODE was removed, frees its preallocated sectors, and
+   hands its blocks to the reclaimer if it was removed.  Without
+   memory for that they are freed here, in one journal
+   operation. */
+static void
+disk_release (struct inode *inode)
+{
+  if (inode->removed && inode->da.cnt > 0)
+    {
+      free_map_unreserve (inode->da.cnt);
+      free (inode->da.buf);
+      inode->da.cnt = 0;
+    }
+  delalloc_flush (inode);
+  if (inode->pa.cnt > 0)
+    free_map_release (inode->pa.start, inode->pa.cnt);
+  if (inode->removed) 
+    {
+      struct reclaim *r = malloc (sizeof *r);
+
+      if (r != NULL)
+        {
+          r->sector = inode->sector;
+          r->indirect = inode->data.indirect;
+          r->map = inode->map;
+          lock_acquire (&reclaim_lock);
+          list_push_back (&reclaim_list, &r->elem);
+          cond_signal (&reclaim_ready, &reclaim_lock);
+          lock_release (&reclaim_lock);
+          return;
+        }
+      journal_begin ();
+      free_inode_sectors (inode->sector, inode->data.indirect, inode->map);
+      free_map_flush ();
+      journal_end ();
+    }
+  free (inode->map);
+}
+
+/* Frees the data pages of INODE, which is in memory.  It is only
+   closed for the last time once removed. */
+static void
+mem_release (struct inode *inode)
+{
+  size_t i;
+
+  ASSERT (inode->removed);
+  for (i = 0; i < inode->page_cnt; i++)
+    palloc_free_page (inode->pages[i]);
+  free (inode->pages);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -190,25 +1083,167 @@ inode_close (struct inode *inode)
 void
 inode_remove (struct inode *inode) 
 {
+  bool was_removed;
+
   ASSERT (inode != NULL);
+  rwlock_acquire_exclusive (&inode->lock);
+  was_removed = inode->removed;
   inode->removed = true;
+  rwlock_release_exclusive (&inode->lock);
+
+  /* Drop the reference that kept an inode in memory alive.  The
+     caller still has it open. */
+  if (!was_removed && inode->ops == &mem_inode_ops)
+    {
+      lock_acquire (&open_inodes_lock);
+      ASSERT (inode->open_cnt > 1);
+      inode->open_cnt--;
+      lock_release (&open_inodes_lock);
+    }
+}
+
+/* Reads SIZE bytes at OFFSET from the data pages of INODE, which
+   is in memory, into BUFFER.  Returns the number of bytes read. */
+static off_t
+mem_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
+{
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  rwlock_acquire_shared (&inode->lock);
+  if (offset < inode->data.length && size > inode->data.length - offset)
+    size = inode->data.length - offset;
+  while (size > 0 && offset < inode->data.length)
+    {
+      size_t page = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      int chunk_size = size < PGSIZE - page_ofs ? size : PGSIZE - page_ofs;
+
+      if (page < inode->page_cnt && inode->pages[page] != NULL)
+        memcpy (buffer + bytes_read, inode->pages[page] + page_ofs,
+                chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  rwlock_release_shared (&inode->lock);
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into the data pages of INODE,
+   which is in memory, at OFFSET, allocating pages and extending
+   the inode as needed.  Returns the number of bytes written,
+   which is short if memory runs out. */
+static off_t
+mem_write_at (struct inode *inode, const void *buffer_, off_t size,
+              off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  rwlock_acquire_exclusive (&inode->lock);
+  if (inode->deny_write_cnt > 0)
+    size = 0;
+  if (size > 0
+      && (size_t) DIV_ROUND_UP (offset + size, PGSIZE) > inode->page_cnt)
+    {
+      size_t cnt = DIV_ROUND_UP (offset + size, PGSIZE);
+      uint8_t **pages = realloc (inode->pages, cnt * sizeof *pages);
+
+      if (pages == NULL)
+        size = 0;
+      else
+        {
+          memset (pages + inode->page_cnt, 0,
+                  (cnt - inode->page_cnt) * sizeof *pages);
+          inode->pages = pages;
+          inode->page_cnt = cnt;
+        }
+    }
+  while (size > 0)
+    {
+      size_t page = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      int chunk_size = size < PGSIZE - page_ofs ? size : PGSIZE - page_ofs;
+
+      if (inode->pages[page] == NULL
+          && (inode->pages[page] = palloc_get_page (PAL_ZERO)) == NULL)
+        break;
+      memcpy (inode->pages[page] + page_ofs, buffer + bytes_written,
+              chunk_size);
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  if (offset > inode->data.length)
+    inode->data.length = offset;
+  if (bytes_written > 0)
+    inode->write_gen++;
+  rwlock_release_exclusive (&inode->lock);
+  return bytes_written;
+}
+
+/* Nothing needs reading ahead in memory. */
+static void
+mem_readahead (struct inode *inode UNUSED, off_t ofs UNUSED,
+               off_t size UNUSED)
+{
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  return inode->ops->read_at (inode, buffer, size, offset);
+}
+
+/* Reads the SIZE bytes of INODE at OFFSET, which lie in a hole or
+   are unwritten, into BUFFER: zeros, except where delayed data
+   covers them. */
+static void
+read_hole (struct inode *inode, uint8_t *buffer, off_t offset, off_t size)
+{
+  struct delalloc *da = &inode->da;
+  off_t da_ofs = (off_t) da->first * BLOCK_SECTOR_SIZE;
+  off_t da_end = da_ofs + (off_t) da->cnt * BLOCK_SECTOR_SIZE;
+  off_t lo = offset > da_ofs ? offset : da_ofs;
+  off_t hi = offset + size < da_end ? offset + size : da_end;
+
+  memset (buffer, 0, size);
+  if (lo < hi)
+    memcpy (buffer + (lo - offset), da->buf + (lo - da_ofs), hi - lo);
+}
+
+static off_t
+disk_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  block_sector_t next_sector;
 
+  rwlock_acquire_shared (&inode->lock);
+  if (inode_is_inline (inode))
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, inline_data (inode) + offset, bytes_read);
+        }
+      rwlock_release_shared (&inode->lock);
+      return bytes_read;
+    }
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      block_sector_t run;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -220,56 +1255,545 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Read whole sectors in runs, straight into BUFFER. */
+      run = run_sectors (inode, buffer + bytes_read, offset, size);
+      if (run > 0)
+        chunk_size = run * BLOCK_SECTOR_SIZE;
+
+      if (sector_idx == HOLE
+          || is_unwritten (inode, offset / BLOCK_SECTOR_SIZE))
+        read_hole (inode, buffer + bytes_read, offset, chunk_size);
+      else if (run > 0)
+        cache_read_run (sector_idx, run, buffer + bytes_read);
+      else
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  /* Start fetching the sector after the last one read, so a
+     sequential reader finds it in the cache. */
+  if (bytes_read > 0)
+    {
+      off_t next = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+
+      next_sector = byte_to_sector (inode, next);
+      if (next_sector != (block_sector_t) -1 && next_sector != HOLE
+          && !is_unwritten (inode, next / BLOCK_SECTOR_SIZE))
+        cache_readahead (next_sector);
+    }
+  rwlock_release_shared (&inode->lock);
 
   return bytes_read;
 }
 
+/* Has the sectors holding the SIZE bytes of INODE at OFS read
+   into the cache in the background.  Holes, unwritten sectors,
+   and data kept in the inode need no reading. */
+void
+inode_readahead (struct inode *inode, off_t ofs, off_t size)
+{
+  inode->ops->readahead (inode, ofs, size);
+}
+
+static void
+disk_readahead (struct inode *inode, off_t ofs, off_t size)
+{
+  off_t end;
+
+  rwlock_acquire_shared (&inode->lock);
+  end = ofs + size < inode->data.length ? ofs + size : inode->data.length;
+  if (!inode_is_inline (inode))
+    for (ofs = ROUND_DOWN (ofs, BLOCK_SECTOR_SIZE); ofs < end;
+         ofs += BLOCK_SECTOR_SIZE)
+      {
+        block_sector_t sector = byte_to_sector (inode, ofs);
+        if (sector != HOLE && !is_unwritten (inode, ofs / BLOCK_SECTOR_SIZE))
+          cache_readahead (sector);
+      }
+  rwlock_release_shared (&inode->lock);
+}
+
+/* Extends INODE to LENGTH bytes, the new sectors forming a hole.
+   Returns false if the inode has run out of extents or needs an
+   indirect block and the disk is full. */
+static bool
+inode_extend (struct inode *inode, off_t length)
+{
+  struct extent_map *map = inode->map;
+  size_t need = bytes_to_sectors (length);
+  block_sector_t old_sectors = map->sectors;
+  off_t old_length = inode->data.length;
+
+  if (need > map->sectors && !map_append (map, HOLE, need - map->sectors))
+    return false;
+  inode->data.length = length;
+  if (!map_store (map, &inode->data, inode->sector))
+    {
+      inode->data.length = old_length;
+      map_truncate (map, old_sectors);
+      return false;
+    }
+  return true;
+}
+
+/* Allocates sectors for the holes among the bytes of INODE from
+   OFFSET to OFFSET + SIZE, which must be within its length.
+   Returns false if the disk is full or the inode has run out of
+   extents. */
+static bool
+inode_fill (struct inode *inode, off_t offset, off_t size)
+{
+  struct extent_map *map = inode->map;
+  block_sector_t idx = offset / BLOCK_SECTOR_SIZE;
+  block_sector_t cnt = bytes_to_sectors (offset + size) - idx;
+  bool success;
+
+  if (!map_has_hole (map, idx, cnt))
+    return true;
+  success = map_fill (map, idx, cnt, inode->sector + 1, &inode->pa);
+  return map_store (map, &inode->data, inode->sector) && success;
+}
+
+/* Writes SIZE bytes from BUFFER into inline INODE at OFFSET, which
+   must end within INLINE_MAX bytes, extending it if needed, and
+   writes the inode out.  Returns SIZE. */
+static off_t
+inline_write (struct inode *inode, const void *buffer, off_t size,
+              off_t offset)
+{
+  ASSERT (offset + size <= (off_t) INLINE_MAX);
+
+  memcpy (inline_data (inode) + offset, buffer, size);
+  if (offset + size > inode->data.length)
+    inode->data.length = offset + size;
+  journal_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  return size;
+}
+
+/* Moves the data of inline INODE out to a sector of its own, so
+   that it can grow past INLINE_MAX bytes.  Returns false, leaving
+   INODE as it was, if the disk is full. */
+static bool
+inode_uninline (struct inode *inode)
+{
+  struct extent_map *map = inode->map;
+  block_sector_t cnt = bytes_to_sectors (inode->data.length);
+
+  ASSERT (map->cnt == 0);
+
+  if (cnt > 0)
+    {
+      map_append (map, HOLE, cnt);
+      if (!map_fill (map, 0, cnt, inode->sector + 1, &inode->pa))
+        {
+          map_truncate (map, 0);
+          return false;
+        }
+      cache_write (byte_to_sector (inode, 0), inline_data (inode), 0,
+                   inode->data.length);
+    }
+  inode->data.flags &= ~INODE_INLINE;
+  if (!map_store (map, &inode->data, inode->sector))
+    NOT_REACHED ();   /* Needs no indirect block. */
+  return true;
+}
+
+/* Allocates sectors for INODE's delayed data and writes it to
+   them, as one journal operation.  INODE's lock must be held
+   exclusive.  In the unlikely case that the disk fills up anyway,
+   what found no sector is lost, reading back as zeros. */
+static void
+delalloc_flush (struct inode *inode)
+{
+  struct delalloc *da = &inode->da;
+  struct extent_map *map = inode->map;
+  size_t i;
+
+  if (da->cnt == 0)
+    return;
+
+  journal_begin ();
+  free_map_unreserve (da->cnt);
+  map_fill (map, da->first, da->cnt, inode->sector + 1, NULL);
+  map_store (map, &inode->data, inode->sector);
+  for (i = 0; i < da->cnt; i++)
+    {
+      block_sector_t sector = byte_to_sector (inode, (da->first + i)
+                                              * BLOCK_SECTOR_SIZE);
+      if (sector != HOLE)
+        cache_write (sector, da->buf + i * BLOCK_SECTOR_SIZE, 0,
+                     BLOCK_SECTOR_SIZE);
+    }
+  journal_end ();
+
+  free (da->buf);
+  da->buf = NULL;
+  da->cnt = 0;
+}
+
+/* Tries to write SIZE bytes from BUFFER into INODE at OFFSET as
+   delayed data, extending the inode as needed, which it can if
+   they land in the hole at the end of the file within
+   DELALLOC_SECTORS of where the delayed data starts.  Delayed data
+   they don't continue is flushed first.  INODE's lock must be
+   held exclusive.  Returns false if the write must allocate
+   sectors instead. */
+static bool
+delalloc_write (struct inode *inode, const void *buffer, off_t size,
+                off_t offset)
+{
+  struct delalloc *da = &inode->da;
+  block_sector_t idx = offset / BLOCK_SECTOR_SIZE;
+  block_sector_t end = bytes_to_sectors (offset + size);
+  size_t need;
+
+  if (da->cnt > 0 && (idx < da->first || end - da->first > DELALLOC_SECTORS))
+    delalloc_flush (inode);
+  if (da->cnt == 0)
+    {
+      if (end - idx > DELALLOC_SECTORS || !map_hole_from (inode->map, idx))
+        return false;
+      da->first = idx;
+    }
+
+  need = end - da->first > da->cnt ? end - da->first - da->cnt : 0;
+  if (!free_map_reserve (need))
+    return false;
+  if (da->buf == NULL
+      && (da->buf = calloc (DELALLOC_SECTORS, BLOCK_SECTOR_SIZE)) == NULL)
+    {
+      free_map_unreserve (need);
+      return false;
+    }
+  if (offset + size > inode->data.length && !inode_extend (inode, offset + size))
+    {
+      free_map_unreserve (need);
+      if (da->cnt == 0)
+        {
+          free (da->buf);
+          da->buf = NULL;
+        }
+      return false;
+    }
+
+  memcpy (da->buf + (offset - (off_t) da->first * BLOCK_SECTOR_SIZE),
+          buffer, size);
+  da->cnt += need;
+  return true;
+}
+
+/* Marks the unwritten sectors of INODE before file sector END
+   written, writing zeros to them first except those wholly
+   covered by the SIZE bytes about to be written at OFFSET.
+   INODE's lock must be held exclusive. */
+static void
+take_unwritten (struct inode *inode, block_sector_t end, off_t offset,
+                off_t size)
+{
+  struct inode_disk *d = &inode->data;
+  block_sector_t uw_end = d->unwritten + d->unwritten_cnt;
+  block_sector_t i;
+
+  if (d->unwritten_cnt == 0 || end <= d->unwritten)
+    return;
+  if (end > uw_end)
+    end = uw_end;
+  for (i = d->unwritten; i < end; i++)
+    {
+      off_t ofs = (off_t) i * BLOCK_SECTOR_SIZE;
+      if (ofs < offset || ofs + BLOCK_SECTOR_SIZE > offset + size)
+        cache_write (byte_to_sector (inode, ofs), zeros, 0,
+                     BLOCK_SECTOR_SIZE);
+    }
+  d->unwritten_cnt = uw_end - end;
+  d->unwritten = d->unwritten_cnt > 0 ? end : 0;
+  journal_write (inode->sector, d, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Gives sectors to file sectors IDX through END - 1 of INODE,
+   which lie in the hole at the end of the file, and marks them
+   unwritten.  They continue INODE's unwritten sectors, if those
+   end at IDX; otherwise those are zeroed first.  Returns false if
+   the disk is full or the inode has run out of extents, in which
+   case only some may have been allocated. */
+static bool
+allocate_unwritten (struct inode *inode, block_sector_t idx,
+                    block_sector_t end)
+{
+  struct extent_map *map = inode->map;
+  struct inode_disk *d = &inode->data;
+  bool success = true;
+
+  if (d->unwritten_cnt > 0 && d->unwritten + d->unwritten_cnt != idx)
+    take_unwritten (inode, d->unwritten + d->unwritten_cnt, 0, 0);
+
+  while (idx < end)
+    {
+      size_t e = map_lookup (map, idx);
+      block_sector_t near = inode->sector + 1;
+      block_sector_t start;
+      size_t got;
+
+      ASSERT (map->ext[e].start == HOLE);
+      if (e > 0)
+        {
+          struct extent *prev = &map->ext[e - 1];
+          near = prev->start + prev->cnt + (idx - map->first[e]);
+        }
+      if (!alloc_run (near, end - idx, 0, &inode->pa, &start, &got))
+        {
+          success = false;
+          break;
+        }
+      if (!map_plug (map, e, idx, start, got))
+        {
+          free_map_release (start, got);
+          success = false;
+          break;
+        }
+      if (d->unwritten_cnt == 0)
+        d->unwritten = idx;
+      d->unwritten_cnt += got;
+      idx += got;
+    }
+  return map_store (map, d, inode->sector) && success;
+}
+
+/* Makes sure the LEN bytes of INODE at OFFSET have sectors on
+   disk, extending INODE if they go past its end, so that writing
+   them later needs no allocation.  Holes within the file are
+   filled with zeros as a write would; sectors for the hole at the
+   end of the file are instead allocated in runs as long as
+   possible and left unwritten, reading as zeros without being
+   read from disk.  Returns false if INODE is not a file on disk,
+   writes to it are denied, or the disk is full, in which case
+   some of the sectors may have been allocated. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t len)
+{
+  struct extent_map *map = inode->map;
+  block_sector_t idx, end, tail;
+  bool success = false;
+
+  if (inode->ops != &disk_inode_ops || inode_is_dir (inode)
+      || inode->sector == FREE_MAP_SECTOR
+      || offset < 0 || len <= 0 || offset > INT32_MAX - len)
+    return false;
+
+  journal_begin ();
+  rwlock_acquire_exclusive (&inode->lock);
+  if (inode->deny_write_cnt > 0)
+    goto done;
+  delalloc_flush (inode);
+  if (inode_is_inline (inode))
+    {
+      if (offset + len <= (off_t) INLINE_MAX)
+        {
+          if (offset + len > inode->data.length)
+            inline_write (inode, zeros, 0, offset + len);
+          success = true;
+          goto done;
+        }
+      if (!inode_uninline (inode))
+        goto done;
+    }
+  if (offset + len > inode->data.length
+      && !inode_extend (inode, offset + len))
+    goto done;
+
+  idx = offset / BLOCK_SECTOR_SIZE;
+  end = bytes_to_sectors (offset + len);
+  tail = map->sectors;
+  if (map->cnt > 0 && map->ext[map->cnt - 1].start == HOLE)
+    tail = map->first[map->cnt - 1];
+  success = ((idx >= tail
+              || inode_fill (inode, offset,
+                             (off_t) (end < tail ? end : tail)
+                             * BLOCK_SECTOR_SIZE - offset))
+             && (end <= tail
+                 || allocate_unwritten (inode, idx > tail ? idx : tail,
+                                        end)));
+
+ done:
+  rwlock_release_exclusive (&inode->lock);
+  journal_end ();
+  return success;
+}
+
+/* Moves the data sectors of INODE, if they lie in more than one
+   run on disk, into one run of free sectors near the inode, so
+   that reading it is sequential.  The data moves through the
+   cache, which has the latest of it, and readers and writers of
+   INODE wait meanwhile.  Returns true if INODE's data is now in
+   one run, false if it is not a file on disk or no run of free
+   sectors is long enough. */
+bool
+inode_defrag (struct inode *inode)
+{
+  struct extent_map *map = inode->map;
+  struct extent_map *merged = NULL;
+  block_sector_t data_cnt = 0, run_end = HOLE, next;
+  size_t runs = 0;
+  uint8_t *page = NULL;
+  bool success = false;
+  size_t i;
+
+  if (inode->ops != &disk_inode_ops || inode_is_dir (inode)
+      || inode->sector == FREE_MAP_SECTOR)
+    return false;
+  page = palloc_get_page (0);
+  merged = malloc (sizeof *merged);
+  if (page == NULL || merged == NULL)
+    goto out;
+
+  journal_begin ();
+  rwlock_acquire_exclusive (&inode->lock);
+  delalloc_flush (inode);
+  for (i = 0; i < map->cnt; i++)
+    if (map->ext[i].start != HOLE)
+      {
+        if (map->ext[i].start != run_end)
+          runs++;
+        run_end = map->ext[i].start + map->ext[i].cnt;
+        data_cnt += map->ext[i].cnt;
+      }
+  if (runs <= 1)
+    {
+      success = true;
+      goto done;
+    }
+  if (!free_map_allocate (inode->sector + 1, data_cnt, &next))
+    goto done;
+
+  /* Copy each extent to its place in the new run, then put the
+     extents back together, merging those that now continue. */
+  merged->cnt = merged->hint = merged->sectors = 0;
+  for (i = 0; i < map->cnt; i++)
+    {
+      struct extent *x = &map->ext[i];
+
+      if (x->start != HOLE)
+        {
+          block_sector_t done_cnt, n;
+
+          for (done_cnt = 0; done_cnt < x->cnt; done_cnt += n)
+            {
+              n = x->cnt - done_cnt;
+              if (n > PGSIZE / BLOCK_SECTOR_SIZE)
+                n = PGSIZE / BLOCK_SECTOR_SIZE;
+              cache_read_run (x->start + done_cnt, n, page);
+              cache_write_run (next + done_cnt, n, page);
+            }
+          free_map_release (x->start, x->cnt);
+          x->start = next;
+          next += x->cnt;
+        }
+      map_append (merged, x->start, x->cnt);
+    }
+  memcpy (map, merged, sizeof *map);
+  if (inode->pa.cnt > 0)
+    {
+      free_map_release (inode->pa.start, inode->pa.cnt);
+      inode->pa.cnt = 0;
+    }
+  success = map_store (map, &inode->data, inode->sector);
+
+ done:
+  rwlock_release_exclusive (&inode->lock);
+  journal_end ();
+ out:
+  free (merged);
+  palloc_free_page (page);
+  return success;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if an error occurs.  A write past end of file
+   extends the inode first, and a write into holes allocates
+   sectors for them.  Data stays in the inode until a write takes
+   it past INLINE_MAX bytes.  The contents of directories and the
+   free map are metadata, and journaled.  Other data appended to
+   a file waits in memory for its sectors, as delalloc_write()
+   describes, until the inode is synced or closed or the data
+   stops growing in place. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset) 
+{
+  return inode->ops->write_at (inode, buffer, size, offset);
+}
+
+static off_t
+disk_write_at (struct inode *inode, const void *buffer_, off_t size,
+               off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  /* Files only grow while open, so a write found to fit needs no
+     exclusive lock even though LENGTH is read without one.  It
+     does if it lands in a hole or on unwritten sectors, or after
+     them, which is only known under the lock. */
+  bool exclusive = size > 0 && offset + size > inode_length (inode);
+  bool meta = inode_is_dir (inode) || inode->sector == FREE_MAP_SECTOR;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  journal_begin ();
+  if (exclusive)
+    rwlock_acquire_exclusive (&inode->lock);
+  else
+    {
+      rwlock_acquire_shared (&inode->lock);
+      if (size > 0
+          && (inode_is_inline (inode)
+              || map_has_hole (inode->map, offset / BLOCK_SECTOR_SIZE,
+                               bytes_to_sectors (offset + size)
+                               - offset / BLOCK_SECTOR_SIZE)
+              || (inode->data.unwritten_cnt > 0
+                  && bytes_to_sectors (offset + size)
+                     > inode->data.unwritten)))
+        {
+          rwlock_release_shared (&inode->lock);
+          rwlock_acquire_exclusive (&inode->lock);
+          exclusive = true;
+        }
+    }
+  if (inode->deny_write_cnt == 0 && size > 0 && inode_is_inline (inode))
+    {
+      if (offset + size <= (off_t) INLINE_MAX)
+        {
+          bytes_written = inline_write (inode, buffer, size, offset);
+          goto done;
+        }
+      if (!inode_uninline (inode))
+        goto done;
+    }
+  if (inode->deny_write_cnt == 0 && exclusive && !meta)
+    {
+      if (delalloc_write (inode, buffer, size, offset))
+        {
+          bytes_written = size;
+          goto done;
+        }
+      delalloc_flush (inode);
+    }
+  if (inode->deny_write_cnt
+      || (exclusive && offset + size > inode->data.length
+          && !inode_extend (inode, offset + size))
+      || (exclusive && !inode_fill (inode, offset, size)))
+    goto done;
+  if (exclusive)
+    take_unwritten (inode, bytes_to_sectors (offset + size), offset, size);
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      block_sector_t run;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -281,49 +1805,93 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
+      /* Write whole sectors of file data in runs, straight from
+         BUFFER.  The holes have been filled by now. */
+      run = meta ? 0 : run_sectors (inode, buffer + bytes_written, offset,
+                                    size);
+      if (run > 0)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          chunk_size = run * BLOCK_SECTOR_SIZE;
+          cache_write_run (sector_idx, run, buffer + bytes_written);
         }
+      else if (meta)
+        journal_write (sector_idx, buffer + bytes_written, sector_ofs,
+                       chunk_size);
+      else
+        cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                     chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+ done:
+  if (bytes_written > 0)
+    inode->write_gen++;
+  if (exclusive)
+    rwlock_release_exclusive (&inode->lock);
+  else
+    rwlock_release_shared (&inode->lock);
+  journal_end ();
   return bytes_written;
 }
 
+/* Returns true if SECTOR holds data or metadata of INODE_. */
+static bool
+holds_sector (block_sector_t sector, void *inode_)
+{
+  struct inode *inode = inode_;
+  struct extent_map *map = inode->map;
+  size_t i;
+
+  if (sector == inode->sector
+      || (inode->data.indirect != 0 && sector == inode->data.indirect))
+    return true;
+  for (i = 0; i < map->cnt; i++)
+    if (map->ext[i].start != HOLE
+        && sector - map->ext[i].start < map->ext[i].cnt)
+      return true;
+  return false;
+}
+
+/* Writes INODE's modified data, and the inode and extent block
+   that lead to it, to disk and waits until they are written.
+   Commits the journal first, since it holds back the latter. */
+void
+inode_sync (struct inode *inode)
+{
+  inode->ops->sync (inode);
+}
+
+static void
+disk_sync (struct inode *inode)
+{
+  rwlock_acquire_exclusive (&inode->lock);
+  delalloc_flush (inode);
+  rwlock_release_exclusive (&inode->lock);
+  journal_commit ();
+  rwlock_acquire_shared (&inode->lock);
+  cache_sync (holds_sector, inode);
+  rwlock_release_shared (&inode->lock);
+}
+
+/* An inode in memory has nothing to write. */
+static void
+mem_sync (struct inode *inode UNUSED)
+{
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_exclusive (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_exclusive (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +1900,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_exclusive (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_exclusive (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -343,3 +1913,26 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Notes that the VM's page cache holds pages of INODE, which must
+   be dropped from it when INODE is closed for the last time. */
+void
+inode_set_page_cached (struct inode *inode)
+{
+  inode->page_cached = true;
+}
+
+/* Returns true if the VM's page cache may hold pages of INODE. */
+bool
+inode_page_cached (const struct inode *inode)
+{
+  return inode->page_cached;
+}
+
+/* Returns a value that changes whenever INODE's data is written,
+   for callers that cache what they derived from it. */
+unsigned
+inode_write_gen (const struct inode *inode)
+{
+  return inode->write_gen;
+}
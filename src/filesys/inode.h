@@ -6,18 +6,66 @@
 #include "devices/block.h"
 
 struct bitmap;
+struct inode;
+
+/* Operations on an inode's data, which differ between inodes on
+   disk, inodes in memory and inodes made by other modules with
+   inode_create_anon().  The public functions of the same names
+   dispatch to them. */
+struct inode_ops
+  {
+    off_t (*read_at) (struct inode *, void *, off_t size, off_t offset);
+    off_t (*write_at) (struct inode *, const void *, off_t size,
+                       off_t offset);
+    void (*readahead) (struct inode *, off_t offset, off_t size);
+    void (*sync) (struct inode *);
+
+    /* Frees what INODE holds, once closed for the last time. */
+    void (*release) (struct inode *);
+  };
+
+/* Inumbers from here up belong to inodes kept only in memory,
+   which have no sector on disk. */
+#define INODE_MEM_BASE 0xf0000000u
+
+/* Returns true if inode number SECTOR is for an inode in
+   memory. */
+static inline bool
+inode_in_memory (block_sector_t sector)
+{
+  return sector >= INODE_MEM_BASE;
+}
+
+/* Sectors in a cluster, the unit of data allocation. */
+extern unsigned inode_cluster;
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+void inode_done (void);
+bool inode_create (block_sector_t, off_t, block_sector_t parent);
+bool inode_create_mem (off_t, block_sector_t parent, block_sector_t *);
+struct inode *inode_create_anon (const struct inode_ops *, void *aux);
+void *inode_aux (const struct inode *);
+void inode_set_length (struct inode *, off_t);
+const struct inode_ops *inode_get_ops (const struct inode *);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
+bool inode_is_dir (const struct inode *);
+block_sector_t inode_get_parent (const struct inode *);
+bool inode_is_removed (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_allocate (struct inode *, off_t offset, off_t len);
+bool inode_defrag (struct inode *);
+void inode_sync (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_set_page_cached (struct inode *);
+bool inode_page_cached (const struct inode *);
+unsigned inode_write_gen (const struct inode *);
 
 #endif /* filesys/inode.h */
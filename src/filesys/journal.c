@@ -0,0 +1,371 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Metadata journal.
+
+   Inodes, extent blocks, directories and the free map are
+   written with journal_write() by operations bracketed with
+   journal_begin() and journal_end().  What all the operations
+   between two commits write forms one transaction, whose sectors
+   the buffer cache holds back from write-back until
+   journal_commit() has written them to the log, in one
+   sequential write, followed by the header that lists them,
+   which is the commit point.  From then on the cache writes them
+   to their home locations at its own pace; only once the log is
+   nearly full does a checkpoint wait for that and empty it.
+
+   A transaction commits when it has no room for another
+   operation, with the buffer cache's periodic flush, on fsync
+   and at shutdown.  After a crash, journal_init() copies the
+   logged sectors home again, which brings the file system back
+   to its state at the last commit.  A released sector that may
+   be in the log gets a revoke entry, so that recovery won't copy
+   stale metadata over what the sector holds by then.
+
+   Only transaction sectors are held back, so file data can reach
+   the disk before or after the metadata that leads to it.
+
+   Synchronization: journal_lock protects the members below.  An
+   operation begun inside another one in the same thread is part
+   of it, and only an outermost one ever waits, before taking any
+   other file system lock. */
+
+/* Marks a valid header. */
+#define JOURNAL_MAGIC 0x4c4e524a
+
+/* Set in a log entry's home sector for a revoke entry. */
+#define REVOKE 0x80000000u
+
+/* Sectors a transaction may hold in the buffer cache. */
+#define TX_MAX (CACHE_SIZE / 2)
+
+/* Sectors one operation is expected to write at most.  Any an
+   operation writes past its transaction's room go straight to the
+   cache, unlogged. */
+#define OP_MAX 8
+
+/* On-disk journal header, at JOURNAL_SECTOR.  The log entries
+   follow it. */
+struct journal_header
+  {
+    uint32_t magic;                     /* JOURNAL_MAGIC. */
+    uint32_t cnt;                       /* Committed entries. */
+    block_sector_t home[JOURNAL_SIZE];  /* Home sector of each entry. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8
+                   - JOURNAL_SIZE * sizeof (block_sector_t)];
+  };
+
+static struct journal_header header;    /* As last written. */
+static block_sector_t tx[TX_MAX];       /* Sectors of the transaction. */
+static size_t tx_cnt;
+static size_t active;                   /* Outermost operations running. */
+static size_t commit_wanted;            /* Threads in journal_commit(). */
+static bool committing;                 /* Commit in progress? */
+static struct lock journal_lock;
+static struct condition journal_cond;   /* Signaled when the above change. */
+static uint8_t *log_buf;                /* TX_MAX sectors for the log. */
+
+/* Statistics. */
+static unsigned long long commit_cnt, logged_cnt, checkpoint_cnt;
+static unsigned long long revoke_cnt, unlogged_cnt;
+
+static void recover (void);
+
+/* Initializes the journal, recovering the file system from it
+   unless FORMAT, in which case it is created empty. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  lock_set_name (&journal_lock, "journal");
+  cond_init (&journal_cond);
+  log_buf = palloc_get_multiple (PAL_ASSERT,
+                                 TX_MAX * BLOCK_SECTOR_SIZE / PGSIZE);
+
+  if (!format)
+    {
+      block_read (fs_device, JOURNAL_SECTOR, &header);
+      if (header.magic != JOURNAL_MAGIC || header.cnt > JOURNAL_SIZE)
+        PANIC ("file system has no journal--reformat it");
+      if (header.cnt > 0)
+        recover ();
+    }
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Returns the index of SECTOR, revoked or not, in the
+   transaction, or TX_CNT if it is not in it.  journal_lock must
+   be held. */
+static size_t
+tx_find (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < tx_cnt; i++)
+    if ((tx[i] & ~REVOKE) == sector)
+      break;
+  return i;
+}
+
+/* Returns true if SECTOR is in the log, for cache_sync(). */
+static bool
+in_log (block_sector_t sector, void *aux UNUSED)
+{
+  size_t i;
+
+  for (i = 0; i < header.cnt; i++)
+    if (header.home[i] == sector)
+      return true;
+  return false;
+}
+
+/* Commits the transaction: writes its sectors to the log, then
+   the header, and lets the cache write them home.  Checkpoints
+   if the log has no room for another transaction.
+   journal_lock must be held, and no operation may be running. */
+static void
+commit (void)
+{
+  size_t first = header.cnt;
+  size_t cnt = tx_cnt;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (active == 0 && !committing);
+
+  if (cnt == 0)
+    return;
+  committing = true;
+  lock_release (&journal_lock);
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *data = log_buf + i * BLOCK_SECTOR_SIZE;
+
+      if (tx[i] & REVOKE)
+        memset (data, 0, BLOCK_SECTOR_SIZE);
+      else
+        cache_read (tx[i], data, 0, BLOCK_SECTOR_SIZE);
+      header.home[first + i] = tx[i];
+    }
+  block_write_multiple (fs_device, JOURNAL_SECTOR + 1 + first, log_buf, cnt);
+  header.cnt = first + cnt;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+  for (i = 0; i < cnt; i++)
+    if (!(tx[i] & REVOKE))
+      cache_unhold (tx[i]);
+  commit_cnt++;
+  logged_cnt += cnt;
+
+  if (header.cnt + TX_MAX > JOURNAL_SIZE)
+    {
+      cache_sync (in_log, NULL);
+      header.cnt = 0;
+      block_write (fs_device, JOURNAL_SECTOR, &header);
+      checkpoint_cnt++;
+    }
+
+  lock_acquire (&journal_lock);
+  tx_cnt = 0;
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+}
+
+/* Begins an operation that writes metadata.  Waits, committing
+   the transaction if it falls to us, until the transaction has
+   room for it. */
+void
+journal_begin (void)
+{
+  if (thread_current ()->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (committing || commit_wanted > 0
+         || tx_cnt + (active + 1) * OP_MAX > TX_MAX)
+    {
+      if (active == 0 && !committing && tx_cnt > 0)
+        commit ();
+      else
+        cond_wait (&journal_cond, &journal_lock);
+    }
+  active++;
+  lock_release (&journal_lock);
+}
+
+/* Ends the operation begun by the matching journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--active == 0)
+    cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into metadata SECTOR starting at
+   byte OFS, as part of the running operation's transaction.
+   Outside of an operation, this is just cache_write(). */
+void
+journal_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  bool hold = false;
+
+  if (thread_current ()->journal_depth > 0)
+    {
+      size_t i;
+
+      lock_acquire (&journal_lock);
+      i = tx_find (sector);
+      if (i < tx_cnt)
+        {
+          tx[i] = sector;
+          hold = true;
+        }
+      else if (tx_cnt < TX_MAX)
+        {
+          tx[tx_cnt++] = sector;
+          hold = true;
+        }
+      else
+        unlogged_cnt++;
+      lock_release (&journal_lock);
+    }
+
+  if (hold)
+    cache_write_held (sector, buffer, ofs, size);
+  else
+    cache_write (sector, buffer, ofs, size);
+}
+
+/* Notes that the CNT sectors starting at SECTOR have been
+   released, so that recovery must not write any of them from the
+   log. */
+void
+journal_revoke (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  if (thread_current ()->journal_depth == 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < tx_cnt; i++)
+    if (!(tx[i] & REVOKE) && tx[i] - sector < cnt)
+      {
+        cache_unhold (tx[i]);
+        tx[i] |= REVOKE;
+        revoke_cnt++;
+      }
+  for (i = 0; i < header.cnt; i++)
+    {
+      block_sector_t home = header.home[i];
+
+      if (!(home & REVOKE) && home - sector < cnt && tx_find (home) == tx_cnt)
+        {
+          if (tx_cnt < TX_MAX)
+            {
+              tx[tx_cnt++] = home | REVOKE;
+              revoke_cnt++;
+            }
+          else
+            unlogged_cnt++;
+        }
+    }
+  lock_release (&journal_lock);
+}
+
+/* Waits for the running operations to end, keeping new ones from
+   starting, and commits the transaction.  Must not be called
+   inside an operation. */
+void
+journal_commit (void)
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  commit_wanted++;
+  while (committing || active > 0)
+    cond_wait (&journal_cond, &journal_lock);
+  commit ();
+  commit_wanted--;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Commits the transaction and writes every sector home, leaving
+   the log empty. */
+void
+journal_done (void)
+{
+  journal_commit ();
+  cache_flush ();
+  header.cnt = 0;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Returns true if log entry I is to be copied home: it is not a
+   revoke entry, and none follows it for the same sector. */
+static bool
+replays (size_t i)
+{
+  size_t j;
+
+  if (header.home[i] & REVOKE)
+    return false;
+  for (j = i + 1; j < header.cnt; j++)
+    if (header.home[j] == (header.home[i] | REVOKE))
+      return false;
+  return true;
+}
+
+/* Copies every committed log entry to its home sector, in log
+   order. */
+static void
+recover (void)
+{
+  size_t first, i;
+
+  printf ("Recovering file system from journal, %u sectors...",
+          (unsigned) header.cnt);
+  for (first = 0; first < header.cnt; first += TX_MAX)
+    {
+      size_t cnt = header.cnt - first < TX_MAX ? header.cnt - first : TX_MAX;
+
+      block_read_multiple (fs_device, JOURNAL_SECTOR + 1 + first, log_buf,
+                           cnt);
+      for (i = 0; i < cnt; i++)
+        if (replays (first + i))
+          block_write (fs_device, header.home[first + i],
+                       log_buf + i * BLOCK_SECTOR_SIZE);
+    }
+  printf ("done.\n");
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu commits, %llu sectors logged, %llu checkpoints, "
+          "%llu revokes, %llu unlogged\n",
+          commit_cnt, logged_cnt, checkpoint_cnt, revoke_cnt, unlogged_cnt);
+}
@@ -0,0 +1,24 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of log entries, which fill up between checkpoints. */
+#define JOURNAL_SIZE 96
+
+/* Sectors used by the journal starting at JOURNAL_SECTOR: its
+   header, then the log. */
+#define JOURNAL_SECTORS (1 + JOURNAL_SIZE)
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *, int ofs, int size);
+void journal_revoke (block_sector_t, size_t cnt);
+void journal_commit (void);
+void journal_done (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,269 @@
+#include "filesys/pipe.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A pipe is a ring of PIPE_PAGES pages, allocated as they are
+   first written, with an inode for each end made by
+   inode_create_anon().  The files opened on the ends are what go
+   in file descriptor tables; fork() and spawn() copy them like
+   any other file.  Each end's inode is released once the last of
+   its files is closed, which the other end then sees as end of
+   file or a broken pipe. */
+#define PIPE_SIZE (PIPE_PAGES * PGSIZE)
+
+struct pipe
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readable;  /* Signaled when data or EOF arrives. */
+    struct condition writable;  /* Signaled when room or no reader. */
+    uint8_t *pages[PIPE_PAGES]; /* The ring, or nulls where unused yet. */
+    size_t rpos, wpos;          /* Bytes read and written, ever. */
+    bool read_open;             /* Read end still open? */
+    bool write_open;            /* Write end still open? */
+  };
+
+static off_t read_end_read_at (struct inode *, void *, off_t, off_t);
+static off_t write_end_read_at (struct inode *, void *, off_t, off_t);
+static off_t read_end_write_at (struct inode *, const void *, off_t, off_t);
+static off_t write_end_write_at (struct inode *, const void *, off_t, off_t);
+static void pipe_readahead (struct inode *, off_t, off_t);
+static void pipe_sync (struct inode *);
+static void read_end_release (struct inode *);
+static void write_end_release (struct inode *);
+
+static const struct inode_ops read_end_ops =
+  {
+    read_end_read_at, read_end_write_at, pipe_readahead, pipe_sync,
+    read_end_release
+  };
+
+static const struct inode_ops write_end_ops =
+  {
+    write_end_read_at, write_end_write_at, pipe_readahead, pipe_sync,
+    write_end_release
+  };
+
+/* Creates a pipe and stores files open on its read and write
+   ends into *READ_END and *WRITE_END.  Returns false if memory is
+   short. */
+bool
+pipe_create (struct file **read_end, struct file **write_end)
+{
+  struct pipe *p;
+  struct inode *r, *w;
+
+  p = calloc (1, sizeof *p);
+  if (p == NULL)
+    return false;
+  lock_init (&p->lock);
+  cond_init (&p->readable);
+  cond_init (&p->writable);
+  p->read_open = p->write_open = true;
+
+  r = inode_create_anon (&read_end_ops, p);
+  if (r == NULL)
+    {
+      free (p);
+      return false;
+    }
+  w = inode_create_anon (&write_end_ops, p);
+  if (w == NULL)
+    {
+      /* Closing the read end then frees P. */
+      p->write_open = false;
+      inode_close (r);
+      return false;
+    }
+
+  *read_end = file_open (r);
+  *write_end = file_open (w);
+  if (*read_end == NULL || *write_end == NULL)
+    {
+      file_close (*read_end);
+      file_close (*write_end);
+      return false;
+    }
+  return true;
+}
+
+/* Returns true if INODE is either end of a pipe. */
+bool
+pipe_is_pipe (const struct inode *inode)
+{
+  const struct inode_ops *ops = inode_get_ops (inode);
+  return ops == &read_end_ops || ops == &write_end_ops;
+}
+
+/* Reads up to SIZE bytes from the pipe whose read end is INODE
+   into BUFFER.  If the pipe is empty and its write end open,
+   waits for data first if BLOCK, or returns 0 if not.  Returns
+   the number of bytes read, 0 at end of file, or -1 if INODE is
+   the write end. */
+off_t
+pipe_read (struct inode *inode, void *buffer_, off_t size, bool block)
+{
+  struct pipe *p = inode_aux (inode);
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  ASSERT (pipe_is_pipe (inode));
+  if (inode_get_ops (inode) != &read_end_ops)
+    return -1;
+
+  lock_acquire (&p->lock);
+  while (block && p->rpos == p->wpos && p->write_open)
+    cond_wait (&p->readable, &p->lock);
+  while (bytes_read < size && p->rpos != p->wpos)
+    {
+      size_t ofs = p->rpos % PGSIZE;
+      size_t chunk = PGSIZE - ofs;
+
+      if (chunk > p->wpos - p->rpos)
+        chunk = p->wpos - p->rpos;
+      if (chunk > (size_t) (size - bytes_read))
+        chunk = size - bytes_read;
+      memcpy (buffer + bytes_read,
+              p->pages[p->rpos / PGSIZE % PIPE_PAGES] + ofs, chunk);
+      p->rpos += chunk;
+      bytes_read += chunk;
+    }
+  if (bytes_read > 0)
+    cond_broadcast (&p->writable, &p->lock);
+  lock_release (&p->lock);
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into the pipe whose write end is
+   INODE, waiting for room as needed.  Returns the number of bytes
+   written, which is short only if the read end is closed or
+   memory is short, or -1 if none could be written for that
+   reason or INODE is the read end. */
+off_t
+pipe_write (struct inode *inode, const void *buffer_, off_t size)
+{
+  struct pipe *p = inode_aux (inode);
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  ASSERT (pipe_is_pipe (inode));
+  if (inode_get_ops (inode) != &write_end_ops)
+    return -1;
+
+  lock_acquire (&p->lock);
+  while (bytes_written < size && p->read_open)
+    {
+      uint8_t **page = &p->pages[p->wpos / PGSIZE % PIPE_PAGES];
+      size_t ofs = p->wpos % PGSIZE;
+      size_t chunk = PGSIZE - ofs;
+
+      if (p->wpos - p->rpos == PIPE_SIZE)
+        {
+          cond_wait (&p->writable, &p->lock);
+          continue;
+        }
+      if (*page == NULL && (*page = palloc_get_page (0)) == NULL)
+        break;
+
+      if (chunk > PIPE_SIZE - (p->wpos - p->rpos))
+        chunk = PIPE_SIZE - (p->wpos - p->rpos);
+      if (chunk > (size_t) (size - bytes_written))
+        chunk = size - bytes_written;
+      memcpy (*page + ofs, buffer + bytes_written, chunk);
+      p->wpos += chunk;
+      bytes_written += chunk;
+      cond_broadcast (&p->readable, &p->lock);
+    }
+  lock_release (&p->lock);
+  return bytes_written > 0 || size == 0 ? bytes_written : -1;
+}
+
+/* inode_read_at() on a read end waits for data, ignoring the
+   offset. */
+static off_t
+read_end_read_at (struct inode *inode, void *buffer, off_t size,
+                  off_t offset UNUSED)
+{
+  return pipe_read (inode, buffer, size, true);
+}
+
+/* Nothing can be read from a write end. */
+static off_t
+write_end_read_at (struct inode *inode UNUSED, void *buffer UNUSED,
+                   off_t size UNUSED, off_t offset UNUSED)
+{
+  return 0;
+}
+
+/* Nothing can be written to a read end. */
+static off_t
+read_end_write_at (struct inode *inode UNUSED, const void *buffer UNUSED,
+                   off_t size UNUSED, off_t offset UNUSED)
+{
+  return 0;
+}
+
+/* inode_write_at() on a write end, ignoring the offset. */
+static off_t
+write_end_write_at (struct inode *inode, const void *buffer, off_t size,
+                    off_t offset UNUSED)
+{
+  off_t bytes_written = pipe_write (inode, buffer, size);
+  return bytes_written > 0 ? bytes_written : 0;
+}
+
+/* A pipe has nothing to read ahead. */
+static void
+pipe_readahead (struct inode *inode UNUSED, off_t offset UNUSED,
+                off_t size UNUSED)
+{
+}
+
+/* A pipe has nothing to write back. */
+static void
+pipe_sync (struct inode *inode UNUSED)
+{
+}
+
+/* Marks one end of P closed, as READ_END tells, waking whoever
+   waits at the other, and frees P once both are. */
+static void
+close_end (struct pipe *p, bool read_end)
+{
+  bool done;
+  size_t i;
+
+  lock_acquire (&p->lock);
+  if (read_end)
+    p->read_open = false;
+  else
+    p->write_open = false;
+  cond_broadcast (&p->readable, &p->lock);
+  cond_broadcast (&p->writable, &p->lock);
+  done = !p->read_open && !p->write_open;
+  lock_release (&p->lock);
+
+  if (done)
+    {
+      for (i = 0; i < PIPE_PAGES; i++)
+        palloc_free_page (p->pages[i]);
+      free (p);
+    }
+}
+
+static void
+read_end_release (struct inode *inode)
+{
+  close_end (inode_aux (inode), true);
+}
+
+static void
+write_end_release (struct inode *inode)
+{
+  close_end (inode_aux (inode), false);
+}
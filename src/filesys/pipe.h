@@ -0,0 +1,18 @@
+#ifndef FILESYS_PIPE_H
+#define FILESYS_PIPE_H
+
+#include <stdbool.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct inode;
+
+/* Pages of data a pipe holds at most. */
+#define PIPE_PAGES 16
+
+bool pipe_create (struct file **read_end, struct file **write_end);
+bool pipe_is_pipe (const struct inode *);
+off_t pipe_read (struct inode *, void *, off_t size, bool block);
+off_t pipe_write (struct inode *, const void *, off_t size);
+
+#endif /* filesys/pipe.h */
@@ -0,0 +1,252 @@
+#include "filesys/stats.h"
+#include <console.h>
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/kbd.h"
+#include "devices/timer.h"
+#include "filesys/inode.h"
+#include "threads/interrupt.h"
+#include "threads/memprof.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/exception.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
+
+/* A statistics file's contents, taken when it was opened, at the
+   start of a page of their own. */
+struct snapshot
+  {
+    size_t len;                 /* Bytes of TEXT used. */
+    char text[];                /* Whatever the group printed. */
+  };
+
+#define SNAPSHOT_MAX (PGSIZE - sizeof (struct snapshot))
+
+static void print_vm (void);
+static void print_io (void);
+static void print_threads (void);
+
+/* The groups of statistics, each printed by the same functions
+   that print it at shutdown. */
+struct stats_group
+  {
+    const char *name;
+    void (*print) (void);
+  };
+
+static const struct stats_group groups[] =
+  {
+    {"vm", print_vm},
+    {"io", print_io},
+    {"threads", print_threads},
+  };
+
+static off_t stats_read_at (struct inode *, void *, off_t, off_t);
+static off_t stats_write_at (struct inode *, const void *, off_t, off_t);
+static void stats_readahead (struct inode *, off_t, off_t);
+static void stats_sync (struct inode *);
+static void stats_release (struct inode *);
+
+static const struct inode_ops stats_ops =
+  {
+    stats_read_at, stats_write_at, stats_readahead, stats_sync,
+    stats_release
+  };
+
+/* Returns true if PATH names a statistics file, existing or
+   not. */
+bool
+stats_is_path (const char *path)
+{
+  size_t len = strlen (STATS_DIR);
+
+  return strnlen (path, len) == len && !memcmp (path, STATS_DIR, len);
+}
+
+/* Opens the statistics file named PATH, which must be under
+   STATS_DIR, taking a snapshot of its group.  Returns a null
+   pointer if there is no such group or memory is short. */
+struct inode *
+stats_open (const char *path)
+{
+  const char *name = path + strlen (STATS_DIR);
+  struct snapshot *s;
+  struct inode *inode;
+  size_t i;
+
+  ASSERT (stats_is_path (path));
+
+  for (i = 0; i < sizeof groups / sizeof *groups; i++)
+    if (!strcmp (name, groups[i].name))
+      break;
+  if (i == sizeof groups / sizeof *groups)
+    return NULL;
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+  console_capture_begin (s->text, SNAPSHOT_MAX);
+  groups[i].print ();
+  s->len = console_capture_end ();
+
+  inode = inode_create_anon (&stats_ops, s);
+  if (inode == NULL)
+    palloc_free_page (s);
+  return inode;
+}
+
+/* Memory: free frames, slab caches, paging and swap. */
+static void
+print_vm (void)
+{
+  palloc_print_stats ();
+  kmem_print_stats ();
+  memprof_print_stats ();
+#ifdef USERPROG
+  exception_print_stats ();
+  pagedir_print_stats ();
+#endif
+#ifdef VM
+  frame_print_stats ();
+  swap_print_stats ();
+  zswap_print_stats ();
+#endif
+}
+
+/* Devices, with the buffer cache and journal, and the console. */
+static void
+print_io (void)
+{
+  block_print_stats ();
+  console_print_stats ();
+  kbd_print_stats ();
+#ifdef USERPROG
+  syscall_print_stats ();
+#endif
+}
+
+/* Most threads listed by print_threads(). */
+#define THREAD_SAMPLES 64
+
+struct thread_sample
+  {
+    tid_t tid;
+    char name[16];
+    enum thread_status status;
+    int priority;
+    int64_t run_ticks;
+  };
+
+struct thread_samples
+  {
+    struct thread_sample s[THREAD_SAMPLES];
+    size_t cnt;
+  };
+
+/* Records T into the thread_samples at AUX, if there is room. */
+static void
+sample_thread (struct thread *t, void *aux)
+{
+  struct thread_samples *samples = aux;
+
+  if (samples->cnt < THREAD_SAMPLES)
+    {
+      struct thread_sample *s = &samples->s[samples->cnt++];
+      s->tid = t->tid;
+      strlcpy (s->name, t->name, sizeof s->name);
+      s->status = t->status;
+      s->priority = t->priority;
+      s->run_ticks = t->run_ticks;
+    }
+}
+
+/* Timer, interrupts and scheduler totals, then each thread's
+   ticks.  The threads are sampled first, with interrupts off, and
+   printed afterward, since printing may block. */
+static void
+print_threads (void)
+{
+  static const char *status_names[] =
+    {"running", "ready", "blocked", "dying"};
+  struct thread_samples *samples;
+  enum intr_level old_level;
+  size_t i;
+
+  timer_print_stats ();
+  intr_print_stats ();
+  thread_print_stats ();
+  lockstat_print_stats ();
+
+  samples = palloc_get_page (0);
+  if (samples == NULL)
+    return;
+  samples->cnt = 0;
+  old_level = intr_disable ();
+  thread_foreach (sample_thread, samples);
+  intr_set_level (old_level);
+
+  printf ("%5s %-15s %-7s %4s %10s\n",
+          "TID", "NAME", "STATUS", "PRI", "TICKS");
+  for (i = 0; i < samples->cnt; i++)
+    {
+      struct thread_sample *s = &samples->s[i];
+      printf ("%5d %-15s %-7s %4d %10lld\n", s->tid, s->name,
+              status_names[s->status], s->priority, s->run_ticks);
+    }
+  palloc_free_page (samples);
+}
+
+/* Reads from the snapshot at OFFSET. */
+static off_t
+stats_read_at (struct inode *inode, void *buffer, off_t size, off_t offset)
+{
+  struct snapshot *s = inode_aux (inode);
+
+  if (offset < 0 || (size_t) offset >= s->len)
+    return 0;
+  if ((size_t) size > s->len - offset)
+    size = s->len - offset;
+  memcpy (buffer, s->text + offset, size);
+  return size;
+}
+
+/* Statistics files are read-only. */
+static off_t
+stats_write_at (struct inode *inode UNUSED, const void *buffer UNUSED,
+                off_t size UNUSED, off_t offset UNUSED)
+{
+  return 0;
+}
+
+/* A snapshot has nothing to read ahead. */
+static void
+stats_readahead (struct inode *inode UNUSED, off_t offset UNUSED,
+                 off_t size UNUSED)
+{
+}
+
+/* A snapshot has nothing to write back. */
+static void
+stats_sync (struct inode *inode UNUSED)
+{
+}
+
+static void
+stats_release (struct inode *inode)
+{
+  palloc_free_page (inode_aux (inode));
+}
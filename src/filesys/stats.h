@@ -0,0 +1,17 @@
+#ifndef FILESYS_STATS_H
+#define FILESYS_STATS_H
+
+#include <stdbool.h>
+
+struct inode;
+
+/* Opening STATS_DIR "NAME" yields a read-only file holding the
+   kernel statistics of group NAME, as printed at shutdown, taken
+   when it is opened: "vm", "io" or "threads".  The directory
+   exists only by name and is served without a disk. */
+#define STATS_DIR "/.stats/"
+
+bool stats_is_path (const char *);
+struct inode *stats_open (const char *path);
+
+#endif /* filesys/stats.h */
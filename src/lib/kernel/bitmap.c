@@ -69,6 +69,29 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the index of the first bit in B from START up to END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Whole elements are examined at a time. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      elem_type bits = (b->bits[idx] ^ flip) & -bit_mask (start);
+
+      if (bits != 0)
+        {
+          size_t bit = idx * ELEM_BITS + __builtin_ctzl (bits);
+          return bit < end ? bit : end;
+        }
+      start = (idx + 1) * ELEM_BITS;
+    }
+  return end;
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -250,16 +273,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,17 +316,44 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Jump to the next bit set to VALUE, then past the first
+         bit in the following CNT that isn't, if any. */
+      while ((i = find_bit (b, i, last + 1, value)) <= last)
+        {
+          size_t end = find_bit (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end + 1;
+        }
     }
   return BITMAP_ERROR;
 }
 
+/* Like bitmap_scan(), but starts looking at HINT and, if that
+   finds nothing, goes on from the beginning of B.  Useful for
+   allocators that keep a cursor past their last allocation. */
+size_t
+bitmap_scan_hint (const struct bitmap *b, size_t hint, size_t cnt, bool value)
+{
+  size_t idx;
+
+  ASSERT (b != NULL);
+
+  if (hint > b->bit_cnt)
+    hint = 0;
+  idx = bitmap_scan (b, hint, cnt, value);
+  if (idx == BITMAP_ERROR && hint > 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  return idx;
+}
+
 /* Finds the first group of CNT consecutive bits in B at or after
    START that are all set to VALUE, flips them all to !VALUE,
    and returns the index of the first bit in the group.
@@ -358,6 +403,19 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B's file image starting at byte OFS
+   to the same place in FILE.  Return true if successful, false
+   otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  ASSERT (ofs <= byte_cnt (b->bit_cnt));
+  ASSERT (size <= byte_cnt (b->bit_cnt) - ofs);
+  return (file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
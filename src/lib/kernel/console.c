@@ -1,14 +1,18 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 static void vprintf_helper (char, void *);
-static void putchar_have_lock (uint8_t c);
+static void putbuf_have_lock (const char *, size_t);
+static void acquire_console (void);
+static void release_console (void);
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -59,14 +63,56 @@ static int console_lock_depth;
 /* Number of characters written to console. */
 static int64_t write_cnt;
 
+/* Output of the thread in capture_thread, if not null, goes into
+   capture_buf instead of the console, up to capture_size bytes.
+   Only one thread captures at a time, holding capture_lock. */
+static struct lock capture_lock;
+static struct thread *capture_thread;
+static char *capture_buf;
+static size_t capture_size, capture_len;
+
 /* Enable console locking. */
 void
 console_init (void) 
 {
   lock_init (&console_lock);
+  lock_set_name (&console_lock, "console");
+  lock_init (&capture_lock);
   use_console_lock = true;
 }
 
+/* Makes the running thread's console output go into the SIZE
+   bytes at BUF, instead of the console, until
+   console_capture_end().  Output past SIZE bytes is dropped.
+   Waits for any other thread's capture to end first. */
+void
+console_capture_begin (char *buf, size_t size) 
+{
+  lock_acquire (&capture_lock);
+  acquire_console ();
+  capture_buf = buf;
+  capture_size = size;
+  capture_len = 0;
+  capture_thread = thread_current ();
+  release_console ();
+}
+
+/* Ends the running thread's capture and returns the number of
+   bytes stored. */
+size_t
+console_capture_end (void) 
+{
+  size_t len;
+
+  ASSERT (capture_thread == thread_current ());
+  acquire_console ();
+  capture_thread = NULL;
+  len = capture_len;
+  release_console ();
+  lock_release (&capture_lock);
+  return len;
+}
+
 /* Notifies the console that a kernel panic is underway,
    which warns it to avoid trying to take the console lock from
    now on. */
@@ -119,19 +165,33 @@ console_locked_by_current_thread (void)
           || lock_held_by_current_thread (&console_lock));
 }
 
+/* vprintf() formats into one of these on its stack and writes it
+   out whenever it fills, rather than a character at a time. */
+#define PRINTF_BUF_SIZE 128
+
+struct printf_buf
+  {
+    char buf[PRINTF_BUF_SIZE];  /* Characters not yet written. */
+    size_t len;                 /* Number of them. */
+    int char_cnt;               /* Characters formatted in all. */
+  };
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list.
    Writes its output to both vga display and serial port. */
 int
 vprintf (const char *format, va_list args) 
 {
-  int char_cnt = 0;
+  struct printf_buf pb;
 
+  pb.len = 0;
+  pb.char_cnt = 0;
   acquire_console ();
-  __vprintf (format, args, vprintf_helper, &char_cnt);
+  __vprintf (format, args, vprintf_helper, &pb);
+  putbuf_have_lock (pb.buf, pb.len);
   release_console ();
 
-  return char_cnt;
+  return pb.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
@@ -140,9 +200,8 @@ int
 puts (const char *s) 
 {
   acquire_console ();
-  while (*s != '\0')
-    putchar_have_lock (*s++);
-  putchar_have_lock ('\n');
+  putbuf_have_lock (s, strlen (s));
+  putbuf_have_lock ("\n", 1);
   release_console ();
 
   return 0;
@@ -153,8 +212,7 @@ void
 putbuf (const char *buffer, size_t n) 
 {
   acquire_console ();
-  while (n-- > 0)
-    putchar_have_lock (*buffer++);
+  putbuf_have_lock (buffer, n);
   release_console ();
 }
 
@@ -162,30 +220,49 @@ putbuf (const char *buffer, size_t n)
 int
 putchar (int c) 
 {
+  char ch = c;
+
   acquire_console ();
-  putchar_have_lock (c);
+  putbuf_have_lock (&ch, 1);
   release_console ();
   
   return c;
 }
-
+
 /* Helper function for vprintf(). */
 static void
-vprintf_helper (char c, void *char_cnt_) 
+vprintf_helper (char c, void *pb_) 
 {
-  int *char_cnt = char_cnt_;
-  (*char_cnt)++;
-  putchar_have_lock (c);
+  struct printf_buf *pb = pb_;
+
+  pb->char_cnt++;
+  pb->buf[pb->len++] = c;
+  if (pb->len == PRINTF_BUF_SIZE)
+    {
+      putbuf_have_lock (pb->buf, pb->len);
+      pb->len = 0;
+    }
 }
 
-/* Writes C to the vga display and serial port.
-   The caller has already acquired the console lock if
-   appropriate. */
+/* Writes the N characters in BUFFER to the vga display and
+   serial port.  The caller has already acquired the console
+   lock if appropriate. */
 static void
-putchar_have_lock (uint8_t c) 
+putbuf_have_lock (const char *buffer, size_t n) 
 {
   ASSERT (console_locked_by_current_thread ());
-  write_cnt++;
-  serial_putc (c);
-  vga_putc (c);
+  if (n == 0)
+    return;
+  if (capture_thread != NULL && !intr_context ()
+      && capture_thread == thread_current ())
+    {
+      if (n > capture_size - capture_len)
+        n = capture_size - capture_len;
+      memcpy (capture_buf + capture_len, buffer, n);
+      capture_len += n;
+      return;
+    }
+  write_cnt += n;
+  serial_putbuf ((const uint8_t *) buffer, n);
+  vga_putbuf (buffer, n);
 }
@@ -1,8 +1,12 @@
 #ifndef __LIB_KERNEL_CONSOLE_H
 #define __LIB_KERNEL_CONSOLE_H
 
+#include <stddef.h>
+
 void console_init (void);
 void console_panic (void);
 void console_print_stats (void);
+void console_capture_begin (char *, size_t);
+size_t console_capture_end (void);
 
 #endif /* lib/kernel/console.h */
@@ -17,7 +17,9 @@ static struct hash_elem *find_elem (struct hash *, struct list *,
                                     struct hash_elem *);
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
+static struct hash_elem *lookup (struct hash *, struct hash_elem *);
 static void rehash (struct hash *);
+static void migrate (struct hash *, size_t cnt);
 
 /* Initializes hash table H to compute hash values using HASH and
    compare hash elements using LESS, given auxiliary data AUX. */
@@ -28,6 +30,9 @@ hash_init (struct hash *h,
   h->elem_cnt = 0;
   h->bucket_cnt = 4;
   h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
+  h->old_buckets = NULL;
+  h->old_bucket_cnt = 0;
+  h->migrate_idx = 0;
   h->hash = hash;
   h->less = less;
   h->aux = aux;
@@ -55,6 +60,7 @@ hash_clear (struct hash *h, hash_action_func *destructor)
 {
   size_t i;
 
+  migrate (h, SIZE_MAX);
   for (i = 0; i < h->bucket_cnt; i++) 
     {
       struct list *bucket = &h->buckets[i];
@@ -89,6 +95,7 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
   if (destructor != NULL)
     hash_clear (h, destructor);
   free (h->buckets);
+  free (h->old_buckets);
 }
 
 /* Inserts NEW into hash table H and returns a null pointer, if
@@ -98,11 +105,10 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
 struct hash_elem *
 hash_insert (struct hash *h, struct hash_elem *new)
 {
-  struct list *bucket = find_bucket (h, new);
-  struct hash_elem *old = find_elem (h, bucket, new);
+  struct hash_elem *old = lookup (h, new);
 
   if (old == NULL) 
-    insert_elem (h, bucket, new);
+    insert_elem (h, find_bucket (h, new), new);
 
   rehash (h);
 
@@ -114,12 +120,11 @@ hash_insert (struct hash *h, struct hash_elem *new)
 struct hash_elem *
 hash_replace (struct hash *h, struct hash_elem *new) 
 {
-  struct list *bucket = find_bucket (h, new);
-  struct hash_elem *old = find_elem (h, bucket, new);
+  struct hash_elem *old = lookup (h, new);
 
   if (old != NULL)
     remove_elem (h, old);
-  insert_elem (h, bucket, new);
+  insert_elem (h, find_bucket (h, new), new);
 
   rehash (h);
 
@@ -131,7 +136,7 @@ hash_replace (struct hash *h, struct hash_elem *new)
 struct hash_elem *
 hash_find (struct hash *h, struct hash_elem *e) 
 {
-  return find_elem (h, find_bucket (h, e), e);
+  return lookup (h, e);
 }
 
 /* Finds, removes, and returns an element equal to E in hash
@@ -144,7 +149,7 @@ hash_find (struct hash *h, struct hash_elem *e)
 struct hash_elem *
 hash_delete (struct hash *h, struct hash_elem *e)
 {
-  struct hash_elem *found = find_elem (h, find_bucket (h, e), e);
+  struct hash_elem *found = lookup (h, e);
   if (found != NULL) 
     {
       remove_elem (h, found);
@@ -153,6 +158,24 @@ hash_delete (struct hash *h, struct hash_elem *e)
   return found;
 }
 
+/* Inserts E, whose hash value is HASH, into hash table H, which
+   must hold no element equal to it.  For tables made by
+   HASH_SPECIALIZE, which hash elements themselves. */
+void
+hash_insert_hashed (struct hash *h, struct hash_elem *e, unsigned hash)
+{
+  insert_elem (h, &h->buckets[hash & (h->bucket_cnt - 1)], e);
+  rehash (h);
+}
+
+/* Removes E, which must be in hash table H, from H. */
+void
+hash_remove (struct hash *h, struct hash_elem *e)
+{
+  remove_elem (h, e);
+  rehash (h);
+}
+
 /* Calls ACTION for each element in hash table H in arbitrary
    order. 
    Modifying hash table H while hash_apply() is running, using
@@ -166,6 +189,7 @@ hash_apply (struct hash *h, hash_action_func *action)
   
   ASSERT (action != NULL);
 
+  migrate (h, SIZE_MAX);
   for (i = 0; i < h->bucket_cnt; i++) 
     {
       struct list *bucket = &h->buckets[i];
@@ -202,6 +226,7 @@ hash_first (struct hash_iterator *i, struct hash *h)
   ASSERT (i != NULL);
   ASSERT (h != NULL);
 
+  migrate (h, SIZE_MAX);
   i->hash = h;
   i->bucket = i->hash->buckets;
   i->elem = list_elem_to_hash_elem (list_head (i->bucket));
@@ -325,6 +350,23 @@ find_elem (struct hash *h, struct list *bucket, struct hash_elem *e)
   return NULL;
 }
 
+/* Searches H for a hash element equal to E, including in the
+   old bucket it may still be in.  Returns it if found or a null
+   pointer otherwise. */
+static struct hash_elem *
+lookup (struct hash *h, struct hash_elem *e)
+{
+  struct hash_elem *found = find_elem (h, find_bucket (h, e), e);
+
+  if (found == NULL && h->old_buckets != NULL)
+    {
+      size_t idx = h->hash (e, h->aux) & (h->old_bucket_cnt - 1);
+      if (idx >= h->migrate_idx)
+        found = find_elem (h, &h->old_buckets[idx], e);
+    }
+  return found;
+}
+
 /* Returns X with its lowest-order bit set to 1 turned off. */
 static inline size_t
 turn_off_least_1bit (size_t x) 
@@ -344,22 +386,52 @@ is_power_of_2 (size_t x)
 #define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
 #define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
 
-/* Changes the number of buckets in hash table H to match the
-   ideal.  This function can fail because of an out-of-memory
-   condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+/* Old buckets moved by each insertion or deletion. */
+#define MIGRATE_STEP 2
+
+/* Moves the elements of up to CNT old buckets of H into the
+   current ones, and frees the old array once it is empty. */
+static void
+migrate (struct hash *h, size_t cnt)
+{
+  for (; h->old_buckets != NULL && cnt > 0; cnt--)
+    {
+      struct list *old_bucket = &h->old_buckets[h->migrate_idx];
+
+      while (!list_empty (old_bucket))
+        {
+          struct list_elem *elem = list_pop_front (old_bucket);
+          list_push_front (find_bucket (h, list_elem_to_hash_elem (elem)),
+                           elem);
+        }
+      if (++h->migrate_idx == h->old_bucket_cnt)
+        {
+          free (h->old_buckets);
+          h->old_buckets = NULL;
+          h->old_bucket_cnt = h->migrate_idx = 0;
+        }
+    }
+}
+
+/* Moves a few elements of H left in old buckets, then, if H has
+   grown or shrunk past the limits, starts over with the ideal
+   number of buckets.  This function can fail because of an
+   out-of-memory condition, but that'll just make hash accesses
+   less efficient; we can still continue. */
 static void
 rehash (struct hash *h) 
 {
-  size_t old_bucket_cnt, new_bucket_cnt;
-  struct list *new_buckets, *old_buckets;
+  size_t new_bucket_cnt;
+  struct list *new_buckets;
   size_t i;
 
   ASSERT (h != NULL);
 
-  /* Save old bucket info for later use. */
-  old_buckets = h->buckets;
-  old_bucket_cnt = h->bucket_cnt;
+  migrate (h, MIGRATE_STEP);
+  if (h->elem_cnt <= h->bucket_cnt * MAX_ELEMS_PER_BUCKET
+      && (h->elem_cnt >= h->bucket_cnt * MIN_ELEMS_PER_BUCKET
+          || h->bucket_cnt <= 4))
+    return;
 
   /* Calculate the number of buckets to use now.
      We want one bucket for about every BEST_ELEMS_PER_BUCKET.
@@ -372,7 +444,7 @@ rehash (struct hash *h)
     new_bucket_cnt = turn_off_least_1bit (new_bucket_cnt);
 
   /* Don't do anything if the bucket count wouldn't change. */
-  if (new_bucket_cnt == old_bucket_cnt)
+  if (new_bucket_cnt == h->bucket_cnt)
     return;
 
   /* Allocate new buckets and initialize them as empty. */
@@ -387,29 +459,18 @@ rehash (struct hash *h)
   for (i = 0; i < new_bucket_cnt; i++) 
     list_init (&new_buckets[i]);
 
-  /* Install new bucket info. */
+  /* Only one migration at a time.  The previous one had as many
+     operations as the table took to grow or shrink this far, so
+     there's little left of it. */
+  migrate (h, SIZE_MAX);
+
+  /* Install new bucket info.  The elements follow over the next
+     operations. */
+  h->old_buckets = h->buckets;
+  h->old_bucket_cnt = h->bucket_cnt;
+  h->migrate_idx = 0;
   h->buckets = new_buckets;
   h->bucket_cnt = new_bucket_cnt;
-
-  /* Move each old element into the appropriate new bucket. */
-  for (i = 0; i < old_bucket_cnt; i++) 
-    {
-      struct list *old_bucket;
-      struct list_elem *elem, *next;
-
-      old_bucket = &old_buckets[i];
-      for (elem = list_begin (old_bucket);
-           elem != list_end (old_bucket); elem = next) 
-        {
-          struct list *new_bucket
-            = find_bucket (h, list_elem_to_hash_elem (elem));
-          next = list_next (elem);
-          list_remove (elem);
-          list_push_front (new_bucket, elem);
-        }
-    }
-
-  free (old_buckets);
 }
 
 /* Inserts E into BUCKET (in hash table H). */
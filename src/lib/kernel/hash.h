@@ -18,7 +18,12 @@
    conversion from a struct hash_elem back to a structure object
    that contains it.  This is the same technique used in the
    linked list implementation.  Refer to lib/kernel/list.h for a
-   detailed explanation. */
+   detailed explanation.
+
+   When the table grows or shrinks, the elements are not moved
+   to the new bucket array all at once.  Each later insertion or
+   deletion moves a few old buckets, and lookups check the old
+   bucket of an element that may not have moved yet. */
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -61,6 +66,9 @@ struct hash
     size_t elem_cnt;            /* Number of elements in table. */
     size_t bucket_cnt;          /* Number of buckets, a power of 2. */
     struct list *buckets;       /* Array of `bucket_cnt' lists. */
+    struct list *old_buckets;   /* Buckets being emptied, or null. */
+    size_t old_bucket_cnt;      /* Number of old buckets. */
+    size_t migrate_idx;         /* Old buckets before this are empty. */
     hash_hash_func *hash;       /* Hash function. */
     hash_less_func *less;       /* Comparison function. */
     void *aux;                  /* Auxiliary data for `hash' and `less'. */
@@ -84,6 +92,8 @@ struct hash_elem *hash_insert (struct hash *, struct hash_elem *);
 struct hash_elem *hash_replace (struct hash *, struct hash_elem *);
 struct hash_elem *hash_find (struct hash *, struct hash_elem *);
 struct hash_elem *hash_delete (struct hash *, struct hash_elem *);
+void hash_insert_hashed (struct hash *, struct hash_elem *, unsigned hash);
+void hash_remove (struct hash *, struct hash_elem *);
 
 /* Iteration. */
 void hash_apply (struct hash *, hash_action_func *);
@@ -100,4 +110,109 @@ unsigned hash_bytes (const void *, size_t);
 unsigned hash_string (const char *);
 unsigned hash_int (int);
 
+/* Multiplicative hash of X, with the high bits, where it mixes
+   best, folded into the low ones that pick a bucket. */
+static inline unsigned
+hash_word (uint32_t x)
+{
+  uint32_t h = x * 0x9e3779b1u;
+  return h ^ (h >> 16);
+}
+
+/* Type-specialized tables.
+
+   HASH_SPECIALIZE (NAME, STRUCT, MEMBER, KEY_TYPE, KEY_OF,
+   KEY_HASH, KEY_EQ) defines inline functions on a hash table of
+   STRUCTs linked through their hash_elem MEMBER, keyed by the
+   KEY_TYPE value KEY_OF (const STRUCT *) gives, which KEY_HASH
+   (KEY_TYPE) hashes and KEY_EQ (KEY_TYPE, KEY_TYPE) compares:
+
+     void NAME_init (struct hash *);
+     STRUCT *NAME_find (struct hash *, KEY_TYPE);
+     STRUCT *NAME_insert (struct hash *, STRUCT *);
+     void NAME_remove (struct hash *, STRUCT *);
+
+   Lookups then hash and compare without calls through function
+   pointers, and without building a key element.  NAME_insert()
+   returns the element with an equal key, without inserting, if
+   there is one, as hash_insert() does, and NAME_remove() takes an
+   element in the table.  Only moving elements after the table
+   grows or shrinks calls the hash function through H.  The
+   generic functions work on the table as well, with the
+   comparison function only telling equal elements apart. */
+#define HASH_SPECIALIZE(NAME, STRUCT, MEMBER, KEY_TYPE, KEY_OF,         \
+                        KEY_HASH, KEY_EQ)                               \
+static inline unsigned                                                  \
+NAME##_hash_elem (const struct hash_elem *e,                            \
+                  void *aux __attribute__ ((unused)))                   \
+{                                                                       \
+  return KEY_HASH (KEY_OF (hash_entry (e, const STRUCT, MEMBER)));      \
+}                                                                       \
+                                                                        \
+static inline bool                                                      \
+NAME##_less_elem (const struct hash_elem *a, const struct hash_elem *b, \
+                  void *aux __attribute__ ((unused)))                   \
+{                                                                       \
+  return !KEY_EQ (KEY_OF (hash_entry (a, const STRUCT, MEMBER)),        \
+                  KEY_OF (hash_entry (b, const STRUCT, MEMBER)));       \
+}                                                                       \
+                                                                        \
+static inline void                                                      \
+NAME##_init (struct hash *h)                                            \
+{                                                                       \
+  hash_init (h, NAME##_hash_elem, NAME##_less_elem, NULL);              \
+}                                                                       \
+                                                                        \
+static inline STRUCT *                                                  \
+NAME##_find_in (struct list *bucket, KEY_TYPE key)                      \
+{                                                                       \
+  struct list_elem *i;                                                  \
+                                                                        \
+  for (i = list_begin (bucket); i != list_end (bucket);                 \
+       i = list_next (i))                                               \
+    {                                                                   \
+      STRUCT *s = list_entry (i, STRUCT, MEMBER.list_elem);             \
+      if (KEY_EQ (KEY_OF (s), key))                                     \
+        return s;                                                       \
+    }                                                                   \
+  return NULL;                                                          \
+}                                                                       \
+                                                                        \
+static inline STRUCT *                                                  \
+NAME##_find_hashed (struct hash *h, KEY_TYPE key, unsigned hash)        \
+{                                                                       \
+  STRUCT *s = NAME##_find_in (&h->buckets[hash & (h->bucket_cnt - 1)],  \
+                              key);                                     \
+                                                                        \
+  if (s == NULL && h->old_buckets != NULL                               \
+      && (hash & (h->old_bucket_cnt - 1)) >= h->migrate_idx)            \
+    s = NAME##_find_in (&h->old_buckets[hash & (h->old_bucket_cnt - 1)],\
+                        key);                                           \
+  return s;                                                             \
+}                                                                       \
+                                                                        \
+static inline STRUCT *                                                  \
+NAME##_find (struct hash *h, KEY_TYPE key)                              \
+{                                                                       \
+  return NAME##_find_hashed (h, key, KEY_HASH (key));                   \
+}                                                                       \
+                                                                        \
+static inline STRUCT *                                                  \
+NAME##_insert (struct hash *h, STRUCT *new)                             \
+{                                                                       \
+  KEY_TYPE key = KEY_OF (new);                                          \
+  unsigned hash = KEY_HASH (key);                                       \
+  STRUCT *old = NAME##_find_hashed (h, key, hash);                      \
+                                                                        \
+  if (old == NULL)                                                      \
+    hash_insert_hashed (h, &new->MEMBER, hash);                         \
+  return old;                                                           \
+}                                                                       \
+                                                                        \
+static inline void                                                      \
+NAME##_remove (struct hash *h, STRUCT *s)                               \
+{                                                                       \
+  hash_remove (h, &s->MEMBER);                                          \
+}
+
 #endif /* lib/kernel/hash.h */
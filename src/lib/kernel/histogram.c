@@ -0,0 +1,36 @@
+#include "histogram.h"
+#include <stdio.h>
+
+/* Counts VALUE in H. */
+void
+histogram_add (struct histogram *h, uint64_t value)
+{
+  int bucket = 0;
+
+  while (value != 0 && bucket < HISTOGRAM_BUCKETS - 1)
+    {
+      value >>= 1;
+      bucket++;
+    }
+  h->cnt[bucket]++;
+}
+
+/* Prints H, labeled with NAME, as the upper bound in UNIT of
+   each nonempty bucket followed by its count. */
+void
+histogram_print (const struct histogram *h, const char *name,
+                 const char *unit)
+{
+  int i;
+
+  printf ("%s (%s):", name, unit);
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    if (h->cnt[i] != 0)
+      {
+        if (i == HISTOGRAM_BUCKETS - 1)
+          printf (" >=%llu:%llu", 1ULL << (i - 1), h->cnt[i]);
+        else
+          printf (" <%llu:%llu", 1ULL << i, h->cnt[i]);
+      }
+  printf ("\n");
+}
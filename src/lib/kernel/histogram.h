@@ -0,0 +1,27 @@
+#ifndef __LIB_KERNEL_HISTOGRAM_H
+#define __LIB_KERNEL_HISTOGRAM_H
+
+/* Histogram with power-of-two buckets.
+
+   Bucket 0 counts the value 0, and bucket I > 0 counts values
+   from 2**(I - 1) up to 2**I - 1, except that the last bucket
+   also takes every larger value.  That keeps the histogram
+   small while still telling a 5 us latency from a 5 ms one.
+
+   Updates are not synchronized, so concurrent updates may
+   occasionally be lost. */
+
+#include <stdint.h>
+
+#define HISTOGRAM_BUCKETS 20
+
+struct histogram
+  {
+    unsigned long long cnt[HISTOGRAM_BUCKETS];
+  };
+
+void histogram_add (struct histogram *, uint64_t value);
+void histogram_print (const struct histogram *, const char *name,
+                      const char *unit);
+
+#endif /* lib/kernel/histogram.h */
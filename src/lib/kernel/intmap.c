@@ -0,0 +1,180 @@
+#include "intmap.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Slots in a map's first array. */
+#define INTMAP_MIN_CAP 16
+
+static bool grow (struct intmap *);
+
+/* Returns the slot KEY hashes to in M.  Fibonacci hashing: the
+   top bits of the product depend on every bit of KEY, so keys
+   that differ only in high bits, like page addresses, spread. */
+static inline size_t
+home (const struct intmap *m, uintptr_t key)
+{
+  return (uint32_t) (key * 2654435769u) >> m->shift;
+}
+
+/* Returns the index of the slot holding KEY in M, or of the empty
+   slot where it would go.  M must have a free slot. */
+static size_t
+probe (const struct intmap *m, uintptr_t key)
+{
+  size_t mask = m->cap - 1;
+  size_t i;
+
+  for (i = home (m, key); m->slots[i].value != NULL; i = (i + 1) & mask)
+    if (m->slots[i].key == key)
+      break;
+  return i;
+}
+
+/* Initializes M as empty.  Doesn't allocate memory, so it can't
+   fail. */
+void
+intmap_init (struct intmap *m)
+{
+  m->cnt = 0;
+  m->cap = 0;
+  m->shift = 32;
+  m->slots = NULL;
+}
+
+/* Frees M's memory.  If ACTION is non-null, it is first called,
+   with AUX, for each entry. */
+void
+intmap_destroy (struct intmap *m, intmap_action_func *action, void *aux)
+{
+  size_t i;
+
+  if (action != NULL)
+    for (i = 0; i < m->cap; i++)
+      if (m->slots[i].value != NULL)
+        action (m->slots[i].key, m->slots[i].value, aux);
+  free (m->slots);
+  intmap_init (m);
+}
+
+/* Returns the value stored under KEY in M, or a null pointer if
+   there is none. */
+void *
+intmap_find (const struct intmap *m, uintptr_t key)
+{
+  if (m->cnt == 0)
+    return NULL;
+  return m->slots[probe (m, key)].value;
+}
+
+/* Stores VALUE, which must not be null, under KEY in M.  Returns
+   false without doing so if KEY is already in M, or if M is full
+   and memory is short. */
+bool
+intmap_insert (struct intmap *m, uintptr_t key, void *value)
+{
+  size_t i;
+
+  ASSERT (value != NULL);
+
+  /* Keep the load under 3/4, and at least one slot free so that
+     probes end. */
+  if ((m->cnt + 1) * 4 > m->cap * 3 && !grow (m) && m->cnt + 1 >= m->cap)
+    return false;
+
+  i = probe (m, key);
+  if (m->slots[i].value != NULL)
+    return false;
+  m->slots[i].key = key;
+  m->slots[i].value = value;
+  m->cnt++;
+  return true;
+}
+
+/* Removes KEY from M.  Returns the value that was stored under
+   it, or a null pointer if there was none. */
+void *
+intmap_remove (struct intmap *m, uintptr_t key)
+{
+  size_t mask = m->cap - 1;
+  size_t i, j;
+  void *value;
+
+  if (m->cnt == 0)
+    return NULL;
+  i = probe (m, key);
+  value = m->slots[i].value;
+  if (value == NULL)
+    return NULL;
+
+  /* Move back each following entry of the run that would no
+     longer be found past the hole at I. */
+  for (j = (i + 1) & mask; m->slots[j].value != NULL; j = (j + 1) & mask)
+    {
+      size_t k = home (m, m->slots[j].key);
+      if (i <= j ? i < k && k <= j : i < k || k <= j)
+        continue;
+      m->slots[i] = m->slots[j];
+      i = j;
+    }
+  m->slots[i].value = NULL;
+  m->cnt--;
+  return value;
+}
+
+/* Initializes I for iterating M.  Calling intmap_next() then
+   returns each value in turn, in arbitrary order.  Inserting into
+   or removing from M invalidates I. */
+void
+intmap_first (struct intmap_iterator *i, const struct intmap *m)
+{
+  i->map = m;
+  i->idx = 0;
+}
+
+/* Returns the next value in the iteration, or a null pointer at
+   the end. */
+void *
+intmap_next (struct intmap_iterator *i)
+{
+  const struct intmap *m = i->map;
+
+  while (i->idx < m->cap)
+    {
+      void *value = m->slots[i->idx++].value;
+      if (value != NULL)
+        return value;
+    }
+  return NULL;
+}
+
+/* Returns the number of entries in M. */
+size_t
+intmap_size (const struct intmap *m)
+{
+  return m->cnt;
+}
+
+/* Doubles the slots of M.  Returns false if memory is short. */
+static bool
+grow (struct intmap *m)
+{
+  struct intmap old = *m;
+  size_t cap = old.cap ? old.cap * 2 : INTMAP_MIN_CAP;
+  size_t i;
+
+  m->slots = calloc (cap, sizeof *m->slots);
+  if (m->slots == NULL)
+    {
+      m->slots = old.slots;
+      return false;
+    }
+  m->cap = cap;
+  for (m->shift = 32; cap > 1; cap /= 2)
+    m->shift--;
+
+  for (i = 0; i < old.cap; i++)
+    if (old.slots[i].value != NULL)
+      m->slots[probe (m, old.slots[i].key)] = old.slots[i];
+  free (old.slots);
+  return true;
+}
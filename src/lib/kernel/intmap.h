@@ -0,0 +1,60 @@
+#ifndef __LIB_KERNEL_INTMAP_H
+#define __LIB_KERNEL_INTMAP_H
+
+/* Integer map.
+
+   A hash table from integer keys to non-null pointers, with
+   open addressing: the entries sit in one array and collisions
+   are resolved by linear probing, so a lookup usually touches a
+   single cache line and follows no pointers.  Deletion shifts the
+   entries behind the deleted one back, so no tombstones build
+   up.
+
+   Unlike struct hash, the map owns its entries, so the values
+   need not embed anything.  The array grows as needed; an
+   insertion only fails if it is full and can't grow. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* An entry.  Empty if VALUE is null. */
+struct intmap_slot
+  {
+    uintptr_t key;
+    void *value;
+  };
+
+/* Integer map. */
+struct intmap
+  {
+    size_t cnt;                 /* Number of entries. */
+    size_t cap;                 /* Slots, 0 or a power of 2. */
+    int shift;                  /* Bits of a key hash not used. */
+    struct intmap_slot *slots;  /* Array of `cap' slots. */
+  };
+
+/* A map iterator. */
+struct intmap_iterator
+  {
+    const struct intmap *map;
+    size_t idx;                 /* Slot after the current one. */
+  };
+
+/* Performs some operation on VALUE, stored under KEY, given
+   auxiliary data AUX. */
+typedef void intmap_action_func (uintptr_t key, void *value, void *aux);
+
+void intmap_init (struct intmap *);
+void intmap_destroy (struct intmap *, intmap_action_func *, void *aux);
+
+void *intmap_find (const struct intmap *, uintptr_t key);
+bool intmap_insert (struct intmap *, uintptr_t key, void *value);
+void *intmap_remove (struct intmap *, uintptr_t key);
+
+void intmap_first (struct intmap_iterator *, const struct intmap *);
+void *intmap_next (struct intmap_iterator *);
+
+size_t intmap_size (const struct intmap *);
+
+#endif /* lib/kernel/intmap.h */
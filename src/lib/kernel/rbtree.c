@@ -0,0 +1,315 @@
+/* Red-black tree.
+
+   See [CLRS] chapter 13 for the algorithms.  Null child pointers
+   stand for the black leaves. */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+/* Returns true if E is a red node.  Leaves are black. */
+static inline bool
+is_red (const struct rb_elem *e)
+{
+  return e != NULL && e->red;
+}
+
+/* Makes NEW take OLD's place as a child of PARENT, or as the root
+   of T if PARENT is null. */
+static void
+replace_child (struct rb_tree *t, struct rb_elem *parent,
+               struct rb_elem *old, struct rb_elem *new)
+{
+  if (parent == NULL)
+    t->root = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+}
+
+/* Rotates the subtree at X to the left, making X's right child
+   its parent. */
+static void
+rotate_left (struct rb_tree *t, struct rb_elem *x)
+{
+  struct rb_elem *y = x->right;
+
+  x->right = y->left;
+  if (y->left != NULL)
+    y->left->parent = x;
+  y->parent = x->parent;
+  replace_child (t, x->parent, x, y);
+  y->left = x;
+  x->parent = y;
+}
+
+/* Rotates the subtree at X to the right, making X's left child
+   its parent. */
+static void
+rotate_right (struct rb_tree *t, struct rb_elem *x)
+{
+  struct rb_elem *y = x->left;
+
+  x->left = y->right;
+  if (y->right != NULL)
+    y->right->parent = x;
+  y->parent = x->parent;
+  replace_child (t, x->parent, x, y);
+  y->right = x;
+  x->parent = y;
+}
+
+/* Initializes T as an empty tree ordered by LESS given AUX. */
+void
+rb_init (struct rb_tree *t, rb_less_func *less, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = t->first = NULL;
+  t->size = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Inserts E into T, after any elements equal to it. */
+void
+rb_insert (struct rb_tree *t, struct rb_elem *e)
+{
+  struct rb_elem **link = &t->root;
+  struct rb_elem *parent = NULL;
+  bool leftmost = true;
+
+  ASSERT (e != NULL);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      if (t->less (e, parent, t->aux))
+        link = &parent->left;
+      else
+        {
+          link = &parent->right;
+          leftmost = false;
+        }
+    }
+  e->parent = parent;
+  e->left = e->right = NULL;
+  e->red = true;
+  *link = e;
+  if (leftmost)
+    t->first = e;
+  t->size++;
+
+  /* Restore the red-black properties. */
+  while (is_red (parent = e->parent))
+    {
+      struct rb_elem *grand = parent->parent;
+
+      if (parent == grand->left)
+        {
+          struct rb_elem *uncle = grand->right;
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grand->red = true;
+              e = grand;
+              continue;
+            }
+          if (e == parent->right)
+            {
+              rotate_left (t, parent);
+              e = parent;
+              parent = e->parent;
+            }
+          parent->red = false;
+          grand->red = true;
+          rotate_right (t, grand);
+        }
+      else
+        {
+          struct rb_elem *uncle = grand->left;
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grand->red = true;
+              e = grand;
+              continue;
+            }
+          if (e == parent->left)
+            {
+              rotate_right (t, parent);
+              e = parent;
+              parent = e->parent;
+            }
+          parent->red = false;
+          grand->red = true;
+          rotate_left (t, grand);
+        }
+    }
+  t->root->red = false;
+}
+
+/* Restores the red-black properties after a black node was
+   removed from above X, a child of PARENT that may be a leaf. */
+static void
+remove_fixup (struct rb_tree *t, struct rb_elem *x, struct rb_elem *parent)
+{
+  while (x != t->root && !is_red (x))
+    {
+      if (x == parent->left)
+        {
+          struct rb_elem *w = parent->right;
+          if (w->red)
+            {
+              w->red = false;
+              parent->red = true;
+              rotate_left (t, parent);
+              w = parent->right;
+            }
+          if (!is_red (w->left) && !is_red (w->right))
+            {
+              w->red = true;
+              x = parent;
+              parent = x->parent;
+              continue;
+            }
+          if (!is_red (w->right))
+            {
+              w->left->red = false;
+              w->red = true;
+              rotate_right (t, w);
+              w = parent->right;
+            }
+          w->red = parent->red;
+          parent->red = false;
+          w->right->red = false;
+          rotate_left (t, parent);
+        }
+      else
+        {
+          struct rb_elem *w = parent->left;
+          if (w->red)
+            {
+              w->red = false;
+              parent->red = true;
+              rotate_right (t, parent);
+              w = parent->left;
+            }
+          if (!is_red (w->left) && !is_red (w->right))
+            {
+              w->red = true;
+              x = parent;
+              parent = x->parent;
+              continue;
+            }
+          if (!is_red (w->left))
+            {
+              w->right->red = false;
+              w->red = true;
+              rotate_left (t, w);
+              w = parent->left;
+            }
+          w->red = parent->red;
+          parent->red = false;
+          w->left->red = false;
+          rotate_right (t, parent);
+        }
+      x = t->root;
+    }
+  if (x != NULL)
+    x->red = false;
+}
+
+/* Removes E, which must be in T, from T. */
+void
+rb_remove (struct rb_tree *t, struct rb_elem *e)
+{
+  struct rb_elem *child, *parent;
+  bool red;
+
+  ASSERT (t->size > 0);
+
+  if (t->first == e)
+    t->first = rb_next (e);
+  t->size--;
+
+  if (e->left == NULL || e->right == NULL)
+    {
+      /* E has at most one child, which takes its place. */
+      child = e->left != NULL ? e->left : e->right;
+      parent = e->parent;
+      red = e->red;
+      if (child != NULL)
+        child->parent = parent;
+      replace_child (t, parent, e, child);
+    }
+  else
+    {
+      /* E's successor Y, which has no left child, takes its
+         place. */
+      struct rb_elem *y = e->right;
+      while (y->left != NULL)
+        y = y->left;
+      red = y->red;
+      child = y->right;
+      if (y->parent == e)
+        parent = y;
+      else
+        {
+          parent = y->parent;
+          if (child != NULL)
+            child->parent = parent;
+          parent->left = child;
+          y->right = e->right;
+          y->right->parent = y;
+        }
+      y->left = e->left;
+      y->left->parent = y;
+      y->parent = e->parent;
+      replace_child (t, e->parent, e, y);
+      y->red = e->red;
+    }
+
+  if (!red)
+    remove_fixup (t, child, parent);
+}
+
+/* Returns the smallest element in T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_first (const struct rb_tree *t)
+{
+  return t->first;
+}
+
+/* Returns the element after E in T's order, or a null pointer if
+   E is the largest. */
+struct rb_elem *
+rb_next (const struct rb_elem *e)
+{
+  if (e->right != NULL)
+    {
+      e = e->right;
+      while (e->left != NULL)
+        e = e->left;
+      return (struct rb_elem *) e;
+    }
+  while (e->parent != NULL && e == e->parent->right)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+rb_size (const struct rb_tree *t)
+{
+  return t->size;
+}
+
+/* Returns true if T is empty. */
+bool
+rb_empty (const struct rb_tree *t)
+{
+  return t->size == 0;
+}
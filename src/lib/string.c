@@ -1,5 +1,10 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* Blocks shorter than this are handled a byte at a time, since
+   setting up a string instruction costs more than it saves. */
+#define STRING_OP_MIN 16
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,6 +17,18 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
+  if (size >= STRING_OP_MIN)
+    {
+      /* Align DST, then copy words. */
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+
+      size -= head + words * 4;
+      asm volatile ("rep movsb; movl %3, %%ecx; rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (head)
+                    : "r" (words)
+                    : "memory");
+    }
   while (size-- > 0)
     *dst++ = *src++;
 
@@ -29,20 +46,29 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  if (dst < src) 
+  /* Copying upward is safe unless DST starts inside SRC. */
+  if (dst <= src || dst >= src + size)
+    return memcpy (dst_, src_, size);
+
+  dst += size;
+  src += size;
+  while (size % 4 != 0)
     {
-      while (size-- > 0)
-        *dst++ = *src++;
+      *--dst = *--src;
+      size--;
     }
-  else 
+  if (size > 0)
     {
-      dst += size;
-      src += size;
-      while (size-- > 0)
-        *--dst = *--src;
+      size_t words = size / 4;
+      dst -= 4;
+      src -= 4;
+      asm volatile ("std; rep movsl; cld"
+                    : "+D" (dst), "+S" (src), "+c" (words)
+                    :
+                    : "memory");
     }
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +84,17 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip equal words, leaving the first differing one, if any,
+     to the byte loop. */
+  if (size >= STRING_OP_MIN && ((uintptr_t) a & 3) == ((uintptr_t) b & 3))
+    {
+      for (; ((uintptr_t) a & 3) != 0; a++, b++, size--)
+        if (*a != *b)
+          return *a > *b ? +1 : -1;
+      for (; size >= 4; a += 4, b += 4, size -= 4)
+        if (*(const uint32_t *) a != *(const uint32_t *) b)
+          break;
+    }
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -281,7 +318,20 @@ memset (void *dst_, int value, size_t size)
   unsigned char *dst = dst_;
 
   ASSERT (dst != NULL || size == 0);
-  
+
+  if (size >= STRING_OP_MIN)
+    {
+      /* Align DST, then store words. */
+      uint32_t word = (unsigned char) value * 0x01010101u;
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+
+      size -= head + words * 4;
+      asm volatile ("rep stosb; movl %3, %%ecx; rep stosl"
+                    : "+D" (dst), "+c" (head)
+                    : "a" (word), "r" (words)
+                    : "memory");
+    }
   while (size-- > 0)
     *dst++ = value;
 
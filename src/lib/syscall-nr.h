@@ -28,7 +28,45 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /* Duplicate this process. */
+    SYS_PREAD,                  /* Read from a file at a given offset. */
+    SYS_PWRITE,                 /* Write to a file at a given offset. */
+    SYS_READV,                  /* Read from a file into several buffers. */
+    SYS_WRITEV,                 /* Write several buffers to a file. */
+    SYS_COPY_FILE,              /* Copy data from one file to another. */
+    SYS_IO_RING_ENTER,          /* Carry out queued requests. */
+    SYS_AIO_READ,               /* Start reading from a file. */
+    SYS_AIO_WRITE,              /* Start writing to a file. */
+    SYS_AIO_WAIT,               /* Wait for a read or write started. */
+    SYS_FSYNC,                  /* Write a file and its metadata to disk. */
+    SYS_FDATASYNC,              /* Write a file's data to disk. */
+    SYS_SBRK,                   /* Grow or shrink the heap. */
+    SYS_GETRUSAGE,              /* Get page fault counts. */
+    SYS_SPAWN,                  /* Start a process without waiting
+                                   for it to load. */
+    SYS_MADVISE,                /* Tell how memory will be used. */
+    SYS_GETDENTS,               /* Read many directory entries. */
+    SYS_STAT,                   /* Get a file's type, size and inumber. */
+    SYS_FSTAT,                  /* Same, for a fd. */
+    SYS_PIPE,                   /* Create a pipe. */
+    SYS_SHM_OPEN,               /* Open a shared memory object. */
+    SYS_SHM_MAP,                /* Map a shared memory object. */
+    SYS_THREAD_SPAWN,           /* Start a thread in this process. */
+    SYS_THREAD_EXIT,            /* End the calling thread. */
+    SYS_FUTEX_WAIT,             /* Wait on a word of memory. */
+    SYS_FUTEX_WAKE,             /* Wake threads waiting on a word. */
+    SYS_SLEEP_MS,               /* Sleep for some milliseconds. */
+    SYS_NANOSLEEP,              /* Sleep for a struct timespec. */
+    SYS_CLOCK_GETTIME,          /* Read a clock. */
+    SYS_WAIT_ANY,               /* Wait for any child process to die. */
+    SYS_PMC_ENABLE,             /* Count events for this process. */
+    SYS_FALLOCATE,              /* Allocate space for a file. */
+    SYS_DEFRAG,                 /* Move a file's data into one run. */
+    SYS_MLOCK,                  /* Keep memory resident. */
+    SYS_MUNLOCK                 /* Let it be paged out again. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -4,11 +4,12 @@
 #include <syscall-nr.h>
 
 /* The standard vprintf() function,
-   which is like printf() but uses a va_list. */
+   which is like printf() but uses a va_list.  Output is line
+   buffered. */
 int
 vprintf (const char *format, va_list args) 
 {
-  return vhprintf (STDOUT_FILENO, format, args);
+  return vfprintf (stdout, format, args);
 }
 
 /* Like printf(), but writes output to the given HANDLE. */
@@ -30,7 +31,7 @@ hprintf (int handle, const char *format, ...)
 int
 puts (const char *s) 
 {
-  write (STDOUT_FILENO, s, strlen (s));
+  fputs (s, stdout);
   putchar ('\n');
 
   return 0;
@@ -40,11 +41,9 @@ puts (const char *s)
 int
 putchar (int c) 
 {
-  char c2 = c;
-  write (STDOUT_FILENO, &c2, 1);
-  return c;
+  return fputc (c, stdout);
 }
-
+
 /* Auxiliary data for vhprintf_helper(). */
 struct vhprintf_aux 
   {
@@ -64,6 +63,10 @@ int
 vhprintf (int handle, const char *format, va_list args) 
 {
   struct vhprintf_aux aux;
+
+  /* Keep the order of output written through stdout. */
+  if (handle == STDOUT_FILENO)
+    fflush (stdout);
   aux.p = aux.buf;
   aux.char_cnt = 0;
   aux.handle = handle;
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* User heap allocator.
+
+   Requests of up to MAX_SMALL bytes are rounded up to a power of
+   2 and served from a free list per size.  An empty list is
+   refilled by carving a chunk obtained from sbrk() into blocks
+   of its size.  Larger requests get a block of their own from
+   sbrk(), in whole pages, and freed ones are kept on a list
+   for reuse, first fit.  Memory is never given back to the
+   kernel.
+
+   Every block is preceded by a header that records its size, so
+   that free() knows where the block goes. */
+
+#define MIN_SHIFT 4                     /* Smallest block: 16 bytes. */
+#define MAX_SHIFT 11                    /* Largest small block: 2 kB. */
+#define MAX_SMALL (1 << MAX_SHIFT)
+#define CHUNK_SIZE (16 * 1024)          /* Bytes per refill. */
+#define PAGE_SIZE 4096
+
+/* Header of a block.  Its size keeps the data 8-byte aligned. */
+struct header
+  {
+    size_t size;                /* Usable bytes. */
+    struct header *next;        /* Next free block, if free. */
+  };
+
+static struct header *small_free[MAX_SHIFT + 1];
+static struct header *large_free;
+
+/* Returns the size class of a request for SIZE bytes, at most
+   MAX_SMALL. */
+static int
+size_class (size_t size)
+{
+  int shift = MIN_SHIFT;
+
+  while (((size_t) 1 << shift) < size)
+    shift++;
+  return shift;
+}
+
+/* Refills the free list of class SHIFT.  Returns false if the
+   heap can't grow. */
+static bool
+refill (int shift)
+{
+  size_t block = sizeof (struct header) + ((size_t) 1 << shift);
+  uint8_t *chunk = sbrk (CHUNK_SIZE);
+  size_t ofs;
+
+  if (chunk == (void *) -1)
+    return false;
+  for (ofs = 0; ofs + block <= CHUNK_SIZE; ofs += block)
+    {
+      struct header *h = (struct header *) (chunk + ofs);
+      h->size = (size_t) 1 << shift;
+      h->next = small_free[shift];
+      small_free[shift] = h;
+    }
+  return true;
+}
+
+/* Returns a block of at least SIZE bytes, more than MAX_SMALL,
+   or a null pointer if the heap can't grow. */
+static struct header *
+large_alloc (size_t size)
+{
+  struct header **hp, *h;
+  size_t bytes;
+
+  for (hp = &large_free; *hp != NULL; hp = &(*hp)->next)
+    if ((*hp)->size >= size)
+      {
+        h = *hp;
+        *hp = h->next;
+        return h;
+      }
+
+  bytes = ROUND_UP (sizeof *h + size, PAGE_SIZE);
+  if (bytes < size)
+    return NULL;
+  h = sbrk (bytes);
+  if (h == (void *) -1)
+    return NULL;
+  h->size = bytes - sizeof *h;
+  return h;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size)
+{
+  struct header *h;
+
+  if (size == 0)
+    return NULL;
+  if (size <= MAX_SMALL)
+    {
+      int shift = size_class (size);
+      if (small_free[shift] == NULL && !refill (shift))
+        return NULL;
+      h = small_free[shift];
+      small_free[shift] = h->next;
+    }
+  else
+    {
+      h = large_alloc (size);
+      if (h == NULL)
+        return NULL;
+    }
+  return h + 1;
+}
+
+/* Allocates and returns A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b)
+{
+  void *p;
+  size_t size = a * b;
+
+  if (b != 0 && size / b != a)
+    return NULL;
+  p = malloc (size);
+  if (p != NULL)
+    memset (p, 0, size);
+  return p;
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.
+   If successful, returns the new block; on failure, returns a
+   null pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size)
+{
+  struct header *h;
+  void *new_block;
+
+  if (new_size == 0)
+    {
+      free (old_block);
+      return NULL;
+    }
+  if (old_block == NULL)
+    return malloc (new_size);
+
+  h = (struct header *) old_block - 1;
+  if (new_size <= h->size)
+    return old_block;
+  new_block = malloc (new_size);
+  if (new_block != NULL)
+    {
+      memcpy (new_block, old_block, h->size);
+      free (old_block);
+    }
+  return new_block;
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p)
+{
+  struct header *h;
+
+  if (p == NULL)
+    return;
+  h = (struct header *) p - 1;
+  if (h->size <= MAX_SMALL)
+    {
+      int shift = size_class (h->size);
+      h->next = small_free[shift];
+      small_free[shift] = h;
+    }
+  else
+    {
+      h->next = large_free;
+      large_free = h;
+    }
+}
@@ -4,4 +4,33 @@
 int hprintf (int, const char *, ...) PRINTF_FORMAT (2, 3);
 int vhprintf (int, const char *, va_list) PRINTF_FORMAT (2, 0);
 
+/* Buffered streams.
+
+   A stream reads from and writes to a file descriptor through a
+   buffer of BUFSIZ bytes, so that reading or writing a character
+   at a time doesn't cost a system call each.  Output reaches the
+   file when the buffer fills, when the stream is flushed or
+   closed, and when the process exits or forks; on stdout, also
+   at each new-line. */
+#define BUFSIZ 512
+#define EOF (-1)
+
+typedef struct stream FILE;
+extern FILE *stdout;
+
+FILE *fopen (const char *file);
+FILE *fdopen (int fd);
+int fclose (FILE *);
+int fflush (FILE *);
+
+int fgetc (FILE *);
+char *fgets (char *, int size, FILE *);
+size_t fread (void *, size_t size, size_t cnt, FILE *);
+
+int fputc (int, FILE *);
+int fputs (const char *, FILE *);
+size_t fwrite (const void *, size_t size, size_t cnt, FILE *);
+int fprintf (FILE *, const char *, ...) PRINTF_FORMAT (2, 3);
+int vfprintf (FILE *, const char *, va_list) PRINTF_FORMAT (2, 0);
+
 #endif /* lib/user/stdio.h */
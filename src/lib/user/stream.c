@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A buffered stream.  BUF holds either data read ahead, of which
+   the part from POS to LEN is still unread, or LEN bytes written
+   but not yet passed on to FD. */
+struct stream
+  {
+    int fd;                     /* File descriptor. */
+    bool writing;               /* BUF holds output? */
+    bool line_buffered;         /* Flush output at each new-line? */
+    bool eof;                   /* FD had nothing more to read? */
+    size_t pos, len;            /* Read position, bytes held. */
+    struct stream *next;        /* Next open stream. */
+    char buf[BUFSIZ];
+  };
+
+static struct stream stdout_stream =
+  {STDOUT_FILENO, false, true, false, 0, 0, NULL, {0}};
+FILE *stdout = &stdout_stream;
+
+/* Open streams, stdout first, for fflush (NULL). */
+static struct stream *streams = &stdout_stream;
+
+/* Passes S's buffered output to its file.  Returns 0 if
+   successful, EOF if the whole of it couldn't be written. */
+static int
+flush_output (FILE *s)
+{
+  int ok = 0;
+
+  if (s->writing && s->len > 0
+      && write (s->fd, s->buf, s->len) != (int) s->len)
+    ok = EOF;
+  s->len = 0;
+  return ok;
+}
+
+/* Gets S ready for output.  Input read ahead is given back to
+   the file, by moving its position back, so that output goes
+   where the reader got to. */
+static void
+start_output (FILE *s)
+{
+  if (!s->writing)
+    {
+      if (s->pos < s->len)
+        seek (s->fd, tell (s->fd) - (s->len - s->pos));
+      s->writing = true;
+      s->pos = s->len = 0;
+    }
+}
+
+/* Gets S ready for input.  Returns false at end of file. */
+static bool
+fill_input (FILE *s)
+{
+  int n;
+
+  if (s->writing)
+    {
+      flush_output (s);
+      s->writing = false;
+    }
+  if (s->pos < s->len)
+    return true;
+  if (s->eof)
+    return false;
+  n = read (s->fd, s->buf, sizeof s->buf);
+  s->pos = 0;
+  s->len = n > 0 ? n : 0;
+  if (n <= 0)
+    s->eof = true;
+  return n > 0;
+}
+
+/* Opens a stream on FD.  Returns a null pointer if memory is
+   short. */
+FILE *
+fdopen (int fd)
+{
+  struct stream *s = malloc (sizeof *s);
+
+  if (s == NULL)
+    return NULL;
+  s->fd = fd;
+  s->writing = false;
+  s->line_buffered = false;
+  s->eof = false;
+  s->pos = s->len = 0;
+  s->next = streams;
+  streams = s;
+  return s;
+}
+
+/* Opens FILE as a stream.  Returns a null pointer on failure. */
+FILE *
+fopen (const char *file)
+{
+  int fd = open (file);
+  FILE *s;
+
+  if (fd < 0)
+    return NULL;
+  s = fdopen (fd);
+  if (s == NULL)
+    close (fd);
+  return s;
+}
+
+/* Flushes S and closes it, with its file descriptor.  Returns 0
+   if successful, EOF if output was lost. */
+int
+fclose (FILE *s)
+{
+  struct stream **sp;
+  int ok = flush_output (s);
+
+  for (sp = &streams; *sp != NULL; sp = &(*sp)->next)
+    if (*sp == s)
+      {
+        *sp = s->next;
+        break;
+      }
+  close (s->fd);
+  if (s != &stdout_stream)
+    free (s);
+  return ok;
+}
+
+/* Writes S's buffered output to its file, or that of every open
+   stream if S is null.  Returns 0 if successful, EOF if output
+   was lost. */
+int
+fflush (FILE *s)
+{
+  int ok = 0;
+
+  if (s != NULL)
+    return flush_output (s);
+  for (s = streams; s != NULL; s = s->next)
+    if (flush_output (s) == EOF)
+      ok = EOF;
+  return ok;
+}
+
+/* Reads and returns the next character from S, or EOF at end of
+   file. */
+int
+fgetc (FILE *s)
+{
+  if (!fill_input (s))
+    return EOF;
+  return (unsigned char) s->buf[s->pos++];
+}
+
+/* Reads a line from S into DST, which has room for SIZE bytes,
+   stopping after a new-line or once SIZE - 1 bytes are read, and
+   null-terminates it.  Returns DST, or a null pointer if nothing
+   was read. */
+char *
+fgets (char *dst, int size, FILE *s)
+{
+  int i = 0;
+
+  while (i < size - 1 && fill_input (s))
+    {
+      char *start = s->buf + s->pos;
+      size_t n = s->len - s->pos;
+      char *nl;
+
+      if (n > (size_t) (size - 1 - i))
+        n = size - 1 - i;
+      nl = memchr (start, '\n', n);
+      if (nl != NULL)
+        n = nl - start + 1;
+      memcpy (dst + i, start, n);
+      s->pos += n;
+      i += n;
+      if (nl != NULL)
+        break;
+    }
+  if (i == 0)
+    return NULL;
+  dst[i] = '\0';
+  return dst;
+}
+
+/* Reads up to CNT items of SIZE bytes each from S into BUFFER.
+   Returns the number of whole items read. */
+size_t
+fread (void *buffer, size_t size, size_t cnt, FILE *s)
+{
+  char *dst = buffer;
+  size_t total = size * cnt;
+  size_t done = 0;
+
+  if (size == 0)
+    return 0;
+  while (done < total && fill_input (s))
+    {
+      size_t n = s->len - s->pos;
+      if (n > total - done)
+        n = total - done;
+      memcpy (dst + done, s->buf + s->pos, n);
+      s->pos += n;
+      done += n;
+    }
+  return done / size;
+}
+
+/* Writes C to S.  Returns C, or EOF if output was lost. */
+int
+fputc (int c, FILE *s)
+{
+  start_output (s);
+  s->buf[s->len++] = c;
+  if (s->len == sizeof s->buf || (s->line_buffered && c == '\n'))
+    if (flush_output (s) == EOF)
+      return EOF;
+  return (unsigned char) c;
+}
+
+/* Writes CNT items of SIZE bytes each from BUFFER to S.  Returns
+   the number of items written, which is less than CNT only if
+   output was lost. */
+size_t
+fwrite (const void *buffer, size_t size, size_t cnt, FILE *s)
+{
+  const char *src = buffer;
+  size_t total = size * cnt;
+  size_t i;
+
+  start_output (s);
+  if (!s->line_buffered && total >= sizeof s->buf)
+    {
+      /* Too big to be worth buffering. */
+      if (flush_output (s) == EOF
+          || write (s->fd, src, total) != (int) total)
+        return 0;
+      return cnt;
+    }
+  for (i = 0; i < total; i++)
+    if (fputc (src[i], s) == EOF)
+      return i / size;
+  return cnt;
+}
+
+/* Writes string STRING to S.  Returns 0, or EOF if output was
+   lost. */
+int
+fputs (const char *string, FILE *s)
+{
+  size_t len = strlen (string);
+  return fwrite (string, 1, len, s) == len ? 0 : EOF;
+}
+
+/* Auxiliary data for vfprintf_helper(). */
+struct vfprintf_aux
+  {
+    FILE *stream;       /* Output stream. */
+    int char_cnt;       /* Total characters written so far. */
+  };
+
+/* Helper function for vfprintf(). */
+static void
+vfprintf_helper (char c, void *aux_)
+{
+  struct vfprintf_aux *aux = aux_;
+  fputc (c, aux->stream);
+  aux->char_cnt++;
+}
+
+/* Like vprintf(), but writes to S. */
+int
+vfprintf (FILE *s, const char *format, va_list args)
+{
+  struct vfprintf_aux aux;
+  aux.stream = s;
+  aux.char_cnt = 0;
+  __vprintf (format, args, vfprintf_helper, &aux);
+  return aux.char_cnt;
+}
+
+/* Like printf(), but writes to S. */
+int
+fprintf (FILE *s, const char *format, ...)
+{
+  va_list args;
+  int retval;
+
+  va_start (args, format);
+  retval = vfprintf (s, format, args);
+  va_end (args);
+
+  return retval;
+}
@@ -1,31 +1,47 @@
 #include <syscall.h>
+#include <stdio.h>
 #include "../syscall-nr.h"
 
+/* Nonzero if system calls are made with SYSENTER, which enters
+   the kernel faster than "int $0x30".  Set by syscall_probe(). */
+int syscall_sysenter;
+
+/* Enters the kernel with the system call number and arguments at
+   the top of the stack: by SYSENTER, passing the return address
+   in %edx and the stack pointer in %ecx, which the kernel
+   returns through, or else by "int $0x30". */
+#define SYSCALL_ENTER                                   \
+        "cmpl $0, syscall_sysenter; je 1f; "            \
+        "movl %%esp, %%ecx; movl $2f, %%edx; sysenter; " \
+        "1: int $0x30; 2: "
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; " SYSCALL_ENTER                  \
+             "addl $4, %%esp"                                   \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing argument ARG0, and returns the
    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
-        ({                                                               \
-          int retval;                                                    \
-          asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
-               : "=a" (retval)                                           \
-               : [number] "i" (NUMBER),                                  \
-                 [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
-          retval;                                                        \
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg0]; pushl %[number]; " SYSCALL_ENTER   \
+             "addl $8, %%esp"                                   \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "g" (ARG0)                              \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
@@ -35,12 +51,13 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; " SYSCALL_ENTER                  \
+             "addl $12, %%esp"                                  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
@@ -51,19 +68,54 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; " SYSCALL_ENTER                  \
+             "addl $16, %%esp"                                  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1),                             \
                  [arg2] "r" (ARG2)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; pushl %[number]; " SYSCALL_ENTER   \
+             "addl $20, %%esp"                                  \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2),                             \
+                 [arg3] "r" (ARG3)                              \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
+        })
+
+/* Sets syscall_sysenter if the CPU has working SYSENTER and
+   SYSEXIT, which the kernel then accepts, by the same test as
+   the kernel's.  The earliest Pentium Pros claim to but don't. */
+void
+syscall_probe (void)
+{
+  unsigned a, b, c, d;
+
+  asm ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (1));
+  syscall_sysenter = ((d & (1 << 11)) != 0
+                      && !(((a >> 8) & 0xf) == 6 && ((a >> 4) & 0xf) < 3
+                           && (a & 0xf) < 3));
+}
+
 void
 halt (void) 
 {
+  fflush (NULL);
   syscall0 (SYS_HALT);
   NOT_REACHED ();
 }
@@ -71,6 +123,7 @@ halt (void)
 void
 exit (int status)
 {
+  fflush (NULL);
   syscall1 (SYS_EXIT, status);
   NOT_REACHED ();
 }
@@ -81,12 +134,32 @@ exec (const char *file)
   return (pid_t) syscall1 (SYS_EXEC, file);
 }
 
+pid_t
+fork (void)
+{
+  /* Or the child would write the parent's output again. */
+  fflush (NULL);
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
 int
 wait (pid_t pid)
 {
   return syscall1 (SYS_WAIT, pid);
 }
 
+pid_t
+wait_any (int *status)
+{
+  return syscall1 (SYS_WAIT_ANY, status);
+}
+
+int
+pmc_enable (void)
+{
+  return syscall0 (SYS_PMC_ENABLE);
+}
+
 bool
 create (const char *file, unsigned initial_size)
 {
@@ -182,3 +255,213 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+copy_file (int in_fd, int out_fd, unsigned size)
+{
+  return syscall3 (SYS_COPY_FILE, in_fd, out_fd, size);
+}
+
+int
+io_ring_enter (struct io_ring *ring)
+{
+  return syscall1 (SYS_IO_RING_ENTER, ring);
+}
+
+int
+aio_read (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_AIO_READ, fd, buffer, size, offset);
+}
+
+int
+aio_write (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_AIO_WRITE, fd, buffer, size, offset);
+}
+
+int
+aio_wait (int id)
+{
+  return syscall1 (SYS_AIO_WAIT, id);
+}
+
+int
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+int
+fdatasync (int fd)
+{
+  return syscall1 (SYS_FDATASYNC, fd);
+}
+
+int
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+int
+defrag (int fd)
+{
+  return syscall1 (SYS_DEFRAG, fd);
+}
+
+void *
+sbrk (intptr_t increment)
+{
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+int
+getrusage (int who, struct rusage *usage)
+{
+  return syscall2 (SYS_GETRUSAGE, who, usage);
+}
+
+pid_t
+spawn (const char *file, const struct spawn_action *actions, int action_cnt)
+{
+  return (pid_t) syscall3 (SYS_SPAWN, file, actions, action_cnt);
+}
+
+int
+madvise (void *addr, size_t length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+int
+mlock (void *addr, size_t length)
+{
+  return syscall2 (SYS_MLOCK, addr, length);
+}
+
+int
+munlock (void *addr, size_t length)
+{
+  return syscall2 (SYS_MUNLOCK, addr, length);
+}
+
+int
+getdents (int fd, struct dirent *ents, int cnt)
+{
+  return syscall3 (SYS_GETDENTS, fd, ents, cnt);
+}
+
+int
+stat (const char *file, struct stat *st)
+{
+  return syscall2 (SYS_STAT, file, st);
+}
+
+int
+fstat (int fd, struct stat *st)
+{
+  return syscall2 (SYS_FSTAT, fd, st);
+}
+
+int
+pipe (int fds[2])
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
+int
+shm_open (const char *name, unsigned size)
+{
+  return syscall2 (SYS_SHM_OPEN, name, size);
+}
+
+mapid_t
+shm_map (int fd, void *addr)
+{
+  return (mapid_t) syscall2 (SYS_SHM_MAP, fd, addr);
+}
+
+/* Where a thread from thread_spawn() starts, with FUNC and AUX
+   on its stack as if called. */
+static void
+thread_start (void (*func) (void *), void *aux)
+{
+  func (aux);
+  thread_exit (0);
+}
+
+/* Starts a thread running FUNC (AUX) in this process, on the
+   stack whose top is STACK, and ends it with status 0 when FUNC
+   returns. */
+pid_t
+thread_spawn (void (*func) (void *), void *aux, void *stack)
+{
+  uintptr_t *sp = stack;
+
+  *--sp = (uintptr_t) aux;
+  *--sp = (uintptr_t) func;
+  *--sp = 0;                    /* Fake return address. */
+  return (pid_t) syscall2 (SYS_THREAD_SPAWN, thread_start, sp);
+}
+
+void
+thread_exit (int status)
+{
+  syscall1 (SYS_THREAD_EXIT, status);
+  NOT_REACHED ();
+}
+
+int
+futex_wait (int *addr, int val)
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, val);
+}
+
+int
+futex_wake (int *addr, int cnt)
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
+
+int
+sleep_ms (unsigned ms)
+{
+  return syscall1 (SYS_SLEEP_MS, ms);
+}
+
+int
+nanosleep (const struct timespec *req)
+{
+  return syscall1 (SYS_NANOSLEEP, req);
+}
+
+int
+clock_gettime (int clock, struct timespec *tp)
+{
+  return syscall2 (SYS_CLOCK_GETTIME, clock, tp);
+}
@@ -2,6 +2,8 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -15,6 +17,134 @@ typedef int mapid_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* One buffer of a readv() or writev() request. */
+struct iovec
+  {
+    void *iov_base;             /* Start of the buffer. */
+    size_t iov_len;             /* Its size in bytes. */
+  };
+
+/* Batched requests, submitted with io_ring_enter().  The process
+   fills SQ[] entries and advances SQ_TAIL; the kernel carries
+   them out in order, advancing SQ_HEAD, and posts each result to
+   CQ[] at CQ_TAIL, from which the process consumes at CQ_HEAD.
+   Indexes run freely and are taken modulo IO_RING_ENTRIES. */
+#define IO_RING_ENTRIES 64
+
+/* Operations of a submission. */
+#define IO_READ  0              /* read (FD, BUF, LEN). */
+#define IO_WRITE 1              /* write (FD, BUF, LEN). */
+#define IO_SEEK  2              /* seek (FD, LEN). */
+#define IO_CLOSE 3              /* close (FD). */
+
+/* A submission. */
+struct io_sqe
+  {
+    int op;                     /* One of IO_*. */
+    int fd;                     /* File descriptor. */
+    void *buf;                  /* Buffer of IO_READ or IO_WRITE. */
+    unsigned len;               /* Size, or position for IO_SEEK. */
+    unsigned user_data;         /* Copied to the completion. */
+  };
+
+/* A completion. */
+struct io_cqe
+  {
+    unsigned user_data;         /* From the submission. */
+    int res;                    /* What the call returned; 0 if void,
+                                   -1 for an unknown operation. */
+  };
+
+/* A submission and a completion queue. */
+struct io_ring
+  {
+    unsigned sq_head, sq_tail;  /* Submission queue indexes. */
+    unsigned cq_head, cq_tail;  /* Completion queue indexes. */
+    struct io_sqe sq[IO_RING_ENTRIES];
+    struct io_cqe cq[IO_RING_ENTRIES];
+  };
+
+/* Which counts getrusage() reports. */
+#define RUSAGE_SELF 0           /* The calling process's. */
+#define RUSAGE_SYSTEM 1         /* Those of all processes since boot. */
+
+/* CPU times and page fault counts, filled in by getrusage().
+   The times are in microseconds.  Fault counts are zero without
+   virtual memory. */
+struct rusage
+  {
+    unsigned ru_majflt;         /* Faults that waited for I/O. */
+    unsigned ru_minflt;         /* Faults served from memory. */
+    unsigned ru_fileflt;        /* Faults on file-backed pages. */
+    unsigned ru_swapflt;        /* Faults on swapped-out pages. */
+    unsigned ru_zeroflt;        /* Faults on zero-fill pages. */
+    unsigned ru_stackflt;       /* Faults on new stack pages. */
+    unsigned ru_cowflt;         /* Copy-on-write faults. */
+    unsigned ru_nevict;         /* Frames evicted to serve them. */
+    unsigned ru_nswapin;        /* Pages read from swap. */
+    unsigned ru_nswapout;       /* Pages written to swap. */
+    unsigned long long ru_utime;     /* Running in user mode. */
+    unsigned long long ru_stime;     /* Running in the kernel. */
+    unsigned long long ru_lockwait;  /* Blocked acquiring locks. */
+    unsigned long long ru_iowait;    /* Blocked on I/O. */
+  };
+
+/* Access patterns given to madvise(). */
+#define MADV_NORMAL     0       /* No particular pattern. */
+#define MADV_RANDOM     1       /* Random: read nothing ahead. */
+#define MADV_SEQUENTIAL 2       /* Sequential: read far ahead, and
+                                   let go of pages behind soon. */
+#define MADV_WILLNEED   3       /* Read the pages in now. */
+#define MADV_DONTNEED   4       /* Drop the pages now. */
+#define MADV_HUGEPAGE   5       /* Map aligned 4 MB of anonymous
+                                   memory with large pages. */
+
+/* Descriptor setup for spawn(), carried out in order before
+   the new program starts, which otherwise gets no open files. */
+#define SPAWN_DUP  0            /* A copy of our SRC_FD, as FD. */
+#define SPAWN_OPEN 1            /* PATH, opened as FD. */
+#define SPAWN_ACTION_MAX 8      /* Most actions one spawn() takes. */
+
+struct spawn_action
+  {
+    int type;                   /* SPAWN_DUP or SPAWN_OPEN. */
+    int fd;                     /* Descriptor in the new process. */
+    int src_fd;                 /* Ours to copy, for SPAWN_DUP. */
+    const char *path;           /* File to open, for SPAWN_OPEN. */
+  };
+
+/* File types, in struct stat and struct dirent. */
+#define DT_REG 1                /* Ordinary file. */
+#define DT_DIR 2                /* Directory. */
+
+/* What stat() and fstat() report about a file. */
+struct stat
+  {
+    unsigned st_ino;            /* Inode number, as from inumber(). */
+    int st_type;                /* DT_REG or DT_DIR. */
+    unsigned st_size;           /* Size in bytes. */
+  };
+
+/* A directory entry, as read by getdents(). */
+struct dirent
+  {
+    unsigned d_ino;             /* Inode number. */
+    int d_type;                 /* DT_REG or DT_DIR. */
+    unsigned d_size;            /* Size in bytes. */
+    char d_name[READDIR_MAX_LEN + 1];   /* Null-terminated name. */
+  };
+
+/* Clocks clock_gettime() reads.  Both count from boot. */
+#define CLOCK_MONOTONIC 0       /* From the time-stamp counter. */
+#define CLOCK_TICKS 1           /* Whole timer ticks only. */
+
+/* A time or interval, for nanosleep() and clock_gettime(). */
+struct timespec
+  {
+    int64_t tv_sec;             /* Seconds. */
+    long tv_nsec;               /* Nanoseconds, 0 to 999999999. */
+  };
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -23,6 +153,7 @@ typedef int mapid_t;
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
 pid_t exec (const char *file);
+pid_t fork (void);
 int wait (pid_t);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
@@ -45,4 +176,43 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int copy_file (int in_fd, int out_fd, unsigned length);
+int io_ring_enter (struct io_ring *);
+int aio_read (int fd, void *buffer, unsigned length, unsigned offset);
+int aio_write (int fd, const void *buffer, unsigned length, unsigned offset);
+int aio_wait (int id);
+int fsync (int fd);
+int fdatasync (int fd);
+int fallocate (int fd, unsigned offset, unsigned length);
+int defrag (int fd);
+void *sbrk (intptr_t increment);
+int getrusage (int who, struct rusage *);
+pid_t spawn (const char *file, const struct spawn_action *, int action_cnt);
+int madvise (void *addr, size_t length, int advice);
+int mlock (void *addr, size_t length);
+int munlock (void *addr, size_t length);
+int getdents (int fd, struct dirent *, int cnt);
+int stat (const char *file, struct stat *);
+int fstat (int fd, struct stat *);
+int pipe (int fds[2]);
+int shm_open (const char *name, unsigned size);
+mapid_t shm_map (int fd, void *addr);
+pid_t thread_spawn (void (*func) (void *), void *aux, void *stack);
+void thread_exit (int status) NO_RETURN;
+int futex_wait (int *addr, int val);
+int futex_wake (int *addr, int cnt);
+int sleep_ms (unsigned ms);
+int nanosleep (const struct timespec *);
+int clock_gettime (int clock, struct timespec *);
+pid_t wait_any (int *status);
+int pmc_enable (void);
+
+/* Picks how to make system calls.  Called by _start(). */
+void syscall_probe (void);
+
 #endif /* lib/user/syscall.h */
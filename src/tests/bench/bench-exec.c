@@ -0,0 +1,28 @@
+/* Measures the latency of starting a process and waiting for it
+   to exit. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ITER_CNT 20
+
+void
+test_main (void) 
+{
+  uint64_t start;
+  int i;
+
+  /* Once untimed, so that the executable is cached. */
+  CHECK (wait (exec ("child-bench")) == 0, "exec and wait child-bench");
+
+  start = bench_cycles ();
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      pid_t pid = exec ("child-bench");
+      if (pid == PID_ERROR || wait (pid) != 0)
+        fail ("exec child-bench failed");
+    }
+  bench_report ("exec-wait", (bench_cycles () - start) / ITER_CNT,
+                "cycles");
+}
@@ -0,0 +1,97 @@
+/* Measures the cost of a page fault, by what serves it: zero
+   fill, stack growth, a mapped file, and copy-on-write after
+   fork().  Each figure is the time per page of touching
+   PAGE_CNT fresh pages.  Without virtual memory the pages are
+   already present and the figures show only the loop. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+
+static char zero_buf[PAGE_CNT * PAGE_SIZE];
+static char cow_buf[PAGE_CNT * PAGE_SIZE];
+
+/* Writes a byte to each page of the PAGE_CNT pages at P and
+   returns the cycles this took per page. */
+static uint64_t
+touch (volatile char *p)
+{
+  uint64_t start = bench_cycles ();
+  int i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    p[i * PAGE_SIZE] = 1;
+  return (bench_cycles () - start) / PAGE_CNT;
+}
+
+/* Grows the stack by PAGE_CNT pages, from the top down. */
+static uint64_t
+grow_stack (void)
+{
+  char stack[PAGE_CNT * PAGE_SIZE];
+  volatile char *p = stack;
+  uint64_t start = bench_cycles ();
+  int i;
+
+  for (i = PAGE_CNT - 1; i >= 0; i--)
+    p[i * PAGE_SIZE] = 1;
+  return (bench_cycles () - start) / PAGE_CNT;
+}
+
+/* Maps a file and reads a byte from each of its pages. */
+static void
+bench_file (void)
+{
+  char *map = (char *) 0x10000000;
+  uint64_t start;
+  mapid_t id;
+  int fd, i;
+
+  CHECK (create ("bench", PAGE_CNT * PAGE_SIZE), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+  id = mmap (fd, map);
+  if (id == MAP_FAILED)
+    {
+      msg ("mmap failed, skipping file faults");
+      return;
+    }
+
+  start = bench_cycles ();
+  for (i = 0; i < PAGE_CNT; i++)
+    (void) *(volatile char *) (map + i * PAGE_SIZE);
+  bench_report ("fault-file", (bench_cycles () - start) / PAGE_CNT,
+                "cycles/page");
+  munmap (id);
+}
+
+/* Copies pages on write in a forked child. */
+static void
+bench_cow (void)
+{
+  pid_t pid;
+
+  memset (cow_buf, 1, sizeof cow_buf);
+  pid = fork ();
+  if (pid == 0)
+    {
+      bench_report ("fault-cow", touch (cow_buf), "cycles/page");
+      exit (0);
+    }
+  else if (pid == PID_ERROR)
+    msg ("fork failed, skipping copy-on-write faults");
+  else
+    CHECK (wait (pid) == 0, "wait for child");
+}
+
+void
+test_main (void) 
+{
+  bench_report ("fault-zero", touch (zero_buf), "cycles/page");
+  bench_report ("fault-stack", grow_stack (), "cycles/page");
+  bench_file ();
+  bench_cow ();
+}
@@ -0,0 +1,136 @@
+/* File system benchmark.  Sets up a file or directory for each
+   of PROC_CNT child-fs processes, runs WORKLOAD in all of them
+   at once, and reports the wall time per operation and, for
+   reads and writes, per kilobyte transferred.  The time covers
+   the whole run, from the first exec to the last wait.
+
+   Usage: bench-fs-* PROC_CNT WORKLOAD ARG1 ARG2
+   where WORKLOAD ARG1 ARG2 is one of
+     seqwr, seqrd, rndwr, rndrd BLOCK SIZE
+       Sequential or random writes or reads of BLOCK bytes each,
+       SIZE bytes in all, over a file of SIZE bytes.
+     files COUNT SIZE
+       Creates, writes and closes COUNT files of SIZE bytes each
+       in a directory, then removes them.
+     lookup COUNT ITER
+       Opens and closes ITER randomly chosen files among COUNT
+       in a directory. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench-fs.h"
+#include "tests/lib.h"
+
+#define PROC_MAX 16
+
+static char buf[BENCH_FS_BLOCK_MAX];
+
+static void
+report (const char *name, uint64_t value, const char *unit)
+{
+  char full[64];
+
+  snprintf (full, sizeof full, "%s-%s", test_name, name);
+  bench_report (full, value, unit);
+}
+
+/* Creates "fs-INDEX" and fills it with SIZE bytes. */
+static void
+make_file (int index, int size)
+{
+  char name[16];
+  int fd, ofs;
+
+  snprintf (name, sizeof name, "fs-%d", index);
+  if (!create (name, 0) || (fd = open (name)) < 2)
+    fail ("create \"%s\" failed", name);
+  for (ofs = 0; ofs < size; ofs += sizeof buf)
+    {
+      int chunk = size - ofs < (int) sizeof buf ? size - ofs : (int) sizeof buf;
+      if (write (fd, buf, chunk) != chunk)
+        fail ("write \"%s\" failed", name);
+    }
+  close (fd);
+}
+
+/* Creates "d-INDEX" holding FILE_CNT empty files. */
+static void
+make_dir (int index, int file_cnt)
+{
+  char name[32];
+  int i;
+
+  snprintf (name, sizeof name, "d-%d", index);
+  if (!mkdir (name))
+    fail ("mkdir \"%s\" failed", name);
+  for (i = 0; i < file_cnt; i++)
+    {
+      snprintf (name, sizeof name, "d-%d/f%d", index, i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  pid_t children[PROC_MAX];
+  const char *workload;
+  char cmd[64];
+  int proc_cnt, arg1, arg2, i;
+  uint64_t ops, bytes, cycles;
+
+  test_name = argv[0];
+  if (argc != 5)
+    fail ("usage: %s PROC_CNT WORKLOAD ARG1 ARG2", argv[0]);
+  proc_cnt = atoi (argv[1]);
+  workload = argv[2];
+  arg1 = atoi (argv[3]);
+  arg2 = atoi (argv[4]);
+  if (proc_cnt < 1 || proc_cnt > PROC_MAX || arg1 < 1 || arg2 < 0)
+    fail ("bad PROC_CNT or arguments");
+
+  /* Per-process operation and byte counts. */
+  if (!strcmp (workload, "files"))
+    {
+      ops = arg1;
+      bytes = 0;
+    }
+  else if (!strcmp (workload, "lookup"))
+    {
+      ops = arg2;
+      bytes = 0;
+    }
+  else
+    {
+      ops = arg2 / arg1;
+      bytes = arg2;
+    }
+
+  for (i = 0; i < proc_cnt; i++)
+    if (!strcmp (workload, "files"))
+      make_dir (i, 0);
+    else if (!strcmp (workload, "lookup"))
+      make_dir (i, arg1);
+    else
+      make_file (i, arg2);
+
+  snprintf (cmd, sizeof cmd, "child-fs %s %d %d", workload, arg1, arg2);
+  quiet = true;
+  cycles = bench_cycles ();
+  exec_children (cmd, children, proc_cnt);
+  wait_children (children, proc_cnt);
+  cycles = bench_cycles () - cycles;
+  quiet = false;
+
+  ops *= proc_cnt;
+  bytes *= proc_cnt;
+  report ("time", cycles, "cycles");
+  if (ops > 0)
+    report ("op", cycles / ops, "cycles/op");
+  if (bytes >= 1024)
+    report ("xfer", cycles / (bytes / 1024), "cycles/KB");
+  return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef TESTS_BENCH_BENCH_FS_H
+#define TESTS_BENCH_BENCH_FS_H
+
+/* Largest BLOCK, and largest small-file SIZE, that bench-fs
+   accepts. */
+#define BENCH_FS_BLOCK_MAX 65536
+
+#endif /* tests/bench/bench-fs.h */
@@ -0,0 +1,61 @@
+/* Measures read() and write() throughput on a file for several
+   chunk sizes, in cycles per kilobyte.  The file is read once
+   before timing, so the reads are mostly served by the buffer
+   cache. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (64 * 1024)
+#define PASS_CNT 4
+
+static char buf[FILE_SIZE];
+
+/* Reads or writes the whole file PASS_CNT times, CHUNK bytes per
+   call, and returns the cycles this took per kilobyte. */
+static uint64_t
+run (int fd, size_t chunk, bool writing)
+{
+  uint64_t start = bench_cycles ();
+  int pass;
+
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      size_t ofs;
+
+      seek (fd, 0);
+      for (ofs = 0; ofs < FILE_SIZE; ofs += chunk)
+        {
+          int n = (writing ? write (fd, buf + ofs, chunk)
+                   : read (fd, buf + ofs, chunk));
+          if (n != (int) chunk)
+            fail ("%s of %zu bytes at %zu returned %d",
+                  writing ? "write" : "read", chunk, ofs, n);
+        }
+    }
+  return (bench_cycles () - start) / (PASS_CNT * FILE_SIZE / 1024);
+}
+
+void
+test_main (void) 
+{
+  static const size_t chunks[] = {512, 4096, 16384, 65536};
+  size_t i;
+  int fd;
+
+  CHECK (create ("bench", FILE_SIZE), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+  run (fd, FILE_SIZE, true);
+
+  for (i = 0; i < sizeof chunks / sizeof *chunks; i++)
+    {
+      char name[32];
+
+      snprintf (name, sizeof name, "write-%zu", chunks[i]);
+      bench_report (name, run (fd, chunks[i], true), "cycles/KB");
+      snprintf (name, sizeof name, "read-%zu", chunks[i]);
+      bench_report (name, run (fd, chunks[i], false), "cycles/KB");
+    }
+}
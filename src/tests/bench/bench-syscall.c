@@ -0,0 +1,23 @@
+/* Measures the round trip of a system call that does next to
+   nothing: tell() on an open file. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ITER_CNT 10000
+
+void
+test_main (void) 
+{
+  uint64_t start;
+  int fd, i;
+
+  CHECK (create ("bench", 0), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+
+  start = bench_cycles ();
+  for (i = 0; i < ITER_CNT; i++)
+    tell (fd);
+  bench_report ("syscall", (bench_cycles () - start) / ITER_CNT, "cycles");
+}
@@ -0,0 +1,69 @@
+/* Paging benchmark.  Runs CHILD_CNT child-vm processes at once,
+   which between them touch PAGE_CNT pages in order PATTERN
+   ("seq", "stride" or "shuffle") several times over, and reports
+   the wall time taken along with the system's page fault, swap
+   and eviction counts for the run.
+
+   Usage: bench-vm-* PATTERN PAGE_CNT CHILD_CNT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+#define CHILD_MAX 16
+
+/* Reports FIELD of rusage AFTER less that of BEFORE, as NAME. */
+#define REPORT_DELTA(NAME, FIELD)                                       \
+        report (NAME, after.FIELD - before.FIELD, "pages")
+
+static void
+report (const char *name, uint64_t value, const char *unit)
+{
+  char full[64];
+
+  snprintf (full, sizeof full, "%s-%s", test_name, name);
+  bench_report (full, value, unit);
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct rusage before, after;
+  pid_t children[CHILD_MAX];
+  int page_cnt, child_cnt, i;
+  uint64_t start;
+
+  test_name = argv[0];
+  if (argc != 4)
+    fail ("usage: %s PATTERN PAGE_CNT CHILD_CNT", argv[0]);
+  page_cnt = atoi (argv[2]);
+  child_cnt = atoi (argv[3]);
+  if (child_cnt < 1 || child_cnt > CHILD_MAX || page_cnt < child_cnt)
+    fail ("bad PAGE_CNT or CHILD_CNT");
+  if (getrusage (RUSAGE_SYSTEM, &before) != 0)
+    fail ("getrusage failed");
+
+  start = bench_cycles ();
+  for (i = 0; i < child_cnt; i++)
+    {
+      char cmd[64];
+
+      snprintf (cmd, sizeof cmd, "child-vm %s %d %d", argv[1],
+                page_cnt / child_cnt, i);
+      if ((children[i] = exec (cmd)) == PID_ERROR)
+        fail ("exec \"%s\" failed", cmd);
+    }
+  for (i = 0; i < child_cnt; i++)
+    if (wait (children[i]) != 0)
+      fail ("child %d failed", i);
+  report ("time", bench_cycles () - start, "cycles");
+
+  getrusage (RUSAGE_SYSTEM, &after);
+  REPORT_DELTA ("major", ru_majflt);
+  REPORT_DELTA ("minor", ru_minflt);
+  REPORT_DELTA ("swapin", ru_nswapin);
+  REPORT_DELTA ("swapout", ru_nswapout);
+  REPORT_DELTA ("evict", ru_nevict);
+  return 0;
+}
@@ -0,0 +1,8 @@
+/* Child process run by bench-exec.  Exits at once, so that the
+   benchmark times little but exec and wait themselves. */
+
+int
+main (void) 
+{
+  return 0;
+}
@@ -0,0 +1,135 @@
+/* Child process of the bench-fs benchmarks.  Runs one copy of
+   WORKLOAD against the file "fs-INDEX" or directory "d-INDEX"
+   that bench-fs set up for it, and exits with INDEX.
+
+   Usage: child-fs WORKLOAD ARG1 ARG2 INDEX
+   where WORKLOAD ARG1 ARG2 is one of
+     seqwr, seqrd, rndwr, rndrd BLOCK SIZE
+     files COUNT SIZE
+     lookup COUNT ITER */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench-fs.h"
+#include "tests/lib.h"
+
+static char buf[BENCH_FS_BLOCK_MAX];
+
+/* Reads or writes SIZE bytes of FILE_NAME, BLOCK bytes at a time,
+   in order or, if RANDOM, at randomly chosen block offsets. */
+static void
+rw (const char *file_name, int block, int size, bool writing, bool random)
+{
+  int fd, i;
+
+  if (block < 1 || block > BENCH_FS_BLOCK_MAX || size % block != 0)
+    fail ("bad BLOCK %d for SIZE %d", block, size);
+  if ((fd = open (file_name)) < 2)
+    fail ("open \"%s\" failed", file_name);
+  for (i = 0; i < size / block; i++)
+    {
+      int ofs = (random ? (int) (random_ulong () % (size / block)) : i) * block;
+      int n;
+
+      seek (fd, ofs);
+      n = writing ? write (fd, buf, block) : read (fd, buf, block);
+      if (n != block)
+        fail ("%s of %d bytes at %d returned %d",
+              writing ? "write" : "read", block, ofs, n);
+    }
+  close (fd);
+}
+
+/* Creates COUNT files of SIZE bytes each in the current
+   directory, then removes them. */
+static void
+files (int count, int size)
+{
+  int i;
+
+  if (size < 0 || size > BENCH_FS_BLOCK_MAX)
+    fail ("bad SIZE %d", size);
+  for (i = 0; i < count; i++)
+    {
+      char name[16];
+      int fd;
+
+      snprintf (name, sizeof name, "f%d", i);
+      if (!create (name, 0) || (fd = open (name)) < 2)
+        fail ("create \"%s\" failed", name);
+      if (write (fd, buf, size) != size)
+        fail ("write \"%s\" failed", name);
+      close (fd);
+    }
+  for (i = 0; i < count; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "f%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+}
+
+/* Opens and closes ITER randomly chosen files among the COUNT
+   in the current directory. */
+static void
+lookup (int count, int iter)
+{
+  int i;
+
+  for (i = 0; i < iter; i++)
+    {
+      char name[16];
+      int fd;
+
+      snprintf (name, sizeof name, "f%lu", random_ulong () % count);
+      if ((fd = open (name)) < 2)
+        fail ("open \"%s\" failed", name);
+      close (fd);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *workload;
+  char name[16];
+  int arg1, arg2, index;
+
+  test_name = "child-fs";
+  if (argc != 5)
+    fail ("usage: child-fs WORKLOAD ARG1 ARG2 INDEX");
+  workload = argv[1];
+  arg1 = atoi (argv[2]);
+  arg2 = atoi (argv[3]);
+  index = atoi (argv[4]);
+  random_init (index);
+  memset (buf, index, sizeof buf);
+
+  snprintf (name, sizeof name, "fs-%d", index);
+  if (!strcmp (workload, "seqwr"))
+    rw (name, arg1, arg2, true, false);
+  else if (!strcmp (workload, "seqrd"))
+    rw (name, arg1, arg2, false, false);
+  else if (!strcmp (workload, "rndwr"))
+    rw (name, arg1, arg2, true, true);
+  else if (!strcmp (workload, "rndrd"))
+    rw (name, arg1, arg2, false, true);
+  else
+    {
+      snprintf (name, sizeof name, "d-%d", index);
+      if (!chdir (name))
+        fail ("chdir \"%s\" failed", name);
+      if (!strcmp (workload, "files"))
+        files (arg1, arg2);
+      else if (!strcmp (workload, "lookup"))
+        lookup (arg1, arg2);
+      else
+        fail ("unknown workload \"%s\"", workload);
+    }
+  return index;
+}
@@ -0,0 +1,78 @@
+/* Child process of the bench-vm benchmarks.  Allocates PAGE_CNT
+   pages and goes over them PASS_CNT times in the order given by
+   PATTERN, checking and bumping a counter in each page.  SEED
+   varies the shuffle between children.
+
+   Usage: child-vm PATTERN PAGE_CNT SEED */
+
+#include <random.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+#define PAGE_SIZE 4096
+#define PASS_CNT 3
+
+/* Returns the greatest common divisor of A and B. */
+static int
+gcd (int a, int b)
+{
+  while (b != 0)
+    {
+      int t = a % b;
+      a = b;
+      b = t;
+    }
+  return a;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *pattern;
+  int page_cnt, stride, pass, i;
+  int *order;
+  char *pages;
+
+  test_name = "child-vm";
+  if (argc != 4)
+    fail ("usage: child-vm PATTERN PAGE_CNT SEED");
+  pattern = argv[1];
+  page_cnt = atoi (argv[2]);
+  random_init (atoi (argv[3]));
+
+  pages = sbrk (page_cnt * PAGE_SIZE);
+  order = malloc (page_cnt * sizeof *order);
+  if (pages == (char *) -1 || order == NULL)
+    fail ("out of memory");
+
+  /* Visit order.  A stride prime to PAGE_CNT visits every page. */
+  if (strcmp (pattern, "seq") && strcmp (pattern, "stride")
+      && strcmp (pattern, "shuffle"))
+    fail ("unknown pattern \"%s\"", pattern);
+  stride = 1;
+  if (!strcmp (pattern, "stride"))
+    {
+      stride = 17;
+      while (gcd (stride, page_cnt) != 1)
+        stride += 2;
+    }
+  for (i = 0; i < page_cnt; i++)
+    order[i] = (long long) i * stride % page_cnt;
+
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      if (!strcmp (pattern, "shuffle"))
+        shuffle (order, page_cnt, sizeof *order);
+      for (i = 0; i < page_cnt; i++)
+        {
+          int *counter = (int *) (pages + order[i] * PAGE_SIZE);
+          if (*counter != pass)
+            fail ("page %d holds %d after %d passes",
+                  order[i], *counter, pass);
+          *counter = pass + 1;
+        }
+    }
+  return 0;
+}
@@ -48,6 +48,17 @@ fail (const char *format, ...)
   exit (1);
 }
 
+/* Reports that benchmark NAME measured VALUE, in UNIT. */
+void
+bench_report (const char *name, uint64_t value, const char *unit)
+{
+  bool was_quiet = quiet;
+
+  quiet = false;
+  msg ("BENCH %s %llu %s", name, (unsigned long long) value, unit);
+  quiet = was_quiet;
+}
+
 static void
 swap (void *a_, void *b_, size_t size) 
 {
@@ -76,6 +87,9 @@ shuffle (void *buf_, size_t cnt, size_t size)
     }
 }
 
+/* Starts CHILD_CNT processes running CHILD_NAME with arguments 0
+   through CHILD_CNT - 1, letting them load in parallel.  A child
+   that fails to load makes wait_children() fail. */
 void
 exec_children (const char *child_name, pid_t pids[], size_t child_cnt) 
 {
@@ -85,7 +99,7 @@ exec_children (const char *child_name, pid_t pids[], size_t child_cnt)
     {
       char cmd_line[128];
       snprintf (cmd_line, sizeof cmd_line, "%s %zu", child_name, i);
-      CHECK ((pids[i] = exec (cmd_line)) != PID_ERROR,
+      CHECK ((pids[i] = spawn (cmd_line, NULL, 0)) != PID_ERROR,
              "exec child %zu of %zu: \"%s\"", i + 1, child_cnt, cmd_line);
     }
 }
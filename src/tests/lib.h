@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <syscall.h>
 
 extern const char *test_name;
@@ -37,6 +38,19 @@ void fail (const char *, ...) PRINTF_FORMAT (1, 2) NO_RETURN;
 
 void shuffle (void *, size_t cnt, size_t size);
 
+/* Benchmarks time what they measure in time-stamp counter cycles
+   and report it with bench_report(), in a form that "make bench"
+   collects. */
+static inline uint64_t
+bench_cycles (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+void bench_report (const char *name, uint64_t value, const char *unit);
+
 void exec_children (const char *child_name, pid_t pids[], size_t child_cnt);
 void wait_children (pid_t pids[], size_t child_cnt);
 
@@ -0,0 +1,226 @@
+/* Scheduler benchmark.  Measures, under a load of CPU-bound
+   threads:
+
+     - how long sleeping threads take to run once timer_sleep()
+       wakes them, at the spinners' priority and above it;
+
+     - how long a high-priority thread waits behind a
+       low-priority holder while medium-priority threads spin,
+       with a lock (priority donation) and with a semaphore
+       (none);
+
+     - how evenly equal-priority spinners share the CPU, as
+       Jain's fairness index times 1000 (1000 is perfectly fair).
+
+   Not part of the graded tests; run it with "pintos run
+   bench-sched", or with "make bench".  Add "-mlfqs" or "-cfs"
+   to compare schedulers. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define SPINNER_CNT 4           /* CPU-bound threads. */
+#define SLEEPER_CNT 2           /* Sleeping threads. */
+#define SLEEP_CNT 20            /* Sleeps per sleeper. */
+#define INVERSION_TICKS 50      /* Spin time in the inversion runs. */
+#define FAIR_TICKS 200          /* Spin time in the fairness run. */
+
+/* Shared by the threads of one run. */
+static struct semaphore done;
+static volatile bool stop;
+static int64_t deadline;
+
+/* Wakeup latencies seen by the sleepers. */
+static uint64_t wake_total, wake_max;
+static int wake_cnt;
+
+/* run_ticks of each spinner, for the fairness run. */
+static int64_t spun[SPINNER_CNT];
+
+/* Spins until STOP, or DEADLINE if that is nonzero, then stores
+   its run time into *AUX if AUX is nonnull. */
+static void
+spinner (void *aux)
+{
+  int64_t *ticks = aux;
+
+  while (!stop && (deadline == 0 || timer_ticks () < deadline))
+    barrier ();
+  if (ticks != NULL)
+    *ticks = thread_current ()->run_ticks;
+  sema_up (&done);
+}
+
+static void
+sleeper (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < SLEEP_CNT; i++)
+    {
+      uint64_t latency;
+
+      timer_sleep (1);
+      latency = thread_current ()->wake_latency;
+      wake_total += latency;
+      wake_cnt++;
+      if (latency > wake_max)
+        wake_max = latency;
+    }
+  sema_up (&done);
+}
+
+/* Starts SPINNER_CNT spinners at the caller's priority and
+   SLEEPER_CNT sleepers at PRIORITY, and reports the sleepers'
+   wakeup latency as NAME. */
+static void
+wake_run (const char *name, int priority)
+{
+  int i;
+
+  sema_init (&done, 0);
+  stop = false;
+  deadline = 0;
+  wake_total = wake_max = wake_cnt = 0;
+  for (i = 0; i < SPINNER_CNT; i++)
+    thread_create ("spinner", thread_get_priority (), spinner, NULL);
+  for (i = 0; i < SLEEPER_CNT; i++)
+    thread_create ("sleeper", priority, sleeper, NULL);
+
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_down (&done);
+  stop = true;
+  for (i = 0; i < SPINNER_CNT; i++)
+    sema_down (&done);
+
+  msg ("BENCH %s %llu cycles", name, wake_total / wake_cnt);
+  msg ("BENCH %s-max %llu cycles", name, wake_max);
+}
+
+/* The resource contended for in an inversion run: a lock if
+   DONATE, otherwise a semaphore with value 1. */
+struct resource
+  {
+    bool donate;
+    struct lock lock;
+    struct semaphore sema;
+    struct semaphore held;
+    uint64_t wait;
+  };
+
+static void
+resource_get (struct resource *r)
+{
+  if (r->donate)
+    lock_acquire (&r->lock);
+  else
+    sema_down (&r->sema);
+}
+
+static void
+resource_put (struct resource *r)
+{
+  if (r->donate)
+    lock_release (&r->lock);
+  else
+    sema_up (&r->sema);
+}
+
+/* Takes the resource and lets the creator know, then gives it
+   back as soon as it gets to run again. */
+static void
+holder (void *r_)
+{
+  struct resource *r = r_;
+
+  resource_get (r);
+  sema_up (&r->held);
+  resource_put (r);
+  sema_up (&done);
+}
+
+/* Times how long it takes to get the resource. */
+static void
+waiter (void *r_)
+{
+  struct resource *r = r_;
+  uint64_t start = timer_cycles ();
+
+  resource_get (r);
+  r->wait = timer_cycles () - start;
+  resource_put (r);
+  sema_up (&done);
+}
+
+/* Runs a low-priority holder, SPINNER_CNT medium-priority
+   spinners and a high-priority waiter, and reports how long the
+   waiter waited as NAME. */
+static void
+inversion_run (const char *name, bool donate)
+{
+  struct resource r;
+  int pri = thread_get_priority ();
+  int i;
+
+  r.donate = donate;
+  lock_init (&r.lock);
+  sema_init (&r.sema, 1);
+  sema_init (&r.held, 0);
+  sema_init (&done, 0);
+  stop = false;
+
+  thread_create ("holder", pri - 10, holder, &r);
+  sema_down (&r.held);
+  deadline = timer_ticks () + INVERSION_TICKS;
+  for (i = 0; i < SPINNER_CNT; i++)
+    thread_create ("spinner", pri - 5, spinner, NULL);
+  thread_create ("waiter", pri + 10, waiter, &r);
+
+  for (i = 0; i < SPINNER_CNT + 2; i++)
+    sema_down (&done);
+  msg ("BENCH %s %llu us", name, timer_cycles_to_us (r.wait));
+}
+
+/* Runs SPINNER_CNT equal-priority spinners for FAIR_TICKS and
+   reports how evenly they were scheduled. */
+static void
+fair_run (void)
+{
+  int64_t sum = 0, sum_sq = 0, min = INT64_MAX, max = 0;
+  int i;
+
+  sema_init (&done, 0);
+  stop = false;
+  deadline = timer_ticks () + FAIR_TICKS;
+  for (i = 0; i < SPINNER_CNT; i++)
+    thread_create ("spinner", thread_get_priority (), spinner, &spun[i]);
+  for (i = 0; i < SPINNER_CNT; i++)
+    sema_down (&done);
+
+  for (i = 0; i < SPINNER_CNT; i++)
+    {
+      sum += spun[i];
+      sum_sq += spun[i] * spun[i];
+      if (spun[i] < min)
+        min = spun[i];
+      if (spun[i] > max)
+        max = spun[i];
+    }
+  msg ("BENCH fair-index %lld x1000",
+       sum_sq != 0 ? sum * sum * 1000 / (SPINNER_CNT * sum_sq) : 0);
+  msg ("BENCH fair-min %lld ticks", min);
+  msg ("BENCH fair-max %lld ticks", max);
+}
+
+void
+test_bench_sched (void)
+{
+  wake_run ("wake-late", thread_get_priority ());
+  wake_run ("wake-late-hi", thread_get_priority () + 1);
+  inversion_run ("inversion-lock", true);
+  inversion_run ("inversion-sema", false);
+  fair_run ();
+}
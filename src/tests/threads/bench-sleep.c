@@ -0,0 +1,42 @@
+/* Measures how late timer_sleep() wakes a thread: each iteration
+   starts right after a tick, sleeps for one tick, and reports
+   how much later than one tick it got to run again.  Not part of
+   the graded tests; run it with "pintos run bench-sleep", or
+   with "make bench". */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define ITER_CNT 50
+#define TICK_NS (1000000000 / TIMER_FREQ)
+
+void
+test_bench_sleep (void)
+{
+  int64_t total = 0, max = 0;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      int64_t start, late;
+
+      /* Start at a tick. */
+      start = timer_ticks ();
+      while (timer_ticks () == start)
+        barrier ();
+
+      start = timer_now_ns ();
+      timer_sleep (1);
+      late = timer_now_ns () - start - TICK_NS;
+      if (late < 0)
+        late = 0;
+      total += late;
+      if (late > max)
+        max = late;
+    }
+  msg ("BENCH sleep-late %lld ns", total / ITER_CNT);
+  msg ("BENCH sleep-late-max %lld ns", max);
+}
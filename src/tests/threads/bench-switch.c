@@ -0,0 +1,57 @@
+/* Measures the cost of a context switch: two threads hand a
+   semaphore back and forth, so that each handoff blocks one
+   thread and runs the other.  Not part of the graded tests; run
+   it with "pintos run bench-switch", or with "make bench". */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define ITER_CNT 10000
+
+struct pingpong
+  {
+    struct semaphore ping, pong;
+    struct semaphore done;
+  };
+
+static thread_func ponger;
+
+void
+test_bench_switch (void)
+{
+  static struct pingpong pp;
+  uint64_t start;
+  int i;
+
+  sema_init (&pp.ping, 0);
+  sema_init (&pp.pong, 0);
+  sema_init (&pp.done, 0);
+  thread_create ("ponger", thread_get_priority (), ponger, &pp);
+
+  start = timer_cycles ();
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      sema_up (&pp.ping);
+      sema_down (&pp.pong);
+    }
+  msg ("BENCH switch %llu cycles",
+       (timer_cycles () - start) / (2 * ITER_CNT));
+  sema_down (&pp.done);
+}
+
+static void
+ponger (void *pp_)
+{
+  struct pingpong *pp = pp_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      sema_down (&pp->ping);
+      sema_up (&pp->pong);
+    }
+  sema_up (&pp->done);
+}
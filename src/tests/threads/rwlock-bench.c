@@ -0,0 +1,99 @@
+/* Compares a reader-writer lock held shared against a plain lock
+   under contention.  Several reader threads each enter the
+   critical section repeatedly and sleep for a tick inside it, as
+   a file system reader waiting on the disk would.  Readers of
+   the rwlock overlap, so its run should take about a
+   READER_CNT-th of the time of the plain lock's.  Not part of
+   the graded tests; run it with "pintos run rwlock-bench". */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define READER_CNT 8
+#define ITER_CNT 16
+
+struct bench
+  {
+    bool use_rwlock;            /* Contend on RW, or on LOCK? */
+    struct rwlock rw;
+    struct lock lock;
+    struct semaphore done;      /* Upped by each reader at exit. */
+    int inside;                 /* Readers in the critical section. */
+    int max_inside;             /* Most readers seen there at once. */
+  };
+
+static thread_func reader;
+
+static int64_t
+run (struct bench *b, bool use_rwlock)
+{
+  int64_t start;
+  int i;
+
+  b->use_rwlock = use_rwlock;
+  b->inside = b->max_inside = 0;
+  sema_init (&b->done, 0);
+
+  start = timer_ticks ();
+  for (i = 0; i < READER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "reader %d", i);
+      thread_create (name, PRI_DEFAULT, reader, b);
+    }
+  for (i = 0; i < READER_CNT; i++)
+    sema_down (&b->done);
+  return timer_elapsed (start);
+}
+
+void
+test_rwlock_bench (void)
+{
+  static struct bench b;
+  int64_t lock_ticks, rw_ticks;
+
+  rwlock_init (&b.rw);
+  lock_init (&b.lock);
+
+  lock_ticks = run (&b, false);
+  msg ("lock: %d readers x %d iterations in %lld ticks, "
+       "at most %d inside", READER_CNT, ITER_CNT, lock_ticks,
+       b.max_inside);
+  if (b.max_inside != 1)
+    fail ("plain lock let %d threads in at once", b.max_inside);
+
+  rw_ticks = run (&b, true);
+  msg ("rwlock: %d readers x %d iterations in %lld ticks, "
+       "at most %d inside", READER_CNT, ITER_CNT, rw_ticks,
+       b.max_inside);
+}
+
+static void
+reader (void *b_)
+{
+  struct bench *b = b_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      if (b->use_rwlock)
+        rwlock_acquire_shared (&b->rw);
+      else
+        lock_acquire (&b->lock);
+
+      if (++b->inside > b->max_inside)
+        b->max_inside = b->inside;
+      timer_sleep (1);
+      b->inside--;
+
+      if (b->use_rwlock)
+        rwlock_release_shared (&b->rw);
+      else
+        lock_release (&b->lock);
+    }
+  sema_up (&b->done);
+}
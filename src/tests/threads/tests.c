@@ -39,6 +39,10 @@ static const struct test tests[] =
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
     {"print-name", test_print_name},
+    {"rwlock-bench", test_rwlock_bench},
+    {"bench-switch", test_bench_switch},
+    {"bench-sleep", test_bench_sleep},
+    {"bench-sched", test_bench_sched},
   };
 
 static const char *test_name;
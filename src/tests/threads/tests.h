@@ -33,6 +33,10 @@ extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
 extern test_func test_print_name;
+extern test_func test_rwlock_bench;
+extern test_func test_bench_switch;
+extern test_func test_bench_sleep;
+extern test_func test_bench_sched;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,254 @@
+#include "threads/bench.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* A benchmark. */
+struct benchmark
+  {
+    const char *name;
+    unsigned cnt;                       /* Default number of operations. */
+    void (*run) (unsigned cnt);         /* Runs CNT of them and reports. */
+  };
+
+/* Prints that CNT operations named NAME took CYCLES in all. */
+static void
+report (const char *name, unsigned cnt, uint64_t cycles)
+{
+  printf ("bench %s: %u ops, %llu cycles/op\n",
+          name, cnt, cnt != 0 ? cycles / cnt : 0);
+}
+
+/* Lock ping-pong: two threads take turns, each waiting on a
+   condition until the other hands the turn over. */
+struct pingpong
+  {
+    struct lock lock;
+    struct condition turned;
+    int turn;                           /* Whose turn, 0 or 1. */
+    unsigned cnt;                       /* Turns each. */
+    struct semaphore done;
+  };
+
+/* Takes PP->cnt turns as player ME. */
+static void
+play (struct pingpong *pp, int me)
+{
+  unsigned i;
+
+  for (i = 0; i < pp->cnt; i++)
+    {
+      lock_acquire (&pp->lock);
+      while (pp->turn != me)
+        cond_wait (&pp->turned, &pp->lock);
+      pp->turn = !me;
+      cond_signal (&pp->turned, &pp->lock);
+      lock_release (&pp->lock);
+    }
+}
+
+static void
+pong (void *pp_)
+{
+  struct pingpong *pp = pp_;
+
+  play (pp, 1);
+  sema_up (&pp->done);
+}
+
+static void
+bench_lock (unsigned cnt)
+{
+  static struct pingpong pp;
+  uint64_t start;
+
+  lock_init (&pp.lock);
+  cond_init (&pp.turned);
+  pp.turn = 0;
+  pp.cnt = cnt;
+  sema_init (&pp.done, 0);
+  thread_create ("pong", thread_get_priority (), pong, &pp);
+
+  start = timer_cycles ();
+  play (&pp, 0);
+  sema_down (&pp.done);
+  report ("lock handoff", 2 * cnt, timer_cycles () - start);
+}
+
+static void
+bench_palloc (unsigned cnt)
+{
+  uint64_t start = timer_cycles ();
+  unsigned i;
+
+  for (i = 0; i < cnt; i++)
+    palloc_free_page (palloc_get_page (PAL_ASSERT));
+  report ("palloc get+free", cnt, timer_cycles () - start);
+}
+
+static void
+bench_malloc (unsigned cnt)
+{
+  uint64_t start = timer_cycles ();
+  unsigned i;
+
+  /* Cycle through the block sizes from 16 to 2048 bytes. */
+  for (i = 0; i < cnt; i++)
+    {
+      void *p = malloc (16 << (i % 8));
+      if (p == NULL)
+        PANIC ("bench: out of memory");
+      free (p);
+    }
+  report ("malloc+free", cnt, timer_cycles () - start);
+}
+
+/* An element of the hash table benchmark. */
+struct item
+  {
+    struct hash_elem elem;
+    int key;
+  };
+
+static unsigned
+item_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct item, elem)->key);
+}
+
+static bool
+item_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return (hash_entry (a, struct item, elem)->key
+          < hash_entry (b, struct item, elem)->key);
+}
+
+static void
+bench_hash (unsigned cnt)
+{
+  struct item *items = malloc (cnt * sizeof *items);
+  struct hash h;
+  uint64_t start;
+  unsigned i;
+
+  if (items == NULL || !hash_init (&h, item_hash, item_less, NULL))
+    PANIC ("bench: out of memory");
+  for (i = 0; i < cnt; i++)
+    items[i].key = i * 7919;
+
+  start = timer_cycles ();
+  for (i = 0; i < cnt; i++)
+    hash_insert (&h, &items[i].elem);
+  report ("hash insert", cnt, timer_cycles () - start);
+
+  start = timer_cycles ();
+  for (i = 0; i < cnt; i++)
+    {
+      struct item key;
+
+      key.key = items[(i * 31) % cnt].key;
+      if (hash_find (&h, &key.elem) == NULL)
+        PANIC ("bench: hash lost key %d", key.key);
+    }
+  report ("hash find", cnt, timer_cycles () - start);
+
+  hash_destroy (&h, NULL);
+  free (items);
+}
+
+/* Pages copied by each memcpy operation. */
+#define COPY_PAGES 16
+
+static void
+bench_memcpy (unsigned cnt)
+{
+  const size_t size = COPY_PAGES * PGSIZE;
+  void *src = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, COPY_PAGES);
+  void *dst = palloc_get_multiple (PAL_ASSERT, COPY_PAGES);
+  uint64_t start, cycles;
+  unsigned i;
+
+  start = timer_cycles ();
+  for (i = 0; i < cnt; i++)
+    memcpy (dst, src, size);
+  cycles = timer_cycles () - start;
+  report ("memcpy 64 kB", cnt, cycles);
+  if (cycles != 0)
+    printf ("bench memcpy: %llu bytes per 1000 cycles\n",
+            (unsigned long long) size * cnt * 1000 / cycles);
+
+  palloc_free_multiple (src, COPY_PAGES);
+  palloc_free_multiple (dst, COPY_PAGES);
+}
+
+/* Bits in the bitmap scanned. */
+#define SCAN_BITS 65536
+
+static void
+bench_bitmap (unsigned cnt)
+{
+  struct bitmap *b = bitmap_create (SCAN_BITS);
+  uint64_t start;
+  unsigned i;
+
+  if (b == NULL)
+    PANIC ("bench: out of memory");
+  bitmap_set_all (b, true);
+
+  /* No bit is clear, so each scan looks at the whole map. */
+  start = timer_cycles ();
+  for (i = 0; i < cnt; i++)
+    if (bitmap_scan (b, 0, 1, false) != BITMAP_ERROR)
+      PANIC ("bench: full bitmap has a clear bit");
+  report ("bitmap_scan of 65536 set bits", cnt, timer_cycles () - start);
+
+  bitmap_destroy (b);
+}
+
+static const struct benchmark benchmarks[] =
+  {
+    {"lock", 10000, bench_lock},
+    {"palloc", 100000, bench_palloc},
+    {"malloc", 100000, bench_malloc},
+    {"hash", 10000, bench_hash},
+    {"memcpy", 1000, bench_memcpy},
+    {"bitmap", 1000, bench_bitmap},
+  };
+
+/* Runs the benchmark named in ARGV[1], which is NAME, for its
+   default number of operations, or NAME=N, for N of them. */
+void
+bench_run (char **argv)
+{
+  char *save_ptr;
+  char *name = strtok_r (argv[1], "=", &save_ptr);
+  char *value = strtok_r (NULL, "", &save_ptr);
+  size_t i;
+
+  if (name == NULL)
+    PANIC ("bench: benchmark name required");
+  for (i = 0; i < sizeof benchmarks / sizeof *benchmarks; i++)
+    {
+      const struct benchmark *b = &benchmarks[i];
+      if (!strcmp (name, b->name))
+        {
+          unsigned cnt = value != NULL ? (unsigned) atoi (value) : b->cnt;
+
+          if (cnt == 0)
+            PANIC ("bench: %s: bad operation count", name);
+          b->run (cnt);
+          return;
+        }
+    }
+  PANIC ("unknown benchmark `%s' (use -h for help)", name);
+}
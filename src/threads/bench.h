@@ -0,0 +1,14 @@
+#ifndef THREADS_BENCH_H
+#define THREADS_BENCH_H
+
+/* Kernel microbenchmarks.
+
+   The kernel command-line action "bench NAME[=N]" runs the
+   benchmark NAME for N operations, or a default number of them,
+   and prints the TSC cycles each took on average.  Interrupts
+   stay on, so timer ticks and whatever else runs meanwhile are
+   counted too; compare runs, not single numbers. */
+
+void bench_run (char **argv);
+
+#endif /* threads/bench.h */
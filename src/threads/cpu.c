@@ -0,0 +1,183 @@
+#include "threads/cpu.h"
+#include <debug.h>
+#include <packed.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/loader.h"
+#include "threads/vaddr.h"
+
+/* Processor discovery and per-processor state.
+
+   The processors are found through the Intel MultiProcessor
+   Specification tables that the BIOS leaves in low memory.  Only
+   the bootstrap processor, cpus[0], is started; the others are
+   recorded so that the scheduler's per-processor structures can
+   be sized for them. */
+
+struct cpu cpus[CPU_MAX];
+unsigned cpu_cnt = 1;
+unsigned cpu_online = 1;
+
+/* MP floating pointer structure. */
+struct mp_fps
+  {
+    char sig[4];                /* "_MP_". */
+    uint32_t config;            /* Physical address of configuration table. */
+    uint8_t length;             /* In 16-byte units. */
+    uint8_t rev;
+    uint8_t checksum;
+    uint8_t features[5];
+  }
+PACKED;
+
+/* MP configuration table header, followed by ENTRY_CNT entries. */
+struct mp_config
+  {
+    char sig[4];                /* "PCMP". */
+    uint16_t length;            /* Of the base table, header included. */
+    uint8_t rev;
+    uint8_t checksum;
+    char oem[20];
+    uint32_t oem_table;
+    uint16_t oem_size;
+    uint16_t entry_cnt;
+    uint32_t lapic;             /* Local APIC address. */
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+  }
+PACKED;
+
+/* Processor entry of the configuration table.  Every other kind
+   of entry is 8 bytes long. */
+struct mp_proc
+  {
+    uint8_t type;               /* MP_PROC. */
+    uint8_t apic_id;
+    uint8_t apic_ver;
+    uint8_t flags;              /* MP_ENABLED, MP_BSP. */
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+  }
+PACKED;
+
+#define MP_PROC 0
+#define MP_ENABLED 0x01
+#define MP_BSP 0x02
+
+/* Initializes the state of every processor. */
+void
+cpu_init (void)
+{
+  unsigned i;
+  int p;
+
+  for (i = 0; i < CPU_MAX; i++)
+    {
+      struct cpu *c = &cpus[i];
+
+      memset (c, 0, sizeof *c);
+      c->id = i;
+      spin_init (&c->rq_lock);
+      for (p = PRI_MIN; p <= PRI_MAX; p++)
+        list_init (&c->pri_list[p]);
+    }
+}
+
+/* Returns true if the SIZE bytes at P sum to zero. */
+static bool
+checksum_ok (const void *p, size_t size)
+{
+  const uint8_t *b = p;
+  uint8_t sum = 0;
+
+  while (size-- > 0)
+    sum += *b++;
+  return sum == 0;
+}
+
+/* Returns true if physical range [PADDR, PADDR + SIZE) is mapped. */
+static bool
+mapped (uint32_t paddr, size_t size)
+{
+  uint32_t ram = init_ram_pages * PGSIZE;
+  return paddr < ram && size <= ram - paddr;
+}
+
+/* Looks for an MP floating pointer structure in the SIZE bytes
+   at physical address PADDR. */
+static struct mp_fps *
+search (uint32_t paddr, size_t size)
+{
+  uint32_t p;
+
+  if (!mapped (paddr, size))
+    return NULL;
+  for (p = paddr; p + sizeof (struct mp_fps) <= paddr + size; p += 16)
+    {
+      struct mp_fps *fps = ptov (p);
+      if (!memcmp (fps->sig, "_MP_", 4)
+          && checksum_ok (fps, sizeof *fps))
+        return fps;
+    }
+  return NULL;
+}
+
+/* Finds the MP floating pointer structure, in the first KB of
+   the EBDA, the last KB of base memory, or the BIOS ROM. */
+static struct mp_fps *
+find_fps (void)
+{
+  uint8_t *bda = ptov (0x400);
+  uint32_t ebda = *(uint16_t *) (bda + 0x0e) << 4;
+  uint32_t base_kb = *(uint16_t *) (bda + 0x13);
+  struct mp_fps *fps = NULL;
+
+  if (ebda != 0)
+    fps = search (ebda, 1024);
+  if (fps == NULL && base_kb != 0)
+    fps = search (base_kb * 1024 - 1024, 1024);
+  if (fps == NULL)
+    fps = search (0xf0000, 0x10000);
+  return fps;
+}
+
+/* Counts the enabled processors in the MP configuration table
+   and records their local APIC IDs, the bootstrap processor's
+   in cpus[0].  Without a table there is just the one. */
+void
+cpu_probe (void)
+{
+  struct mp_fps *fps = find_fps ();
+  struct mp_config *conf;
+  uint8_t *e, *end;
+  unsigned i, cnt = 1;
+
+  if (fps == NULL || fps->config == 0
+      || !mapped (fps->config, sizeof *conf))
+    return;
+  conf = ptov (fps->config);
+  if (memcmp (conf->sig, "PCMP", 4) || !mapped (fps->config, conf->length)
+      || !checksum_ok (conf, conf->length))
+    return;
+
+  e = (uint8_t *) (conf + 1);
+  end = (uint8_t *) conf + conf->length;
+  for (i = 0; i < conf->entry_cnt && e < end; i++)
+    if (*e == MP_PROC)
+      {
+        struct mp_proc *proc = (struct mp_proc *) e;
+        if (proc->flags & MP_BSP)
+          cpus[0].apic_id = proc->apic_id;
+        else if ((proc->flags & MP_ENABLED) && cnt < CPU_MAX)
+          cpus[cnt++].apic_id = proc->apic_id;
+        e += sizeof *proc;
+      }
+    else
+      e += 8;
+
+  cpu_cnt = cnt;
+  if (cpu_cnt > 1)
+    printf ("%u processors found, running on 1.\n", cpu_cnt);
+}
@@ -0,0 +1,58 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/spinlock.h"
+#include "threads/thread.h"
+
+/* Most processors we keep state for. */
+#define CPU_MAX 16
+
+/* Per-processor scheduler state. */
+struct cpu
+  {
+    unsigned id;                /* Index in cpus[]. */
+    uint8_t apic_id;            /* Local APIC ID, from the MP table. */
+    struct thread *idle;        /* This processor's idle thread. */
+
+    /* Threads ready to run here, in one list per priority.  Bit N
+       of ready_mask is set iff pri_list[N] is not empty.
+       Protected by rq_lock. */
+    struct spinlock rq_lock;
+    struct list pri_list[PRI_MAX + 1];
+    uint64_t ready_mask;
+    size_t ready_cnt;           /* Number of ready threads. */
+
+    /* With -cfs, the ready threads are instead in cfs_tree, in
+       order of vruntime.  min_vruntime only ever grows. */
+    struct rb_tree cfs_tree;
+    int64_t min_vruntime;
+
+    /* Ready threads of the deadline class, in order of absolute
+       deadline, which run before any other. */
+    struct rb_tree edf_tree;
+
+    unsigned slice_ticks;       /* Timer ticks since last yield. */
+    long long idle_ticks;       /* Timer ticks spent idle. */
+    long long kernel_ticks;     /* Timer ticks in kernel threads. */
+    long long user_ticks;       /* Timer ticks in user programs. */
+  };
+
+extern struct cpu cpus[CPU_MAX];
+extern unsigned cpu_cnt;        /* Processors described by the MP table. */
+extern unsigned cpu_online;     /* Processors scheduling threads. */
+
+void cpu_init (void);
+void cpu_probe (void);
+
+/* Returns the processor we are running on.  Only the bootstrap
+   processor is brought up, so far. */
+static inline struct cpu *
+cpu_current (void)
+{
+  return &cpus[0];
+}
+
+#endif /* threads/cpu.h */
@@ -12,18 +12,80 @@
 
 typedef int32_t fixed;
 
-inline fixed itof (int n);
-inline int ftoi (fixed x);
-inline int ftopc (fixed x);
-inline int ftoi_round (fixed x);
-inline fixed fadd (fixed op1, fixed op2);
-inline fixed fsub (fixed op1, fixed op2);
-inline fixed fmult (fixed op1, fixed op2);
-inline fixed fdiv (fixed op1, fixed op2);
-inline fixed faddn (fixed op1, int n);
-inline fixed fsubn (fixed op1, int n);
-inline fixed fmultn (fixed op1, int n);
-inline fixed fdivn (fixed op1, int n);
+/* The fraction N/D, as a constant expression. */
+#define FIXED_FRAC(N, D) ((fixed) (((int64_t) (N) << FIXED_Q) / (D)))
 
+/* From int to fixed. */
+static inline fixed
+itof (int n){
+	return n << FIXED_Q;
+}
+
+/* From fixed to int. */
+static inline int
+ftoi (fixed x){
+	return x >> FIXED_Q;
+}
+
+/* Round to zero. */
+static inline int
+ftoi_round (fixed x){
+	return (x>=0) ? (x + (FIXED_F>>1)) >> FIXED_Q 
+			: (x - (FIXED_F>>1)) >> FIXED_Q;
+}
+
+/* Add two fixed numbers. */
+static inline fixed
+fadd (fixed op1, fixed op2){
+	return op1 + op2;
+}
+
+/* Subtract two fixed numbers. */
+static inline fixed
+fsub (fixed op1, fixed op2){
+	return op1 - op2;
+}
+
+/* Multiply two fixed numbers. */
+static inline fixed
+fmult (fixed op1, fixed op2){
+	return (((int64_t) op1) * op2) >> FIXED_Q;
+}
+
+/* Divide two fixed numbers. */
+static inline fixed
+fdiv (fixed op1, fixed op2){
+	return (((int64_t) op1) << FIXED_Q) / op2;
+}
+
+/* Add fixed number with n. */
+static inline fixed
+faddn (fixed op1, int n){
+	return op1 + (n << FIXED_Q);
+}
+
+/* Subtract fixed number with n. */
+static inline fixed
+fsubn (fixed op1, int n){
+	return op1 - (n << FIXED_Q);
+}
+
+/* Multiply fixed number with n. */
+static inline fixed
+fmultn (fixed op1, int n){
+	return op1 * n;
+}
+
+/* Divide fixed number with n. */
+static inline fixed
+fdivn (fixed op1, int n){
+	return op1 / n;
+}
+
+/* From fixed to percent. */
+static inline int
+ftopc (fixed x){
+  return ftoi_round(fmultn(x,100));
+}
 
 #endif	/* threads/fixed-point.h */
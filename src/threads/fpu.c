@@ -0,0 +1,294 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/slab.h"
+#include "threads/thread.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/syscall.h"
+#endif
+
+/* CR0 and CR4 bits.  See [IA32-v3a] 2.5 "Control Registers". */
+#define CR0_MP 0x00000002       /* Monitor Coprocessor. */
+#define CR0_EM 0x00000004       /* Emulation. */
+#define CR0_TS 0x00000008       /* Task Switched. */
+#define CR0_NE 0x00000020       /* Numeric Error. */
+#define CR4_OSFXSR 0x00000200   /* FXSAVE/FXRSTOR and SSE enabled. */
+#define CR4_OSXMMEXCPT 0x00000400 /* SIMD exceptions raise #XM. */
+
+/* CPUID feature bits, in EDX. */
+#define CPUID_FPU (1u << 0)     /* On-chip x87. */
+#define CPUID_FXSR (1u << 24)   /* FXSAVE and FXRSTOR. */
+#define CPUID_SSE (1u << 25)    /* SSE. */
+
+/* Size and alignment of a saved FPU state.  FNSAVE, for want of
+   FXSAVE, only needs 108 bytes of it. */
+#define FPU_SIZE 512
+#define FPU_ALIGN 16
+
+/* Saved states.  The slab allocator only aligns to a pointer, so
+   each object has room to be aligned by hand. */
+static struct kmem_cache fpu_cache;
+
+/* The thread whose state the registers hold, or null. */
+static struct thread *fpu_owner;
+
+/* Whether CR0.TS is set, to spare writing CR0 when it stays. */
+static bool ts_set;
+
+/* Whether we have FXSAVE, rather than only FNSAVE. */
+static bool fxsr;
+
+/* State of a thread that has not used the FPU yet. */
+static uint8_t initial_state[FPU_SIZE] __attribute__ ((aligned (FPU_ALIGN)));
+
+static intr_handler_func fpu_trap;
+
+static inline uint32_t
+read_cr0 (void)
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+static inline void
+write_cr0 (uint32_t cr0)
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0));
+}
+
+/* Sets or clears CR0.TS. */
+static void
+set_ts (bool ts)
+{
+  if (ts != ts_set)
+    {
+      if (ts)
+        write_cr0 (read_cr0 () | CR0_TS);
+      else
+        asm volatile ("clts");
+      ts_set = ts;
+    }
+}
+
+/* Returns T's aligned state area, or null if it has none. */
+static void *
+state_of (struct thread *t)
+{
+  return t->fpu != NULL ? (void *) ROUND_UP ((uintptr_t) t->fpu, FPU_ALIGN)
+                        : NULL;
+}
+
+/* Saves the registers into STATE.  TS must be clear.  FNSAVE also
+   reinitializes the x87, which does no harm where we use it. */
+static void
+save (void *state)
+{
+  if (fxsr)
+    asm volatile ("fxsave %0" : "=m" (*(uint8_t (*)[FPU_SIZE]) state));
+  else
+    asm volatile ("fnsave %0; fwait" : "=m" (*(uint8_t (*)[FPU_SIZE]) state));
+}
+
+/* Loads the registers from STATE.  TS must be clear. */
+static void
+restore (const void *state)
+{
+  if (fxsr)
+    asm volatile ("fxrstor %0" : : "m" (*(const uint8_t (*)[FPU_SIZE]) state));
+  else
+    asm volatile ("frstor %0" : : "m" (*(const uint8_t (*)[FPU_SIZE]) state));
+}
+
+/* Saves the registers for their owner, if any, and leaves them
+   with none.  Interrupts must be off. */
+static void
+release_owner (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (fpu_owner != NULL)
+    {
+      set_ts (false);
+      save (state_of (fpu_owner));
+      fpu_owner = NULL;
+    }
+}
+
+/* Enables the FPU and, if the CPU has them, FXSAVE and SSE, and
+   takes over the #NM exception. */
+void
+fpu_init (void)
+{
+  uint32_t a, b, c, d;
+  uint32_t cr4;
+
+  asm ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (1));
+  if (!(d & CPUID_FPU))
+    PANIC ("no x87 FPU");
+  fxsr = (d & CPUID_FXSR) != 0;
+
+  write_cr0 ((read_cr0 () & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+  if (fxsr)
+    {
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_OSFXSR;
+      if (d & CPUID_SSE)
+        cr4 |= CR4_OSXMMEXCPT;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
+
+  /* FNINIT leaves MXCSR alone, so set its default, with every
+     SIMD exception masked, ourselves. */
+  asm volatile ("fninit");
+  if (d & CPUID_SSE)
+    {
+      uint32_t mxcsr = 0x1f80;
+      asm volatile ("ldmxcsr %0" : : "m" (mxcsr));
+    }
+  save (initial_state);
+
+  kmem_cache_init (&fpu_cache, "fpu", FPU_SIZE + FPU_ALIGN - 1, NULL);
+  write_cr0 (read_cr0 () | CR0_TS);
+  ts_set = true;
+  intr_register_int (7, 0, INTR_ON, fpu_trap,
+                     "#NM Device Not Available Exception");
+}
+
+/* Called with interrupts off when thread switching to T is
+   complete.  Lets T use the FPU only if it owns the registers. */
+void
+fpu_switch (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  set_ts (t != fpu_owner);
+}
+
+/* Saves the registers for their owner, if any, and leaves them
+   with none, as before hibernate(), which loses them.
+   Interrupts must be off. */
+void
+fpu_flush (void)
+{
+  release_owner ();
+  set_ts (true);
+}
+
+/* #NM handler: the current thread used the FPU while CR0.TS was
+   set.  Gives it the registers, with its own state in them. */
+static void
+fpu_trap (struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+#ifdef USERPROG
+  if (f->cs != SEL_UCSEG)
+#endif
+    {
+      intr_dump_frame (f);
+      PANIC ("kernel used the FPU outside fpu_kernel_begin()");
+    }
+
+  if (cur->fpu == NULL)
+    {
+      cur->fpu = kmem_cache_alloc (&fpu_cache);
+      if (cur->fpu == NULL)
+        {
+#ifdef USERPROG
+          exit (-1);
+#endif
+          NOT_REACHED ();
+        }
+      memcpy (state_of (cur), initial_state, FPU_SIZE);
+    }
+
+  old_level = intr_disable ();
+  set_ts (false);
+  if (fpu_owner != cur)
+    {
+      release_owner ();
+      restore (state_of (cur));
+      fpu_owner = cur;
+    }
+  intr_set_level (old_level);
+}
+
+/* Gives CHILD, which must be the running thread, a copy of
+   PARENT's FPU state.  Returns false if out of memory. */
+bool
+fpu_fork (struct thread *child, struct thread *parent)
+{
+  enum intr_level old_level;
+
+  ASSERT (child == thread_current ());
+  ASSERT (child->fpu == NULL);
+
+  if (parent->fpu == NULL)
+    return true;
+  child->fpu = kmem_cache_alloc (&fpu_cache);
+  if (child->fpu == NULL)
+    return false;
+
+  old_level = intr_disable ();
+  if (fpu_owner == parent)
+    {
+      set_ts (false);
+      save (state_of (child));
+
+      /* FNSAVE reinitialized the registers. */
+      if (!fxsr)
+        restore (state_of (child));
+      set_ts (true);
+    }
+  else
+    memcpy (state_of (child), state_of (parent), FPU_SIZE);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Frees T's FPU state.  T must be exiting. */
+void
+fpu_exit (struct thread *t)
+{
+  enum intr_level old_level;
+  void *fpu;
+
+  old_level = intr_disable ();
+  if (fpu_owner == t)
+    fpu_owner = NULL;
+  fpu = t->fpu;
+  t->fpu = NULL;
+  intr_set_level (old_level);
+
+  if (fpu != NULL)
+    kmem_cache_free (&fpu_cache, fpu);
+}
+
+/* Lets kernel code use the FPU and SSE until fpu_kernel_end(),
+   which must be passed the return value.  Saves whatever state
+   the registers hold for their owner first.  Interrupts are off
+   in between. */
+enum intr_level
+fpu_kernel_begin (void)
+{
+  enum intr_level old_level = intr_disable ();
+
+  release_owner ();
+  set_ts (false);
+  return old_level;
+}
+
+/* Ends a section begun with fpu_kernel_begin(). */
+void
+fpu_kernel_end (enum intr_level old_level)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (fpu_owner == NULL);
+
+  set_ts (true);
+  intr_set_level (old_level);
+}
@@ -0,0 +1,30 @@
+#ifndef THREADS_FPU_H
+#define THREADS_FPU_H
+
+#include "threads/interrupt.h"
+
+struct thread;
+
+/* Lazy FPU context switching.
+
+   The x87 and SSE registers are not saved on a thread switch.
+   Instead, the thread switched to runs with CR0.TS set unless it
+   is the one whose state the registers hold, so that its first
+   FPU or SSE instruction raises #NM, whose handler saves the
+   registers for their owner and loads the current thread's.  A
+   thread that never uses the FPU never pays for it.
+
+   The kernel is compiled with -msoft-float.  Kernel code that
+   wants the FPU or SSE anyway must bracket its use with
+   fpu_kernel_begin() and fpu_kernel_end(), and may not sleep in
+   between. */
+
+void fpu_init (void);
+void fpu_switch (struct thread *);
+void fpu_flush (void);
+bool fpu_fork (struct thread *child, struct thread *parent);
+void fpu_exit (struct thread *);
+enum intr_level fpu_kernel_begin (void);
+void fpu_kernel_end (enum intr_level);
+
+#endif /* threads/fpu.h */
@@ -0,0 +1,264 @@
+#include "threads/hibernate.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/ide.h"
+#include "devices/serial.h"
+#include "devices/shutdown.h"
+#include "devices/timer.h"
+#include "threads/fpu.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/pmc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/tss.h"
+#endif
+#ifdef FILESYS
+#include "filesys/cache.h"
+#endif
+
+/* A snapshot is the header below, in sector 0 of hdd, followed
+   by the contents of each of its ranges of physical memory in
+   turn: the initial thread's page, which holds main()'s stack,
+   the kernel image, and everything from 1 MB up, where palloc()
+   hands out pages.  The rest of low memory is free after boot;
+   hibernate_resume() keeps the header and its stack there while
+   it reads the ranges back in. */
+
+/* Disk the snapshot is on: hdd, the slave on the second channel. */
+#define SNAPSHOT_DISK 3
+
+#define MAGIC "HIBERNAT"
+#define RANGE_CNT 3
+
+struct header
+  {
+    char magic[8];                      /* MAGIC. */
+    uint32_t ram_pages;                 /* init_ram_pages. */
+    uint32_t text_sum;                  /* text_sum() of the kernel. */
+    struct
+      {
+        uint32_t start, end;            /* Physical, page-aligned. */
+      }
+    ranges[RANGE_CNT];
+  };
+
+/* Where hibernate_resume() keeps the header, and the top of its
+   stack, in physical memory. */
+#define RESUME_HEADER 0x1000
+#define RESUME_STACK 0x7000
+
+/* Registers saved by hibernate_save_context() and loaded by
+   hibernate_restore_context(), in resume.S, which knows this
+   layout. */
+struct context
+  {
+    uint32_t ebx, esi, edi, ebp;        /* Callee-saved registers. */
+    uint32_t esp, eip;                  /* Where to return to. */
+    uint32_t cr0, cr3, cr4;             /* Control registers. */
+    uint16_t pad0, gdt_limit;           /* Operand of SGDT and LGDT. */
+    uint32_t gdt_base;
+    uint16_t pad1, idt_limit;           /* Operand of SIDT and LIDT. */
+    uint32_t idt_base;
+    uint32_t tr;                        /* TSS selector, or 0. */
+  };
+
+/* Saved in RAM, and so in the snapshot, before RAM is written. */
+static struct context context;
+
+int hibernate_save_context (struct context *) __attribute__ ((returns_twice));
+void hibernate_restore_context (const struct context *) NO_RETURN;
+
+/* Returns a checksum of the kernel's code, to tell whether a
+   snapshot was taken by this kernel. */
+static uint32_t
+text_sum (void)
+{
+  extern char _start, _end_kernel_text;
+  const uint32_t *p;
+  uint32_t sum = 0;
+
+  for (p = (const uint32_t *) &_start;
+       p < (const uint32_t *) &_end_kernel_text; p++)
+    sum = ((sum << 1) | (sum >> 31)) + *p;
+  return sum;
+}
+
+/* Writes H and the memory it describes to the snapshot disk.
+   Kept out of hibernate() so that nothing it changes is in the
+   frames that resume. */
+static bool NO_INLINE
+write_snapshot (const struct header *h)
+{
+  static uint8_t sector[BLOCK_SECTOR_SIZE];
+  block_sector_t sec_no = 1;
+  int i;
+
+  memset (sector, 0, sizeof sector);
+  memcpy (sector, h, sizeof *h);
+  for (i = 0; i < RANGE_CNT; i++)
+    {
+      block_sector_t cnt = ((h->ranges[i].end - h->ranges[i].start)
+                            / BLOCK_SECTOR_SIZE);
+
+      if (!ide_poll_transfer (SNAPSHOT_DISK, sec_no,
+                              ptov (h->ranges[i].start), cnt, true))
+        return false;
+      sec_no += cnt;
+    }
+
+  /* The header goes last, so that a snapshot cut short is never
+     resumed. */
+  return ide_poll_transfer (SNAPSHOT_DISK, 0, sector, 1, true);
+}
+
+/* Saves a snapshot to hdd and powers off.  Must be called with
+   interrupts on, by the initial thread, with no user process
+   running.  Returns true on the boot that resumed from the
+   snapshot, or false, at once, if none can be saved. */
+bool
+hibernate (void)
+{
+  extern char _end;
+  struct header h;
+  struct block *b;
+  block_sector_t sectors = 1;
+  enum intr_level old_level;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_ON);
+  ASSERT (vtop (thread_current ()) < LOADER_KERN_BASE);
+
+  memcpy (h.magic, MAGIC, sizeof h.magic);
+  h.ram_pages = init_ram_pages;
+  h.text_sum = text_sum ();
+  h.ranges[0].start = vtop (pg_round_down (thread_current ()));
+  h.ranges[0].end = h.ranges[0].start + PGSIZE;
+  h.ranges[1].start = LOADER_KERN_BASE;
+  h.ranges[1].end = vtop (pg_round_up (&_end));
+  h.ranges[2].start = 1024 * 1024;
+  h.ranges[2].end = init_ram_pages * PGSIZE;
+  for (i = 0; i < RANGE_CNT; i++)
+    sectors += (h.ranges[i].end - h.ranges[i].start) / BLOCK_SECTOR_SIZE;
+
+  b = block_get_by_name ("hdd");
+  if (b == NULL || block_type (b) != BLOCK_RAW || block_size (b) < sectors)
+    {
+      printf ("hibernate: need an unpartitioned hdd of %"PRDSNu" sectors\n",
+              sectors);
+      return false;
+    }
+  for (b = block_first (); b != NULL; b = block_next (b))
+    if (!memcmp (block_name (b), "vd", 2))
+      {
+        printf ("hibernate: virtio disks can't be resumed\n");
+        return false;
+      }
+
+#ifdef FILESYS
+  /* Not needed for the snapshot, which includes the cache, but it
+     leaves the file system whole for a boot that doesn't resume. */
+  cache_flush ();
+#endif
+
+  /* Wait for transfers in progress, which would otherwise finish
+     after the snapshot and be lost. */
+  old_level = intr_disable ();
+  while (!ide_idle ())
+    {
+      intr_set_level (old_level);
+      timer_msleep (1);
+      intr_disable ();
+    }
+  fpu_flush ();
+
+  if (hibernate_save_context (&context) == 0)
+    {
+      if (!write_snapshot (&h))
+        {
+          intr_set_level (old_level);
+          printf ("hibernate: writing hdd failed\n");
+          return false;
+        }
+      printf ("Hibernated, %"PRDSNu" sectors.\n", sectors);
+      shutdown_power_off_now ();
+    }
+
+  /* Resumed.  Set up again what lost its state. */
+  intr_reinit ();
+  timer_reinit ();
+  serial_reinit ();
+#ifdef USERPROG
+  tss_load_msrs ();
+#endif
+  pmc_init ();
+  intr_set_level (old_level);
+  ide_reinit ();
+  printf ("Resumed from snapshot.\n");
+  return true;
+}
+
+/* Reads the snapshot described by the header H back into the
+   memory it came from and jumps into it.  Runs on a stack of its
+   own, because the one it was called on is overwritten. */
+static void NO_RETURN
+restore (const struct header *h)
+{
+  block_sector_t sec_no = 1;
+  int i;
+
+  for (i = 0; i < RANGE_CNT; i++)
+    {
+      block_sector_t cnt = ((h->ranges[i].end - h->ranges[i].start)
+                            / BLOCK_SECTOR_SIZE);
+
+      /* Too late to boot normally: stop. */
+      if (!ide_poll_transfer (SNAPSHOT_DISK, sec_no,
+                              ptov (h->ranges[i].start), cnt, false))
+        for (;;)
+          asm volatile ("cli; hlt");
+      sec_no += cnt;
+    }
+  hibernate_restore_context (&context);
+}
+
+/* Resumes from the snapshot on hdd, if the kernel command line
+   starts with -resume.  Must be called first thing in main(),
+   before the BSS is cleared, because it depends on no kernel data
+   and overwrites all of it.  Returns only if it doesn't resume:
+   a null pointer if not asked to, or otherwise why not. */
+const char *
+hibernate_resume (void)
+{
+  struct header *h = ptov (RESUME_HEADER);
+  int i;
+
+  if (*(uint32_t *) ptov (LOADER_ARG_CNT) == 0
+      || strcmp (ptov (LOADER_ARGS), "-resume"))
+    return NULL;
+
+  if (!ide_poll_transfer (SNAPSHOT_DISK, 0, h, 1, false))
+    return "can't read hdd";
+  if (memcmp (h->magic, MAGIC, sizeof h->magic))
+    return "no snapshot on hdd";
+  if (h->ram_pages != init_ram_pages)
+    return "snapshot is of a different amount of RAM";
+  if (h->text_sum != text_sum ())
+    return "snapshot is of a different kernel";
+  for (i = 0; i < RANGE_CNT; i++)
+    if (h->ranges[i].start < LOADER_END
+        || h->ranges[i].end > init_ram_pages * PGSIZE
+        || h->ranges[i].start >= h->ranges[i].end
+        || pg_ofs ((void *) h->ranges[i].start) != 0
+        || pg_ofs ((void *) h->ranges[i].end) != 0)
+      return "corrupt snapshot on hdd";
+
+  asm volatile ("movl %0, %%esp; pushl %1; call *%2"
+                : : "r" (ptov (RESUME_STACK)), "r" (h), "r" (restore)
+                : "memory");
+  NOT_REACHED ();
+}
@@ -0,0 +1,22 @@
+#ifndef THREADS_HIBERNATE_H
+#define THREADS_HIBERNATE_H
+
+#include <stdbool.h>
+
+/* Hibernation.
+
+   hibernate() writes a snapshot of all the RAM the kernel uses to
+   the raw disk hdd and powers off.  A later boot whose command
+   line starts with -resume reads it back in hibernate_resume(),
+   at the very start of main(), and carries on from the moment it
+   was taken: hibernate() returns true, after setting up again
+   the devices that lost their state.
+
+   The other disks are not saved.  They must be booted from just
+   as they were at power off, which the pintos utility's
+   --snapshot option sees to. */
+
+bool hibernate (void);
+const char *hibernate_resume (void);
+
+#endif /* threads/hibernate.h */
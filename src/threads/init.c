@@ -15,13 +15,23 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/bench.h"
+#include "threads/cpu.h"
+#include "threads/fpu.h"
+#include "threads/hibernate.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memprof.h"
 #include "threads/palloc.h"
+#include "threads/pmc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vmalloc.h"
+#include "threads/worker.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -35,12 +45,18 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/replace.h"
+#include "vm/shm.h"
+#include "vm/zswap.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -54,14 +70,27 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
-#ifdef VM
-static const char *swap_bdev_name;
-#endif
+
+/* -ramdisk: Size of the RAM disk in kB, or 0 for none. */
+static size_t ramdisk_kb;
+
+/* -tmpfs: Directory to mount a tmpfs on, or null for none. */
+static const char *tmpfs_path;
+
+/* -image: Directory to mount the scratch device's packed image
+   on, or null for none. */
+static const char *image_path;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+#ifdef VM
+/* -prefetch: Comma-separated executables whose code to read in at
+   boot, or null for none. */
+static const char *prefetch_list;
+#endif
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -82,12 +111,23 @@ int
 main (void)
 {
   char **argv;
+#ifdef FILESYS
+  const char *no_resume;
+
+  /* Carry on from a snapshot instead, if the command line says
+     so.  Returns only if there is none. */
+  no_resume = hibernate_resume ();
+#endif
 
   /* Clear BSS. */  
   bss_init ();
 
   /* Break command line into arguments and parse options. */
   argv = read_command_line ();
+#ifdef FILESYS
+  if (no_resume != NULL)
+    printf ("Not resuming: %s.\n", no_resume);
+#endif
   argv = parse_options (argv);
 
   /* Initialize ourselves as a thread so we can use locks,
@@ -102,7 +142,11 @@ main (void)
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
+  memprof_init ();
   paging_init ();
+  vmalloc_init ();
+  cpu_probe ();
+  trace_init ();
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -112,30 +156,43 @@ main (void)
 
   /* Initialize interrupt handlers. */
   intr_init ();
+  fpu_init ();
+  pmc_init ();
   timer_init ();
   kbd_init ();
   input_init ();
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  process_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  worker_init ();
   serial_init_queue ();
   timer_calibrate ();
 
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
+  ramdisk_init (ramdisk_kb);
   locate_block_devices ();
   filesys_init (format_filesys);
+  if (tmpfs_path != NULL && !filesys_mount ("tmpfs", tmpfs_path))
+    printf ("Failed to mount tmpfs on %s.\n", tmpfs_path);
+  if (image_path != NULL && !filesys_mount ("image", image_path))
+    printf ("Failed to mount image on %s.\n", image_path);
 #endif
 
 #ifdef VM
 	frame_init ();
 	page_init ();
 	swap_init ();
+	shm_init ();
+	if (prefetch_list != NULL)
+		process_prefetch (prefetch_list);
 #endif
 
   printf ("Boot complete.\n");
@@ -161,20 +218,48 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CPUID feature flags (leaf 1, EDX). */
+#define CPUID_PSE (1u << 3)     /* 4 MB pages. */
+#define CPUID_PGE (1u << 13)    /* Global pages. */
+
+/* CR4 bits. */
+#define CR4_PSE 0x00000010      /* Page Size Extensions. */
+#define CR4_PGE 0x00000080      /* Page Global Enable. */
+
+/* Returns the feature flags CPUID reports in EDX.  See
+   [IA32-v2a] "CPUID--CPU Identification". */
+static uint32_t
+cpuid_features (void) 
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return edx;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   Where the CPU allows it, each 4 MB of RAM that holds no kernel
+   text is mapped by a single large page, and all kernel mappings
+   are global, so that switching page directories doesn't flush
+   them from the TLB.  They are the same in every page directory
+   and never change. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t features = cpuid_features ();
+  bool pse = (features & CPUID_PSE) != 0;
+  uint32_t global = (features & CPUID_PGE) != 0 ? PTE_G : 0;
+  uint32_t cr4;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
-  for (page = 0; page < init_ram_pages; page++)
+  for (page = 0; page < init_ram_pages; )
     {
       uintptr_t paddr = page * PGSIZE;
       char *vaddr = ptov (paddr);
@@ -182,13 +267,33 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0 && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true) | global;
+          page += PTSPAN / PGSIZE;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
+      page++;
+    }
+
+  /* Large pages must be enabled before they are used, global
+     pages are best enabled once paging is on.  See [IA32-v3a]
+     2.5 "Control Registers" and 3.12 "Translation Lookaside
+     Buffers". */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (pse)
+    {
+      cr4 |= CR4_PSE;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
     }
 
   /* Store the physical address of the page directory into CR3
@@ -196,7 +301,13 @@ paging_init (void)
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
-  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
+
+  if (global != 0)
+    {
+      cr4 |= CR4_PGE;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -258,22 +369,90 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-tmpfs"))
+        tmpfs_path = value;
+      else if (!strcmp (name, "-image"))
+        image_path = value;
+      else if (!strcmp (name, "-cluster"))
+        inode_cluster = atoi (value);
+      else if (!strcmp (name, "-resume"))
+        continue;                       /* See hibernate_resume(). */
 #ifdef VM
       else if (!strcmp (name, "-swap"))
-        swap_bdev_name = value;
+        swap_devices = value;
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-cfs"))
+        thread_cfs = true;
+      else if (!strcmp (name, "-slice"))
+        {
+          if (value == NULL || !thread_set_slices (value))
+            PANIC ("-slice needs up to 4 tick counts, lowest band first");
+        }
+      else if (!strcmp (name, "-profile"))
+        profile_enabled = true;
+      else if (!strcmp (name, "-irqoff"))
+        intr_off_trace = true;
+      else if (!strcmp (name, "-memprof"))
+        memprof_enabled = true;
+      else if (!strcmp (name, "-trace"))
+        trace_enabled = true;
+      else if (!strcmp (name, "-lps"))
+        timer_preset_calibration (value);
+      else if (!strcmp (name, "-serial-trigger"))
+        {
+          if (value == NULL || !serial_set_rx_trigger (atoi (value)))
+            PANIC ("serial trigger level must be 1, 4, 8 or 14");
+        }
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-cputime"))
+        syscall_cpu_times = true;
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-vm-policy"))
+        {
+          if (value == NULL || !replacement_select (value))
+            PANIC ("unknown replacement policy `%s'", value);
+        }
+      else if (!strcmp (name, "-vm-scan"))
+        replace_scan_ticks = atoi (value);
+      else if (!strcmp (name, "-wstau"))
+        wsclock_tau = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        zswap_max_pages = atoi (value);
+      else if (!strcmp (name, "-lowwm"))
+        frame_low_wm = atoi (value);
+      else if (!strcmp (name, "-highwm"))
+        frame_high_wm = atoi (value);
+      else if (!strcmp (name, "-rss"))
+        frame_rss_limit = atoi (value);
+      else if (!strcmp (name, "-vm-thrash"))
+        frame_thrash_rate = atoi (value);
+      else if (!strcmp (name, "-ksm"))
+        frame_ksm_pages = atoi (value);
+      else if (!strcmp (name, "-colors"))
+        {
+          palloc_colors = value != NULL ? atoi (value) : 0;
+          if (palloc_colors == 0 || palloc_colors > 1024
+              || (palloc_colors & (palloc_colors - 1)) != 0)
+            PANIC ("-colors needs a power of 2 up to 1024");
+        }
+      else if (!strcmp (name, "-prefetch"))
+        prefetch_list = value;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
     }
+  if (thread_mlfqs && thread_cfs)
+    PANIC ("-mlfqs and -cfs don't go together");
 
   /* Initialize the random number generator based on the system
      time.  This has no effect if an "-rs" option was specified.
@@ -303,6 +482,28 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifdef FILESYS
+/* Saves a snapshot and powers off.  Once resumed from it, runs
+   the actions on the command line of the boot that resumed
+   instead.  Of its options only -q and -r count; the rest were
+   fixed when the snapshot was taken. */
+static void
+run_hibernate (char **argv UNUSED)
+{
+  if (!hibernate ())
+    return;
+
+  for (argv = read_command_line (); *argv != NULL && **argv == '-'; argv++)
+    if (!strcmp (*argv, "-q"))
+      shutdown_configure (SHUTDOWN_POWER_OFF);
+    else if (!strcmp (*argv, "-r"))
+      shutdown_configure (SHUTDOWN_REBOOT);
+  run_actions (argv);
+  shutdown ();
+  thread_exit ();
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -320,12 +521,15 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+      {"bench", 2, bench_run},
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
       {"rm", 2, fsutil_rm},
+      {"defrag", 2, fsutil_defrag},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"hibernate", 1, run_hibernate},
 #endif
       {NULL, 0, NULL},
     };
@@ -368,10 +572,14 @@ usage (void)
 #else
           "  run TEST           Run TEST.\n"
 #endif
+          "  bench NAME[=N]     Time N operations of kernel benchmark NAME:\n"
+          "                     lock, palloc, malloc, hash, memcpy or bitmap.\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  defrag FILE        Move FILE's data into one run on disk.\n"
+          "  hibernate          Save a snapshot on hdd and power off.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -384,14 +592,42 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Add a KB RAM disk, ram0, for use as a BDEV.\n"
+          "  -tmpfs=DIR         Mount a file system held in memory on DIR.\n"
+          "  -image=DIR         Mount the packed image on scratch on DIR.\n"
+          "  -cluster=SECTORS   Allocate file data SECTORS at a time.\n"
+          "  -resume            Carry on from the snapshot on hdd, if any.\n"
 #ifdef VM
-          "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -swap=BDEV[:PRIO],...  Swap to each BDEV, higher PRIO first,\n"
+          "                     instead of to every swap partition.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -cfs               Use fair-share scheduler.\n"
+          "  -slice=T0,T1,..    Give priority bands, lowest first, T ticks.\n"
+          "  -profile           Sample the kernel on timer interrupts.\n"
+          "  -irqoff            Time interrupts-off windows by call site.\n"
+          "  -memprof           Profile kernel allocations by call site.\n"
+          "  -trace             Trace events to the scratch device.\n"
+          "  -lps=LOOPS         Trust timer calibration of LOOPS loops/s.\n"
+          "  -serial-trigger=N  Interrupt on N bytes of serial input.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -cputime           Print each process's CPU times at exit.\n"
+#endif
+#ifdef VM
+          "  -vm-policy=NAME    Replace pages by clock, wsclock, aging or 2q.\n"
+          "  -vm-scan=TICKS     Sample accessed bits every TICKS, for aging.\n"
+          "  -wstau=TICKS       Set WSClock working-set window to TICKS.\n"
+          "  -zswap=PAGES       Keep up to PAGES of compressed swap in RAM.\n"
+          "  -lowwm=PAGES       Start paging out below PAGES free frames.\n"
+          "  -highwm=PAGES      Page out until PAGES frames are free.\n"
+          "  -rss=PAGES         Limit each process to PAGES resident frames.\n"
+          "  -vm-thrash=FAULTS  Suspend processes above FAULTS major faults/s.\n"
+          "  -ksm=PAGES         Merge identical frames, scanning PAGES per 100 ms.\n"
+          "  -colors=N          Give user pages frames of N cache colors.\n"
+          "  -prefetch=PROG,..  Read in the code of each PROG at boot.\n"
 #endif
           );
   shutdown_power_off ();
@@ -404,9 +640,6 @@ locate_block_devices (void)
 {
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
-#ifdef VM
-  locate_block_device (BLOCK_SWAP, swap_bdev_name);
-#endif
 }
 
 /* Figures out what block device to use for the given ROLE: the
@@ -3,12 +3,18 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/syscall.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -33,6 +39,55 @@ static intr_handler_func *intr_handlers[INTR_CNT];
 /* Names for each interrupt, for debugging purposes. */
 static const char *intr_names[INTR_CNT];
 
+/* Time spent in each vector's handler, in TSC cycles, including
+   any nested interrupts and, for handlers that may sleep, time
+   spent blocked. */
+struct intr_stat
+  {
+    unsigned long long cnt;     /* Times the handler returned. */
+    uint64_t cycles;            /* Total time in the handler. */
+    uint64_t max_cycles;        /* Longest single run. */
+    unsigned int slow_cnt;      /* Runs with interrupts off that took
+                                   longer than INTR_SLOW_US. */
+  };
+static struct intr_stat intr_stats[INTR_CNT];
+
+/* A handler that runs with interrupts off for longer than this
+   many microseconds gets a warning. */
+#define INTR_SLOW_US 1000
+
+/* Interrupts-off windows.
+
+   With -irqoff, every switch from interrupts on to off by
+   intr_disable() or intr_set_level() is timestamped, and so is
+   the next switch back on, by intr_enable(), intr_set_level() or
+   the return from an external interrupt, which may be in another
+   thread.  Windows are kept per pair of call sites, the return
+   addresses of the calls that began and ended them, in a table
+   of OFF_SITES entries; once it is full, a window longer than the
+   longest of some entry takes that entry over.  Time spent in
+   external interrupt handlers is counted by intr_stats instead. */
+#define OFF_SITES 64
+
+struct off_site
+  {
+    void *begin, *end;          /* Call sites. */
+    unsigned long long cnt;     /* Windows between them. */
+    uint64_t cycles;            /* Total time off. */
+    uint64_t max_cycles;        /* Longest window. */
+  };
+
+bool intr_off_trace;
+
+static struct off_site off_sites[OFF_SITES];
+static size_t off_site_cnt;
+static unsigned long long off_cnt;      /* All windows. */
+static uint64_t off_cycles;             /* Their total time. */
+
+/* The window in progress, if OFF_BEGIN is nonnull. */
+static void *off_begin;
+static uint64_t off_start;
+
 /* Number of unexpected interrupts for each vector.  An
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
@@ -59,6 +114,10 @@ static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 /* Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
 static void unexpected_interrupt (const struct intr_frame *);
+static void account (uint8_t vec_no, bool intr_off, uint64_t cycles);
+static void off_end (void *site);
+static enum intr_level enable (void *site);
+static enum intr_level disable (void *site);
 
 /* Returns the current interrupt status. */
 enum intr_level
@@ -80,16 +139,35 @@ intr_get_level (void)
 enum intr_level
 intr_set_level (enum intr_level level) 
 {
-  return level == INTR_ON ? intr_enable () : intr_disable ();
+  void *site = __builtin_return_address (0);
+  return level == INTR_ON ? enable (site) : disable (site);
 }
 
 /* Enables interrupts and returns the previous interrupt status. */
 enum intr_level
 intr_enable (void) 
+{
+  return enable (__builtin_return_address (0));
+}
+
+/* Disables interrupts and returns the previous interrupt status. */
+enum intr_level
+intr_disable (void) 
+{
+  return disable (__builtin_return_address (0));
+}
+
+/* Enables interrupts, on behalf of a call from SITE, and returns
+   the previous interrupt status. */
+static enum intr_level
+enable (void *site)
 {
   enum intr_level old_level = intr_get_level ();
   ASSERT (!intr_context ());
 
+  if (old_level == INTR_OFF)
+    off_end (site);
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -99,9 +177,10 @@ intr_enable (void)
   return old_level;
 }
 
-/* Disables interrupts and returns the previous interrupt status. */
-enum intr_level
-intr_disable (void) 
+/* Disables interrupts, on behalf of a call from SITE, and
+   returns the previous interrupt status. */
+static enum intr_level
+disable (void *site)
 {
   enum intr_level old_level = intr_get_level ();
 
@@ -110,8 +189,59 @@ intr_disable (void)
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
 
+  if (old_level == INTR_ON && intr_off_trace)
+    {
+      off_begin = site;
+      off_start = timer_cycles ();
+    }
   return old_level;
 }
+
+/* Ends the interrupts-off window in progress, if any, at SITE.
+   Interrupts must be off. */
+static void
+off_end (void *site)
+{
+  uint64_t cycles;
+  struct off_site *s, *min;
+  size_t i;
+
+  if (off_begin == NULL)
+    return;
+  cycles = timer_cycles () - off_start;
+  off_cnt++;
+  off_cycles += cycles;
+
+  min = NULL;
+  for (i = 0; i < off_site_cnt; i++)
+    {
+      s = &off_sites[i];
+      if (s->begin == off_begin && s->end == site)
+        goto found;
+      if (min == NULL || s->max_cycles < min->max_cycles)
+        min = s;
+    }
+  if (off_site_cnt < OFF_SITES)
+    s = &off_sites[off_site_cnt++];
+  else if (cycles > min->max_cycles)
+    s = min;
+  else
+    {
+      off_begin = NULL;
+      return;
+    }
+  s->begin = off_begin;
+  s->end = site;
+  s->cnt = 0;
+  s->cycles = s->max_cycles = 0;
+
+ found:
+  s->cnt++;
+  s->cycles += cycles;
+  if (cycles > s->max_cycles)
+    s->max_cycles = cycles;
+  off_begin = NULL;
+}
 
 /* Initializes the interrupt system. */
 void
@@ -268,6 +398,14 @@ pic_init (void)
   outb (PIC1_DATA, 0x00);
 }
 
+/* Programs the PICs again after hibernate() resumes, with the
+   IDT already loaded. */
+void
+intr_reinit (void)
+{
+  pic_init ();
+}
+
 /* Sends an end-of-interrupt signal to the PIC for the given IRQ.
    If we don't acknowledge the IRQ, it will never be delivered to
    us again, so this is important.  */
@@ -284,6 +422,20 @@ pic_end_of_interrupt (int irq)
     outb (0xa0, 0x20);
 }
 
+/* Returns true if external interrupt VEC has been raised on the
+   PIC but not yet delivered. */
+bool
+intr_pending (uint8_t vec)
+{
+  int port = vec >= 0x28 ? 0xa0 : 0x20;
+
+  ASSERT (vec >= 0x20 && vec < 0x30);
+
+  /* OCW3: read the interrupt request register. */
+  outb (port, 0x0a);
+  return (inb (port) & (1 << ((vec - 0x20) % 8))) != 0;
+}
+
 /* Creates an gate that invokes FUNCTION.
 
    The gate has descriptor privilege level DPL, meaning that it
@@ -356,6 +508,13 @@ intr_handler (struct intr_frame *frame)
 {
   bool external;
   intr_handler_func *handler;
+  uint8_t vec_no = frame->vec_no;
+
+#ifdef USERPROG
+	/* The process's time is the kernel's until we return. */
+	if (frame->cs == SEL_UCSEG)
+		thread_account (CPU_KERNEL);
+#endif
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
@@ -369,6 +528,13 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+
+      /* Interrupts were on, so no window is in progress. */
+      off_begin = NULL;
+
+      /* Restart the periodic tick if the idle thread stopped it,
+         before anything gets to run. */
+      timer_resume (frame->vec_no == 0x20);
     }
 #ifdef USERPROG
 	else if (frame->vec_no == 0x30)
@@ -380,7 +546,13 @@ intr_handler (struct intr_frame *frame)
   /* Invoke the interrupt's handler. */
   handler = intr_handlers[frame->vec_no];
   if (handler != NULL)
-    handler (frame);
+    {
+      bool intr_off = intr_get_level () == INTR_OFF;
+      uint64_t start = timer_cycles ();
+
+      handler (frame);
+      account (vec_no, intr_off, timer_cycles () - start);
+    }
   else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f)
     {
       /* There is no handler, but this interrupt can trigger
@@ -401,15 +573,54 @@ intr_handler (struct intr_frame *frame)
 
       if (yield_on_return) 
         thread_yield (); 
+
+      /* Returning turns interrupts back on, ending a window that
+         a thread switched away from to here began. */
+      off_end ((void *) intr_exit);
+#ifdef USERPROG
+			/* Stop a thread of an exiting process even if it never
+			   enters the kernel itself. */
+			if (frame->cs == SEL_UCSEG && thread_current ()->process->exiting)
+				{
+					intr_enable ();
+					exit_check ();
+				}
+#endif
     }
 #ifdef USERPROG
 	else if (frame->vec_no == 0x30)
 		{
 			thread_current ()->in_syscall = false;
 		}
+	if (frame->cs == SEL_UCSEG)
+		thread_account (CPU_USER);
 #endif
 }
 
+/* Adds a run of CYCLES of the handler for VEC_NO to its
+   statistics, warning about it if it ran too long with
+   interrupts off. */
+static void
+account (uint8_t vec_no, bool intr_off, uint64_t cycles)
+{
+  struct intr_stat *st = &intr_stats[vec_no];
+  enum intr_level old_level = intr_disable ();
+  unsigned int n = 0;
+
+  st->cnt++;
+  st->cycles += cycles;
+  if (cycles > st->max_cycles)
+    st->max_cycles = cycles;
+  if (intr_off && timer_cycles_to_us (cycles) > INTR_SLOW_US)
+    n = ++st->slow_cnt;
+  intr_set_level (old_level);
+
+  /* Rate limited like unexpected interrupts, below. */
+  if (n != 0 && (n & (n - 1)) == 0)
+    printf ("Interrupt %#04x (%s) ran %"PRIu64" us with interrupts off\n",
+            vec_no, intr_names[vec_no], timer_cycles_to_us (cycles));
+}
+
 /* Handles an unexpected interrupt with interrupt frame F.  An
    unexpected interrupt is one that has no registered handler. */
 static void
@@ -452,6 +663,71 @@ intr_dump_frame (const struct intr_frame *f)
           f->cs, f->ds, f->es, f->ss);
 }
 
+/* Most call site pairs printed. */
+#define OFF_TOP 10
+
+/* Orders off_sites by descending longest window. */
+static int
+compare_off_sites (const void *a_, const void *b_)
+{
+  const struct off_site *a = a_, *b = b_;
+
+  return (a->max_cycles < b->max_cycles ? 1
+          : a->max_cycles > b->max_cycles ? -1 : 0);
+}
+
+/* Prints the call sites of the longest interrupts-off windows,
+   as addresses for utils/backtrace. */
+static void
+print_off_stats (void)
+{
+  struct off_site top[OFF_TOP];
+  enum intr_level old_level;
+  unsigned long long cnt;
+  uint64_t cycles;
+  size_t top_cnt, i;
+
+  old_level = intr_disable ();
+  qsort (off_sites, off_site_cnt, sizeof *off_sites, compare_off_sites);
+  top_cnt = off_site_cnt < OFF_TOP ? off_site_cnt : OFF_TOP;
+  memcpy (top, off_sites, top_cnt * sizeof *top);
+  cnt = off_cnt;
+  cycles = off_cycles;
+  intr_set_level (old_level);
+
+  printf ("Interrupts off: %llu windows, %"PRIu64" us in all; longest:\n",
+          cnt, timer_cycles_to_us (cycles));
+  printf ("  %10s %10s %12s  %-10s %-10s (us)\n",
+          "max", "count", "total", "begin", "end");
+  for (i = 0; i < top_cnt; i++)
+    printf ("  %10"PRIu64" %10llu %12"PRIu64"  %-10p %-10p\n",
+            timer_cycles_to_us (top[i].max_cycles), top[i].cnt,
+            timer_cycles_to_us (top[i].cycles), top[i].begin, top[i].end);
+}
+
+/* Prints a line for each interrupt vector that was handled, and
+   with -irqoff the longest interrupts-off windows. */
+void
+intr_print_stats (void)
+{
+  int i;
+
+  printf ("Interrupts: %-4s %-36s %10s %12s %10s %6s (us)\n",
+          "vec", "name", "count", "total", "max", "slow");
+  for (i = 0; i < INTR_CNT; i++)
+    {
+      const struct intr_stat *st = &intr_stats[i];
+
+      if (st->cnt == 0)
+        continue;
+      printf ("            %#04x %-36s %10llu %12"PRIu64" %10"PRIu64" %6u\n",
+              i, intr_names[i], st->cnt, timer_cycles_to_us (st->cycles),
+              timer_cycles_to_us (st->max_cycles), st->slow_cnt);
+    }
+  if (intr_off_trace)
+    print_off_stats ();
+}
+
 /* Returns the name of interrupt VEC. */
 const char *
 intr_name (uint8_t vec) 
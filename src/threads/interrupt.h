@@ -58,14 +58,21 @@ struct intr_frame
 typedef void intr_handler_func (struct intr_frame *);
 
 void intr_init (void);
+void intr_reinit (void);
 void intr_register_ext (uint8_t vec, intr_handler_func *, const char *name);
 void intr_register_int (uint8_t vec, int dpl, enum intr_level,
                         intr_handler_func *, const char *name);
 bool intr_context (void);
 bool intr_syscall_context (void);
 void intr_yield_on_return (void);
+bool intr_pending (uint8_t vec);
+
+/* If false (default), interrupts-off windows are not timed.
+   If true, set by the kernel command-line option "-irqoff". */
+extern bool intr_off_trace;
 
 void intr_dump_frame (const struct intr_frame *);
+void intr_print_stats (void);
 const char *intr_name (uint8_t vec);
 
 #endif /* threads/interrupt.h */
@@ -5,9 +5,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memprof.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
@@ -28,11 +31,27 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
+   Each thread keeps a magazine of up to MAG_SIZE free blocks for
+   each of the smallest MAG_CLASSES descriptors, which are the
+   sizes allocated most often.  Allocations and frees of those
+   sizes come out of and go into the current thread's magazine
+   without any locking.  An empty magazine is refilled, and a full
+   one drained, half at a time under the descriptor's lock.  The
+   magazines are drained for good when their thread exits.
+
+   Each descriptor also keeps up to ARENA_SPARE entirely free
+   arenas, instead of handing them straight back to the page
+   allocator, so that alternating allocations and frees don't
+   keep taking and returning the same page.
+
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.  If no run
+   of contiguous pages is free, scattered pages are mapped
+   contiguously by vmalloc() instead, so a big block may not be
+   physically contiguous. */
 
 /* Descriptor. */
 struct desc
@@ -40,9 +59,13 @@ struct desc
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
+    size_t spare_cnt;           /* Arenas with all blocks free. */
     struct lock lock;           /* Lock. */
   };
 
+/* Entirely free arenas a descriptor may keep. */
+#define ARENA_SPARE 1
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -66,6 +89,10 @@ static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *desc_take (struct desc *);
+static void desc_put (struct desc *, struct block *);
+static void *allocate (size_t);
+static size_t block_size (void *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -80,7 +107,9 @@ malloc_init (void)
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
+      d->spare_cnt = 0;
       lock_init (&d->lock);
+      lock_set_name (&d->lock, "malloc");
     }
 }
 
@@ -88,6 +117,18 @@ malloc_init (void)
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  void *p = allocate (size);
+
+  if (memprof_enabled && p != NULL)
+    memprof_alloc (__builtin_return_address (0), MEMPROF_MALLOC, p,
+                   block_size (p));
+  return p;
+}
+
+/* Does the work of malloc(). */
+static void *
+allocate (size_t size) 
 {
   struct desc *d;
   struct block *b;
@@ -108,6 +149,8 @@ malloc (size_t size)
          Allocate enough pages to hold SIZE plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
       a = palloc_get_multiple (0, page_cnt);
+      if (a == NULL && page_cnt > 1)
+        a = vmalloc (0, page_cnt);
       if (a == NULL)
         return NULL;
 
@@ -119,7 +162,39 @@ malloc (size_t size)
       return a + 1;
     }
 
+  /* Small blocks come from the thread's magazine, which is
+     refilled half full when it runs out. */
+  if (d - descs < MAG_CLASSES)
+    {
+      struct magazine *m = &thread_current ()->mags[d - descs];
+
+      if (m->cnt == 0)
+        {
+          lock_acquire (&d->lock);
+          while (m->cnt < MAG_SIZE / 2
+                 && (b = desc_take (d)) != NULL)
+            m->blocks[m->cnt++] = b;
+          lock_release (&d->lock);
+          if (m->cnt == 0)
+            return NULL;
+        }
+      return m->blocks[--m->cnt];
+    }
+
   lock_acquire (&d->lock);
+  b = desc_take (d);
+  lock_release (&d->lock);
+  return b;
+}
+
+/* Takes a free block from D, creating a new arena if there is
+   none.  Returns a null pointer if memory is not available.
+   D's lock must be held. */
+static struct block *
+desc_take (struct desc *d)
+{
+  struct block *b;
+  struct arena *a;
 
   /* If the free list is empty, create a new arena. */
   if (list_empty (&d->free_list))
@@ -129,15 +204,13 @@ malloc (size_t size)
       /* Allocate a page. */
       a = palloc_get_page (0);
       if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
+        return NULL; 
 
       /* Initialize arena and add its blocks to the free list. */
       a->magic = ARENA_MAGIC;
       a->desc = d;
       a->free_cnt = d->blocks_per_arena;
+      d->spare_cnt++;
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
           struct block *b = arena_to_block (a, i);
@@ -148,11 +221,63 @@ malloc (size_t size)
   /* Get a block from free list and return it. */
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
+  if (a->free_cnt-- == d->blocks_per_arena)
+    d->spare_cnt--;
   return b;
 }
 
+/* Returns block B to D's free list.  If B's arena is now entirely
+   unused, keeps it as a spare or frees it.  D's lock must be
+   held. */
+static void
+desc_put (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it, unless we are
+     short of spares. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      if (d->spare_cnt < ARENA_SPARE)
+        {
+          d->spare_cnt++;
+          return;
+        }
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+    }
+}
+
+/* Drains the current thread's magazines, which must not be used
+   again.  Called when the thread exits. */
+void
+malloc_thread_exit (void)
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  for (i = 0; i < MAG_CLASSES && i < desc_cnt; i++)
+    {
+      struct magazine *m = &t->mags[i];
+      if (m->cnt == 0)
+        continue;
+      lock_acquire (&descs[i].lock);
+      while (m->cnt > 0)
+        desc_put (&descs[i], m->blocks[--m->cnt]);
+      lock_release (&descs[i].lock);
+    }
+}
+
 /* Allocates and return A times B bytes initialized to zeroes.
    Returns a null pointer if memory is not available. */
 void *
@@ -167,9 +292,14 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = allocate (size);
   if (p != NULL)
-    memset (p, 0, size);
+    {
+      memset (p, 0, size);
+      if (memprof_enabled)
+        memprof_alloc (__builtin_return_address (0), MEMPROF_MALLOC, p,
+                       block_size (p));
+    }
 
   return p;
 }
@@ -186,7 +316,9 @@ block_size (void *block)
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
-   moving it in the process.
+   moving it in the process.  It stays in place if it is already
+   big enough, or if it is a big block and the pages after it are
+   free.
    If successful, returns the new block; on failure, returns a
    null pointer.
    A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
@@ -201,7 +333,29 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block;
+
+      if (old_block != NULL)
+        {
+          struct arena *a = block_to_arena (old_block);
+          size_t page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+
+          if (new_size <= block_size (old_block))
+            return old_block;
+          if (a->desc == NULL && !is_vmalloc_vaddr (a)
+              && palloc_extend (a, a->free_cnt, page_cnt))
+            {
+              a->free_cnt = page_cnt;
+              if (memprof_enabled)
+                memprof_resize (old_block, block_size (old_block));
+              return old_block;
+            }
+        }
+
+      new_block = allocate (new_size);
+      if (memprof_enabled && new_block != NULL)
+        memprof_alloc (__builtin_return_address (0), MEMPROF_MALLOC,
+                       new_block, block_size (new_block));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -223,6 +377,9 @@ free (void *p)
       struct block *b = p;
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
+
+      if (memprof_enabled)
+        memprof_free (p);
       
       if (d != NULL) 
         {
@@ -233,31 +390,34 @@ free (void *p)
           memset (b, 0xcc, d->block_size);
 #endif
   
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Small blocks go to the thread's magazine, half of which
+             is drained when it is full. */
+          if (d - descs < MAG_CLASSES)
             {
-              size_t i;
+              struct magazine *m = &thread_current ()->mags[d - descs];
 
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
+              if (m->cnt == MAG_SIZE)
                 {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
+                  lock_acquire (&d->lock);
+                  while (m->cnt > MAG_SIZE / 2)
+                    desc_put (d, m->blocks[--m->cnt]);
+                  lock_release (&d->lock);
                 }
-              palloc_free_page (a);
+              m->blocks[m->cnt++] = b;
+              return;
             }
 
+          lock_acquire (&d->lock);
+          desc_put (d, b);
           lock_release (&d->lock);
         }
       else
         {
           /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
+          if (is_vmalloc_vaddr (a))
+            vfree (a, a->free_cnt);
+          else
+            palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
@@ -4,7 +4,19 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Per-thread magazine: free blocks of one small size class that
+   the owning thread allocates from and frees into without taking
+   the descriptor's lock. */
+#define MAG_CLASSES 3           /* Classes with magazines: 16-64 bytes. */
+#define MAG_SIZE 8              /* Blocks a magazine holds. */
+struct magazine
+  {
+    unsigned cnt;               /* Blocks in BLOCKS. */
+    void *blocks[MAG_SIZE];
+  };
+
 void malloc_init (void);
+void malloc_thread_exit (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
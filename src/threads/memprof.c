@@ -0,0 +1,323 @@
+#include "threads/memprof.h"
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Call sites, in an open-addressed hash table of MEMPROF_SITES
+   entries keyed by return address and kind.  Sites are never
+   removed; once the table is full, allocations from new sites
+   are only counted as untracked. */
+#define MEMPROF_SITES 256
+
+struct site
+  {
+    void *pc;                   /* Return address, null if unused. */
+    enum memprof_kind kind;
+    unsigned long long alloc_cnt;
+    size_t live, peak;          /* Bytes held now and at most. */
+  };
+
+/* Live allocations, in an open-addressed hash table filling
+   LIVE_PAGES pages, keyed by address.  An allocation with no
+   free slot within LIVE_PROBES of its home is untracked. */
+#define LIVE_PAGES 24
+#define LIVE_PROBES 32
+
+struct live
+  {
+    const void *p;              /* Block, null if the slot is free. */
+    uint16_t site;              /* Index in sites[]. */
+    size_t size;                /* Bytes charged to the site. */
+  };
+
+#define LIVE_CNT (LIVE_PAGES * PGSIZE / sizeof (struct live))
+
+bool memprof_enabled;
+
+static struct site sites[MEMPROF_SITES];
+static size_t site_cnt;
+static struct live *lives;
+static unsigned long long untracked_cnt;
+static size_t kind_live[MEMPROF_KIND_CNT], kind_peak[MEMPROF_KIND_CNT];
+static int64_t start_ticks;
+
+static const char *kind_names[MEMPROF_KIND_CNT] = {"malloc", "slab", "page"};
+
+/* Start of each subsystem's code, in link order, from
+   kernel.lds.S. */
+extern char _text_threads[], _text_devices[], _text_lib[];
+extern char _text_userprog[], _text_filesys[], _text_vm[];
+extern char _text_tests[], _text_end[];
+
+struct subsystem
+  {
+    const char *name;
+    const char *start;
+  };
+
+static const struct subsystem subsystems[] =
+  {
+    {"threads", _text_threads},
+    {"devices", _text_devices},
+    {"lib", _text_lib},
+    {"userprog", _text_userprog},
+    {"filesys", _text_filesys},
+    {"vm", _text_vm},
+    {"tests", _text_tests},
+  };
+
+/* Allocates the table of live allocations, if -memprof was
+   given.  Allocations made before this are not tracked. */
+void
+memprof_init (void)
+{
+  if (!memprof_enabled)
+    return;
+  lives = palloc_get_multiple (PAL_ZERO, LIVE_PAGES);
+  if (lives == NULL)
+    {
+      printf ("memprof: no memory for %d pages, disabled\n", LIVE_PAGES);
+      memprof_enabled = false;
+      return;
+    }
+  start_ticks = timer_ticks ();
+}
+
+/* Returns the subsystem whose code contains PC. */
+static const char *
+subsystem_of (const void *pc)
+{
+  size_t i;
+
+  if ((const char *) pc >= _text_end)
+    return "?";
+  for (i = sizeof subsystems / sizeof *subsystems; i-- > 0; )
+    if ((const char *) pc >= subsystems[i].start)
+      return subsystems[i].name;
+  return "?";
+}
+
+/* Returns the site entry for PC and KIND, adding it if there is
+   room, or a null pointer. */
+static struct site *
+find_site (void *pc, enum memprof_kind kind)
+{
+  size_t h = hash_int ((uintptr_t) pc ^ kind) % MEMPROF_SITES;
+  size_t i;
+
+  for (i = 0; i < MEMPROF_SITES; i++)
+    {
+      struct site *s = &sites[(h + i) % MEMPROF_SITES];
+      if (s->pc == pc && s->kind == kind)
+        return s;
+      if (s->pc == NULL)
+        {
+          s->pc = pc;
+          s->kind = kind;
+          site_cnt++;
+          return s;
+        }
+    }
+  return NULL;
+}
+
+/* Returns the home slot of block P in lives[]. */
+static size_t
+live_home (const void *p)
+{
+  return hash_int ((uintptr_t) p) % LIVE_CNT;
+}
+
+/* Returns the slot holding P, or a free slot for it if INSERT,
+   or a null pointer. */
+static struct live *
+find_live (const void *p, bool insert)
+{
+  size_t h = live_home (p);
+  size_t i;
+
+  for (i = 0; i < LIVE_PROBES; i++)
+    {
+      struct live *l = &lives[(h + i) % LIVE_CNT];
+      if (l->p == p)
+        return l;
+      if (l->p == NULL)
+        return insert ? l : NULL;
+    }
+  return NULL;
+}
+
+/* Frees slot L, moving later entries of its probe run back so
+   that lookups never stop early. */
+static void
+remove_live (struct live *l)
+{
+  size_t i = l - lives, j = i;
+
+  for (;;)
+    {
+      size_t k;
+
+      j = (j + 1) % LIVE_CNT;
+      if (lives[j].p == NULL)
+        break;
+
+      /* The entry at J may stay if its home is cyclically in
+         (I, J]. */
+      k = live_home (lives[j].p);
+      if (i <= j ? i < k && k <= j : i < k || k <= j)
+        continue;
+      lives[i] = lives[j];
+      i = j;
+    }
+  lives[i].p = NULL;
+}
+
+/* Adds DELTA bytes to site S and its kind. */
+static void
+charge (struct site *s, long delta)
+{
+  s->live += delta;
+  if (s->live > s->peak)
+    s->peak = s->live;
+  kind_live[s->kind] += delta;
+  if (kind_live[s->kind] > kind_peak[s->kind])
+    kind_peak[s->kind] = kind_live[s->kind];
+}
+
+/* Records that the allocator call returning to PC allocated SIZE
+   bytes of KIND at P. */
+void
+memprof_alloc (void *pc, enum memprof_kind kind, const void *p, size_t size)
+{
+  enum intr_level old_level;
+  struct site *s;
+  struct live *l;
+
+  if (!memprof_enabled || lives == NULL || p == NULL)
+    return;
+
+  old_level = intr_disable ();
+  s = find_site (pc, kind);
+  l = s != NULL ? find_live (p, true) : NULL;
+  if (l != NULL && l->p == NULL)
+    {
+      l->p = p;
+      l->site = s - sites;
+      l->size = size;
+      s->alloc_cnt++;
+      charge (s, size);
+    }
+  else
+    untracked_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Records that the allocation at P now takes SIZE bytes. */
+void
+memprof_resize (const void *p, size_t size)
+{
+  enum intr_level old_level;
+  struct live *l;
+
+  if (!memprof_enabled || lives == NULL)
+    return;
+
+  old_level = intr_disable ();
+  l = find_live (p, false);
+  if (l != NULL)
+    {
+      charge (&sites[l->site], (long) size - (long) l->size);
+      l->size = size;
+    }
+  intr_set_level (old_level);
+}
+
+/* Records that the allocation at P was freed.  Does nothing if
+   it was not tracked. */
+void
+memprof_free (const void *p)
+{
+  enum intr_level old_level;
+  struct live *l;
+
+  if (!memprof_enabled || lives == NULL || p == NULL)
+    return;
+
+  old_level = intr_disable ();
+  l = find_live (p, false);
+  if (l != NULL)
+    {
+      charge (&sites[l->site], -(long) l->size);
+      remove_live (l);
+    }
+  intr_set_level (old_level);
+}
+
+/* Most sites printed. */
+#define MEMPROF_TOP 16
+
+/* Prints the totals for each kind of allocation, then the sites
+   holding the most memory, with how fast they allocate. */
+void
+memprof_print_stats (void)
+{
+  struct site top[MEMPROF_TOP];
+  size_t live[MEMPROF_KIND_CNT], peak[MEMPROF_KIND_CNT];
+  unsigned long long untracked;
+  enum intr_level old_level;
+  size_t top_cnt, cnt, i;
+  int64_t secs;
+
+  if (!memprof_enabled)
+    return;
+
+  /* Copy out the sites holding the most, in descending order. */
+  old_level = intr_disable ();
+  top_cnt = 0;
+  for (i = 0; i < MEMPROF_SITES; i++)
+    {
+      const struct site *s = &sites[i];
+      size_t j;
+
+      if (s->pc == NULL
+          || (top_cnt == MEMPROF_TOP && s->live <= top[top_cnt - 1].live))
+        continue;
+      if (top_cnt < MEMPROF_TOP)
+        top_cnt++;
+      for (j = top_cnt - 1; j > 0 && top[j - 1].live < s->live; j--)
+        top[j] = top[j - 1];
+      top[j] = *s;
+    }
+  for (i = 0; i < MEMPROF_KIND_CNT; i++)
+    {
+      live[i] = kind_live[i];
+      peak[i] = kind_peak[i];
+    }
+  cnt = site_cnt;
+  untracked = untracked_cnt;
+  intr_set_level (old_level);
+
+  printf ("Allocations:");
+  for (i = 0; i < MEMPROF_KIND_CNT; i++)
+    printf (" %s %zu kB live, %zu kB peak;",
+            kind_names[i], live[i] / 1024, peak[i] / 1024);
+  printf (" %llu untracked\n", untracked);
+
+  secs = (timer_ticks () - start_ticks) / TIMER_FREQ;
+  printf ("  %10s %10s %10s %8s %-6s %-8s %s (of %zu sites)\n",
+          "live", "peak", "allocs", "allocs/s", "kind", "subsys", "site",
+          cnt);
+  for (i = 0; i < top_cnt; i++)
+    printf ("  %10zu %10zu %10llu %8llu %-6s %-8s %p\n",
+            top[i].live, top[i].peak, top[i].alloc_cnt,
+            secs > 0 ? top[i].alloc_cnt / (unsigned long long) secs
+                     : top[i].alloc_cnt,
+            kind_names[top[i].kind], subsystem_of (top[i].pc), top[i].pc);
+}
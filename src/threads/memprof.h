@@ -0,0 +1,39 @@
+#ifndef THREADS_MEMPROF_H
+#define THREADS_MEMPROF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Kernel allocation profiler.
+
+   With -memprof, each malloc() block, slab object and kernel
+   pool page range is charged to its call site, the return
+   address of the call into the allocator, and to the subsystem,
+   the source directory, that address lies in.  Every site keeps
+   its live and peak bytes and its allocation rate.  The sites
+   holding the most memory are printed at shutdown and in
+   /stats/vm, as addresses for utils/backtrace.
+
+   malloc() arenas and slabs are themselves pages, so they show
+   up again as page sites in malloc.c and slab.c. */
+
+/* Kinds of allocation. */
+enum memprof_kind
+  {
+    MEMPROF_MALLOC,             /* malloc(), calloc(), realloc(). */
+    MEMPROF_SLAB,               /* kmem_cache_alloc(). */
+    MEMPROF_PAGE,               /* Kernel pool pages. */
+    MEMPROF_KIND_CNT
+  };
+
+/* If false (default), nothing is recorded.
+   If true, set by the kernel command-line option "-memprof". */
+extern bool memprof_enabled;
+
+void memprof_init (void);
+void memprof_alloc (void *site, enum memprof_kind, const void *, size_t);
+void memprof_resize (const void *, size_t);
+void memprof_free (const void *);
+void memprof_print_stats (void);
+
+#endif /* threads/memprof.h */
@@ -2,12 +2,15 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/memprof.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -22,8 +25,45 @@
    even if user processes are swapping like mad.
 
    By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   half to the user pool.  Neither half is fixed, though: a
+   request that its own pool cannot satisfy borrows pages from the
+   other one, within limits.  The kernel pool lends out all but a
+   quarter of its pages, and only as long as the user pages stay
+   within the boot-time limit; the user pool lends out up to half
+   of its pages, and gets them back from the page-out thread, which
+   frees user frames as the free ones run low.  A lent page goes
+   back to the pool it came from when freed.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**ORDER pages,
+   each aligned to its size relative to the pool's base, on one
+   free list per order.  The list element lives in the block's
+   first page.  A request for PAGE_CNT pages splits the smallest
+   big enough block and gives back the pages past PAGE_CNT.  A
+   freed range is split into aligned blocks, each merged with its
+   buddy for as long as the buddy is free too.  Both take time
+   logarithmic in the pool size.
+
+   Up to ZERO_RESERVE freed user pages are held back in a reserve
+   instead of going back to the buddy lists.  The idle thread
+   zeroes them through palloc_idle_zero(), so that most
+   single-page PAL_USER | PAL_ZERO requests, which is what every
+   page fault makes, get a page that is already clear.  The
+   reserve's pages stay marked in use.  It is protected by turning
+   interrupts off, because the idle thread must not block on a
+   lock, and other user requests fall back to it when the pool
+   is otherwise empty.
+
+   If palloc_colors is set, palloc_get_colored() hands out a page
+   of a given color, its page number modulo palloc_colors, so that
+   a process's consecutive pages map to different sets of a
+   physically indexed cache.  It takes an order 0 block of that
+   color if one is near the front of its list, or else splits the
+   smallest block that has one, and falls back to any page if
+   there is none left. */
+
+/* Orders of block sizes, enough for 2**(ORDERS - 1) pages. */
+#define ORDERS 16
 
 /* A memory pool. */
 struct pool
@@ -31,14 +71,48 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    const char *name;                   /* For statistics. */
+    uint8_t *free_order;                /* Per page: 1 + order of the free
+                                           block starting there, or 0. */
+    struct list free_list[ORDERS];      /* Free blocks of each order. */
+    size_t free_cnt;                    /* Pages on the free lists. */
+    struct bitmap *lent_map;            /* Pages lent to the other pool. */
+    size_t lent_cnt;                    /* Pages lent out. */
+    size_t lend_max;                    /* Most pages it may lend out. */
+    size_t keep_free;                   /* Free pages it never lends. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Reserve of user pages for PAL_ZERO requests. */
+#define ZERO_RESERVE 16
+static struct list dirty_pages;         /* Still to be zeroed. */
+static struct list zeroed_pages;        /* Zeroed by the idle thread. */
+static size_t reserve_cnt;              /* Pages in the reserve, including
+                                           one being zeroed. */
+static unsigned long long zero_hit_cnt, zero_miss_cnt;
+
+/* Page colors for palloc_get_colored(), a power of 2, or 0 to
+   ignore colors. */
+size_t palloc_colors;
+
+/* Blocks smaller than palloc_colors looked at per order for a
+   page of the right color. */
+#define COLOR_SCAN 32
+static unsigned long long color_hit_cnt, color_miss_cnt;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void take_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void *pool_get (struct pool *, size_t page_cnt, bool lend);
+static void *pool_get_color (struct pool *, size_t color);
+static void print_pool_stats (struct pool *);
+static void *reserve_take (bool zeroed_only, bool *zeroed);
+static void *get_multiple (enum palloc_flags, size_t page_cnt);
+static void *charge (void *pages, size_t page_cnt, void *site);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -59,36 +133,69 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+  kernel_pool.keep_free = bitmap_size (kernel_pool.used_map) / 4;
+  kernel_pool.lend_max = user_page_limit - bitmap_size (user_pool.used_map);
+  user_pool.lend_max = bitmap_size (user_pool.used_map) / 2;
+
+  /* Start the reserve off with some pages to zero. */
+  list_init (&dirty_pages);
+  list_init (&zeroed_pages);
+  while (reserve_cnt < ZERO_RESERVE)
+    {
+      void *page = palloc_get_page (PAL_USER);
+      if (page == NULL)
+        break;
+      list_push_back (&dirty_pages, page);
+      reserve_cnt++;
+    }
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   otherwise from the kernel pool, or else borrowed from the other
+   pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
+{
+  return charge (get_multiple (flags, page_cnt), page_cnt,
+                 __builtin_return_address (0));
+}
+
+/* Does the work of palloc_get_multiple(). */
+static void *
+get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
-  size_t page_idx;
+  struct pool *other = flags & PAL_USER ? &kernel_pool : &user_pool;
+  void *pages = NULL;
+  bool zeroed = false;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  if (page_cnt == 1 && (flags & (PAL_USER | PAL_ZERO)) == (PAL_USER | PAL_ZERO))
+    {
+      pages = reserve_take (true, &zeroed);
+      if (pages != NULL)
+        {
+          zero_hit_cnt++;
+          return pages;
+        }
+      zero_miss_cnt++;
+    }
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  pages = pool_get (pool, page_cnt, false);
+  if (pages == NULL && page_cnt == 1 && (flags & PAL_USER))
+    pages = reserve_take (false, &zeroed);
+  if (pages == NULL)
+    pages = pool_get (other, page_cnt, true);
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -100,6 +207,104 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
+/* Takes PAGE_CNT contiguous pages off POOL's free lists and
+   returns them, or a null pointer if it has no block big enough.
+   If LEND, the pages are for the other pool, which they are only
+   given to within POOL's lending limits. */
+static void *
+pool_get (struct pool *pool, size_t page_cnt, bool lend)
+{
+  void *pages = NULL;
+  size_t order, j;
+
+  for (order = 0; order < ORDERS && ((size_t) 1 << order) < page_cnt; order++)
+    continue;
+
+  lock_acquire (&pool->lock);
+  if (lend && (pool->free_cnt < pool->keep_free + page_cnt
+               || pool->lend_max < pool->lent_cnt + page_cnt))
+    {
+      lock_release (&pool->lock);
+      return NULL;
+    }
+  for (j = order; j < ORDERS; j++)
+    if (!list_empty (&pool->free_list[j]))
+      {
+        uint8_t *block = (uint8_t *) list_pop_front (&pool->free_list[j]);
+        size_t page_idx = pg_no (block) - pg_no (pool->base);
+
+        pool->free_order[page_idx] = 0;
+
+        /* Split off the buddies we don't need, then give back
+           the tail of the block past PAGE_CNT. */
+        while (j > order)
+          {
+            size_t buddy;
+
+            j--;
+            buddy = page_idx + ((size_t) 1 << j);
+            pool->free_order[buddy] = j + 1;
+            list_push_front (&pool->free_list[j],
+                             (struct list_elem *) (pool->base
+                                                   + PGSIZE * buddy));
+          }
+        free_range (pool, page_idx + page_cnt,
+                    ((size_t) 1 << order) - page_cnt);
+
+        ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+        bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+        pool->free_cnt -= page_cnt;
+        if (lend)
+          {
+            bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, true);
+            pool->lent_cnt += page_cnt;
+          }
+        pages = pool->base + PGSIZE * page_idx;
+        break;
+      }
+  lock_release (&pool->lock);
+  return pages;
+}
+
+/* Obtains PAGE_CNT contiguous free pages from the pool FLAGS
+   selects, never borrowed, whose physical address is a multiple
+   of PAGE_CNT pages, a power of 2, as large pages need.  Blocks
+   are only aligned relative to the pool's base, so every aligned
+   range is looked at.  Returns a null pointer if none is free,
+   unless PAL_ASSERT is set, in which case the kernel panics. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t pool_cnt = bitmap_size (pool->used_map);
+  size_t page_idx;
+  void *pages = NULL;
+
+  ASSERT (page_cnt > 0 && (page_cnt & (page_cnt - 1)) == 0);
+
+  lock_acquire (&pool->lock);
+  page_idx = (page_cnt - pg_no (pool->base) % page_cnt) % page_cnt;
+  for (; page_idx + page_cnt <= pool_cnt; page_idx += page_cnt)
+    if (bitmap_none (pool->used_map, page_idx, page_cnt))
+      {
+        take_range (pool, page_idx, page_cnt);
+        bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+        pool->free_cnt -= page_cnt;
+        pages = pool->base + PGSIZE * page_idx;
+        break;
+      }
+  lock_release (&pool->lock);
+
+  if (pages != NULL)
+    {
+      if (flags & PAL_ZERO)
+        memset (pages, 0, PGSIZE * page_cnt);
+    }
+  else if (flags & PAL_ASSERT)
+    PANIC ("palloc_get: out of pages");
+  return charge (pages, page_cnt, __builtin_return_address (0));
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -110,7 +315,97 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 void *
 palloc_get_page (enum palloc_flags flags) 
 {
-  return palloc_get_multiple (flags, 1);
+  return charge (get_multiple (flags, 1), 1, __builtin_return_address (0));
+}
+
+/* Obtains a single free page whose color is COLOR modulo
+   palloc_colors, or any page if there is none of that color or
+   colors are off, as palloc_get_page() would. */
+void *
+palloc_get_colored (enum palloc_flags flags, size_t color)
+{
+  void *page;
+
+  if (palloc_colors == 0)
+    return charge (get_multiple (flags, 1), 1, __builtin_return_address (0));
+
+  page = pool_get_color (flags & PAL_USER ? &user_pool : &kernel_pool,
+                         color % palloc_colors);
+  if (page == NULL)
+    {
+      color_miss_cnt++;
+      return charge (get_multiple (flags, 1), 1,
+                     __builtin_return_address (0));
+    }
+  color_hit_cnt++;
+  if (flags & PAL_ZERO)
+    memset (page, 0, PGSIZE);
+  return charge (page, 1, __builtin_return_address (0));
+}
+
+/* Takes a page of color COLOR off POOL's free lists and returns
+   it, or a null pointer if none is found.  A block bigger than
+   the page is split so that the page's buddies at each order go
+   back on the free lists. */
+static void *
+pool_get_color (struct pool *pool, size_t color)
+{
+  size_t base_no = pg_no (pool->base);
+  void *page = NULL;
+  size_t order;
+
+  lock_acquire (&pool->lock);
+  for (order = 0; order < ORDERS && page == NULL; order++)
+    {
+      struct list *list = &pool->free_list[order];
+      size_t span = (size_t) 1 << order;
+      size_t scanned = 0;
+      struct list_elem *e;
+
+      for (e = list_begin (list); e != list_end (list); e = list_next (e))
+        {
+          size_t page_idx = pg_no (e) - base_no;
+          size_t ofs = (color - (base_no + page_idx)) & (palloc_colors - 1);
+          size_t j = order;
+
+          if (ofs >= span)
+            {
+              if (++scanned == COLOR_SCAN)
+                break;
+              continue;
+            }
+
+          /* Keep the half holding the page at OFS, and free the
+             other. */
+          list_remove (e);
+          pool->free_order[page_idx] = 0;
+          while (j > 0)
+            {
+              size_t half = (size_t) 1 << --j;
+              size_t other = page_idx;
+
+              if (ofs >= half)
+                {
+                  page_idx += half;
+                  ofs -= half;
+                }
+              else
+                other += half;
+              pool->free_order[other] = j + 1;
+              list_push_front (&pool->free_list[j],
+                               (struct list_elem *) (pool->base
+                                                     + PGSIZE * other));
+            }
+
+          ASSERT (!bitmap_test (pool->used_map, page_idx));
+          bitmap_mark (pool->used_map, page_idx);
+          pool->free_cnt--;
+          page = pool->base + PGSIZE * page_idx;
+          break;
+        }
+    }
+  lock_release (&pool->lock);
+  return page;
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
@@ -123,6 +418,8 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
     return;
+  if (memprof_enabled)
+    memprof_free (pages);
 
   if (page_from_pool (&kernel_pool, pages))
     pool = &kernel_pool;
@@ -137,8 +434,74 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  /* Top up the zero reserve before giving pages back, with pages
+     that are the user pool's own. */
+  if (pool == &user_pool && page_cnt == 1
+      && !bitmap_test (pool->lent_map, page_idx))
+    {
+      enum intr_level old_level = intr_disable ();
+      if (reserve_cnt < ZERO_RESERVE)
+        {
+          list_push_back (&dirty_pages, pages);
+          reserve_cnt++;
+          intr_set_level (old_level);
+          return;
+        }
+      intr_set_level (old_level);
+    }
+
+  lock_acquire (&pool->lock);
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_range (pool, page_idx, page_cnt);
+  pool->free_cnt += page_cnt;
+  if (!bitmap_none (pool->lent_map, page_idx, page_cnt))
+    {
+      pool->lent_cnt -= bitmap_count (pool->lent_map, page_idx, page_cnt,
+                                      true);
+      bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, false);
+    }
+  lock_release (&pool->lock);
+}
+
+/* Tries to grow the block of OLD_CNT pages at PAGES, which
+   palloc_get_multiple() returned, to NEW_CNT pages in place.
+   Returns true if the pages past it were free and are now part
+   of it, false if the block is unchanged.  Doesn't grow pages
+   borrowed from the other pool. */
+bool
+palloc_extend (void *pages, size_t old_cnt, size_t new_cnt)
+{
+  struct pool *pool;
+  size_t page_idx, add_cnt = new_cnt - old_cnt;
+  bool ok;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (old_cnt > 0 && new_cnt >= old_cnt);
+
+  if (page_from_pool (&kernel_pool, pages))
+    pool = &kernel_pool;
+  else if (page_from_pool (&user_pool, pages))
+    pool = &user_pool;
+  else
+    NOT_REACHED ();
+  page_idx = pg_no (pages) - pg_no (pool->base) + old_cnt;
+  if (page_idx + add_cnt > bitmap_size (pool->used_map))
+    return false;
+
+  lock_acquire (&pool->lock);
+  ok = (!bitmap_test (pool->lent_map, page_idx - old_cnt)
+        && bitmap_none (pool->used_map, page_idx, add_cnt));
+  if (ok)
+    {
+      take_range (pool, page_idx, add_cnt);
+      bitmap_set_multiple (pool->used_map, page_idx, add_cnt, true);
+      pool->free_cnt -= add_cnt;
+    }
+  lock_release (&pool->lock);
+  if (ok && memprof_enabled)
+    memprof_resize (pages, PGSIZE * new_cnt);
+  return ok;
 }
 
 /* Frees the page at PAGE. */
@@ -148,15 +511,129 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Charges the PAGE_CNT pages at PAGES, if they are from the
+   kernel pool, to the allocator call returning to SITE, for
+   -memprof.  Returns PAGES. */
+static void *
+charge (void *pages, size_t page_cnt, void *site)
+{
+  if (memprof_enabled && pages != NULL
+      && page_from_pool (&kernel_pool, pages))
+    memprof_alloc (site, MEMPROF_PAGE, pages, PGSIZE * page_cnt);
+  return pages;
+}
+
+/* Takes a page out of the zero reserve, a zeroed one if there is
+   one, else a dirty one unless ZEROED_ONLY.  Sets *ZEROED to
+   whether the page is already clear.  Returns a null pointer if
+   there is no suitable page. */
+static void *
+reserve_take (bool zeroed_only, bool *zeroed)
+{
+  enum intr_level old_level = intr_disable ();
+  void *page = NULL;
+
+  if (!list_empty (&zeroed_pages))
+    {
+      page = list_pop_front (&zeroed_pages);
+      *zeroed = true;
+    }
+  else if (!zeroed_only && !list_empty (&dirty_pages))
+    {
+      page = list_pop_front (&dirty_pages);
+      *zeroed = false;
+    }
+  if (page != NULL)
+    reserve_cnt--;
+  intr_set_level (old_level);
+  return page;
+}
+
+/* Zeroes the pages waiting in the reserve, one at a time with
+   interrupts on.  Called by the idle thread, so it never blocks:
+   a thread that becomes ready just preempts it. */
+void
+palloc_idle_zero (void)
+{
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      void *page = NULL;
+
+      if (!list_empty (&dirty_pages))
+        page = list_pop_front (&dirty_pages);
+      intr_set_level (old_level);
+      if (page == NULL)
+        return;
+
+      zero_page (page);
+
+      old_level = intr_disable ();
+      list_push_back (&zeroed_pages, page);
+      intr_set_level (old_level);
+    }
+}
+
+/* Returns the number of pages in the user pool. */
+size_t
+palloc_user_page_cnt (void)
+{
+  return bitmap_size (user_pool.used_map);
+}
+
+/* Returns how many pages user requests could get, including the
+   zero reserve and what the kernel pool would lend.  Takes no
+   lock, so the answer may be slightly stale. */
+size_t
+palloc_user_free_cnt (void)
+{
+  size_t free_cnt = user_pool.free_cnt + reserve_cnt;
+  size_t lendable = 0;
+
+  if (kernel_pool.free_cnt > kernel_pool.keep_free
+      && kernel_pool.lend_max > kernel_pool.lent_cnt)
+    {
+      lendable = kernel_pool.free_cnt - kernel_pool.keep_free;
+      if (lendable > kernel_pool.lend_max - kernel_pool.lent_cnt)
+        lendable = kernel_pool.lend_max - kernel_pool.lent_cnt;
+    }
+  return free_cnt + lendable;
+}
+
+/* Returns the number of pages in both pools, any of which may be
+   handed out to a user request. */
+size_t
+palloc_frame_cnt (void)
+{
+  return bitmap_size (kernel_pool.used_map) + bitmap_size (user_pool.used_map);
+}
+
+/* Returns the index of PAGE among the pages of both pools, kernel
+   pool first, in the range [0, palloc_frame_cnt ()), or SIZE_MAX
+   if PAGE belongs to neither. */
+size_t
+palloc_frame_idx (const void *page)
+{
+  if (page_from_pool (&kernel_pool, (void *) page))
+    return pg_no (page) - pg_no (kernel_pool.base);
+  if (page_from_pool (&user_pool, (void *) page))
+    return (bitmap_size (kernel_pool.used_map)
+            + pg_no (page) - pg_no (user_pool.base));
+  return SIZE_MAX;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and lent_map, followed by its
+     free_order array, at its base.  Calculate the space needed for
+     them and subtract it from the pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (2 * bm_size + page_cnt, PGSIZE);
+  size_t i;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,8 +642,136 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  lock_set_name (&p->lock, name);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->lent_map = bitmap_create_in_buf (page_cnt, (uint8_t *) base + bm_size,
+                                      bm_size);
   p->base = base + bm_pages * PGSIZE;
+  p->name = name;
+  p->free_order = (uint8_t *) base + 2 * bm_size;
+  memset (p->free_order, 0, page_cnt);
+  for (i = 0; i < ORDERS; i++)
+    list_init (&p->free_list[i]);
+  free_range (p, 0, page_cnt);
+  p->free_cnt = page_cnt;
+  p->lent_cnt = 0;
+  p->lend_max = 0;
+  p->keep_free = 0;
+}
+
+/* Puts the PAGE_CNT pages starting at PAGE_IDX in POOL on the
+   free lists, as the largest aligned blocks they divide into,
+   merging each block with its free buddies.  POOL's lock must be
+   held, except during initialization. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t pool_cnt = bitmap_size (pool->used_map);
+
+  while (page_cnt > 0)
+    {
+      size_t order = 0, idx = page_idx;
+
+      while (order + 1 < ORDERS
+             && page_idx % ((size_t) 1 << (order + 1)) == 0
+             && ((size_t) 1 << (order + 1)) <= page_cnt)
+        order++;
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+
+      /* Merge with the buddy while it is a free block of the same
+         order. */
+      while (order + 1 < ORDERS)
+        {
+          size_t buddy = idx ^ ((size_t) 1 << order);
+          if (buddy + ((size_t) 1 << order) > pool_cnt
+              || pool->free_order[buddy] != order + 1)
+            break;
+          list_remove ((struct list_elem *) (pool->base + PGSIZE * buddy));
+          pool->free_order[buddy] = 0;
+          if (buddy < idx)
+            idx = buddy;
+          order++;
+        }
+      pool->free_order[idx] = order + 1;
+      list_push_front (&pool->free_list[order],
+                       (struct list_elem *) (pool->base + PGSIZE * idx));
+    }
+}
+
+/* Takes the PAGE_CNT pages starting at PAGE_IDX in POOL, which
+   must all be free, off the free lists.  Each free block they
+   overlap is removed whole and the parts of it outside the range
+   put back.  POOL's lock must be held. */
+static void
+take_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t end = page_idx + page_cnt;
+
+  while (page_idx < end)
+    {
+      size_t order, start, block_end;
+
+      /* Find the free block that holds PAGE_IDX. */
+      for (order = 0; ; order++)
+        {
+          ASSERT (order < ORDERS);
+          start = page_idx & ~(((size_t) 1 << order) - 1);
+          if (pool->free_order[start] == order + 1)
+            break;
+        }
+      block_end = start + ((size_t) 1 << order);
+
+      list_remove ((struct list_elem *) (pool->base + PGSIZE * start));
+      pool->free_order[start] = 0;
+      free_range (pool, start, page_idx - start);
+      if (block_end > end)
+        {
+          free_range (pool, end, block_end - end);
+          block_end = end;
+        }
+      page_idx = block_end;
+    }
+}
+
+/* Prints how pages are used in each pool, and how fragmented the
+   free ones are.  Takes no lock, since it may run during a
+   panic. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+  printf ("Palloc zero reserve: %zu pages, %llu hits, %llu misses\n",
+          reserve_cnt, zero_hit_cnt, zero_miss_cnt);
+  if (palloc_colors != 0)
+    printf ("Palloc colors: %zu, %llu pages of the asked color, "
+            "%llu of another\n", palloc_colors, color_hit_cnt,
+            color_miss_cnt);
+}
+
+/* Prints statistics for POOL: its free pages, and how many free
+   blocks it has of each order, up to the largest. */
+static void
+print_pool_stats (struct pool *pool)
+{
+  size_t free_cnt = 0, top = 0;
+  size_t order;
+
+  for (order = 0; order < ORDERS; order++)
+    {
+      size_t n = list_size (&pool->free_list[order]);
+      if (n > 0)
+        top = order;
+      free_cnt += n << order;
+    }
+  printf ("Palloc %s: %zu of %zu pages free, %zu lent, largest block "
+          "%zu pages, blocks by order:", pool->name, free_cnt,
+          bitmap_size (pool->used_map), pool->lent_cnt,
+          free_cnt > 0 ? (size_t) 1 << top : 0);
+  for (order = 0; order <= top; order++)
+    printf (" %zu", list_size (&pool->free_list[order]));
+  printf ("\n");
 }
 
 /* Returns true if PAGE was allocated from POOL,
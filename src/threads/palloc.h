@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +12,21 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+extern size_t palloc_colors;
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_colored (enum palloc_flags, size_t color);
+void *palloc_get_aligned (enum palloc_flags, size_t page_cnt);
+bool palloc_extend (void *, size_t old_cnt, size_t new_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+size_t palloc_user_page_cnt (void);
+size_t palloc_user_free_cnt (void);
+size_t palloc_frame_cnt (void);
+size_t palloc_frame_idx (const void *);
+void palloc_idle_zero (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
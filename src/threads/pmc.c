@@ -0,0 +1,271 @@
+#include "threads/pmc.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* MSRs.  See [IA32-v3b] 18.2 "Architectural Performance
+   Monitoring". */
+#define MSR_PMC0 0xc1                   /* First counter. */
+#define MSR_PERFEVTSEL0 0x186           /* Its event select. */
+
+/* PERFEVTSEL bits. */
+#define EVTSEL_USR (1u << 16)           /* Count in user mode. */
+#define EVTSEL_OS (1u << 17)            /* Count in kernel mode. */
+#define EVTSEL_EN (1u << 22)            /* Enable. */
+
+/* CR4.PCE: RDPMC allowed in user mode. */
+#define CR4_PCE 0x00000100
+
+/* Events counted, in counter order.  The first, second and
+   fourth are architectural; the third is DTLB_LOAD_MISSES, which
+   most Intel cores since Nehalem have at this encoding. */
+struct pmc_event
+  {
+    const char *name;
+    uint8_t event, umask;
+    int arch_bit;                       /* CPUID.0AH:EBX bit that says it is
+                                           missing, or -1. */
+  };
+
+static const struct pmc_event events[PMC_MAX] =
+  {
+    {"instructions", 0xc0, 0x00, 1},
+    {"LLC misses", 0x2e, 0x41, 4},
+    {"DTLB load misses", 0x08, 0x01, -1},
+    {"branch misses", 0xc5, 0x00, 6},
+  };
+
+/* Counters programmed, from the start of EVENTS: 0 without
+   performance monitoring. */
+unsigned pmc_cnt;
+
+/* Regions that have run, for printing. */
+static struct list regions = LIST_INITIALIZER (regions);
+
+#ifdef USERPROG
+/* Whether CR4.PCE is set. */
+static bool pce_set;
+
+/* A process's counts, from pmc_enable_user() until it exits. */
+struct pmc_totals
+  {
+    struct pmc_sample total;            /* While its threads ran. */
+    struct pmc_sample start;            /* When its thread last ran. */
+  };
+#endif
+
+static void
+cpuid (uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d)
+{
+  asm volatile ("cpuid" : "=a" (*a), "=b" (*b), "=c" (*c), "=d" (*d)
+                : "a" (leaf), "c" (0));
+}
+
+static void
+wrmsr (uint32_t msr, uint64_t value)
+{
+  asm volatile ("wrmsr" : : "c" (msr), "A" (value));
+}
+
+/* Programs the counters, if this is an Intel CPU with
+   architectural performance monitoring.  Otherwise leaves
+   pmc_cnt at 0. */
+void
+pmc_init (void)
+{
+  uint32_t a, b, c, d;
+  unsigned gp_cnt, missing, i;
+
+  cpuid (0, &a, &b, &c, &d);
+  if (a < 0x0a || b != 0x756e6547 || d != 0x49656e69 || c != 0x6c65746e)
+    return;                             /* Not a "GenuineIntel" with 0AH. */
+  cpuid (0x0a, &a, &b, &c, &d);
+  if ((a & 0xff) == 0)
+    return;                             /* No version of perfmon. */
+  gp_cnt = (a >> 8) & 0xff;
+  missing = b;
+
+  for (i = 0; i < PMC_MAX && i < gp_cnt; i++)
+    {
+      const struct pmc_event *e = &events[i];
+
+      if (e->arch_bit >= 0 && (missing & (1u << e->arch_bit)))
+        break;
+      wrmsr (MSR_PERFEVTSEL0 + i, 0);
+      wrmsr (MSR_PMC0 + i, 0);
+      wrmsr (MSR_PERFEVTSEL0 + i, (e->event | (e->umask << 8) | EVTSEL_USR
+                                   | EVTSEL_OS | EVTSEL_EN));
+    }
+  pmc_cnt = i;
+}
+
+/* Stores the TSC and the counters into S. */
+void
+pmc_read (struct pmc_sample *s)
+{
+  unsigned i;
+
+  s->tsc = timer_cycles ();
+  for (i = 0; i < pmc_cnt; i++)
+    asm volatile ("rdpmc" : "=A" (s->count[i]) : "c" (i));
+  for (; i < PMC_MAX; i++)
+    s->count[i] = 0;
+}
+
+/* Adds the counts from START to END to TOTAL. */
+static void
+add_delta (struct pmc_sample *total, const struct pmc_sample *start,
+           const struct pmc_sample *end)
+{
+  unsigned i;
+
+  total->tsc += end->tsc - start->tsc;
+  for (i = 0; i < PMC_MAX; i++)
+    total->count[i] += end->count[i] - start->count[i];
+}
+
+/* Starts timing a region, storing where it starts into START. */
+void
+pmc_region_begin (struct pmc_sample *start)
+{
+  pmc_read (start);
+}
+
+/* Ends the region R begun with pmc_region_begin() at START. */
+void
+pmc_region_end (struct pmc_region *r, const struct pmc_sample *start)
+{
+  struct pmc_sample end;
+  enum intr_level old_level;
+
+  pmc_read (&end);
+  old_level = intr_disable ();
+  add_delta (&r->total, start, &end);
+  r->calls++;
+  if (!r->listed)
+    {
+      r->listed = true;
+      list_push_back (&regions, &r->elem);
+    }
+  intr_set_level (old_level);
+}
+
+/* Prints the counts of S, after PREFIX. */
+static void
+print_sample (const char *prefix, const struct pmc_sample *s)
+{
+  unsigned i;
+
+  printf ("%s%"PRIu64" cycles", prefix, s->tsc);
+  for (i = 0; i < pmc_cnt; i++)
+    printf (", %"PRIu64" %s", s->count[i], events[i].name);
+  printf ("\n");
+}
+
+/* Prints the totals of every region that ran. */
+void
+pmc_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&regions); e != list_end (&regions);
+       e = list_next (e))
+    {
+      struct pmc_region *r = list_entry (e, struct pmc_region, elem);
+      char prefix[64];
+
+      snprintf (prefix, sizeof prefix, "PMC %s: %llu calls, ",
+                r->name, r->calls);
+      print_sample (prefix, &r->total);
+    }
+}
+
+#ifdef USERPROG
+/* Called with interrupts off on each switch from PREV, which may
+   be null, to CUR.  Adds what PREV's process counted to its
+   totals, starts counting for CUR's, and allows RDPMC in user
+   mode only to a process that asked for it. */
+void
+pmc_switch (struct thread *prev, struct thread *cur)
+{
+  struct pmc_totals *pt = prev != NULL ? prev->process->pmc : NULL;
+  struct pmc_totals *ct = cur->process->pmc;
+  bool pce = ct != NULL && pmc_cnt > 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (pt != NULL || ct != NULL)
+    {
+      struct pmc_sample now;
+
+      pmc_read (&now);
+      if (pt != NULL)
+        add_delta (&pt->total, &pt->start, &now);
+      if (ct != NULL)
+        ct->start = now;
+    }
+
+  if (pce != pce_set)
+    {
+      uint32_t cr4;
+
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 = pce ? cr4 | CR4_PCE : cr4 & ~CR4_PCE;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+      pce_set = pce;
+    }
+}
+
+/* Starts counting for the current process and lets it use
+   RDPMC, on counters 0 through the return value less 1.
+   Returns -1 if memory is short. */
+int
+pmc_enable_user (void)
+{
+  struct thread *p = thread_current ()->process;
+  struct pmc_totals *t;
+  enum intr_level old_level;
+
+  if (p->pmc == NULL)
+    {
+      t = calloc (1, sizeof *t);
+      if (t == NULL)
+        return -1;
+      old_level = intr_disable ();
+      p->pmc = t;
+      pmc_switch (NULL, thread_current ());
+      intr_set_level (old_level);
+    }
+  return pmc_cnt;
+}
+
+/* Prints and frees the totals of process P, the running thread,
+   if it has any. */
+void
+pmc_exit (struct thread *p)
+{
+  struct pmc_totals *t = p->pmc;
+  enum intr_level old_level;
+  struct pmc_sample now;
+  char prefix[32];
+
+  ASSERT (p == thread_current ());
+  if (t == NULL)
+    return;
+
+  old_level = intr_disable ();
+  pmc_read (&now);
+  add_delta (&t->total, &t->start, &now);
+  p->pmc = NULL;
+  intr_set_level (old_level);
+
+  snprintf (prefix, sizeof prefix, "%s: pmc: ", p->name);
+  print_sample (prefix, &t->total);
+  free (t);
+}
+#endif /* USERPROG */
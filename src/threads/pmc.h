@@ -0,0 +1,63 @@
+#ifndef THREADS_PMC_H
+#define THREADS_PMC_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Performance-monitoring counters.
+
+   On an Intel CPU with architectural performance monitoring,
+   pmc_init() programs up to PMC_MAX general-purpose counters to
+   count a fixed set of events, in both kernel and user mode.
+   Elsewhere, as under Bochs, there are no counters and only TSC
+   cycles are measured.
+
+   Kernel code times a region by calling pmc_region_begin() and
+   pmc_region_end() around it; totals for each region are printed
+   at power off.  The counters run for the whole processor, so a
+   region that sleeps or is interrupted also counts whatever runs
+   meanwhile.
+
+   A user process that calls pmc_enable() may read the counters
+   itself with RDPMC, and has its totals printed when it exits. */
+
+/* Most counters used. */
+#define PMC_MAX 4
+
+/* Counter values at some moment. */
+struct pmc_sample
+  {
+    uint64_t tsc;                       /* Time stamp counter. */
+    uint64_t count[PMC_MAX];            /* Counters, as programmed. */
+  };
+
+/* A timed kernel region.  Define one statically with
+   PMC_REGION_INITIALIZER. */
+struct pmc_region
+  {
+    const char *name;                   /* Name, for printing. */
+    unsigned long long calls;           /* Times it ran. */
+    struct pmc_sample total;            /* Summed counts. */
+    bool listed;                        /* In the list of regions? */
+    struct list_elem elem;              /* Element in that list. */
+  };
+
+#define PMC_REGION_INITIALIZER(NAME) { .name = (NAME) }
+
+struct thread;
+
+extern unsigned pmc_cnt;
+
+void pmc_init (void);
+void pmc_read (struct pmc_sample *);
+void pmc_region_begin (struct pmc_sample *);
+void pmc_region_end (struct pmc_region *, const struct pmc_sample *start);
+void pmc_print_stats (void);
+#ifdef USERPROG
+void pmc_switch (struct thread *prev, struct thread *cur);
+int pmc_enable_user (void);
+void pmc_exit (struct thread *);
+#endif
+
+#endif /* threads/pmc.h */
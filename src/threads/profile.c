@@ -0,0 +1,126 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Samples are kept in a ring, so that a long run keeps its
+   latest PROFILE_SAMPLES samples rather than its first ones. */
+#define PROFILE_SAMPLES 4096
+#define PROFILE_DEPTH 4         /* Interrupted EIP plus 3 callers. */
+
+struct sample
+  {
+    uintptr_t pc[PROFILE_DEPTH];        /* PC, then return addresses. */
+    unsigned count;                     /* Used only while printing. */
+  };
+
+bool profile_enabled;
+
+static struct sample samples[PROFILE_SAMPLES];
+static unsigned sample_cnt;     /* Samples taken in kernel mode. */
+static unsigned user_cnt;       /* Samples taken in user mode. */
+
+/* Records the kernel location interrupted by timer interrupt F.
+   Only frames that lie within the interrupted thread's own stack
+   page are followed, so a corrupt or missing frame pointer ends
+   the backtrace instead of faulting. */
+void
+profile_sample (const struct intr_frame *f)
+{
+  struct sample *s;
+  uintptr_t stack, *frame;
+  int i;
+
+  ASSERT (intr_context ());
+
+  if (f->cs != SEL_KCSEG)
+    {
+      user_cnt++;
+      return;
+    }
+
+  s = &samples[sample_cnt++ % PROFILE_SAMPLES];
+  s->pc[0] = (uintptr_t) f->eip;
+  stack = (uintptr_t) thread_current ();
+  frame = (uintptr_t *) f->ebp;
+  for (i = 1; i < PROFILE_DEPTH; i++)
+    {
+      if ((uintptr_t) frame < stack
+          || (uintptr_t) (frame + 2) > stack + PGSIZE
+          || frame[1] == 0)
+        break;
+      s->pc[i] = frame[1];
+      frame = (uintptr_t *) frame[0];
+    }
+  for (; i < PROFILE_DEPTH; i++)
+    s->pc[i] = 0;
+}
+
+/* Orders samples by their backtraces. */
+static int
+compare_pcs (const void *a_, const void *b_)
+{
+  const struct sample *a = a_, *b = b_;
+  int i;
+
+  for (i = 0; i < PROFILE_DEPTH; i++)
+    if (a->pc[i] != b->pc[i])
+      return a->pc[i] < b->pc[i] ? -1 : 1;
+  return 0;
+}
+
+/* Orders samples by descending count. */
+static int
+compare_counts (const void *a_, const void *b_)
+{
+  const struct sample *a = a_, *b = b_;
+
+  return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+/* Prints the number of samples taken with each distinct
+   backtrace, most frequent first.  Destroys the samples, so it
+   is meant to be called only at shutdown. */
+void
+profile_print_stats (void)
+{
+  enum intr_level old_level;
+  size_t cnt, uniq, i, j;
+
+  if (!profile_enabled)
+    return;
+
+  old_level = intr_disable ();
+  cnt = sample_cnt < PROFILE_SAMPLES ? sample_cnt : PROFILE_SAMPLES;
+  printf ("Profile: %u kernel samples (%zu kept), %u in user mode\n",
+          sample_cnt, cnt, user_cnt);
+
+  /* Merge equal backtraces. */
+  qsort (samples, cnt, sizeof *samples, compare_pcs);
+  for (i = uniq = 0; i < cnt; i = j)
+    {
+      for (j = i + 1; j < cnt && !compare_pcs (&samples[i], &samples[j]); j++)
+        continue;
+      samples[uniq] = samples[i];
+      samples[uniq++].count = j - i;
+    }
+  qsort (samples, uniq, sizeof *samples, compare_counts);
+
+  for (i = 0; i < uniq; i++)
+    {
+      struct sample *s = &samples[i];
+
+      printf ("%6u:", s->count);
+      for (j = 0; j < PROFILE_DEPTH && s->pc[j] != 0; j++)
+        printf (" %#"PRIxPTR, s->pc[j]);
+      printf ("\n");
+    }
+  intr_set_level (old_level);
+}
@@ -0,0 +1,22 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+
+/* Sampling profiler.
+
+   When enabled, every timer interrupt records where the kernel
+   was interrupted, along with a few return addresses from its
+   frame-pointer chain.  At shutdown the samples are printed as
+   a histogram whose addresses can be fed to utils/backtrace. */
+
+struct intr_frame;
+
+/* If false (default), no samples are taken.
+   If true, set by the kernel command-line option "-profile". */
+extern bool profile_enabled;
+
+void profile_sample (const struct intr_frame *);
+void profile_print_stats (void);
+
+#endif /* threads/profile.h */
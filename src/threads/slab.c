@@ -0,0 +1,206 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/memprof.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator for small, hot kernel objects.
+
+   Each cache hands out objects of a single size, so unlike
+   malloc() it doesn't round them up to a power of 2.  A slab is
+   one page from the kernel pool: a header followed by as many
+   objects as fit.  The free objects of a slab are chained
+   through their first word.
+
+   A cache's state is only touched for a few instructions at a
+   time, so it is protected by turning interrupts off rather
+   than by a lock.  That also makes kmem_cache_free() safe to
+   call where interrupts are already off, as in the middle of
+   frame eviction.  Pages are taken from and returned to the
+   page allocator with interrupts on, and a cache keeps up to
+   EMPTY_MAX empty slabs so that alternating allocations and
+   frees don't keep going back to it. */
+
+/* Identifies a slab. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Empty slabs a cache may keep. */
+#define EMPTY_MAX 1
+
+/* Header at the start of each slab. */
+struct slab
+  {
+    unsigned magic;             /* Always SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in cache's partial list. */
+    void *free;                 /* First free object, or null. */
+    size_t in_use;              /* Objects handed out. */
+  };
+
+/* Offset of the first object within a slab. */
+#define SLAB_HDR ROUND_UP (sizeof (struct slab), sizeof (void *))
+
+/* Every cache, for kmem_print_stats(). */
+static struct list caches = LIST_INITIALIZER (caches);
+
+/* Initializes cache C for objects of SIZE bytes, named NAME in
+   statistics.  If CTOR is nonnull, each object is passed to it
+   as it is allocated. */
+void
+kmem_cache_init (struct kmem_cache *c, const char *name, size_t size,
+                 void (*ctor) (void *))
+{
+  enum intr_level old_level;
+
+  ASSERT (c != NULL);
+  ASSERT (size > 0 && size <= PGSIZE - SLAB_HDR);
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, sizeof (void *));
+  c->objs_per_slab = (PGSIZE - SLAB_HDR) / c->obj_size;
+  c->ctor = ctor;
+  list_init (&c->partial);
+  c->empty_cnt = 0;
+  c->slab_cnt = c->in_use = 0;
+  c->alloc_cnt = c->free_cnt = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&caches, &c->elem);
+  intr_set_level (old_level);
+}
+
+/* Returns a new slab for C with all of its objects free, or a
+   null pointer if no page is available. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  uint8_t *obj;
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free = NULL;
+  obj = (uint8_t *) s + SLAB_HDR + c->objs_per_slab * c->obj_size;
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      obj -= c->obj_size;
+      *(void **) obj = s->free;
+      s->free = obj;
+    }
+  return s;
+}
+
+/* Obtains an object from cache C.  Returns a null pointer if
+   memory is not available.  Must not be called from an interrupt
+   handler. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  enum intr_level old_level;
+  struct slab *s;
+  void *obj;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  while (list_empty (&c->partial))
+    {
+      intr_set_level (old_level);
+      s = slab_create (c);
+      if (s == NULL)
+        return NULL;
+      old_level = intr_disable ();
+      list_push_front (&c->partial, &s->elem);
+      c->slab_cnt++;
+      c->empty_cnt++;
+    }
+
+  s = list_entry (list_front (&c->partial), struct slab, elem);
+  obj = s->free;
+  s->free = *(void **) obj;
+  if (s->in_use++ == 0)
+    c->empty_cnt--;
+  if (s->free == NULL)
+    list_remove (&s->elem);
+  c->in_use++;
+  c->alloc_cnt++;
+  intr_set_level (old_level);
+
+  if (c->ctor != NULL)
+    c->ctor (obj);
+  if (memprof_enabled)
+    memprof_alloc (__builtin_return_address (0), MEMPROF_SLAB, obj,
+                   c->obj_size);
+  return obj;
+}
+
+/* Returns OBJ, which must have come from kmem_cache_alloc() on
+   C, to C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  enum intr_level old_level;
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT (((uint8_t *) obj - (uint8_t *) s - SLAB_HDR) % c->obj_size == 0);
+  if (memprof_enabled)
+    memprof_free (obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs. */
+  memset (obj, 0xcc, c->obj_size);
+#endif
+
+  old_level = intr_disable ();
+  ASSERT (s->in_use > 0);
+  if (s->free == NULL)
+    list_push_front (&c->partial, &s->elem);
+  *(void **) obj = s->free;
+  s->free = obj;
+  c->in_use--;
+  c->free_cnt++;
+  if (--s->in_use == 0)
+    {
+      /* Give the slab back unless it is a spare, or we were
+         called with interrupts off and can't reach palloc. */
+      if (c->empty_cnt >= EMPTY_MAX && old_level == INTR_ON)
+        {
+          list_remove (&s->elem);
+          c->slab_cnt--;
+          intr_set_level (old_level);
+          palloc_free_page (s);
+          return;
+        }
+      c->empty_cnt++;
+    }
+  intr_set_level (old_level);
+}
+
+/* Prints statistics for every cache. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      printf ("Slab %s: %zu of %zu-byte objects in use, %zu slabs, "
+              "%llu allocs, %llu frees\n",
+              c->name, c->in_use, c->obj_size, c->slab_cnt,
+              c->alloc_cnt, c->free_cnt);
+    }
+}
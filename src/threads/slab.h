@@ -0,0 +1,32 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A cache of fixed-size objects, carved out of whole pages
+   ("slabs") taken from the page allocator.  See slab.c. */
+struct kmem_cache
+  {
+    const char *name;           /* For statistics. */
+    size_t obj_size;            /* Size of each object, rounded up. */
+    size_t objs_per_slab;       /* Objects in one slab. */
+    void (*ctor) (void *);      /* Initializes each allocated object. */
+    struct list partial;        /* Slabs with at least one free object. */
+    size_t empty_cnt;           /* Slabs on PARTIAL with none in use. */
+    struct list_elem elem;      /* Element in the list of caches. */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* Slabs owned. */
+    size_t in_use;              /* Objects handed out. */
+    unsigned long long alloc_cnt, free_cnt;
+  };
+
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t size,
+                      void (*ctor) (void *));
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -0,0 +1,57 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <debug.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* A spin lock, for data shared between processors in code that
+   can't sleep.  Turning interrupts off only excludes the current
+   processor; a spin lock excludes the others as well.  It must be
+   acquired, and is held, with interrupts off, so that a holder is
+   never preempted by a thread that then spins on it. */
+struct spinlock
+  {
+    volatile uint32_t locked;   /* Nonzero while held. */
+  };
+
+/* Initializer for a static spin lock. */
+#define SPINLOCK_INITIALIZER { 0 }
+
+static inline void
+spin_init (struct spinlock *l)
+{
+  l->locked = 0;
+}
+
+/* Atomically stores VALUE in *P and returns the old value. */
+static inline uint32_t
+spin_xchg (volatile uint32_t *p, uint32_t value)
+{
+  asm volatile ("xchgl %0, %1" : "+r" (value), "+m" (*p) : : "memory");
+  return value;
+}
+
+/* Acquires L, spinning until it is free.  Interrupts must be
+   off. */
+static inline void
+spin_lock (struct spinlock *l)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (spin_xchg (&l->locked, 1) != 0)
+    while (l->locked)
+      asm volatile ("pause");
+}
+
+/* Releases L. */
+static inline void
+spin_unlock (struct spinlock *l)
+{
+  ASSERT (l->locked);
+
+  asm volatile ("" : : : "memory");
+  l->locked = 0;
+}
+
+#endif /* threads/spinlock.h */
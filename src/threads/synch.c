@@ -27,8 +27,10 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
@@ -52,6 +54,15 @@ sema_init (struct semaphore *sema, unsigned value)
   list_init (&sema->waiters);
 }
 
+/* Check if thread a's priority higher than b's. */
+bool
+thread_higher (const struct list_elem *a,
+                             const struct list_elem *b,
+                             void *aux UNUSED){
+	return list_entry (a, struct thread, elem)->priority 
+						> list_entry (b, struct thread, elem)->priority;
+}
+
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
    to become positive and then atomically decrements it.
 
@@ -62,6 +73,7 @@ sema_init (struct semaphore *sema, unsigned value)
 void
 sema_down (struct semaphore *sema) 
 {
+  struct thread *cur = thread_current ();
   enum intr_level old_level;
 
   ASSERT (sema != NULL);
@@ -70,7 +82,10 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
+			/* Waiters are kept highest priority first, and in arrival
+				 order among equals. */
+			cur->wait_sema = sema;
+			list_insert_ordered (&sema->waiters, &cur->elem, thread_higher, NULL);
       thread_block ();
     }
   sema->value--;
@@ -103,15 +118,6 @@ sema_try_down (struct semaphore *sema)
   return success;
 }
 
-/* Check if thread a's priority higher than b's. */
-bool
-thread_higher (const struct list_elem *a,
-                             const struct list_elem *b,
-                             void *aux UNUSED){
-	return list_entry (a, struct thread, elem)->priority 
-						> list_entry (b, struct thread, elem)->priority;
-}
-
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
    and wakes up one thread of those waiting for SEMA, if any.
 
@@ -126,13 +132,48 @@ sema_up (struct semaphore *sema)
   old_level = intr_disable ();
   sema->value++;
   if (!list_empty (&sema->waiters)) {
-		list_sort (&sema->waiters, thread_higher, NULL);
-		thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+		struct thread *t = list_entry (list_pop_front (&sema->waiters),
+				struct thread, elem);
+
+		t->wait_sema = NULL;
+		thread_unblock (t);
 	}
   intr_set_level (old_level);
 }
 
+/* Like sema_up(), but adds the thread it wakes, if any, to
+   BATCH for thread_unblock_batch() instead of unblocking it.
+   Interrupts must be off. */
+static void
+sema_up_batch (struct semaphore *sema, struct list *batch)
+{
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	sema->value++;
+	if (!list_empty (&sema->waiters)) {
+		struct thread *t = list_entry (list_pop_front (&sema->waiters),
+				struct thread, elem);
+
+		t->wait_sema = NULL;
+		list_push_back (batch, &t->elem);
+	}
+}
+
+/* Moves T, whose priority just changed, to its place among the
+   waiters of the semaphore it is blocked on, if any.  Interrupts
+   must be off. */
+void
+sema_requeue (struct thread *t)
+{
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->wait_sema == NULL)
+		return;
+	list_remove (&t->elem);
+	list_insert_ordered (&t->wait_sema->waiters, &t->elem, thread_higher,
+			NULL);
+}
+
 static void sema_test_helper (void *sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -193,6 +234,139 @@ lock_init (struct lock *lock)
   lock->holder = NULL;
 	lock->boosted_priority = -1;
   sema_init (&lock->semaphore, 1);
+#ifdef LOCKSTAT
+  memset (&lock->stat, 0, sizeof lock->stat);
+#endif
+}
+
+#ifdef LOCKSTAT
+/* Locks given a name, in order of naming. */
+static struct list named_locks = LIST_INITIALIZER (named_locks);
+
+/* Names LOCK, which must never be freed, and starts keeping its
+   contention statistics. */
+void
+lock_set_name (struct lock *lock, const char *name)
+{
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+  ASSERT (name != NULL);
+
+  old_level = intr_disable ();
+  if (lock->stat.name == NULL)
+    list_push_back (&named_locks, &lock->stat.elem);
+  lock->stat.name = name;
+  intr_set_level (old_level);
+}
+
+/* Orders named locks by descending total wait. */
+static bool
+more_wait (const struct list_elem *a_, const struct list_elem *b_,
+           void *aux UNUSED)
+{
+  const struct lock_stat *a = list_entry (a_, struct lock_stat, elem);
+  const struct lock_stat *b = list_entry (b_, struct lock_stat, elem);
+
+  return a->wait_total > b->wait_total;
+}
+
+/* Prints the statistics of every named lock, longest total wait
+   first. */
+void
+lockstat_print_stats (void)
+{
+  enum intr_level old_level = intr_disable ();
+  struct list_elem *e;
+
+  list_sort (&named_locks, more_wait, NULL);
+  printf ("Locks: %-16s %9s %9s %12s %10s %12s (us)\n",
+          "name", "acquired", "contended", "wait", "max wait", "held");
+  for (e = list_begin (&named_locks); e != list_end (&named_locks);
+       e = list_next (e))
+    {
+      struct lock_stat *st = list_entry (e, struct lock_stat, elem);
+
+      printf ("       %-16s %9u %9u %12"PRIu64" %10"PRIu64" %12"PRIu64"\n",
+              st->name, st->acquire_cnt, st->contend_cnt,
+              timer_cycles_to_us (st->wait_total),
+              timer_cycles_to_us (st->wait_max),
+              timer_cycles_to_us (st->hold_total));
+    }
+  intr_set_level (old_level);
+}
+#endif
+
+/* Makes LOCK, held by HOLDER, boost HOLDER's priority to PRI, or
+   to nothing if PRI is -1, keeping HOLDER's per-priority counts
+   of boosting locks up to date.  Interrupts must be off. */
+static void
+lock_boost (struct lock *lock, struct thread *holder, int pri)
+{
+	int old = lock->boosted_priority;
+
+	if (old >= 0 && --holder->boost_cnt[old] == 0)
+		holder->boost_mask &= ~((uint64_t) 1 << old);
+	if (pri >= 0) {
+		ASSERT (holder->boost_cnt[pri] < UINT8_MAX);
+		if (holder->boost_cnt[pri]++ == 0)
+			holder->boost_mask |= (uint64_t) 1 << pri;
+	}
+	lock->boosted_priority = pri;
+}
+
+/* Returns the highest priority donated to T through the locks it
+   holds, or -1 if there is none.  Interrupts must be off. */
+int
+donated_priority (const struct thread *t)
+{
+	uint32_t hi = t->boost_mask >> 32, lo = t->boost_mask;
+
+	if (hi != 0)
+		return 63 - __builtin_clz (hi);
+	if (lo != 0)
+		return 31 - __builtin_clz (lo);
+	return -1;
+}
+
+/* Maximum length of a donation chain.  Deeper nesting is not
+   expected, and the bound keeps the walk short with interrupts
+   off. */
+#define DONATE_DEPTH_MAX 8
+
+/* Donates CUR's priority to the holder of LOCK, which CUR is
+   about to wait for, and on down the chain of locks that holder
+   is itself waiting for.  Stops at the first thread that already
+   runs at CUR's priority or higher, or after DONATE_DEPTH_MAX
+   links.  Interrupts must be off. */
+static void
+donate_priority (struct lock *lock, struct thread *cur)
+{
+	struct thread *holder = lock->holder;
+	int pri = cur->priority;
+	int depth;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	cur->donated_for = holder;
+	cur->donated_to_get = lock;
+	for (depth = 0; depth < DONATE_DEPTH_MAX; depth++) {
+		if (holder->priority >= pri)
+			break;
+		thread_change_priority (holder, pri);	/* current effective priority */
+		lock_boost (lock, holder, pri);	/* history of priorities */
+
+		/* Follow HOLDER to the lock it waits for, if it still does. */
+		if (holder->donated_for == NULL)
+			break;
+		lock = holder->donated_to_get;
+		if (lock->holder != holder->donated_for) {
+			holder->donated_for = NULL;
+			holder->donated_to_get = NULL;
+			break;
+		}
+		holder = lock->holder;
+	}
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -207,55 +381,54 @@ void
 lock_acquire (struct lock *lock)
 {
 	enum intr_level old_level;
-	struct thread *t;
 	struct thread *cur = thread_current ();
 
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-#ifdef VM
 	old_level = intr_disable ();
-	sema_down (&lock->semaphore);
-  lock->holder = cur;
-	intr_set_level (old_level);
-	return;
+	/* Fast path: the lock is free, so nobody waits for it and
+		 there is nothing to donate. */
+	if (lock->semaphore.value > 0) {
+		lock->semaphore.value--;
+#ifdef LOCKSTAT
+		if (lock->stat.name != NULL)
+			lock->stat.acquired_at = timer_cycles ();
 #endif
-
-	old_level = intr_disable ();
-  if (!sema_try_down (&lock->semaphore)){
-		/* Donate priority to holder. */
-		if (lock->holder->priority < cur->priority) {
-			lock->holder->priority = cur->priority;	/* current effective priority */
-			lock->boosted_priority = cur->priority; /* history of priorities */
-			cur->donated_for = lock->holder;
-			cur->donated_to_get = lock;
-			t = lock->holder;
-			while ( t->donated_for != NULL ) {
-				if (t->donated_to_get->holder != t->donated_for){
-					t->donated_for = NULL;
-					t->donated_to_get = NULL;
-					break;
-				}
-				t->donated_for->priority = cur->priority;
-				t->donated_to_get->boosted_priority = cur->priority;
-				t = t->donated_for;
-			}
-			intr_set_level (old_level);
-
-			/* Lock acquire */
-			sema_down (&lock->semaphore);
-			cur->donated_for = NULL;
-			cur->donated_to_get = NULL;
-		} else {
-			intr_set_level (old_level);
-			sema_down (&lock->semaphore);
-		}
 	} else {
-		intr_set_level (old_level);
+#ifdef LOCKSTAT
+		uint64_t start = timer_cycles ();
+#endif
+		enum cpu_time old_time;
+
+		/* HOLDER is null for the moment between a release and the
+			 wakeup of the waiter it hands the lock to. */
+		if (lock->holder != NULL)
+			donate_priority (lock, cur);
+		old_time = thread_set_block_time (CPU_LOCK_WAIT);
+		sema_down (&lock->semaphore);
+		thread_set_block_time (old_time);
+		cur->donated_for = NULL;
+		cur->donated_to_get = NULL;
+#ifdef LOCKSTAT
+		if (lock->stat.name != NULL) {
+			uint64_t wait;
+
+			lock->stat.acquired_at = timer_cycles ();
+			wait = lock->stat.acquired_at - start;
+			lock->stat.contend_cnt++;
+			lock->stat.wait_total += wait;
+			if (wait > lock->stat.wait_max)
+				lock->stat.wait_max = wait;
+		}
+#endif
 	}
-	list_push_back (&cur->hold_list, &lock->holdelem);
+#ifdef LOCKSTAT
+	lock->stat.acquire_cnt++;
+#endif
   lock->holder = cur;
+	intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -290,35 +463,35 @@ void
 lock_release (struct lock *lock) 
 {
 	enum intr_level old_level;
-	struct list_elem *e;
 	struct thread *cur = thread_current ();
+	int donated;
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
-#ifdef VM
 	old_level = intr_disable ();
-  lock->holder = NULL;
-  sema_up (&lock->semaphore);
-	intr_set_level (old_level);
-	return;
+#ifdef LOCKSTAT
+	if (lock->stat.name != NULL)
+		lock->stat.hold_total += timer_cycles () - lock->stat.acquired_at;
 #endif
-	old_level = intr_disable ();
   lock->holder = NULL;
 
-	list_remove (&lock->holdelem);
-	lock->boosted_priority = -1;
-
-	/* Calculate effective priority by searching hold_list. */
-	int max = cur->original_priority;
-	for (e = list_begin (&cur->hold_list); e != list_end (&cur->hold_list);
-			 e = list_next (e))
-		{
-			struct lock *l = list_entry (e, struct lock, holdelem);
-			if ( max < l->boosted_priority )
-				max = l->boosted_priority;
-		}
-	cur->priority = max;
-	thread_priority = max;
+	/* Fast path: nobody waits, and our priority comes from no
+		 donation, so it stays the same. */
+	if (list_empty (&lock->semaphore.waiters)
+			&& lock->boosted_priority == -1
+			&& cur->priority == cur->original_priority) {
+		lock->semaphore.value++;
+		intr_set_level (old_level);
+		return;
+	}
+	lock_boost (lock, cur, -1);
+
+	/* Effective priority is the highest of the original and the
+		 donations through the locks still held. */
+	donated = donated_priority (cur);
+	cur->priority = donated > cur->original_priority
+		? donated : cur->original_priority;
+	thread_priority = cur->priority;
   sema_up (&lock->semaphore);
 	intr_set_level (old_level);
 }
@@ -334,13 +507,121 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+/* Initializes RWLOCK.  A reader-writer lock may be held by any
+   number of readers at once, or by a single writer.
+
+   The writer holds the embedded lock for as long as it is
+   inside, and every reader takes the same lock just long enough
+   to count itself in.  Thus a waiting writer keeps new readers
+   out while the current ones drain, so writers never starve, and
+   a reader or writer blocked behind a writer donates its priority
+   to it through lock_acquire(). */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  rw->readers = 0;
+  rw->draining = false;
+  sema_init (&rw->drained, 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it.  Must not be called within an interrupt
+   handler. */
+void
+rwlock_acquire_shared (struct rwlock *rw)
+{
+	enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+	old_level = intr_disable ();
+  rw->readers++;
+	intr_set_level (old_level);
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_shared (struct rwlock *rw)
+{
+	enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+	old_level = intr_disable ();
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0 && rw->draining)
+    {
+      rw->draining = false;
+      sema_up (&rw->drained);
+    }
+	intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.  Must not be called within an interrupt handler. */
+void
+rwlock_acquire_exclusive (struct rwlock *rw)
+{
+	enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+	old_level = intr_disable ();
+  if (rw->readers > 0)
+    {
+      enum cpu_time old_time = thread_set_block_time (CPU_LOCK_WAIT);
+
+      rw->draining = true;
+      sema_down (&rw->drained);
+      thread_set_block_time (old_time);
+    }
+	intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_release_exclusive (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw->readers == 0);
+
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rwlock_held_exclusive (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return lock_held_by_current_thread (&rw->lock);
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem 
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    int priority;                       /* Waiter's priority when it
+                                           started waiting. */
   };
 
+/* Check if the waiter of semaphore_elem a has higher priority
+   than b's. */
+static bool
+waiter_higher (const struct list_elem *a, const struct list_elem *b,
+               void *aux UNUSED)
+{
+	return list_entry (a, struct semaphore_elem, elem)->priority
+						> list_entry (b, struct semaphore_elem, elem)->priority;
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -383,28 +664,13 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
+	waiter.priority = thread_get_priority ();
+	list_insert_ordered (&cond->waiters, &waiter.elem, waiter_higher, NULL);
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
 
-/* Check if thread of sema a's priority higher than b's. */
-bool
-sema_higher (const struct list_elem *a,
-                             const struct list_elem *b,
-                             void *aux UNUSED){
-	struct list_elem *aa = list_entry (a, struct semaphore_elem, elem)->semaphore.waiters.head.next;
-	struct list_elem *bb = list_entry (b, struct semaphore_elem, elem)->semaphore.waiters.head.next;
-
-	ASSERT (aa != NULL);
-	ASSERT (bb != NULL);
-
-	return list_entry (aa, struct thread, elem)->priority
-						> list_entry (bb, struct thread, elem)->priority;
-}
-
-
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -421,7 +687,6 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) {
-		list_sort (&cond->waiters, sema_higher, NULL);
     sema_up (&list_entry (list_pop_front (&cond->waiters),
                           struct semaphore_elem, elem)->semaphore);
 	}
@@ -436,9 +701,20 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
 void
 cond_broadcast (struct condition *cond, struct lock *lock) 
 {
+	struct list batch;
+	enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
 
+	/* Wake them all in their order, with one reschedule. */
+	list_init (&batch);
+	old_level = intr_disable ();
   while (!list_empty (&cond->waiters))
-    cond_signal (cond, lock);
+		sema_up_batch (&list_entry (list_pop_front (&cond->waiters),
+					struct semaphore_elem, elem)->semaphore, &batch);
+	thread_unblock_batch (&batch);
+	intr_set_level (old_level);
 }
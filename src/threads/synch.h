@@ -3,27 +3,50 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct list waiters;        /* Waiting threads, highest priority
+                                   first. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
 void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
+struct thread;
+void sema_requeue (struct thread *);
 void sema_self_test (void);
 
+#ifdef LOCKSTAT
+/* Contention statistics of a named lock.  Times are in TSC
+   cycles. */
+struct lock_stat
+  {
+    const char *name;           /* Null if the lock is not tracked. */
+    unsigned acquire_cnt;       /* Number of acquisitions. */
+    unsigned contend_cnt;       /* Acquisitions that had to wait. */
+    uint64_t wait_total;        /* Time spent waiting. */
+    uint64_t wait_max;          /* Longest single wait. */
+    uint64_t hold_total;        /* Time spent holding the lock. */
+    uint64_t acquired_at;       /* Time of the last acquisition. */
+    struct list_elem elem;      /* Element in the named locks list. */
+  };
+#endif
+
 /* Lock. */
 struct lock 
   {
     struct thread *holder;      /* Thread holding lock. */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
-		struct list_elem holdelem;  /* List element for holded locks list for a thread. */
-    int boosted_priority;       /* Boosted priority when donation occurs. */
+    int boosted_priority;       /* Priority donated to the holder through
+                                   this lock, or -1. */
+#ifdef LOCKSTAT
+    struct lock_stat stat;      /* Contention statistics. */
+#endif
   };
 
 void lock_init (struct lock *);
@@ -32,10 +55,40 @@ void lock_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* With -DLOCKSTAT, a lock given a name with lock_set_name()
+   keeps contention statistics, which lockstat_print_stats()
+   reports.  Only locks that are never freed may be named.
+   Without it, both compile to nothing. */
+#ifdef LOCKSTAT
+void lock_set_name (struct lock *, const char *name);
+void lockstat_print_stats (void);
+#else
+#define lock_set_name(LOCK, NAME) ((void) 0)
+#define lockstat_print_stats() ((void) 0)
+#endif
+
+/* Reader-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Held by the writer, and briefly by
+                                   each entering reader. */
+    unsigned readers;           /* Number of readers inside. */
+    bool draining;              /* A writer waits for readers to leave. */
+    struct semaphore drained;   /* Upped by the last reader out. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_shared (struct rwlock *);
+void rwlock_release_shared (struct rwlock *);
+void rwlock_acquire_exclusive (struct rwlock *);
+void rwlock_release_exclusive (struct rwlock *);
+bool rwlock_held_exclusive (const struct rwlock *);
+
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct list waiters;        /* Waiting threads, highest priority
+                                   first. */
   };
 
 void cond_init (struct condition *);
@@ -44,7 +97,7 @@ void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
 bool thread_higher (const struct list_elem *, const struct list_elem *, void *);
-bool sema_higher (const struct list_elem *, const struct list_elem *, void *);
+int donated_priority (const struct thread *);
 
 /* Optimization barrier.
 
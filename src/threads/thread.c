@@ -2,17 +2,24 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
+#include "threads/cpu.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/pmc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #ifdef USERPROG
 #include "userprog/process.h"
+#include "filesys/directory.h"
 #endif
 #ifdef VM
 #include "vm/page.h"
@@ -23,33 +30,63 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-
-/* Multi-grouped list of ready_list. Grouped by priority. */
-struct list pri_list[PRI_MAX+1];
-
-/* List of sleeping processes, that is, processes that should be 
-	 checked each tick whether it should be awake or not. */
-struct list sleep_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, are kept in a run queue
+   per processor, in struct cpu: one list per priority, with a
+   bit mask of the nonempty ones so that the highest ready
+   priority is found with a single bit scan.  A ready thread sits
+   in the queue of the processor named by its `cpu' member.
+
+   With -cfs, every thread but the idle thread has PRI_DEFAULT,
+   and a processor's ready threads are kept in a red-black tree
+   in order of vruntime instead: the time each has run, scaled
+   down by a weight that grows as its nice value drops.  The
+   thread that has run least is picked next, so each thread gets
+   CPU in proportion to its weight.
+
+   Above either sits the deadline class.  A thread that joins it
+   with thread_set_deadline() is given RUNTIME ticks of CPU every
+   PERIOD ticks, due DEADLINE ticks into the period, as long as
+   the class as a whole stays within RT_UTIL_MAX of the CPU.
+   Ready threads of the class wait in a red-black tree per
+   processor, in order of absolute deadline, and the earliest one
+   runs before any other thread.  One that uses up its budget is
+   throttled: it falls back to its priority until its next period
+   starts. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
+/* Threads by tid, chained in buckets of TID_BUCKETS lists.  A
+   process stays here until its parent reaps it, so that wait()
+   still finds it after it exits.  Changed with interrupts off. */
+#define TID_BUCKETS 64
+static struct list tid_buckets[TID_BUCKETS];
+
 /* List of recent_cpu changed processes. */
 struct list rcc_list;
 
-/* Idle thread. */
-static struct thread *idle_thread;
-
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* Pages of dead threads, kept for thread_create() to reuse
+   without going through the page allocator.  Protected by
+   page_cache_lock, taken with interrupts off. */
+#define PAGE_CACHE_MAX 8
+static void *page_cache[PAGE_CACHE_MAX];
+static size_t page_cache_cnt;
+static struct spinlock page_cache_lock = SPINLOCK_INITIALIZER;
+
+#ifdef USERPROG
+/* Protects the reference counts of struct child records, shared by
+   a parent and a child.  Taken with interrupts off. */
+static struct spinlock child_lock = SPINLOCK_INITIALIZER;
+#endif
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
   {
@@ -59,14 +96,66 @@ struct kernel_thread_frame
   };
 
 /* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
 static fixed load_avg;          /* System load average. */
 
-/* Scheduling. */
-#define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+/* Lazy recent_cpu decay.  Once per second only the running and
+   ready threads have recent_cpu decayed.  Blocked threads catch
+   up when they are unblocked, replaying the decay coefficients of
+   the seconds they missed from decay_hist. */
+#define DECAY_HIST 256          /* Seconds of coefficients kept. */
+static unsigned mlfqs_sec;      /* Seconds since scheduler start. */
+static fixed decay_hist[DECAY_HIST];   /* Coefficient of each second. */
+
+/* A thread woken from disk or console I/O under -mlfqs runs this
+   many levels above its priority, so that it gets the processor
+   soon, and then sinks back as the boost halves with each tick
+   it runs, gone by the time the priorities are next computed.
+   recent_cpu is charged as usual. */
+#define IO_BOOST 8
+
+/* Scheduling.  The priorities are split into SLICE_BANDS equal
+   bands, lowest first, and a thread gets the time slice of the
+   band its priority is in when the slice is checked: longer for
+   low priority, CPU-bound work and shorter for high.  Under
+   -mlfqs the priority is the queue level, so a thread's quantum
+   grows as it sinks.  The default band keeps the old 4 ticks.
+   Set with "-slice=T0,T1,T2,T3". */
+#define SLICE_BANDS 4
+#define BAND_WIDTH ((PRI_MAX - PRI_MIN + 1) / SLICE_BANDS)
+static unsigned time_slice[SLICE_BANDS] = { 8, 4, 4, 2 };
+
+/* -cfs.  A tick of a nice 0 thread adds NICE_0_WEIGHT to its
+   vruntime.  A thread is preempted once it is CFS_GRANULARITY
+   ahead of the leftmost ready thread, and a waking thread is
+   placed no further than that behind min_vruntime. */
+#define NICE_0_WEIGHT 1024
+#define CFS_GRANULARITY (2 * NICE_0_WEIGHT)
+
+/* Weight of each nice value from NICE_MIN to NICE_MAX.  Every
+   step of nice is worth about 10% of CPU. */
+static const int32_t nice_weight[NICE_MAX - NICE_MIN + 1] =
+  {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
+    12,
+  };
+
+bool thread_cfs;
+
+/* Deadline class.  PRI_EDF stands for its ready threads where
+   priorities are compared.  Utilizations are in thousandths of
+   the CPU.  Protected by disabling interrupts. */
+#define PRI_EDF (PRI_MAX + 1)
+#define RT_UTIL_MAX 950
+static struct list rt_list;     /* Threads in the class. */
+static int rt_util;             /* Sum of their utilizations. */
+static unsigned long long rt_throttle_cnt;   /* Budgets used up. */
 int thread_priority;            /* priority of current running thread. */
 
 /* If false (default), use round-robin scheduler.
@@ -79,12 +168,38 @@ static void kernel_thread (thread_func *, void *aux);
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static int highest_ready_priority (struct cpu *);
+static struct cpu *busiest_peer (struct cpu *, int priority);
+static struct thread *steal (struct cpu *, struct cpu *peer, int priority);
+static void thread_ready_insert (struct thread *);
+static bool make_ready (struct thread *);
+static void preempt (void);
+static void thread_ready_remove (struct thread *);
+static void dequeue (struct cpu *, struct thread *);
+static struct thread *queue_front (struct cpu *, int priority);
+static rb_less_func vruntime_less;
+static rb_less_func deadline_less;
+static bool edf_queued (const struct thread *);
+static bool edf_preempts (struct thread *t, struct thread *cur);
+static void edf_tick (struct thread *cur);
+static int rt_thread_util (const struct thread *);
+static void cfs_place (struct thread *);
+static bool cfs_preempts (struct thread *t, struct thread *cur);
+static unsigned slice_of (const struct thread *);
+static void decay_recent_cpu (struct thread *, fixed c);
+static void catch_up_recent_cpu (struct thread *);
 static void init_thread (struct thread *, const char *name, int priority, int nice, bool is_user_thread);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
+static struct thread *alloc_thread_page (void);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void account_switch (struct thread *prev, struct thread *cur);
+#ifdef USERPROG
+static void orphan_children (struct thread *);
+static void child_release (struct child *);
+#endif
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -102,27 +217,34 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
-	int i;
+  unsigned i;
 
   ASSERT (intr_get_level () == INTR_OFF);
 
+  cpu_init ();
+  for (i = 0; i < CPU_MAX; i++)
+    {
+      rb_init (&cpus[i].cfs_tree, vruntime_less, NULL);
+      rb_init (&cpus[i].edf_tree, deadline_less, NULL);
+    }
+  list_init (&rt_list);
   lock_init (&tid_lock);
-  list_init (&ready_list);
-  list_init (&sleep_list);
+  lock_set_name (&tid_lock, "tid");
   list_init (&all_list);
+  for (i = 0; i < TID_BUCKETS; i++)
+    list_init (&tid_buckets[i]);
 	if(thread_mlfqs) {
 		list_init (&rcc_list);
 	}
 
-	for (i=PRI_MIN ; i<=PRI_MAX ; i++){
-  	list_init (&pri_list[i]);
-	}
-
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT, NICE_DEFAULT, false);
   initial_thread->status = THREAD_RUNNING;
+	initial_thread->cpu_state = CPU_KERNEL;
   initial_thread->tid = allocate_tid ();
+  list_push_back (&tid_buckets[initial_thread->tid % TID_BUCKETS],
+                  &initial_thread->tidelem);
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -138,7 +260,7 @@ thread_start (void)
   /* Start preemptive thread scheduling. */
   intr_enable ();
 
-  /* Wait for the idle thread to initialize idle_thread. */
+  /* Wait for the idle thread to register itself. */
   sema_down (&idle_started);
 }
 
@@ -148,20 +270,23 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  struct cpu *c = cpu_current ();
 
   /* Update statistics. */
-  if (t == idle_thread)
-    idle_ticks++;
+  if (t == c->idle)
+    c->idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
-    user_ticks++;
+    c->user_ticks++;
 #endif
   else
-    kernel_ticks++;
+    c->kernel_ticks++;
+	if (t != c->idle)
+		t->run_ticks++;
 
   ASSERT (intr_get_level () == INTR_OFF);
 
-	if ( thread_mlfqs && t != idle_thread){
+	if ( thread_mlfqs && t != c->idle){
 		if(!t->rcc){
 			/* Mark the thread that it's recent_cpu has changed. */
 			list_push_back (&rcc_list, &t->rccelem);
@@ -169,19 +294,145 @@ thread_tick (void)
 		}
 		/* Increament recent_cpu of the thread by 1. */
 		t->recent_cpu = faddn(t->recent_cpu, 1);
+		t->io_boost /= 2;
+	}
+
+	if (thread_cfs && t != c->idle) {
+		struct rb_elem *e;
+		int64_t min;
+
+		t->vruntime += ((int64_t) NICE_0_WEIGHT * NICE_0_WEIGHT
+										/ nice_weight[t->nice - NICE_MIN]);
+		spin_lock (&c->rq_lock);
+		e = rb_first (&c->cfs_tree);
+		min = t->vruntime;
+		if (e != NULL) {
+			struct thread *left = rb_entry (e, struct thread, rbelem);
+			if (left->vruntime < min)
+				min = left->vruntime;
+			if (cfs_preempts (left, t))
+				intr_yield_on_return ();
+		}
+		if (min > c->min_vruntime)
+			c->min_vruntime = min;
+		spin_unlock (&c->rq_lock);
 	}
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+	if (!list_empty (&rt_list))
+		edf_tick (t);
+
+  /* Enforce preemption.  Priorities are global, so also give way
+     to a higher priority thread queued on another processor, or
+     to any waiting thread if we're idle; schedule() steals it. */
+  if ((!thread_cfs && ++c->slice_ticks >= slice_of (t))
+      || busiest_peer (c, t == c->idle ? PRI_MIN - 1 : t->priority) != NULL)
     intr_yield_on_return ();
 }
 
+/* Returns the time slice, in ticks, for T's priority band. */
+static unsigned
+slice_of (const struct thread *t)
+{
+  int band = (t->priority - PRI_MIN) / BAND_WIDTH;
+
+  /* A deadline thread's budget, not its slice, limits it. */
+  return time_slice[band < SLICE_BANDS ? band : SLICE_BANDS - 1];
+}
+
+/* Sets the time slices of the priority bands from SLICES, a list
+   of tick counts separated by commas, lowest band first.  Bands
+   left out keep theirs.  Returns false, changing nothing, if a
+   count is not positive or there are too many. */
+bool
+thread_set_slices (const char *slices)
+{
+  unsigned new[SLICE_BANDS];
+  const char *p = slices;
+  int band;
+
+  memcpy (new, time_slice, sizeof new);
+  for (band = 0; *p != '\0'; band++)
+    {
+      unsigned ticks = 0;
+
+      if (band >= SLICE_BANDS || *p < '0' || *p > '9')
+        return false;
+      for (; *p >= '0' && *p <= '9'; p++)
+        ticks = ticks * 10 + (*p - '0');
+      if (ticks == 0 || (*p != ',' && *p != '\0'))
+        return false;
+      new[band] = ticks;
+      if (*p == ',')
+        p++;
+    }
+  memcpy (time_slice, new, sizeof new);
+  return true;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
 {
+  long long idle_ticks = 0, kernel_ticks = 0, user_ticks = 0;
+  unsigned i;
+
+  for (i = 0; i < cpu_online; i++)
+    {
+      idle_ticks += cpus[i].idle_ticks;
+      kernel_ticks += cpus[i].kernel_ticks;
+      user_ticks += cpus[i].user_ticks;
+    }
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  if (rt_throttle_cnt != 0 || !list_empty (&rt_list))
+    printf ("Deadline class: %zu threads, %d.%d%% of the CPU, "
+            "%llu budgets used up\n", list_size (&rt_list),
+            rt_util / 10, rt_util % 10, rt_throttle_cnt);
+}
+
+/* Puts the running thread in the deadline class, with RUNTIME
+   ticks of CPU every PERIOD ticks, due DEADLINE ticks after each
+   period starts, or takes it out if RUNTIME is 0.  Its first
+   period starts now.  Returns false, leaving the thread as it
+   was, unless 0 < RUNTIME <= DEADLINE <= PERIOD, or if the class
+   would take more than RT_UTIL_MAX of the CPU. */
+bool
+thread_set_deadline (int64_t runtime, int64_t period, int64_t deadline)
+{
+	struct thread *cur = thread_current ();
+	enum intr_level old_level;
+	int util = 0;
+	bool ok = true;
+
+	ASSERT (!intr_context ());
+
+	if (runtime != 0) {
+		if (runtime < 0 || deadline < runtime || period < deadline)
+			return false;
+		util = DIV_ROUND_UP (runtime * 1000, period);
+	}
+
+	old_level = intr_disable ();
+	if (rt_util - rt_thread_util (cur) + util > RT_UTIL_MAX)
+		ok = false;
+	else {
+		rt_util += util - rt_thread_util (cur);
+		if (cur->rt_period == 0 && runtime != 0)
+			list_push_back (&rt_list, &cur->rtelem);
+		else if (cur->rt_period != 0 && runtime == 0)
+			list_remove (&cur->rtelem);
+		cur->rt_runtime = runtime;
+		cur->rt_period = runtime != 0 ? period : 0;
+		cur->rt_rel_deadline = deadline;
+		cur->rt_release = timer_ticks () + period;
+		cur->rt_deadline = timer_ticks () + deadline;
+		cur->rt_budget = runtime;
+		cur->rt_throttled = false;
+		/* Let the scheduler place us anew. */
+		thread_yield ();
+	}
+	intr_set_level (old_level);
+	return ok;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -213,21 +464,47 @@ thread_create (const char *name, int priority,
 
   ASSERT (function != NULL);
 
-  /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+#ifdef USERPROG
+	/* A process gets a record that its parent can wait on, and a
+	   thread from thread_spawn() one that the threads of its process
+	   can. */
+	bool is_process = function == start_process || function == start_fork;
+	bool is_thread = function == start_thread;
+	struct child *child = NULL;
+	if ((is_process || is_thread)
+			&& (child = malloc (sizeof *child)) == NULL)
+		return TID_ERROR;
+#endif
+
+  /* Allocate thread.  init_thread() initializes the struct
+     thread; the rest of the page is stack and needn't be
+     zeroed. */
+  t = alloc_thread_page ();
   if (t == NULL)
-    return TID_ERROR;
+    {
+#ifdef USERPROG
+      free (child);
+#endif
+      return TID_ERROR;
+    }
 
   /* Initialize thread. */
 	nice = thread_current ()->nice;
   ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+	if (thread_cfs && function != idle)
+		priority = PRI_DEFAULT;
 
 #ifdef USERPROG
-  init_thread (t, name, priority, nice, function==start_process);
+  init_thread (t, name, priority, nice, is_process);
 #else
 	init_thread (t, name, priority, nice, false);
 #endif
   tid = t->tid = allocate_tid ();
+#ifdef USERPROG
+  /* Start out in the creator's current directory. */
+  if (!is_thread && thread_current ()->process->cwd != NULL)
+    t->cwd = dir_reopen (thread_current ()->process->cwd);
+#endif
 
   old_level = intr_disable ();
 
@@ -246,6 +523,26 @@ thread_create (const char *name, int priority,
   sf->eip = switch_entry;
   sf->ebp = 0;
 
+	/* Start out level with the threads already here. */
+	t->vruntime = t->cpu->min_vruntime;
+
+	list_push_back (&tid_buckets[tid % TID_BUCKETS], &t->tidelem);
+#ifdef USERPROG
+	if (child != NULL)
+		{
+			child->tid = tid;
+			child->exit_status = -1;
+			child->load_failed = false;
+			child->ref_cnt = 2;
+			sema_init (&child->loaded, 0);
+			sema_init (&child->exited, 0);
+			child->parent = is_process ? thread_current ()->process : NULL;
+			child->exit_queued = false;
+			t->child = child;
+			list_push_back (&thread_current ()->process->children, &child->elem);
+		}
+#endif
+
   intr_set_level (old_level);
 
   /* Add to run queue. */
@@ -268,6 +565,7 @@ thread_block (void)
   ASSERT (intr_get_level () == INTR_OFF);
 
 	t = thread_current ();
+	trace (TRACE_BLOCK, (uint32_t) __builtin_return_address (0), 0);
   t->status = THREAD_BLOCKED;
   schedule ();
 }
@@ -285,23 +583,84 @@ thread_unblock (struct thread *t)
 {
   enum intr_level old_level;
 
-  ASSERT (is_thread (t));
+  old_level = intr_disable ();
+	if (make_ready (t))
+		preempt ();
+  intr_set_level (old_level);
+}
+
+/* Unblocks every thread in THREADS, a list of blocked threads
+   linked through their elem members, which is left empty.  Like
+   thread_unblock(), but the threads are queued in one pass and
+   preemption is decided once, for all of them. */
+void
+thread_unblock_batch (struct list *threads)
+{
+  enum intr_level old_level;
+	bool yield = false;
 
   old_level = intr_disable ();
+	while (!list_empty (threads)) {
+		struct thread *t = list_entry (list_pop_front (threads),
+				struct thread, elem);
+		if (make_ready (t))
+			yield = true;
+	}
+	if (yield)
+		preempt ();
+  intr_set_level (old_level);
+}
+
+/* Makes blocked thread T ready.  Returns true if it should
+   preempt the running thread.  Interrupts must be off. */
+static bool
+make_ready (struct thread *t)
+{
+	struct thread *cur;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
-	list_push_back (&pri_list[t->priority], &t->prielem);
+	trace (TRACE_UNBLOCK, t->tid, 0);
+	t->ready_since = timer_cycles ();
+	if (thread_mlfqs) {
+		catch_up_recent_cpu (t);
+		if (t->block_time == CPU_IO_WAIT) {
+			t->io_boost = IO_BOOST;
+			t->priority = thread_boosted_priority (t, t->original_priority);
+		}
+	}
+	if (thread_cfs)
+		cfs_place (t);
+	/* Waking up in a new period starts a new job. */
+	if (t->rt_period != 0 && timer_ticks () >= t->rt_release) {
+		t->rt_release = timer_ticks () + t->rt_period;
+		t->rt_deadline = timer_ticks () + t->rt_rel_deadline;
+		t->rt_budget = t->rt_runtime;
+		t->rt_throttled = false;
+	}
   t->status = THREAD_READY;
+	thread_ready_insert (t);
+
+	/* If unblocked thread is due before a deadline-class thread
+		 running, or else is in the class, has higher priority than
+		 current, or with -cfs has run much less, yield. */
+	cur = running_thread ();
+	return (edf_queued (cur) ? edf_preempts (t, cur)
+			: (edf_queued (t) || thread_priority < t->priority
+				 || (thread_cfs && cfs_preempts (t, cur))));
+}
 
-	/* If unblocked thread has higher priority than current, yield. */
-	if ( thread_priority < t->priority ) {
-		if (!intr_context ()) {
-			thread_yield ();
-		}else{
-			intr_yield_on_return ();
-		}
+/* Yields the processor to a thread just made ready, now or on
+   return from the interrupt being handled. */
+static void
+preempt (void)
+{
+	if (!intr_context ()) {
+		thread_yield ();
+	}else{
+		intr_yield_on_return ();
 	}
-  intr_set_level (old_level);
 }
 
 /* Returns the name of the running thread. */
@@ -349,26 +708,45 @@ thread_exit (void)
 
 #ifdef USERPROG
   process_exit ();
+	/* Records are freed with malloc, so before malloc_thread_exit(). */
+	t = thread_current ();
+	orphan_children (t);
+	if (t->child != NULL)
+		{
+			struct child *c = t->child;
+			enum intr_level old_level;
+
+			c->exit_status = t->exit_status;
+			old_level = intr_disable ();
+			if (c->parent != NULL) {
+				list_push_back (&c->parent->exited_children, &c->exit_elem);
+				c->exit_queued = true;
+				sema_up (&c->parent->child_exited);
+			}
+			intr_set_level (old_level);
+			sema_up (&t->child->exited);
+			child_release (t->child);
+			t->child = NULL;
+		}
 #endif
+  fpu_exit (thread_current ());
+  malloc_thread_exit ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
 	t = thread_current ();
-#ifndef USERPROG
   list_remove (&t->allelem);
-#endif
+	list_remove (&t->tidelem);
 	/* If the thread is in the recent_cpu changed list, then remove. */
 	if(t->rcc)
 		list_remove (&t->rccelem);	
+	if (t->rt_period != 0) {
+		list_remove (&t->rtelem);
+		rt_util -= rt_thread_util (t);
+	}
   t->status = THREAD_DYING;
-#ifdef USERPROG
-	/* Tell parent that it is safe to get the exit_status value,
-		 and also free child's TCB. This function should have been called
-		 after exit_status has saved. */
-	sema_up (&t->exit_wait_sema);
-#endif
   schedule ();
   NOT_REACHED ();
 }
@@ -384,11 +762,9 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) {
-    list_push_back (&ready_list, &cur->elem);
-		list_push_back (&pri_list[cur->priority], &cur->prielem);
-	}
   cur->status = THREAD_READY;
+  if (cur != cpu_current ()->idle)
+		thread_ready_insert (cur);
   schedule ();
   intr_set_level (old_level);
 }
@@ -410,41 +786,130 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
+/* CPU time accounting.
+
+   Each thread's time, as measured by the TSC, is charged to one
+   of its cpu_times at a time: user or kernel while it runs, as
+   intr_handler() switches between them on entry from and
+   return to user mode, ready while it waits to run, and, while
+   it is blocked, what it set with thread_set_block_time(), which
+   lock_acquire() and the block layer do around their waits. */
+
+/* Times of threads that have exited, other than idle threads. */
+static uint64_t dead_times[CPU_TIME_CNT];
+
+/* Charges T's time since its last stamp to its current state
+   and starts STATE at NOW.  Interrupts must be off. */
+static void
+charge (struct thread *t, enum cpu_time state, uint64_t now)
+{
+	t->cpu_times[t->cpu_state] += now - t->cpu_stamp;
+	t->cpu_stamp = now;
+	t->cpu_state = state;
+}
+
+/* Ends the running thread's time in its current state, which
+   is user or kernel, and starts STATE. */
+void
+thread_account (enum cpu_time state)
+{
+	enum intr_level old_level = intr_disable ();
+	charge (thread_current (), state, timer_cycles ());
+	intr_set_level (old_level);
+}
+
+/* Makes the running thread's blocks count as STATE from now on,
+   and returns what they counted as before. */
+enum cpu_time
+thread_set_block_time (enum cpu_time state)
+{
+	struct thread *cur = thread_current ();
+	enum cpu_time old = cur->block_time;
+
+	cur->block_time = state;
+	return old;
+}
+
+/* Called by thread_schedule_tail() on each switch from PREV to
+   CUR, with interrupts off. */
+static void
+account_switch (struct thread *prev, struct thread *cur)
+{
+	uint64_t now = timer_cycles ();
+	enum cpu_time state = (prev->status == THREAD_BLOCKED ? prev->block_time
+												 : CPU_READY);
+
+	charge (prev, state, now);
+	charge (cur, CPU_KERNEL, now);
+	if (prev->status == THREAD_DYING) {
+		int i;
+
+		for (i = 0; i < CPU_TIME_CNT; i++)
+			dead_times[i] += prev->cpu_times[i];
+	}
+}
+
+/* Adds T's times so far to TIMES. */
+void
+thread_add_times (struct thread *t, uint64_t times[CPU_TIME_CNT])
+{
+	enum intr_level old_level = intr_disable ();
+	int i;
+
+	if (t == thread_current ())
+		charge (t, t->cpu_state, timer_cycles ());
+	for (i = 0; i < CPU_TIME_CNT; i++)
+		times[i] += t->cpu_times[i];
+	intr_set_level (old_level);
+}
+
+/* Adds to TIMES those of every thread since boot but the idle
+   threads. */
+void
+thread_add_system_times (uint64_t times[CPU_TIME_CNT])
+{
+	enum intr_level old_level = intr_disable ();
+	struct list_elem *e;
+	int i;
+
+	for (i = 0; i < CPU_TIME_CNT; i++)
+		times[i] += dead_times[i];
+	for (e = list_begin (&all_list); e != list_end (&all_list);
+			 e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, allelem);
+		if (t != t->cpu->idle)
+			thread_add_times (t, times);
+	}
+	intr_set_level (old_level);
+}
+
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void
 thread_set_priority (int new_priority) 
 {
 	enum intr_level old_level;
-	int i, old_priority;
 	struct thread *cur;
+	int donated;
+	if (thread_cfs)
+		return;
 	old_level = intr_disable ();
 	cur = thread_current ();
 
-	old_priority = cur->priority;
-	barrier();
-
 
-	/* Set priority to new value. 
-
-		 If current thread has boosted priority,
-		 because of priority donation, then skip setting 
-		 the new_priority to cur->priority and just set to
-		 cur->original_priority, so that after the end of donation,
-		 it could go back to `new_priority'. */
-	if (cur->priority == cur->original_priority)
-  	cur->priority = new_priority;
+	/* Set priority to new value.  The effective priority stays at
+		 the highest donation, if that is higher, and goes back to
+		 `new_priority' when the donations end. */
+	donated = donated_priority (cur);
   cur->original_priority = new_priority;
-	thread_priority = new_priority;
+	cur->priority = new_priority > donated ? new_priority : donated;
+	thread_priority = cur->priority;
 	
 	/* If I become non-highest priority, yield. */
-	for ( i=old_priority ; i>new_priority ; i-- ){
-		if ( !list_empty (&pri_list[i]) ){
-			if (!intr_context ())
-				thread_yield ();
-			else
-				intr_yield_on_return ();
-			break;
-		}
+	if (thread_ready_higher (cur->priority)) {
+		if (!intr_context ())
+			thread_yield ();
+		else
+			intr_yield_on_return ();
 	}
 	
 	intr_set_level (old_level);
@@ -465,8 +930,13 @@ thread_set_nice (int nice)
 	register int a;
 	enum intr_level old_level = intr_disable ();
 
-	/* Set nice to new value. */
+	/* Set nice to new value.  With -cfs, that's all it takes: the
+		 weight is looked up at every tick. */
 	thread_current ()->nice = nice;
+	if (thread_cfs) {
+		intr_set_level (old_level);
+		return;
+	}
 
 	/* Recalculate the thread's priority. */
 	a = thread_get_recent_cpu () / 40;
@@ -485,6 +955,15 @@ thread_set_nice (int nice)
 	intr_set_level (old_level);
 }
 
+/* Returns PRIORITY, an -mlfqs priority computed for T, raised
+   by T's I/O boost. */
+int
+thread_boosted_priority (const struct thread *t, int priority)
+{
+	priority += t->io_boost;
+	return priority < PRI_MAX ? priority : PRI_MAX;
+}
+
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
@@ -510,7 +989,7 @@ thread_get_recent_cpu (void)
 
    The idle thread is initially put on the ready list by
    thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
+   point it registers itself in its struct cpu, "up"s the semaphore passed
    to it to enable thread_start() to continue, and immediately
    blocks.  After that, the idle thread never appears in the
    ready list.  It is returned by next_thread_to_run() as a
@@ -519,15 +998,23 @@ static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  cpu_current ()->idle = thread_current ();
   sema_up (idle_started);
 
   for (;;) 
     {
-      /* Let someone else run. */
+      /* Use the spare time to zero pages. */
+      palloc_idle_zero ();
+
+      /* Let someone else run.  If nothing is ready here,
+         next_thread_to_run() steals from a busier processor. */
       intr_disable ();
       thread_block ();
 
+      /* Stop the periodic tick until it's needed.  The next
+         interrupt restarts it. */
+      timer_stop_tick ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -604,36 +1091,90 @@ init_thread (struct thread *t, const char *name, int priority, int nice, bool is
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
   t->original_priority = priority;
+  t->cpu = cpu_current ();
 	t->nice = nice;
 	t->recent_cpu = 0;
 	t->rcc=false;
+	t->rc_sec = mlfqs_sec;
 	t->donated_for = NULL;
 	t->donated_to_get = NULL;
+	t->wait_sema = NULL;
+	t->cpu_stamp = timer_cycles ();
+	t->cpu_state = CPU_READY;
+	t->block_time = CPU_SLEEP;
   t->magic = THREAD_MAGIC;
 
 #ifdef USERPROG
 	t->exit_status=-1;
-	sema_init(&t->exit_wait_sema, 0);
-	t->lastfd = 2;
-	t->load_failed = false;
 	t->my_binary=NULL;
-	list_init (&t->open_list);
-	sema_init (&t->loaded, 0);
+	t->fds = NULL;
+	t->fd_used = NULL;
+	t->fd_cap = 0;
+	t->cwd = NULL;
+	list_init (&t->aio_list);
+	t->next_aio_id = 0;
 	t->is_process = is_user_process;
+	t->child = NULL;
+	list_init (&t->children);
+	list_init (&t->exited_children);
+	sema_init (&t->child_exited, 0);
+	t->process = t;
+	lock_init (&t->proc_lock);
+	sema_init (&t->thread_gone, 0);
+	list_init (&t->futex_waiters);
 #endif
 #ifdef VM
 	if (is_user_process) {
-		hash_init (&t->spt, page_hash, page_less, NULL);
+		page_table_init (t);
 	}
+	lock_init (&t->mm_lock);
 #endif
 
-  list_init (&t->hold_list);
-
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
   intr_set_level (old_level);
 }
 
+/* Returns a page for a new thread, recycled if possible, or a
+   null pointer if memory is short. */
+static struct thread *
+alloc_thread_page (void)
+{
+  enum intr_level old_level = intr_disable ();
+  void *page = NULL;
+
+  spin_lock (&page_cache_lock);
+  if (page_cache_cnt > 0)
+    page = page_cache[--page_cache_cnt];
+  spin_unlock (&page_cache_lock);
+  intr_set_level (old_level);
+
+  return page != NULL ? page : palloc_get_page (0);
+}
+
+/* Releases the page of dead thread T, keeping it for reuse by a
+   later thread_create() while there is room. */
+void
+thread_free_page (struct thread *t)
+{
+  enum intr_level old_level = intr_disable ();
+  bool kept = false;
+
+  ASSERT (t->status == THREAD_DYING);
+
+  spin_lock (&page_cache_lock);
+  if (page_cache_cnt < PAGE_CACHE_MAX)
+    {
+      page_cache[page_cache_cnt++] = t;
+      kept = true;
+    }
+  spin_unlock (&page_cache_lock);
+  intr_set_level (old_level);
+
+  if (!kept)
+    palloc_free_page (t);
+}
+
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
    returns a pointer to the frame's base. */
 static void *
@@ -650,27 +1191,317 @@ alloc_frame (struct thread *t, size_t size)
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   will be in the run queue.)  A thread of higher priority ready
+   on another processor, or any ready thread there if our queue
+   is empty, is stolen instead.  If no thread is ready anywhere,
+   return this processor's idle thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-	int i;
+	struct cpu *c = cpu_current ();
+	struct cpu *peer;
 	struct thread *t;
-	struct list_elem *e;
+	int i;
 
   ASSERT (intr_get_level () == INTR_OFF);
 
-	/* Search threads from PRI_MAX priority to PRI_MIN priority. */
-	for ( i=PRI_MAX; i>=PRI_MIN ; i-- ){
-		if(!list_empty(&pri_list[i])){
-			e = list_pop_front (&pri_list[i]);  /* If same priority, RR. */
-			t = list_entry (e, struct thread, prielem);
-  		list_remove (&t->elem);  /* Remove from ready_list. */
-			return t;
+	i = highest_ready_priority (c);
+	peer = busiest_peer (c, i < PRI_MIN ? PRI_MIN - 1 : i);
+	if (peer != NULL && (t = steal (c, peer, i)) != NULL)
+		return t;
+
+	spin_lock (&c->rq_lock);
+	i = highest_ready_priority (c);
+	if (i < PRI_MIN)
+		t = c->idle;
+	else {
+		/* If same priority, RR. */
+		t = queue_front (c, i);
+		dequeue (c, t);
+		if (thread_cfs && i != PRI_EDF && t->vruntime > c->min_vruntime)
+			c->min_vruntime = t->vruntime;
+	}
+	spin_unlock (&c->rq_lock);
+	return t;
+}
+
+/* Returns the highest priority with a ready thread on C, PRI_EDF
+   if a thread of the deadline class is ready there, or -1 if no
+   thread is ready there. */
+static int
+highest_ready_priority (struct cpu *c)
+{
+	uint32_t hi = c->ready_mask >> 32, lo = c->ready_mask;
+
+	if (!rb_empty (&c->edf_tree))
+		return PRI_EDF;
+	if (thread_cfs)
+		return c->ready_cnt > 0 ? PRI_DEFAULT : -1;
+
+	if (hi != 0)
+		return 63 - __builtin_clz (hi);
+	if (lo != 0)
+		return 31 - __builtin_clz (lo);
+	return -1;
+}
+
+/* Returns the processor other than C with the highest priority
+   ready thread, if that priority is above PRIORITY, or a null
+   pointer.  Among equals, the one with the most ready threads
+   wins.  Peers' queues are peeked at without their locks, so the
+   answer is only a hint. */
+static struct cpu *
+busiest_peer (struct cpu *c, int priority)
+{
+	struct cpu *best = NULL;
+	int best_pri = priority;
+	unsigned i;
+
+	for (i = 0; i < cpu_online; i++) {
+		struct cpu *p = &cpus[i];
+		int pri = p != c ? highest_ready_priority (p) : -1;
+
+		if (pri > best_pri || (best != NULL && pri == best_pri
+													 && p->ready_cnt > best->ready_cnt)) {
+			best = p;
+			best_pri = pri;
+		}
+	}
+	return best;
+}
+
+/* Takes the highest priority thread ready on PEER, if its
+   priority is above PRIORITY, and moves it over to C.  Returns
+   the thread, or a null pointer if PEER has nothing better. */
+static struct thread *
+steal (struct cpu *c, struct cpu *peer, int priority)
+{
+	struct thread *t = NULL;
+	int i;
+
+	spin_lock (&peer->rq_lock);
+	i = highest_ready_priority (peer);
+	if (i > priority) {
+		t = queue_front (peer, i);
+		dequeue (peer, t);
+		t->cpu = c;
+		/* Keep its standing relative to the others here. */
+		t->vruntime += c->min_vruntime - peer->min_vruntime;
+	}
+	spin_unlock (&peer->rq_lock);
+	return t;
+}
+
+/* Puts ready thread T at the back of its priority's ready
+   queue, on the processor it last ran on.  Interrupts must be
+   off. */
+static void
+thread_ready_insert (struct thread *t)
+{
+	struct cpu *c = t->cpu;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+	spin_lock (&c->rq_lock);
+	if (edf_queued (t))
+		rb_insert (&c->edf_tree, &t->edfelem);
+	else if (thread_cfs)
+		rb_insert (&c->cfs_tree, &t->rbelem);
+	else {
+		list_push_back (&c->pri_list[t->priority], &t->prielem);
+		c->ready_mask |= (uint64_t) 1 << t->priority;
+	}
+	c->ready_cnt++;
+	spin_unlock (&c->rq_lock);
+}
+
+/* Takes ready thread T off C's ready queue.  C's rq_lock must
+   be held. */
+static void
+dequeue (struct cpu *c, struct thread *t)
+{
+  ASSERT (t->status == THREAD_READY);
+
+	if (edf_queued (t))
+		rb_remove (&c->edf_tree, &t->edfelem);
+	else if (thread_cfs)
+		rb_remove (&c->cfs_tree, &t->rbelem);
+	else {
+		list_remove (&t->prielem);
+		if (list_empty (&c->pri_list[t->priority]))
+			c->ready_mask &= ~((uint64_t) 1 << t->priority);
+	}
+	c->ready_cnt--;
+}
+
+/* Returns the thread that runs next of those ready on C at
+   PRIORITY, which must not be empty.  C's rq_lock must be
+   held. */
+static struct thread *
+queue_front (struct cpu *c, int priority)
+{
+	if (priority == PRI_EDF)
+		return rb_entry (rb_first (&c->edf_tree), struct thread, edfelem);
+	if (thread_cfs)
+		return rb_entry (rb_first (&c->cfs_tree), struct thread, rbelem);
+	return list_entry (list_front (&c->pri_list[priority]),
+										 struct thread, prielem);
+}
+
+/* Orders threads by vruntime, for the -cfs ready trees. */
+static bool
+vruntime_less (const struct rb_elem *a_, const struct rb_elem *b_,
+							 void *aux UNUSED)
+{
+	const struct thread *a = rb_entry (a_, struct thread, rbelem);
+	const struct thread *b = rb_entry (b_, struct thread, rbelem);
+
+	return a->vruntime < b->vruntime;
+}
+
+/* Orders threads by absolute deadline, for the EDF ready
+   trees. */
+static bool
+deadline_less (const struct rb_elem *a_, const struct rb_elem *b_,
+							 void *aux UNUSED)
+{
+	const struct thread *a = rb_entry (a_, struct thread, edfelem);
+	const struct thread *b = rb_entry (b_, struct thread, edfelem);
+
+	return a->rt_deadline < b->rt_deadline;
+}
+
+/* Returns true if T, when ready, belongs in an EDF ready tree:
+   it is in the deadline class and has budget left.  Whatever
+   decides this must only change while T is not ready. */
+static bool
+edf_queued (const struct thread *t)
+{
+	return t->rt_period != 0 && !t->rt_throttled;
+}
+
+/* Returns true if ready thread T should preempt CUR, which runs
+   in the deadline class, being due earlier. */
+static bool
+edf_preempts (struct thread *t, struct thread *cur)
+{
+	return edf_queued (t) && t->rt_deadline < cur->rt_deadline;
+}
+
+/* Returns the share of the CPU T's reservation takes, in
+   thousandths. */
+static int
+rt_thread_util (const struct thread *t)
+{
+	return t->rt_period != 0
+			? DIV_ROUND_UP (t->rt_runtime * 1000, t->rt_period) : 0;
+}
+
+/* Charges a tick to CUR, the running thread, if it runs in the
+   deadline class, throttling it once its budget is gone, and
+   gives a new job to every throttled thread whose next period has
+   started, preempting CUR if one is due earlier.  Called from the
+   timer interrupt. */
+static void
+edf_tick (struct thread *cur)
+{
+	int64_t now = timer_ticks ();
+	struct list_elem *e;
+
+	if (edf_queued (cur) && --cur->rt_budget <= 0) {
+		cur->rt_throttled = true;
+		rt_throttle_cnt++;
+		intr_yield_on_return ();
+	}
+
+	for (e = list_begin (&rt_list); e != list_end (&rt_list);
+			 e = list_next (e))
+		{
+			struct thread *t = list_entry (e, struct thread, rtelem);
+			bool ready = t->status == THREAD_READY;
+
+			if (!t->rt_throttled || now < t->rt_release)
+				continue;
+			if (ready)
+				thread_ready_remove (t);
+			t->rt_deadline = t->rt_release + t->rt_rel_deadline;
+			t->rt_release += t->rt_period;
+			t->rt_budget = t->rt_runtime;
+			t->rt_throttled = false;
+			if (ready)
+				thread_ready_insert (t);
+			if (t == cur || !edf_queued (cur) || edf_preempts (t, cur))
+				intr_yield_on_return ();
 		}
+}
+
+/* Brings the vruntime of T, which is waking up, to no less than
+   CFS_GRANULARITY below its processor's min_vruntime.  That way
+   a thread that slept gets ahead of the others, but can't claim
+   all the time it spent asleep. */
+static void
+cfs_place (struct thread *t)
+{
+	int64_t floor = t->cpu->min_vruntime - CFS_GRANULARITY;
+
+	if (t->vruntime < floor)
+		t->vruntime = floor;
+}
+
+/* Returns true if ready thread T should preempt CUR, having run
+   CFS_GRANULARITY less than it. */
+static bool
+cfs_preempts (struct thread *t, struct thread *cur)
+{
+	return (cur != cur->cpu->idle
+					&& t->vruntime + CFS_GRANULARITY < cur->vruntime);
+}
+
+/* Takes ready thread T off its ready queue.  Interrupts must be
+   off. */
+static void
+thread_ready_remove (struct thread *t)
+{
+	struct cpu *c = t->cpu;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+	spin_lock (&c->rq_lock);
+	dequeue (c, t);
+	spin_unlock (&c->rq_lock);
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching ready queue if it is ready, or to its new place among
+   a semaphore's waiters if it is blocked on one.  Every change to the
+   priority of a thread that may be ready must go through here, to
+   keep the ready masks exact.  Interrupts must be off. */
+void
+thread_change_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (priority >= PRI_MIN && priority <= PRI_MAX);
+
+	if (t->status == THREAD_READY) {
+		thread_ready_remove (t);
+		t->priority = priority;
+		thread_ready_insert (t);
+	} else {
+		t->priority = priority;
+		if (t->status == THREAD_BLOCKED)
+			sema_requeue (t);
 	}
-	return idle_thread;
+}
+
+/* Returns true if some thread ready on this processor has a
+   priority higher than PRIORITY.  Interrupts must be off. */
+bool
+thread_ready_higher (int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+	return highest_ready_priority (cpu_current ()) > priority;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -698,10 +1529,21 @@ thread_schedule_tail (struct thread *prev)
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+	cur->cpu = cpu_current ();
+	fpu_switch (cur);
+#ifdef USERPROG
+	pmc_switch (prev, cur);
+#endif
 
   /* Start new time slice. */
-  thread_ticks = 0;
+  cur->cpu->slice_ticks = 0;
 	thread_priority = cur->priority;
+	if (cur->ready_since != 0) {
+		cur->wake_latency = timer_cycles () - cur->ready_since;
+		cur->ready_since = 0;
+	}
+	if (prev != NULL)
+		account_switch (prev, cur);
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -716,14 +1558,7 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread ) 
     {
       ASSERT (prev != cur);
-#ifdef USERPROG
-			/* We will not free the TCB til parent calls wait() function. 
-				Because we have to use exit_status value in wait(). */
-			if(!prev->is_process)
-				palloc_free_page (prev);
-#else
-      palloc_free_page (prev);
-#endif
+      thread_free_page (prev);
     }
 }
 
@@ -746,7 +1581,10 @@ schedule (void)
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      trace (TRACE_SWITCH, cur->tid, next->tid);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -773,66 +1611,258 @@ uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 void
 update_load_avg (void)
 {
-	fixed c1, c2;
+	const fixed c1 = FIXED_FRAC (59, 60);   /* Decay factor. */
+	const fixed c2 = FIXED_FRAC (1, 60);
 	int ready_threads;
+	unsigned i;
 
   ASSERT (intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
 
-	c1 = fdivn (itof(59), 60);    /* 59/60. Decay factor. */
-	c2 = fdivn (itof(1), 60);     /* 1/60 */
-	ready_threads = list_size (&ready_list);
-	ready_threads += (thread_current () == idle_thread ? 0 : 1);
+	ready_threads = thread_current () == cpu_current ()->idle ? 0 : 1;
+	for (i = 0; i < cpu_online; i++)
+		ready_threads += cpus[i].ready_cnt;
 
 	/* Set load_avg to new value. */
 	load_avg = fadd ( fmult(c1, load_avg) , fmultn(c2, ready_threads) );
 }
 
-/* Update recent_cpu value in evetry threads.
+/* Sets T's recent_cpu to C * recent_cpu + nice, one second's
+   worth of decay, and marks it for priority recalculation. */
+static void
+decay_recent_cpu (struct thread *t, fixed c)
+{
+	/* Mark that recent_cpu has changed. */
+	if(!t->rcc){
+		list_push_back (&rcc_list, &t->rccelem);
+		t->rcc = true;
+	}
+	t->recent_cpu = faddn (fmult (c, t->recent_cpu), t->nice);
+	t->rc_sec = mlfqs_sec;
+}
+
+/* Applies to T the decay of every second it spent blocked.
+   Seconds older than DECAY_HIST reuse the oldest coefficient
+   kept; by then recent_cpu has long converged anyway. */
+static void
+catch_up_recent_cpu (struct thread *t)
+{
+	unsigned missed = mlfqs_sec - t->rc_sec;
+	unsigned sec;
+
+	if (missed > DECAY_HIST) {
+		fixed oldest = decay_hist[(mlfqs_sec + 1) % DECAY_HIST];
+		unsigned n = missed - DECAY_HIST;
+		if (n > DECAY_HIST)
+			n = DECAY_HIST;
+		while (n-- > 0)
+			t->recent_cpu = faddn (fmult (oldest, t->recent_cpu), t->nice);
+		missed = DECAY_HIST;
+	}
+	for (sec = mlfqs_sec - missed + 1; sec != mlfqs_sec + 1; sec++)
+		decay_recent_cpu (t, decay_hist[sec % DECAY_HIST]);
+	t->rc_sec = mlfqs_sec;
+}
+
+/* Update recent_cpu value of the running and ready threads.
+   Blocked threads are brought up to date by thread_unblock().
    Used by devices/timer.c, once per sencond. */
 void
 update_recent_cpu (void)
 {
-	struct thread *t;
-	struct list_elem *e;
+	struct thread *cur = thread_current ();
+	fixed load_avg_2, c1;
+	unsigned n;
+	int i;
 
   ASSERT (intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
 
-  for (e = list_begin (&all_list); e != list_end (&all_list);
-       e = list_next (e))
-    {
-			fixed load_avg_2, c1;
+	load_avg_2 = fmultn (load_avg,2);   /* load_avg*2 */
+	c1 = fdiv (load_avg_2, faddn (load_avg_2, 1));  /* (load_avg*2)/(load_avg*2+1) */
+	mlfqs_sec++;
+	decay_hist[mlfqs_sec % DECAY_HIST] = c1;
+
+	if (cur != cpu_current ()->idle)
+		decay_recent_cpu (cur, c1);
+	for (n = 0; n < cpu_online; n++)
+		{
+			struct cpu *c = &cpus[n];
+
+			spin_lock (&c->rq_lock);
+			for (i = highest_ready_priority (c); i >= PRI_MIN; i--)
+				{
+					struct list_elem *e;
+
+					if (!(c->ready_mask & ((uint64_t) 1 << i)))
+						continue;
+					for (e = list_begin (&c->pri_list[i]);
+							 e != list_end (&c->pri_list[i]); e = list_next (e))
+						decay_recent_cpu (list_entry (e, struct thread, prielem), c1);
+				}
+			spin_unlock (&c->rq_lock);
+		}
+}
 
-			t = list_entry (e, struct thread, allelem);
-			load_avg_2 = fmultn (load_avg,2);   /* load_avg*2 */
+/* Returns the thread with TID, or a null pointer if there is
+   none.  A process that has exited is found until it is reaped. */
+struct thread *get_thread_by_tid (tid_t tid){
+	struct list *bucket = &tid_buckets[tid % TID_BUCKETS];
+	struct thread *found = NULL;
+	struct list_elem *e;
+	enum intr_level old_level = intr_disable ();
 
-			/* Mark that recent_cpu has changed. */
-			if(!t->rcc){
-				list_push_back (&rcc_list, &t->rccelem);
-				t->rcc = true;
-			}
-			c1 = fdiv (load_avg_2, faddn (load_avg_2, 1));  /* (load_avg*2)/(load_avg*2+1) */
+	for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+		{
+			struct thread *t = list_entry (e, struct thread, tidelem);
+			if (t->tid == tid)
+				{
+					found = t;
+					break;
+				}
+		}
+	intr_set_level (old_level);
+	return found;
+}
+
+#ifdef USERPROG
+/* Drops a reference to C, freeing it with the last one. */
+static void
+child_release (struct child *c)
+{
+	enum intr_level old_level = intr_disable ();
+	bool last;
+
+	spin_lock (&child_lock);
+	last = --c->ref_cnt == 0;
+	spin_unlock (&child_lock);
+	intr_set_level (old_level);
+	if (last)
+		free (c);
+}
 
-			/* Set recent_cpu to new value. */
-			t->recent_cpu = faddn (fmult (c1, t->recent_cpu), t->nice);
+/* Drops T's records of its children, which it is exiting without
+   waiting for.  Those still running free them when they exit. */
+static void
+orphan_children (struct thread *t)
+{
+	while (!list_empty (&t->children))
+		{
+			struct child *c = list_entry (list_pop_front (&t->children),
+					struct child, elem);
+			enum intr_level old_level = intr_disable ();
+
+			/* T's exited_children goes away with T. */
+			c->parent = NULL;
+			c->exit_queued = false;
+			intr_set_level (old_level);
+			child_release (c);
 		}
 }
 
-/* Search thread that has the tid in all_list. */
-struct thread *get_thread_by_tid (tid_t tid){
-	
-	struct thread *t;
+/* Finds the running process's record of its child TID, removing
+   it from the process's children if TAKE. */
+static struct child *
+find_child (tid_t tid, bool take)
+{
+	struct list *children = &thread_current ()->process->children;
+	struct child *found = NULL;
 	struct list_elem *e;
+	enum intr_level old_level;
 
-  for (e = list_begin (&all_list); e != list_end (&all_list);
-       e = list_next (e))
-    {
-			t = list_entry (e, struct thread, allelem);
-			if ( t->tid == tid ){
-				return t;
+	/* Other threads of the process add and take children too. */
+	old_level = intr_disable ();
+	for (e = list_begin (children); e != list_end (children); e = list_next (e))
+		{
+			struct child *c = list_entry (e, struct child, elem);
+			if (c->tid == tid) {
+				if (take) {
+					list_remove (e);
+					if (c->exit_queued) {
+						list_remove (&c->exit_elem);
+						c->exit_queued = false;
+					}
+				}
+				found = c;
+				break;
 			}
 		}
-	return NULL;
+	intr_set_level (old_level);
+	return found;
 }
 
+/* Returns the running process's record of its child TID, or a
+   null pointer if it has no such child or one of its threads has
+   already waited for it.  Its threads from thread_spawn() count as
+   children too. */
+struct child *
+thread_get_child (tid_t tid)
+{
+	return find_child (tid, false);
+}
+
+/* Like thread_get_child(), but takes the record out of the
+   process's children, so that only the caller waits for the
+   child.  Pass it to thread_reap_child() once the child has
+   exited. */
+struct child *
+thread_take_child (tid_t tid)
+{
+	return find_child (tid, true);
+}
+
+/* Returns true if the children of process P include a process,
+   as opposed to threads from thread_spawn().  Interrupts must be
+   off. */
+static bool
+has_child_process (struct thread *p)
+{
+	struct list_elem *e;
+
+	for (e = list_begin (&p->children); e != list_end (&p->children);
+			 e = list_next (e))
+		if (list_entry (e, struct child, elem)->parent != NULL)
+			return true;
+	return false;
+}
+
+/* Like thread_take_child(), but for whichever child process of
+   the running process exits first, waiting for one to if none
+   has yet.  Returns a null pointer at once if the process has no
+   child processes left to wait for. */
+struct child *
+thread_take_exited_child (void)
+{
+	struct thread *p = thread_current ()->process;
+	struct child *c = NULL;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	for (;;)
+		{
+			if (!list_empty (&p->exited_children)) {
+				c = list_entry (list_pop_front (&p->exited_children),
+						struct child, exit_elem);
+				c->exit_queued = false;
+				list_remove (&c->elem);
+				break;
+			}
+			if (!has_child_process (p))
+				break;
+			/* Ups for children since waited for by tid are left over,
+			   so this may come back with nothing queued. */
+			sema_down (&p->child_exited);
+		}
+	intr_set_level (old_level);
+	return c;
+}
+
+/* Forgets C, a record from thread_take_child() of a child that has
+   exited. */
+void
+thread_reap_child (struct child *c)
+{
+	child_release (c);
+}
+#endif
+
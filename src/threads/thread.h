@@ -4,10 +4,40 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
-#include <hash.h>
+#include <intmap.h>
+#include <rbtree.h>
 #include "threads/fixed-point.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 
+struct vma;
+struct cpu;
+
+#ifdef VM
+/* What served a page fault. */
+enum fault_type
+  {
+    FAULT_FILE,         /* Read from a file, or shared with another
+                           process that had read it. */
+    FAULT_SWAP,         /* Swapped back in. */
+    FAULT_ZERO,         /* Zero-filled. */
+    FAULT_STACK,        /* Zero-filled stack page. */
+    FAULT_COW,          /* Copied on write after fork. */
+    FAULT_TYPE_CNT
+  };
+
+/* Page fault counts of a process, or of all of them. */
+struct fault_stats
+  {
+    unsigned type_cnt[FAULT_TYPE_CNT];  /* Faults by enum fault_type. */
+    unsigned major_cnt;                 /* Faults that waited for I/O. */
+    unsigned minor_cnt;                 /* Faults served from memory. */
+    unsigned evict_cnt;                 /* Frames evicted to serve them. */
+    unsigned swapin_cnt;                /* Pages read from swap. */
+    unsigned swapout_cnt;               /* Pages written to swap. */
+  };
+#endif
+
 /* States in a thread's life cycle. */
 enum thread_status
   {
@@ -17,6 +47,18 @@ enum thread_status
     THREAD_DYING        /* About to be destroyed. */
   };
 
+/* Where a thread's time goes, for CPU time accounting. */
+enum cpu_time
+  {
+    CPU_USER,           /* Running in user mode. */
+    CPU_KERNEL,         /* Running in the kernel. */
+    CPU_LOCK_WAIT,      /* Blocked acquiring a lock. */
+    CPU_IO_WAIT,        /* Blocked on disk or console I/O. */
+    CPU_READY,          /* Ready but not running. */
+    CPU_SLEEP,          /* Blocked otherwise. */
+    CPU_TIME_CNT
+  };
+
 /* Thread identifier type.
    You can redefine this to whatever type you like. */
 typedef int tid_t;
@@ -30,6 +72,31 @@ typedef int tid_t;
 #define NICE_DEFAULT 0                  /* Default nice. */
 #define NICE_MAX 20                     /* Highest nice. */
 
+#ifdef USERPROG
+/* What a parent keeps of a child process, so that it can wait for
+   the child after the child's struct thread has been freed. */
+struct child
+  {
+    tid_t tid;                          /* The child's thread id. */
+    int exit_status;                    /* Its exit status, once exited. */
+    bool load_failed;                   /* Whether it failed to load. */
+    int ref_cnt;                        /* References: parent, child. */
+    struct semaphore loaded;            /* Upped once it has loaded or
+                                           failed to. */
+    struct semaphore exited;            /* Upped when it exits. */
+    struct list_elem elem;              /* Element in parent's children. */
+    struct thread *parent;              /* Process to tell when it exits,
+                                           or null for a thread from
+                                           thread_spawn() or an orphan. */
+    bool exit_queued;                   /* In parent's exited_children? */
+    struct list_elem exit_elem;         /* Element there. */
+  };
+
+/* Files one system call may keep open, against close() by other
+   threads of its process, at a time.  See get_file_by_fd(). */
+#define FD_PINS 2
+#endif
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -88,52 +155,155 @@ typedef int tid_t;
    blocked state is on a semaphore wait list. */
 struct thread
   {
-    /* Owned by thread.c. */
-    tid_t tid;                          /* Thread identifier. */
+    /* Owned by thread.c.  What schedule() and the ready queues
+       touch on every switch comes first, with ELEM below, so that it
+       shares the first cache line. */
     enum thread_status status;          /* Thread state. */
-    char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
     int priority;                       /* Priority. */
+    struct cpu *cpu;                    /* Processor it last ran on, whose
+                                           ready queue it joins. */
+    int64_t vruntime;                   /* Weighted run time, for -cfs. */
+    int64_t run_ticks;                  /* Timer ticks spent running. */
+    struct rb_elem rbelem;              /* Element in a -cfs ready tree. */
+
+    /* Shared between thread.c and synch.c. */
+    struct list_elem elem;              /* List element. */
+
+    /* Owned by thread.c. */
+    tid_t tid;                          /* Thread identifier. */
+    char name[16];                      /* Name (for debugging purposes). */
     int nice;                           /* Nice. How nice to other threads. */
 		fixed recent_cpu;                   /* Recent CPU. how much CPU time each process
 																					 has received recently. */
     struct list_elem allelem;           /* List element for all threads list. */
-    struct list_elem sleepelem;         /* List element for sleeping threads list. */
+    struct list_elem tidelem;           /* Element in a tid bucket. */
     struct list_elem prielem;           /* List element for all threads list. */
 		struct list_elem rccelem;           /* List element for recent_cpu changed list. */
 		bool rcc;                           /* If recent_cpu changed, it's true. It also means
 																				   whether rccelem is in the rcc_list or not. */
-
-    /* Owned by timer.c. */
-    int64_t awake_tick;                 /* The time when sleeping thread to awake. */
-
-    /* Shared between thread.c and synch.c. */
-    struct list_elem elem;              /* List element. */
+		unsigned rc_sec;                    /* Second up to which recent_cpu has been
+																				   decayed.  Lags behind while blocked. */
+		uint64_t ready_since;               /* timer_cycles() when last unblocked,
+                                           or 0 once it has run since. */
+		uint64_t wake_latency;              /* Cycles from the last unblock until
+                                           it next ran. */
+		uint64_t cpu_times[CPU_TIME_CNT];   /* TSC cycles spent each way. */
+		uint64_t cpu_stamp;                 /* timer_cycles() when it began to
+                                           spend them as CPU_STATE says. */
+		uint8_t cpu_state;                  /* enum cpu_time it is in now. */
+		uint8_t block_time;                 /* enum cpu_time its blocks count as. */
+		int io_boost;                       /* -mlfqs: levels added to its priority
+                                           on waking from I/O, halved each
+                                           tick it runs. */
+		int64_t rt_runtime;                 /* Deadline class: ticks of CPU per */
+		int64_t rt_period;                  /* period of this many ticks, due */
+		int64_t rt_rel_deadline;            /* this many ticks after each period
+                                           starts.  Zero period if not in it. */
+		int64_t rt_deadline;                /* Tick the current job is due. */
+		int64_t rt_release;                 /* Tick the next period starts. */
+		int64_t rt_budget;                  /* Ticks the current job has left. */
+		bool rt_throttled;                  /* Out of budget until rt_release:
+                                           scheduled by priority meanwhile. */
+		struct rb_elem edfelem;             /* Element in an EDF ready tree. */
+		struct list_elem rtelem;            /* Element in the deadline class. */
 
     /* Owned by synch.c. */
     struct thread *donated_for;         /* If this thread donated it's priority to thread A, 
 																					 then A is stored in this variable. */
     struct lock *donated_to_get;        /* The acquired lock when donation has occured. */
-    struct list hold_list;              /* List of held locks. */
+    uint64_t boost_mask;                /* Bit N set iff boost_cnt[N] > 0. */
+    uint8_t boost_cnt[PRI_MAX + 1];     /* Held locks that boost it to
+                                           each priority. */
+    struct semaphore *wait_sema;        /* Semaphore it is blocked on,
+                                           or null. */
     int original_priority;              /* Original priority. */
+
+    /* Owned by malloc.c. */
+    struct magazine mags[MAG_CLASSES];  /* Small free blocks. */
+
+    /* Owned by threads/fpu.c. */
+    void *fpu;                          /* Saved FPU state, or null if
+                                           the FPU was never used. */
+
+#ifdef USERPROG
+    /* Owned by threads/pmc.c. */
+    struct pmc_totals *pmc;             /* Counter totals of the process,
+                                           if it asked for them, or null. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Journal operations begun and
+                                           not yet ended. */
+#endif
 		
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
 		int exit_status;                    /* Saved return value(main()) of this process. */
-		struct semaphore exit_wait_sema;    /* For parent to wait this thread. */
-		int lastfd;                         /* Last value of allocated file descriptor. */
-		struct list open_list;              /* List of opend files. */
-		struct semaphore loaded;            /* For parent to wait until finish of loading. */
-		bool load_failed;                   /* Tells to parent whether loading is failed. */
+		struct file **fds;                  /* Open files, indexed by file
+                                           descriptor - FD_MIN. */
+		uint32_t *fd_used;                  /* Bitmap of the slots of FDS in use. */
+		size_t fd_cap;                      /* Slots allocated in FDS. */
+		struct dir *cwd;                    /* Current directory, or null
+                                           for the root. */
+		struct list aio_list;               /* Outstanding asynchronous I/O. */
+		int next_aio_id;                    /* Id of the next one. */
 		struct file *my_binary;             /* The binary excutable file of this process. */
 		bool is_process;                    /* Whether if it is a user process. */
+		struct child *child;                /* This process's record in its
+                                           parent's children. */
+		struct list children;               /* Records of child processes not
+                                           yet waited for. */
+		struct list exited_children;        /* Those of them that have exited,
+                                           in the order they did. */
+		struct semaphore child_exited;      /* Upped as each is queued there. */
 		bool in_syscall;                    /* Whether if this process called a system call.  */
+		struct file *fd_pins[FD_PINS];      /* Files the current system call uses,
+                                           kept open against other threads'
+                                           close(). */
+		unsigned next_fd_pin;               /* Slot of FD_PINS to use next. */
+
+		/* The page directory, file descriptors, current directory,
+		   executable and children above, and the VM members below,
+		   belong to the process as a whole.  A thread from
+		   thread_spawn() leaves its own unused and uses those of
+		   PROCESS, the thread that started the process, which outlives
+		   it. */
+		struct thread *process;             /* Owner of the process's state:
+                                           this thread, unless it came from
+                                           thread_spawn(). */
+		struct lock proc_lock;              /* Guards the file descriptor table
+                                           and the members below against
+                                           the threads sharing them. */
+		int thread_cnt;                     /* Threads from thread_spawn()
+                                           sharing them, still alive. */
+		bool exiting;                       /* Whether exit() was called. */
+		struct semaphore thread_gone;       /* Upped as each of those ends. */
+		uint64_t exited_times[CPU_TIME_CNT];/* Their cpu_times, once ended. */
+		struct list futex_waiters;          /* Threads in futex_wait(). */
 #endif
 #ifdef VM
-		struct hash spt;                    /* SPT(Supplemental Page Table).
-                                           Implemented by hash table. */
+		struct intmap spt;                  /* SPT(Supplemental Page Table).
+                                           SPTEs by page number. */
+		struct vma *vmas;                   /* Regions, sorted by address. */
+		size_t vma_cnt, vma_cap;            /* Regions used, allocated. */
+		int next_mapid;                     /* Id of the next mapped file. */
+		uint8_t *heap_start;                /* First page of the heap. */
+		uint8_t *brk;                       /* End of the heap. */
+		struct fault_stats faults;          /* Page fault counts. */
+		size_t rss;                         /* Frames it maps, shared ones
+                                           included. */
+		size_t rss_hand;                    /* Frame table index where the next
+                                           search for a frame of its own to
+                                           evict starts. */
+		bool vm_suspended;                  /* Stopped by load control. */
+		size_t locked_cnt;                  /* Pages locked by mlock(). */
+		struct lock mm_lock;                /* Serializes page faults and
+                                           changes to the regions among the
+                                           threads of the process. */
 #endif
 
     /* Owned by thread.c. */
@@ -145,33 +315,50 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, use the fair-share scheduler instead.  Controlled by
+   kernel command-line option "-cfs". */
+extern bool thread_cfs;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+bool thread_set_deadline (int64_t runtime, int64_t period, int64_t deadline);
+bool thread_set_slices (const char *);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_unblock_batch (struct list *);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
 const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
+void thread_free_page (struct thread *);
 void thread_yield (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
 void thread_foreach (thread_action_func *, void *);
 
+void thread_account (enum cpu_time);
+enum cpu_time thread_set_block_time (enum cpu_time);
+void thread_add_times (struct thread *, uint64_t times[CPU_TIME_CNT]);
+void thread_add_system_times (uint64_t times[CPU_TIME_CNT]);
+
+void thread_change_priority (struct thread *, int priority);
+bool thread_ready_higher (int priority);
+
 int thread_get_priority (void);
 void thread_set_priority (int);
 
 int thread_get_nice (void);
+int thread_boosted_priority (const struct thread *, int priority);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
@@ -180,5 +367,11 @@ void update_load_avg(void);
 void update_recent_cpu(void);
 
 struct thread *get_thread_by_tid (tid_t tid);
+#ifdef USERPROG
+struct child *thread_get_child (tid_t);
+struct child *thread_take_child (tid_t);
+struct child *thread_take_exited_child (void);
+void thread_reap_child (struct child *);
+#endif
 
 #endif /* threads/thread.h */
@@ -0,0 +1,172 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Size of each processor's ring. */
+#define TRACE_PAGES 16
+#define TRACE_RECORDS (TRACE_PAGES * PGSIZE / sizeof (struct trace_record))
+
+/* A processor's ring of recent events. */
+struct trace_ring
+  {
+    struct trace_record *buf;   /* TRACE_RECORDS records, or null. */
+    unsigned cnt;               /* Records ever written. */
+  };
+
+bool trace_enabled;
+
+static struct trace_ring rings[CPU_MAX];
+
+/* Allocates the rings, if tracing.  Must be called after
+   palloc_init() and cpu_probe(). */
+void
+trace_init (void)
+{
+  unsigned i;
+
+  if (!trace_enabled)
+    return;
+  for (i = 0; i < cpu_cnt && i < CPU_MAX; i++)
+    {
+      rings[i].buf = palloc_get_multiple (0, TRACE_PAGES);
+      if (rings[i].buf == NULL)
+        PANIC ("no memory for trace buffers");
+    }
+}
+
+/* Appends EVENT with arguments A and B to the running processor's
+   ring.  Called by trace(), from any context. */
+void
+trace_record (enum trace_event event, uint32_t a, uint32_t b)
+{
+  enum intr_level old_level = intr_disable ();
+  struct cpu *c = cpu_current ();
+  struct trace_ring *r = &rings[c->id];
+
+  if (r->buf != NULL)
+    {
+      struct trace_record *rec = &r->buf[r->cnt++ % TRACE_RECORDS];
+      uint32_t *esp;
+
+      /* Unlike thread_current(), this works mid-switch too. */
+      asm ("mov %%esp, %0" : "=g" (esp));
+      rec->time = timer_now_ns ();
+      rec->tid = ((struct thread *) pg_round_down (esp))->tid;
+      rec->cpu = c->id;
+      rec->event = event;
+      rec->arg[0] = a;
+      rec->arg[1] = b;
+    }
+  intr_set_level (old_level);
+}
+
+/* Writes bytes to consecutive sectors of a block device. */
+struct sector_writer
+  {
+    struct block *block;
+    block_sector_t sector;      /* Next sector to write. */
+    size_t ofs;                 /* Bytes in BUF. */
+    uint8_t buf[BLOCK_SECTOR_SIZE];
+  };
+
+/* Appends SIZE bytes from DATA, and returns false if the device
+   is full. */
+static bool
+put_bytes (struct sector_writer *w, const void *data, size_t size)
+{
+  const uint8_t *p = data;
+
+  while (size > 0)
+    {
+      size_t chunk = BLOCK_SECTOR_SIZE - w->ofs;
+
+      if (w->sector >= block_size (w->block))
+        return false;
+      if (chunk > size)
+        chunk = size;
+      memcpy (w->buf + w->ofs, p, chunk);
+      w->ofs += chunk;
+      p += chunk;
+      size -= chunk;
+      if (w->ofs == BLOCK_SECTOR_SIZE)
+        {
+          block_write (w->block, w->sector++, w->buf);
+          w->ofs = 0;
+        }
+    }
+  return true;
+}
+
+/* Stops tracing and writes the rings to the scratch device, if
+   tracing.  Must be called with interrupts on, so it does nothing
+   in a panic. */
+void
+trace_dump (void)
+{
+  static struct sector_writer w;
+  struct trace_header h;
+  unsigned i, j;
+
+  if (!trace_enabled || intr_get_level () == INTR_OFF)
+    return;
+  trace_enabled = false;
+
+  w.block = block_get_role (BLOCK_SCRATCH);
+  if (w.block == NULL)
+    {
+      printf ("Trace: no scratch device to write the trace to\n");
+      return;
+    }
+
+  memset (&h, 0, sizeof h);
+  memcpy (h.magic, "PINTRACE", sizeof h.magic);
+  h.version = TRACE_VERSION;
+  h.record_size = sizeof (struct trace_record);
+  for (i = 0; i < CPU_MAX; i++)
+    if (rings[i].buf != NULL)
+      {
+        unsigned kept = (rings[i].cnt < TRACE_RECORDS
+                         ? rings[i].cnt : TRACE_RECORDS);
+        h.record_cnt += kept;
+        h.lost_cnt += rings[i].cnt - kept;
+      }
+
+  /* Records go after the header's sector. */
+  w.sector = 1;
+  w.ofs = 0;
+  for (i = 0; i < CPU_MAX; i++)
+    {
+      struct trace_ring *r = &rings[i];
+      unsigned first = r->cnt < TRACE_RECORDS ? 0 : r->cnt - TRACE_RECORDS;
+
+      if (r->buf == NULL)
+        continue;
+      for (j = first; j != r->cnt; j++)
+        if (!put_bytes (&w, &r->buf[j % TRACE_RECORDS], sizeof *r->buf))
+          {
+            h.lost_cnt += r->cnt - j;
+            h.record_cnt -= r->cnt - j;
+            break;
+          }
+    }
+  if (w.ofs > 0)
+    {
+      memset (w.buf + w.ofs, 0, BLOCK_SECTOR_SIZE - w.ofs);
+      block_write (w.block, w.sector, w.buf);
+    }
+
+  memset (w.buf, 0, sizeof w.buf);
+  memcpy (w.buf, &h, sizeof h);
+  block_write (w.block, 0, w.buf);
+  printf ("Trace: %"PRIu32" events written to %s, %"PRIu32" lost\n",
+          h.record_cnt, block_name (w.block), h.lost_cnt);
+}
@@ -0,0 +1,69 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Event tracing.
+
+   With -trace, tracepoints throughout the kernel append
+   fixed-size binary records to a ring of recent events kept for
+   each processor, which costs far less, and disturbs timing far
+   less, than printing.  At power off the rings are written to
+   the scratch device, from which utils/trace-decode prints them
+   as a timeline. */
+
+/* Traced events.  utils/trace-decode knows these by number. */
+enum trace_event
+  {
+    TRACE_SWITCH,       /* Context switch: old tid, new tid. */
+    TRACE_BLOCK,        /* Thread blocked: caller's address. */
+    TRACE_UNBLOCK,      /* Thread woken: its tid. */
+    TRACE_FAULT,        /* Page fault: address, error code. */
+    TRACE_EVICT,        /* Frame evicted: frame, swap slot. */
+    TRACE_IDE_READ,     /* Disk read: sector, sector count. */
+    TRACE_IDE_WRITE,    /* Disk write: sector, sector count. */
+    TRACE_SYSCALL,      /* System call: number, first argument. */
+    TRACE_EVENT_CNT
+  };
+
+/* A traced event, as written to the scratch device. */
+struct trace_record
+  {
+    int64_t time;       /* Nanoseconds since boot. */
+    int32_t tid;        /* Running thread. */
+    uint16_t cpu;       /* Processor. */
+    uint16_t event;     /* One of TRACE_*. */
+    uint32_t arg[2];    /* Event-specific arguments. */
+  };
+
+/* Header in the first sector of a dump, followed by RECORD_CNT
+   records packed back to back, oldest first for each
+   processor. */
+struct trace_header
+  {
+    char magic[8];              /* "PINTRACE". */
+    uint32_t version;           /* TRACE_VERSION. */
+    uint32_t record_size;       /* sizeof (struct trace_record). */
+    uint32_t record_cnt;        /* Records that follow. */
+    uint32_t lost_cnt;          /* Records overwritten or cut off. */
+  };
+#define TRACE_VERSION 1
+
+/* If false (default), nothing is traced.
+   If true, set by the kernel command-line option "-trace". */
+extern bool trace_enabled;
+
+void trace_init (void);
+void trace_record (enum trace_event, uint32_t, uint32_t);
+void trace_dump (void);
+
+/* Records EVENT with arguments A and B, if tracing. */
+static inline void
+trace (enum trace_event event, uint32_t a, uint32_t b)
+{
+  if (trace_enabled)
+    trace_record (event, a, b);
+}
+
+#endif /* threads/trace.h */
@@ -63,6 +63,13 @@ static inline void *pg_round_down (const void *va) {
    virtual address space belongs to the kernel. */
 #define	PHYS_BASE ((void *) LOADER_PHYS_BASE)
 
+/* Kernel virtual addresses from VMALLOC_BASE to VMALLOC_END are
+   not mapped to physical memory one-to-one, as those from
+   PHYS_BASE up are: vmalloc() maps scattered pages there.  RAM
+   must end below VMALLOC_BASE - PHYS_BASE. */
+#define VMALLOC_BASE ((void *) 0xf0000000)
+#define VMALLOC_END ((void *) 0xf1000000)      /* 16 MB. */
+
 /* Returns true if VADDR is a user virtual address. */
 static inline bool
 is_user_vaddr (const void *vaddr) 
@@ -77,6 +84,13 @@ is_kernel_vaddr (const void *vaddr)
   return vaddr >= PHYS_BASE;
 }
 
+/* Returns true if VADDR lies in the vmalloc() range. */
+static inline bool
+is_vmalloc_vaddr (const void *vaddr)
+{
+  return vaddr >= VMALLOC_BASE && vaddr < VMALLOC_END;
+}
+
 /* Returns kernel virtual address at which physical address PADDR
    is mapped. */
 static inline void *
@@ -93,17 +107,40 @@ static inline uintptr_t
 vtop (const void *vaddr)
 {
   ASSERT (is_kernel_vaddr (vaddr));
+  ASSERT (!is_vmalloc_vaddr (vaddr));
 
   return (uintptr_t) vaddr - (uintptr_t) PHYS_BASE;
 }
 
+/* Sets the page at KPAGE to zeros. */
+static inline void
+zero_page (void *kpage)
+{
+  size_t cnt = PGSIZE / 4;
+
+  ASSERT (pg_ofs (kpage) == 0);
+  asm volatile ("rep stosl"
+                : "+D" (kpage), "+c" (cnt) : "a" (0) : "memory");
+}
+
+/* Copies the page at SRC to the page at DST. */
+static inline void
+copy_page (void *dst, const void *src)
+{
+  size_t cnt = PGSIZE / 4;
+
+  ASSERT (pg_ofs (dst) == 0 && pg_ofs (src) == 0);
+  asm volatile ("rep movsl"
+                : "+D" (dst), "+S" (src), "+c" (cnt) : : "memory");
+}
+
 #ifdef USERPROG
 /* Returns physical address at which user virtual address VADDR
    is mapped. */
 static inline uintptr_t
 user_vtop (const void *vaddr)
 {
-	struct thread *t = thread_current ();
+	struct thread *t = thread_current ()->process;
 
 	ASSERT (is_user_vaddr (vaddr));
 
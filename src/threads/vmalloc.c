@@ -0,0 +1,130 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include "threads/init.h"
+#include "threads/loader.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Pages in the vmalloc() range. */
+#define VMALLOC_PAGES \
+  (((uintptr_t) VMALLOC_END - (uintptr_t) VMALLOC_BASE) / PGSIZE)
+
+/* Page tables for the whole range, contiguous, so that the PTE
+   for its Nth page is ptes[N].  They are put in init_page_dir
+   before any other page directory copies it, so every page
+   directory shares them. */
+static uint32_t *ptes;
+
+/* Pages of the range in use.  Each allocation is followed by an
+   unmapped guard page, which counts as in use with it. */
+static struct bitmap *used_map;
+static struct lock vmalloc_lock;
+
+/* Sets up the page tables of the vmalloc() range. */
+void
+vmalloc_init (void)
+{
+  size_t pt_cnt = VMALLOC_PAGES / (PTSPAN / PGSIZE);
+  size_t i;
+
+  ASSERT (ptov (init_ram_pages * PGSIZE) <= VMALLOC_BASE);
+  ASSERT (pt_no (VMALLOC_BASE) == 0 && pt_no (VMALLOC_END) == 0);
+
+  ptes = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, pt_cnt);
+  for (i = 0; i < pt_cnt; i++)
+    init_page_dir[pd_no (VMALLOC_BASE) + i]
+      = pde_create (ptes + i * (PTSPAN / PGSIZE));
+
+  used_map = bitmap_create (VMALLOC_PAGES);
+  if (used_map == NULL)
+    PANIC ("vmalloc: out of memory");
+  lock_init (&vmalloc_lock);
+}
+
+/* Returns the address of page IDX of the range. */
+static void *
+idx_to_page (size_t idx)
+{
+  return (uint8_t *) VMALLOC_BASE + idx * PGSIZE;
+}
+
+/* Unmaps and frees the PAGE_CNT pages starting at page IDX of the
+   range, and gives back their addresses and the guard page's. */
+static void
+unmap_pages (size_t idx, size_t page_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      uint32_t pte = ptes[idx + i];
+      void *page = idx_to_page (idx + i);
+
+      ASSERT (pte & PTE_P);
+      ptes[idx + i] = 0;
+      asm volatile ("invlpg (%0)" : : "r" (page) : "memory");
+      palloc_free_page (pte_get_page (pte));
+    }
+
+  lock_acquire (&vmalloc_lock);
+  bitmap_set_multiple (used_map, idx, page_cnt + 1, false);
+  lock_release (&vmalloc_lock);
+}
+
+/* Obtains PAGE_CNT pages from the kernel pool, which need not be
+   contiguous, and returns them mapped at contiguous kernel
+   virtual addresses.  FLAGS are as for palloc_get_multiple(),
+   without PAL_USER.  Returns a null pointer if pages or addresses
+   run out, unless PAL_ASSERT is set. */
+void *
+vmalloc (enum palloc_flags flags, size_t page_cnt)
+{
+  size_t idx, i;
+
+  ASSERT (!(flags & PAL_USER));
+  if (page_cnt == 0)
+    return NULL;
+
+  lock_acquire (&vmalloc_lock);
+  idx = bitmap_scan_and_flip (used_map, 0, page_cnt + 1, false);
+  lock_release (&vmalloc_lock);
+
+  for (i = 0; idx != BITMAP_ERROR && i < page_cnt; i++)
+    {
+      void *page = palloc_get_page (flags & ~PAL_ASSERT);
+
+      if (page == NULL)
+        {
+          unmap_pages (idx, i);
+          idx = BITMAP_ERROR;
+          break;
+        }
+      ptes[idx + i] = pte_create_kernel (page, true);
+    }
+
+  if (idx == BITMAP_ERROR)
+    {
+      if (flags & PAL_ASSERT)
+        PANIC ("vmalloc: out of pages");
+      return NULL;
+    }
+  return idx_to_page (idx);
+}
+
+/* Frees the PAGE_CNT pages at PAGES, which vmalloc() returned. */
+void
+vfree (void *pages, size_t page_cnt)
+{
+  size_t idx = pg_no (pages) - pg_no (VMALLOC_BASE);
+
+  if (pages == NULL)
+    return;
+  ASSERT (is_vmalloc_vaddr (pages));
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (bitmap_all (used_map, idx, page_cnt));
+
+  unmap_pages (idx, page_cnt);
+}
@@ -0,0 +1,19 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stddef.h>
+#include "threads/palloc.h"
+
+/* Virtually contiguous allocations.
+
+   vmalloc() takes PAGE_CNT pages one by one from the kernel pool
+   and maps them next to each other between VMALLOC_BASE and
+   VMALLOC_END, so it works even where palloc_get_multiple()
+   finds no physically contiguous run.  The memory may not be
+   passed to vtop(), so it is unfit for DMA. */
+
+void vmalloc_init (void);
+void *vmalloc (enum palloc_flags, size_t page_cnt);
+void vfree (void *, size_t page_cnt);
+
+#endif /* threads/vmalloc.h */
@@ -0,0 +1,154 @@
+#include "threads/worker.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Each queue starts with one worker, so that work queued from
+   an interrupt handler always has someone to run it, and grows
+   whenever work is queued from a thread while every worker is
+   busy, up to WORKER_MAX.  Workers then stay around waiting for
+   more.
+
+   A queue's list and counters are shared with interrupt
+   handlers, so they are only touched with interrupts off. */
+#define WORKER_MAX 8
+
+struct pool
+  {
+    const char *name;           /* Name of the workers. */
+    int priority;               /* Priority of the workers. */
+    struct list queue;          /* Queued work, oldest first. */
+    int queued_cnt;             /* Number of items in QUEUE. */
+    struct semaphore pending;   /* Upped once per queued item. */
+    int worker_cnt;             /* Number of workers. */
+    int idle_cnt;               /* Workers waiting for work. */
+  };
+
+static struct pool pools[WQ_CNT];
+
+static thread_func worker NO_RETURN;
+static bool spawn_worker (struct pool *);
+
+/* Initializes the worker queues and starts their first workers.
+   Must be called after thread_start(). */
+void
+worker_init (void)
+{
+  static const char *names[WQ_CNT] = {"work-high", "work", "work-low"};
+  static const int priorities[WQ_CNT] = {PRI_MAX, PRI_DEFAULT, PRI_MIN + 1};
+  int i;
+
+  for (i = 0; i < WQ_CNT; i++)
+    {
+      struct pool *p = &pools[i];
+
+      p->name = names[i];
+      p->priority = priorities[i];
+      list_init (&p->queue);
+      sema_init (&p->pending, 0);
+      p->worker_cnt = p->idle_cnt = p->queued_cnt = 0;
+      if (!spawn_worker (p))
+        PANIC ("can't start %s thread", p->name);
+    }
+}
+
+/* Initializes W to call FUNC with AUX. */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->queued = false;
+}
+
+/* Queues W to be run by a worker of queue Q.  Returns false,
+   doing nothing, if W is already waiting to run.  May be called
+   from an interrupt handler.  Otherwise another worker is
+   started first if all of Q's workers are busy. */
+bool
+work_queue (enum work_queue q, struct work *w)
+{
+  struct pool *p;
+  enum intr_level old_level;
+  bool spawn;
+
+  ASSERT (q < WQ_CNT);
+  p = &pools[q];
+
+  old_level = intr_disable ();
+  if (w->queued)
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  w->queued = true;
+  list_push_back (&p->queue, &w->elem);
+  p->queued_cnt++;
+  spawn = (!intr_context ()
+           && p->idle_cnt < p->queued_cnt
+           && p->worker_cnt < WORKER_MAX);
+  intr_set_level (old_level);
+
+  /* If the worker can't be had, the ones there are catch up. */
+  if (spawn)
+    spawn_worker (p);
+  sema_up (&p->pending);
+  return true;
+}
+
+/* Queues W on the normal-priority queue. */
+void
+work_submit (struct work *w)
+{
+  work_queue (WQ_NORMAL, w);
+}
+
+/* Starts another worker for P.  Returns true if successful. */
+static bool
+spawn_worker (struct pool *p)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  p->worker_cnt++;
+  intr_set_level (old_level);
+
+  if (thread_create (p->name, p->priority, worker, p) != TID_ERROR)
+    return true;
+
+  old_level = intr_disable ();
+  p->worker_cnt--;
+  intr_set_level (old_level);
+  return false;
+}
+
+/* Worker thread.  Runs work items queued on P_ one at a time. */
+static void
+worker (void *p_)
+{
+  struct pool *p = p_;
+
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct work *w;
+
+      old_level = intr_disable ();
+      p->idle_cnt++;
+      intr_set_level (old_level);
+
+      sema_down (&p->pending);
+
+      old_level = intr_disable ();
+      p->idle_cnt--;
+      w = list_entry (list_pop_front (&p->queue), struct work, elem);
+      p->queued_cnt--;
+      w->queued = false;
+      intr_set_level (old_level);
+
+      w->func (w->aux);
+    }
+}
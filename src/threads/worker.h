@@ -0,0 +1,43 @@
+#ifndef THREADS_WORKER_H
+#define THREADS_WORKER_H
+
+#include <list.h>
+#include <stdbool.h>
+
+/* Kernel worker threads.
+
+   A work item is a function to be called, with its auxiliary
+   data, by one of a pool of kernel threads.  It spares a caller
+   that needs something done in the background from creating a
+   thread for it, and lets an interrupt handler hand off work
+   that may sleep or take long.  Each queue has its own workers,
+   running at the queue's priority. */
+
+typedef void work_func (void *aux);
+
+/* Work queues, by the priority of their workers. */
+enum work_queue
+  {
+    WQ_HIGH,                    /* PRI_MAX, for latency-bound work. */
+    WQ_NORMAL,                  /* PRI_DEFAULT. */
+    WQ_LOW,                     /* PRI_MIN + 1, for bulk work. */
+    WQ_CNT
+  };
+
+/* A work item.  Owned by the pool from work_queue() until its
+   function is called; it may be queued again from then on,
+   including by the function itself. */
+struct work
+  {
+    struct list_elem elem;      /* Element in the pending queue. */
+    work_func *func;            /* Function to call. */
+    void *aux;                  /* Passed to FUNC. */
+    bool queued;                /* Waiting to run? */
+  };
+
+void worker_init (void);
+void work_init (struct work *, work_func *, void *aux);
+bool work_queue (enum work_queue, struct work *);
+void work_submit (struct work *);
+
+#endif /* threads/worker.h */
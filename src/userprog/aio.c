@@ -0,0 +1,112 @@
+#include "userprog/aio.h"
+#include <debug.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Asynchronous file I/O.
+
+	 aio_submit() queues a request and returns at once; a kernel
+	 worker thread later carries it out with file_read_at() or
+	 file_write_at().  The worker pool grows as needed, so one
+	 process can keep several requests in flight.  Each process
+	 keeps its outstanding requests on its aio_list until
+	 aio_wait() reaps them or it exits. */
+
+static work_func aio_transfer;
+
+/* Queues a transfer of SIZE bytes between kernel buffer BUF,
+	 which the request takes over, and byte OFS of FILE, on behalf
+	 of user buffer UBUF of the current process.  Returns the
+	 request's id, or -1 if memory is short, in which case the
+	 caller keeps BUF. */
+int
+aio_submit (struct file *file, bool write, off_t ofs, void *buf, off_t size,
+		void *ubuf)
+{
+	struct thread *t = thread_current ();
+	struct aio_req *r = malloc (sizeof *r);
+
+	if (r == NULL)
+		return -1;
+	r->file = file_reopen (file);
+	if (r->file == NULL) {
+		free (r);
+		return -1;
+	}
+	r->id = t->next_aio_id++;
+	r->write = write;
+	r->ofs = ofs;
+	r->size = size;
+	r->buf = buf;
+	r->ubuf = ubuf;
+	r->result = 0;
+	sema_init (&r->done, 0);
+	list_push_back (&t->aio_list, &r->pelem);
+
+	work_init (&r->work, aio_transfer, r);
+	work_submit (&r->work);
+	return r->id;
+}
+
+/* Waits for request ID of the current process to finish and
+	 returns it, or returns a null pointer if there is no such
+	 request.  The request stays outstanding until the caller frees
+	 it with aio_free(). */
+struct aio_req *
+aio_wait (int id)
+{
+	struct thread *t = thread_current ();
+	struct list_elem *e;
+
+	for (e = list_begin (&t->aio_list); e != list_end (&t->aio_list);
+			 e = list_next (e))
+		{
+			struct aio_req *r = list_entry (e, struct aio_req, pelem);
+			if (r->id == id) {
+				/* Leave DONE up, so that waiting again returns at once. */
+				sema_down (&r->done);
+				sema_up (&r->done);
+				return r;
+			}
+		}
+	return NULL;
+}
+
+/* Frees finished request R of the current process along with its
+	 buffer. */
+void
+aio_free (struct aio_req *r)
+{
+	list_remove (&r->pelem);
+	file_close (r->file);
+	free (r->buf);
+	free (r);
+}
+
+/* Waits for every outstanding request of exiting process T and
+	 frees them, dropping what they read. */
+void
+aio_release_process (struct thread *t)
+{
+	while (!list_empty (&t->aio_list))
+		{
+			struct aio_req *r = list_entry (list_front (&t->aio_list),
+					struct aio_req, pelem);
+			sema_down (&r->done);
+			aio_free (r);
+		}
+}
+
+/* Carries out request R_, in a worker thread. */
+static void
+aio_transfer (void *r_)
+{
+	struct aio_req *r = r_;
+
+	if (r->write)
+		r->result = file_write_at (r->file, r->buf, r->size, r->ofs);
+	else
+		r->result = file_read_at (r->file, r->buf, r->size, r->ofs);
+	sema_up (&r->done);
+}
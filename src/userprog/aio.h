@@ -0,0 +1,40 @@
+#ifndef USERPROG_AIO_H
+#define USERPROG_AIO_H
+
+#include <list.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+#include "threads/worker.h"
+
+struct thread;
+
+/* Largest transfer of one asynchronous request; longer ones are
+	 cut short. */
+#define AIO_MAX_SIZE (64 * 1024)
+
+/* An asynchronous read or write, carried out by an I/O worker
+	 thread on a kernel buffer.  The system call layer moves the
+	 data between that buffer and the process. */
+struct aio_req
+	{
+		int id;                     /* Id within the owning process. */
+		struct file *file;          /* Own reference to the file. */
+		bool write;                 /* Write BUF, or read into it? */
+		off_t ofs;                  /* Offset in FILE. */
+		off_t size;                 /* Bytes to move. */
+		void *buf;                  /* Kernel buffer of SIZE bytes. */
+		void *ubuf;                 /* User buffer the data is for. */
+		off_t result;               /* Bytes moved, once DONE is up. */
+		struct semaphore done;      /* Upped when the transfer ends. */
+		struct work work;           /* Carries out the transfer. */
+		struct list_elem pelem;     /* Element in the owner's aio_list. */
+	};
+
+int aio_submit (struct file *, bool write, off_t ofs, void *buf, off_t size,
+		void *ubuf);
+struct aio_req *aio_wait (int id);
+void aio_free (struct aio_req *);
+void aio_release_process (struct thread *);
+
+#endif /* userprog/aio.h */
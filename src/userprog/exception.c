@@ -2,11 +2,17 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <hash.h>
+#include <histogram.h>
 #include <string.h>
 #include "userprog/gdt.h"
+#include "devices/timer.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/pmc.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "userprog/syscall.h"
+#include "userprog/process.h"
 #include "devices/block.h"
 #include "threads/vaddr.h"
 #include "vm/page.h"
@@ -16,7 +22,19 @@
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
-extern struct lock filesys_lock;
+#ifdef VM
+/* Time spent resolving page faults. */
+static struct pmc_region fault_region = PMC_REGION_INITIALIZER ("page fault");
+#endif
+
+#ifdef VM
+/* Page faults served, over all processes, and how long each took
+   demand_paging(), in microseconds. */
+static struct fault_stats fault_totals;
+static struct histogram fault_latency;
+static unsigned long long swap_ahead_cnt;   /* Pages swap_around() read. */
+static unsigned long long advised_cnt;      /* Pages read in on advice. */
+#endif
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
@@ -55,8 +73,6 @@ exception_init (void)
   intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
   intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
   intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-  intr_register_int (7, 0, INTR_ON, kill,
-                     "#NM Device Not Available Exception");
   intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
   intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
   intr_register_int (13, 0, INTR_ON, kill, "#GP General Protection Exception");
@@ -75,6 +91,18 @@ void
 exception_print_stats (void) 
 {
   printf ("Exception: %lld page faults\n", page_fault_cnt);
+#ifdef VM
+  printf ("Page faults: %u major, %u minor; %u file, %u swap, %u zero, "
+          "%u stack, %u cow; %u evictions, %u swapped in, %u out\n",
+          fault_totals.major_cnt, fault_totals.minor_cnt,
+          fault_totals.type_cnt[FAULT_FILE], fault_totals.type_cnt[FAULT_SWAP],
+          fault_totals.type_cnt[FAULT_ZERO], fault_totals.type_cnt[FAULT_STACK],
+          fault_totals.type_cnt[FAULT_COW], fault_totals.evict_cnt,
+          fault_totals.swapin_cnt, fault_totals.swapout_cnt);
+  printf ("Swap readahead: %llu pages\n", swap_ahead_cnt);
+  printf ("Advised readahead: %llu pages\n", advised_cnt);
+  histogram_print (&fault_latency, "Page fault latency", "us");
+#endif
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -149,6 +177,7 @@ page_fault (struct intr_frame *f)
 
   /* Count page faults. */
   page_fault_cnt++;
+  trace (TRACE_FAULT, (uint32_t) fault_addr, f->error_code);
 
   /* Determine cause. */
   //not_present = (f->error_code & PGF_P) == 0;
@@ -156,9 +185,18 @@ page_fault (struct intr_frame *f)
   //user = (f->error_code & PGF_U) != 0;
 
 #ifdef VM
-	if (demand_paging (fault_addr, write)) {
-		return;
+	if ((f->error_code & PGF_U) != 0) {
+		frame_check_suspend ();
+		exit_check ();
 	}
+	struct pmc_sample start;
+	bool resolved;
+
+	pmc_region_begin (&start);
+	resolved = demand_paging (fault_addr, write);
+	pmc_region_end (&fault_region, &start);
+	if (resolved)
+		return;
 #endif
 
 #ifdef USERPROG
@@ -183,7 +221,7 @@ page_fault (struct intr_frame *f)
 bool
 install_page (void *upage, void *kpage, bool writable)
 {
-  struct thread *t = thread_current ();
+  struct thread *t = process_current ();
 
   /* Verify that there's not already a page at that virtual
      address, then map our page there. */
@@ -192,71 +230,373 @@ install_page (void *upage, void *kpage, bool writable)
 }
 
 #ifdef VM
-bool
-demand_paging (const void *paging_addr, bool write)
+/* Counts a page fault of TYPE, MAJOR if it waited for I/O, for the
+	 current process and in the totals. */
+static void
+count_fault (enum fault_type type, bool major)
 {
-	// Do frame_alloc if valid access. else return false;
-  /* TODO : code sharing.
-		 block_sector_t sector_idx = byte_to_sector (inode, offset); */
-	struct spte search;
-	struct hash_elem *e;
+	struct fault_stats *st[2] = {&process_current ()->faults, &fault_totals};
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		st[i]->type_cnt[type]++;
+		if (major)
+			st[i]->major_cnt++;
+		else
+			st[i]->minor_cnt++;
+	}
+}
+
+/* Counts a frame evicted by the current process to serve a page
+	 fault. */
+void
+exception_count_eviction (void)
+{
+	process_current ()->faults.evict_cnt++;
+	fault_totals.evict_cnt++;
+}
+
+/* Counts PAGE_CNT pages read from swap, or written to it if OUT,
+	 by the current thread. */
+void
+exception_count_swap (bool out, unsigned page_cnt)
+{
+	if (out) {
+		process_current ()->faults.swapout_cnt += page_cnt;
+		fault_totals.swapout_cnt += page_cnt;
+	} else {
+		process_current ()->faults.swapin_cnt += page_cnt;
+		fault_totals.swapin_cnt += page_cnt;
+	}
+}
+
+/* Returns the page fault counts over all processes since boot. */
+const struct fault_stats *
+exception_fault_totals (void)
+{
+	return &fault_totals;
+}
+
+/* Returns a pinned frame holding file-backed page P, read in from
+	 its file unless P is a code page some other process already has
+	 resident, and sets *MAJOR to whether it was read.  Returns a
+	 null pointer if the file is short. */
+static void *
+load_file_page (struct spte *p, bool *major)
+{
+	struct inode *inode = NULL;
+	void *fr;
+
+	if (p->segtype == SEGTYPE_CODE) {
+		/* Another process running this program may have it. */
+		inode = file_get_inode (p->file);
+		fr = frame_share (inode, p->file_ofs, p->vaddr);
+		*major = false;
+		if (fr != NULL)
+			return fr;
+	}
+	*major = true;
+	fr = frame_alloc (p->vaddr);
+	if (file_read_at (p->file, fr, PGSIZE - p->zero_bytes,
+				p->file_ofs)
+			!= (off_t)(PGSIZE - p->zero_bytes)) {
+		frame_free (fr);
+		return NULL;
+	}
+	memset (fr + (PGSIZE - p->zero_bytes), 0, p->zero_bytes);
+	if (inode != NULL)
+		frame_publish (fr, inode, p->file_ofs, PGSIZE - p->zero_bytes);
+	return fr;
+}
+
+/* Maps the other non-resident code pages in the aligned window of
+	 FAULT_AROUND_PAGES pages around code page UPAGE, which just
+	 faulted, so that running through a function or two doesn't
+	 take a fault per page.  Gives up at the first failure. */
+static void
+fault_around (const void *upage)
+{
+	struct thread *t = process_current ();
+	uint8_t *base = (uint8_t *) upage
+			- pg_no (upage) % FAULT_AROUND_PAGES * PGSIZE;
+	size_t i;
+
+	for (i = 0; i < FAULT_AROUND_PAGES; i++)
+		{
+			uint8_t *near = base + i * PGSIZE;
+			const struct vma *v;
+			struct spte scratch;
+			bool major;
+			void *fr;
+
+			if (near == upage || pagedir_get_page (t->pagedir, near) != NULL)
+				continue;
+			/* Only read-only code, which has no SPTE to create. */
+			v = page_find_region (t, near);
+			if (v == NULL || v->writable || v->segtype != SEGTYPE_CODE)
+				continue;
+			if (page_get (near, &scratch) != &scratch
+					|| scratch.type != BACKING_TYPE_FILE)
+				continue;
+			fr = load_file_page (&scratch, &major);
+			if (fr == NULL)
+				break;
+			if (!install_page (near, fr, false)) {
+				frame_free (fr);
+				break;
+			}
+			frame_unpin (fr);
+		}
+}
+
+/* Reads in the other pages in the aligned window of
+	 SWAP_AROUND_PAGES pages around page UPAGE, just read back from
+	 swap slot SLOT, that were swapped out along with it: those in the
+	 same region whose slots lie as far from SLOT as they do from
+	 UPAGE.  They are mapped clean, keeping their slots, and with their
+	 accessed bits clear, so that one that goes unused is the first to
+	 be evicted again, at no cost.  Gives up at the first failure. */
+static void
+swap_around (const void *upage, block_sector_t slot)
+{
+	struct thread *t = process_current ();
+	const struct vma *region = page_find_region (t, upage);
+	uint8_t *base = (uint8_t *) upage
+			- pg_no (upage) % SWAP_AROUND_PAGES * PGSIZE;
+	size_t i;
+
+	for (i = 0; i < SWAP_AROUND_PAGES; i++)
+		{
+			uint8_t *near = base + i * PGSIZE;
+			int dist = (near - (const uint8_t *) upage) / PGSIZE;
+			block_sector_t near_slot = slot + dist * BLOCK_SECTOR_RATIO;
+			struct spte *p;
+			void *fr;
+
+			if (near == upage || pagedir_get_swap (t->pagedir, near) != near_slot
+					|| page_find_region (t, near) != region)
+				continue;
+			p = page_lookup (t, near);
+			if (p == NULL)
+				continue;
+			frame_wait_slot (near_slot);
+			if (!swap_slot_keep (near_slot) || (fr = frame_alloc (near)) == NULL)
+				break;
+			swap_load (near_slot, fr);
+			if (!install_page (near, fr, false)) {
+				frame_free (fr);
+				break;
+			}
+			frame_keep_swap (fr, near_slot);
+			p->type = BACKING_TYPE_SWAP;
+			frame_unpin (fr);
+			swap_ahead_cnt++;
+		}
+}
+
+/* Reads in page UPAGE of the current process, unless it is
+	 resident or zero-filled, and maps it clean without counting a
+	 fault.  A page from swap keeps its slot if it can.  Returns false
+	 if UPAGE is not mapped or memory is short. */
+static bool
+prefetch_page (uint8_t *upage)
+{
+	struct thread *t = process_current ();
+	struct spte scratch;
 	struct spte *p;
+	bool major, dirty = false, writable;
+	block_sector_t slot = SWAP_NONE;
+	void *fr;
+
+	if (pagedir_get_page (t->pagedir, upage) != NULL)
+		return true;
+	p = page_get (upage, &scratch);
+	if (p == NULL)
+		return false;
+	writable = p->writable;
+	slot = pagedir_get_swap (t->pagedir, upage);
+	if (slot != SWAP_NONE) {
+		frame_wait_slot (slot);
+		if ((fr = frame_alloc (upage)) == NULL)
+			return false;
+		swap_load (slot, fr);
+		if (swap_slot_keep (slot))
+			writable = false;
+		else {
+			swap_free_slot (slot);
+			slot = SWAP_NONE;
+			dirty = true;
+		}
+		p->type = BACKING_TYPE_SWAP;
+	} else if (p->type == BACKING_TYPE_FILE) {
+		fr = load_file_page (p, &major);
+		if (fr == NULL)
+			return false;
+	} else
+		return true;
+	if (!install_page (upage, fr, writable))
+		PANIC ("prefetch_page(): page install failed.");
+	pagedir_set_dirty (t->pagedir, upage, dirty);
+	if (slot != SWAP_NONE)
+		frame_keep_swap (fr, slot);
+	frame_unpin (fr);
+	advised_cnt++;
+	return true;
+}
+
+/* Reads in the PAGE_CNT pages of the current process at UPAGE,
+	 for madvise(MADV_WILLNEED), as long as there are free frames for
+	 them. */
+void
+exception_prefetch (uint8_t *upage, size_t page_cnt)
+{
+	for (; page_cnt > 0; page_cnt--, upage += PGSIZE)
+		if (palloc_user_free_cnt () <= frame_low_wm || !prefetch_page (upage))
+			break;
+}
+
+/* Reads in the SEQ_AHEAD_PAGES pages after UPAGE, which just
+	 faulted, within region V, advised sequential, and clears the
+	 accessed bits of as many pages that far behind, so that they
+	 are evicted first. */
+static void
+seq_around (const uint8_t *upage, const struct vma *v)
+{
+	struct thread *t = process_current ();
+	const uint8_t *end = v->start + v->page_cnt * PGSIZE;
+	const uint8_t *p;
+	size_t i;
+
+	for (i = 1, p = upage + PGSIZE; i <= SEQ_AHEAD_PAGES && p < end;
+			 i++, p += PGSIZE)
+		if (!prefetch_page ((uint8_t *) p))
+			break;
+	for (i = 0, p = upage - SEQ_AHEAD_PAGES * PGSIZE;
+			 i < SEQ_AHEAD_PAGES && p > v->start; i++)
+		{
+			p -= PGSIZE;
+			pagedir_set_accessed (t->pagedir, p, false);
+		}
+}
 
-	bool havelock = lock_held_by_current_thread (&filesys_lock);
+/* Brings in the page at PAGING_ADDR for a fault, and counts the
+	 fault.  Returns false if the access is invalid. */
+static bool
+serve_fault (const void *paging_addr, bool write)
+{
+	// Do frame_alloc if valid access. else return false;
+	struct spte scratch;
+	struct spte *p;
 
-	search.vaddr = pg_round_down (paging_addr);
-	e = hash_find (&thread_current()->spt, &search.helem);
-	if (e!=NULL) { /* Valid page */
-		p = hash_entry (e, struct spte, helem);
+	if (page_huge (paging_addr)) {
+		count_fault (FAULT_ZERO, false);
+		return true;
+	}
+	p = page_get (paging_addr, &scratch);
+	if (p!=NULL) { /* Valid page */
 		if (p->writable || !write) {
 			void *fr=NULL;
-			if (pagedir_get_page (thread_current ()->pagedir, p->vaddr) == NULL)
+			if (pagedir_get_page (process_current ()->pagedir, p->vaddr) == NULL)
 				{
 					bool dirty = false;
-					switch (p->bpage.type) {
-					case BACKING_TYPE_FILE: /* C, clean D, clean F */
+					bool major = false;
+					bool writable = p->writable;
+					block_sector_t slot;
+					enum fault_type type;
+					const struct vma *v;
+					int advice;
+					slot = pagedir_get_swap (process_current ()->pagedir, p->vaddr);
+					if (slot != SWAP_NONE) { /* dirty D, S, dirty F */
+						/* The page may be on its way out to swap. */
+						frame_wait_slot (slot);
+						type = FAULT_SWAP;
 						fr = frame_alloc (p->vaddr);
-						if (!havelock)
-							lock_acquire (&filesys_lock);
-						file_seek (p->bpage.file, p->bpage.file_ofs);
-						if (file_read (p->bpage.file, fr, PGSIZE - p->bpage.zero_bytes) 
-								!= (off_t)(PGSIZE - p->bpage.zero_bytes)) {
-							if (!havelock)
-								lock_release (&filesys_lock);
-							frame_free (fr);
-							return false;
-							//PANIC ("page_fault(): Read binary failed.");
+						major = swap_load (slot, fr);
+						/* Keeping the slot saves writing the page again if it
+						   is evicted unchanged.  The page is mapped read-only
+						   until its first write, which frees the slot. */
+						if (!write && swap_slot_keep (slot)) {
+							frame_keep_swap (fr, slot);
+							writable = false;
+						} else {
+							swap_free_slot (slot);
+							dirty = true;
 						}
-						if (!havelock)
-							lock_release (&filesys_lock);
-						memset (fr + (PGSIZE - p->bpage.zero_bytes),
-								0, p->bpage.zero_bytes);
-						break;
-					case BACKING_TYPE_SWAP: /* dirty D, S, dirty F */
-						fr = frame_alloc (p->vaddr);
-						swap_load (p->bpage.sector_idx, fr);
-						swap_free_slot (p->bpage.sector_idx);
-						dirty = true;
+						p->type = BACKING_TYPE_SWAP;
+					} else switch (p->type) {
+					case BACKING_TYPE_FILE: /* C, clean D, clean F */
+						type = FAULT_FILE;
+						fr = load_file_page (p, &major);
+						if (fr == NULL)
+							return false;
 						break;
 					case BACKING_TYPE_ZERO:
-						fr = frame_alloc(p->vaddr);
-						memset (fr, 0, PGSIZE);
+						type = p->segtype == SEGTYPE_STACK ? FAULT_STACK : FAULT_ZERO;
+						if (!write) {
+							/* Reads see the zero frame until the first write. */
+							if (!install_page (p->vaddr, frame_zero (), false))
+								PANIC ("page_fault(): page install failed.");
+							count_fault (type, false);
+							return true;
+						}
+						fr = frame_alloc(p->vaddr);   /* Comes zeroed. */
 							break;
-					default: break;
+					default: NOT_REACHED ();
 					}
 					ASSERT (fr);
 					/* Add the page to the process's address space. */
-					if (!install_page (p->vaddr, fr, p->writable)) 
+					if (!install_page (p->vaddr, fr, writable)) 
 						{
 							frame_free (fr);
 							PANIC ("page_fault(): page install failed.");
 						}
-					pagedir_set_dirty (thread_current ()->pagedir, p->vaddr, dirty);
+					pagedir_set_dirty (process_current ()->pagedir, p->vaddr, dirty);
+					frame_unpin (fr);
+					count_fault (type, major);
+					v = page_find_region (process_current (), p->vaddr);
+					advice = v != NULL ? v->advice : MADV_NORMAL;
+					if (advice == MADV_SEQUENTIAL)
+						seq_around (p->vaddr, v);
+					else if (advice != MADV_RANDOM) {
+						if (p->segtype == SEGTYPE_CODE
+								&& p->type == BACKING_TYPE_FILE)
+							fault_around (p->vaddr);
+						else if (slot != SWAP_NONE)
+							swap_around (p->vaddr, slot);
+					}
 				}
+			else if (write
+					&& !pagedir_is_writable (process_current ()->pagedir, p->vaddr)) {
+				/* Shared since fork, or holding on to its swap slot. */
+				if (!frame_cow_break (p->vaddr))
+					return false;
+				count_fault (FAULT_COW, false);
+			}
 			return true;  /* Valid access. */
 		}
 	}
 	return false;		/* Invalid access. Let Kernel to handle. */
 }
-#endif
 
+/* Handles a fault on user address PAGING_ADDR, a write if WRITE,
+	 and times it.  Returns false if the access is invalid.  Faults
+	 of the threads of a process are served one at a time, and not
+	 while one of them changes its regions. */
+bool
+demand_paging (const void *paging_addr, bool write)
+{
+	struct lock *mm_lock = &process_current ()->mm_lock;
+	bool locked = !lock_held_by_current_thread (mm_lock);
+	uint64_t start = timer_cycles ();
+	bool valid;
+
+	if (locked)
+		lock_acquire (mm_lock);
+	valid = serve_fault (paging_addr, write);
+	if (locked)
+		lock_release (mm_lock);
+
+	histogram_add (&fault_latency, timer_cycles_to_us (timer_cycles () - start));
+	return valid;
+}
+#endif
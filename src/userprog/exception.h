@@ -2,6 +2,8 @@
 #define USERPROG_EXCEPTION_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* Page fault error code bits that describe the cause of the exception.  */
 #define PGF_P 0x1    /* 0: not-present page. 1: access rights violation. */
@@ -12,5 +14,10 @@ void exception_init (void);
 void exception_print_stats (void);
 bool install_page (void *upage, void *kpage, bool writable);
 bool demand_paging (const void *paging_addr, bool write);
+void exception_count_eviction (void);
+void exception_count_swap (bool out, unsigned page_cnt);
+void exception_prefetch (uint8_t *upage, size_t page_cnt);
+struct fault_stats;
+const struct fault_stats *exception_fault_totals (void);
 
 #endif /* userprog/exception.h */
@@ -1,14 +1,76 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "vm/frame.h"
+#include "vm/swap.h"
 
 static uint32_t *active_pd (void);
+static void load_pagedir (uint32_t *);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
+
+/* A page table entry that is not present but has this bit, one
+   of those PTE_AVL leaves to us, records in its address bits the
+   swap slot holding the page instead of a frame. */
+#define PTE_SWAP 0x200
+
+/* CR3 loads done, and avoided because PD was already active. */
+static unsigned long long load_cnt, skip_cnt;
+
+/* CR4.PSE, which paging_init() sets if the CPU has large pages. */
+#define CR4_PSE 0x00000010
+
+/* Page directory entries for user virtual addresses. */
+#define USER_PDES (LOADER_PHYS_BASE >> PDSHIFT)
+
+/* Bookkeeping kept in the page just after each page directory, so
+   that pagedir_destroy() visits only the page tables that exist,
+   and each only up to its last entry in use. */
+struct pd_info
+  {
+    size_t pt_cnt;                      /* Page tables in PTS. */
+    uint16_t pts[USER_PDES];            /* PDE index of each page table. */
+    uint16_t used[USER_PDES];           /* Nonzero entries of the page table
+                                           at each PDE index. */
+  };
+
+/* Returns PD's bookkeeping. */
+static struct pd_info *
+pd_info (uint32_t *pd)
+{
+  return (struct pd_info *) (pd + PGSIZE / sizeof *pd);
+}
+
+/* Records that PD got a page table at PDE index IDX, with USED
+   nonzero entries. */
+static void
+add_pt (uint32_t *pd, size_t idx, size_t used)
+{
+  struct pd_info *info = pd_info (pd);
+
+  info->pts[info->pt_cnt++] = idx;
+  info->used[idx] = used;
+}
+
+/* Stores NEW into PTE, the entry of user page UPAGE in PD, keeping
+   count of the nonzero entries of its page table. */
+static void
+pte_store (uint32_t *pd, const void *upage, uint32_t *pte, uint32_t new)
+{
+  uint16_t *used = &pd_info (pd)->used[pd_no (upage)];
+
+  if (*pte == 0 && new != 0)
+    ++*used;
+  else if (*pte != 0 && new == 0)
+    --*used;
+  *pte = new;
+}
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -17,36 +79,60 @@ static void invalidate_pagedir (uint32_t *);
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  uint32_t *pd = palloc_get_multiple (0, 2);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    {
+      memset (pd, 0, USER_PDES * sizeof *pd);
+      memcpy (pd + USER_PDES, init_page_dir + USER_PDES,
+              PGSIZE - USER_PDES * sizeof *pd);
+      memset (pd_info (pd), 0, sizeof (struct pd_info));
+    }
   return pd;
 }
 
-/* Destroys page directory PD, freeing all the pages it
-   references. */
+/* Destroys page directory PD, freeing all the pages and swap
+   slots it references. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
-  uint32_t *pde;
+  struct pd_info *info;
+  size_t i;
 
   if (pd == NULL)
     return;
 
   ASSERT (pd != init_page_dir);
-  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
-      {
-        uint32_t *pt = pde_get_pt (*pde);
-        uint32_t *pte;
-        
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+  info = pd_info (pd);
+  for (i = 0; i < info->pt_cnt; i++)
+    {
+      size_t idx = info->pts[i];
+      uint32_t *pt = pde_get_pt (pd[idx]);
+      size_t left = info->used[idx];
+      uint32_t *pte;
+
+      ASSERT ((pd[idx] & PTE_PS) == 0);
+      for (pte = pt; left > 0; pte++)
+        {
+          if (*pte == 0)
+            continue;
+          left--;
           if (*pte & PTE_P) 
             frame_free (pte_get_page (*pte));
-            //palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
-      }
-  palloc_free_page (pd);
+#ifdef VM
+          else if (*pte & PTE_SWAP)
+            {
+              block_sector_t slot = (*pte >> PTSHIFT) * BLOCK_SECTOR_RATIO;
+
+              /* A slot still being written to mustn't be handed
+                 out yet. */
+              frame_wait_slot (slot);
+              swap_free_slot (slot);
+            }
+#endif
+        }
+      palloc_free_page (pt);
+    }
+  palloc_free_multiple (pd, 2);
 }
 
 /* Returns the address of the page table entry for virtual
@@ -68,6 +154,14 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
   /* Check for a page table for VADDR.
      If one is missing, create one if requested. */
   pde = pd + pd_no (vaddr);
+  if (*pde & PTE_PS)
+    {
+      /* A large page's PDE stands for the PTE of each of its pages,
+         whose flag bits are in the same places.  Only the accessed
+         and dirty bits may be changed through it. */
+      ASSERT (!create);
+      return pde;
+    }
   if (*pde == 0) 
     {
       if (create)
@@ -77,6 +171,7 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
             return NULL; 
       
           *pde = pde_create (pt);
+          add_pt (pd, pd_no (vaddr), 0);
         }
       else
         return NULL;
@@ -113,7 +208,7 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
   if (pte != NULL) 
     {
       ASSERT ((*pte & PTE_P) == 0);
-      *pte = pte_create_user (kpage, writable);
+      pte_store (pd, upage, pte, pte_create_user (kpage, writable));
       return true;
     }
   else
@@ -133,11 +228,104 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
   
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
-    return pte_get_page (*pte) + pg_ofs (uaddr);
+    {
+      if (*pte & PTE_PS)
+        return pte_get_page (*pte) + ((uintptr_t) uaddr & (PTSPAN - 1));
+      return pte_get_page (*pte) + pg_ofs (uaddr);
+    }
   else
     return NULL;
 }
 
+/* Returns true if PD maps nothing, not even a swap slot, in the 4
+   MB large page at UPAGE, which must be aligned to one. */
+bool
+pagedir_large_unused (uint32_t *pd, const void *upage)
+{
+  uint32_t pde = pd[pd_no (upage)];
+
+  ASSERT (((uintptr_t) upage & (PTSPAN - 1)) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  if (pde == 0)
+    return true;
+  return (pde & PTE_PS) == 0 && pd_info (pd)->used[pd_no (upage)] == 0;
+}
+
+/* Maps the 4 MB large page at UPAGE in PD to the physically
+   contiguous, equally aligned frames at KPAGE, with a single PDE,
+   read/write if WRITABLE.  UPAGE must be unused, as
+   pagedir_large_unused() tells; an empty page table there is
+   freed.  Returns false if the CPU has no large pages. */
+bool
+pagedir_set_large (uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+  uint32_t *pde = pd + pd_no (upage);
+  uint32_t cr4;
+
+  ASSERT (pd != init_page_dir);
+  ASSERT (pagedir_large_unused (pd, upage));
+
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if ((cr4 & CR4_PSE) == 0)
+    return false;
+
+  if (*pde != 0)
+    {
+      struct pd_info *info = pd_info (pd);
+      size_t i;
+
+      for (i = 0; info->pts[i] != pd_no (upage); i++)
+        continue;
+      info->pts[i] = info->pts[--info->pt_cnt];
+      palloc_free_page (pde_get_pt (*pde));
+    }
+  *pde = pde_create_large (kpage, writable) | PTE_U;
+  invalidate_page (pd, upage);
+  return true;
+}
+
+/* Replaces the large page at UPAGE in PD by a page table mapping
+   the same frames, each page getting the large page's accessed
+   and dirty bits.  Returns false if memory is short. */
+bool
+pagedir_split_large (uint32_t *pd, void *upage)
+{
+  uint32_t *pde = pd + pd_no (upage);
+  uint32_t *pt = palloc_get_page (0);
+  enum intr_level old_level;
+  uint8_t *kpage;
+  size_t i;
+
+  ASSERT (*pde & PTE_PS);
+  if (pt == NULL)
+    return false;
+
+  /* The process may not set more bits in the PDE meanwhile. */
+  old_level = intr_disable ();
+  kpage = pte_get_page (*pde);
+  for (i = 0; i < PGSIZE / sizeof *pt; i++)
+    pt[i] = (pte_create_user (kpage + i * PGSIZE, (*pde & PTE_W) != 0)
+             | (*pde & (PTE_A | PTE_D)));
+  *pde = pde_create (pt);
+  add_pt (pd, pd_no (upage), PGSIZE / sizeof *pt);
+  invalidate_page (pd, upage);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Removes the large page at UPAGE from PD, leaving its frames to
+   the caller. */
+void
+pagedir_clear_large (uint32_t *pd, void *upage)
+{
+  uint32_t *pde = pd + pd_no (upage);
+
+  ASSERT (*pde & PTE_PS);
+  *pde = 0;
+  invalidate_page (pd, upage);
+}
+
 /* Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
    bits in the page table entry are preserved.
@@ -153,11 +341,94 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   pte = lookup_page (pd, upage, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
+      ASSERT ((*pte & PTE_PS) == 0);
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
+/* Marks user virtual page UPAGE "not present" in PD and records
+   in its page table entry that the page is in swap slot SLOT, so
+   that a fault on it needs no other lookup to find it.  If SLOT
+   is SWAP_NONE, instead forgets any slot recorded for UPAGE,
+   unless UPAGE is present.  May have to allocate a page table,
+   but never does if UPAGE ever was mapped.  Returns false if
+   that fails. */
+bool
+pagedir_set_swap (uint32_t *pd, void *upage, block_sector_t slot) 
+{
+  uint32_t *pte;
+  bool was_present;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  if (slot == SWAP_NONE)
+    {
+      pte = lookup_page (pd, upage, false);
+      if (pte != NULL && (*pte & PTE_P) == 0)
+        pte_store (pd, upage, pte, 0);
+      return true;
+    }
+
+  ASSERT (slot % BLOCK_SECTOR_RATIO == 0);
+  ASSERT (slot / BLOCK_SECTOR_RATIO < (PTE_ADDR >> PTSHIFT));
+
+  pte = lookup_page (pd, upage, true);
+  if (pte == NULL)
+    return false;
+  was_present = (*pte & PTE_P) != 0;
+  pte_store (pd, upage, pte, (slot / BLOCK_SECTOR_RATIO) << PTSHIFT | PTE_SWAP);
+  if (was_present)
+    invalidate_page (pd, upage);
+  return true;
+}
+
+/* Returns the swap slot recorded for user virtual page UPAGE in
+   PD by pagedir_set_swap(), or SWAP_NONE if there is none. */
+block_sector_t
+pagedir_get_swap (uint32_t *pd, const void *upage) 
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+
+  if (pte == NULL || (*pte & (PTE_P | PTE_SWAP)) != PTE_SWAP)
+    return SWAP_NONE;
+  return (*pte >> PTSHIFT) * BLOCK_SECTOR_RATIO;
+}
+
+/* More pages than this cleared at once by pagedir_clear_pages()
+   are cheaper to flush by reloading the whole TLB. */
+#define INVLPG_MAX 32
+
+/* Clears the CNT pages UPAGES[] in PD as pagedir_clear_page()
+   does, flushing the TLB once for all of them. */
+void
+pagedir_clear_pages (uint32_t *pd, void *const upages[], size_t cnt) 
+{
+  bool active = active_pd () == pd;
+  size_t i, cleared = 0;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint32_t *pte;
+
+      ASSERT (pg_ofs (upages[i]) == 0);
+      ASSERT (is_user_vaddr (upages[i]));
+
+      pte = lookup_page (pd, upages[i], false);
+      if (pte != NULL && (*pte & PTE_P) != 0)
+        {
+          ASSERT ((*pte & PTE_PS) == 0);
+          *pte &= ~PTE_P;
+          cleared++;
+          if (active && cnt <= INVLPG_MAX)
+            invalidate_page (pd, upages[i]);
+        }
+    }
+  if (cleared > 0 && cnt > INVLPG_MAX)
+    invalidate_pagedir (pd);
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -170,23 +441,51 @@ pagedir_is_dirty (uint32_t *pd, const void *vpage)
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
-   in PD. */
+   in PD.  Entries not in use, neither mapping a page nor
+   recording a swap slot, are left alone here and in the other
+   setters of bits, so that they stay zero. */
 void
 pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty) 
 {
   uint32_t *pte = lookup_page (pd, vpage, false);
-  if (pte != NULL) 
+  if (pte != NULL && *pte != 0) 
     {
       if (dirty)
         *pte |= PTE_D;
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
+/* Returns true if the PTE for virtual page VPAGE in PD is
+   present and writable. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_W)) == (PTE_P | PTE_W);
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD, leaving its other bits alone. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL && *pte != 0) 
+    {
+      ASSERT ((*pte & PTE_PS) == 0);
+      if (writable)
+        *pte |= PTE_W;
+      else 
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_page (pd, vpage);
+    }
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
@@ -204,26 +503,52 @@ void
 pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed) 
 {
   uint32_t *pte = lookup_page (pd, vpage, false);
-  if (pte != NULL) 
+  if (pte != NULL && *pte != 0) 
     {
       if (accessed)
         *pte |= PTE_A;
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
-/* Loads page directory PD into the CPU's page directory base
-   register. */
+/* Makes PD, or the kernel-only page directory if PD is null, the
+   active page directory.  Nothing is done if it already is, so
+   that switching back to the process whose page tables are still
+   loaded, for instance after a kernel thread ran, keeps the
+   TLB. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
 
+  if (active_pd () == pd)
+    {
+      skip_cnt++;
+      return;
+    }
+  load_pagedir (pd);
+}
+
+/* Prints page directory statistics. */
+void
+pagedir_print_stats (void) 
+{
+  printf ("Paging: %llu page directory loads, %llu avoided\n",
+          load_cnt, skip_cnt);
+}
+
+/* Loads page directory PD into the CPU's page directory base
+   register, which also flushes the TLB. */
+static void
+load_pagedir (uint32_t *pd) 
+{
+  load_cnt++;
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -260,6 +585,18 @@ invalidate_pagedir (uint32_t *pd)
     {
       /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      load_pagedir (pd);
     } 
 }
+
+/* Invalidates the TLB entry of user page UPAGE if PD is the
+   active page directory. */
+static void
+invalidate_page (uint32_t *pd, const void *upage) 
+{
+  if (active_pd () == pd)
+    {
+      /* See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+      asm volatile ("invlpg (%0)" : : "r" (upage) : "memory");
+    }
+}
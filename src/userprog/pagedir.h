@@ -2,17 +2,31 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
+bool pagedir_large_unused (uint32_t *pd, const void *upage);
+bool pagedir_set_large (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_split_large (uint32_t *pd, void *upage);
+void pagedir_clear_large (uint32_t *pd, void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+void pagedir_clear_pages (uint32_t *pd, void *const upages[], size_t cnt);
+
+/* Swap slots are block_sector_t's, but devices/block.h can't be
+   included here by everything that includes this. */
+bool pagedir_set_swap (uint32_t *pd, void *upage, uint32_t slot);
+uint32_t pagedir_get_swap (uint32_t *pd, const void *upage);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
+bool pagedir_is_writable (uint32_t *pd, const void *upage);
+void pagedir_set_writable (uint32_t *pd, const void *upage, bool writable);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
 void pagedir_activate (uint32_t *pd);
+void pagedir_print_stats (void);
 
 #endif /* userprog/pagedir.h */
@@ -5,16 +5,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/aio.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
+#include "threads/pmc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/syscall.h"
@@ -22,100 +27,190 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 
-extern struct lock filesys_lock;
-extern struct lock filesys_wlock;
-extern struct lock filesys_rlock;
 
-static bool load (const char *file_name, void (**eip) (void), void **esp, char *arg_start, int arg_len, int argc);
+static bool load (const char *file_name, void (**eip) (void), void **esp,
+                  const char *args, size_t args_len, int argc);
 
 bool install_page (void *upage, void *kpage, bool writable);
 
+/* Time spent loading page directories. */
+static struct pmc_region cr3_region = PMC_REGION_INITIALIZER ("CR3 load");
+
+/* What start_process() gets: the files to install as the new
+   process's descriptors, and its command line, all in the
+   CMD_LINE_PAGES pages that process_cmd_line_alloc() returns. */
+struct start_aux
+  {
+    size_t file_cnt;
+    struct spawn_file files[SPAWN_ACTION_MAX];
+    char cmd_line[];            /* CMD_LINE_MAX bytes. */
+  };
+
+/* Returns the start_aux that CMD_LINE is part of. */
+static struct start_aux *
+cmd_line_aux (char *cmd_line)
+{
+	return pg_round_down (cmd_line);
+}
+
+/* Returns a buffer of CMD_LINE_MAX bytes for the command line of
+   a new process, or a null pointer if memory is short.  Fill it in
+   place and pass it to process_start(), or free it with
+   process_cmd_line_free(). */
+char *
+process_cmd_line_alloc (void)
+{
+	struct start_aux *aux;
+
+	ASSERT (sizeof *aux + CMD_LINE_MAX <= CMD_LINE_PAGES * PGSIZE);
+
+	aux = palloc_get_multiple (0, CMD_LINE_PAGES);
+	return aux != NULL ? aux->cmd_line : NULL;
+}
+
+/* Frees CMD_LINE, which came from process_cmd_line_alloc(), if it
+   is nonnull. */
+void
+process_cmd_line_free (char *cmd_line)
+{
+	if (cmd_line != NULL)
+		palloc_free_multiple (cmd_line_aux (cmd_line), CMD_LINE_PAGES);
+}
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   thread id, or TID_ERROR if the thread cannot be created or the
+   program cannot be loaded. */
 tid_t
 process_execute (const char *file_name) 
 {
-  char *fn_copy;
+	char *cmd_line = process_cmd_line_alloc ();
+
+	if (cmd_line == NULL)
+		return TID_ERROR;
+	strlcpy (cmd_line, file_name, CMD_LINE_MAX);
+	return process_start (cmd_line, true, NULL, 0);
+}
+
+/* Starts a new process running CMD_LINE, which must come from
+   process_cmd_line_alloc() and is handed over to it.  The new
+   process starts with the FILE_CNT FILES open under the given
+   descriptors; they are handed over too, or closed if it cannot
+   be created.  If WAIT_LOAD, waits for the program to load, as
+   process_execute() does; otherwise returns at once, so that
+   several can load at once, and a process that fails to load
+   exits with status -1, as wait() reports. */
+tid_t
+process_start (char *cmd_line, bool wait_load,
+		const struct spawn_file *files, size_t file_cnt)
+{
+  struct start_aux *aux = cmd_line_aux (cmd_line);
   tid_t tid;
+  size_t i;
 
-  /* Make a copy of FILE_NAME.
-     Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
-    return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  ASSERT (file_cnt <= SPAWN_ACTION_MAX);
+
+  aux->file_cnt = file_cnt;
+  memcpy (aux->files, files, file_cnt * sizeof *files);
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  /* Create a new thread to execute CMD_LINE. */
+  tid = thread_create (cmd_line, PRI_DEFAULT, start_process, aux);
   if (tid == TID_ERROR) {
-    palloc_free_page (fn_copy); 
-		return tid;
+		process_cmd_line_free (cmd_line);
+		goto error;
 	}
+	if (!wait_load)
+		return tid;
 
 	/* Wait for child finish loading. */
-	struct thread *child = get_thread_by_tid (tid);
+	struct child *child = thread_get_child (tid);
 	ASSERT (child);
 	sema_down (&child->loaded);
 
-	/* If failed to load, return -1. */
-	if (child->load_failed)
+	/* If failed to load, reap it and return -1. */
+	if (child->load_failed) {
+		process_wait (tid);
 		return TID_ERROR;
+	}
 
 	return tid;
+
+ error:
+	for (i = 0; i < file_cnt; i++)
+		file_close (files[i].file);
+	return TID_ERROR;
 }
 
-/* A thread function that loads a user process and starts it
-   running. */
-void
-start_process (void *file_name_)
+/* Splits CMD_LINE into words in place, packing them together
+   with a null after each.  Returns the number of words and
+   stores the bytes they take up into *LEN. */
+static int
+split_args (char *cmd_line, size_t *len)
 {
-  char *file_name = file_name_;
-  struct intr_frame if_;
-  bool success;
-
-	int argc=0;
-	int offset=0;
-	char *p=0;
-	char *ptr=0;
-
-	/* Parse cmdline. */
-	p = strtok_r(file_name, " \t\n", &ptr);
-	argc++;
-	offset += (strlen(p)+1);
-	while (1) {
-		int len=0;
-		p = strtok_r(NULL, " \t\n", &ptr);
-		if (p == NULL) break;
-		len = strlen(p);
+	char *dst = cmd_line;
+	char *word, *save;
+	int argc = 0;
+
+	for (word = strtok_r (cmd_line, " \t\n", &save); word != NULL;
+			 word = strtok_r (NULL, " \t\n", &save)) {
+		size_t n = strlen (word) + 1;
+
+		memmove (dst, word, n);
+		dst += n;
 		argc++;
-		if ( file_name+offset != p )
-			strlcpy(file_name+offset, p, len+1);
-		offset += len+1;
 	}
+	*len = dst - cmd_line;
+	return argc;
+}
+
+/* A thread function that installs the descriptors AUX_ gives
+   and then loads a user process and starts it running. */
+void
+start_process (void *aux_)
+{
+  struct start_aux *aux = aux_;
+  char *file_name = aux->cmd_line;
+  struct intr_frame if_;
+  bool success = true;
+  size_t args_len;
+  int argc;
+  size_t i;
+
+	for (i = 0; i < aux->file_cnt; i++)
+		if (!success || !fd_install (thread_current (), aux->files[i].fd,
+					aux->files[i].file)) {
+			file_close (aux->files[i].file);
+			success = false;
+		}
+
+	/* The program's name is its first word. */
+	argc = split_args (file_name, &args_len);
+	if (argc == 0)
+		success = false;
 
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp, file_name, offset, argc);
+  success = success && load (file_name, &if_.eip, &if_.esp,
+                             file_name, args_len, argc);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
+  process_cmd_line_free (file_name);
   if (!success) {
 		struct thread *cur = thread_current ();
 
 		/* Tell parent that load is failed. */
-		cur->load_failed = true;
-		sema_up (&cur->loaded);
+		cur->child->load_failed = true;
+		sema_up (&cur->child->loaded);
 
 		exit (-1);
 	}
 
 	/* Tell parent that load is finished. */
-	sema_up (&thread_current ()->loaded);
+	sema_up (&thread_current ()->child->loaded);
 	
   /* Start the user process by simulating a return from an
      interrupt, implemented by intr_exit (in
@@ -123,10 +218,195 @@ start_process (void *file_name_)
      arguments on the stack in the form of a `struct intr_frame',
      we just point the stack pointer (%esp) to our stack frame
      and jump to it. */
+  thread_account (CPU_USER);
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* What a forked child needs from its parent to start. */
+struct fork_aux
+  {
+    struct thread *parent;      /* Forking thread, blocked meanwhile. */
+    struct intr_frame if_;      /* Its user context at the fork. */
+  };
+
+/* What a thread from thread_spawn() needs to start. */
+struct thread_aux
+  {
+    struct thread *process;     /* Process it joins. */
+    struct intr_frame if_;      /* User context to start from. */
+  };
+
+static bool fork_copy (struct thread *parent);
+
+/* Starts a new process that is a copy of the current one,
+   resuming from user context F with fork() returning 0.  The
+   address space is shared copy-on-write.  Returns the child's
+   thread id, or TID_ERROR if it could not be created. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+  struct fork_aux *aux;
+  tid_t tid;
+
+  aux = malloc (sizeof *aux);
+  if (aux == NULL)
+    return TID_ERROR;
+  aux->parent = cur;
+  aux->if_ = *f;
+
+  tid = thread_create (cur->name, thread_get_priority (), start_fork, aux);
+  if (tid == TID_ERROR) {
+		free (aux);
+		return tid;
+	}
+
+	/* Our address space must stay put until the child has copied it. */
+	struct child *child = thread_get_child (tid);
+	ASSERT (child);
+	sema_down (&child->loaded);
+
+	if (child->load_failed) {
+		process_wait (tid);
+		return TID_ERROR;
+	}
+	return tid;
+}
+
+/* A thread function that makes a forked child a copy of its
+   parent and starts it running. */
+void
+start_fork (void *aux_)
+{
+	struct fork_aux *aux = aux_;
+	struct thread *cur = thread_current ();
+	struct intr_frame if_ = aux->if_;
+	struct thread *parent = aux->parent;
+
+	free (aux);
+	if (!fork_copy (parent)) {
+		cur->child->load_failed = true;
+		sema_up (&cur->child->loaded);
+		exit (-1);
+	}
+	sema_up (&cur->child->loaded);
+
+	if_.eax = 0;   /* fork() returns 0 in the child. */
+	thread_account (CPU_USER);
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current process its own page directory, executable,
+   and file descriptors copied from the process of PARENT, the
+   forking thread, and a copy-on-write copy of its address space.
+   Other threads of that process keep running; only PARENT is
+   copied. */
+static bool
+fork_copy (struct thread *parent)
+{
+	struct thread *cur = thread_current ();
+	struct thread *p = parent->process;
+	bool success;
+
+	cur->pagedir = pagedir_create ();
+	if (cur->pagedir == NULL)
+		return false;
+	process_activate ();
+
+	cur->my_binary = file_reopen (p->my_binary);
+	if (cur->my_binary == NULL)
+		return false;
+	file_deny_write (cur->my_binary);
+
+	if (!fd_table_copy (cur, p))
+		return false;
+	if (!fpu_fork (cur, parent))
+		return false;
+
+#ifdef VM
+	lock_acquire (&p->mm_lock);
+	success = page_fork (p);
+	lock_release (&p->mm_lock);
+#else
+	success = false;   /* Needs copy-on-write paging. */
+#endif
+	return success;
+}
+
+/* Starts a new thread in the current process, sharing its address
+   space and files, that enters user mode at EIP with its stack
+   pointer at ESP, with the other registers as in F.  Returns its
+   thread id, which the threads of the process can wait() for, or
+   TID_ERROR if it could not be created or the process is
+   exiting. */
+tid_t
+process_thread_spawn (const struct intr_frame *f, void *eip, void *esp)
+{
+	struct thread *cur = thread_current ();
+	struct thread *p = cur->process;
+	struct thread_aux *aux;
+	tid_t tid;
+
+	aux = malloc (sizeof *aux);
+	if (aux == NULL)
+		return TID_ERROR;
+	aux->process = p;
+	aux->if_ = *f;
+	aux->if_.eip = eip;
+	aux->if_.esp = esp;
+	aux->if_.eax = 0;
+
+	/* Counted before it exists, so that an exit() meanwhile waits
+	   for it. */
+	lock_acquire (&p->proc_lock);
+	if (p->exiting) {
+		lock_release (&p->proc_lock);
+		free (aux);
+		return TID_ERROR;
+	}
+	p->thread_cnt++;
+	lock_release (&p->proc_lock);
+
+	tid = thread_create (cur->name, thread_get_priority (), start_thread, aux);
+	if (tid == TID_ERROR) {
+		free (aux);
+		lock_acquire (&p->proc_lock);
+		p->thread_cnt--;
+		lock_release (&p->proc_lock);
+		sema_up (&p->thread_gone);
+	}
+	return tid;
+}
+
+/* A thread function that joins the process AUX_ gives and starts
+   running in user mode. */
+void
+start_thread (void *aux_)
+{
+	struct thread_aux *aux = aux_;
+	struct thread *cur = thread_current ();
+	struct intr_frame if_ = aux->if_;
+
+	cur->process = aux->process;
+	free (aux);
+	process_activate ();
+	exit_check ();
+
+	thread_account (CPU_USER);
   asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
   NOT_REACHED ();
 }
 
+/* Returns the thread that holds the address space and files of
+   the running thread's process. */
+struct thread *
+process_current (void)
+{
+	return thread_current ()->process;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -141,47 +421,71 @@ process_wait (tid_t child_tid)
 {
 	int status = 0;
 
-	struct thread *child = get_thread_by_tid (child_tid);
-	if (child==NULL) {
+	struct child *child;
+	if (child_tid == thread_tid ())
 		return -1;
-	}
-	sema_down (&child->exit_wait_sema);
+	child = thread_take_child (child_tid);
+	if (child == NULL)
+		return -1;
+	sema_down (&child->exited);
 	status = child->exit_status;
 
-	enum intr_level old_level = intr_disable();
-
-	/* Remove process from all_list. */
-	list_remove (&child->allelem);
+	/* The child's struct thread is long gone; free its record. */
+	thread_reap_child (child);
+  return status;
+}
 
-	/* Free memory of child's TCB. */
-	palloc_free_page (child);
+/* Waits for whichever child process of the running process exits
+   first, in any order, stores its tid into *TID and returns its
+   exit status.  Returns -1, storing TID_ERROR, if the process has
+   no children left to wait for. */
+int
+process_wait_any (tid_t *tid)
+{
+	struct child *child = thread_take_exited_child ();
+	int status;
 
-	intr_set_level (old_level);
-  return status;
+	if (child == NULL) {
+		*tid = TID_ERROR;
+		return -1;
+	}
+	sema_down (&child->exited);
+	*tid = child->tid;
+	status = child->exit_status;
+	thread_reap_child (child);
+	return status;
 }
 
-/* Free the current process's resources. */
+/* Free the current process's resources.  A thread from
+   thread_spawn() has none but its own asynchronous I/O; it just
+   lets the process know it is gone. */
 void
 process_exit (void)
 {
   struct thread *cur = thread_current ();
+  struct thread *p = cur->process;
   uint32_t *pd;
 
-	lock_acquire (&filesys_lock);
-	struct list_elem *e;
-	for (e = list_begin (&cur->open_list); e != list_end (&cur->open_list);)
-		{
-			struct openfile *of = list_entry (e, struct openfile, openelem);
-			if (of->f != NULL) {
-				file_close (of->f);
-			}
-			e = list_remove (&of->openelem);
-			free (of);
-		}
-	lock_release (&filesys_lock);
+	aio_release_process (cur);
+	fd_unpin_all ();
+	if (p != cur) {
+		lock_acquire (&p->proc_lock);
+		thread_add_times (cur, p->exited_times);
+		p->thread_cnt--;
+		lock_release (&p->proc_lock);
+		sema_up (&p->thread_gone);
+		return;
+	}
+
+	fd_table_destroy (cur);
+	dir_close (cur->cwd);
+	cur->cwd = NULL;
 
 #ifdef VM
-	hash_destroy (&cur->spt, page_destructor);
+	page_munlock_all ();
+	page_munmap_all ();
+	frame_release_process (cur);
+	page_table_destroy (cur);
 #endif
 
   /* Destroy the current process's page directory and switch back
@@ -208,10 +512,19 @@ process_exit (void)
 void
 process_activate (void)
 {
-  struct thread *t = thread_current ();
+  struct thread *t = process_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A kernel thread has none of
+     its own and never touches user memory, so it just keeps
+     whichever ones are loaded. */
+  if (t->pagedir != NULL)
+    {
+      struct pmc_sample start;
+
+      pmc_region_begin (&start);
+      pagedir_activate (t->pagedir);
+      pmc_region_end (&cr3_region, &start);
+    }
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -281,29 +594,154 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp, char *arg_start, int arg_len, int argc);
+/* A loadable segment, as load_segment() takes it. */
+struct exec_seg
+	{
+		uint32_t file_page;         /* Offset of its first page in the file. */
+		uint32_t mem_page;          /* User address of its first page. */
+		uint32_t read_bytes;        /* Bytes read from the file. */
+		uint32_t zero_bytes;        /* Bytes zeroed after them. */
+		bool writable;
+	};
+
+/* An executable's validated headers: its entry point and
+   loadable segments. */
+struct exec_image
+	{
+		struct list_elem elem;      /* Element in exec_cache. */
+		struct inode *inode;        /* Executable, held open while cached. */
+		unsigned gen;               /* inode_write_gen() it was read at. */
+		int ref_cnt;                /* The cache's and loaders' references. */
+		Elf32_Addr entry;           /* Entry point. */
+		uintptr_t load_end;         /* End of the highest segment. */
+		int seg_cnt;                /* Number of segments. */
+		struct exec_seg segs[];     /* Segments. */
+	};
+
+/* Images of recently loaded executables, most recent first.  Each
+   holds its inode open, so a removed executable's blocks are not
+   freed until it is dropped, which the next lookup does. */
+#define EXEC_CACHE_SIZE 8
+static struct list exec_cache;
+static struct lock exec_cache_lock;
+static unsigned long long exec_hit_cnt, exec_miss_cnt;
+
+static struct exec_image *read_image (struct file *, const char *file_name);
+static bool setup_stack (void **esp, const char *args, size_t args_len,
+                         int argc);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
+/* Initializes the cache of executable images. */
+void
+process_init (void)
+{
+	list_init (&exec_cache);
+	lock_init (&exec_cache_lock);
+	lock_set_name (&exec_cache_lock, "exec cache");
+}
+
+/* Prints exec cache statistics. */
+void
+process_print_stats (void)
+{
+	printf ("Exec: %llu cached headers used, %llu read\n",
+			exec_hit_cnt, exec_miss_cnt);
+}
+
+/* Drops a reference to IMAGE, freeing it with the last one. */
+static void
+exec_image_release (struct exec_image *image)
+{
+	bool last;
+
+	lock_acquire (&exec_cache_lock);
+	last = --image->ref_cnt == 0;
+	lock_release (&exec_cache_lock);
+	if (last)
+		free (image);
+}
+
+/* Removes IMAGE from the cache and closes its inode.  The caller
+   holds exec_cache_lock. */
+static void
+exec_cache_drop (struct exec_image *image)
+{
+	list_remove (&image->elem);
+	inode_close (image->inode);
+	image->inode = NULL;
+	if (--image->ref_cnt == 0)
+		free (image);
+}
+
+/* Returns a reference to the cached image of FILE, or a null
+   pointer if there is none or FILE has been written since it was
+   read.  Also drops the images of removed files. */
+static struct exec_image *
+exec_cache_get (struct file *file)
+{
+	struct inode *inode = file_get_inode (file);
+	struct exec_image *found = NULL;
+	struct list_elem *e, *next;
+
+	lock_acquire (&exec_cache_lock);
+	for (e = list_begin (&exec_cache); e != list_end (&exec_cache); e = next) {
+		struct exec_image *image = list_entry (e, struct exec_image, elem);
+
+		next = list_next (e);
+		if (image->inode == inode && image->gen == inode_write_gen (inode))
+			found = image;
+		else if (image->inode == inode || inode_is_removed (image->inode))
+			exec_cache_drop (image);
+	}
+	if (found != NULL) {
+		list_remove (&found->elem);
+		list_push_front (&exec_cache, &found->elem);
+		found->ref_cnt++;
+		exec_hit_cnt++;
+	}
+	else
+		exec_miss_cnt++;
+	lock_release (&exec_cache_lock);
+	return found;
+}
+
+/* Adds IMAGE, just read from FILE, to the cache, evicting the
+   least recently used image if it is full.  The caller keeps its
+   reference. */
+static void
+exec_cache_add (struct file *file, struct exec_image *image)
+{
+	struct inode *inode = inode_reopen (file_get_inode (file));
+
+	lock_acquire (&exec_cache_lock);
+	image->inode = inode;
+	image->ref_cnt++;
+	list_push_front (&exec_cache, &image->elem);
+	if (list_size (&exec_cache) > EXEC_CACHE_SIZE)
+		exec_cache_drop (list_entry (list_back (&exec_cache),
+				struct exec_image, elem));
+	lock_release (&exec_cache_lock);
+}
+
+/* Loads an ELF executable from FILE_NAME into the current thread,
+   with the ARGC null-terminated words packed into the ARGS_LEN
+   bytes at ARGS as its arguments.
    Stores the executable's entry point into *EIP
    and its initial stack pointer into *ESP.
    Returns true if successful, false otherwise. */
 bool
-load (const char *file_name, void (**eip) (void), void **esp, char *arg_start, int arg_len, int argc) 
+load (const char *file_name, void (**eip) (void), void **esp,
+      const char *args, size_t args_len, int argc)
 {
   struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
+  struct exec_image *image = NULL;
   struct file *file = NULL;
-  off_t file_ofs;
   bool success = false;
   int i;
 
-	lock_acquire (&filesys_rlock);
-	lock_acquire (&filesys_lock);
-
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
@@ -324,6 +762,124 @@ load (const char *file_name, void (**eip) (void), void **esp, char *arg_start, i
 		file_deny_write (file);
 	//}
 
+	/* Read and verify the headers, unless they were cached. */
+	image = exec_cache_get (file);
+	if (image == NULL) {
+		image = read_image (file, file_name);
+		if (image == NULL)
+			goto done;
+		exec_cache_add (file, image);
+	}
+
+  for (i = 0; i < image->seg_cnt; i++)
+    {
+      const struct exec_seg *seg = &image->segs[i];
+
+      if (!load_segment (file, seg->file_page, (void *) seg->mem_page,
+                         seg->read_bytes, seg->zero_bytes, seg->writable))
+        goto done;
+    }
+
+#ifdef VM
+  /* The heap starts out empty, past the last segment. */
+  page_heap_init ((uint8_t *) image->load_end);
+#endif
+
+  /* Set up stack. */
+  if (!setup_stack (esp, args, args_len, argc))
+    goto done;
+
+  /* Start address. */
+  *eip = (void (*) (void)) image->entry;
+
+  success = true;
+
+ done:
+  /* We arrive here whether the load is successful or not. */
+  if (image != NULL)
+    exec_image_release (image);
+  return success;
+}
+
+#ifdef VM
+static thread_func prefetch_thread;
+
+/* Starts reading the code pages of the comma-separated
+   executables in NAMES into memory in the background, so that
+   the first process to run each finds them resident. */
+void
+process_prefetch (const char *names)
+{
+	char *copy = malloc (strlen (names) + 1);
+
+	if (copy == NULL)
+		return;
+	strlcpy (copy, names, strlen (names) + 1);
+	if (thread_create ("prefetch", PRI_MIN, prefetch_thread, copy) == TID_ERROR)
+		free (copy);
+}
+
+/* Prefetches the executables named in NAMES_, a malloc()'d
+   comma-separated list.  Each stays open and denied writes for
+   good, since its pages are found by its inode. */
+static void
+prefetch_thread (void *names_)
+{
+	char *names = names_;
+	char *name, *save;
+
+	for (name = strtok_r (names, ",", &save); name != NULL;
+			 name = strtok_r (NULL, ",", &save)) {
+		struct file *file = filesys_open (name);
+		struct exec_image *image;
+		int i;
+
+		if (file == NULL) {
+			printf ("prefetch: %s: open failed\n", name);
+			continue;
+		}
+		file_deny_write (file);
+		image = exec_cache_get (file);
+		if (image == NULL) {
+			image = read_image (file, name);
+			if (image == NULL) {
+				file_close (file);
+				continue;
+			}
+			exec_cache_add (file, image);
+		}
+
+		for (i = 0; i < image->seg_cnt; i++) {
+			const struct exec_seg *seg = &image->segs[i];
+			uint32_t ofs;
+
+			if (seg->writable)
+				continue;
+			for (ofs = 0; ofs < seg->read_bytes; ofs += PGSIZE) {
+				size_t left = seg->read_bytes - ofs;
+				if (!frame_prefetch (file, seg->file_page + ofs,
+							left < PGSIZE ? left : PGSIZE))
+					break;
+			}
+		}
+		exec_image_release (image);
+	}
+	free (names);
+}
+#endif
+
+/* Reads and verifies the executable header and program headers
+   of FILE, named FILE_NAME, and returns its image with one
+   reference, or a null pointer on failure. */
+static struct exec_image *
+read_image (struct file *file, const char *file_name)
+{
+  struct Elf32_Ehdr ehdr;
+  struct exec_image *image;
+  off_t file_ofs;
+  unsigned gen = inode_write_gen (file_get_inode (file));
+  int i;
+
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
       || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
@@ -334,9 +890,19 @@ load (const char *file_name, void (**eip) (void), void **esp, char *arg_start, i
       || ehdr.e_phnum > 1024) 
     {
       printf ("load: %s: error loading executable\n", file_name);
-      goto done; 
+      return NULL;
     }
 
+  image = malloc (sizeof *image + ehdr.e_phnum * sizeof *image->segs);
+  if (image == NULL)
+    return NULL;
+  image->inode = NULL;
+  image->gen = gen;
+  image->ref_cnt = 1;
+  image->entry = ehdr.e_entry;
+  image->load_end = 0;
+  image->seg_cnt = 0;
+
   /* Read program headers. */
   file_ofs = ehdr.e_phoff;
   for (i = 0; i < ehdr.e_phnum; i++) 
@@ -344,11 +910,11 @@ load (const char *file_name, void (**eip) (void), void **esp, char *arg_start, i
       struct Elf32_Phdr phdr;
 
       if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
+        goto error;
       file_seek (file, file_ofs);
 
       if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
+        goto error;
       file_ofs += sizeof phdr;
       switch (phdr.p_type) 
         {
@@ -362,56 +928,50 @@ load (const char *file_name, void (**eip) (void), void **esp, char *arg_start, i
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-          goto done;
+          goto error;
         case PT_LOAD:
           if (validate_segment (&phdr, file)) 
             {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
+              struct exec_seg *seg = &image->segs[image->seg_cnt++];
               uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
+
+              seg->writable = (phdr.p_flags & PF_W) != 0;
+              seg->file_page = phdr.p_offset & ~PGMASK;
+              seg->mem_page = phdr.p_vaddr & ~PGMASK;
               if (phdr.p_filesz > 0)
                 {
                   /* Normal segment.
                      Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
+                  seg->read_bytes = page_offset + phdr.p_filesz;
+                  seg->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz,
+                                               PGSIZE)
+                                     - seg->read_bytes);
                 }
               else 
                 {
                   /* Entirely zero.
                      Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+                  seg->read_bytes = 0;
+                  seg->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz,
+                                              PGSIZE);
                 }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
+              if (seg->mem_page + seg->read_bytes + seg->zero_bytes
+                  > image->load_end)
+                image->load_end = (seg->mem_page + seg->read_bytes
+                                   + seg->zero_bytes);
             }
           else
-            goto done;
+            goto error;
           break;
         }
     }
+  return image;
 
-  /* Set up stack. */
-  if (!setup_stack (esp, arg_start, arg_len, argc))
-    goto done;
-
-  /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
-
-  success = true;
-
- done:
-	lock_release (&filesys_lock);
-	lock_release (&filesys_rlock);
-  /* We arrive here whether the load is successful or not. */
-  return success;
+ error:
+  free (image);
+  return NULL;
 }
-
+
 /* load() helpers. */
 
 /* Checks whether PHDR describes a valid, loadable segment in
@@ -484,9 +1044,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 #ifdef VM
 	if (file_length (file) < (off_t)(ofs + read_bytes))
 		return false;
+	/* Just record the segment as a region; its pages are read in
+		 when first touched. */
+	return page_map (upage, (read_bytes + zero_bytes) / PGSIZE, file, ofs,
+			read_bytes, writable, writable ? SEGTYPE_DATA : SEGTYPE_CODE);
 #else
 	file_seek (file, ofs);
-#endif
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -495,15 +1058,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-#ifdef VM
-      /* Just record that it is valid page to the SPT. */
-			uint8_t segtype = writable ? SEGTYPE_DATA : SEGTYPE_CODE;
-			if (!page_alloc (upage, file, ofs, page_read_bytes, page_zero_bytes, 
-					writable, segtype)){
-				return false;
-			}
-			ofs += page_read_bytes;
-#else
 			/* Get a page of memory. */
 			uint8_t *kpage = palloc_get_page (PAL_USER);
 			if (kpage == NULL)
@@ -523,7 +1077,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 					palloc_free_page (kpage);
 					return false;
 				}
-#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -531,79 +1084,96 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
-/* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+/* Most pages the initial argument block may take up. */
+#define ARG_PAGES 8
+
+/* Create a minimal stack by mapping zeroed pages at the top of
+   user virtual memory, as many as it takes to hold the argument
+   block for the ARGC words in ARGS, and build that block in them:
+   the words, argv[] and its null terminator, argv, argc and a
+   fake return address. */
 static bool
-setup_stack (void **esp, char *arg_start, int arg_len, int argc) 
+setup_stack (void **esp, const char *args, size_t args_len, int argc) 
 {
-  uint8_t *kpage;
-	uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
-  bool success = false;
-
+	size_t size = ROUND_UP (args_len, sizeof (char *))
+		+ (argc + 1) * sizeof (char *) + 3 * sizeof (uint32_t);
+	size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
 #ifdef VM
-	success = page_alloc (upage, NULL, 0, 0, PGSIZE, 
-			true, SEGTYPE_STACK);
-	if (!success)
-		return false;
-	kpage = frame_alloc (upage);
-	memset (kpage, 0, PGSIZE);
-#else
-	kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+	uint8_t *kpages[ARG_PAGES];
 #endif
-	if (kpage == NULL)
+	size_t installed = 0;
+	bool success;
+	char **argv;
+	char *word;
+	uint32_t *sp;
+	int i;
+
+	if (page_cnt > ARG_PAGES)
 		return false;
 
-	// TODO : page_alloc for 8MB sized Stack.
-	/* Mark valid to 2046 pages for stack. */
 #ifdef VM
-	int i;
-	for (i=1; i < STACK_PAGES; i++) {
-		if (!page_alloc (upage - (PGSIZE*i), NULL, 0, 0, PGSIZE,
-				true, SEGTYPE_STACK)) {
-			return false;
-		}
-	}
+	/* The stack region; only the pages the arguments take get their
+		 SPTEs now, the others when first touched. */
+	if (!page_map ((uint8_t *) PHYS_BASE - (size_t) STACK_PAGES * PGSIZE,
+				STACK_PAGES, NULL, 0, 0, true, SEGTYPE_STACK))
+		return false;
 #endif
 
-	/* Add the page to the process's address space. */
-	success = install_page (upage, kpage, true);
-
-  if (success)
-		{
-			memcpy(kpage + PGSIZE - arg_len, arg_start, arg_len);
-			uint32_t *kp = (uint32_t *) ((( ( ((unsigned)kpage+PGSIZE) - arg_len )>>2 )-1-argc-2)*4);
-			uint32_t *up = (uint32_t *) ((( ( ((unsigned)PHYS_BASE) - arg_len )>>2 )-1-argc)*4);
-			*kp = (uint32_t) argc;
-			*(kp+1) = (uint32_t) up;
-			*(kp+2) = (uint32_t) (up+argc+1);
-			char *p= (char *) *(kp+2);
-			if(*p!=0){
-			}else if(*(p+1)!=0){
-				*(kp+2) = (uint32_t) (p+1);
-			}else if(*(p+2)!=0){
-				*(kp+2) = (uint32_t) (p+2);
-			}else if(*(p+3)!=0){
-				*(kp+2) = (uint32_t) (p+3);
-			}
-			int i;
-			for (i=1;i<argc;i++){
-				char *s = (char *) *(kp+1+i);
-			*(kp+2+i) = (uint32_t) (s+strlen(s)+1);
-			}
-			*(kp+2+argc)= (uint32_t) 0;
+	while (installed < page_cnt) {
+		uint8_t *upage = (uint8_t *) PHYS_BASE - (installed + 1) * PGSIZE;
+		uint8_t *kpage;
 
-			*esp = up-3;
-		}
-	else
-		{
+#ifdef VM
+		if (!page_alloc (upage, NULL, 0, 0, PGSIZE, true, SEGTYPE_STACK))
+			break;
+		kpage = frame_alloc (upage);   /* Comes zeroed and pinned. */
+#else
+		kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+#endif
+		if (kpage == NULL)
+			break;
+		if (!install_page (upage, kpage, true)) {
 #ifdef VM
 			frame_free (kpage);
 #else
 			palloc_free_page (kpage);
 #endif
+			break;
 		}
-  return success;
+#ifdef VM
+		kpages[installed] = kpage;
+#endif
+		installed++;
+	}
+
+	success = installed == page_cnt;
+	if (success) {
+		/* The page directory is active, so the block is built in
+			 place through its user addresses, which also marks the
+			 pages dirty. */
+		word = (char *) PHYS_BASE - args_len;
+		memcpy (word, args, args_len);
+		argv = (char **) ROUND_DOWN ((uintptr_t) word, sizeof (char *)) - (argc + 1);
+		for (i = 0; i < argc; i++) {
+			argv[i] = word;
+			word += strlen (word) + 1;
+		}
+		argv[argc] = NULL;
+
+		sp = (uint32_t *) argv;
+		*--sp = (uint32_t) argv;
+		*--sp = (uint32_t) argc;
+		*--sp = 0;
+		*esp = sp;
+	}
+
+#ifdef VM
+	while (installed > 0)
+		frame_unpin (kpages[--installed]);
+#endif
+	return success;
 }
 
@@ -1,12 +1,44 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <stddef.h>
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
+
+/* An open file that process_start() gives the new process as
+   descriptor FD. */
+struct spawn_file
+  {
+    int fd;
+    struct file *file;
+  };
+
+/* Pages that hold a new process's command line, and the longest
+   command line that fits, counting the null terminator. */
+#define CMD_LINE_PAGES 2
+#define CMD_LINE_MAX (CMD_LINE_PAGES * PGSIZE - 128)
 
 thread_func start_process NO_RETURN;
+thread_func start_fork NO_RETURN;
+thread_func start_thread NO_RETURN;
+char *process_cmd_line_alloc (void);
+void process_cmd_line_free (char *);
 tid_t process_execute (const char *file_name);
+tid_t process_start (char *cmd_line, bool wait_load,
+                     const struct spawn_file *, size_t file_cnt);
+struct intr_frame;
+tid_t process_fork (const struct intr_frame *);
+tid_t process_thread_spawn (const struct intr_frame *, void *eip, void *esp);
+struct thread *process_current (void);
 int process_wait (tid_t);
+int process_wait_any (tid_t *);
 void process_exit (void);
 void process_activate (void);
+void process_init (void);
+void process_print_stats (void);
+#ifdef VM
+void process_prefetch (const char *names);
+#endif
 
 #endif /* userprog/process.h */
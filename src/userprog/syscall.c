@@ -4,38 +4,69 @@
 #include <string.h>
 #include <syscall-nr.h>
 #include <debug.h>
+#include "filesys/defrag.h"
+#include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/pipe.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
 #include "devices/shutdown.h"
 #include "threads/palloc.h"
+#include "threads/pmc.h"
+#include "threads/profile.h"
+#include "userprog/aio.h"
+#include "userprog/exception.h"
 #include "userprog/process.h"
+#include "userprog/pagedir.h"
 #include "threads/synch.h"
 #include "devices/input.h"
+#include "devices/timer.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
 
 #define MIN(x, y)	(((x)>(y))?(y):(x))
 #define MAX(x, y)	(((x)>(y))?(x):(y))
 
-/* Virtual addr -> de-ref uint32_t. */
-#define VPOP(x) (*((uint32_t *)user_vtop((const void *)(x))))
-
-/* Lock of whole file system. [TODO]Should be divided into 
-	 multiple small locks later. */
-struct lock filesys_lock;
-struct lock filesys_wlock;
-struct lock filesys_rlock;
+/* Most iovecs readv() and writev() copy in at once. */
+#define IOV_BATCH 8
 
 static void syscall_handler (struct intr_frame *);
-static bool str_over_boundary (const char *);
 static char *strlbond (char *, const char *, size_t);
-static int get_next_fd (struct thread *);
+static int fd_alloc (struct thread *, struct file *);
+static struct file **fd_lookup (const struct thread *, int fd);
+
+/* Cursor over the pages spanned by a user buffer, so that each
+	 page is translated only once.  The page of the current chunk
+	 stays pinned in memory until the next one is fetched or
+	 ubuf_end() is called, so the kernel may use it across I/O. */
+struct ubuf_iter
+	{
+		const uint8_t *uaddr;        /* User address of the next chunk. */
+		size_t left;                 /* Bytes not yet visited. */
+		bool writing;                /* Will the kernel store into it? */
+		void *pinned;                /* Frame pinned for the current chunk,
+		                                or null. */
+	};
+
+static void ubuf_init (struct ubuf_iter *, const void *, size_t, bool);
+static size_t ubuf_next (struct ubuf_iter *, uint8_t **);
+static void ubuf_end (struct ubuf_iter *);
+static void copy_in (void *, const void *, size_t);
+static void copy_out (void *, const void *, size_t);
+static int file_xfer (struct file *, void *, unsigned, bool, off_t);
+static int pipe_xfer (struct file *, void *, unsigned, bool);
 
 /* Projects 2 and later. */
 static void halt (void);
 static pid_t exec (const char *file);
+static pid_t sys_fork (struct intr_frame *);
 static int wait (pid_t);
 static bool create (const char *file, unsigned initial_size);
 static bool remove (const char *file);
@@ -47,159 +78,424 @@ static void seek (int fd, unsigned position);
 static unsigned tell (int fd);
 static void close (int fd);
 
+/* Extensions. */
+static int pread (int fd, void *buffer, unsigned length, unsigned offset);
+static int pwrite (int fd, const void *buffer, unsigned length,
+		unsigned offset);
+static int readv (int fd, const struct iovec *iov, int iovcnt);
+static int writev (int fd, const struct iovec *iov, int iovcnt);
+static int copy_file (int in_fd, int out_fd, unsigned length);
+static int io_ring_enter (struct io_ring *);
+static int sys_aio_read (int fd, void *buffer, unsigned length,
+		unsigned offset);
+static int sys_aio_write (int fd, const void *buffer, unsigned length,
+		unsigned offset);
+static int sys_aio_wait (int id);
+static int fsync (int fd);
+static int fdatasync (int fd);
+static int fallocate (int fd, unsigned offset, unsigned length);
+static int defrag (int fd);
+static void *sbrk (intptr_t increment);
+static int getrusage (int who, struct rusage *);
+static void print_cpu_times (struct thread *);
+static pid_t spawn (const char *cmd_line, const struct spawn_action *,
+		int action_cnt);
+static int madvise (void *addr, size_t length, int advice);
+static int mlock (void *addr, size_t length);
+static int munlock (void *addr, size_t length);
+static int getdents (int fd, struct dirent *, int cnt);
+static int stat (const char *file, struct stat *);
+static int fstat (int fd, struct stat *);
+static int pipe (int *fds);
+static pid_t sys_thread_spawn (struct intr_frame *, void *eip, void *esp);
+static void sys_thread_exit (int status);
+static int futex_wait (int *addr, int val);
+static int futex_wake (int *addr, int cnt);
+static int sleep_ms (unsigned ms);
+static int nanosleep (const struct timespec *);
+static int clock_gettime (int clock, struct timespec *);
+static pid_t wait_any (int *status);
+static int pmc_enable (void);
+
 /* Project 3 and optionally project 4. */
-static mapid_t mmap (int fd, void *addr) UNUSED;
-static void munmap (mapid_t) UNUSED;
+static mapid_t mmap (int fd, void *addr);
+static void munmap (mapid_t);
+static int sys_shm_open (const char *name, unsigned size);
+static mapid_t sys_shm_map (int fd, void *addr);
 
 /* Project 4 only. */
-static bool chdir (const char *dir) UNUSED;
-static bool mkdir (const char *dir) UNUSED;
-static bool readdir (int fd, char name[READDIR_MAX_LEN + 1]) UNUSED;
-static bool isdir (int fd) UNUSED;
-static int inumber (int fd) UNUSED;
+static bool chdir (const char *dir);
+static bool mkdir (const char *dir);
+static bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
+static bool isdir (int fd);
+static int inumber (int fd);
+
+bool syscall_cpu_times;
 
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-	lock_init (&filesys_lock);
-	lock_init (&filesys_wlock);
-	lock_init (&filesys_rlock);
 }
 
+/* What the dispatcher knows about each system call. */
+struct syscall_info
+	{
+		const char *name;           /* For statistics. */
+		size_t argc;                /* Number of arguments. */
+	};
+
+static const struct syscall_info syscalls[] =
+	{
+		[SYS_HALT] = {"halt", 0},          [SYS_EXIT] = {"exit", 1},
+		[SYS_EXEC] = {"exec", 1},          [SYS_WAIT] = {"wait", 1},
+		[SYS_CREATE] = {"create", 2},      [SYS_REMOVE] = {"remove", 1},
+		[SYS_OPEN] = {"open", 1},          [SYS_FILESIZE] = {"filesize", 1},
+		[SYS_READ] = {"read", 3},          [SYS_WRITE] = {"write", 3},
+		[SYS_SEEK] = {"seek", 2},          [SYS_TELL] = {"tell", 1},
+		[SYS_CLOSE] = {"close", 1},        [SYS_MMAP] = {"mmap", 2},
+		[SYS_MUNMAP] = {"munmap", 1},      [SYS_CHDIR] = {"chdir", 1},
+		[SYS_MKDIR] = {"mkdir", 1},        [SYS_READDIR] = {"readdir", 2},
+		[SYS_ISDIR] = {"isdir", 1},        [SYS_INUMBER] = {"inumber", 1},
+		[SYS_FORK] = {"fork", 0},          [SYS_PREAD] = {"pread", 4},
+		[SYS_PWRITE] = {"pwrite", 4},      [SYS_READV] = {"readv", 3},
+		[SYS_WRITEV] = {"writev", 3},      [SYS_COPY_FILE] = {"copy_file", 3},
+		[SYS_IO_RING_ENTER] = {"io_ring_enter", 1},
+		[SYS_AIO_READ] = {"aio_read", 4},  [SYS_AIO_WRITE] = {"aio_write", 4},
+		[SYS_AIO_WAIT] = {"aio_wait", 1},  [SYS_FSYNC] = {"fsync", 1},
+		[SYS_FDATASYNC] = {"fdatasync", 1}, [SYS_SBRK] = {"sbrk", 1},
+		[SYS_GETRUSAGE] = {"getrusage", 2}, [SYS_SPAWN] = {"spawn", 3},
+		[SYS_MADVISE] = {"madvise", 3},    [SYS_GETDENTS] = {"getdents", 3},
+		[SYS_STAT] = {"stat", 2},          [SYS_FSTAT] = {"fstat", 2},
+		[SYS_PIPE] = {"pipe", 1},          [SYS_SHM_OPEN] = {"shm_open", 2},
+		[SYS_SHM_MAP] = {"shm_map", 2},    [SYS_THREAD_SPAWN] = {"thread_spawn", 2},
+		[SYS_THREAD_EXIT] = {"thread_exit", 1},
+		[SYS_FUTEX_WAIT] = {"futex_wait", 2}, [SYS_FUTEX_WAKE] = {"futex_wake", 2},
+		[SYS_SLEEP_MS] = {"sleep_ms", 1},  [SYS_NANOSLEEP] = {"nanosleep", 1},
+		[SYS_CLOCK_GETTIME] = {"clock_gettime", 2}, [SYS_WAIT_ANY] = {"wait_any", 1},
+		[SYS_PMC_ENABLE] = {"pmc_enable", 0}, [SYS_FALLOCATE] = {"fallocate", 3},
+		[SYS_DEFRAG] = {"defrag", 1},      [SYS_MLOCK] = {"mlock", 2},
+		[SYS_MUNLOCK] = {"munlock", 2},
+	};
+
+#define SYSCALL_CNT (sizeof syscalls / sizeof *syscalls)
+
+/* Calls made and cycles spent in them, per system call, for the
+	 profiler.  Calls that don't return, like exit, add no cycles. */
+static unsigned long long call_cnt[SYSCALL_CNT];
+static uint64_t call_cycles[SYSCALL_CNT];
+
+/* Copies the system call number and then, as many as it takes,
+	 the arguments from the user stack in one go, and dispatches.
+	 A process making an unknown call is killed. */
 static void
 syscall_handler (struct intr_frame *f) 
 {
 	uint32_t *esp = f->esp;
-
-	/* Check %esp. */
-	if ((void *)esp >= PHYS_BASE) exit (-1);
-	
-	int syscall_num = VPOP(esp);
-
-	/* Check %esp more. */
-	switch(syscall_num) {
-	/* If argument is one. */
-	case SYS_EXIT: case SYS_EXEC: case SYS_WAIT: case SYS_REMOVE:
-	case SYS_OPEN: case SYS_FILESIZE: case SYS_TELL: case SYS_CLOSE:
-	case SYS_MUNMAP: case SYS_CHDIR: case SYS_MKDIR: case SYS_ISDIR:
-	case SYS_INUMBER:
-		if ((void *)(esp+1) >= PHYS_BASE) exit (-1);
-		break;
-	/* If argument is two. */
-	case SYS_CREATE: case SYS_SEEK: case SYS_MMAP: case SYS_READDIR:
-		if ((void *)(esp+2) >= PHYS_BASE) exit (-1);
-		break;
-	/* If argument is three. */
-	case SYS_READ: case SYS_WRITE:
-		if ((void *)(esp+3) >= PHYS_BASE) exit (-1);
-		break;
-	}
+	uint32_t args[5];   /* System call number, then its arguments. */
+	unsigned syscall_num;
+	uint64_t start;
+
+#ifdef VM
+	frame_check_suspend ();
+#endif
+	exit_check ();
+	copy_in (args, esp, sizeof *args);
+	syscall_num = args[0];
+	if (syscall_num >= SYSCALL_CNT)
+		exit (-1);
+	copy_in (args + 1, esp + 1, syscalls[syscall_num].argc * sizeof *args);
+	trace (TRACE_SYSCALL, syscall_num, args[1]);
+	call_cnt[syscall_num]++;
+	start = timer_cycles ();
 
 	switch(syscall_num){
   /* Projects 2 and later. */
 	case SYS_HALT:     /*void*/      halt ();  break;
-	case SYS_EXIT:     /*void*/      exit ((int) VPOP(esp+1));  break;
-	case SYS_EXEC:     f->eax =      exec ((const char *) VPOP(esp+1));  break;
-	case SYS_WAIT:     f->eax =      wait ((pid_t) VPOP(esp+1));  break;
-	case SYS_CREATE:   f->eax =    create ((const char *) VPOP(esp+1), (unsigned) VPOP(esp+2));  break;
-	case SYS_REMOVE:   f->eax =    remove ((const char *) VPOP(esp+1));  break;
-	case SYS_OPEN:     f->eax =      open ((const char *) VPOP(esp+1));  break;
-	case SYS_FILESIZE: f->eax =  filesize ((int) VPOP(esp+1));  break;
-	case SYS_READ:     f->eax =      read ((int) VPOP(esp+1), (void *) VPOP(esp+2), (unsigned) VPOP(esp+3));  break;
-	case SYS_WRITE:    f->eax =     write ((int) VPOP(esp+1), (const void *) VPOP(esp+2), (unsigned) VPOP(esp+3));  break;
-	case SYS_SEEK:     /*void*/      seek ((int) VPOP(esp+1), (unsigned) VPOP(esp+2));  break;
-	case SYS_TELL:     f->eax =      tell ((int) VPOP(esp+1));  break;
-	case SYS_CLOSE:    /*void*/     close ((int) VPOP(esp+1));  break;
+	case SYS_EXIT:     /*void*/      exit ((int) args[1]);  break;
+	case SYS_EXEC:     f->eax =      exec ((const char *) args[1]);  break;
+	case SYS_WAIT:     f->eax =      wait ((pid_t) args[1]);  break;
+	case SYS_CREATE:   f->eax =    create ((const char *) args[1], (unsigned) args[2]);  break;
+	case SYS_REMOVE:   f->eax =    remove ((const char *) args[1]);  break;
+	case SYS_OPEN:     f->eax =      open ((const char *) args[1]);  break;
+	case SYS_FILESIZE: f->eax =  filesize ((int) args[1]);  break;
+	case SYS_READ:     f->eax =      read ((int) args[1], (void *) args[2], (unsigned) args[3]);  break;
+	case SYS_WRITE:    f->eax =     write ((int) args[1], (const void *) args[2], (unsigned) args[3]);  break;
+	case SYS_SEEK:     /*void*/      seek ((int) args[1], (unsigned) args[2]);  break;
+	case SYS_TELL:     f->eax =      tell ((int) args[1]);  break;
+	case SYS_CLOSE:    /*void*/     close ((int) args[1]);  break;
 
   /* Project 3 and optionally project 4. */
-	case SYS_MMAP:     /*printf("SYS_MMAP\n");*/  break;
-	case SYS_MUNMAP:   /*printf("SYS_MUNMAP\n");*/  break;
+	case SYS_MMAP:     f->eax =      mmap ((int) args[1], (void *) args[2]);  break;
+	case SYS_MUNMAP:   /*void*/    munmap ((mapid_t) args[1]);  break;
 
   /* Project 4 only. */
-	case SYS_CHDIR:    printf("SYS_CHDIR\n");  break;
-	case SYS_MKDIR:    printf("SYS_MKDIR\n");  break;
-	case SYS_READDIR:  printf("SYS_READDIR\n");  break;
-	case SYS_ISDIR:    printf("SYS_ISDIR\n");  break;
-	case SYS_INUMBER:  printf("SYS_INUMBER\n");  break;
-	default:	PANIC ("Wrong system call number.\n");  break;
+	case SYS_CHDIR:    f->eax =     chdir ((const char *) args[1]);  break;
+	case SYS_MKDIR:    f->eax =     mkdir ((const char *) args[1]);  break;
+	case SYS_READDIR:  f->eax =   readdir ((int) args[1], (char *) args[2]);  break;
+	case SYS_ISDIR:    f->eax =     isdir ((int) args[1]);  break;
+	case SYS_INUMBER:  f->eax =   inumber ((int) args[1]);  break;
+
+  /* Extensions. */
+	case SYS_FORK:     f->eax =  sys_fork (f);  break;
+	case SYS_PREAD:    f->eax =     pread ((int) args[1], (void *) args[2], (unsigned) args[3], (unsigned) args[4]);  break;
+	case SYS_PWRITE:   f->eax =    pwrite ((int) args[1], (const void *) args[2], (unsigned) args[3], (unsigned) args[4]);  break;
+	case SYS_READV:    f->eax =     readv ((int) args[1], (const struct iovec *) args[2], (int) args[3]);  break;
+	case SYS_WRITEV:   f->eax =    writev ((int) args[1], (const struct iovec *) args[2], (int) args[3]);  break;
+	case SYS_COPY_FILE: f->eax = copy_file ((int) args[1], (int) args[2], (unsigned) args[3]);  break;
+	case SYS_IO_RING_ENTER: f->eax = io_ring_enter ((struct io_ring *) args[1]);  break;
+	case SYS_AIO_READ:  f->eax = sys_aio_read ((int) args[1], (void *) args[2], (unsigned) args[3], (unsigned) args[4]);  break;
+	case SYS_AIO_WRITE: f->eax = sys_aio_write ((int) args[1], (const void *) args[2], (unsigned) args[3], (unsigned) args[4]);  break;
+	case SYS_AIO_WAIT:  f->eax = sys_aio_wait ((int) args[1]);  break;
+	case SYS_FSYNC:    f->eax =     fsync ((int) args[1]);  break;
+	case SYS_FDATASYNC: f->eax = fdatasync ((int) args[1]);  break;
+	case SYS_SBRK:     f->eax = (uint32_t) sbrk ((intptr_t) args[1]);  break;
+	case SYS_GETRUSAGE: f->eax = getrusage ((int) args[1], (struct rusage *) args[2]);  break;
+	case SYS_SPAWN:    f->eax =     spawn ((const char *) args[1], (const struct spawn_action *) args[2], (int) args[3]);  break;
+	case SYS_MADVISE:  f->eax =   madvise ((void *) args[1], (size_t) args[2], (int) args[3]);  break;
+	case SYS_GETDENTS: f->eax =  getdents ((int) args[1], (struct dirent *) args[2], (int) args[3]);  break;
+	case SYS_STAT:     f->eax =      stat ((const char *) args[1], (struct stat *) args[2]);  break;
+	case SYS_FSTAT:    f->eax =     fstat ((int) args[1], (struct stat *) args[2]);  break;
+	case SYS_PIPE:     f->eax =      pipe ((int *) args[1]);  break;
+	case SYS_SHM_OPEN: f->eax = sys_shm_open ((const char *) args[1], (unsigned) args[2]);  break;
+	case SYS_SHM_MAP:  f->eax = sys_shm_map ((int) args[1], (void *) args[2]);  break;
+	case SYS_THREAD_SPAWN: f->eax = sys_thread_spawn (f, (void *) args[1], (void *) args[2]);  break;
+	case SYS_THREAD_EXIT: /*void*/ sys_thread_exit ((int) args[1]);  break;
+	case SYS_FUTEX_WAIT: f->eax = futex_wait ((int *) args[1], (int) args[2]);  break;
+	case SYS_FUTEX_WAKE: f->eax = futex_wake ((int *) args[1], (int) args[2]);  break;
+	case SYS_SLEEP_MS: f->eax =  sleep_ms ((unsigned) args[1]);  break;
+	case SYS_NANOSLEEP: f->eax = nanosleep ((const struct timespec *) args[1]);  break;
+	case SYS_CLOCK_GETTIME: f->eax = clock_gettime ((int) args[1], (struct timespec *) args[2]);  break;
+	case SYS_WAIT_ANY: f->eax = wait_any ((int *) args[1]);  break;
+	case SYS_PMC_ENABLE: f->eax = pmc_enable ();  break;
+	case SYS_FALLOCATE: f->eax = fallocate ((int) args[1], (unsigned) args[2], (unsigned) args[3]);  break;
+	case SYS_DEFRAG:   f->eax =     defrag ((int) args[1]);  break;
+	case SYS_MLOCK:    f->eax =      mlock ((void *) args[1], (size_t) args[2]);  break;
+	case SYS_MUNLOCK:  f->eax =    munlock ((void *) args[1], (size_t) args[2]);  break;
 	}
+	call_cycles[syscall_num] += timer_cycles () - start;
+	fd_unpin_all ();
+	exit_check ();
 }
 
-/* Checks if a string is over page boundary. */
-static bool
-str_over_boundary (const char *s){
-	char *page = (char *) pg_round_down (s);
-	uintptr_t offset = pg_ofs (s);
+/* Prints the number of calls to each system call made, and the
+	 average cycles they took, if profiling. */
+void
+syscall_print_stats (void)
+{
+	size_t i;
 
-	for (; offset<PGSIZE; offset++)
-		if(page[offset]=='\0')
-			return false;
-	return true;
+	if (!profile_enabled)
+		return;
+	for (i = 0; i < SYSCALL_CNT; i++)
+		if (call_cnt[i] > 0)
+			printf ("Syscall %s: %llu calls, %llu cycles each\n", syscalls[i].name,
+							call_cnt[i], call_cycles[i] / call_cnt[i]);
 }
 
-/* Bond and copy string from user virtual address src to kernel 
-	 page dst. It cannot copy string over one page. */
+/* Copies the string at user address SRC into kernel buffer DST
+	 of SIZE bytes, truncating it to fit.  Kills the process if the
+	 string is not in valid user memory. */
 static char *
-strlbond (char *dst, const char *src, size_t size){
-	
-	const char *s = (const char *) user_vtop ((const void *) src);
-	uintptr_t soffset = pg_ofs(src);
-	uintptr_t doffset = 0;
-	if (s==NULL)
-		exit (-1);
-	if (str_over_boundary (s)){
-		memcpy (dst, s, MIN(PGSIZE-soffset, size-1));
-		doffset += MIN(PGSIZE-soffset, size-1);
-		dst[doffset] = '\0';
-		s = (const char *) user_vtop ((const void *) src+doffset);
-		if (s==NULL)
-			exit (-1);
-	}
+strlbond (char *dst, const char *src, size_t size)
+{
+	struct ubuf_iter it;
+	uint8_t *kaddr;
+	size_t chunk;
+	size_t len = 0;
 
-	ASSERT (!str_over_boundary (s));
+	ASSERT (size > 0);
 
-	strlcpy (dst+doffset, s, size-doffset);
+	ubuf_init (&it, src, size - 1, false);
+	while ((chunk = ubuf_next (&it, &kaddr)) > 0)
+		{
+			const uint8_t *nul = memchr (kaddr, '\0', chunk);
+			size_t n = nul != NULL ? (size_t) (nul - kaddr) : chunk;
+
+			memcpy (dst + len, kaddr, n);
+			len += n;
+			if (nul != NULL)
+				break;
+		}
+	ubuf_end (&it);
+	dst[len] = '\0';
 
 	return dst;
 }
 
-/* Search file that has opened with fd in thread's open_list. */
+/* Returns the slot of T's file descriptor table holding FD, or a
+	 null pointer if FD is not open. */
+static struct file **
+fd_lookup (const struct thread *t, int fd)
+{
+	size_t slot = (size_t) fd - FD_MIN;
+
+	if (fd < FD_MIN || slot >= t->fd_cap || t->fds[slot] == NULL)
+		return NULL;
+	return &t->fds[slot];
+}
+
+/* Returns the file the current process has open as FD, or a null
+	 pointer.  While other threads share the descriptor table, the
+	 file stays open until the current system call ends even if one
+	 of them closes FD meanwhile; a call may only go on using the
+	 last two files it looked up. */
 struct file *
 get_file_by_fd (int fd) {
-	struct thread *t = thread_current ();
-	struct list_elem *e;
+	struct thread *cur = thread_current ();
+	struct thread *p = cur->process;
+	struct file **fp;
+	struct file *f;
 
-  for (e = list_begin (&t->open_list); e != list_end (&t->open_list);
-       e = list_next (e))
-    {
-			struct openfile *of = list_entry (e, struct openfile, openelem);
-			if ( of->fd == fd )
-				return of->f;
-		}
-	return NULL;
+	/* No other thread to add one, while there are none. */
+	if (p->thread_cnt == 0) {
+		fp = fd_lookup (p, fd);
+		return fp != NULL ? *fp : NULL;
+	}
+
+	lock_acquire (&p->proc_lock);
+	fp = fd_lookup (p, fd);
+	f = fp != NULL ? file_dup (*fp) : NULL;
+	lock_release (&p->proc_lock);
+	if (f != NULL) {
+		struct file **pin = &cur->fd_pins[cur->next_fd_pin++ % FD_PINS];
+		file_close (*pin);
+		*pin = f;
+	}
+	return f;
 }
 
-/* Search openfile that has opened with fd in thread's open_list. */
-struct openfile *
-get_openfile_by_fd (int fd) {
-	struct thread *t = thread_current ();
-	struct list_elem *e;
+/* Lets go of the files get_file_by_fd() kept open for the current
+	 system call. */
+void
+fd_unpin_all (void)
+{
+	struct thread *cur = thread_current ();
+	size_t i;
 
-  for (e = list_begin (&t->open_list); e != list_end (&t->open_list);
-       e = list_next (e))
-    {
-			struct openfile *of = list_entry (e, struct openfile, openelem);
-			if ( of->fd == fd )
-				return of;
+	for (i = 0; i < FD_PINS; i++)
+		if (cur->fd_pins[i] != NULL) {
+			file_close (cur->fd_pins[i]);
+			cur->fd_pins[i] = NULL;
 		}
-	return NULL;
 }
 
-/* Allocates and returns a new file descriptor. */
+/* Doubles the size of T's file descriptor table.  Returns false if
+	 memory is short.  T's proc_lock must be held. */
+static bool
+fd_grow (struct thread *t)
+{
+	size_t cap = t->fd_cap != 0 ? 2 * t->fd_cap : 32;
+	struct file **fds;
+	uint32_t *used;
+
+	fds = realloc (t->fds, cap * sizeof *fds);
+	if (fds == NULL)
+		return false;
+	t->fds = fds;
+	used = realloc (t->fd_used, cap / 32 * sizeof *used);
+	if (used == NULL)
+		return false;
+	t->fd_used = used;
+
+	memset (fds + t->fd_cap, 0, (cap - t->fd_cap) * sizeof *fds);
+	memset (used + t->fd_cap / 32, 0, (cap - t->fd_cap) / 32 * sizeof *used);
+	t->fd_cap = cap;
+	return true;
+}
+
+/* Gives F the lowest file descriptor process T has free and
+	 returns it, or -1 if memory is short. */
 static int
-get_next_fd (struct thread *t) {
-	return (++t->lastfd);
+fd_alloc (struct thread *t, struct file *f)
+{
+	size_t word, bit;
+	int fd = -1;
+
+	lock_acquire (&t->proc_lock);
+	for (word = 0; word < t->fd_cap / 32; word++)
+		if (t->fd_used[word] != UINT32_MAX)
+			break;
+	if (word < t->fd_cap / 32 || fd_grow (t)) {
+		for (bit = 0; t->fd_used[word] & (1u << bit); bit++)
+			continue;
+		t->fd_used[word] |= 1u << bit;
+		t->fds[word * 32 + bit] = f;
+		fd = (int) (word * 32 + bit) + FD_MIN;
+	}
+	lock_release (&t->proc_lock);
+	return fd;
+}
+
+/* Installs F in T's file descriptor table as FD.  Returns false if
+	 FD is out of range or taken, or memory is short.  T must be a
+	 new process, with no other threads. */
+bool
+fd_install (struct thread *t, int fd, struct file *f)
+{
+	size_t slot = (size_t) fd - FD_MIN;
+
+	ASSERT (t->process == t && t->thread_cnt == 0);
+
+	if (fd < FD_MIN || fd > FD_MIN + 1023)
+		return false;
+	while (slot >= t->fd_cap)
+		if (!fd_grow (t))
+			return false;
+	if (t->fds[slot] != NULL)
+		return false;
+	t->fds[slot] = f;
+	t->fd_used[slot / 32] |= 1u << slot % 32;
+	return true;
+}
+
+/* Gives DST, a new process with no open files, its own copy of
+	 each file process SRC has open, under the same descriptor and at
+	 the same position.  Returns false if memory is short; whatever
+	 was copied is closed by fd_table_destroy(). */
+bool
+fd_table_copy (struct thread *dst, struct thread *src)
+{
+	bool success = true;
+	size_t slot;
+
+	ASSERT (dst->fd_cap == 0);
+
+	lock_acquire (&src->proc_lock);
+	while (success && dst->fd_cap < src->fd_cap)
+		success = fd_grow (dst);
+	for (slot = 0; success && slot < src->fd_cap; slot++)
+		if (src->fds[slot] != NULL)
+			{
+				struct file *f = file_reopen (src->fds[slot]);
+				if (f == NULL)
+					success = false;
+				else
+					{
+						file_seek (f, file_tell (src->fds[slot]));
+						dst->fds[slot] = f;
+						dst->fd_used[slot / 32] |= 1u << slot % 32;
+					}
+			}
+	lock_release (&src->proc_lock);
+	return success;
+}
+
+/* Closes every file T has open and frees its file descriptor
+	 table. */
+void
+fd_table_destroy (struct thread *t)
+{
+	size_t slot;
+
+	for (slot = 0; slot < t->fd_cap; slot++)
+		if (t->fds[slot] != NULL)
+			file_close (t->fds[slot]);
+	free (t->fds);
+	free (t->fd_used);
+	t->fds = NULL;
+	t->fd_used = NULL;
+	t->fd_cap = 0;
 }
 
 /* System call `halt'. */
@@ -209,42 +505,169 @@ halt (void)
   shutdown_power_off ();
 }
 
-/* System call `exit'. */
+/* A thread blocked in futex_wait(). */
+struct futex_waiter
+	{
+		const int *uaddr;           /* Word it waits on. */
+		struct semaphore woken;     /* Upped by futex_wake(). */
+		struct list_elem elem;      /* In its process's futex_waiters. */
+	};
+
+/* Wakes every thread of process P blocked in futex_wait().  P's
+	 proc_lock must be held. */
+static void
+futex_wake_all (struct thread *p)
+{
+	while (!list_empty (&p->futex_waiters))
+		sema_up (&list_entry (list_pop_front (&p->futex_waiters),
+					struct futex_waiter, elem)->woken);
+}
+
+/* Waits until process P, the running one, has no threads from
+	 thread_spawn() left. */
+static void
+wait_for_threads (struct thread *p)
+{
+	lock_acquire (&p->proc_lock);
+	while (p->thread_cnt > 0) {
+		lock_release (&p->proc_lock);
+		sema_down (&p->thread_gone);
+		lock_acquire (&p->proc_lock);
+	}
+	lock_release (&p->proc_lock);
+}
+
+/* System call `exit'.  Ends the whole process, with STATUS unless
+	 another of its threads called exit() first.  Each of the others
+	 ends at its next entry to the kernel, or return from it, and the
+	 process's first thread, which holds its state, goes last. */
 void
 exit (int status)
 {
 	struct thread *cur = thread_current ();
+	struct thread *p = cur->process;
 	struct file *f = cur->my_binary;
 
-	if (f!=NULL){
-		lock_acquire (&filesys_lock);
+	lock_acquire (&p->proc_lock);
+	if (!p->exiting) {
+		p->exiting = true;
+		p->exit_status = status;
+		futex_wake_all (p);
+	}
+	lock_release (&p->proc_lock);
+	if (p != cur)
+		thread_exit ();
+	wait_for_threads (p);
 
+	if (f!=NULL)
 		file_close (f);
 
-		lock_release (&filesys_lock);
-	}
-
-	cur->exit_status = status;
-	printf ("%s: exit(%d)\n", cur->name, status);
+	printf ("%s: exit(%d)\n", cur->name, cur->exit_status);
+	print_cpu_times (cur);
+	pmc_exit (cur);
 	thread_exit ();
 }
 
+/* Ends the running thread, as exit() does, if another thread of
+	 its process has called exit().  Called where it holds no locks:
+	 on entry to and return from system calls, and on interrupts from
+	 user mode. */
+void
+exit_check (void)
+{
+	struct thread *p = thread_current ()->process;
+
+	if (p->exiting)
+		exit (p->exit_status);
+}
+
 /* System call `exec'. */
 static pid_t
 exec (const char *_cmd_line)
 {
+	char *cmd_line;
+
 	if ((void *)_cmd_line >= PHYS_BASE)
 		exit (-1);
-	char *cmd_line = (char *) malloc (4096);
-	if (cmd_line==NULL)
+	cmd_line = process_cmd_line_alloc ();
+	if (cmd_line == NULL)
 		return -1;
-	strlbond (cmd_line, _cmd_line, (size_t)PGSIZE);
-	pid_t pid = (pid_t) process_execute (cmd_line);
-	free (cmd_line);
+	strlbond (cmd_line, _cmd_line, CMD_LINE_MAX);
+	return (pid_t) process_start (cmd_line, true, NULL, 0);
+}
+
+/* System call `spawn'.  Like exec(), but returns before the
+	 program has loaded; if it fails to load, wait() returns -1.
+	 The new process starts with the files that the ACTION_CNT
+	 ACTIONS set up.  Returns -1 if any of them fails. */
+static pid_t
+spawn (const char *_cmd_line, const struct spawn_action *_actions,
+		int action_cnt)
+{
+	enum { PATH_MAX = PGSIZE / SPAWN_ACTION_MAX };
+	struct spawn_action actions[SPAWN_ACTION_MAX];
+	struct spawn_file files[SPAWN_ACTION_MAX];
+	char *cmd_line, *paths;
+	int i, cnt = 0;
+	pid_t pid = -1;
+
+	if ((void *)_cmd_line >= PHYS_BASE || action_cnt < 0)
+		exit (-1);
+	if (action_cnt > SPAWN_ACTION_MAX)
+		return -1;
+	copy_in (actions, _actions, action_cnt * sizeof *actions);
+
+	/* Copy in the command line, then each path, before opening
+		 anything, so that a bad pointer can't leak open files. */
+	cmd_line = process_cmd_line_alloc ();
+	paths = palloc_get_page (0);
+	if (cmd_line == NULL || paths == NULL)
+		goto done;
+	strlbond (cmd_line, _cmd_line, CMD_LINE_MAX);
+	for (i = 0; i < action_cnt; i++)
+		if (actions[i].type == SPAWN_OPEN) {
+			if ((void *) actions[i].path >= PHYS_BASE)
+				exit (-1);
+			strlbond (paths + i * PATH_MAX, actions[i].path, PATH_MAX);
+		}
 
+	for (cnt = 0; cnt < action_cnt; cnt++) {
+		const struct spawn_action *a = &actions[cnt];
+		struct file *f = NULL;
+
+		if (a->type == SPAWN_DUP) {
+			struct file *src = get_file_by_fd (a->src_fd);
+			if (src != NULL && (f = file_reopen (src)) != NULL)
+				file_seek (f, file_tell (src));
+		}
+		else if (a->type == SPAWN_OPEN)
+			f = filesys_open (paths + cnt * PATH_MAX);
+		if (f == NULL)
+			goto done;
+		files[cnt].fd = a->fd;
+		files[cnt].file = f;
+	}
+
+	pid = process_start (cmd_line, false, files, cnt);
+	cmd_line = NULL;
+	cnt = 0;
+
+ done:
+	for (i = 0; i < cnt; i++)
+		file_close (files[i].file);
+	process_cmd_line_free (cmd_line);
+	palloc_free_page (paths);
 	return pid;
 }
 
+/* System call `fork'.  Named so as not to clash with the
+	 builtin. */
+static pid_t
+sys_fork (struct intr_frame *f)
+{
+	return (pid_t) process_fork (f);
+}
+
 /* System call `wait'. */
 static int
 wait (pid_t pid)
@@ -252,6 +675,34 @@ wait (pid_t pid)
 	return process_wait((tid_t) pid);
 }
 
+/* System call `wait_any'.  Waits for whichever child process
+   exits first, stores its exit status into *STATUS unless STATUS
+   is null, and returns its pid, or returns PID_ERROR if there are
+   no children to wait for. */
+static pid_t
+wait_any (int *status)
+{
+	tid_t tid;
+	int s = process_wait_any (&tid);
+
+	if (tid == TID_ERROR)
+		return PID_ERROR;
+	if (status != NULL)
+		copy_out (status, &s, sizeof s);
+	return (pid_t) tid;
+}
+
+/* System call `pmc_enable'.  Lets the process read performance
+	 counters 0 up to the return value, less 1, with RDPMC, and
+	 prints its totals when it exits.  Returns 0 if the CPU has no
+	 counters, in which case only TSC cycles are totaled, or -1 if
+	 memory is short. */
+static int
+pmc_enable (void)
+{
+	return pmc_enable_user ();
+}
+
 /* System call `create'. */
 static bool
 create (const char *_file, unsigned initial_size)
@@ -265,9 +716,7 @@ create (const char *_file, unsigned initial_size)
 		return false;
 	strlbond (file, _file, (size_t)PGSIZE);
 
-	lock_acquire (&filesys_lock);
 	success = filesys_create (file, initial_size);
-	lock_release (&filesys_lock);
 
 	palloc_free_page (file);
   return success;
@@ -286,9 +735,7 @@ remove (const char *_file)
 		return false;
 	strlbond (file, _file, (size_t)PGSIZE);
 
-	lock_acquire (&filesys_lock);
 	success = filesys_remove (file);
-	lock_release (&filesys_lock);
 
 	palloc_free_page (file);
   return success;
@@ -301,7 +748,7 @@ open (const char *_file)
 	if ((void *)_file >= PHYS_BASE)
 		exit (-1);
 
-	struct thread *t = thread_current ();
+	struct thread *t = process_current ();
 	struct file *f;
 
 	char *file = (char *) palloc_get_page (0);
@@ -309,300 +756,1302 @@ open (const char *_file)
 		return -1;
 	strlbond (file, _file, (size_t)PGSIZE);
 
-	lock_acquire (&filesys_lock);
 	f = filesys_open (file);
 
 	palloc_free_page (file);
 
-	if (f==NULL) { /* File open fail. */
-		lock_release (&filesys_lock);
+	if (f==NULL) /* File open fail. */
 		return -1;
-	}
 
-	/* Add (fd, f) mapping into thread's open_list */
-	struct openfile *of = (struct openfile *) calloc (1, sizeof(struct openfile));
-	if (of==NULL) {
-		lock_release (&filesys_lock);
-		return -1;
-	}
-	of->fd = get_next_fd(t);
-	of->f = f;
-	list_push_back (&t->open_list, &of->openelem);
+	int fd = fd_alloc (t, f);
+	if (fd < 0)
+		file_close (f);
 
-	lock_release (&filesys_lock);
-  return of->fd;
+  return fd;
 }
 
 /* System call `filesize'. */
 static int
 filesize (int fd) 
 {
-	int len;
-
-	lock_acquire (&filesys_lock);
 	struct file *f = get_file_by_fd (fd);
 
-	if (f==NULL) {
-		lock_release (&filesys_lock);
+	if (f==NULL)
 		return -1;
-	}
 
-	len = (int) file_length (f);
-	lock_release (&filesys_lock);
+  return (int) file_length (f);
+}
 
-  return len;
+/* Starts iterating over the SIZE-byte user buffer UBUF.  WRITING
+	 tells whether the kernel is going to store into the buffer. */
+static void
+ubuf_init (struct ubuf_iter *it, const void *ubuf, size_t size,
+		bool writing)
+{
+	it->uaddr = (const uint8_t *) ubuf;
+	it->left = size;
+	it->writing = writing;
+	it->pinned = NULL;
 }
 
-/* System call `read'. */
-static int
-read (int fd, void *_buffer, unsigned size)
+/* Returns the kernel address of the page holding IT's next chunk,
+	 faulting it in if necessary, and pins its frame into
+	 IT->pinned.  Kills the process if the chunk is not valid user
+	 memory. */
+static uint8_t *
+ubuf_pin (struct ubuf_iter *it)
 {
-	off_t offset = 0;
+	struct thread *t = process_current ();
+	void *upage = pg_round_down (it->uaddr);
+	void *kpage;
 
-	if ((void *)(_buffer) >= PHYS_BASE)
+#ifdef VM
+	for (;;)
+		{
+			bool dirty;
+
+			if (frame_pin_page (t, upage, &kpage, &dirty))
+				{
+					if (!it->writing || pagedir_is_writable (t->pagedir, upage))
+						{
+							it->pinned = kpage;
+							return kpage;
+						}
+					frame_unpin (kpage);
+				}
+			else if (!it->writing
+					&& (kpage = pagedir_get_page (t->pagedir, upage)) != NULL)
+				return kpage;    /* The zero frame, which stays put. */
+
+			/* Stores through the kernel alias bypass the PTE's
+				 protection, so a copy-on-write page is broken first.
+				 The page may be evicted again before it is pinned. */
+			if (!demand_paging (it->uaddr, it->writing))
+				exit (-1);
+		}
+#else
+	kpage = pagedir_get_page (t->pagedir, upage);
+	if (kpage == NULL)
 		exit (-1);
+	return kpage;
+#endif
+}
 
-	char *buffer = (char *) user_vtop (_buffer);
-	if (buffer==NULL)
+/* Translates the next page-bounded chunk of the user buffer and
+	 stores its kernel address into *KADDR.  Returns the length of
+	 the chunk, or 0 once the whole buffer has been visited.
+	 Kills the process if the chunk is not valid user memory. */
+static size_t
+ubuf_next (struct ubuf_iter *it, uint8_t **kaddr)
+{
+	size_t chunk;
+
+	ubuf_end (it);
+	if (it->left == 0)
+		return 0;
+	if (!is_user_vaddr (it->uaddr))
 		exit (-1);
-	uintptr_t remain = (uintptr_t) pg_round_down(buffer+PGSIZE) - (uintptr_t) buffer;
 
-	lock_acquire (&filesys_rlock);
-	if (fd == STDIN_FILENO)
+	*kaddr = ubuf_pin (it) + pg_ofs (it->uaddr);
+	/* Stores through the kernel alias do not set the user PTE's
+		 dirty bit, which eviction relies on. */
+	if (it->writing)
+		pagedir_set_dirty (process_current ()->pagedir,
+				pg_round_down (it->uaddr), true);
+
+	chunk = MIN (it->left, (size_t) (PGSIZE - pg_ofs (it->uaddr)));
+	it->uaddr += chunk;
+	it->left -= chunk;
+	return chunk;
+}
+
+/* Unpins the page of IT's current chunk, if any.  Needed only
+	 when stopping before ubuf_next() has returned 0. */
+static void
+ubuf_end (struct ubuf_iter *it)
+{
+#ifdef VM
+	if (it->pinned != NULL)
 		{
-			while (size>0){
-				off_t st_offset = offset;
-				lock_acquire (&filesys_lock);
-				for (; size>0 && (pg_ofs(buffer+offset)!=0 || offset==st_offset);
-						offset++, size--) {
-					buffer[offset] = input_getc ();
-				}
-				lock_release (&filesys_lock);
-				if(size>0) {
-					buffer = (char *) user_vtop (_buffer+offset);
-					if (buffer == NULL)
-						exit (-1);
-					buffer -= offset;
-				}
-			}
+			frame_unpin (it->pinned);
+			it->pinned = NULL;
 		}
-	else
+#else
+	(void) it;
+#endif
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Kills the
+	 process if they are not all valid user memory. */
+static void
+copy_in (void *dst, const void *usrc, size_t size)
+{
+	struct ubuf_iter it;
+	uint8_t *kaddr;
+	size_t chunk;
+	uint8_t *d = dst;
+
+	ubuf_init (&it, usrc, size, false);
+	while ((chunk = ubuf_next (&it, &kaddr)) > 0)
 		{
-			lock_acquire (&filesys_lock);
-			struct file *f = get_file_by_fd (fd);
-			lock_release (&filesys_lock);
-			if (f==NULL) {
-				lock_release (&filesys_rlock);
-				return -1;
-			}
+			memcpy (d, kaddr, chunk);
+			d += chunk;
+		}
+}
 
-			while (size>0) {
-				lock_acquire (&filesys_lock);
-				//off_t read_now = file_read (f, buffer+offset, (off_t) MIN(size, remain));
-				off_t read_now = file_read (f, buffer+offset, (off_t) 1);
-				lock_release (&filesys_lock);
+/* Copies SIZE bytes from SRC to user address UDST.  Kills the
+	 process if they are not all valid, writable user memory. */
+static void
+copy_out (void *udst, const void *src, size_t size)
+{
+	struct ubuf_iter it;
+	uint8_t *kaddr;
+	size_t chunk;
+	const uint8_t *s = src;
 
-				if (read_now==0) {
-					lock_release (&filesys_rlock);
-					return  (int) offset;
+	ubuf_init (&it, udst, size, true);
+	while ((chunk = ubuf_next (&it, &kaddr)) > 0)
+		{
+			memcpy (kaddr, s, chunk);
+			s += chunk;
+		}
+}
+
+#ifdef VM
+/* Copies what the page cache has of the CHUNK bytes at byte OFS
+	 of F, or at F's position, which it advances, if OFS is negative,
+	 into KADDR.  Returns the number of bytes copied, from the
+	 start. */
+static size_t
+read_cached (struct file *f, uint8_t *kaddr, size_t chunk, off_t ofs)
+{
+	struct inode *inode = file_get_inode (f);
+	off_t pos = ofs >= 0 ? ofs : file_tell (f);
+	size_t n = 0, now;
+
+	if (!inode_page_cached (inode))
+		return 0;
+
+	/* A chunk spans at most two file pages. */
+	while (n < chunk
+			&& (now = frame_read_cached (inode, kaddr + n, chunk - n, pos + n)) > 0)
+		n += now;
+	if (ofs < 0 && n > 0)
+		file_seek (f, pos + n);
+	return n;
+}
+
+/* If IT's next chunk is a whole user page and the page at byte OFS
+	 of F, or at F's position, which it advances, if OFS is negative,
+	 is a whole page in the page cache, maps that page there instead
+	 of copying it, and moves IT past the page. */
+static bool
+flip_page (struct file *f, struct ubuf_iter *it, off_t ofs)
+{
+	struct inode *inode = file_get_inode (f);
+	off_t pos;
+
+	if (it->left < PGSIZE || pg_ofs (it->uaddr) != 0
+			|| !is_user_vaddr (it->uaddr) || !inode_page_cached (inode))
+		return false;
+	pos = ofs >= 0 ? ofs : file_tell (f);
+	if (pos % PGSIZE != 0)
+		return false;
+
+	ubuf_end (it);
+	if (!frame_flip (inode, pos, (void *) it->uaddr))
+		return false;
+	if (ofs < 0)
+		file_seek (f, pos + PGSIZE);
+	it->uaddr += PGSIZE;
+	it->left -= PGSIZE;
+	return true;
+}
+#endif
+
+/* Moves up to SIZE bytes between file F and user buffer UBUF,
+	 reading from F into UBUF if TO_USER is true and writing UBUF
+	 into F otherwise.  The transfer starts at byte OFS of F, or at
+	 F's current position, which it advances, if OFS is negative.
+	 Each page of UBUF is handed to the file system as one chunk.
+	 Returns the number of bytes moved, which is short only at end
+	 of file. */
+static int
+file_xfer (struct file *f, void *ubuf, unsigned size, bool to_user,
+		off_t ofs)
+{
+	struct ubuf_iter it;
+	uint8_t *kaddr;
+	size_t chunk;
+	int done = 0;
+
+	ubuf_init (&it, ubuf, size, to_user);
+	for (;;)
+		{
+			off_t now;
+
+#ifdef VM
+			if (to_user && flip_page (f, &it, ofs >= 0 ? ofs + done : -1))
+				{
+					done += PGSIZE;
+					continue;
+				}
+#endif
+			if ((chunk = ubuf_next (&it, &kaddr)) == 0)
+				break;
+#ifdef VM
+			if (to_user)
+				{
+					size_t cached = read_cached (f, kaddr, chunk,
+							ofs >= 0 ? ofs + done : -1);
+
+					done += (int) cached;
+					if (cached == chunk)
+						continue;
+					kaddr += cached;
+					chunk -= cached;
 				}
+#endif
+			if (ofs >= 0 && to_user)
+				now = file_read_at (f, kaddr, (off_t) chunk, ofs + done);
+			else if (ofs >= 0)
+				now = file_write_at (f, kaddr, (off_t) chunk, ofs + done);
+			else if (to_user)
+				now = file_read (f, kaddr, (off_t) chunk);
+			else
+				now = file_write (f, kaddr, (off_t) chunk);
+
+			done += (int) now;
+			if ((size_t) now < chunk)
+				break;
+		}
+	ubuf_end (&it);
+	return done;
+}
 
-				offset += (int) read_now;
-				size -= (unsigned) read_now;
-				if(size>0) {
-					buffer = (char *) user_vtop (_buffer+offset);
-					if (buffer == NULL)
-						exit (-1);
-					buffer -= offset;
-					//remain = PGSIZE-pg_ofs(buffer+offset);
-					//ASSERT (remain == PGSIZE);
+/* Moves up to SIZE bytes between pipe end F and user buffer UBUF
+	 a page at a time, like file_xfer().  A read waits only until the
+	 pipe has some data; a write waits for room for all of it.
+	 Returns the number of bytes moved, or -1 if F is the wrong end
+	 or, for a write, no reader is left. */
+static int
+pipe_xfer (struct file *f, void *ubuf, unsigned size, bool to_user)
+{
+	struct inode *inode = file_get_inode (f);
+	struct ubuf_iter it;
+	uint8_t *kaddr;
+	size_t chunk;
+	int done = 0;
+
+	ubuf_init (&it, ubuf, size, to_user);
+	while ((chunk = ubuf_next (&it, &kaddr)) > 0)
+		{
+			off_t now;
+
+			if (to_user)
+				now = pipe_read (inode, kaddr, (off_t) chunk, done == 0);
+			else
+				now = pipe_write (inode, kaddr, (off_t) chunk);
+			if (now < 0)
+				{
+					if (done == 0)
+						done = -1;
+					break;
 				}
-			}
+			done += (int) now;
+			if ((size_t) now < chunk)
+				break;
 		}
-	lock_release (&filesys_rlock);
-	if ((void *)(_buffer+offset-1) >= PHYS_BASE)
-		exit (-1);
-  return  (int) offset;
+	ubuf_end (&it);
+	return done;
 }
 
-/* System call `write'. */
+/* System call `read'. */
 static int
-write (int fd, const void *_buffer, unsigned size)
+read (int fd, void *buffer, unsigned size)
 {
-	off_t offset = 0;
+	int bytes_read;
 
-	if ((void *)(_buffer) >= PHYS_BASE)
-		exit (-1);
+	if (fd == STDIN_FILENO)
+		{
+			struct ubuf_iter it;
+			uint8_t *kaddr;
+			size_t chunk;
+
+			/* Waits only for the first line; then takes what lines
+				 are there. */
+			bytes_read = 0;
+			ubuf_init (&it, buffer, size, true);
+			while ((chunk = ubuf_next (&it, &kaddr)) > 0)
+				{
+					size_t n = input_read (kaddr, chunk, bytes_read == 0);
+
+					bytes_read += (int) n;
+					if (n < chunk)
+						break;
+				}
+			ubuf_end (&it);
+		}
+	else
+		{
+			struct file *f = get_file_by_fd (fd);
+			if (f==NULL)
+				return -1;
+			if (pipe_is_pipe (file_get_inode (f)))
+				return pipe_xfer (f, buffer, size, true);
+			bytes_read = file_xfer (f, buffer, size, true, -1);
+		}
+  return bytes_read;
+}
 
-	char *buffer = (char *) user_vtop (_buffer);
-	if (buffer==NULL)
-		exit (-1);
-	uintptr_t remain = (uintptr_t) pg_round_down(buffer+PGSIZE) - (uintptr_t) buffer;
+/* System call `write'. */
+static int
+write (int fd, const void *buffer, unsigned size)
+{
+	int bytes_written;
 
-	lock_acquire (&filesys_wlock);
 	if (fd == STDOUT_FILENO)
 		{
-			while (size>0){
-				off_t st_offset = offset;
-				lock_acquire (&filesys_lock);
-				for (; size>0 && (pg_ofs(buffer+offset)!=0 || offset==st_offset);
-						offset++, size--) {
-					putbuf ((const char *)buffer+offset, (size_t)1);
-				}
-				lock_release (&filesys_lock);
-				if(size>0) {
-					buffer = (char *) user_vtop (_buffer+offset);
-					if (buffer == NULL)
-						exit (-1);
-					buffer -= offset;
+			struct ubuf_iter it;
+			uint8_t *kaddr;
+			size_t chunk;
+
+			bytes_written = 0;
+			ubuf_init (&it, buffer, size, false);
+			while ((chunk = ubuf_next (&it, &kaddr)) > 0)
+				{
+					putbuf ((const char *) kaddr, chunk);
+					bytes_written += (int) chunk;
 				}
-			}
 		}
 	else
 		{
-			lock_acquire (&filesys_lock);
 			struct file *f = get_file_by_fd (fd);
-			lock_release (&filesys_lock);
-			if (f==NULL) {
-				lock_release (&filesys_wlock);
+			if (f==NULL)
+				return -1;
+			else if (pipe_is_pipe (file_get_inode (f)))
+				return pipe_xfer (f, (void *) buffer, size, false);
+			else if (inode_is_dir (file_get_inode (f)))
 				return -1;
-			} else if (f->deny_write) {
-				lock_release (&filesys_wlock);
+			else if (f->deny_write)
 				return 0;
-			}
+			bytes_written = file_xfer (f, (void *) buffer, size, false, -1);
+		}
+  return bytes_written;
+}
 
-			while (size>0) {
-				lock_acquire (&filesys_lock);
-				off_t wrote_now = file_write (f, buffer+offset, (off_t) 1);
-				//off_t wrote_now = file_write (f, buffer+offset, (off_t) MIN(size, remain));
-				lock_release (&filesys_lock);
+/* System call `pread'.  Like read() from a file, but at byte
+	 OFFSET, leaving the file position alone. */
+static int
+pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+	struct file *f = get_file_by_fd (fd);
+	if (f==NULL || (off_t) offset < 0 || pipe_is_pipe (file_get_inode (f)))
+		return -1;
+	return file_xfer (f, buffer, size, true, (off_t) offset);
+}
 
-				if (wrote_now==0) {
-					lock_release (&filesys_wlock);
-					return  (int) offset;
-				}
+/* System call `pwrite'.  Like write() to a file, but at byte
+	 OFFSET, leaving the file position alone. */
+static int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+	struct file *f = get_file_by_fd (fd);
+	if (f==NULL || (off_t) offset < 0 || pipe_is_pipe (file_get_inode (f)))
+		return -1;
+	else if (f->deny_write)
+		return 0;
+	return file_xfer (f, (void *) buffer, size, false, (off_t) offset);
+}
+
+/* Reads into, if TO_USER is true, or writes out the IOVCNT
+	 buffers described by user array IOV in turn, as read() or
+	 write() on FD would, stopping after a short transfer.  Returns
+	 the number of bytes moved, or -1 if FD is not open. */
+static int
+xferv (int fd, const struct iovec *iov, int iovcnt, bool to_user)
+{
+	struct iovec batch[IOV_BATCH];
+	int done = 0;
+	int i;
+
+	if (iovcnt < 0)
+		return -1;
+	for (i = 0; i < iovcnt; i++)
+		{
+			struct iovec *v = &batch[i % IOV_BATCH];
+			int now;
+
+			if (i % IOV_BATCH == 0)
+				copy_in (batch, iov + i,
+						MIN (iovcnt - i, IOV_BATCH) * sizeof *batch);
+			if (to_user)
+				now = read (fd, v->iov_base, v->iov_len);
+			else
+				now = write (fd, v->iov_base, v->iov_len);
+			if (now < 0)
+				return -1;
+			done += now;
+			if ((size_t) now < v->iov_len)
+				break;
+		}
+	return done;
+}
+
+/* System call `readv'. */
+static int
+readv (int fd, const struct iovec *iov, int iovcnt)
+{
+	return xferv (fd, iov, iovcnt, true);
+}
+
+/* System call `writev'. */
+static int
+writev (int fd, const struct iovec *iov, int iovcnt)
+{
+	return xferv (fd, iov, iovcnt, false);
+}
 
-				offset += (int) wrote_now;
-				size -= (unsigned) wrote_now;
-				if(size>0) {
-					buffer = (char *) user_vtop (_buffer+offset);
-					if (buffer == NULL)
-						exit (-1);
-					buffer -= offset;
-					//remain = PGSIZE-pg_ofs(buffer+offset);
-					//ASSERT (remain == PGSIZE);
+/* System call `copy_file'.  Copies up to SIZE bytes from the
+	 current position of file IN_FD to that of file OUT_FD inside
+	 the kernel, advancing both.  Returns the number of bytes
+	 copied, or -1 if either is not an open file. */
+static int
+copy_file (int in_fd, int out_fd, unsigned size)
+{
+	struct file *in = get_file_by_fd (in_fd);
+	struct file *out = get_file_by_fd (out_fd);
+
+	if (in==NULL || out==NULL)
+		return -1;
+	else if (out->deny_write)
+		return 0;
+	if ((off_t) size < 0)
+		size = INT32_MAX;
+	return (int) file_copy (out, in, (off_t) size);
+}
+
+/* System call `io_ring_enter'.  Carries out the requests queued
+	 in user RING, in order, as long as there is room for their
+	 completions.  Returns the number carried out. */
+static int
+io_ring_enter (struct io_ring *ring)
+{
+	unsigned idx[4];   /* sq_head, sq_tail, cq_head, cq_tail. */
+	int done = 0;
+
+	copy_in (idx, ring, sizeof idx);
+	while (idx[0] != idx[1] && idx[3] - idx[2] < IO_RING_ENTRIES)
+		{
+			struct io_sqe sqe;
+			struct io_cqe cqe;
+
+			copy_in (&sqe, &ring->sq[idx[0] % IO_RING_ENTRIES], sizeof sqe);
+			cqe.user_data = sqe.user_data;
+			cqe.res = 0;
+			switch (sqe.op)
+				{
+				case IO_READ:  cqe.res = read (sqe.fd, sqe.buf, sqe.len);  break;
+				case IO_WRITE: cqe.res = write (sqe.fd, sqe.buf, sqe.len);  break;
+				case IO_SEEK:  seek (sqe.fd, sqe.len);  break;
+				case IO_CLOSE: close (sqe.fd);  break;
+				default:       cqe.res = -1;  break;
 				}
-			}
+			copy_out (&ring->cq[idx[3] % IO_RING_ENTRIES], &cqe, sizeof cqe);
+			idx[0]++;
+			idx[3]++;
+			done++;
 		}
-	lock_release (&filesys_wlock);
-	if ((void *)(_buffer+offset-1) >= PHYS_BASE)
-		exit (-1);
-  return  (int) offset;
+
+	/* Publish the new heads of both queues. */
+	copy_out (&ring->sq_head, &idx[0], sizeof idx[0]);
+	copy_out (&ring->cq_tail, &idx[3], sizeof idx[3]);
+	return done;
+}
+
+/* Starts moving up to SIZE bytes, at most AIO_MAX_SIZE, between
+	 byte OFFSET of file FD and user BUFFER.  Returns the request's
+	 id, or -1 if FD is not an open file or memory is short. */
+static int
+aio_start (int fd, void *buffer, unsigned size, unsigned offset, bool write)
+{
+	struct file *f = get_file_by_fd (fd);
+	void *buf;
+	int id;
+
+	if (f==NULL || (off_t) offset < 0)
+		return -1;
+	size = MIN (size, (unsigned) AIO_MAX_SIZE);
+	buf = malloc (size > 0 ? size : 1);
+	if (buf==NULL)
+		return -1;
+	if (write)
+		copy_in (buf, buffer, size);
+	id = aio_submit (f, write && !f->deny_write, (off_t) offset, buf,
+			write && f->deny_write ? 0 : (off_t) size, buffer);
+	if (id < 0)
+		free (buf);
+	return id;
+}
+
+/* System call `aio_read'.  Like pread(), but returns at once with
+	 an id for aio_wait(), which delivers the data.  The process
+	 must not rely on BUFFER's contents before then. */
+static int
+sys_aio_read (int fd, void *buffer, unsigned size, unsigned offset)
+{
+	return aio_start (fd, buffer, size, offset, false);
+}
+
+/* System call `aio_write'.  Like pwrite(), but returns at once
+	 with an id for aio_wait().  BUFFER has already been copied and
+	 may be reused. */
+static int
+sys_aio_write (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+	return aio_start (fd, (void *) buffer, size, offset, true);
+}
+
+/* System call `aio_wait'.  Waits for request ID and returns the
+	 number of bytes it moved, or -1 if there is no such request. */
+static int
+sys_aio_wait (int id)
+{
+	struct aio_req *r = aio_wait (id);
+	int result;
+
+	if (r==NULL)
+		return -1;
+	/* Should this kill the process, R is freed on exit. */
+	if (!r->write && r->result > 0)
+		copy_out (r->ubuf, r->buf, r->result);
+	result = r->result;
+	aio_free (r);
+	return result;
+}
+
+/* System call `fdatasync'.  Writes FD's modified data, and what
+	 is needed to find it, to disk.  Returns 0, or -1 if FD is not
+	 open. */
+static int
+fdatasync (int fd)
+{
+	struct file *f = get_file_by_fd (fd);
+
+	if (f==NULL)
+		return -1;
+	inode_sync (file_get_inode (f));
+	return 0;
+}
+
+/* System call `fsync'.  Like fdatasync(), but also writes the
+	 free map, so that the file system is consistent on disk. */
+static int
+fsync (int fd)
+{
+	if (fdatasync (fd) < 0)
+		return -1;
+	free_map_sync ();
+	return 0;
+}
+
+/* System call `fallocate'.  Allocates disk space for the LENGTH
+	 bytes of FD at OFFSET, extending the file if they go past its
+	 end, so that writing them later needs no allocation.  They
+	 read as zeros until written.  Returns 0, or -1 if FD is not an
+	 open file on disk or the disk is full. */
+static int
+fallocate (int fd, unsigned offset, unsigned length)
+{
+	struct file *f = get_file_by_fd (fd);
+
+	if (f==NULL || offset > INT32_MAX || length > INT32_MAX)
+		return -1;
+	return inode_allocate (file_get_inode (f), offset, length) ? 0 : -1;
+}
+
+/* System call `defrag'.  Queues FD's file to have its data moved
+	 into one run on disk in the background.  Returns 0, or -1 if FD
+	 is not open or memory is short. */
+static int
+defrag (int fd)
+{
+	struct file *f = get_file_by_fd (fd);
+
+	if (f==NULL || !defrag_queue (file_get_inode (f)))
+		return -1;
+	return 0;
 }
 
 /* System call `seek'. */
 static void
 seek (int fd, unsigned position) 
 {
-	lock_acquire (&filesys_lock);
 	struct file *f = get_file_by_fd (fd);
-	if (f==NULL) {
-		lock_release (&filesys_lock);
+	if (f==NULL)
 		return;
-	}
 
 	file_seek (f, (off_t) position);
-	lock_release (&filesys_lock);
 }
 
 /* System call `tell'. */
 static unsigned
 tell (int fd) 
 {
-	lock_acquire (&filesys_lock);
 	struct file *f = get_file_by_fd (fd);
-	if (f==NULL) {
-		lock_release (&filesys_lock);
+	if (f==NULL)
 		return -1;
-	}
-	unsigned ret = file_tell (f);
-	lock_release (&filesys_lock);
-	return ret;
+	return file_tell (f);
 }
 
 /* System call `close'. */
 static void
 close (int fd)
 {
-	lock_acquire (&filesys_lock);
-	struct openfile *of = get_openfile_by_fd (fd);
-	if (of==NULL) {
-		lock_release (&filesys_lock);
+	struct thread *t = process_current ();
+	struct file **fp;
+	struct file *f;
+
+	lock_acquire (&t->proc_lock);
+	fp = fd_lookup (t, fd);
+	if (fp==NULL) {
+		lock_release (&t->proc_lock);
 		return;
 	}
+	f = *fp;
+	*fp = NULL;
+	t->fd_used[(fd - FD_MIN) / 32] &= ~(1u << (fd - FD_MIN) % 32);
+	lock_release (&t->proc_lock);
 
-	file_close (of->f);
-	list_remove (&of->openelem);
-	free (of);
-	
-	lock_release (&filesys_lock);
+	file_close (f);
 }
 
 /* ----- til here, enough for project2 ----- */
 
 /* System call `mmap'. */
 static mapid_t
-mmap (int fd UNUSED, void *_addr UNUSED)
+mmap (int fd UNUSED, void *addr UNUSED)
 {
-	//TODO
-  return 0;
+#ifdef VM
+	struct file *f = get_file_by_fd (fd);
+	mapid_t mapid;
+
+	if (f==NULL)
+		return MAP_FAILED;
+	/* The mapping outlives a close() of FD. */
+	f = file_reopen (f);
+	if (f==NULL)
+		return MAP_FAILED;
+	lock_acquire (&process_current ()->mm_lock);
+	mapid = page_mmap (f, addr);
+	lock_release (&process_current ()->mm_lock);
+	if (mapid == MAP_FAILED)
+		file_close (f);
+	return mapid;
+#else
+	return MAP_FAILED;
+#endif
 }
 
 /* System call `munmap'. */
 static void
 munmap (mapid_t mapid UNUSED)
 {
-  //TODO
+#ifdef VM
+	lock_acquire (&process_current ()->mm_lock);
+	page_munmap (mapid);
+	lock_release (&process_current ()->mm_lock);
+#endif
+}
+
+/* System call `shm_open'.  Opens the shared memory object NAME,
+	 creating it with SIZE bytes of zeros if there is none, and
+	 returns a file descriptor for it, or -1. */
+static int
+sys_shm_open (const char *_name UNUSED, unsigned size UNUSED)
+{
+#ifdef VM
+	char name[SHM_NAME_MAX + 2];
+	struct file *f;
+	int fd;
+
+	if ((void *) _name >= PHYS_BASE)
+		exit (-1);
+	strlbond (name, _name, sizeof name);
+	f = shm_open (name, size);
+	if (f == NULL)
+		return -1;
+	fd = fd_alloc (process_current (), f);
+	if (fd < 0)
+		file_close (f);
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+/* System call `shm_map'.  Maps the shared memory object open as
+	 FD at ADDR, until munmap() of the id returned. */
+static mapid_t
+sys_shm_map (int fd UNUSED, void *addr UNUSED)
+{
+#ifdef VM
+	struct file *f = get_file_by_fd (fd);
+	mapid_t mapid;
+
+	if (f==NULL)
+		return MAP_FAILED;
+	/* The mapping outlives a close() of FD. */
+	f = file_reopen (f);
+	if (f==NULL)
+		return MAP_FAILED;
+	lock_acquire (&process_current ()->mm_lock);
+	mapid = shm_map (f, addr);
+	lock_release (&process_current ()->mm_lock);
+	if (mapid == MAP_FAILED)
+		file_close (f);
+	return mapid;
+#else
+	return MAP_FAILED;
+#endif
+}
+
+/* System call `sbrk'.  Returns the old break, or (void *) -1 if
+	 the heap can't be moved. */
+static void *
+sbrk (intptr_t increment UNUSED)
+{
+#ifdef VM
+	void *old;
+
+	lock_acquire (&process_current ()->mm_lock);
+	old = page_sbrk (increment);
+	lock_release (&process_current ()->mm_lock);
+	if (old != NULL)
+		return old;
+#endif
+	return (void *) -1;
+}
+
+/* What add_process_times() passes thread_foreach(). */
+struct process_times
+	{
+		struct thread *process;
+		uint64_t *times;
+	};
+
+static void
+add_if_in_process (struct thread *t, void *pt_)
+{
+	struct process_times *pt = pt_;
+
+	if (t->process == pt->process)
+		thread_add_times (t, pt->times);
+}
+
+/* Adds to TIMES the cpu_times of process P, all of its threads
+	 included. */
+static void
+add_process_times (struct thread *p, uint64_t times[CPU_TIME_CNT])
+{
+	struct process_times pt;
+	enum intr_level old_level;
+	int i;
+
+	pt.process = p;
+	pt.times = times;
+	lock_acquire (&p->proc_lock);
+	for (i = 0; i < CPU_TIME_CNT; i++)
+		times[i] += p->exited_times[i];
+	old_level = intr_disable ();
+	thread_foreach (add_if_in_process, &pt);
+	intr_set_level (old_level);
+	lock_release (&p->proc_lock);
+}
+
+/* Prints the CPU times of process P, which has no other threads
+	 left, if -cputime asked for them. */
+static void
+print_cpu_times (struct thread *p)
+{
+	uint64_t times[CPU_TIME_CNT];
+
+	if (!syscall_cpu_times)
+		return;
+	memset (times, 0, sizeof times);
+	add_process_times (p, times);
+	printf ("%s: cpu: %"PRIu64" us user, %"PRIu64" us kernel, "
+					"%"PRIu64" us lock wait, %"PRIu64" us I/O wait\n", p->name,
+					timer_cycles_to_us (times[CPU_USER]),
+					timer_cycles_to_us (times[CPU_KERNEL]),
+					timer_cycles_to_us (times[CPU_LOCK_WAIT]),
+					timer_cycles_to_us (times[CPU_IO_WAIT]));
+}
+
+/* System call `getrusage'.  Returns 0, or -1 if WHO is not
+	 RUSAGE_SELF or RUSAGE_SYSTEM. */
+static int
+getrusage (int who, struct rusage *usage)
+{
+	uint64_t times[CPU_TIME_CNT];
+	struct rusage ru;
+#ifdef VM
+	const struct fault_stats *st;
+#endif
+
+	memset (times, 0, sizeof times);
+	memset (&ru, 0, sizeof ru);
+	if (who == RUSAGE_SELF) {
+		add_process_times (process_current (), times);
+#ifdef VM
+		st = &process_current ()->faults;
+#endif
+	} else if (who == RUSAGE_SYSTEM) {
+		thread_add_system_times (times);
+#ifdef VM
+		st = exception_fault_totals ();
+#endif
+	} else
+		return -1;
+
+	ru.ru_utime = timer_cycles_to_us (times[CPU_USER]);
+	ru.ru_stime = timer_cycles_to_us (times[CPU_KERNEL]);
+	ru.ru_lockwait = timer_cycles_to_us (times[CPU_LOCK_WAIT]);
+	ru.ru_iowait = timer_cycles_to_us (times[CPU_IO_WAIT]);
+#ifdef VM
+	ru.ru_majflt = st->major_cnt;
+	ru.ru_minflt = st->minor_cnt;
+	ru.ru_fileflt = st->type_cnt[FAULT_FILE];
+	ru.ru_swapflt = st->type_cnt[FAULT_SWAP];
+	ru.ru_zeroflt = st->type_cnt[FAULT_ZERO];
+	ru.ru_stackflt = st->type_cnt[FAULT_STACK];
+	ru.ru_cowflt = st->type_cnt[FAULT_COW];
+	ru.ru_nevict = st->evict_cnt;
+	ru.ru_nswapin = st->swapin_cnt;
+	ru.ru_nswapout = st->swapout_cnt;
+#endif
+	copy_out (usage, &ru, sizeof ru);
+	return 0;
+}
+
+/* System call `madvise'.  Returns 0, or -1 if ADDR is not
+	 page-aligned, the range is not all mapped, ADVICE is not one of
+	 MADV_*, or without virtual memory. */
+static int
+madvise (void *addr UNUSED, size_t length UNUSED, int advice UNUSED)
+{
+#ifdef VM
+	bool success;
+
+	lock_acquire (&process_current ()->mm_lock);
+	success = page_madvise (addr, length, advice);
+	lock_release (&process_current ()->mm_lock);
+	if (success)
+		return 0;
+#endif
+	return -1;
+}
+
+/* System call `mlock'.  Keeps the pages of LENGTH bytes at ADDR
+	 resident, so that accessing them never faults, until munlock()
+	 or exit.  Locks are not inherited by fork().  Returns 0, or -1
+	 if ADDR is not page-aligned, the range is not all mapped, too
+	 many pages are locked already, memory is short, or without
+	 virtual memory. */
+static int
+mlock (void *addr UNUSED, size_t length UNUSED)
+{
+#ifdef VM
+	bool success;
+
+	lock_acquire (&process_current ()->mm_lock);
+	success = page_mlock (addr, length);
+	lock_release (&process_current ()->mm_lock);
+	if (success)
+		return 0;
+#endif
+	return -1;
+}
+
+/* System call `munlock'.  Lets the pages locked by mlock() among
+	 LENGTH bytes at ADDR be paged out again.  Returns 0, or -1 if
+	 ADDR is not page-aligned, the range is not all mapped, or
+	 without virtual memory. */
+static int
+munlock (void *addr UNUSED, size_t length UNUSED)
+{
+#ifdef VM
+	bool success;
+
+	lock_acquire (&process_current ()->mm_lock);
+	success = page_munlock (addr, length);
+	lock_release (&process_current ()->mm_lock);
+	if (success)
+		return 0;
+#endif
+	return -1;
 }
 
 /* ----- til here, enough for project3 ----- */
 
+/* Runs FN on the path at user address _PATH, copied into the
+	 kernel, and returns its result. */
+static bool
+path_call (const char *_path, bool (*fn) (const char *))
+{
+	bool success;
+	char *path = (char *) palloc_get_page (0);
+	if (path==NULL)
+		return false;
+	strlbond (path, _path, (size_t)PGSIZE);
+
+	success = fn (path);
+
+	palloc_free_page (path);
+	return success;
+}
+
 /* System call `chdir'. */
 static bool
-chdir (const char *_dir UNUSED)
+chdir (const char *_dir)
 {
-	//TODO
-  return false;
+	return path_call (_dir, filesys_chdir);
 }
 
 /* System call `mkdir'. */
 static bool
-mkdir (const char *_dir UNUSED)
+mkdir (const char *_dir)
 {
-	//TODO
-  return false;
+	return path_call (_dir, filesys_mkdir);
 }
 
-/* System call `readdir'. */
+/* System call `readdir'.  Reads the next entry of directory FD,
+	 whose file position tracks the position in the directory. */
 static bool
-readdir (int fd UNUSED, char name[READDIR_MAX_LEN + 1] UNUSED) 
+readdir (int fd, char name[READDIR_MAX_LEN + 1]) 
 {
-	//TODO
-  return false;
+	struct file *f = get_file_by_fd (fd);
+	char kname[NAME_MAX + 1];
+	struct dir *dir;
+	bool success;
+
+	if (f==NULL || !inode_is_dir (file_get_inode (f)))
+		return false;
+	dir = dir_open (inode_reopen (file_get_inode (f)));
+	if (dir==NULL)
+		return false;
+	dir_seek (dir, file_tell (f));
+	success = dir_readdir (dir, kname, NULL);
+	file_seek (f, dir_tell (dir));
+	dir_close (dir);
+
+	if (success)
+		copy_out (name, kname, strlen (kname) + 1);
+  return success;
 }
 
 /* System call `isdir'. */
 static bool
-isdir (int fd UNUSED) 
+isdir (int fd) 
 {
-	//TODO
-  return false;
+	struct file *f = get_file_by_fd (fd);
+
+	return f!=NULL && inode_is_dir (file_get_inode (f));
 }
 
 /* System call `inumber'. */
 static int
-inumber (int fd UNUSED) 
+inumber (int fd) 
+{
+	struct file *f = get_file_by_fd (fd);
+
+	if (f==NULL)
+		return -1;
+  return (int) inode_get_inumber (file_get_inode (f));
+}
+
+/* Stores what stat() reports about INODE into *ST. */
+static void
+stat_inode (const struct inode *inode, struct stat *st)
+{
+	st->st_ino = inode_get_inumber (inode);
+	st->st_type = inode_is_dir (inode) ? DT_DIR : DT_REG;
+	st->st_size = inode_length (inode);
+}
+
+/* System call `getdents'.  Reads up to CNT entries of directory FD,
+	 starting where its file position is, into ENTS, and returns how
+	 many, 0 at the end of the directory, or -1 if FD is not a
+	 directory or memory is short.  At most a page of entries is
+	 read per call, into a kernel buffer, so that no directory is
+	 open while copying out. */
+static int
+getdents (int fd, struct dirent *ents, int cnt)
+{
+	struct file *f = get_file_by_fd (fd);
+	struct dirent *kents;
+	struct dir *dir;
+	bool short_mem = false;
+	int n = 0;
+
+	if (f==NULL || !inode_is_dir (file_get_inode (f)) || cnt < 0)
+		return -1;
+	cnt = MIN (cnt, (int) (PGSIZE / sizeof *kents));
+	kents = palloc_get_page (0);
+	dir = dir_open (inode_reopen (file_get_inode (f)));
+	if (kents==NULL || dir==NULL)
+		{
+			palloc_free_page (kents);
+			dir_close (dir);
+			return -1;
+		}
+
+	dir_seek (dir, file_tell (f));
+	while (n < cnt)
+		{
+			struct dirent *de = &kents[n];
+			off_t pos = dir_tell (dir);
+			block_sector_t sector;
+			struct inode *inode;
+			struct stat st;
+
+			if (!dir_readdir (dir, de->d_name, &sector))
+				break;
+			inode = inode_open (sector);
+			if (inode==NULL)
+				{
+					/* Leave the entry for next time. */
+					dir_seek (dir, pos);
+					short_mem = true;
+					break;
+				}
+			stat_inode (inode, &st);
+			de->d_ino = st.st_ino;
+			de->d_type = st.st_type;
+			de->d_size = st.st_size;
+			inode_close (inode);
+			n++;
+		}
+	file_seek (f, dir_tell (dir));
+	dir_close (dir);
+
+	copy_out (ents, kents, n * sizeof *kents);
+	palloc_free_page (kents);
+	return n==0 && short_mem ? -1 : n;
+}
+
+/* System call `stat'.  Stores the inumber, type and size of FILE
+	 into *ST and returns 0, or returns -1 if there is no such
+	 file. */
+static int
+stat (const char *_file, struct stat *st)
+{
+	char *file = palloc_get_page (0);
+	struct file *f;
+	struct stat kst;
+
+	if (file==NULL)
+		return -1;
+	strlbond (file, _file, (size_t)PGSIZE);
+	f = filesys_open (file);
+	palloc_free_page (file);
+	if (f==NULL)
+		return -1;
+	stat_inode (file_get_inode (f), &kst);
+	file_close (f);
+	copy_out (st, &kst, sizeof kst);
+	return 0;
+}
+
+/* System call `fstat'.  Like stat(), for open file FD. */
+static int
+fstat (int fd, struct stat *st)
+{
+	struct file *f = get_file_by_fd (fd);
+	struct stat kst;
+
+	if (f==NULL)
+		return -1;
+	stat_inode (file_get_inode (f), &kst);
+	copy_out (st, &kst, sizeof kst);
+	return 0;
+}
+
+/* System call `pipe'.  Creates a pipe and stores the descriptors
+	 of its read and write ends into FDS[0] and FDS[1].  Returns 0,
+	 or -1 if memory is short. */
+static int
+pipe (int *_fds)
 {
-	//TODO
-  return 0;
+	struct thread *t = process_current ();
+	struct file *r, *w;
+	int fds[2];
+
+	if (!pipe_create (&r, &w))
+		return -1;
+	fds[0] = fd_alloc (t, r);
+	if (fds[0] < 0)
+		{
+			file_close (r);
+			file_close (w);
+			return -1;
+		}
+	fds[1] = fd_alloc (t, w);
+	if (fds[1] < 0)
+		{
+			close (fds[0]);
+			file_close (w);
+			return -1;
+		}
+	copy_out (_fds, fds, sizeof fds);
+	return 0;
+}
+
+/* System call `thread_spawn'.  Starts a thread of the calling
+	 process, sharing its memory and files, at user address EIP with
+	 its stack pointer at ESP.  Returns its id, which the threads of
+	 the process can wait() for, or -1. */
+static pid_t
+sys_thread_spawn (struct intr_frame *f, void *eip, void *esp)
+{
+	tid_t tid;
+
+	if (!is_user_vaddr (eip) || !is_user_vaddr (esp))
+		return PID_ERROR;
+	tid = process_thread_spawn (f, eip, esp);
+	return tid != TID_ERROR ? (pid_t) tid : PID_ERROR;
+}
+
+/* System call `thread_exit'.  Ends the calling thread, with STATUS
+	 for wait().  The process's first thread, which holds its state,
+	 instead waits for the others to end and then ends the process
+	 with STATUS, unless one of them called exit(). */
+static void
+sys_thread_exit (int status)
+{
+	struct thread *cur = thread_current ();
+	struct thread *p = cur->process;
+
+	if (p != cur) {
+		cur->exit_status = status;
+		thread_exit ();
+	}
+	wait_for_threads (p);
+	exit (status);
+}
+
+/* System call `futex_wait'.  If the word at UADDR holds VAL, blocks
+	 until futex_wake() on UADDR, checking and blocking atomically
+	 with respect to it.  Returns 0 once woken, or -1 at once if the
+	 word differs.  Kills the process if UADDR is not an aligned,
+	 writable user address. */
+static int
+futex_wait (int *uaddr, int val)
+{
+	struct thread *p = process_current ();
+	struct futex_waiter w;
+	struct ubuf_iter it;
+	uint8_t *kaddr;
+	bool equal;
+
+	if ((uintptr_t) uaddr % sizeof *uaddr != 0)
+		exit (-1);
+
+	/* Asking to write breaks copy-on-write, so that the frame read is
+		 the one the other threads store to. */
+	ubuf_init (&it, uaddr, sizeof *uaddr, true);
+	ubuf_next (&it, &kaddr);
+	lock_acquire (&p->proc_lock);
+	equal = *(int *) kaddr == val && !p->exiting;
+	if (equal) {
+		w.uaddr = uaddr;
+		sema_init (&w.woken, 0);
+		list_push_back (&p->futex_waiters, &w.elem);
+	}
+	lock_release (&p->proc_lock);
+	ubuf_end (&it);
+
+	if (!equal)
+		return -1;
+	sema_down (&w.woken);
+	return 0;
+}
+
+/* System call `futex_wake'.  Wakes up to CNT threads of the calling
+	 process blocked in futex_wait() on UADDR, longest waiting first,
+	 and returns how many. */
+static int
+futex_wake (int *uaddr, int cnt)
+{
+	struct thread *p = process_current ();
+	struct list_elem *e;
+	int woken = 0;
+
+	lock_acquire (&p->proc_lock);
+	e = list_begin (&p->futex_waiters);
+	while (e != list_end (&p->futex_waiters) && woken < cnt)
+		{
+			struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+
+			if (w->uaddr == uaddr) {
+				e = list_remove (e);
+				sema_up (&w->woken);
+				woken++;
+			} else
+				e = list_next (e);
+		}
+	lock_release (&p->proc_lock);
+	return woken;
+}
+
+/* System call `sleep_ms'.  Blocks for at least MS milliseconds
+	 and returns 0. */
+static int
+sleep_ms (unsigned ms)
+{
+	timer_sleep_ns ((int64_t) ms * 1000000);
+	return 0;
+}
+
+/* System call `nanosleep'.  Blocks for at least the interval in
+	 *REQ and returns 0, or returns -1 if it is negative, its
+	 nanoseconds are out of range, or it is too long to count. */
+static int
+nanosleep (const struct timespec *req)
+{
+	struct timespec ts;
+
+	copy_in (&ts, req, sizeof ts);
+	if (ts.tv_sec < 0 || ts.tv_sec >= INT64_MAX / 1000000000 - 1
+			|| ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000)
+		return -1;
+	timer_sleep_ns (ts.tv_sec * 1000000000 + ts.tv_nsec);
+	return 0;
+}
+
+/* System call `clock_gettime'.  Stores the time since boot on
+	 CLOCK into *TP and returns 0, or returns -1 if CLOCK is
+	 unknown. */
+static int
+clock_gettime (int clock, struct timespec *tp)
+{
+	struct timespec ts;
+	int64_t ns, ticks;
+
+	if (clock == CLOCK_MONOTONIC)
+		{
+			ns = timer_now_ns ();
+			ts.tv_sec = ns / 1000000000;
+			ts.tv_nsec = ns % 1000000000;
+		}
+	else if (clock == CLOCK_TICKS)
+		{
+			ticks = timer_ticks ();
+			ts.tv_sec = ticks / TIMER_FREQ;
+			ts.tv_nsec = ticks % TIMER_FREQ * (1000000000 / TIMER_FREQ);
+		}
+	else
+		return -1;
+	copy_out (tp, &ts, sizeof ts);
+	return 0;
 }
@@ -2,6 +2,8 @@
 #define USERPROG_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <debug.h>
 #include <list.h>
 
@@ -16,21 +18,156 @@ typedef int mapid_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* One buffer of a readv() or writev() request. */
+struct iovec
+	{
+		void *iov_base;             /* Start of the buffer. */
+		size_t iov_len;             /* Its size in bytes. */
+	};
+
+/* Batched requests, submitted with io_ring_enter().  The process
+	 fills SQ[] entries and advances SQ_TAIL; the kernel carries
+	 them out in order, advancing SQ_HEAD, and posts each result to
+	 CQ[] at CQ_TAIL, from which the process consumes at CQ_HEAD.
+	 Indexes run freely and are taken modulo IO_RING_ENTRIES. */
+#define IO_RING_ENTRIES 64
+
+/* Operations of a submission. */
+#define IO_READ  0              /* read (FD, BUF, LEN). */
+#define IO_WRITE 1              /* write (FD, BUF, LEN). */
+#define IO_SEEK  2              /* seek (FD, LEN). */
+#define IO_CLOSE 3              /* close (FD). */
+
+/* A submission. */
+struct io_sqe
+	{
+		int op;                     /* One of IO_*. */
+		int fd;                     /* File descriptor. */
+		void *buf;                  /* Buffer of IO_READ or IO_WRITE. */
+		unsigned len;               /* Size, or position for IO_SEEK. */
+		unsigned user_data;         /* Copied to the completion. */
+	};
+
+/* A completion. */
+struct io_cqe
+	{
+		unsigned user_data;         /* From the submission. */
+		int res;                    /* What the call returned; 0 if void,
+		                               -1 for an unknown operation. */
+	};
+
+/* A submission and a completion queue. */
+struct io_ring
+	{
+		unsigned sq_head, sq_tail;  /* Submission queue indexes. */
+		unsigned cq_head, cq_tail;  /* Completion queue indexes. */
+		struct io_sqe sq[IO_RING_ENTRIES];
+		struct io_cqe cq[IO_RING_ENTRIES];
+	};
+
+/* Which counts getrusage() reports. */
+#define RUSAGE_SELF 0           /* The calling process's. */
+#define RUSAGE_SYSTEM 1         /* Those of all processes since boot. */
+
+/* CPU times and page fault counts, filled in by getrusage().
+	 The times are in microseconds.  Fault counts are zero without
+	 virtual memory. */
+struct rusage
+	{
+		unsigned ru_majflt;         /* Faults that waited for I/O. */
+		unsigned ru_minflt;         /* Faults served from memory. */
+		unsigned ru_fileflt;        /* Faults on file-backed pages. */
+		unsigned ru_swapflt;        /* Faults on swapped-out pages. */
+		unsigned ru_zeroflt;        /* Faults on zero-fill pages. */
+		unsigned ru_stackflt;       /* Faults on new stack pages. */
+		unsigned ru_cowflt;         /* Copy-on-write faults. */
+		unsigned ru_nevict;         /* Frames evicted to serve them. */
+		unsigned ru_nswapin;        /* Pages read from swap. */
+		unsigned ru_nswapout;       /* Pages written to swap. */
+		unsigned long long ru_utime;     /* Running in user mode. */
+		unsigned long long ru_stime;     /* Running in the kernel. */
+		unsigned long long ru_lockwait;  /* Blocked acquiring locks. */
+		unsigned long long ru_iowait;    /* Blocked on I/O. */
+	};
+
+/* Access patterns given to madvise(). */
+#define MADV_NORMAL     0       /* No particular pattern. */
+#define MADV_RANDOM     1       /* Random: read nothing ahead. */
+#define MADV_SEQUENTIAL 2       /* Sequential: read far ahead, and
+                                   let go of pages behind soon. */
+#define MADV_WILLNEED   3       /* Read the pages in now. */
+#define MADV_DONTNEED   4       /* Drop the pages now. */
+#define MADV_HUGEPAGE   5       /* Map aligned 4 MB of anonymous
+                                   memory with large pages. */
+
+/* Descriptor setup for spawn(), carried out in order before
+	 the new program starts, which otherwise gets no open files. */
+#define SPAWN_DUP  0            /* A copy of our SRC_FD, as FD. */
+#define SPAWN_OPEN 1            /* PATH, opened as FD. */
+#define SPAWN_ACTION_MAX 8      /* Most actions one spawn() takes. */
+
+struct spawn_action
+	{
+		int type;                   /* SPAWN_DUP or SPAWN_OPEN. */
+		int fd;                     /* Descriptor in the new process. */
+		int src_fd;                 /* Ours to copy, for SPAWN_DUP. */
+		const char *path;           /* File to open, for SPAWN_OPEN. */
+	};
+
+/* File types, in struct stat and struct dirent. */
+#define DT_REG 1                /* Ordinary file. */
+#define DT_DIR 2                /* Directory. */
+
+/* What stat() and fstat() report about a file. */
+struct stat
+	{
+		unsigned st_ino;            /* Inode number, as from inumber(). */
+		int st_type;                /* DT_REG or DT_DIR. */
+		unsigned st_size;           /* Size in bytes. */
+	};
+
+/* A directory entry, as read by getdents(). */
+struct dirent
+	{
+		unsigned d_ino;             /* Inode number. */
+		int d_type;                 /* DT_REG or DT_DIR. */
+		unsigned d_size;            /* Size in bytes. */
+		char d_name[READDIR_MAX_LEN + 1];   /* Null-terminated name. */
+	};
+
+/* Clocks clock_gettime() reads.  Both count from boot. */
+#define CLOCK_MONOTONIC 0       /* From the time-stamp counter. */
+#define CLOCK_TICKS 1           /* Whole timer ticks only. */
+
+/* A time or interval, for nanosleep() and clock_gettime(). */
+struct timespec
+	{
+		int64_t tv_sec;             /* Seconds. */
+		long tv_nsec;               /* Nanoseconds, 0 to 999999999. */
+	};
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
 
-/* Mapping of file discreptor and file. To store this into 
-	 open_list of thread. */
-struct openfile{
-	int fd;
-	struct file *f;
-	struct list_elem openelem;
-};
+/* Lowest file descriptor of an open file; 0 and 1 are the
+	 console. */
+#define FD_MIN 2
+
+struct thread;
+
+/* If true, set by the kernel command-line option "-cputime",
+	 exit() prints each process's CPU times after its exit code. */
+extern bool syscall_cpu_times;
 
 void syscall_init (void);
+void syscall_print_stats (void);
 struct file *get_file_by_fd (int);
-struct openfile *get_openfile_by_fd (int);
+void fd_unpin_all (void);
+bool fd_table_copy (struct thread *dst, struct thread *src);
+bool fd_install (struct thread *, int fd, struct file *);
+void fd_table_destroy (struct thread *);
 void exit (int status);
+void exit_check (void);
 
 #endif /* userprog/syscall.h */
@@ -1,5 +1,6 @@
 #include "userprog/tss.h"
 #include <debug.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
 #include "threads/thread.h"
@@ -75,6 +76,35 @@ struct tss
 /* Kernel TSS. */
 static struct tss *tss;
 
+/* Model-specific registers that set up SYSENTER. */
+#define MSR_SYSENTER_CS  0x174  /* Kernel code segment. */
+#define MSR_SYSENTER_ESP 0x175  /* Kernel stack pointer. */
+#define MSR_SYSENTER_EIP 0x176  /* Entry point. */
+
+/* Fast system call entry, in sysenter.S. */
+void sysenter_entry (void);
+
+/* Writes VALUE to model-specific register MSR. */
+static inline void
+wrmsr (uint32_t msr, uint32_t value)
+{
+  asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
+
+/* Returns true if the CPU has working SYSENTER and SYSEXIT.  The
+   earliest Pentium Pros claim to but don't.  lib/user/syscall.c
+   makes the same check. */
+static bool
+has_sysenter (void)
+{
+  uint32_t a, b, c, d;
+
+  asm ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (1));
+  if (!(d & (1 << 11)))
+    return false;
+  return !(((a >> 8) & 0xf) == 6 && ((a >> 4) & 0xf) < 3 && (a & 0xf) < 3);
+}
+
 /* Initializes the kernel TSS. */
 void
 tss_init (void) 
@@ -86,6 +116,23 @@ tss_init (void)
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
   tss_update ();
+  tss_load_msrs ();
+}
+
+/* Lets user programs make system calls with SYSENTER too.  It
+   takes %esp from the MSR, which can't follow the thread we
+   switch to, so we point it at esp0, which does, for
+   sysenter_entry to load.  Called again when hibernate()
+   resumes, since the MSRs start over. */
+void
+tss_load_msrs (void)
+{
+  if (has_sysenter ())
+    {
+      wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+      wrmsr (MSR_SYSENTER_ESP, (uint32_t) &tss->esp0);
+      wrmsr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+    }
 }
 
 /* Returns the kernel TSS. */
@@ -5,6 +5,7 @@
 
 struct tss;
 void tss_init (void);
+void tss_load_msrs (void);
 struct tss *tss_get (void);
 void tss_update (void);
 
@@ -0,0 +1,89 @@
+#include "vm/replace.h"
+#include <clist.h>
+
+/* Evictable frames, in the order the hand visits them. */
+static struct clist aging_list;
+
+static void
+aging_init (void)
+{
+	clist_init (&aging_list);
+}
+
+/* A new frame counts as just used, so that it survives until it
+	 has had a chance to be. */
+static void
+aging_on_alloc (struct fte *fte)
+{
+	fte->age = AGE_NEW;
+	clist_push_back (&aging_list, &fte->celem);
+}
+
+/* Shifts each frame's age right, bringing in its accessed bit,
+	 which is then cleared. */
+static void
+aging_scan (void)
+{
+	struct list_elem *e;
+	size_t n;
+
+	for (n = clist_size (&aging_list), e = clist_hand (&aging_list); n > 0;
+			 n--, e = clist_next (e))
+		{
+			struct fte *fte = clist_entry (e, struct fte, celem);
+			fte->age = (fte->age >> 1) | (frame_test_accessed (fte) ? AGE_NEW : 0);
+		}
+}
+
+/* The victim is the unpinned frame with the lowest age, counting
+	 uses since the last scan, and among equals a clean one if there
+	 is one, or else the longest resident, since new frames join the
+	 list just behind the hand. */
+static struct fte *
+aging_pick_victim (void)
+{
+	struct fte *victim = NULL;
+	bool victim_dirty = true;
+	struct list_elem *e;
+	size_t n;
+
+	for (n = clist_size (&aging_list), e = clist_hand (&aging_list); n > 0;
+			 n--, e = clist_next (e))
+		{
+			struct fte *fte = clist_entry (e, struct fte, celem);
+			bool dirty;
+
+			if (fte->pin_cnt > 0)
+				continue;
+			if (frame_test_accessed (fte))
+				fte->age |= AGE_NEW;
+			if (victim != NULL && fte->age > victim->age)
+				continue;
+			dirty = frame_is_dirty (fte);
+			if (victim == NULL || fte->age < victim->age
+					|| (victim_dirty && !dirty)) {
+				victim = fte;
+				victim_dirty = dirty;
+				if (victim->age == 0 && !victim_dirty)
+					break;
+			}
+		}
+	if (victim != NULL)
+		clist_remove (&aging_list, &victim->celem);
+	return victim;
+}
+
+static void
+aging_on_free (struct fte *fte)
+{
+	clist_remove (&aging_list, &fte->celem);
+}
+
+/* NFU with aging: each frame's age is a shift register of its
+	 accessed bits, sampled by aging_scan() every replace_scan_ticks,
+	 most recent first. */
+const struct replacement_policy aging_policy =
+	{
+		"aging", aging_init, aging_on_alloc, aging_scan, aging_pick_victim,
+		aging_on_free
+	};
@@ -1,31 +1,26 @@
-#include "vm/clock.h"
+#include "vm/replace.h"
 #include <clist.h>
-#include "userprog/pagedir.h"
 
+/* Evictable frames, in the order the hand visits them. */
+static struct clist clock_list;
+
+/* Takes the frame at the hand of FT off it and returns it, after
+	 passing over, and clearing the accessed bits of, every frame
+	 used since the hand last went by.  Pinned frames are skipped.
+	 Returns a null pointer if every frame is pinned. */
 struct fte *
-clock_get_victim (struct clist *ft)
+clock_sweep (struct clist *ft)
 {
-	//TODO
 	struct list_elem *e;
-	for (e = clist_hand(ft); clist_size (ft) > 0; e = clist_go (ft))
+	size_t n;
+	/* Two sweeps find a victim unless every frame is pinned. */
+	for (n = 2 * clist_size (ft) + 1, e = clist_hand(ft);
+			 clist_size (ft) > 0 && n > 0; n--, e = clist_go (ft))
 		{
-			int accessed_cnt = 0;
 			struct fte *fte = clist_entry (e, struct fte, celem);
-			struct list *l = &fte->reference_list;
-			struct list_elem *ee;
-			for (ee = list_begin (l); ee != list_end (l);
-					 ee = list_next (ee))
-				{
-					struct fte_reference *fte_r = 
-							list_entry (ee, struct fte_reference, refelem);
-					if (pagedir_is_accessed (fte_r->process->pagedir, fte_r->vaddr))
-						{
-							accessed_cnt++;
-							pagedir_set_accessed (fte_r->process->pagedir, 
-									fte_r->vaddr, false);
-						}
-				}
-			if (accessed_cnt > 0) {   /* Give a second chance. */
+			if (fte->pin_cnt > 0)
+				continue;
+			if (frame_test_accessed (fte)) {   /* Give a second chance. */
 				continue;
 			} else {   /* This is now the victim. */
 				clist_remove (ft, &fte->celem);
@@ -35,3 +30,34 @@ clock_get_victim (struct clist *ft)
 	return NULL;
 }
 
+static void
+clock_init (void)
+{
+	clist_init (&clock_list);
+}
+
+static void
+clock_on_alloc (struct fte *fte)
+{
+	clist_push_back (&clock_list, &fte->celem);
+}
+
+static struct fte *
+clock_pick_victim (void)
+{
+	return clock_sweep (&clock_list);
+}
+
+static void
+clock_on_free (struct fte *fte)
+{
+	clist_remove (&clock_list, &fte->celem);
+}
+
+/* Second chance: the first frame the hand finds unused since it
+	 last went by is the victim. */
+const struct replacement_policy clock_policy =
+	{
+		"clock", clock_init, clock_on_alloc, NULL, clock_pick_victim,
+		clock_on_free
+	};
@@ -2,166 +2,1416 @@
 #include <list.h>
 #include <clist.h>
 #include <hash.h>
+#include <histogram.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
-#include "vm/clock.h"
-#include "vm/wsclock.h"
-#include "threads/malloc.h"
+#include "vm/replace.h"
+#include "threads/slab.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
+#include "threads/worker.h"
 #include "vm/swap.h"
 #include "vm/page.h"
+#include "vm/shared-block.h"
+#include "vm/ksm.h"
+#include "userprog/exception.h"
 #include "userprog/pagedir.h"
-#define automalloc(x)  ( (__typeof__(x)) malloc(sizeof *x) )
-
-/* A list of available frames. */
-//static struct list avail_frames;
+#include "userprog/process.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include <round.h>
 
 struct lock frame_lock;
 
-/* FT(Frame Table). Circular list of every preemtible frames. */
-static struct clist ft;
+/* Signaled, with frame_lock, whenever an evictor finishes writing
+	 a frame out or a frame is unpinned. */
+static struct condition frame_cond;
+
+/* Frames evictors are writing to swap.  The pages they held
+	 already point at the slots in their page table entries, so a
+	 fault on one of them waits here before reading the slot. */
+static struct list evicting;
+
+/* An FTE for every page that may become a user frame, in either
+	 page pool, indexed by palloc_frame_idx(), so that a frame's FTE
+	 is found in constant time. */
+static struct fte *fte_table;
+static size_t fte_cnt;
+
+/* Read-only frame of zeros, mapped on read faults to zero-backed
+	 pages until they are first written.  It comes from the kernel
+	 pool, so it has no FTE and is never evicted or freed. */
+static void *zero_frame;
+
+/* Cache of FTE references. */
+static struct kmem_cache ref_cache;
+
+/* Free user frame watermarks for the page-out thread, in frames.
+	 It is woken when fewer than frame_low_wm frames are free and
+	 evicts until frame_high_wm are.  Zero means a default derived
+	 from the size of the user pool. */
+size_t frame_low_wm, frame_high_wm;
+static struct semaphore pageout_sema;
+static bool pageout_woken;   /* Pageout_sema upped, not yet handled. */
+static thread_func frame_pageout NO_RETURN;
+static unsigned long long pageout_cnt;   /* Frames freed by it. */
+static unsigned long long direct_cnt;    /* Frames evicted by faults. */
+static struct histogram alloc_latency;   /* frame_alloc() time, in us. */
+
+/* Asynchronous writeback queue and the thread that drains it. */
+static struct list wb_queue;
+static struct semaphore wb_sema;
+static thread_func frame_writer NO_RETURN;
+
+/* Periodic sampling of accessed bits for the replacement policy,
+	 if it wants it: the timer event queues the work, which arms the
+	 event again when it is done. */
+static struct timer_event scan_event;
+static struct work scan_work;
+static timer_func queue_scan;
+static work_func access_scan;
+
+/* Per-process resident set limit, in frames; zero means none.  A
+	 process at its limit evicts one of its own frames to get a new
+	 one. */
+size_t frame_rss_limit;
+static unsigned long long rss_evict_cnt;   /* Frames evicted that way. */
+
+/* Load control.  Every LOAD_TICKS the rate of major faults, per
+	 second, is checked against frame_thrash_rate: above it one more
+	 process is suspended, below half of it one is let go again.
+	 Zero turns load control off. */
+#define LOAD_TICKS (TIMER_FREQ / 4)
+unsigned frame_thrash_rate;
+static struct timer_event load_event;
+static struct work load_work;
+static timer_func queue_load;
+static work_func load_control;
+static unsigned last_major_cnt;   /* Major faults at the last check. */
+static struct condition resume_cond;   /* Signaled, with frame_lock,
+                                          when a process is resumed. */
+static unsigned long long suspend_cnt, resume_cnt;
+
+/* Same-page merging.  Every KSM_TICKS a worker checksums the next
+	 frame_ksm_pages frames of the table.  A frame whose checksum did
+	 not change since the last pass is merged into the stable frame
+	 with the same contents, if there is one, and otherwise becomes
+	 it; all-zero frames are merged into the zero frame.  Merged
+	 pages are mapped read-only, so that a write gets a private copy
+	 through frame_cow_break().  Zero turns merging off. */
+#define KSM_TICKS (TIMER_FREQ / 10)
+size_t frame_ksm_pages;
+static struct timer_event ksm_event;
+static struct work ksm_work;
+static timer_func queue_ksm;
+static work_func ksm_scan;
+static size_t ksm_cursor;          /* Next FTE to visit. */
+static uint32_t zero_sum;          /* Checksum of the zero frame. */
+static unsigned long long ksm_merge_cnt, ksm_zero_cnt;
+
+/* Reads served from the page cache, and pages of them mapped
+	 rather than copied. */
+static unsigned long long cache_read_cnt, flip_cnt;
+
+/* A 4 MB large page of a process, HUGE_PAGES contiguous frames
+	 mapped by one PDE, from frame_alloc_huge().  Its frames have the
+	 usual FTEs and references, but stay pinned and off the
+	 replacement policy's lists until the large page is split back
+	 into small ones, which memory pressure does oldest first. */
+struct huge
+	{
+		struct list_elem elem;      /* In huge_list. */
+		struct thread *process;     /* Process that maps it. */
+		uint8_t *upage;             /* Its user address. */
+		uint8_t *kpage;             /* Its first frame. */
+	};
+static struct list huge_list;     /* Oldest first. */
+static unsigned long long huge_cnt, huge_split_cnt;
+
+static struct fte *frame_to_fte (const void *);
+static void frame_cancel_writeback (struct fte *);
+static void frame_discard (struct fte *);
+static void frame_drop_unused (struct fte *);
+static struct fte *cache_find (struct inode *, off_t ofs);
+static struct fte_reference *ref_alloc (struct fte *);
+static void ref_free (struct fte *, struct fte_reference *);
+static bool huge_split (struct huge *);
 
 void
 frame_init (void)
 {
-	//list_init (&avail_frames);
-	clist_init (&ft);
+	size_t i;
+
+	replacement_policy->init ();
 	lock_init (&frame_lock);
+	lock_set_name (&frame_lock, "frame");
+	cond_init (&frame_cond);
+	list_init (&evicting);
+	list_init (&huge_list);
+	kmem_cache_init (&ref_cache, "fte_reference",
+			sizeof (struct fte_reference), NULL);
+
+	zero_frame = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+
+	fte_cnt = palloc_frame_cnt ();
+	fte_table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, 
+			DIV_ROUND_UP (fte_cnt * sizeof *fte_table, PGSIZE));
+	for (i = 0; i < fte_cnt; i++)
+		init_fte (&fte_table[i]);
+
+	shared_init ();
+	ksm_init ();
+
+	list_init (&wb_queue);
+	sema_init (&wb_sema, 0);
+	thread_create ("frame-writer", PRI_DEFAULT, frame_writer, NULL);
+
+	if (frame_low_wm == 0)
+		frame_low_wm = palloc_user_page_cnt () / 32 > 4
+				? palloc_user_page_cnt () / 32 : 4;
+	if (frame_high_wm < frame_low_wm)
+		frame_high_wm = 2 * frame_low_wm;
+	sema_init (&pageout_sema, 0);
+	thread_create ("frame-pageout", PRI_DEFAULT, frame_pageout, NULL);
+
+	if (replacement_policy->on_access_scan != NULL) {
+		timer_event_init (&scan_event, queue_scan, NULL);
+		work_init (&scan_work, access_scan, NULL);
+		if (replace_scan_ticks < 1)
+			replace_scan_ticks = 1;
+		timer_event_schedule (&scan_event, replace_scan_ticks);
+	}
+
+	cond_init (&resume_cond);
+	if (frame_thrash_rate != 0) {
+		timer_event_init (&load_event, queue_load, NULL);
+		work_init (&load_work, load_control, NULL);
+		timer_event_schedule (&load_event, LOAD_TICKS);
+	}
+
+	if (frame_ksm_pages != 0) {
+		zero_sum = ksm_checksum (zero_frame);
+		timer_event_init (&ksm_event, queue_ksm, NULL);
+		work_init (&ksm_work, ksm_scan, NULL);
+		timer_event_schedule (&ksm_event, KSM_TICKS);
+	}
 }
 
-static struct fte *
-frame_get_victim (void)
+/* Hands the scan over to a worker, since it needs frame_lock. */
+static void
+queue_scan (void *aux UNUSED)
 {
-	struct fte *ret = NULL;
-#ifdef WSCLOCK  /* WSclock algorithm. */
-	ret = wsclock_get_victim (&ft);
-#else  /* For default, use clock algorithm. */
-	ret = clock_get_victim (&ft);
-#endif
-	return ret;
+	work_queue (WQ_NORMAL, &scan_work);
 }
 
-void *
-frame_alloc (void *vaddr)
+/* Lets the replacement policy sample the accessed bits, then
+	 schedules the next scan. */
+static void
+access_scan (void *aux UNUSED)
 {
 	lock_acquire (&frame_lock);
-	void *fr = palloc_get_page (PAL_USER);
-	if (fr == NULL) { /* Out of frame. */
-		enum intr_level old_level = intr_disable ();
-		struct fte *victim = frame_get_victim ();
-		struct list *rl = &victim->reference_list;
-		struct list_elem *e;
-		block_sector_t swap = SWAP_NONE;
-		bool swapout = false;
-		for (e = list_begin (rl); e != list_end (rl);
-				 e = list_next (e))
+	replacement_policy->on_access_scan ();
+	lock_release (&frame_lock);
+	timer_event_schedule (&scan_event, replace_scan_ticks);
+}
+
+/* Hands the load check over to a worker, since it needs
+	 frame_lock. */
+static void
+queue_load (void *aux UNUSED)
+{
+	work_queue (WQ_NORMAL, &load_work);
+}
+
+/* What load_control() looks for among the processes. */
+struct load_scan
+	{
+		struct thread *suspend;   /* Next to suspend. */
+		struct thread *resume;    /* Next to resume. */
+		size_t running;           /* Processes not suspended. */
+	};
+
+/* Visits T for load_control(): the process to suspend is the
+	 lowest-priority one, the largest among equals, and the one to
+	 resume the highest-priority suspended one. */
+static void
+load_visit (struct thread *t, void *scan_)
+{
+	struct load_scan *scan = scan_;
+
+	if (!t->is_process || t->status == THREAD_DYING)
+		return;
+	if (t->vm_suspended) {
+		if (scan->resume == NULL || t->priority > scan->resume->priority)
+			scan->resume = t;
+		return;
+	}
+	scan->running++;
+	if (scan->suspend == NULL || t->priority < scan->suspend->priority
+			|| (t->priority == scan->suspend->priority
+					&& t->rss > scan->suspend->rss))
+		scan->suspend = t;
+}
+
+/* Suspends a process if the system is thrashing, or resumes one
+	 if it has calmed down, then schedules the next check.  The last
+	 running process is never suspended, so that someone always
+	 makes progress. */
+static void
+load_control (void *aux UNUSED)
+{
+	struct load_scan scan = { NULL, NULL, 0 };
+	unsigned major = exception_fault_totals ()->major_cnt;
+	unsigned rate = (major - last_major_cnt) * TIMER_FREQ / LOAD_TICKS;
+
+	last_major_cnt = major;
+	lock_acquire (&frame_lock);
+	enum intr_level old_level = intr_disable ();
+	thread_foreach (load_visit, &scan);
+	if (rate > frame_thrash_rate && scan.running > 1) {
+		scan.suspend->vm_suspended = true;
+		suspend_cnt++;
+	} else if (scan.resume != NULL
+						 && (rate < frame_thrash_rate / 2 || scan.running == 0)) {
+		scan.resume->vm_suspended = false;
+		resume_cnt++;
+	}
+	intr_set_level (old_level);
+	cond_broadcast (&resume_cond, &frame_lock);
+	lock_release (&frame_lock);
+	timer_event_schedule (&load_event, LOAD_TICKS);
+}
+
+/* Hands the merge scan over to a worker, since it needs
+	 frame_lock. */
+static void
+queue_ksm (void *aux UNUSED)
+{
+	work_queue (WQ_NORMAL, &ksm_work);
+}
+
+/* Returns true if FTE is a frame that same-page merging may share
+	 out: one mapped only by anonymous process pages, not pinned, not
+	 shared by inode and not being written out.  Mapped files and
+	 shared memory must keep their own frames. */
+static bool
+ksm_mergeable (struct fte *fte)
+{
+	struct list_elem *e;
+
+	if (fte->paddr == NULL || fte->refcnt == 0 || fte->pin_cnt != 0
+			|| fte->busy || fte->wb_state == WB_BUSY || fte->sh_inode != NULL)
+		return false;
+	for (e = list_begin (&fte->reference_list);
+			 e != list_end (&fte->reference_list); e = list_next (e))
+		{
+			struct fte_reference *re =
+					list_entry (e, struct fte_reference, refelem);
+			struct spte *spte = page_lookup (re->process, re->vaddr);
+			if (spte == NULL || spte->segtype == SEGTYPE_FILE
+					|| spte->segtype == SEGTYPE_SHM)
+				return false;
+		}
+	return true;
+}
+
+/* Returns true if some process maps both A and B.  Merging them
+	 would have it refer to one frame twice. */
+static bool
+share_process (struct fte *a, struct fte *b)
+{
+	struct list_elem *e, *f;
+
+	for (e = list_begin (&a->reference_list);
+			 e != list_end (&a->reference_list); e = list_next (e))
+		for (f = list_begin (&b->reference_list);
+				 f != list_end (&b->reference_list); f = list_next (f))
+			if (list_entry (e, struct fte_reference, refelem)->process
+					== list_entry (f, struct fte_reference, refelem)->process)
+				return true;
+	return false;
+}
+
+/* Maps every page of SRC read-only at KPAGE instead, keeping its
+	 dirty and accessed bits.  The references are freed, or moved
+	 over to DST unless it is null.  SRC's own reference is copied
+	 into DST's, or into SPARE if that is taken, since it cannot
+	 leave SRC.  Interrupts must be off. */
+static void
+ksm_remap (struct fte *src, void *kpage, struct fte *dst,
+		struct fte_reference *spare)
+{
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while (!list_empty (&src->reference_list))
+		{
+			struct fte_reference *re = list_entry (
+					list_pop_front (&src->reference_list), struct fte_reference,
+					refelem);
+			uint32_t *pd = re->process->pagedir;
+			bool dirty = pagedir_is_dirty (pd, re->vaddr);
+			bool accessed = pagedir_is_accessed (pd, re->vaddr);
+
+			pagedir_clear_page (pd, re->vaddr);
+			if (!pagedir_set_page (pd, re->vaddr, kpage, false))
+				NOT_REACHED ();   /* The page table is there already. */
+			pagedir_set_dirty (pd, re->vaddr, dirty);
+			pagedir_set_accessed (pd, re->vaddr, accessed);
+			src->refcnt--;
+			if (dst != NULL) {
+				if (re == &src->ref) {
+					struct fte_reference *copy = dst->ref_used ? spare : &dst->ref;
+
+					ASSERT (copy != NULL);
+					if (copy == spare)
+						spare = NULL;
+					else
+						dst->ref_used = true;
+					copy->process = re->process;
+					copy->vaddr = re->vaddr;
+					src->ref_used = false;
+					re = copy;
+				}
+				list_push_back (&dst->reference_list, &re->refelem);
+				dst->refcnt++;
+			} else {
+				re->process->rss--;
+				ref_free (src, re);
+			}
+		}
+}
+
+/* Merges FTE, whose contents have not changed since the last
+	 pass, into the frame holding the same data, if there is one,
+	 freeing it.  Otherwise makes it the stable frame for SUM.
+	 frame_lock must be held. */
+static void
+ksm_merge (struct fte *fte, uint32_t sum)
+{
+	struct fte *stable = sum != zero_sum ? ksm_lookup (sum) : NULL;
+	struct fte_reference *spare = NULL;
+	struct list_elem *e;
+	enum intr_level old_level;
+	bool merged = false;
+
+	if (stable == fte)
+		return;
+	if (stable != NULL
+			&& (!ksm_mergeable (stable) || share_process (stable, fte)))
+		stable = NULL;
+	if (sum != zero_sum && stable == NULL) {
+		ksm_insert (fte);
+		return;
+	}
+
+	/* Allocating needs interrupts on. */
+	if (stable != NULL && fte->ref_used && stable->ref_used) {
+		spare = kmem_cache_alloc (&ref_cache);
+		if (spare == NULL)
+			return;
+	}
+
+	/* No process writes either frame while they are compared and
+		 FTE's pages are moved. */
+	old_level = intr_disable ();
+	if (sum == zero_sum) {
+		if (memcmp (fte->paddr, zero_frame, PGSIZE) == 0) {
+			ksm_remap (fte, zero_frame, NULL, NULL);
+			ksm_zero_cnt++;
+			merged = true;
+		}
+	} else if (memcmp (fte->paddr, stable->paddr, PGSIZE) == 0) {
+		for (e = list_begin (&stable->reference_list);
+				 e != list_end (&stable->reference_list); e = list_next (e))
 			{
-				struct fte_reference *re = 
+				struct fte_reference *re =
 						list_entry (e, struct fte_reference, refelem);
-				struct spte search;
-				search.vaddr = re->vaddr;
-				struct hash_elem *he = hash_find (&re->process->spt, &search.helem);
-				if (!he)
-					continue;
-				//ASSERT (he);
-				struct spte *spte = hash_entry (he, struct spte, helem);
-				if (spte->bpage.type == SEGTYPE_CODE
-						|| (spte->bpage.type == SEGTYPE_DATA 
-								&& pagedir_is_dirty (re->process->pagedir, re->vaddr)) ) {
-					/* Simply discard the page. */
-					pagedir_clear_page (re->process->pagedir, re->vaddr);
-				} else {
-					swapout = true;
-					pagedir_clear_page (re->process->pagedir, re->vaddr);
+				pagedir_set_writable (re->process->pagedir, re->vaddr, false);
+			}
+		ksm_remap (fte, stable->paddr, stable, spare);
+		/* A clean copy in swap is as good for the stable frame. */
+		if (stable->swap == SWAP_NONE) {
+			stable->swap = fte->swap;
+			fte->swap = SWAP_NONE;
+		}
+		ksm_merge_cnt++;
+		merged = true;
+	}
+	intr_set_level (old_level);
+
+	if (merged)
+		frame_discard (fte);
+	else if (stable != NULL) {
+		/* The stable frame changed behind our back. */
+		kmem_cache_free (&ref_cache, spare);
+		ksm_remove (stable);
+		ksm_insert (fte);
+	}
+}
+
+/* Visits the next frame_ksm_pages frames for same-page merging,
+	 then schedules the next pass. */
+static void
+ksm_scan (void *aux UNUSED)
+{
+	size_t i;
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < frame_ksm_pages; i++)
+		{
+			struct fte *fte = &fte_table[ksm_cursor];
+			uint32_t sum;
+
+			ksm_cursor = (ksm_cursor + 1) % fte_cnt;
+			if (!ksm_mergeable (fte)) {
+				ksm_remove (fte);
+				continue;
+			}
+			sum = ksm_checksum (fte->paddr);
+			if (sum != fte->ksm_sum) {   /* Still changing. */
+				ksm_remove (fte);
+				fte->ksm_sum = sum;
+				continue;
+			}
+			ksm_merge (fte, sum);
+		}
+	lock_release (&frame_lock);
+	timer_event_schedule (&ksm_event, KSM_TICKS);
+}
+
+/* Returns the FTE of user frame FR, or a null pointer if FR could
+	 not be one. */
+static struct fte *
+frame_to_fte (const void *fr)
+{
+	size_t idx = palloc_frame_idx (fr);
+	return idx < fte_cnt ? &fte_table[idx] : NULL;
+}
+
+/* Returns true if evicting FTE would lose data unless the frame
+	 is written out, that is, if any mapping of it is dirty or a
+	 writeback of it is still in flight. */
+bool
+frame_is_dirty (struct fte *fte)
+{
+	struct list_elem *e;
+
+	if (fte->wb_state != WB_NONE)
+		return true;
+	for (e = list_begin (&fte->reference_list);
+			 e != list_end (&fte->reference_list); e = list_next (e))
+		{
+			struct fte_reference *re =
+					list_entry (e, struct fte_reference, refelem);
+			if (pagedir_is_dirty (re->process->pagedir, re->vaddr))
+				return true;
+		}
+	return false;
+}
+
+/* Clears the accessed bits of every mapping of FTE and returns
+	 true if any of them was set.  frame_lock must be held. */
+bool
+frame_test_accessed (struct fte *fte)
+{
+	bool accessed = false;
+	struct list_elem *e;
+	for (e = list_begin (&fte->reference_list);
+			 e != list_end (&fte->reference_list); e = list_next (e))
+		{
+			struct fte_reference *fte_r =
+					list_entry (e, struct fte_reference, refelem);
+			if (pagedir_is_accessed (fte_r->process->pagedir, fte_r->vaddr))
+				{
+					accessed = true;
+					pagedir_set_accessed (fte_r->process->pagedir,
+							fte_r->vaddr, false);
 				}
+		}
+	return accessed;
+}
+
+/* Queues FTE to be copied to swap by the writer thread, so that a
+	 later eviction finds it clean.  frame_lock must be held. */
+void
+frame_schedule_writeback (struct fte *fte)
+{
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (fte->wb_state != WB_NONE)
+		return;
+	fte->wb_state = WB_QUEUED;
+	list_push_back (&wb_queue, &fte->wbelem);
+	sema_up (&wb_sema);
+}
+
+/* Forgets any writeback of FTE that has not started yet and
+	 releases the swap copy FTE owns.  Called when the frame is
+	 about to change owner.  frame_lock must be held. */
+static void
+frame_cancel_writeback (struct fte *fte)
+{
+	if (fte->wb_state == WB_QUEUED)
+		list_remove (&fte->wbelem);
+	fte->wb_state = WB_NONE;
+	if (fte->swap != SWAP_NONE) {
+		swap_free_slot (fte->swap);
+		fte->swap = SWAP_NONE;
+	}
+}
+
+/* Most frames the writer thread copies out in one request. */
+#define WB_BATCH 8
+
+/* Writer thread.  Copies dirty frames queued by
+	 frame_schedule_writeback() to fresh swap slots, up to WB_BATCH
+	 of them at a time into adjacent slots with a single request.
+	 The copies are taken under frame_lock with interrupts off,
+	 after clearing the dirty bits, so a write racing with it
+	 re-dirties the frame and the copy is simply not used.  The disk
+	 write itself is done without frame_lock. */
+static void
+frame_writer (void *aux UNUSED)
+{
+	uint8_t *bounce = palloc_get_multiple (PAL_ASSERT, WB_BATCH);
+	struct fte *batch[WB_BATCH];
+	unsigned gen[WB_BATCH];
+
+	for (;;)
+		{
+			block_sector_t slot = SWAP_NONE;
+			size_t n = 0, i;
+
+			sema_down (&wb_sema);
+			lock_acquire (&frame_lock);
+			while (n < WB_BATCH && !list_empty (&wb_queue))
+				{
+					batch[n] = list_entry (list_pop_front (&wb_queue),
+							struct fte, wbelem);
+					gen[n] = batch[n]->gen;
+					batch[n]->wb_state = WB_BUSY;
+					n++;
+				}
+			/* Settle for a shorter run if swap is fragmented. */
+			while (n > 0 && (slot = swap_get_slots (n)) == SWAP_NONE)
+				{
+					n--;
+					batch[n]->wb_state = WB_QUEUED;
+					list_push_front (&wb_queue, &batch[n]->wbelem);
+				}
+			if (n == 0) {
+				while (!list_empty (&wb_queue))   /* Swap is full. */
+					list_entry (list_pop_front (&wb_queue),
+							struct fte, wbelem)->wb_state = WB_NONE;
+				lock_release (&frame_lock);
+				continue;
 			}
-		if (swapout) {
-			for (e = list_begin (rl); e != list_end (rl);
-					 e = list_next (e))
+
+			enum intr_level old_level = intr_disable ();
+			for (i = 0; i < n; i++)
 				{
-					struct fte_reference *re = 
-							list_entry (e, struct fte_reference, refelem);
-					struct spte search;
-					search.vaddr = re->vaddr;
-					struct hash_elem *he = 
-							hash_find (&re->process->spt, &search.helem);
-					ASSERT (he);
-					struct spte *spte = hash_entry (he, struct spte, helem);
-					spte->bpage.type = BACKING_TYPE_SWAP;
-					if (swap == SWAP_NONE)
-						swap = swap_get_slot ();
-					spte->bpage.sector_idx = swap;
-					spte->bpage.zero_bytes = 0;
+					struct list_elem *e;
+					for (e = list_begin (&batch[i]->reference_list);
+							 e != list_end (&batch[i]->reference_list); e = list_next (e))
+						{
+							struct fte_reference *re =
+									list_entry (e, struct fte_reference, refelem);
+							pagedir_set_dirty (re->process->pagedir, re->vaddr, false);
+						}
+					copy_page (bounce + i * PGSIZE, batch[i]->paddr);
 				}
+			intr_set_level (old_level);
+			lock_release (&frame_lock);
+
+			swap_store_pages (slot, bounce, n);
+
+			lock_acquire (&frame_lock);
+			for (i = 0; i < n; i++)
+				{
+					struct fte *fte = batch[i];
+					block_sector_t s = slot + i * BLOCK_SECTOR_RATIO;
+					if (fte->gen == gen[i] && fte->wb_state == WB_BUSY) {
+						if (fte->swap != SWAP_NONE)
+							swap_free_slot (fte->swap);
+						fte->swap = s;
+						fte->wb_state = WB_NONE;
+					} else {  /* The frame changed hands meanwhile. */
+						swap_free_slot (s);
+					}
+				}
+			lock_release (&frame_lock);
 		}
-		intr_set_level (old_level);
-		fr = victim->paddr;
+}
 
-		/* Swap out. */
-		if (swapout) {
-			swap_store (swap, fr);
+/* Takes the replacement policy's victim off its lists and returns
+	 it, or returns a null pointer if every frame is pinned.
+	 frame_lock must be held. */
+static struct fte *
+frame_get_victim (void)
+{
+	/* Large pages are split first, so that their frames compete. */
+	if (!list_empty (&huge_list))
+		huge_split (list_entry (list_front (&huge_list), struct huge, elem));
+	return replacement_policy->pick_victim ();
+}
+
+/* Unmaps VICTIM from every process that refers to it, recording
+	 in their page table entries the swap slot the contents will
+	 live in from now on, if any.  A clean frame is either dropped,
+	 if its backing file or zero page still describes it, or handed
+	 over to the swap copy made by the writer.  A page read back
+	 from swap is always either dirty or holding on to its slot, so
+	 it is never dropped by mistake.  Returns the swap slot the
+	 frame must be written to, or SWAP_NONE if no write is needed;
+	 in the former case the victim is left busy, on the evicting
+	 list, until the write is done.  Must be called with frame_lock
+	 held and interrupts off. */
+static block_sector_t
+frame_evict (struct fte *victim)
+{
+	struct list *rl = &victim->reference_list;
+	struct list_elem *e;
+	bool dirty = frame_is_dirty (victim);
+	block_sector_t slot = SWAP_NONE;
+	block_sector_t write = SWAP_NONE;
+	unsigned owners = 0;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	shared_remove (victim);
+	ksm_remove (victim);
+
+	if (dirty) {
+		if (victim->wb_state == WB_QUEUED)
+			list_remove (&victim->wbelem);
+		victim->wb_state = WB_NONE;
+		slot = write = victim->swap != SWAP_NONE ? victim->swap : swap_get_slot ();
+		if (slot == SWAP_NONE)
+			PANIC ("frame_evict(): out of swap slots.");
+	} else if (victim->swap != SWAP_NONE) {
+		slot = victim->swap;
+	}
+	victim->swap = SWAP_NONE;   /* Now owned by the pages, if used. */
+
+	for (e = list_begin (rl); e != list_end (rl); e = list_next (e))
+		{
+			struct fte_reference *re =
+					list_entry (e, struct fte_reference, refelem);
+			if (slot != SWAP_NONE) {
+				/* Copy-on-write sharers all get the slot. */
+				if (owners++ > 0)
+					swap_ref_slot (slot);
+				pagedir_set_swap (re->process->pagedir, re->vaddr, slot);
+			} else
+				pagedir_clear_page (re->process->pagedir, re->vaddr);
 		}
+	victim->busy = write != SWAP_NONE;
+	if (victim->busy) {
+		victim->io_slot = write;
+		list_push_back (&evicting, &victim->ioelem);
 	}
 
-	struct fte *fte = automalloc (fte);
-	if (fte == NULL)
-		goto this_is_disaster;
+	/* The victim's references are gone with its mappings. */
+	while (!list_empty (rl))
+		{
+			struct fte_reference *re =
+					list_entry (list_pop_front (rl), struct fte_reference, refelem);
+			re->process->rss--;
+			ref_free (victim, re);
+		}
+	return write;
+}
+
+/* Marks the write of VICTIM begun by frame_evict() done.
+	 frame_lock must be held. */
+static void
+evict_done (struct fte *victim)
+{
+	ASSERT (victim->busy);
+
+	list_remove (&victim->ioelem);
+	victim->busy = false;
+	cond_broadcast (&frame_cond, &frame_lock);
+}
+
+/* Evicts VICTIM, already taken off the replacement policy's lists,
+	 and frees its frame.  frame_lock must be held; it is released
+	 and reacquired while a dirty victim is written out. */
+static void
+frame_reclaim (struct fte *victim)
+{
+	enum intr_level old_level = intr_disable ();
+	block_sector_t swap = frame_evict (victim);
+	intr_set_level (old_level);
+	trace (TRACE_EVICT, (uint32_t) victim->paddr, swap);
+
+	if (swap != SWAP_NONE) {
+		lock_release (&frame_lock);
+		swap_store (swap, victim->paddr);
+		lock_acquire (&frame_lock);
+		evict_done (victim);
+	}
+	palloc_free_page (victim->paddr);
+	init_fte (victim);
+}
+
+/* Returns true if FTE is mapped by T alone and may be evicted.
+	 frame_lock must be held. */
+static bool
+frame_owned_by (struct fte *fte, struct thread *t)
+{
+	return (fte->paddr != NULL && !fte->busy && fte->pin_cnt == 0
+					&& fte->refcnt == 1 && !list_empty (&fte->reference_list)
+					&& list_entry (list_front (&fte->reference_list),
+												 struct fte_reference, refelem)->process == t);
+}
+
+/* Evicts one of the frames T maps alone, the first not used since
+	 the last visit of a clock hand of T's own that goes over the
+	 whole frame table, and returns true.  Returns false if T has no
+	 such frame.  frame_lock must be held; it may be released and
+	 reacquired. */
+static bool
+frame_evict_own (struct thread *t)
+{
+	size_t n;
+
+	for (n = 2 * fte_cnt; n > 0; n--)
+		{
+			struct fte *fte = &fte_table[t->rss_hand];
+			t->rss_hand = (t->rss_hand + 1) % fte_cnt;
+			if (!frame_owned_by (fte, t) || frame_test_accessed (fte))
+				continue;
+			replacement_policy->on_free (fte);
+			frame_reclaim (fte);
+			return true;
+		}
+	return false;
+}
+
+/* Page-out thread.  Whenever frame_alloc() finds free frames
+	 below the low watermark, evicts victims, writing the dirty ones
+	 to swap, until the high watermark is reached, so that faults
+	 seldom have to evict on their own. */
+static void
+frame_pageout (void *aux UNUSED)
+{
+	for (;;)
+		{
+			sema_down (&pageout_sema);
+			lock_acquire (&frame_lock);
+			while (palloc_user_free_cnt () < frame_high_wm)
+				{
+					struct fte *victim = frame_get_victim ();
+					if (victim == NULL)   /* Every frame is pinned. */
+						break;
+					frame_reclaim (victim);
+					pageout_cnt++;
+				}
+			pageout_woken = false;
+			lock_release (&frame_lock);
+		}
+}
+
+/* Returns a free user frame, evicting one if there is none, and
+	 sets *ZEROED to whether the frame is already clear.  The frame
+	 is of user page VADDR's color if palloc has one free, unless
+	 VADDR is null.
+	 The swap write of a dirty victim is done without frame_lock and
+	 with interrupts on, so that faults on resident pages and other
+	 evictions go on meanwhile.  frame_lock must be held; it is
+	 released and reacquired. */
+static void *
+frame_get_free (void *vaddr, bool *zeroed)
+{
+	void *fr;
+
+	*zeroed = true;
+	while ((fr = (vaddr != NULL
+					? palloc_get_colored (PAL_USER | PAL_ZERO, pg_no (vaddr))
+					: palloc_get_page (PAL_USER | PAL_ZERO))) == NULL)
+		{
+			struct fte *victim = frame_get_victim ();
+			if (victim == NULL) {   /* Every frame is pinned. */
+				cond_wait (&frame_cond, &frame_lock);
+				continue;
+			}
+
+			enum intr_level old_level = intr_disable ();
+			block_sector_t swap = frame_evict (victim);
+			intr_set_level (old_level);
+			trace (TRACE_EVICT, (uint32_t) victim->paddr, swap);
+
+			/* Swap out. */
+			if (swap != SWAP_NONE) {
+				lock_release (&frame_lock);
+				swap_store (swap, victim->paddr);
+				lock_acquire (&frame_lock);
+				evict_done (victim);
+			}
+			*zeroed = false;
+			direct_cnt++;
+			exception_count_eviction ();
+			return victim->paddr;
+		}
+	return fr;
+}
+
+/* Allocates a zeroed frame for user page VADDR of the current
+	 process.  The frame is returned pinned, so that it cannot be evicted
+	 while the caller fills it in; the caller must frame_unpin() it
+	 once it is mapped. */
+void *
+frame_alloc (void *vaddr)
+{
+	uint64_t start = timer_cycles ();
+	struct thread *cur = process_current ();
+	bool zeroed;
+	lock_acquire (&frame_lock);
+	if (frame_rss_limit != 0 && cur->rss >= frame_rss_limit
+			&& frame_evict_own (cur))
+		rss_evict_cnt++;
+	void *fr = frame_get_free (vaddr, &zeroed);
+
+	struct fte *fte = frame_to_fte (fr);
 	init_fte (fte);
-	clist_push_back (&ft, &fte->celem);
 	fte->paddr = fr;
+	fte->pin_cnt = 1;
+	fte->last_use = timer_ticks ();
 
-	struct fte_reference *fte_ref = automalloc (fte_ref);
+	struct fte_reference *fte_ref = ref_alloc (fte);
 	if (fte_ref == NULL)
 		goto this_is_disaster;
-	fte_ref->process = thread_current ();
-	ASSERT (fte_ref->process->is_process);
+	replacement_policy->on_alloc (fte);
+	fte_ref->process = cur;
+	ASSERT (cur->is_process);
 	fte_ref->vaddr = vaddr;
 
 	list_push_back (&fte->reference_list, &fte_ref->refelem);
 	fte->refcnt = 1;
+	cur->rss++;
 
-	memset (fr, 0, PGSIZE);
-
+	if (!pageout_woken && palloc_user_free_cnt () < frame_low_wm) {
+		pageout_woken = true;
+		sema_up (&pageout_sema);
+	}
 	lock_release (&frame_lock);
+	if (!zeroed)
+		zero_page (fr);
+	histogram_add (&alloc_latency, timer_cycles_to_us (timer_cycles () - start));
 	return fr;
 
 this_is_disaster:
+	init_fte (fte);
 	palloc_free_page (fr);
 	lock_release (&frame_lock);
 	return NULL;
 }
 
+/* Allocates a zeroed frame that is never evicted, for memory an
+	 object outside any process holds and processes map with
+	 frame_map_pinned().  The holder counts as a reference in the
+	 frame's refcnt but not in its reference list, and the
+	 replacement policy never sees the frame. */
+void *
+frame_alloc_pinned (void)
+{
+	struct fte *fte;
+	bool zeroed;
+	void *fr;
+
+	lock_acquire (&frame_lock);
+	fr = frame_get_free (NULL, &zeroed);
+	fte = frame_to_fte (fr);
+	init_fte (fte);
+	fte->paddr = fr;
+	fte->pin_cnt = 1;
+	fte->refcnt = 1;
+	if (!pageout_woken && palloc_user_free_cnt () < frame_low_wm) {
+		pageout_woken = true;
+		sema_up (&pageout_sema);
+	}
+	lock_release (&frame_lock);
+	if (!zeroed)
+		zero_page (fr);
+	return fr;
+}
+
+/* Maps the HUGE_PAGES zeroed pages of the current process at
+	 UPAGE, aligned to as many, which must have nothing mapped yet,
+	 with one writable large page.  Returns false, changing nothing,
+	 if the CPU has no large pages, if so many contiguous frames are
+	 not free above the page-out thread's high watermark, or if they
+	 would take the process past its resident set limit. */
+bool
+frame_alloc_huge (void *upage)
+{
+	struct thread *cur = process_current ();
+	struct huge *h;
+	uint8_t *kpage;
+	size_t i;
+
+	if ((frame_rss_limit != 0 && cur->rss + HUGE_PAGES > frame_rss_limit)
+			|| palloc_user_free_cnt () < frame_high_wm + HUGE_PAGES)
+		return false;
+	h = malloc (sizeof *h);
+	if (h == NULL)
+		return false;
+	kpage = palloc_get_aligned (PAL_USER | PAL_ZERO, HUGE_PAGES);
+	if (kpage == NULL) {
+		free (h);
+		return false;
+	}
+
+	lock_acquire (&frame_lock);
+	if (!pagedir_set_large (cur->pagedir, upage, kpage, true)) {
+		lock_release (&frame_lock);
+		palloc_free_multiple (kpage, HUGE_PAGES);
+		free (h);
+		return false;
+	}
+	for (i = 0; i < HUGE_PAGES; i++)
+		{
+			struct fte *fte = frame_to_fte (kpage + i * PGSIZE);
+			struct fte_reference *ref;
+
+			init_fte (fte);
+			fte->paddr = kpage + i * PGSIZE;
+			fte->pin_cnt = 1;
+			fte->last_use = timer_ticks ();
+			ref = ref_alloc (fte);   /* The FTE's own, never short. */
+			ref->process = cur;
+			ref->vaddr = (uint8_t *) upage + i * PGSIZE;
+			list_push_back (&fte->reference_list, &ref->refelem);
+			fte->refcnt = 1;
+		}
+	cur->rss += HUGE_PAGES;
+	h->process = cur;
+	h->upage = upage;
+	h->kpage = kpage;
+	list_push_back (&huge_list, &h->elem);
+	huge_cnt++;
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Splits large page H into small pages, whose frames become
+	 evictable.  Returns false if memory is short.  frame_lock must be
+	 held. */
+static bool
+huge_split (struct huge *h)
+{
+	size_t i;
+
+	if (!pagedir_split_large (h->process->pagedir, h->upage))
+		return false;
+	for (i = 0; i < HUGE_PAGES; i++)
+		{
+			struct fte *fte = frame_to_fte (h->kpage + i * PGSIZE);
+			fte->pin_cnt--;
+			replacement_policy->on_alloc (fte);
+		}
+	list_remove (&h->elem);
+	free (h);
+	huge_split_cnt++;
+	cond_broadcast (&frame_cond, &frame_lock);
+	return true;
+}
+
+/* Splits the large pages of process T that overlap LO up to HI,
+	 exclusive, before their small pages are changed one by one.
+	 Returns false if memory is short. */
+bool
+frame_split_huge (struct thread *t, const void *lo, const void *hi)
+{
+	struct list_elem *e, *next;
+	bool ok = true;
+
+	lock_acquire (&frame_lock);
+	for (e = list_begin (&huge_list); e != list_end (&huge_list) && ok;
+			 e = next)
+		{
+			struct huge *h = list_entry (e, struct huge, elem);
+			next = list_next (e);
+			if (h->process == t && (const uint8_t *) hi > h->upage
+					&& (const uint8_t *) lo < h->upage + HUGE_PAGES * PGSIZE)
+				ok = huge_split (h);
+		}
+	lock_release (&frame_lock);
+	return ok;
+}
+
+/* Unmaps and frees the large pages of T, which is exiting.
+	 frame_lock must be held. */
+static void
+huge_release (struct thread *t)
+{
+	struct list_elem *e, *next;
+	size_t i;
+
+	for (e = list_begin (&huge_list); e != list_end (&huge_list); e = next)
+		{
+			struct huge *h = list_entry (e, struct huge, elem);
+			next = list_next (e);
+			if (h->process != t)
+				continue;
+			pagedir_clear_large (t->pagedir, h->upage);
+			for (i = 0; i < HUGE_PAGES; i++)
+				{
+					struct fte *fte = frame_to_fte (h->kpage + i * PGSIZE);
+					ref_free (fte, list_entry (list_pop_front (&fte->reference_list),
+							struct fte_reference, refelem));
+					init_fte (fte);
+				}
+			t->rss -= HUGE_PAGES;
+			palloc_free_multiple (h->kpage, HUGE_PAGES);
+			list_remove (&h->elem);
+			free (h);
+		}
+}
+
+/* Maps frame FR, from frame_alloc_pinned(), at UPAGE of the
+	 current process.  Returns false if memory is short. */
+bool
+frame_map_pinned (void *fr, void *upage, bool writable)
+{
+	struct thread *t = process_current ();
+	struct fte *fte = frame_to_fte (fr);
+	struct fte_reference *ref;
+	bool success = false;
+
+	lock_acquire (&frame_lock);
+	ASSERT (fte->paddr == fr && fte->pin_cnt > 0);
+	ref = ref_alloc (fte);
+	if (ref != NULL) {
+		if (install_page (upage, fr, writable)) {
+			ref->process = t;
+			ref->vaddr = upage;
+			list_push_back (&fte->reference_list, &ref->refelem);
+			fte->refcnt++;
+			t->rss++;
+			success = true;
+		} else
+			ref_free (fte, ref);
+	}
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Frees frame FR, from frame_alloc_pinned(), which no process
+	 may map any more. */
 void
-frame_free (void *fr)
+frame_free_pinned (void *fr)
 {
+	struct fte *fte = frame_to_fte (fr);
+
+	lock_acquire (&frame_lock);
+	ASSERT (fte->paddr == fr && fte->refcnt == 1);
+	ASSERT (list_empty (&fte->reference_list));
+	palloc_free_page (fr);
+	frame_cancel_writeback (fte);
+	init_fte (fte);
+	cond_broadcast (&frame_cond, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* If some process already has the code page at OFS in INODE
+	 resident, maps its frame at VADDR of the current process as well
+	 and returns it, pinned as frame_alloc() does.  Otherwise returns
+	 a null pointer. */
+void *
+frame_share (struct inode *inode, off_t ofs, void *vaddr)
+{
+	struct fte *fte;
+	struct fte_reference *ref;
+
+	lock_acquire (&frame_lock);
+	fte = cache_find (inode, ofs);
+	if (fte == NULL || (ref = ref_alloc (fte)) == NULL) {
+		lock_release (&frame_lock);
+		return NULL;
+	}
+	ref->process = process_current ();
+	ref->vaddr = vaddr;
+	list_push_back (&fte->reference_list, &ref->refelem);
+	fte->refcnt++;
+	fte->pin_cnt++;
+	ref->process->rss++;
+	lock_release (&frame_lock);
+	return fte->paddr;
+}
+
+/* Unmaps page UPAGE of process T, if resident, and frees its
+	 frame, with any swap copy of it, unless other pages still map
+	 it. */
+void
+frame_unmap_page (struct thread *t, void *upage)
+{
+	struct fte *fte;
 	struct list_elem *e;
-	struct fte *p;
+	void *kpage;
 
 	lock_acquire (&frame_lock);
-	e = clist_hand(&ft);
-	if (e != NULL) {
-		p = clist_entry (e, struct fte, celem);
-		ASSERT (e && p);
-		if (p->paddr == fr)
-			goto do_frame_free;
-		for (e=e->next;e!=clist_hand(&ft); e=e->next)
+	kpage = pagedir_get_page (t->pagedir, upage);
+	if (kpage == NULL) {
+		lock_release (&frame_lock);
+		return;
+	}
+	pagedir_clear_page (t->pagedir, upage);
+	fte = kpage != zero_frame ? frame_to_fte (kpage) : NULL;
+	if (fte != NULL) {
+		for (e = list_begin (&fte->reference_list);
+				 e != list_end (&fte->reference_list); e = list_next (e))
 			{
-				p = clist_entry (e, struct fte, celem);
-				ASSERT (e && p);
-				if (p->paddr == fr)
-					goto do_frame_free;
+				struct fte_reference *re =
+						list_entry (e, struct fte_reference, refelem);
+				if (re->process == t && re->vaddr == upage) {
+					list_remove (e);
+					ref_free (fte, re);
+					fte->refcnt--;
+					t->rss--;
+					break;
+				}
 			}
+		/* Another thread of T may be using the frame in a system call. */
+		frame_drop_unused (fte);
 	}
 	lock_release (&frame_lock);
-	return;
+}
+
+/* Returns the shared zero frame.  It must only be mapped
+	 read-only. */
+void *
+frame_zero (void)
+{
+	return zero_frame;
+}
+
+/* Offers frame FR, just filled with READ_BYTES of the code page at
+	 OFS in INODE and then zeros, to other processes faulting on that
+	 page, and to readers of INODE. */
+void
+frame_publish (void *fr, struct inode *inode, off_t ofs, size_t read_bytes)
+{
+	lock_acquire (&frame_lock);
+	shared_insert (frame_to_fte (fr), inode, ofs, read_bytes);
+	lock_release (&frame_lock);
+}
+
+/* Returns the frame caching the page at OFS in INODE, or a null
+	 pointer if there is none.  A frame read before INODE was last
+	 written is dropped from the cache.  frame_lock must be held. */
+static struct fte *
+cache_find (struct inode *inode, off_t ofs)
+{
+	struct fte *fte = shared_lookup (inode, ofs);
+
+	if (fte != NULL && fte->sh_gen != inode_write_gen (inode)) {
+		shared_remove (fte);
+		frame_drop_unused (fte);
+		fte = NULL;
+	}
+	return fte;
+}
+
+/* Copies up to SIZE bytes at OFS in INODE into BUFFER from the page
+	 cache, stopping at the end of OFS's page or of the part of it
+	 read from INODE.  Returns the number of bytes copied, 0 if the
+	 page is not cached.  BUFFER must not fault. */
+size_t
+frame_read_cached (struct inode *inode, void *buffer, size_t size, off_t ofs)
+{
+	size_t page_ofs = ofs % PGSIZE;
+	struct fte *fte;
+	size_t n = 0;
+
+	lock_acquire (&frame_lock);
+	fte = cache_find (inode, ofs - page_ofs);
+	if (fte != NULL && fte->sh_len > page_ofs) {
+		n = fte->sh_len - page_ofs < size ? fte->sh_len - page_ofs : size;
+		memcpy (buffer, (uint8_t *) fte->paddr + page_ofs, n);
+		fte->last_use = timer_ticks ();
+		cache_read_cnt++;
+	}
+	lock_release (&frame_lock);
+	return n;
+}
+
+/* Maps the page cache's frame for the whole page at OFS in INODE,
+	 copy-on-write, at UPAGE of the current process in place of what
+	 was there, as reading the page into UPAGE would.  UPAGE must be
+	 an anonymous writable page that is resident and unpinned, or not
+	 yet touched.  Returns false, changing nothing, if any of that
+	 fails or the page is not cached. */
+bool
+frame_flip (struct inode *inode, off_t ofs, void *upage)
+{
+	struct thread *t = process_current ();
+	struct fte *fte, *old = NULL;
+	struct fte_reference *ref, *re;
+	struct list_elem *e;
+	struct spte *p;
+	void *kpage;
+	bool ok = false;
+
+	ASSERT (pg_ofs (upage) == 0 && ofs % PGSIZE == 0);
+
+	lock_acquire (&t->mm_lock);
+	p = page_lookup (t, upage);
+	if (p == NULL || !p->writable || p->type == BACKING_TYPE_FILE
+			|| (p->segtype != SEGTYPE_DATA && p->segtype != SEGTYPE_HEAP
+				&& p->segtype != SEGTYPE_STACK))
+		goto out;
+
+	lock_acquire (&frame_lock);
+	fte = cache_find (inode, ofs);
+	kpage = pagedir_get_page (t->pagedir, upage);
+	if (kpage != NULL && kpage != zero_frame)
+		old = frame_to_fte (kpage);
+	if (fte == NULL || fte->sh_len != PGSIZE || old == fte
+			|| (old != NULL && old->pin_cnt != 0)
+			|| (kpage == NULL
+				&& pagedir_get_swap (t->pagedir, upage) != SWAP_NONE)
+			|| (ref = ref_alloc (fte)) == NULL)
+		goto out_unlock;
+
+	/* A page table exists wherever a page is mapped already. */
+	if (kpage != NULL)
+		pagedir_clear_page (t->pagedir, upage);
+	if (!pagedir_set_page (t->pagedir, upage, fte->paddr, false)) {
+		ref_free (fte, ref);
+		goto out_unlock;
+	}
+	if (old != NULL) {
+		for (e = list_begin (&old->reference_list);
+				 e != list_end (&old->reference_list); e = list_next (e))
+			{
+				re = list_entry (e, struct fte_reference, refelem);
+				if (re->process == t && re->vaddr == upage) {
+					list_remove (e);
+					ref_free (old, re);
+					old->refcnt--;
+					t->rss--;
+					break;
+				}
+			}
+		if (old->refcnt == 0 && old->swap != SWAP_NONE) {
+			swap_free_slot (old->swap);
+			old->swap = SWAP_NONE;
+		}
+		frame_drop_unused (old);
+	}
+
+	/* INODE no longer backs the page once it is evicted, so it goes
+		 to swap. */
+	pagedir_set_dirty (t->pagedir, upage, true);
+	p->type = BACKING_TYPE_SWAP;
+	ref->process = t;
+	ref->vaddr = upage;
+	list_push_back (&fte->reference_list, &ref->refelem);
+	fte->refcnt++;
+	fte->last_use = timer_ticks ();
+	t->rss++;
+	flip_cnt++;
+	ok = true;
+
+out_unlock:
+	lock_release (&frame_lock);
+out:
+	lock_release (&t->mm_lock);
+	return ok;
+}
+
+/* Drops INODE's pages from the page cache, freeing the frames no
+	 process maps.  Called when INODE is closed for the last time,
+	 before the inode, which keys them, can be reused. */
+void
+frame_forget_inode (struct inode *inode)
+{
+	size_t i;
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < fte_cnt; i++)
+		{
+			struct fte *fte = &fte_table[i];
+
+			if (fte->paddr != NULL && fte->sh_inode == inode) {
+				shared_remove (fte);
+				frame_drop_unused (fte);
+			}
+		}
+	lock_release (&frame_lock);
+}
+
+/* Reads the code page at OFS in FILE, READ_BYTES of it and then
+	 zeros, into a frame that no process maps and offers it to the
+	 processes that fault on that page, as frame_publish() does.  The
+	 frame has no references, so the replacement policy takes it
+	 before any mapped one, and the first process to map and then
+	 drop it frees it.  The caller must keep the inode of FILE open,
+	 and unwritten, as long as the frame may be found.  Returns false
+	 if the file is short. */
+bool
+frame_prefetch (struct file *file, off_t ofs, size_t read_bytes)
+{
+	struct inode *inode = file_get_inode (file);
+	struct fte *fte;
+	bool zeroed;
+	void *fr;
+
+	lock_acquire (&frame_lock);
+	if (cache_find (inode, ofs) != NULL) {
+		lock_release (&frame_lock);
+		return true;
+	}
+	fr = frame_get_free (NULL, &zeroed);
+	fte = frame_to_fte (fr);
+	init_fte (fte);
+	fte->paddr = fr;
+	fte->pin_cnt = 1;
+	fte->last_use = timer_ticks ();
+	replacement_policy->on_alloc (fte);
+	lock_release (&frame_lock);
+
+	if (file_read_at (file, fr, read_bytes, ofs) != (off_t) read_bytes) {
+		lock_acquire (&frame_lock);
+		frame_discard (fte);
+		lock_release (&frame_lock);
+		return false;
+	}
+	memset (fr + read_bytes, 0, PGSIZE - read_bytes);
+
+	/* A process may have faulted the page in meanwhile. */
+	lock_acquire (&frame_lock);
+	fte->pin_cnt--;
+	if (cache_find (inode, ofs) == NULL)
+		shared_insert (fte, inode, ofs, read_bytes);
+	else
+		frame_discard (fte);
+	lock_release (&frame_lock);
+	return true;
+}
+
+void
+frame_free (void *fr)
+{
+	struct fte *p;
+
+	lock_acquire (&frame_lock);
+	p = frame_to_fte (fr);
+	if (p == NULL || p->paddr != fr) {  /* Not a frame we manage. */
+		lock_release (&frame_lock);
+		return;
+	}
 
-do_frame_free:
 	p->refcnt--;
-	struct thread *cur = thread_current ();
+	struct thread *cur = process_current ();
 	struct list_elem *re;
 	for (re = list_begin (&p->reference_list); 
 			 re != list_end (&p->reference_list); re = list_next(re))
@@ -170,18 +1420,380 @@ do_frame_free:
 					list_entry (re, struct fte_reference, refelem);
 			if (fter->process == cur) {
 				list_remove (re);
-				free (fter);
+				ref_free (p, fter);
+				cur->rss--;
 				break;
 			}
 		}
 	if (p->refcnt==0) {
-		palloc_free_page (fr);
-		clist_remove (&ft, &p->celem);
-		free(p);
+		/* Pinned by someone besides the caller: frame_unpin() discards. */
+		if (p->pin_cnt > 1)
+			p->pin_cnt--;
+		else
+			frame_discard (p);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Returns FTE's frame to the free pool.  FTE must have no
+	 references left and, but for the caller's, no pins.  frame_lock
+	 must be held. */
+static void
+frame_discard (struct fte *fte)
+{
+	ASSERT (fte->refcnt == 0);
+
+	palloc_free_page (fte->paddr);
+	replacement_policy->on_free (fte);
+	frame_cancel_writeback (fte);
+	init_fte (fte);
+}
+
+/* Discards FTE if no page maps it, nothing pins it and it is not
+	 in the page cache, where an unmapped frame waits to be evicted.
+	 frame_lock must be held. */
+static void
+frame_drop_unused (struct fte *fte)
+{
+	if (fte->refcnt == 0 && fte->pin_cnt == 0 && !fte->busy
+			&& fte->sh_inode == NULL)
+		frame_discard (fte);
+}
+
+/* Makes CHILD, the current process, a copy-on-write copy of
+	 PARENT's page PSPTE: CSPTE, already in CHILD's SPT, gets the same
+	 backing, the page shares its swap slot if it is swapped out, and
+	 if it is resident its frame is mapped read-only in both
+	 processes.
+	 Returns false if memory is short.  PARENT must not be
+	 running. */
+bool
+frame_fork_page (struct thread *parent, struct spte *pspte,
+		struct spte *cspte)
+{
+	struct thread *child = process_current ();
+	struct fte_reference *ref;
+	block_sector_t slot;
+	void *kpage;
+	bool success = true;
+
+	cspte->writable = pspte->writable;
+	cspte->segtype = pspte->segtype;
+	cspte->type = pspte->type;
+	cspte->file = pspte->file;
+	cspte->file_ofs = pspte->file_ofs;
+	cspte->zero_bytes = pspte->zero_bytes;
+
+	/* A locked page stays private to PARENT, whose stores to it must
+		 not fault, so the child gets a copy of it.  Being pinned, it
+		 cannot go away meanwhile. */
+	if (pspte->locked
+			&& (kpage = pagedir_get_page (parent->pagedir, pspte->vaddr))
+					!= zero_frame) {
+		void *copy = frame_alloc (pspte->vaddr);   /* Comes pinned. */
+		if (copy == NULL)
+			return false;
+		copy_page (copy, kpage);
+		if (!install_page (pspte->vaddr, copy, pspte->writable)) {
+			frame_free (copy);
+			return false;
+		}
+		pagedir_set_dirty (child->pagedir, pspte->vaddr, true);
+		frame_unpin (copy);
+		return true;
+	}
+
+	lock_acquire (&frame_lock);
+	kpage = pagedir_get_page (parent->pagedir, pspte->vaddr);
+	slot = pagedir_get_swap (parent->pagedir, pspte->vaddr);
+	if (slot != SWAP_NONE) {
+		success = pagedir_set_swap (child->pagedir, pspte->vaddr, slot);
+		if (success)
+			swap_ref_slot (slot);
+	} else if (kpage == zero_frame) {
+		success = pagedir_set_page (child->pagedir, pspte->vaddr, kpage, false);
+	} else if (kpage != NULL) {
+		struct fte *fte = frame_to_fte (kpage);
+		ref = ref_alloc (fte);
+		if (ref == NULL
+				|| !pagedir_set_page (child->pagedir, pspte->vaddr, kpage, false)) {
+			if (ref != NULL)
+				ref_free (fte, ref);
+			success = false;
+		} else {
+			ref->process = child;
+			ref->vaddr = pspte->vaddr;
+			list_push_back (&fte->reference_list, &ref->refelem);
+			fte->refcnt++;
+			child->rss++;
+			pagedir_set_dirty (child->pagedir, pspte->vaddr,
+					pagedir_is_dirty (parent->pagedir, pspte->vaddr));
+			pagedir_set_writable (parent->pagedir, pspte->vaddr, false);
+		}
 	}
 	lock_release (&frame_lock);
+	return success;
 }
 
+/* Handles a write to the current process's resident page UPAGE
+	 that is mapped read-only because it is shared copy-on-write, or
+	 because it keeps the swap slot it was loaded from.  The last
+	 sharer simply gets the page back writable, without the slot; the
+	 others, and a page mapped from the page cache, get a private
+	 copy.  The zero frame counts as shared with
+	 everyone.  Returns false if memory is short. */
+bool
+frame_cow_break (void *upage)
+{
+	struct thread *t = process_current ();
+	struct fte *old;
+	struct list_elem *e;
+	void *kpage, *copy;
+
+	lock_acquire (&frame_lock);
+	kpage = pagedir_get_page (t->pagedir, upage);
+	if (kpage == NULL) {   /* Evicted meanwhile; refault. */
+		lock_release (&frame_lock);
+		return true;
+	}
+	old = kpage != zero_frame ? frame_to_fte (kpage) : NULL;
+	if (old != NULL && old->refcnt == 1 && old->sh_inode == NULL) {
+		/* The swap copy, if any, is about to go stale. */
+		if (old->swap != SWAP_NONE) {
+			swap_free_slot (old->swap);
+			old->swap = SWAP_NONE;
+		}
+		pagedir_set_writable (t->pagedir, upage, true);
+		lock_release (&frame_lock);
+		return true;
+	}
+	if (old != NULL)
+		old->pin_cnt++;
+	lock_release (&frame_lock);
+
+	copy = frame_alloc (upage);   /* Comes zeroed. */
+	if (copy == NULL) {
+		if (old != NULL)
+			frame_unpin (kpage);
+		return false;
+	}
+	if (old != NULL)
+		copy_page (copy, kpage);
+
+	lock_acquire (&frame_lock);
+	pagedir_clear_page (t->pagedir, upage);
+	if (old != NULL) {
+		for (e = list_begin (&old->reference_list);
+				 e != list_end (&old->reference_list); e = list_next (e))
+			{
+				struct fte_reference *re =
+						list_entry (e, struct fte_reference, refelem);
+				if (re->process == t && re->vaddr == upage) {
+					list_remove (e);
+					ref_free (old, re);
+					old->refcnt--;
+					t->rss--;
+					break;
+				}
+			}
+		old->pin_cnt--;
+		frame_drop_unused (old);
+		cond_broadcast (&frame_cond, &frame_lock);
+	}
+	lock_release (&frame_lock);
+
+	if (!install_page (upage, copy, true)) {
+		frame_free (copy);
+		return false;
+	}
+	pagedir_set_dirty (t->pagedir, upage, true);
+	frame_unpin (copy);
+	return true;
+}
+
+/* Pages whose mappings frame_release_process() clears with one
+	 TLB flush. */
+#define RELEASE_BATCH 64
+
+/* Clears T's *UP_CNT pages UPAGES[] with a single TLB flush, then
+	 frees the *DEAD_CNT frames DEAD[] they mapped, which must not
+	 be reused before.  Empties both batches.  frame_lock must be
+	 held. */
+static void
+release_flush (struct thread *t, void *upages[], size_t *up_cnt,
+		struct fte *dead[], size_t *dead_cnt)
+{
+	size_t i;
+
+	pagedir_clear_pages (t->pagedir, upages, *up_cnt);
+	for (i = 0; i < *dead_cnt; i++)
+		frame_discard (dead[i]);
+	*up_cnt = *dead_cnt = 0;
+}
+
+/* Drops every mapping process T has of a frame, freeing the
+	 frames no one else refers to, in a single pass over the frame
+	 table.  T's page directory is cleared along the way, so that
+	 destroying it afterwards frees nothing twice.  Called when T
+	 exits; it must not be running user code any more. */
+void
+frame_release_process (struct thread *t)
+{
+	void *upages[RELEASE_BATCH];
+	struct fte *dead[RELEASE_BATCH];
+	size_t up_cnt = 0, dead_cnt = 0;
+	size_t i;
+
+	lock_acquire (&frame_lock);
+	huge_release (t);
+	for (i = 0; i < fte_cnt; i++)
+		{
+			struct fte *fte = &fte_table[i];
+			struct list_elem *e;
+			bool dropped = false;
+
+			if (fte->paddr == NULL)
+				continue;
+			for (e = list_begin (&fte->reference_list);
+					 e != list_end (&fte->reference_list); )
+				{
+					struct fte_reference *re =
+							list_entry (e, struct fte_reference, refelem);
+					if (re->process != t) {
+						e = list_next (e);
+						continue;
+					}
+					if (up_cnt == RELEASE_BATCH)
+						release_flush (t, upages, &up_cnt, dead, &dead_cnt);
+					upages[up_cnt++] = re->vaddr;
+					e = list_remove (e);
+					ref_free (fte, re);
+					fte->refcnt--;
+					t->rss--;
+					dropped = true;
+				}
+			/* Frames in the page cache stay. */
+			if (dropped && fte->refcnt == 0 && !fte->busy
+					&& fte->sh_inode == NULL) {
+				ASSERT (fte->pin_cnt == 0);
+				if (dead_cnt == RELEASE_BATCH)
+					release_flush (t, upages, &up_cnt, dead, &dead_cnt);
+				dead[dead_cnt++] = fte;
+			}
+		}
+	release_flush (t, upages, &up_cnt, dead, &dead_cnt);
+	cond_broadcast (&frame_cond, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* If load control has suspended the current process, pages out
+	 every frame it maps alone and blocks until it is resumed.  Called
+	 where the process holds no locks: on system call entry and on
+	 page faults from user mode. */
+void
+frame_check_suspend (void)
+{
+	struct thread *t = process_current ();
+	size_t i;
+
+	if (!t->vm_suspended)
+		return;
+	lock_acquire (&frame_lock);
+	for (i = 0; i < fte_cnt && t->vm_suspended; i++)
+		if (frame_owned_by (&fte_table[i], t)) {
+			replacement_policy->on_free (&fte_table[i]);
+			frame_reclaim (&fte_table[i]);
+		}
+	while (t->vm_suspended)
+		cond_wait (&resume_cond, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Lets frame FR, allocated by frame_alloc(), be evicted.  A frame
+	 whose last page was unmapped while it was pinned is freed
+	 now. */
+void
+frame_unpin (void *fr)
+{
+	struct fte *p;
+
+	lock_acquire (&frame_lock);
+	p = frame_to_fte (fr);
+	ASSERT (p != NULL && p->pin_cnt > 0);
+	if (--p->pin_cnt == 0) {
+		frame_drop_unused (p);
+		cond_broadcast (&frame_cond, &frame_lock);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Makes swap slot SLOT, which holds the contents frame FR was just
+	 loaded with, FR's copy, so that FR is clean until written.  The
+	 frame takes over the caller's ownership of the slot. */
+void
+frame_keep_swap (void *fr, block_sector_t slot)
+{
+	struct fte *fte = frame_to_fte (fr);
+
+	lock_acquire (&frame_lock);
+	ASSERT (fte->swap == SWAP_NONE);
+	fte->swap = slot;
+	lock_release (&frame_lock);
+}
+
+/* If page UPAGE of process T is resident, pins its frame, stores
+	 the frame into *KPAGE and whether the page may differ from its
+	 backing into *DIRTY, and returns true.  Otherwise returns
+	 false. */
+bool
+frame_pin_page (struct thread *t, const void *upage, void **kpage,
+		bool *dirty)
+{
+	struct fte *p;
+
+	lock_acquire (&frame_lock);
+	*kpage = pagedir_get_page (t->pagedir, upage);
+	p = *kpage != NULL && *kpage != zero_frame ? frame_to_fte (*kpage) : NULL;
+	if (p == NULL) {
+		lock_release (&frame_lock);
+		return false;
+	}
+	p->pin_cnt++;
+	/* The writer clears the dirty bit of a frame it copies to swap. */
+	*dirty = pagedir_is_dirty (t->pagedir, upage) || frame_is_dirty (p)
+			|| p->swap != SWAP_NONE;
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Returns true if an evictor is still writing a frame to swap
+	 slot SLOT.  frame_lock must be held. */
+static bool
+slot_in_flight (block_sector_t slot)
+{
+	struct list_elem *e;
+
+	for (e = list_begin (&evicting); e != list_end (&evicting);
+			 e = list_next (e))
+		if (list_entry (e, struct fte, ioelem)->io_slot == slot)
+			return true;
+	return false;
+}
+
+/* Waits until the frame being written out to swap slot SLOT, if
+	 there is one, has reached it, so that the slot may be read or
+	 freed.  Only a few frames are ever on their way out at once. */
+void
+frame_wait_slot (block_sector_t slot)
+{
+	lock_acquire (&frame_lock);
+	while (slot_in_flight (slot))
+		cond_wait (&frame_cond, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Resets FTE to describe an unused frame.  Any writeback of the
+	 frame must already have been cancelled. */
 void
 init_fte (struct fte *fte)
 {
@@ -190,6 +1802,58 @@ init_fte (struct fte *fte)
 	fte->paddr = NULL;
 	list_init (&fte->reference_list);
 	fte->refcnt=0;
+	fte->ref_used = false;
+	fte->pin_cnt = 0;
+	fte->busy = false;
+	fte->last_use = 0;
+	fte->swap = SWAP_NONE;
+	fte->wb_state = WB_NONE;
+	shared_remove (fte);
+	ksm_remove (fte);
+	fte->gen++;
+}
+
+/* Returns a reference for FTE's reference list: its own if it is
+	 free, else an allocated one, or a null pointer if memory is
+	 short. */
+static struct fte_reference *
+ref_alloc (struct fte *fte)
+{
+	if (!fte->ref_used) {
+		fte->ref_used = true;
+		return &fte->ref;
+	}
+	return kmem_cache_alloc (&ref_cache);
 }
 
+/* Frees RE, a reference of FTE already off its list. */
+static void
+ref_free (struct fte *fte, struct fte_reference *re)
+{
+	if (re == &fte->ref)
+		fte->ref_used = false;
+	else
+		kmem_cache_free (&ref_cache, re);
+}
 
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+	printf ("Frames: %s replacement, watermarks %zu/%zu, "
+			"%llu evicted by page-out, %llu by faults\n",
+			replacement_policy->name, frame_low_wm, frame_high_wm, pageout_cnt,
+			direct_cnt);
+	printf ("Load control: %llu suspended, %llu resumed, "
+			"%llu evicted for RSS limits\n", suspend_cnt, resume_cnt,
+			rss_evict_cnt);
+	printf ("Page cache: %llu reads served, %llu pages flipped\n",
+			cache_read_cnt, flip_cnt);
+	if (frame_ksm_pages != 0)
+		printf ("Same-page merging: %llu frames merged, %llu into the zero "
+				"frame\n", ksm_merge_cnt, ksm_zero_cnt);
+	if (huge_cnt != 0)
+		printf ("Large pages: %llu mapped, %llu split\n", huge_cnt,
+				huge_split_cnt);
+	histogram_print (&alloc_latency, "Frame allocation latency", "us");
+}
@@ -2,35 +2,108 @@
 #define VM_FRAME_H
 
 #include <list.h>
+#include <hash.h>
 #include <stdint.h>
 #include "threads/thread.h"
-
-/* Frame Table Entry. */
-struct fte
-  {
-		struct list_elem celem;     /* For circular list. */
-		void *paddr;                /* Physical address of the frame. */
-		struct list reference_list; /* List of reference. Process, vaddr */
-		uint32_t refcnt;            /* Reference count. */
-  };
+#include "devices/block.h"
+#include "filesys/off_t.h"
 
 /* FTE reference. (Process, vaddr) */
 struct fte_reference
   {
-		struct thread *process;     /* Process who has page that refers 
+		struct thread *process;     /* Process who has page that refers
                                    the frame. */
 		void *vaddr;                /* Virtual address of that page. */
 		struct list_elem refelem;   /* List element for reference_list
                                    in the FTE. */
   };
 
+/* Frame Table Entry.  Most frames are mapped by one page, so the
+	 first reference is held in the FTE itself and only the others
+	 are allocated. */
+struct fte
+  {
+		struct list_elem celem;     /* For circular list. */
+		void *paddr;                /* Physical address of the frame. */
+		struct list reference_list; /* List of reference. Process, vaddr */
+		uint32_t refcnt;            /* Reference count. */
+		struct fte_reference ref;   /* A reference not allocated. */
+		bool ref_used;              /* Is REF on reference_list? */
+		uint32_t pin_cnt;           /* Never evicted while nonzero. */
+		bool busy;                  /* Being written out by an evictor. */
+		block_sector_t io_slot;     /* Slot it is being written to, if busy. */
+		struct list_elem ioelem;    /* Element in the list of frames being
+                                   written out, if busy. */
+		int64_t last_use;           /* Tick of the last observed access. */
+		uint8_t age;                /* Sampled accessed bits, for aging. */
+		uint8_t queue;              /* Queue it is on, for 2Q. */
+		block_sector_t swap;        /* Swap slot holding an up-to-date copy
+                                   of the frame, or SWAP_NONE. */
+		uint8_t wb_state;           /* Asynchronous writeback state. */
+#define WB_NONE    0x00             /* No writeback scheduled. */
+#define WB_QUEUED  0x01             /* Waiting in the writeback queue. */
+#define WB_BUSY    0x02             /* Being written by the writer. */
+		struct list_elem wbelem;    /* List element for writeback queue. */
+		unsigned gen;               /* Bumped whenever the frame changes
+                                   owner, to detect stale writebacks. */
+		struct inode *sh_inode;     /* File whose page this frame caches,
+                                   or null. */
+		off_t sh_ofs;               /* Offset of that page in it. */
+		unsigned sh_gen;            /* inode_write_gen() it was read at. */
+		uint16_t sh_len;            /* Bytes read, the rest being zeros. */
+		struct hash_elem shelem;    /* Element in the shared index. */
+		uint32_t ksm_sum;           /* Checksum at the last merge scan. */
+		bool ksm_stable;            /* In the same-page merging index? */
+		struct hash_elem ksmelem;   /* Element in that index. */
+  };
+
+/* Pages in a 4 MB large page. */
+#define HUGE_PAGES 1024
+
+extern size_t frame_low_wm, frame_high_wm;
+extern size_t frame_rss_limit;
+extern unsigned frame_thrash_rate;
+extern size_t frame_ksm_pages;
+
 void frame_init (void);
 
-void *frame_alloc (void *);  /* Allocate new frame from physical memory. 
+void *frame_alloc (void *);  /* Allocate new frame from physical memory.
                                 And create FTE(Frame Table Entry) to manage
-                                the frame. And put it into FT(Frame Table; 
+                                the frame. And put it into FT(Frame Table;
                                 implemented by a circular list.) */
+void *frame_share (struct inode *, off_t ofs, void *vaddr);
+void *frame_alloc_pinned (void);
+bool frame_map_pinned (void *, void *upage, bool writable);
+bool frame_alloc_huge (void *upage);
+bool frame_split_huge (struct thread *, const void *lo, const void *hi);
+void frame_free_pinned (void *);
+void *frame_zero (void);
+void frame_publish (void *, struct inode *, off_t ofs, size_t read_bytes);
+struct file;
+bool frame_prefetch (struct file *, off_t ofs, size_t read_bytes);
+size_t frame_read_cached (struct inode *, void *, size_t size, off_t ofs);
+bool frame_flip (struct inode *, off_t ofs, void *upage);
+void frame_forget_inode (struct inode *);
 void frame_free (void *);
+void frame_unmap_page (struct thread *, void *upage);
+void frame_release_process (struct thread *);
+void frame_unpin (void *);
+void frame_check_suspend (void);
+void frame_keep_swap (void *, block_sector_t);
+struct spte;
+bool frame_fork_page (struct thread *parent, struct spte *pspte,
+		struct spte *cspte);
+bool frame_cow_break (void *upage);
+bool frame_pin_page (struct thread *, const void *upage, void **kpage,
+		bool *dirty);
 void init_fte (struct fte *fte);
 
+void frame_wait_slot (block_sector_t);
+
+void frame_print_stats (void);
+
+bool frame_is_dirty (struct fte *);
+bool frame_test_accessed (struct fte *);
+void frame_schedule_writeback (struct fte *);
+
 #endif
@@ -0,0 +1,86 @@
+#include "vm/ksm.h"
+#include <hash.h>
+#include <debug.h>
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+
+/* Stable frames, by ksm_sum. */
+static struct hash stable_frames;
+
+static inline uint32_t
+sum_of (const struct fte *fte)
+{
+	return fte->ksm_sum;
+}
+
+static inline bool
+sum_eq (uint32_t a, uint32_t b)
+{
+	return a == b;
+}
+
+/* The sums are hashes already. */
+static inline unsigned
+sum_hash (uint32_t sum)
+{
+	return sum;
+}
+
+HASH_SPECIALIZE (stable, struct fte, ksmelem, uint32_t, sum_of, sum_hash,
+		sum_eq)
+
+void
+ksm_init (void)
+{
+	stable_init (&stable_frames);
+}
+
+/* Returns a checksum of the PGSIZE bytes at PAGE, a word at a
+	 time, FNV-1a style. */
+uint32_t
+ksm_checksum (const void *page)
+{
+	const uint32_t *w = page;
+	uint32_t sum = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < PGSIZE / sizeof *w; i++)
+		sum = (sum ^ w[i]) * 16777619u;
+	return sum;
+}
+
+/* Returns the stable frame whose checksum is SUM, or a null
+	 pointer if there is none. */
+struct fte *
+ksm_lookup (uint32_t sum)
+{
+	return stable_find (&stable_frames, sum);
+}
+
+/* Records FTE, whose ksm_sum is up to date, as the stable frame
+	 for its checksum, in place of any other. */
+void
+ksm_insert (struct fte *fte)
+{
+	struct fte *old;
+
+	ASSERT (!fte->ksm_stable);
+
+	old = stable_find (&stable_frames, fte->ksm_sum);
+	if (old != NULL) {
+		stable_remove (&stable_frames, old);
+		old->ksm_stable = false;
+	}
+	stable_insert (&stable_frames, fte);
+	fte->ksm_stable = true;
+}
+
+/* Forgets FTE, if it is in the index. */
+void
+ksm_remove (struct fte *fte)
+{
+	if (fte->ksm_stable) {
+		stable_remove (&stable_frames, fte);
+		fte->ksm_stable = false;
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+#include <stdint.h>
+
+/* Index of the frames the same-page merging scanner has found
+	 unchanged between two of its visits, keyed by a checksum of
+	 their contents, so that a later frame with the same checksum
+	 is compared against just one of them.  One frame at most is
+	 kept per checksum.  All of these must be called with
+	 frame_lock held. */
+
+struct fte;
+
+void ksm_init (void);
+uint32_t ksm_checksum (const void *page);
+struct fte *ksm_lookup (uint32_t sum);
+void ksm_insert (struct fte *);
+void ksm_remove (struct fte *);
+
+#endif
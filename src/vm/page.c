@@ -1,15 +1,65 @@
 #include "vm/page.h"
-#include <hash.h>
+#include <intmap.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "threads/thread.h"
-#include "threads/malloc.h"
-#define automalloc(x)  ( (__typeof__(x)) malloc(sizeof *x) )
+#include "threads/slab.h"
+#include "userprog/exception.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Cache of SPTEs. */
+static struct kmem_cache spte_cache;
+
+/* Pages locked by mlock() in all processes, at most a quarter of
+	 the user pool, so that pinned frames never starve eviction. */
+static struct lock mlock_lock;
+static size_t mlock_cnt;
+
+static intmap_action_func page_destructor;
+static void spte_free (struct spte *);
+static void drop_swap (struct thread *, uint8_t *upage);
+static void region_unmap (size_t);
+static void unlock_page (struct spte *);
 
 void
 page_init (void)
 {
+	kmem_cache_init (&spte_cache, "spte", sizeof (struct spte), NULL);
+	lock_init (&mlock_lock);
+}
+
+/* Sets up the empty address space of user process T. */
+void
+page_table_init (struct thread *t)
+{
+	intmap_init (&t->spt);
+	t->vmas = NULL;
+	t->vma_cnt = t->vma_cap = 0;
+	t->next_mapid = 0;
+	t->heap_start = t->brk = NULL;
+	t->locked_cnt = 0;
+	memset (&t->faults, 0, sizeof t->faults);
+}
+
+/* Frees the SPTEs and regions of T.  The swap slots holding its
+	 pages are recorded in its page directory, which frees them when
+	 it is destroyed. */
+void
+page_table_destroy (struct thread *t)
+{
+	intmap_destroy (&t->spt, page_destructor, NULL);
+	free (t->vmas);
+	t->vmas = NULL;
+	t->vma_cnt = t->vma_cap = 0;
 }
 
 
@@ -21,51 +71,757 @@ page_alloc (uint8_t *upage, struct file *backing, off_t ofs,
 	ASSERT ((read_bytes + zero_bytes) == PGSIZE);
 	ASSERT (pg_ofs (upage) == 0);
 
-	struct spte *spte = automalloc(spte);
+	struct spte *spte = kmem_cache_alloc (&spte_cache);
 	if (spte==NULL){
 		return false;
 	}
 	spte->writable = writable;
 	spte->segtype = segtype;
-	spte->bpage.file = backing;
-	spte->bpage.file_ofs = ofs;
-	spte->bpage.zero_bytes = zero_bytes;
+	spte->locked = false;
+	spte->file = backing;
+	spte->file_ofs = ofs;
+	spte->zero_bytes = zero_bytes;
 	if (backing)
-		spte->bpage.type = BACKING_TYPE_FILE;
+		spte->type = BACKING_TYPE_FILE;
 	else
-		spte->bpage.type = BACKING_TYPE_ZERO;
+		spte->type = BACKING_TYPE_ZERO;
 	spte->vaddr = upage;
 
-	if (hash_insert (&thread_current()->spt, &spte->helem)) {
-		free (spte);
+	if (!intmap_insert (&process_current ()->spt, pg_no (upage), spte)) {
+		kmem_cache_free (&spte_cache, spte);
 		return false;
 	} else {
 		return true;
 	}
 }
 
-unsigned
-page_hash (const struct hash_elem *p_, void *aux UNUSED)
+/* Returns the SPTE of T's page containing UADDR, or a null
+	 pointer if there is none. */
+struct spte *
+page_lookup (struct thread *t, const void *uaddr)
+{
+	return intmap_find (&t->spt, pg_no (uaddr));
+}
+
+/* Returns the index of the first of T's regions that ends
+	 above UPAGE, or T->vma_cnt if there is none. */
+static size_t
+region_search (struct thread *t, const uint8_t *upage)
+{
+	size_t lo = 0, hi = t->vma_cnt;
+
+	while (lo < hi)
+		{
+			size_t mid = lo + (hi - lo) / 2;
+			const struct vma *v = &t->vmas[mid];
+			if (v->start + v->page_cnt * PGSIZE <= upage)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+	return lo;
+}
+
+/* Returns how many bytes of the page PAGE_OFS bytes into region V
+	 come from its file. */
+static size_t
+region_page_read_bytes (const struct vma *v, size_t page_ofs)
+{
+	if (v->read_bytes <= page_ofs)
+		return 0;
+	return v->read_bytes - page_ofs < PGSIZE ? v->read_bytes - page_ofs
+			: PGSIZE;
+}
+
+/* Adds to the current process a region of PAGE_CNT pages at
+	 UPAGE, whose first READ_BYTES bytes are read from BACKING at
+	 OFS and the rest zeroed, and returns it.  No page is touched
+	 until it faults.  Returns a null pointer if the region is
+	 empty, wraps around, overlaps an existing one, or if memory is
+	 short. */
+static struct vma *
+region_add (uint8_t *upage, size_t page_cnt, struct file *backing, off_t ofs,
+		size_t read_bytes, bool writable, int segtype)
+{
+	struct thread *t = process_current ();
+	size_t i;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (read_bytes <= page_cnt * PGSIZE);
+
+	if (page_cnt == 0 || page_cnt > ((uintptr_t) PHYS_BASE - (uintptr_t) upage)
+			/ PGSIZE)
+		return NULL;
+	i = region_search (t, upage);
+	if (i < t->vma_cnt && t->vmas[i].start < upage + page_cnt * PGSIZE)
+		return NULL;
+
+	if (t->vma_cnt == t->vma_cap) {
+		size_t cap = t->vma_cap != 0 ? 2 * t->vma_cap : 4;
+		struct vma *vmas = realloc (t->vmas, cap * sizeof *vmas);
+		if (vmas == NULL)
+			return NULL;
+		t->vmas = vmas;
+		t->vma_cap = cap;
+	}
+	memmove (&t->vmas[i + 1], &t->vmas[i],
+			(t->vma_cnt - i) * sizeof *t->vmas);
+	t->vma_cnt++;
+
+	struct vma *v = &t->vmas[i];
+	v->start = upage;
+	v->page_cnt = page_cnt;
+	v->file = backing;
+	v->ofs = ofs;
+	v->read_bytes = backing != NULL ? read_bytes : 0;
+	v->writable = writable;
+	v->segtype = segtype;
+	v->mapid = -1;
+	v->advice = MADV_NORMAL;
+	return v;
+}
+
+/* Adds a region to the current process as region_add() does.
+	 Returns false on failure. */
+bool
+page_map (uint8_t *upage, size_t page_cnt, struct file *backing, off_t ofs,
+		size_t read_bytes, bool writable, int segtype)
+{
+	return region_add (upage, page_cnt, backing, ofs, read_bytes, writable,
+			segtype) != NULL;
+}
+
+/* Maps file F, which the mapping takes over, at UPAGE in the
+	 current process.  Its pages are read in when first touched.
+	 Returns the new mapping's id, or -1 on failure, in which case
+	 the caller keeps F. */
+int
+page_mmap (struct file *f, uint8_t *upage)
+{
+	struct thread *t = process_current ();
+	off_t length = file_length (f);
+	struct vma *v;
+
+	if (length == 0 || upage == NULL || pg_ofs (upage) != 0
+			|| !is_user_vaddr (upage))
+		return -1;
+	v = region_add (upage, DIV_ROUND_UP (length, PGSIZE), f, 0, length,
+			true, SEGTYPE_FILE);
+	if (v == NULL)
+		return -1;
+	v->mapid = t->next_mapid++;
+	return v->mapid;
+}
+
+/* Maps the PAGE_CNT pinned FRAMES of a shared memory object,
+	 opened as F, which the mapping takes over, at UPAGE in the
+	 current process, all at once.  Returns the new mapping's id, or
+	 -1 on failure, in which case the caller keeps F. */
+int
+page_shm_map (struct file *f, uint8_t *upage, void **frames,
+		size_t page_cnt)
+{
+	struct thread *t = process_current ();
+	struct vma *v;
+	size_t i;
+
+	if (upage == NULL || pg_ofs (upage) != 0 || !is_user_vaddr (upage))
+		return -1;
+	v = region_add (upage, page_cnt, f, 0, 0, true, SEGTYPE_SHM);
+	if (v == NULL)
+		return -1;
+	v->mapid = t->next_mapid++;
+	for (i = 0; i < page_cnt; i++)
+		if (!frame_map_pinned (frames[i], upage + i * PGSIZE, true)) {
+			v->file = NULL;
+			region_unmap (v - t->vmas);
+			return -1;
+		}
+	return v->mapid;
+}
+
+/* Drops the page PAGE pages into region V of the current
+	 process, with its frame, SPTE and swap slot, so that it is read
+	 back from V when next touched.  A page of a mapped file modified
+	 since it was read, whether still resident or now in swap, is
+	 written back first.  *BOUNCE is a page to read such a page back
+	 from swap into, allocated on first use. */
+static void
+region_drop_page (const struct vma *v, size_t page, uint8_t **bounce)
+{
+	struct thread *t = process_current ();
+	uint8_t *upage = v->start + page * PGSIZE;
+	struct spte *spte = page_lookup (t, upage);
+
+	if (spte != NULL && spte->locked)
+		unlock_page (spte);
+	if (v->segtype != SEGTYPE_FILE) {
+		frame_unmap_page (t, upage);
+	} else if (spte != NULL) {
+		size_t page_read_bytes = region_page_read_bytes (v, page * PGSIZE);
+		off_t ofs = v->ofs + page * PGSIZE;
+		void *kpage;
+		bool dirty;
+
+		if (frame_pin_page (t, upage, &kpage, &dirty)) {
+			/* A page loaded from swap differs from the file. */
+			if (dirty || spte->type == BACKING_TYPE_SWAP)
+				file_write_at (v->file, kpage, page_read_bytes, ofs);
+			pagedir_clear_page (t->pagedir, upage);
+			frame_free (kpage);
+		} else {
+			block_sector_t slot = pagedir_get_swap (t->pagedir, upage);
+			if (slot != SWAP_NONE) {
+				if (*bounce == NULL)
+					*bounce = palloc_get_page (PAL_ASSERT);
+				frame_wait_slot (slot);
+				swap_load (slot, *bounce);
+				file_write_at (v->file, *bounce, page_read_bytes, ofs);
+			}
+		}
+	}
+	drop_swap (t, upage);
+	if (spte != NULL) {
+		intmap_remove (&t->spt, pg_no (upage));
+		spte_free (spte);
+	}
+}
+
+/* Removes the Ith region of the current process, a mapped file,
+	 writing back its modified pages, or a shared memory object. */
+static void
+region_unmap (size_t i)
+{
+	struct thread *t = process_current ();
+	struct vma v = t->vmas[i];
+	uint8_t *bounce = NULL;
+	size_t page;
+
+	ASSERT (v.segtype == SEGTYPE_FILE || v.segtype == SEGTYPE_SHM);
+
+	for (page = 0; page < v.page_cnt; page++)
+		region_drop_page (&v, page, &bounce);
+	if (bounce != NULL)
+		palloc_free_page (bounce);
+
+	file_close (v.file);
+	t->vma_cnt--;
+	memmove (&t->vmas[i], &t->vmas[i + 1],
+			(t->vma_cnt - i) * sizeof *t->vmas);
+}
+
+/* Drops the pages of the current process from UPAGE up to END,
+	 exclusive, along with their frames and swap slots. */
+static void
+drop_pages (uint8_t *upage, uint8_t *end)
+{
+	struct thread *t = process_current ();
+
+	for (; upage < end; upage += PGSIZE)
+		{
+			struct spte *spte = page_lookup (t, upage);
+			void *kpage;
+			bool dirty;
+
+			if (spte == NULL)   /* Never touched. */
+				continue;
+			if (spte->locked)
+				unlock_page (spte);
+			if (frame_pin_page (t, upage, &kpage, &dirty)) {
+				pagedir_clear_page (t->pagedir, upage);
+				frame_free (kpage);
+			} else
+				drop_swap (t, upage);
+			intmap_remove (&t->spt, pg_no (upage));
+			spte_free (spte);
+		}
+}
+
+/* Starts the current process's heap, empty, at UPAGE, just past
+	 its loaded segments. */
+void
+page_heap_init (uint8_t *upage)
+{
+	struct thread *t = process_current ();
+
+	ASSERT (pg_ofs (upage) == 0);
+	t->heap_start = t->brk = upage;
+}
+
+/* Moves the current process's break, the end of its heap, by
+	 INCREMENT bytes and returns the old break.  Pages the heap
+	 grows into are zero-filled when first touched; whole pages it
+	 shrinks out of are freed.  Returns a null pointer, changing
+	 nothing, if the heap would shrink below its start or run into
+	 another region, or if memory is short. */
+void *
+page_sbrk (intptr_t increment)
+{
+	struct thread *t = process_current ();
+	uint8_t *old = t->brk;
+	uint8_t *new = old + increment;
+	uint8_t *old_end, *new_end;
+	struct vma *v = NULL;
+	size_t i;
+
+	if (t->heap_start == NULL
+			|| (increment < 0 ? new < t->heap_start || new > old : new < old)
+			|| new > (uint8_t *) PHYS_BASE)
+		return NULL;
+
+	old_end = pg_round_up (old);
+	new_end = pg_round_up (new);
+	i = region_search (t, t->heap_start);
+	if (i < t->vma_cnt && t->vmas[i].start == t->heap_start)
+		v = &t->vmas[i];
+
+	if (new_end > old_end) {
+		size_t page_cnt = (new_end - t->heap_start) / PGSIZE;
+		if (v == NULL)
+			v = region_add (t->heap_start, page_cnt, NULL, 0, 0, true,
+					SEGTYPE_HEAP);
+		else if (i + 1 < t->vma_cnt && t->vmas[i + 1].start < new_end)
+			v = NULL;
+		else
+			v->page_cnt = page_cnt;
+		if (v == NULL)
+			return NULL;
+	} else if (new_end < old_end) {
+		ASSERT (v != NULL);
+		if (!frame_split_huge (t, new_end, old_end))
+			return NULL;
+		drop_pages (new_end, old_end);
+		v->page_cnt = (new_end - t->heap_start) / PGSIZE;
+		if (v->page_cnt == 0) {
+			t->vma_cnt--;
+			memmove (&t->vmas[i], &t->vmas[i + 1],
+					(t->vma_cnt - i) * sizeof *t->vmas);
+		}
+	}
+
+	t->brk = new;
+	return old;
+}
+
+/* Returns true if UPAGE, which must be page-aligned, up to END,
+	 exclusive, is all in T's regions. */
+static bool
+range_mapped (struct thread *t, const uint8_t *upage, const uint8_t *end)
+{
+	const uint8_t *p;
+	size_t i;
+
+	if (pg_ofs (upage) != 0 || end < upage || end > (uint8_t *) PHYS_BASE)
+		return false;
+	for (i = region_search (t, upage), p = upage; p < end; i++)
+		{
+			if (i == t->vma_cnt || t->vmas[i].start > p)
+				return false;
+			p = t->vmas[i].start + t->vmas[i].page_cnt * PGSIZE;
+		}
+	return true;
+}
+
+/* Applies ADVICE, one of MADV_*, to the LENGTH bytes of the
+	 current process's memory at UPAGE, which must be page-aligned and
+	 all mapped.  Access patterns are kept per region, so they cover
+	 every region the range touches in full.  Returns false, doing
+	 nothing, if the range or ADVICE is invalid. */
+bool
+page_madvise (uint8_t *upage, size_t length, int advice)
 {
-	const struct spte *p = hash_entry (p_, struct spte, helem);
-	return hash_bytes (&p->vaddr, sizeof p->vaddr);
+	struct thread *t = process_current ();
+	uint8_t *end = upage + ROUND_UP (length, PGSIZE);
+	uint8_t *p;
+	size_t i, first;
+
+	if (!range_mapped (t, upage, end)
+			|| advice < MADV_NORMAL || advice > MADV_HUGEPAGE)
+		return false;
+	first = region_search (t, upage);
+
+	for (i = first; i < t->vma_cnt && t->vmas[i].start < end; i++)
+		{
+			struct vma *v = &t->vmas[i];
+			uint8_t *lo = v->start > upage ? v->start : upage;
+			uint8_t *hi = v->start + v->page_cnt * PGSIZE;
+			uint8_t *bounce = NULL;
+
+			if (hi > end)
+				hi = end;
+			switch (advice)
+				{
+				case MADV_NORMAL: case MADV_RANDOM: case MADV_SEQUENTIAL:
+					v->advice = advice;
+					break;
+				case MADV_WILLNEED:
+					exception_prefetch (lo, (hi - lo) / PGSIZE);
+					break;
+				case MADV_DONTNEED:
+					/* Shared memory has no backing to read back from. */
+					if (v->segtype == SEGTYPE_SHM)
+						break;
+					if (!frame_split_huge (t, lo, hi))
+						return false;
+					for (p = lo; p < hi; p += PGSIZE)
+						region_drop_page (v, (p - v->start) / PGSIZE, &bounce);
+					if (bounce != NULL)
+						palloc_free_page (bounce);
+					break;
+				case MADV_HUGEPAGE:
+					/* Only anonymous memory; see page_huge(). */
+					if (v->writable && v->segtype != SEGTYPE_FILE
+							&& v->segtype != SEGTYPE_SHM)
+						v->advice = advice;
+					break;
+				}
+		}
+	return true;
 }
 
+/* Maps the aligned 4 MB of the current process around UADDR with
+	 one large page, if its region was advised MADV_HUGEPAGE, holds
+	 all of it past the part read from a file, and none of it was
+	 touched yet.  Returns true if it did. */
 bool
-page_less (const struct hash_elem *a_, const struct hash_elem *b_,
-		void *aux UNUSED)
+page_huge (const void *uaddr)
+{
+	struct thread *t = process_current ();
+	const struct vma *v = page_find_region (t, uaddr);
+	uint8_t *upage = (uint8_t *) ROUND_DOWN ((uintptr_t) uaddr,
+			HUGE_PAGES * PGSIZE);
+	size_t i;
+
+	if (v == NULL || v->advice != MADV_HUGEPAGE
+			|| upage < v->start + ROUND_UP (v->read_bytes, PGSIZE)
+			|| upage + HUGE_PAGES * PGSIZE > v->start + v->page_cnt * PGSIZE
+			|| !pagedir_large_unused (t->pagedir, upage))
+		return false;
+	for (i = 0; i < HUGE_PAGES; i++)
+		if (page_lookup (t, upage + i * PGSIZE) != NULL)
+			return false;
+
+	/* Each page has its SPTE, as if touched, for when it is split. */
+	for (i = 0; i < HUGE_PAGES; i++)
+		if (!page_alloc (upage + i * PGSIZE, NULL, 0, 0, PGSIZE, true,
+					v->segtype))
+			break;
+	if (i == HUGE_PAGES && frame_alloc_huge (upage))
+		return true;
+	while (i-- > 0)
+		spte_free (intmap_remove (&t->spt, pg_no (upage + i * PGSIZE)));
+	return false;
+}
+
+/* Makes SPTE's page of the current process resident and pins its
+	 frame, for mlock().  A writable page gets a frame of its own,
+	 writable, so that stores to it never fault either.  Returns false
+	 if memory is short. */
+static bool
+lock_page (struct spte *spte)
+{
+	struct thread *t = process_current ();
+	void *kpage;
+	bool dirty;
+
+	for (;;)
+		{
+			if (frame_pin_page (t, spte->vaddr, &kpage, &dirty)) {
+				if (!spte->writable || pagedir_is_writable (t->pagedir, spte->vaddr))
+					break;
+				frame_unpin (kpage);
+			} else if (!spte->writable
+					&& pagedir_get_page (t->pagedir, spte->vaddr) == frame_zero ())
+				break;   /* The zero frame stays put. */
+			if (!demand_paging (spte->vaddr, spte->writable))
+				return false;
+		}
+	spte->locked = true;
+	t->locked_cnt++;
+	return true;
+}
+
+/* Unpins SPTE's page of the current process, locked by
+	 lock_page(). */
+static void
+unlock_page (struct spte *spte)
 {
-	const struct spte *a = hash_entry (a_, struct spte, helem);
-	const struct spte *b = hash_entry (b_, struct spte, helem);
+	struct thread *t = process_current ();
+	void *kpage = pagedir_get_page (t->pagedir, spte->vaddr);
 
-	return a->vaddr < b->vaddr;
+	ASSERT (spte->locked && kpage != NULL);
+	if (kpage != frame_zero ())
+		frame_unpin (kpage);
+	spte->locked = false;
+	t->locked_cnt--;
+	lock_acquire (&mlock_lock);
+	mlock_cnt--;
+	lock_release (&mlock_lock);
 }
 
+/* Locks the LENGTH bytes of the current process's memory at UPAGE,
+	 which must be page-aligned and all mapped, resident: its pages
+	 are brought in and never evicted until page_munlock().  Returns
+	 false if the range is invalid, if pages would be locked past
+	 the system-wide limit, or if memory is short; pages locked
+	 before a failure stay locked. */
+bool
+page_mlock (uint8_t *upage, size_t length)
+{
+	struct thread *t = process_current ();
+	uint8_t *end = upage + ROUND_UP (length, PGSIZE);
+	uint8_t *p;
+
+	if (!range_mapped (t, upage, end))
+		return false;
+	for (p = upage; p < end; p += PGSIZE)
+		{
+			struct spte scratch;
+			struct spte *spte = page_get (p, &scratch);
+			bool ok;
+
+			/* Read-only pages need an SPTE too, to be marked locked. */
+			if (spte == &scratch
+					&& (!page_alloc (p, scratch.type == BACKING_TYPE_FILE
+								? scratch.file : NULL, scratch.file_ofs,
+								PGSIZE - scratch.zero_bytes, scratch.zero_bytes, false,
+								scratch.segtype)
+						|| (spte = page_lookup (t, p)) == NULL))
+				return false;
+			if (spte == NULL)
+				return false;
+			if (spte->locked)
+				continue;
+
+			lock_acquire (&mlock_lock);
+			ok = mlock_cnt < palloc_user_page_cnt () / 4;
+			if (ok)
+				mlock_cnt++;
+			lock_release (&mlock_lock);
+			if (!ok)
+				return false;
+			if (!lock_page (spte)) {
+				lock_acquire (&mlock_lock);
+				mlock_cnt--;
+				lock_release (&mlock_lock);
+				return false;
+			}
+		}
+	return true;
+}
+
+/* Unlocks the pages locked by page_mlock() among the LENGTH bytes
+	 of the current process's memory at UPAGE, which must be
+	 page-aligned and all mapped.  Returns false if the range is
+	 invalid. */
+bool
+page_munlock (uint8_t *upage, size_t length)
+{
+	struct thread *t = process_current ();
+	uint8_t *end = upage + ROUND_UP (length, PGSIZE);
+	uint8_t *p;
+
+	if (!range_mapped (t, upage, end))
+		return false;
+	for (p = upage; p < end && t->locked_cnt > 0; p += PGSIZE)
+		{
+			struct spte *spte = page_lookup (t, p);
+			if (spte != NULL && spte->locked)
+				unlock_page (spte);
+		}
+	return true;
+}
+
+/* Unlocks every page of the current process.  Called on exit,
+	 before its frames are released. */
 void
-page_destructor (struct hash_elem *a, void *aux UNUSED)
+page_munlock_all (void)
+{
+	struct thread *t = process_current ();
+	struct intmap_iterator i;
+	struct spte *spte;
+
+	if (t->locked_cnt == 0)
+		return;
+	intmap_first (&i, &t->spt);
+	while ((spte = intmap_next (&i)) != NULL)
+		if (spte->locked)
+			unlock_page (spte);
+}
+
+/* Removes mapping MAPID of the current process.  Returns false if
+	 there is no such mapping. */
+bool
+page_munmap (int mapid)
+{
+	struct thread *t = process_current ();
+	size_t i;
+
+	for (i = 0; i < t->vma_cnt; i++)
+		if (t->vmas[i].mapid == mapid && mapid >= 0)
+			{
+				region_unmap (i);
+				return true;
+			}
+	return false;
+}
+
+/* Removes every mapped file of the current process, writing back
+	 their dirty pages.  Called on exit, before the process's frames
+	 are released. */
+void
+page_munmap_all (void)
+{
+	struct thread *t = process_current ();
+	size_t i = t->vma_cnt;
+
+	while (i-- > 0)
+		if (t->vmas[i].mapid >= 0)
+			region_unmap (i);
+}
+
+/* Gives the current process, just forked, a copy-on-write copy of
+	 PARENT's address space.  The current process's page directory
+	 must exist and its executable must be open.  Mapped files and
+	 shared memory are not inherited.  Returns false if memory is short; whatever was
+	 copied is freed when the process exits. */
+bool
+page_fork (struct thread *parent)
+{
+	struct thread *t = process_current ();
+	struct intmap_iterator i;
+	struct spte *pspte;
+	size_t n;
+
+	/* Large pages are not shared copy-on-write. */
+	if (!frame_split_huge (parent, NULL, PHYS_BASE))
+		return false;
+	for (n = 0; n < parent->vma_cnt; n++)
+		{
+			const struct vma *pv = &parent->vmas[n];
+			struct file *f = pv->file == parent->my_binary ? t->my_binary
+					: pv->file;
+			struct vma *v;
+			if (pv->segtype == SEGTYPE_FILE || pv->segtype == SEGTYPE_SHM)
+				continue;
+			v = region_add (pv->start, pv->page_cnt, f, pv->ofs, pv->read_bytes,
+					pv->writable, pv->segtype);
+			if (v == NULL)
+				return false;
+			v->advice = pv->advice;
+		}
+
+	t->heap_start = parent->heap_start;
+	t->brk = parent->brk;
+
+	intmap_first (&i, &parent->spt);
+	while ((pspte = intmap_next (&i)) != NULL)
+		{
+			struct spte *cspte;
+
+			if (pspte->segtype == SEGTYPE_FILE)
+				continue;
+			cspte = kmem_cache_alloc (&spte_cache);
+			if (cspte == NULL)
+				return false;
+			/* In the SPT first, so an evictor finds it once shared. */
+			cspte->vaddr = pspte->vaddr;
+			cspte->type = BACKING_TYPE_NONE;
+			cspte->locked = false;   /* Locks are not inherited. */
+			if (!intmap_insert (&t->spt, pg_no (cspte->vaddr), cspte))
+				{
+					kmem_cache_free (&spte_cache, cspte);
+					return false;
+				}
+			if (!frame_fork_page (parent, pspte, cspte))
+				return false;
+			if (cspte->file == parent->my_binary)
+				cspte->file = t->my_binary;
+		}
+	return true;
+}
+
+/* Returns T's region containing UADDR, or a null pointer. */
+const struct vma *
+page_find_region (struct thread *t, const void *uaddr)
+{
+	size_t i = region_search (t, pg_round_down (uaddr));
+
+	if (i < t->vma_cnt && t->vmas[i].start <= (const uint8_t *) uaddr)
+		return &t->vmas[i];
+	return NULL;
+}
+
+/* Returns the SPTE of the current process's page containing
+	 UADDR, which may have to be derived from its region.
+	 Read-only pages can always be read back from their region, so
+	 they don't get an SPTE; for those SCRATCH is filled in and
+	 returned.  Writable pages may later be dirtied and swapped out,
+	 so their SPTE is created here, on first touch.  Returns a null
+	 pointer if UADDR isn't mapped or if memory is short. */
+struct spte *
+page_get (const void *uaddr, struct spte *scratch)
+{
+	struct thread *t = process_current ();
+	uint8_t *upage = pg_round_down (uaddr);
+	struct spte *spte;
+	const struct vma *v;
+	size_t page_ofs, page_read_bytes;
+
+	spte = page_lookup (t, upage);
+	if (spte != NULL)
+		return spte;
+	v = page_find_region (t, upage);
+	if (v == NULL)
+		return NULL;
+
+	page_ofs = upage - v->start;
+	page_read_bytes = region_page_read_bytes (v, page_ofs);
+
+	if (v->writable) {
+		if (!page_alloc (upage, page_read_bytes ? v->file : NULL,
+					v->ofs + page_ofs, page_read_bytes, PGSIZE - page_read_bytes,
+					true, v->segtype))
+			return NULL;
+		return page_lookup (t, upage);
+	}
+
+	scratch->writable = false;
+	scratch->segtype = v->segtype;
+	scratch->type = page_read_bytes ? BACKING_TYPE_FILE
+			: BACKING_TYPE_ZERO;
+	scratch->file = v->file;
+	scratch->file_ofs = v->ofs + page_ofs;
+	scratch->zero_bytes = PGSIZE - page_read_bytes;
+	scratch->vaddr = upage;
+	return scratch;
+}
+
+/* Frees SPTE. */
+static void
+spte_free (struct spte *spte)
+{
+	kmem_cache_free (&spte_cache, spte);
+}
+
+/* Frees the swap slot holding T's page UPAGE, if it is swapped
+	 out, and forgets it. */
+static void
+drop_swap (struct thread *t, uint8_t *upage)
+{
+	block_sector_t slot = pagedir_get_swap (t->pagedir, upage);
+
+	if (slot != SWAP_NONE) {
+		/* A slot still being written to mustn't be handed out yet. */
+		frame_wait_slot (slot);
+		swap_free_slot (slot);
+		pagedir_set_swap (t->pagedir, upage, SWAP_NONE);
+	}
+}
+
+static void
+page_destructor (uintptr_t key UNUSED, void *spte, void *aux UNUSED)
 {
-	struct spte *spte = hash_entry (a, struct spte, helem);
-	if (spte)
-		free (spte);
+	spte_free (spte);
 }
 
@@ -3,48 +3,98 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <hash.h>
 #include "filesys/file.h"
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
-struct backing_page
-  {
-		uint8_t type;                /* Backing type */
-#define BACKING_TYPE_NONE   0x00 /* If there is no backing. */	
+/* Backing types of a page. */
+#define BACKING_TYPE_NONE   0x00 /* If there is no backing. */
 #define BACKING_TYPE_FILE   0x01 /* If there is file copy. */
-#define BACKING_TYPE_SWAP   0x02 /* If it is swapped out. */
+#define BACKING_TYPE_SWAP   0x02 /* If it has been swapped in, so that
+                                    only swap holds it when evicted. */
 #define BACKING_TYPE_ZERO   0x03 /* If it's just zero page. */
-		struct file *file;           /* File. */
-		off_t file_ofs;              /* Offset of file. */
-		block_sector_t sector_idx;   /* Index of starting sector of swap. */
-		uint32_t zero_bytes;         /* Number of padding zeros. */
+
+struct fte;
+
+/* Code pages read in per code page fault, the faulting one
+	 included, as one aligned window.  1 disables fault-around. */
+#define FAULT_AROUND_PAGES 8
+
+/* Likewise for pages read back from swap. */
+#define SWAP_AROUND_PAGES 8
+
+/* Pages read ahead of a fault in a region advised sequential.  As
+	 many pages, that far behind it, lose their accessed bits, so
+	 that they are the first to go. */
+#define SEQ_AHEAD_PAGES 16
+
+/* A region of a process's address space: PAGE_CNT pages starting
+	 at START, of which the first READ_BYTES bytes come from FILE at
+	 offset OFS and the rest are zero.  The regions of a process are
+	 kept sorted by address and never overlap. */
+struct vma
+  {
+		uint8_t *start;             /* First page. */
+		size_t page_cnt;            /* Number of pages. */
+		struct file *file;          /* Backing file, or null. */
+		off_t ofs;                  /* Offset in FILE of START. */
+		size_t read_bytes;          /* Bytes backed by FILE. */
+		bool writable;              /* Writable? */
+		uint8_t segtype;            /* SEGTYPE_* of the pages. */
+		int mapid;                  /* Id of a mapped file, or -1. */
+		uint8_t advice;             /* MADV_* pattern given by madvise(). */
   };
 
-/* Supplemental Page Table Entry. */
+/* Supplemental Page Table Entry.  One exists for every page a
+	 process has touched, so its type, flags and zero count share a
+	 word: 16 bytes in all.  FILE and FILE_OFS mean something only
+	 for BACKING_TYPE_FILE; the swap slot of a page swapped out is in
+	 its page table entry instead. */
 struct spte
   {
-		bool writable;               /* Writable? */
-		uint8_t segtype;             /* Which segment? or mmaped file? */
+		void *vaddr;                 /* [Key] Virtual address. */
+		struct file *file;           /* File. */
+		off_t file_ofs;              /* Offset of file. */
+		unsigned zero_bytes : 13;    /* Number of padding zeros. */
+		unsigned type : 2;           /* BACKING_TYPE_*. */
+		unsigned writable : 1;       /* Writable? */
+		unsigned segtype : 3;        /* Which segment? or mmaped file? */
+		unsigned locked : 1;         /* Pinned resident by mlock()? */
 #define SEGTYPE_CODE   0x01
 #define SEGTYPE_DATA   0x02
-#define SEGTYPE_HEAP   0x03      /* Unused. */
+#define SEGTYPE_HEAP   0x03      /* Grown by sbrk(). */
 #define SEGTYPE_STACK  0x04
 #define SEGTYPE_FILE   0x05      /* Memory maped file. */
-		struct backing_page bpage;   /* Backing info. */
-		struct hash_elem helem;      /* Hash table (SPT; 
-                                    Supplemental Page Table) element. */
-		void *vaddr;                 /* [Key] Virtual address. */
+#define SEGTYPE_SHM    0x06      /* Shared memory object. */
   };
 
 void page_init (void);
 
+struct thread;
+void page_table_init (struct thread *);
+void page_table_destroy (struct thread *);
+
+bool page_map (uint8_t *upage, size_t page_cnt, struct file *, off_t ofs,
+		size_t read_bytes, bool writable, int segtype);
+int page_mmap (struct file *, uint8_t *upage);
+int page_shm_map (struct file *, uint8_t *upage, void **frames,
+		size_t page_cnt);
+bool page_munmap (int mapid);
+void page_munmap_all (void);
+bool page_fork (struct thread *parent);
+void page_heap_init (uint8_t *upage);
+void *page_sbrk (intptr_t increment);
+bool page_madvise (uint8_t *upage, size_t length, int advice);
+bool page_huge (const void *uaddr);
+bool page_mlock (uint8_t *upage, size_t length);
+bool page_munlock (uint8_t *upage, size_t length);
+void page_munlock_all (void);
+const struct vma *page_find_region (struct thread *, const void *uaddr);
+
 bool page_alloc (uint8_t *upage, struct file *backing, off_t ofs, 
 		uint32_t read_bytes, uint32_t zero_bytes, bool writable, int segtype);
 
-unsigned page_hash (const struct hash_elem *p_, void *aux);
-bool page_less (const struct hash_elem *a_, const struct hash_elem *b_,
-		void *aux);
-void page_destructor (struct hash_elem *a, void *aux);
+struct spte *page_lookup (struct thread *, const void *uaddr);
+struct spte *page_get (const void *uaddr, struct spte *scratch);
 
 #endif
@@ -0,0 +1,28 @@
+#include "vm/replace.h"
+#include <stddef.h>
+#include <string.h>
+
+/* Every policy, for -vm-policy. */
+static const struct replacement_policy *const policies[] =
+	{ &clock_policy, &wsclock_policy, &aging_policy, &twoq_policy };
+
+const struct replacement_policy *replacement_policy = &clock_policy;
+
+/* Default sampling period, overridden by -vm-scan. */
+int64_t replace_scan_ticks = 4;
+
+/* Makes the policy called NAME the one in use.  Returns false if
+	 there is none by that name.  Must be called before
+	 frame_init(). */
+bool
+replacement_select (const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof policies / sizeof *policies; i++)
+		if (!strcmp (policies[i]->name, name)) {
+			replacement_policy = policies[i];
+			return true;
+		}
+	return false;
+}
@@ -0,0 +1,50 @@
+#ifndef VM_REPLACE_H
+#define VM_REPLACE_H
+
+#include <clist.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "vm/frame.h"
+
+/* A page replacement policy.  It keeps track of the evictable
+   frames, from frame_alloc() until they are evicted or freed, and
+   picks the victims.  Every operation is called with frame_lock
+   held. */
+struct replacement_policy
+  {
+    const char *name;                   /* Name for -vm-policy. */
+    void (*init) (void);
+    void (*on_alloc) (struct fte *);    /* FTE became evictable. */
+    void (*on_access_scan) (void);      /* Periodic sampling of the
+                                           accessed bits, or null. */
+    struct fte *(*pick_victim) (void);  /* Takes a victim off the
+                                           policy's lists and returns
+                                           it, or returns null if every
+                                           frame is pinned. */
+    void (*on_free) (struct fte *);     /* FTE freed without being
+                                           evicted. */
+  };
+
+extern const struct replacement_policy clock_policy;
+extern const struct replacement_policy wsclock_policy;
+extern const struct replacement_policy aging_policy;
+extern const struct replacement_policy twoq_policy;
+
+/* The policy in use, clock unless -vm-policy says otherwise. */
+extern const struct replacement_policy *replacement_policy;
+
+bool replacement_select (const char *name);
+
+/* Ticks between calls to a policy's on_access_scan. */
+extern int64_t replace_scan_ticks;
+
+/* Age of a frame just used, for aging. */
+#define AGE_NEW 0x80
+
+struct fte *clock_sweep (struct clist *);
+
+/* Working-set window, in timer ticks.  A frame not accessed for
+   longer than this is outside its owner's working set. */
+extern int64_t wsclock_tau;
+
+#endif /* vm/replace.h */
@@ -1 +1,85 @@
 #include "vm/shared-block.h"
+#include <hash.h>
+#include <debug.h>
+#include "filesys/inode.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+
+/* Shared frames, by (sh_inode, sh_ofs). */
+static struct hash shared_frames;
+
+struct shared_key
+	{
+		struct inode *inode;
+		off_t ofs;
+	};
+
+static inline struct shared_key
+shared_key_of (const struct fte *fte)
+{
+	struct shared_key key = { fte->sh_inode, fte->sh_ofs };
+	return key;
+}
+
+/* Code pages are at page offsets, so the page number goes in the
+	 low bits. */
+static inline unsigned
+shared_key_hash (struct shared_key key)
+{
+	return hash_word ((uintptr_t) key.inode ^ (key.ofs >> PGBITS));
+}
+
+static inline bool
+shared_key_eq (struct shared_key a, struct shared_key b)
+{
+	return a.inode == b.inode && a.ofs == b.ofs;
+}
+
+HASH_SPECIALIZE (shared_index, struct fte, shelem, struct shared_key,
+		shared_key_of, shared_key_hash, shared_key_eq)
+
+void
+shared_init (void)
+{
+	shared_index_init (&shared_frames);
+}
+
+/* Returns the frame holding the page at OFS in INODE, or a null
+	 pointer if no process has it resident. */
+struct fte *
+shared_lookup (struct inode *inode, off_t ofs)
+{
+	struct shared_key key = { inode, ofs };
+
+	return shared_index_find (&shared_frames, key);
+}
+
+/* Records that FTE holds the page at OFS in INODE, READ_BYTES of
+	 it as INODE now has them and then zeros, unless some other frame
+	 already does. */
+void
+shared_insert (struct fte *fte, struct inode *inode, off_t ofs,
+		size_t read_bytes)
+{
+	ASSERT (fte->sh_inode == NULL);
+	ASSERT (read_bytes <= PGSIZE);
+
+	fte->sh_inode = inode;
+	fte->sh_ofs = ofs;
+	fte->sh_gen = inode_write_gen (inode);
+	fte->sh_len = read_bytes;
+	if (shared_index_insert (&shared_frames, fte) != NULL)
+		fte->sh_inode = NULL;
+	else
+		inode_set_page_cached (inode);
+}
+
+/* Forgets FTE, if it is in the index. */
+void
+shared_remove (struct fte *fte)
+{
+	if (fte->sh_inode != NULL) {
+		shared_index_remove (&shared_frames, fte);
+		fte->sh_inode = NULL;
+	}
+}
@@ -1,4 +1,23 @@
 #ifndef VM_SHARED_BLOCK_H
 #define VM_SHARED_BLOCK_H
 
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+/* Index of the frames holding read-only file pages, keyed by the
+	 file's inode and the page's offset, so that every process
+	 running the same program maps the same frames.  It is the page
+	 cache: a frame stays in it once no process maps it, until it is
+	 evicted, and read() copies from it.  All of these must be called
+	 with frame_lock held. */
+
+struct fte;
+struct inode;
+
+void shared_init (void);
+struct fte *shared_lookup (struct inode *, off_t ofs);
+void shared_insert (struct fte *, struct inode *, off_t ofs,
+		size_t read_bytes);
+void shared_remove (struct fte *);
+
 #endif
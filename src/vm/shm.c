@@ -0,0 +1,250 @@
+#include "vm/shm.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Named shared memory objects.
+
+	 An object's pages are frames allocated with
+	 frame_alloc_pinned() when it is created, so they are never
+	 evicted, and every process that maps it maps the very same
+	 frames, through the frame table's reference lists.  Each
+	 shm_open() gets its own inode, made by inode_create_anon(), on
+	 the object, and a mapping keeps a file open on it, so the
+	 object goes away, and its name with it, once the last
+	 descriptor and the last mapping are gone.
+
+	 Since the frames stay resident, all objects together may take
+	 at most a quarter of the user pool. */
+struct shm
+	{
+		struct list_elem elem;      /* Element in shm_list. */
+		char name[SHM_NAME_MAX + 1];
+		size_t page_cnt;            /* Size, in pages. */
+		void **frames;              /* PAGE_CNT pinned frames. */
+		int ref_cnt;                /* Inodes open on it. */
+	};
+
+/* Objects by name, the pages they hold, and a lock for both and
+	 for each object's REF_CNT. */
+static struct list shm_list;
+static size_t shm_page_cnt;
+static struct lock shm_lock;
+
+static off_t shm_read_at (struct inode *, void *, off_t, off_t);
+static off_t shm_write_at (struct inode *, const void *, off_t, off_t);
+static void shm_readahead (struct inode *, off_t, off_t);
+static void shm_sync (struct inode *);
+static void shm_release (struct inode *);
+
+static const struct inode_ops shm_ops =
+	{
+		shm_read_at, shm_write_at, shm_readahead, shm_sync, shm_release
+	};
+
+void
+shm_init (void)
+{
+	list_init (&shm_list);
+	lock_init (&shm_lock);
+	lock_set_name (&shm_lock, "shm");
+}
+
+/* Returns the object named NAME, or a null pointer.  shm_lock
+	 must be held. */
+static struct shm *
+shm_lookup (const char *name)
+{
+	struct list_elem *e;
+
+	for (e = list_begin (&shm_list); e != list_end (&shm_list);
+			 e = list_next (e))
+		{
+			struct shm *s = list_entry (e, struct shm, elem);
+			if (!strcmp (s->name, name))
+				return s;
+		}
+	return NULL;
+}
+
+/* Frees object S and its frames.  It must be unnamed already. */
+static void
+shm_free (struct shm *s)
+{
+	size_t i;
+
+	for (i = 0; i < s->page_cnt; i++)
+		if (s->frames[i] != NULL)
+			frame_free_pinned (s->frames[i]);
+	free (s->frames);
+	free (s);
+}
+
+/* Creates the object NAME of SIZE bytes, zeroed, and returns it
+	 with no references.  Returns a null pointer if SIZE is 0 or too
+	 large, or memory is short.  shm_lock must be held. */
+static struct shm *
+shm_create (const char *name, size_t size)
+{
+	size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+	struct shm *s;
+	size_t i;
+
+	if (page_cnt == 0
+			|| page_cnt > palloc_user_page_cnt () / 4 - shm_page_cnt)
+		return NULL;
+	s = calloc (1, sizeof *s);
+	if (s == NULL)
+		return NULL;
+	s->frames = calloc (page_cnt, sizeof *s->frames);
+	if (s->frames == NULL) {
+		free (s);
+		return NULL;
+	}
+	s->page_cnt = page_cnt;
+	for (i = 0; i < page_cnt; i++)
+		s->frames[i] = frame_alloc_pinned ();
+	strlcpy (s->name, name, sizeof s->name);
+	list_push_back (&shm_list, &s->elem);
+	shm_page_cnt += page_cnt;
+	return s;
+}
+
+/* Opens the shared memory object NAME, creating it with SIZE
+	 bytes of zeros if there is none; an existing object keeps its
+	 size.  Returns a file open on it, or a null pointer if NAME is
+	 empty or too long, if there is no object NAME and SIZE is 0 or
+	 too large, or if memory is short. */
+struct file *
+shm_open (const char *name, size_t size)
+{
+	struct inode *inode = NULL;
+	struct shm *s;
+
+	if (*name == '\0' || strlen (name) > SHM_NAME_MAX)
+		return NULL;
+
+	lock_acquire (&shm_lock);
+	s = shm_lookup (name);
+	if (s == NULL)
+		s = shm_create (name, size);
+	if (s != NULL) {
+		inode = inode_create_anon (&shm_ops, s);
+		if (inode != NULL)
+			s->ref_cnt++;
+		else if (s->ref_cnt == 0) {
+			list_remove (&s->elem);
+			shm_page_cnt -= s->page_cnt;
+			shm_free (s);
+		}
+	}
+	lock_release (&shm_lock);
+	return file_open (inode);
+}
+
+/* Maps the shared memory object that F is open on at UPAGE in the
+	 current process, which the mapping takes over, and returns the
+	 mapping's id, for munmap().  Returns -1, leaving F to the
+	 caller, if F is no shared memory object or the object does not
+	 fit at UPAGE. */
+int
+shm_map (struct file *f, void *upage)
+{
+	struct inode *inode = file_get_inode (f);
+	struct shm *s;
+
+	if (inode_get_ops (inode) != &shm_ops)
+		return -1;
+	s = inode_aux (inode);
+	return page_shm_map (f, upage, s->frames, s->page_cnt);
+}
+
+/* Reads SIZE bytes at OFFSET in INODE's object into BUFFER, up to
+	 the end of the object. */
+static off_t
+shm_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
+{
+	struct shm *s = inode_aux (inode);
+	off_t length = s->page_cnt * PGSIZE;
+	uint8_t *buffer = buffer_;
+	off_t done = 0;
+
+	while (done < size && offset + done < length)
+		{
+			off_t ofs = offset + done;
+			off_t chunk = PGSIZE - ofs % PGSIZE;
+
+			if (chunk > size - done)
+				chunk = size - done;
+			memcpy (buffer + done, (uint8_t *) s->frames[ofs / PGSIZE]
+					+ ofs % PGSIZE, chunk);
+			done += chunk;
+		}
+	return done;
+}
+
+/* Writes SIZE bytes from BUFFER at OFFSET in INODE's object, up to
+	 the end of the object, which does not grow. */
+static off_t
+shm_write_at (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset)
+{
+	struct shm *s = inode_aux (inode);
+	off_t length = s->page_cnt * PGSIZE;
+	const uint8_t *buffer = buffer_;
+	off_t done = 0;
+
+	while (done < size && offset + done < length)
+		{
+			off_t ofs = offset + done;
+			off_t chunk = PGSIZE - ofs % PGSIZE;
+
+			if (chunk > size - done)
+				chunk = size - done;
+			memcpy ((uint8_t *) s->frames[ofs / PGSIZE] + ofs % PGSIZE,
+					buffer + done, chunk);
+			done += chunk;
+		}
+	return done;
+}
+
+/* Shared memory is always resident. */
+static void
+shm_readahead (struct inode *inode UNUSED, off_t offset UNUSED,
+		off_t size UNUSED)
+{
+}
+
+/* Shared memory has nowhere to be written back to. */
+static void
+shm_sync (struct inode *inode UNUSED)
+{
+}
+
+/* Drops INODE's reference to its object, and the object with the
+	 last one. */
+static void
+shm_release (struct inode *inode)
+{
+	struct shm *s = inode_aux (inode);
+	bool dead;
+
+	lock_acquire (&shm_lock);
+	dead = --s->ref_cnt == 0;
+	if (dead) {
+		list_remove (&s->elem);
+		shm_page_cnt -= s->page_cnt;
+	}
+	lock_release (&shm_lock);
+	if (dead)
+		shm_free (s);
+}
@@ -0,0 +1,16 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct file;
+
+/* Longest name of a shared memory object. */
+#define SHM_NAME_MAX 14
+
+void shm_init (void);
+struct file *shm_open (const char *name, size_t size);
+int shm_map (struct file *, void *upage);
+
+#endif
@@ -1,78 +1,388 @@
 #include "vm/swap.h"
 #include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "devices/block.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "userprog/exception.h"
+#include "vm/zswap.h"
 
-#define BLOCK_SECTOR_RATIO  (PGSIZE / BLOCK_SECTOR_SIZE)
+/* Swap areas, one per swap device.  Slots are numbered across
+	 all of them, each area taking the next range, so that the rest
+	 of the VM sees a single swap space.  Areas are kept in order of
+	 priority, highest first.  A run of slots goes to an area of the
+	 highest priority that has room, taking those areas in turn, so
+	 that consecutive page-outs, and the page-ins that follow them,
+	 spread across devices that can each work on a request at the
+	 same time. */
+#define SWAP_AREA_MAX 8
 
-static struct lock st_lock;
-static struct lock swap_lock;
-static struct bitmap *st;   /* Swap Table */
+struct swap_area
+	{
+		struct block *dev;
+		int prio;                 /* Higher is used first. */
+		size_t base;              /* Number of its first slot. */
+		struct bitmap *map;       /* Its slots in use. */
+		size_t hint;              /* Next-fit cursor: where the last run ended. */
+		struct lock io_lock;      /* One request to DEV at a time. */
+	};
 
-struct block *swap_dev;
+static struct swap_area areas[SWAP_AREA_MAX];
+static size_t area_cnt;
+static size_t next_area;    /* Where the round robin goes next. */
+
+static struct lock st_lock; /* Protects the slot maps and below. */
+static size_t slot_cnt;     /* Slots in all areas. */
+static uint8_t *st_refs;    /* Per slot, owners beyond the first. */
+static size_t used_cnt;     /* Slots in use. */
+
+/* Statistics. */
+static unsigned long long alloc_cnt, wrap_cnt;
+
+/* Swap devices to use, from "-swap=BDEV[:PRIO],...", or null for
+	 every swap partition, all at priority 0. */
+char *swap_devices;
+
+/* Adds DEV as a swap area of priority PRIO, after those of the
+	 same priority or higher. */
+static void
+add_area (struct block *dev, int prio)
+{
+	size_t i;
+
+	if (area_cnt == SWAP_AREA_MAX)
+		PANIC ("too many swap devices");
+	for (i = area_cnt; i > 0 && areas[i - 1].prio < prio; i--)
+		areas[i] = areas[i - 1];
+	areas[i].dev = dev;
+	areas[i].prio = prio;
+	area_cnt++;
+}
 
 void
 swap_init (void)
 {
+	struct block *dev;
+	size_t i;
+
 	lock_init (&st_lock);
-	lock_init (&swap_lock);
-	swap_dev = block_get_role (BLOCK_SWAP);
+	lock_set_name (&st_lock, "swap table");
+
+	if (swap_devices != NULL) {
+		char *tok, *save;
 
-	ASSERT(swap_dev);
+		for (tok = strtok_r (swap_devices, ",", &save); tok != NULL;
+				 tok = strtok_r (NULL, ",", &save))
+			{
+				char *colon = strchr (tok, ':');
+				int prio = 0;
 
-	block_sector_t sector_cnt = block_size (swap_dev);
-	size_t block_cnt = sector_cnt / BLOCK_SECTOR_RATIO;
+				if (colon != NULL) {
+					*colon = '\0';
+					prio = atoi (colon + 1);
+				}
+				dev = block_get_by_name (tok);
+				if (dev == NULL)
+					PANIC ("No such block device \"%s\"", tok);
+				add_area (dev, prio);
+			}
+	} else {
+		for (dev = block_first (); dev != NULL; dev = block_next (dev))
+			if (block_type (dev) == BLOCK_SWAP)
+				add_area (dev, 0);
+	}
+	ASSERT (area_cnt > 0);
+
+	/* The areas are in place now, so their locks can be set up. */
+	for (i = 0; i < area_cnt; i++)
+		{
+			struct swap_area *a = &areas[i];
+			size_t cnt = block_size (a->dev) / BLOCK_SECTOR_RATIO;
 
-	size_t bm_size = bitmap_buf_size (block_cnt);
-	void *base = malloc (bm_size);
-	ASSERT (base);
-	st = bitmap_create_in_buf (block_cnt, base, bm_size);
+			a->base = slot_cnt;
+			a->map = bitmap_create (cnt);
+			ASSERT (a->map);
+			a->hint = 0;
+			lock_init (&a->io_lock);
+			lock_set_name (&a->io_lock, "swap");
+			slot_cnt += cnt;
+			printf ("swap: using %s, priority %d\n", block_name (a->dev), a->prio);
+		}
+	st_refs = calloc (slot_cnt, 1);
+	ASSERT (st_refs);
+	zswap_init ();
+}
+
+/* Returns the area holding slot B_IDX. */
+static struct swap_area *
+area_of (size_t b_idx)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < area_cnt; i++)
+		if (b_idx - areas[i].base < bitmap_size (areas[i].map))
+			break;
+	return &areas[i];
+}
+
+/* Returns the device holding the swap sector IDX, and stores the
+	 sector's number on it into *DEV_SECTOR. */
+static struct swap_area *
+locate (block_sector_t idx, block_sector_t *dev_sector)
+{
+	struct swap_area *a = area_of (idx / BLOCK_SECTOR_RATIO);
+
+	*dev_sector = idx - a->base * BLOCK_SECTOR_RATIO;
+	return a;
+}
+
+/* Returns true if slot B_IDX is in use.  st_lock must be held, or
+	 the caller must own the slot. */
+static bool
+slot_used (size_t b_idx)
+{
+	struct swap_area *a = area_of (b_idx);
+	return bitmap_test (a->map, b_idx - a->base);
 }
 
 block_sector_t
 swap_get_slot (void)
 {
-	block_sector_t idx;
+	return swap_get_slots (1);
+}
+
+/* Reserves CNT adjacent slots in area A and returns the number of
+	 the first, or BITMAP_ERROR if it has no such run.  Searches next
+	 fit, starting where the previous run ended, so that a mostly
+	 full area is not rescanned from the start on every eviction
+	 and consecutive allocations land next to each other.
+	 st_lock must be held. */
+static size_t
+area_get_slots (struct swap_area *a, size_t cnt)
+{
+	size_t b_idx = bitmap_scan_hint (a->map, a->hint, cnt, false);
+
+	if (b_idx == BITMAP_ERROR)
+		return BITMAP_ERROR;
+	if (b_idx < a->hint)
+		wrap_cnt++;
+	bitmap_set_multiple (a->map, b_idx, cnt, true);
+	a->hint = b_idx + cnt;
+	if (a->hint >= bitmap_size (a->map))
+		a->hint = 0;
+	return a->base + b_idx;
+}
+
+/* Reserves CNT adjacent slots, all on one device, and returns the
+	 first sector of the run, or SWAP_NONE if there is no such run.
+	 Each slot is freed on its own with swap_free_slot(). */
+block_sector_t
+swap_get_slots (size_t cnt)
+{
+	size_t b_idx = BITMAP_ERROR;
+	size_t first, last, i;
+
 	lock_acquire (&st_lock);
-	size_t b_idx = bitmap_scan_and_flip (st, 0, 1, false);
+	for (first = 0; first < area_cnt && b_idx == BITMAP_ERROR; first = last)
+		{
+			/* Areas FIRST up to LAST share a priority.  Start with the
+				 one after the last used, if it is one of them. */
+			size_t n, start;
+
+			for (last = first + 1;
+					 last < area_cnt && areas[last].prio == areas[first].prio; last++)
+				continue;
+			n = last - first;
+			start = next_area >= first && next_area < last ? next_area - first : 0;
+			for (i = 0; i < n && b_idx == BITMAP_ERROR; i++)
+				{
+					size_t a = first + (start + i) % n;
+
+					b_idx = area_get_slots (&areas[a], cnt);
+					if (b_idx != BITMAP_ERROR)
+						next_area = first + (a - first + 1) % n;
+				}
+		}
 	if (b_idx != BITMAP_ERROR) {
-		idx = BLOCK_SECTOR_RATIO * b_idx;
-	} else{
-		idx = BITMAP_ERROR;
+		alloc_cnt += cnt;
+		used_cnt += cnt;
 	}
 	lock_release (&st_lock);
-	return idx;
+	return b_idx != BITMAP_ERROR ? BLOCK_SECTOR_RATIO * b_idx : SWAP_NONE;
+}
+
+/* Adds an owner to slot IDX, for a page that has been copied
+	 lazily and so shares it.  The slot is only freed once every
+	 owner has called swap_free_slot(). */
+void
+swap_ref_slot (block_sector_t idx)
+{
+	size_t b_idx = idx / BLOCK_SECTOR_RATIO;
+
+	ASSERT (idx % BLOCK_SECTOR_RATIO == 0);
+	ASSERT (slot_used (b_idx));
+
+	lock_acquire (&st_lock);
+	ASSERT (st_refs[b_idx] < UINT8_MAX);
+	st_refs[b_idx]++;
+	lock_release (&st_lock);
 }
 
 void
 swap_free_slot (block_sector_t idx)
 {
 	size_t b_idx = idx / BLOCK_SECTOR_RATIO;
+	struct swap_area *a = area_of (b_idx);
+
+	ASSERT (idx % BLOCK_SECTOR_RATIO == 0);
+	ASSERT (slot_used (b_idx));
+
+	lock_acquire (&st_lock);
+	if (st_refs[b_idx] > 0) {
+		st_refs[b_idx]--;
+		lock_release (&st_lock);
+		return;
+	}
+	/* Before the slot can be handed out again. */
+	zswap_invalidate (idx);
+	bitmap_flip (a->map, b_idx - a->base);
+	used_cnt--;
+	lock_release (&st_lock);
+}
+
+/* Returns true if a page just read back from slot IDX may keep the
+	 slot as its copy while it is resident, so that it need not be
+	 written again if it is evicted unchanged.  The slot must have no
+	 other owner, since a page that is written and then evicted
+	 overwrites the slot, and swap must be less than half full, so
+	 that slots kept this way do not crowd out evictions. */
+bool
+swap_slot_keep (block_sector_t idx)
+{
+	size_t b_idx = idx / BLOCK_SECTOR_RATIO;
+	bool keep;
 
 	ASSERT (idx % BLOCK_SECTOR_RATIO == 0);
-	ASSERT (bitmap_test (st, b_idx));
+	ASSERT (slot_used (b_idx));
 
 	lock_acquire (&st_lock);
-	bitmap_flip (st, b_idx);
+	keep = st_refs[b_idx] == 0 && 2 * used_cnt < slot_cnt;
 	lock_release (&st_lock);
+	return keep;
 }
 
+/* Writes the page FROM to the slot starting at sector TO, as a
+	 single multi-sector request, unless it fits compressed in
+	 memory. */
 bool
 swap_store (block_sector_t to, const void *from)
 {
-	lock_acquire (&swap_lock);
-	block_write (swap_dev, to, from);
-	lock_release (&swap_lock);
+	struct swap_area *a;
+	block_sector_t sector;
+
+	if (zswap_store (to, from))
+		return true;
+	a = locate (to, &sector);
+	lock_acquire (&a->io_lock);
+	block_write_multiple (a->dev, sector, from, BLOCK_SECTOR_RATIO);
+	lock_release (&a->io_lock);
+	exception_count_swap (true, 1);
 	return true;
 }
 
+/* Reads the slot starting at sector FROM into the page TO, as a
+	 single multi-sector request.  Returns true if it had to be read
+	 from the device, false if it was still in memory. */
 bool
 swap_load (block_sector_t from, void *to)
 {
-	lock_acquire (&swap_lock);
-	block_read (swap_dev, from, to);
-	lock_release (&swap_lock);
+	struct swap_area *a;
+	block_sector_t sector;
+
+	if (zswap_load (from, to))
+		return false;
+	a = locate (from, &sector);
+	lock_acquire (&a->io_lock);
+	block_read_multiple (a->dev, sector, to, BLOCK_SECTOR_RATIO);
+	lock_release (&a->io_lock);
+	exception_count_swap (false, 1);
 	return true;
 }
 
+/* Writes the CNT pages starting at FROM to the CNT consecutive
+	 slots starting at sector TO, which swap_get_slots() reserved on
+	 one device.  Pages that fit compressed in
+	 memory stay there; each run of the others is written as a
+	 single request. */
+bool
+swap_store_pages (block_sector_t to, const void *from, size_t cnt)
+{
+	const uint8_t *pages = from;
+	size_t i = 0;
+
+	while (i < cnt)
+		{
+			size_t run = 0;
+
+			while (i + run < cnt
+						 && !zswap_store (to + (i + run) * BLOCK_SECTOR_RATIO,
+								 pages + (i + run) * PGSIZE))
+				run++;
+			if (run > 0) {
+				block_sector_t sector;
+				struct swap_area *a = locate (to + i * BLOCK_SECTOR_RATIO, &sector);
+
+				lock_acquire (&a->io_lock);
+				block_write_multiple (a->dev, sector, pages + i * PGSIZE,
+						run * BLOCK_SECTOR_RATIO);
+				lock_release (&a->io_lock);
+				exception_count_swap (true, run);
+			}
+			i += run + 1;
+		}
+	return true;
+}
+/* Prints swap statistics: slot occupancy, and fragmentation as
+	 the number of free runs and the longest one, then the occupancy
+	 of each device if there are several. */
+void
+swap_print_stats (void)
+{
+	size_t used = 0, runs = 0, longest = 0;
+	size_t used_in[SWAP_AREA_MAX];
+	size_t a, i;
+
+	/* No locking: this may run from a panic. */
+	if (st_refs == NULL)
+		return;
+	for (a = 0; a < area_cnt; a++)
+		{
+			struct bitmap *map = areas[a].map;
+			size_t run = 0;
+
+			used_in[a] = 0;
+			for (i = 0; i < bitmap_size (map); i++)
+				if (bitmap_test (map, i)) {
+					used_in[a]++;
+					run = 0;
+				} else {
+					if (run++ == 0)
+						runs++;
+					if (run > longest)
+						longest = run;
+				}
+			used += used_in[a];
+		}
+
+	printf ("Swap: %zu of %zu slots used, %zu free runs (longest %zu), "
+					"%llu allocated, %llu wraps\n", used, slot_cnt,
+					runs, longest, alloc_cnt, wrap_cnt);
+	if (area_cnt > 1)
+		for (a = 0; a < area_cnt; a++)
+			printf ("Swap: %s: %zu of %zu slots used\n", block_name (areas[a].dev),
+							used_in[a], bitmap_size (areas[a].map));
+}
@@ -2,14 +2,26 @@
 #define VM_SWAP_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "devices/block.h"
+#include "threads/vaddr.h"
 
 #define SWAP_NONE ((uint32_t) -1)
 
+/* Sectors per swap slot; a slot holds one page. */
+#define BLOCK_SECTOR_RATIO  (PGSIZE / BLOCK_SECTOR_SIZE)
+
+extern char *swap_devices;
+
 void swap_init (void);
 block_sector_t swap_get_slot (void);
+block_sector_t swap_get_slots (size_t cnt);
+void swap_ref_slot (block_sector_t);
 void swap_free_slot (block_sector_t);
+bool swap_slot_keep (block_sector_t);
 bool swap_store (block_sector_t, const void *);
 bool swap_load (block_sector_t, void *);
+bool swap_store_pages (block_sector_t, const void *, size_t cnt);
+void swap_print_stats (void);
 
 #endif
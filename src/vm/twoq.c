@@ -0,0 +1,74 @@
+#include "vm/replace.h"
+#include <clist.h>
+
+/* Which of the queues below a frame is on. */
+#define TWOQ_A1 0
+#define TWOQ_AM 1
+
+/* New frames, oldest at the hand, and frames used again while in
+	 A1, swept by a clock. */
+static struct clist a1, am;
+
+static void
+twoq_init (void)
+{
+	clist_init (&a1);
+	clist_init (&am);
+}
+
+static void
+twoq_on_alloc (struct fte *fte)
+{
+	fte->queue = TWOQ_A1;
+	clist_push_back (&a1, &fte->celem);
+}
+
+/* While A1 holds more than a quarter of the frames, or Am is
+	 empty, takes frames from the old end of A1: those used since
+	 they came in move to Am, and the first that was not is the
+	 victim.  Otherwise, or if nothing in A1 qualifies, the victim
+	 comes from Am by second chance, and as a last resort from A1 the
+	 same way. */
+static struct fte *
+twoq_pick_victim (void)
+{
+	struct fte *victim;
+	size_t n;
+
+	for (n = clist_size (&a1);
+			 n > 0 && (4 * clist_size (&a1) > clist_size (&a1) + clist_size (&am)
+								 || clist_empty (&am));
+			 n--)
+		{
+			struct fte *fte = clist_entry (clist_hand (&a1), struct fte, celem);
+			if (fte->pin_cnt > 0) {
+				clist_go (&a1);
+				continue;
+			}
+			clist_remove (&a1, &fte->celem);
+			if (!frame_test_accessed (fte))
+				return fte;
+			fte->queue = TWOQ_AM;
+			clist_push_back (&am, &fte->celem);
+		}
+
+	victim = clock_sweep (&am);
+	if (victim == NULL)
+		victim = clock_sweep (&a1);
+	return victim;
+}
+
+static void
+twoq_on_free (struct fte *fte)
+{
+	clist_remove (fte->queue == TWOQ_A1 ? &a1 : &am, &fte->celem);
+}
+
+/* A simplified 2Q: a frame has to be used again after it comes in
+	 to earn a place in the main queue, so that a one-time scan of
+	 many pages only churns A1.  There is no A1out queue of recently
+	 evicted pages, since evicted pages are not tracked by frame. */
+const struct replacement_policy twoq_policy =
+	{
+		"2q", twoq_init, twoq_on_alloc, NULL, twoq_pick_victim, twoq_on_free
+	};
@@ -1,9 +1,107 @@
-#include "vm/wsclock.h"
+#include "vm/replace.h"
+#include <clist.h>
+#include "devices/timer.h"
 
-struct fte *
-wsclock_get_victim (struct clist *ft UNUSED)
+/* Default working-set window, overridden by -wstau. */
+int64_t wsclock_tau = TIMER_FREQ;
+
+/* Maximum writebacks scheduled by a single scan, so that one
+   fault does not flood the writer. */
+#define WSCLOCK_WB_MAX 8
+
+/* Evictable frames, in the order the hand visits them. */
+static struct clist ws_list;
+
+/* WSClock.  Sweeps the hand around ws_list.  A frame used since
+   the last sweep has its age reset.  A clean frame older than
+   wsclock_tau is outside the working set and is the victim.  An
+   old dirty frame is queued for writeback, so that a later sweep
+   finds it clean.  Pinned frames are skipped.  If two sweeps find
+   nothing, falls back to the oldest clean frame, or else the
+   oldest frame.  Returns a null pointer if every frame is
+   pinned. */
+static struct fte *
+wsclock_pick_victim (void)
+{
+	struct clist *ft = &ws_list;
+	int64_t now = timer_ticks ();
+	struct fte *oldest = NULL, *oldest_clean = NULL;
+	struct list_elem *e;
+	size_t wb_cnt = 0;
+	size_t n;
+
+	if (clist_empty (ft))
+		return NULL;
+
+	for (n = 2 * clist_size (ft), e = clist_hand (ft); n > 0;
+			 n--, e = clist_go (ft))
+		{
+			struct fte *fte = clist_entry (e, struct fte, celem);
+			bool dirty;
+
+			if (fte->pin_cnt > 0)
+				continue;
+
+			if (frame_test_accessed (fte)) {
+				fte->last_use = now;
+				continue;
+			}
+
+			dirty = frame_is_dirty (fte);
+			if (now - fte->last_use > wsclock_tau) {
+				if (!dirty) {   /* This is now the victim. */
+					clist_remove (ft, &fte->celem);
+					return fte;
+				}
+				if (wb_cnt < WSCLOCK_WB_MAX && fte->wb_state == WB_NONE) {
+					frame_schedule_writeback (fte);
+					wb_cnt++;
+				}
+			}
+			if (oldest == NULL || fte->last_use < oldest->last_use)
+				oldest = fte;
+			if (!dirty && (oldest_clean == NULL
+										 || fte->last_use < oldest_clean->last_use))
+				oldest_clean = fte;
+		}
+
+	if (oldest_clean != NULL)
+		oldest = oldest_clean;
+	if (oldest == NULL)   /* Everything accessed or pinned. */
+		for (n = clist_size (ft), e = clist_hand (ft); n > 0;
+				 n--, e = clist_go (ft))
+			{
+				struct fte *fte = clist_entry (e, struct fte, celem);
+				if (fte->pin_cnt == 0) {
+					oldest = fte;
+					break;
+				}
+			}
+	if (oldest != NULL)
+		clist_remove (ft, &oldest->celem);
+	return oldest;
+}
+
+static void
+wsclock_init (void)
+{
+	clist_init (&ws_list);
+}
+
+static void
+wsclock_on_alloc (struct fte *fte)
+{
+	clist_push_back (&ws_list, &fte->celem);
+}
+
+static void
+wsclock_on_free (struct fte *fte)
 {
-	//TODO
-	return NULL;
+	clist_remove (&ws_list, &fte->celem);
 }
 
+const struct replacement_policy wsclock_policy =
+	{
+		"wsclock", wsclock_init, wsclock_on_alloc, NULL, wsclock_pick_victim,
+		wsclock_on_free
+	};
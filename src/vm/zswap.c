@@ -0,0 +1,301 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Default budget, overridden by -zswap. */
+size_t zswap_max_pages = 64;
+
+/* Compressed pages larger than this are not worth keeping. */
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+/* A cached page. */
+struct zswap_entry
+  {
+		struct hash_elem elem;      /* Element in zswap_entries. */
+		block_sector_t slot;        /* [Key] Swap slot it stands for. */
+		size_t len;                 /* Bytes of DATA; 0 for a zero page. */
+		uint8_t data[];             /* Compressed page. */
+  };
+
+static struct hash zswap_entries;
+static struct lock zswap_lock;
+static size_t zswap_bytes;          /* Bytes of compressed data held. */
+static uint8_t *zswap_buf;          /* Compression output, ZSWAP_MAX_LEN. */
+
+/* Statistics. */
+static unsigned long long store_cnt, zero_cnt, reject_cnt, full_cnt;
+static unsigned long long load_cnt;
+
+static size_t lz_compress (const uint8_t *, uint8_t *, size_t);
+static void lz_decompress (const uint8_t *, size_t, uint8_t *);
+
+static inline block_sector_t
+slot_of (const struct zswap_entry *z)
+{
+	return z->slot;
+}
+
+static inline bool
+slot_eq (block_sector_t a, block_sector_t b)
+{
+	return a == b;
+}
+
+HASH_SPECIALIZE (entry_table, struct zswap_entry, elem, block_sector_t, slot_of,
+		hash_word, slot_eq)
+
+void
+zswap_init (void)
+{
+	entry_table_init (&zswap_entries);
+	lock_init (&zswap_lock);
+	lock_set_name (&zswap_lock, "zswap");
+	zswap_buf = malloc (ZSWAP_MAX_LEN);
+	if (zswap_buf == NULL)
+		zswap_max_pages = 0;
+}
+
+/* Returns the entry of SLOT, or a null pointer.  zswap_lock must
+	 be held. */
+static struct zswap_entry *
+entry_find (block_sector_t slot)
+{
+	return entry_table_find (&zswap_entries, slot);
+}
+
+/* Drops SLOT's entry, if any.  zswap_lock must be held. */
+static void
+entry_drop (block_sector_t slot)
+{
+	struct zswap_entry *z = entry_find (slot);
+
+	if (z != NULL) {
+		entry_table_remove (&zswap_entries, z);
+		zswap_bytes -= z->len;
+		free (z);
+	}
+}
+
+/* Returns true if PAGE is all zeros. */
+static bool
+page_is_zero (const void *page)
+{
+	const uint32_t *w = page;
+	size_t i;
+
+	for (i = 0; i < PGSIZE / sizeof *w; i++)
+		if (w[i] != 0)
+			return false;
+	return true;
+}
+
+/* Keeps a compressed copy of PAGE as the contents of SLOT,
+	 replacing any earlier one.  Returns false, leaving the page to
+	 be written to the device, if it doesn't compress well or the
+	 cache is full. */
+bool
+zswap_store (block_sector_t slot, const void *page)
+{
+	struct zswap_entry *z;
+	size_t len = 0;
+
+	if (zswap_max_pages == 0)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	entry_drop (slot);
+	if (!page_is_zero (page)) {
+		len = lz_compress (page, zswap_buf, ZSWAP_MAX_LEN);
+		if (len == 0) {
+			reject_cnt++;
+			lock_release (&zswap_lock);
+			return false;
+		}
+	}
+	if (zswap_bytes + len > zswap_max_pages * PGSIZE
+			|| (z = malloc (sizeof *z + len)) == NULL) {
+		full_cnt++;
+		lock_release (&zswap_lock);
+		return false;
+	}
+	z->slot = slot;
+	z->len = len;
+	memcpy (z->data, zswap_buf, len);
+	entry_table_insert (&zswap_entries, z);
+	zswap_bytes += len;
+	if (len == 0)
+		zero_cnt++;
+	else
+		store_cnt++;
+	lock_release (&zswap_lock);
+	return true;
+}
+
+/* If SLOT's contents are cached, decompresses them into PAGE and
+	 returns true.  The entry stays until the slot is freed, since a
+	 swapped-in page may be swapped out again unchanged. */
+bool
+zswap_load (block_sector_t slot, void *page)
+{
+	struct zswap_entry *z;
+
+	if (zswap_max_pages == 0)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	z = entry_find (slot);
+	if (z != NULL) {
+		if (z->len == 0)
+			zero_page (page);
+		else
+			lz_decompress (z->data, z->len, page);
+		load_cnt++;
+	}
+	lock_release (&zswap_lock);
+	return z != NULL;
+}
+
+/* Forgets SLOT, which has been freed. */
+void
+zswap_invalidate (block_sector_t slot)
+{
+	if (zswap_max_pages == 0)
+		return;
+
+	lock_acquire (&zswap_lock);
+	entry_drop (slot);
+	lock_release (&zswap_lock);
+}
+
+/* Prints compressed cache statistics. */
+void
+zswap_print_stats (void)
+{
+	printf ("Zswap: %zu entries in %zu bytes, %llu stored, %llu zero, "
+			"%llu incompressible, %llu full, %llu loads\n",
+			hash_size (&zswap_entries), zswap_bytes, store_cnt, zero_cnt,
+			reject_cnt, full_cnt, load_cnt);
+}
+
+/* Page codec, a small LZ77 over PGSIZE bytes.  The output is a
+	 sequence of tokens: a byte 0..127 is followed by that many plus
+	 one literal bytes; a byte 128 + N is a back reference of N +
+	 LZ_MIN_MATCH bytes, at the distance given by the following two
+	 bytes, little endian. */
+
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (127 + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 128
+#define LZ_HASH_BITS 10
+
+/* Hashes the three bytes at P. */
+static inline unsigned
+lz_hash (const uint8_t *p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Last position of each hash, kept off the small kernel stacks.
+	 Only used under zswap_lock. */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+/* Compresses the page IN into OUT, which has room for MAX bytes.
+	 Returns the compressed length, or 0 if it would exceed MAX. */
+static size_t
+lz_compress (const uint8_t *in, uint8_t *out, size_t max)
+{
+	uint16_t *table = lz_table;
+	size_t ip = 0, op = 0, lit = 0;
+
+	memset (lz_table, 0xff, sizeof lz_table);
+	while (ip < PGSIZE)
+		{
+			size_t len = 0, dist = 0;
+
+			if (ip + LZ_MIN_MATCH <= PGSIZE) {
+				unsigned h = lz_hash (in + ip);
+				size_t cand = table[h];
+				table[h] = ip;
+				if (cand != 0xffff) {
+					dist = ip - cand;
+					while (ip + len < PGSIZE && len < LZ_MAX_MATCH
+								 && in[cand + len] == in[ip + len])
+						len++;
+				}
+			}
+
+			if (len < LZ_MIN_MATCH) {
+				/* Close a literal run that is full. */
+				if (ip - lit == LZ_MAX_LITERALS) {
+					if (op + 1 + LZ_MAX_LITERALS > max)
+						return 0;
+					out[op++] = LZ_MAX_LITERALS - 1;
+					memcpy (out + op, in + lit, LZ_MAX_LITERALS);
+					op += LZ_MAX_LITERALS;
+					lit = ip;
+				}
+				ip++;
+				continue;
+			}
+
+			if (ip > lit) {
+				size_t n = ip - lit;
+				if (op + 1 + n > max)
+					return 0;
+				out[op++] = n - 1;
+				memcpy (out + op, in + lit, n);
+				op += n;
+			}
+			if (op + 3 > max)
+				return 0;
+			out[op++] = 128 + (len - LZ_MIN_MATCH);
+			out[op++] = dist & 0xff;
+			out[op++] = dist >> 8;
+			ip += len;
+			lit = ip;
+		}
+	if (ip > lit) {
+		size_t n = ip - lit;
+		if (op + 1 + n > max)
+			return 0;
+		out[op++] = n - 1;
+		memcpy (out + op, in + lit, n);
+		op += n;
+	}
+	return op;
+}
+
+/* Decompresses the LEN bytes at IN, made by lz_compress(), into
+	 the page OUT. */
+static void
+lz_decompress (const uint8_t *in, size_t len, uint8_t *out)
+{
+	size_t ip = 0, op = 0;
+
+	while (ip < len)
+		{
+			uint8_t token = in[ip++];
+			if (token < 128) {
+				size_t n = token + 1;
+				memcpy (out + op, in + ip, n);
+				ip += n;
+				op += n;
+			} else {
+				size_t n = token - 128 + LZ_MIN_MATCH;
+				size_t dist = in[ip] | (in[ip + 1] << 8);
+				ip += 2;
+				/* Byte by byte: the copy may overlap itself. */
+				while (n-- > 0) {
+					out[op] = out[op - dist];
+					op++;
+				}
+			}
+		}
+	ASSERT (op == PGSIZE);
+}
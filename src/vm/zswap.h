@@ -0,0 +1,20 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Compressed in-memory cache in front of the swap device.  Pages
+   are kept by swap slot, so a slot whose page is cached here is
+   simply never written to disk.  At most zswap_max_pages pages of
+   kernel memory hold compressed data; 0 disables the cache. */
+extern size_t zswap_max_pages;
+
+void zswap_init (void);
+bool zswap_store (block_sector_t slot, const void *page);
+bool zswap_load (block_sector_t slot, void *page);
+void zswap_invalidate (block_sector_t slot);
+void zswap_print_stats (void);
+
+#endif